@@ -0,0 +1,53 @@
+# Compiles inja templates into a C++ header with inja_compile as part of the build.
+#
+#   inja_compile_templates(<output>
+#     TEMPLATES <template>...
+#     [NAMESPACE <name>]
+#     [INPUT_DIR <dir>]
+#     [CALLBACKS <name>:<num_args>...]
+#     [EXTERNALS <name>...]
+#     [DEPENDS <file>...]
+#     [TRIM_BLOCKS] [LSTRIP_BLOCKS])
+#
+# Templates are given relative to INPUT_DIR (default: the current source
+# directory). Included templates are compiled as well; list them in DEPENDS so
+# that changes to them trigger a rebuild. EXTERNALS are templates that are
+# included by name but only added to the environment at render time. Add the
+# output to the sources of a target to generate it.
+function(inja_compile_templates output)
+  cmake_parse_arguments(INJA "TRIM_BLOCKS;LSTRIP_BLOCKS" "NAMESPACE;INPUT_DIR" "TEMPLATES;CALLBACKS;EXTERNALS;DEPENDS" ${ARGN})
+
+  if(NOT INJA_INPUT_DIR)
+    set(INJA_INPUT_DIR ${CMAKE_CURRENT_SOURCE_DIR})
+  endif()
+
+  set(arguments --output ${output} --input-dir ${INJA_INPUT_DIR})
+  if(INJA_NAMESPACE)
+    list(APPEND arguments --namespace ${INJA_NAMESPACE})
+  endif()
+  foreach(callback ${INJA_CALLBACKS})
+    list(APPEND arguments --callback ${callback})
+  endforeach()
+  foreach(external ${INJA_EXTERNALS})
+    list(APPEND arguments --external ${external})
+  endforeach()
+  if(INJA_TRIM_BLOCKS)
+    list(APPEND arguments --trim-blocks)
+  endif()
+  if(INJA_LSTRIP_BLOCKS)
+    list(APPEND arguments --lstrip-blocks)
+  endif()
+
+  set(dependencies)
+  foreach(template ${INJA_TEMPLATES})
+    list(APPEND dependencies ${INJA_INPUT_DIR}/${template})
+  endforeach()
+
+  add_custom_command(
+    OUTPUT ${output}
+    COMMAND inja_compile ${arguments} ${INJA_TEMPLATES}
+    DEPENDS inja_compile ${dependencies} ${INJA_DEPENDS}
+    COMMENT "Compiling inja templates into ${output}"
+    VERBATIM
+  )
+endfunction()
@@ -0,0 +1,616 @@
+#ifndef INCLUDE_INJA_ANALYSIS_HPP_
+#define INCLUDE_INJA_ANALYSIS_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "function_storage.hpp"
+#include "node.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/// A path into the input data, split into its reference tokens
+using DataPath = std::vector<std::string>;
+
+/*!
+ * \brief Splits a JSON pointer string into its (unescaped) reference tokens.
+ */
+inline DataPath split_json_pointer(std::string_view pointer) {
+  DataPath result;
+  if (pointer.empty()) {
+    return result;
+  }
+  size_t start = 1;
+  for (;;) {
+    const size_t end = pointer.find('/', start);
+    std::string token {string_view::slice(pointer, start, end)};
+    replace_substring(token, "~1", "/");
+    replace_substring(token, "~0", "~");
+    result.emplace_back(std::move(token));
+    if (end == std::string_view::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+/*!
+ * \brief Joins reference tokens into an escaped JSON pointer string.
+ */
+inline std::string join_json_pointer(const DataPath& path) {
+  std::string result;
+  for (const auto& segment : path) {
+    std::string token = segment;
+    replace_substring(token, "~", "~0");
+    replace_substring(token, "/", "~1");
+    result.push_back('/');
+    result.append(token);
+  }
+  return result;
+}
+
+/*!
+ * \brief Result of the static dependency analysis of a Template.
+ *
+ * Paths are JSON pointers into the input data. Elements of iterated
+ * containers are written with the wildcard token `*`, so reading `a.name`
+ * inside `{% for a in actors %}` is reported as the pointer to `name` below
+ * `actors` with `*` as the element token in between.
+ */
+struct TemplateAnalysis {
+  /// Wildcard reference token standing for every element of a container
+  static constexpr const char* any_element = "*";
+
+  /// Distinct paths read from the input data
+  std::set<std::string> input_paths;
+  /// Input containers that are iterated by for loops (their shape is needed, not necessarily their values)
+  std::set<std::string> iterated_paths;
+  /// Variables assigned by set statements
+  std::set<std::string> set_locals;
+  /// Variables bound by for loops
+  std::set<std::string> loop_locals;
+  /// Called callbacks with all argument counts they are called with
+  std::map<std::string, std::set<int>> callbacks;
+  /// Include and extends graph, from a template name to the templates it includes or extends directly
+  std::map<std::string, std::set<std::string>> includes;
+  /// Included or extended templates that could not be found in the template storage
+  std::set<std::string> missing_templates;
+  /// True if the template looks up input data by a name only known at render time (e.g. `exists(name)`)
+  bool has_dynamic_lookups {false};
+
+  /// Returns all templates reachable from the analyzed template through includes and extends
+  std::set<std::string> included_templates() const {
+    std::set<std::string> result;
+    for (const auto& [name, targets] : includes) {
+      result.insert(targets.begin(), targets.end());
+    }
+    return result;
+  }
+};
+
+/*!
+ * \brief A visitor collecting the data, callback and include dependencies of a Template.
+ *
+ * Included and extended templates are analyzed in the context of their call
+ * site, so that loop variables and set variables of the including template are
+ * resolved to the input paths they refer to. The analysis is conservative:
+ * a variable assigned in a branch or loop body that might not run is still
+ * reported as an input read afterwards.
+ */
+class AnalysisVisitor : public NodeVisitor {
+protected:
+  using Op = FunctionStorage::Operation;
+
+  struct ValueRef {
+    enum class Kind {
+      Input,    // A path into the input data
+      Local,    // A set or loop variable of the template
+      Computed, // A temporary result of a function
+    };
+
+    Kind kind;
+    DataPath path;
+  };
+
+  struct LoopBinding {
+    std::string name;
+    ValueRef value;
+  };
+
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
+
+  TemplateAnalysis result;
+  ValueRef last_value {ValueRef::Kind::Computed, {}};
+
+  std::vector<std::string> template_stack;
+  std::vector<const Template*> template_chain;
+  std::vector<LoopBinding> loop_bindings;
+  std::vector<std::vector<DataPath>> set_scopes;
+  size_t loop_depth {0};
+
+  static bool is_prefix(const DataPath& prefix, const DataPath& path) {
+    return prefix.size() <= path.size() && std::equal(prefix.begin(), prefix.end(), path.begin());
+  }
+
+  bool is_set_local(const DataPath& path) const {
+    for (const auto& scope : set_scopes) {
+      for (const auto& key : scope) {
+        if (is_prefix(key, path)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  ValueRef eval(const ExpressionNode& node) {
+    last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    node.accept(*this);
+    return last_value;
+  }
+
+  void use(const ValueRef& value) {
+    if (value.kind == ValueRef::Kind::Input) {
+      result.input_paths.insert(join_json_pointer(value.path));
+    }
+  }
+
+  void use_arguments(const FunctionNode& node, size_t start = 0) {
+    for (size_t i = start; i < node.arguments.size(); ++i) {
+      use(eval(*node.arguments[i]));
+    }
+  }
+
+  static bool literal_token(const ExpressionNode& node, std::string& token) {
+    const auto* literal = dynamic_cast<const LiteralNode*>(&node);
+    if (literal == nullptr) {
+      return false;
+    }
+    if (literal->value.is_string()) {
+      token = literal->value.get<std::string>();
+      return true;
+    } else if (literal->value.is_number_integer()) {
+      token = std::to_string(literal->value.get<json::number_integer_t>());
+      return true;
+    }
+    return false;
+  }
+
+  static ValueRef child_of(const ValueRef& container, const DataPath& tokens) {
+    if (container.kind != ValueRef::Kind::Input) {
+      return ValueRef {container.kind == ValueRef::Kind::Local ? ValueRef::Kind::Local : ValueRef::Kind::Computed, {}};
+    }
+    ValueRef child = container;
+    child.path.insert(child.path.end(), tokens.begin(), tokens.end());
+    return child;
+  }
+
+  /// Called before the body of a loop is analyzed, with the iterated container
+  virtual void enter_loop(const ForStatementNode&, const ValueRef&) {}
+
+  /// Called after the body of a loop was analyzed
+  virtual void exit_loop(const ForStatementNode&) {}
+
+  void bind_loop(const ForStatementNode& node, const std::string& value_name, const std::string& key_name) {
+    ValueRef container {ValueRef::Kind::Computed, {}};
+    ValueRef element {ValueRef::Kind::Local, {}};
+    if (node.condition.root) {
+      container = eval(*node.condition.root);
+      if (container.kind == ValueRef::Kind::Input) {
+        result.iterated_paths.insert(join_json_pointer(container.path));
+        element = child_of(container, {TemplateAnalysis::any_element});
+      }
+    }
+    enter_loop(node, container);
+
+    if (!key_name.empty()) {
+      result.loop_locals.insert(key_name);
+      loop_bindings.push_back(LoopBinding {key_name, ValueRef {ValueRef::Kind::Local, {}}});
+    }
+    result.loop_locals.insert(value_name);
+    loop_bindings.push_back(LoopBinding {value_name, element});
+  }
+
+  void analyze_template(const std::string& name, const Template& tmpl) {
+    template_stack.push_back(name);
+    template_chain.push_back(&tmpl);
+    tmpl.root.accept(*this);
+    template_chain.pop_back();
+    template_stack.pop_back();
+  }
+
+  const Template* follow(const std::string& file) {
+    result.includes[template_stack.back()].insert(file);
+    if (std::find(template_stack.begin(), template_stack.end(), file) != template_stack.end()) {
+      return nullptr; // Recursive include, already being analyzed
+    }
+
+    const auto it = template_storage.find(file);
+    if (it == template_storage.end()) {
+      result.missing_templates.insert(file);
+      return nullptr;
+    }
+    return &it->second;
+  }
+
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+
+  void visit(const LiteralNode&) override {
+    last_value = ValueRef {ValueRef::Kind::Computed, {}};
+  }
+
+  void visit(const DataNode& node) override {
+    const DataPath path = split_json_pointer(node.ptr.to_string());
+    if (path.empty()) {
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+      return;
+    }
+
+    // Innermost loop binding first
+    for (auto it = loop_bindings.rbegin(); it != loop_bindings.rend(); ++it) {
+      if (it->name == path.front()) {
+        last_value = child_of(it->value, DataPath(path.begin() + 1, path.end()));
+        return;
+      }
+    }
+
+    if ((loop_depth > 0 && path.front() == "loop") || is_set_local(path)) {
+      last_value = ValueRef {ValueRef::Kind::Local, {}};
+      return;
+    }
+
+    // Names missing in the data fall back to a callback without arguments
+    if (function_storage.find_function(node.name, 0).operation == Op::Callback) {
+      result.callbacks[node.name].insert(0);
+    }
+    last_value = ValueRef {ValueRef::Kind::Input, path};
+  }
+
+  void visit(const FunctionNode& node) override {
+    switch (node.operation) {
+    case Op::AtId: {
+      if (node.arguments.size() != 2) {
+        use_arguments(node);
+        break;
+      }
+      const ValueRef container = eval(*node.arguments[0]);
+      const auto* member = dynamic_cast<const DataNode*>(node.arguments[1].get());
+      if (member == nullptr) {
+        use(container);
+        use(eval(*node.arguments[1]));
+        last_value = ValueRef {ValueRef::Kind::Computed, {}};
+        break;
+      }
+      last_value = child_of(container, split_json_pointer(member->ptr.to_string()));
+    } break;
+    case Op::At: {
+      if (node.arguments.size() != 2) {
+        use_arguments(node);
+        break;
+      }
+      const ValueRef container = eval(*node.arguments[0]);
+      std::string token;
+      if (!literal_token(*node.arguments[1], token)) {
+        // Dynamic key: any element of the container might be read
+        use(eval(*node.arguments[1]));
+        token = TemplateAnalysis::any_element;
+      }
+      last_value = child_of(container, {token});
+    } break;
+    case Op::Exists: {
+      std::string name;
+      if (!node.arguments.empty() && literal_token(*node.arguments[0], name)) {
+        // exists() only looks into the input data, never into local variables
+        result.input_paths.insert(join_json_pointer(split_json_pointer(DataNode::convert_dot_to_ptr(name))));
+      } else {
+        use_arguments(node);
+        result.has_dynamic_lookups = true;
+      }
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    } break;
+    case Op::ExistsInObject: {
+      std::string key;
+      if (node.arguments.size() == 2 && literal_token(*node.arguments[1], key)) {
+        const ValueRef container = eval(*node.arguments[0]);
+        if (container.kind == ValueRef::Kind::Input) {
+          use(child_of(container, {key}));
+        }
+      } else {
+        use_arguments(node);
+      }
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    } break;
+    case Op::Callback: {
+      result.callbacks[node.name].insert(static_cast<int>(node.arguments.size()));
+      use_arguments(node);
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    } break;
+    default: {
+      use_arguments(node);
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    }
+    }
+  }
+
+  void visit(const ExpressionListNode& node) override {
+    if (node.root) {
+      use(eval(*node.root));
+    }
+  }
+
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    const size_t bindings = loop_bindings.size();
+    bind_loop(node, node.value, "");
+
+    loop_depth += 1;
+    set_scopes.emplace_back();
+    node.body.accept(*this);
+    set_scopes.pop_back();
+    loop_depth -= 1;
+    exit_loop(node);
+
+    loop_bindings.resize(bindings);
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    const size_t bindings = loop_bindings.size();
+    bind_loop(node, node.value, node.key);
+
+    loop_depth += 1;
+    set_scopes.emplace_back();
+    node.body.accept(*this);
+    set_scopes.pop_back();
+    loop_depth -= 1;
+    exit_loop(node);
+
+    loop_bindings.resize(bindings);
+  }
+
+  void visit(const IfStatementNode& node) override {
+    node.condition.accept(*this);
+
+    set_scopes.emplace_back();
+    node.true_statement.accept(*this);
+    set_scopes.pop_back();
+
+    set_scopes.emplace_back();
+    node.false_statement.accept(*this);
+    set_scopes.pop_back();
+  }
+
+  void visit(const IncludeStatementNode& node) override {
+    const Template* included = follow(node.file);
+    if (included != nullptr) {
+      // Set statements of an included template do not leak into the including one
+      set_scopes.emplace_back();
+      analyze_template(node.file, *included);
+      set_scopes.pop_back();
+    }
+  }
+
+  void visit(const ExtendsStatementNode& node) override {
+    const Template* parent = follow(node.file);
+    if (parent != nullptr) {
+      analyze_template(node.file, *parent);
+    }
+  }
+
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+
+    // Blocks can be overridden by any template of the extends chain (and reached through super())
+    for (const Template* tmpl : template_chain) {
+      const auto it = tmpl->block_storage.find(node.name);
+      if (it != tmpl->block_storage.end() && it->second.get() != &node) {
+        it->second->block.accept(*this);
+      }
+    }
+  }
+
+  void visit(const SetStatementNode& node) override {
+    node.expression.accept(*this);
+
+    std::string ptr = node.key;
+    replace_substring(ptr, ".", "/");
+    result.set_locals.insert(node.key);
+    set_scopes.back().emplace_back(split_json_pointer("/" + ptr));
+  }
+
+  void visit(const RawStatementNode&) override {}
+
+public:
+  explicit AnalysisVisitor(const TemplateStorage& template_storage, const FunctionStorage& function_storage)
+      : template_storage(template_storage), function_storage(function_storage) {}
+
+  /// Analyzes the template; name is used as the root of the include graph
+  TemplateAnalysis analyze(const Template& tmpl, const std::string& name = "") {
+    result = TemplateAnalysis();
+    set_scopes.assign(1, {});
+    loop_bindings.clear();
+    loop_depth = 0;
+
+    analyze_template(name, tmpl);
+    return std::move(result);
+  }
+};
+
+/*!
+ * \brief What rendering a node could change besides its output.
+ */
+struct RenderEffects {
+  bool sets_variables {false};             // Set statements, whose variables stay visible to the rest of the render
+  std::set<std::string> loop_variables;    // Variables bound by loops, which keep their last value after the loop
+  std::set<std::string> free_variables;    // Top-level names read outside of the loops binding them
+  bool has_side_effects {false};           // Callbacks not marked deterministic, super() or extends, which depend on the order of rendering
+
+  /// Returns whether the node changes no variables of the render
+  bool is_read_only() const {
+    return !sets_variables && loop_variables.empty();
+  }
+};
+
+/*!
+ * \brief A visitor finding the effects of rendering a node, e.g. to render independent nodes concurrently.
+ *
+ * Included templates are followed, but their set and loop variables are not
+ * reported as they are local to the include. Block statements are analyzed with all
+ * blocks of the same name in the given extends chain, which might override
+ * them. The analysis is conservative: a callback that is only called if a
+ * variable is missing in the data is still reported.
+ */
+class EffectVisitor : public NodeVisitor {
+  using Op = FunctionStorage::Operation;
+
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
+  const std::vector<const Template*>& template_chain;
+
+  RenderEffects result;
+  std::vector<const Template*> include_stack;
+  std::vector<std::string> bound_variables; // Variables of the loops around the visited node
+
+  void check_callback(std::string_view name, int number_args) {
+    const auto function_data = function_storage.find_function(name, number_args);
+    if (function_data.operation == Op::Callback && !function_data.deterministic) {
+      result.has_side_effects = true;
+    }
+  }
+
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+  void visit(const LiteralNode&) override {}
+
+  void visit(const DataNode& node) override {
+    if (std::find(bound_variables.begin(), bound_variables.end(), node.path.front()) == bound_variables.end()) {
+      result.free_variables.insert(node.path.front());
+    }
+    // Names missing in the data fall back to a callback without arguments
+    check_callback(node.name, 0);
+  }
+
+  void visit_loop(const ForStatementNode& node, const std::vector<std::string>& variables) {
+    node.condition.accept(*this);
+    if (include_stack.empty()) {
+      result.loop_variables.insert(variables.begin(), variables.end());
+    }
+    bound_variables.insert(bound_variables.end(), variables.begin(), variables.end());
+    bound_variables.push_back("loop");
+    node.body.accept(*this);
+    bound_variables.resize(bound_variables.size() - variables.size() - 1);
+  }
+
+  void visit(const FunctionNode& node) override {
+    if (node.operation == Op::Super || node.operation == Op::None) {
+      result.has_side_effects = true;
+    } else if (node.operation == Op::Callback) {
+      check_callback(node.name, static_cast<int>(node.arguments.size()));
+    }
+    for (const auto& argument : node.arguments) {
+      argument->accept(*this);
+    }
+  }
+
+  void visit(const ExpressionListNode& node) override {
+    if (node.root) {
+      node.root->accept(*this);
+    }
+  }
+
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    visit_loop(node, {node.value});
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    visit_loop(node, {node.key, node.value});
+  }
+
+  void visit(const IfStatementNode& node) override {
+    node.condition.accept(*this);
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
+
+  void visit(const IncludeStatementNode& node) override {
+    const Template* included = node.linked;
+    if (included == nullptr) {
+      const auto it = template_storage.find(node.file);
+      included = (it != template_storage.end()) ? &it->second : nullptr;
+    }
+    if (included == nullptr || std::find(include_stack.begin(), include_stack.end(), included) != include_stack.end()) {
+      return;
+    }
+
+    // Variables of an included template do not leak into the including one
+    const bool sets_variables = result.sets_variables;
+    include_stack.push_back(included);
+    included->root.accept(*this);
+    include_stack.pop_back();
+    result.sets_variables = sets_variables;
+  }
+
+  void visit(const ExtendsStatementNode&) override {
+    result.has_side_effects = true;
+  }
+
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+    for (const Template* tmpl : template_chain) {
+      const auto it = tmpl->block_storage.find(node.name);
+      if (it != tmpl->block_storage.end() && it->second.get() != &node) {
+        it->second->block.accept(*this);
+      }
+    }
+  }
+
+  void visit(const SetStatementNode& node) override {
+    result.sets_variables = true;
+    node.expression.accept(*this);
+  }
+
+  void visit(const RawStatementNode&) override {}
+
+public:
+  explicit EffectVisitor(const TemplateStorage& template_storage, const FunctionStorage& function_storage,
+                         const std::vector<const Template*>& template_chain)
+      : template_storage(template_storage), function_storage(function_storage), template_chain(template_chain) {}
+
+  RenderEffects analyze(const AstNode& node) {
+    result = RenderEffects();
+    include_stack.clear();
+    bound_variables.clear();
+    node.accept(*this);
+    return result;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_ANALYSIS_HPP_
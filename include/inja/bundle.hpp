@@ -0,0 +1,315 @@
+#ifndef INCLUDE_INJA_BUNDLE_HPP_
+#define INCLUDE_INJA_BUNDLE_HPP_
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.hpp"
+#include "data_file.hpp"
+#include "exceptions.hpp"
+#include "function_storage.hpp"
+#include "json.hpp"
+#include "node.hpp"
+#include "template.hpp"
+#include "throw.hpp"
+#include "utils.hpp"
+
+namespace inja {
+
+/// FNV-1a hash, used to detect changed template sources
+inline uint64_t fnv1a_hash(std::string_view text, uint64_t hash = 14695981039346656037ull) {
+  for (const char ch : text) {
+    hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/// Hash of all settings that change the result of parsing a template
+inline uint64_t parse_config_hash(const LexerConfig& lexer_config, const ParserConfig& parser_config) {
+  uint64_t hash = fnv1a_hash("inja");
+  for (const auto* delimiter :
+       {&lexer_config.statement_open, &lexer_config.statement_open_no_lstrip, &lexer_config.statement_open_force_lstrip, &lexer_config.statement_close,
+        &lexer_config.statement_close_force_rstrip, &lexer_config.line_statement, &lexer_config.expression_open, &lexer_config.expression_open_force_lstrip,
+        &lexer_config.expression_close, &lexer_config.expression_close_force_rstrip, &lexer_config.comment_open, &lexer_config.comment_open_force_lstrip,
+        &lexer_config.comment_close, &lexer_config.comment_close_force_rstrip}) {
+    hash = fnv1a_hash(*delimiter + '\0', hash);
+  }
+  const char flags[] = {lexer_config.trim_blocks ? '1' : '0', lexer_config.lstrip_blocks ? '1' : '0',
+                        parser_config.search_included_templates_in_files ? '1' : '0', parser_config.graceful_errors ? '1' : '0'};
+  return fnv1a_hash(std::string_view(flags, sizeof(flags)), hash);
+}
+
+/*!
+ * \brief A parsed template in a bundle, with the source file it was parsed from.
+ */
+struct BundleEntry {
+  std::string name;
+  std::string source_path; // Empty for templates not parsed from a file
+  int64_t modification_time {0};
+  uint64_t source_hash {0};
+  Template tmpl;
+};
+
+/*!
+ * \brief Converts parsed templates to and from a binary bundle.
+ *
+ * A bundle is a CBOR document with the format version, a hash of the parse
+ * configuration and all templates. Each template stores its source, the AST
+ * as compact arrays with literals as native CBOR values, and the file it was
+ * parsed from. Loading a bundle rebuilds the AST without lexing or parsing.
+ */
+class TemplateBundle {
+  using Op = FunctionStorage::Operation;
+
+  enum NodeKind {
+    Text,
+    Expression,
+    ForArray,
+    ForObject,
+    If,
+    Include,
+    Extends,
+    Block,
+    Set,
+    Raw,
+  };
+
+  enum ExpressionKind {
+    Literal,
+    Data,
+    Function,
+  };
+
+  static json encode(const std::shared_ptr<ExpressionNode>& node) {
+    if (const auto* literal = dynamic_cast<const LiteralNode*>(node.get())) {
+      return json::array({Literal, literal->pos, literal->value});
+    } else if (const auto* data = dynamic_cast<const DataNode*>(node.get())) {
+      return json::array({Data, data->pos, data->name});
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(node.get())) {
+      json arguments = json::array();
+      for (const auto& argument : function->arguments) {
+        arguments.push_back(encode(argument));
+      }
+      return json::array({Function, function->pos, static_cast<int>(function->operation), function->name, function->number_args, std::move(arguments)});
+    }
+    return nullptr;
+  }
+
+  static json encode(const ExpressionListNode& node) {
+    return json::array({node.pos, node.length, encode(node.root)});
+  }
+
+  static json encode(const BlockNode& block) {
+    json result = json::array();
+    for (const auto& n : block.nodes) {
+      const AstNode* node = n.get();
+      if (const auto* text = dynamic_cast<const TextNode*>(node)) {
+        result.push_back(json::array({Text, text->pos, text->length}));
+      } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(node)) {
+        result.push_back(json::array({Expression, expression->pos, encode(*expression)}));
+      } else if (const auto* array_loop = dynamic_cast<const ForArrayStatementNode*>(node)) {
+        result.push_back(json::array({ForArray, array_loop->pos, array_loop->value, encode(array_loop->condition), encode(array_loop->body)}));
+      } else if (const auto* object_loop = dynamic_cast<const ForObjectStatementNode*>(node)) {
+        result.push_back(json::array(
+            {ForObject, object_loop->pos, object_loop->key, object_loop->value, encode(object_loop->condition), encode(object_loop->body)}));
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node)) {
+        result.push_back(json::array({If, condition->pos, condition->is_nested, condition->has_false_statement, encode(condition->condition),
+                                      encode(condition->true_statement), encode(condition->false_statement)}));
+      } else if (const auto* include = dynamic_cast<const IncludeStatementNode*>(node)) {
+        result.push_back(json::array({Include, include->pos, include->file}));
+      } else if (const auto* extends = dynamic_cast<const ExtendsStatementNode*>(node)) {
+        result.push_back(json::array({Extends, extends->pos, extends->file}));
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node)) {
+        result.push_back(json::array({Block, block_statement->pos, block_statement->name, encode(block_statement->block)}));
+      } else if (const auto* set = dynamic_cast<const SetStatementNode*>(node)) {
+        result.push_back(json::array({Set, set->pos, set->key, encode(set->expression)}));
+      } else if (const auto* raw = dynamic_cast<const RawStatementNode*>(node)) {
+        result.push_back(json::array({Raw, raw->pos, raw->content_pos, raw->content_length}));
+      }
+    }
+    return result;
+  }
+
+  const FunctionStorage& function_storage;
+
+  std::shared_ptr<ExpressionNode> decode_expression(const json& value) const {
+    if (value.is_null()) {
+      return nullptr;
+    }
+
+    const size_t pos = value.at(1).get<size_t>();
+    switch (value.at(0).get<int>()) {
+    case Literal:
+      return std::make_shared<LiteralNode>(value.at(2), pos);
+    case Data:
+      return std::make_shared<DataNode>(value.at(2).get<std::string>(), pos);
+    case Function: {
+      const auto operation = static_cast<Op>(value.at(2).get<int>());
+      const auto& name = value.at(3).get_ref<const json::string_t&>();
+      auto function = name.empty() ? std::make_shared<FunctionNode>(operation, pos) : std::make_shared<FunctionNode>(name, pos);
+      function->operation = operation;
+      function->number_args = value.at(4).get<int>();
+      for (const auto& argument : value.at(5)) {
+        function->arguments.push_back(decode_expression(argument));
+      }
+      if (operation == Op::Callback) {
+        function->callback = function_storage.find_function(name, static_cast<int>(function->arguments.size())).callback;
+      }
+      return function;
+    }
+    default:
+      INJA_THROW(FileError("invalid expression in template bundle"));
+    }
+  }
+
+  void decode_expression_list(const json& value, ExpressionListNode& target) const {
+    target.pos = value.at(0).get<size_t>();
+    target.length = value.at(1).get<size_t>();
+    target.root = decode_expression(value.at(2));
+  }
+
+  // Throws if a node refers to text outside of the template source
+  static void check_source_range(const Template& tmpl, size_t pos, size_t length) {
+    if (pos > tmpl.content.size() || length > tmpl.content.size() - pos) {
+      INJA_THROW(FileError("invalid node in template bundle"));
+    }
+  }
+
+  void decode_block(const json& value, BlockNode& target, Template& tmpl) const {
+    for (const auto& node : value) {
+      const size_t pos = node.at(1).get<size_t>();
+      switch (node.at(0).get<int>()) {
+      case Text: {
+        const size_t length = node.at(2).get<size_t>();
+        check_source_range(tmpl, pos, length);
+        target.nodes.push_back(std::make_shared<TextNode>(pos, length));
+      } break;
+      case Expression: {
+        auto expression = std::make_shared<ExpressionListNode>(pos);
+        decode_expression_list(node.at(2), *expression);
+        target.nodes.push_back(expression);
+      } break;
+      case ForArray: {
+        auto loop = std::make_shared<ForArrayStatementNode>(node.at(2).get<std::string>(), &target, pos);
+        decode_expression_list(node.at(3), loop->condition);
+        decode_block(node.at(4), loop->body, tmpl);
+        target.nodes.push_back(loop);
+      } break;
+      case ForObject: {
+        auto loop = std::make_shared<ForObjectStatementNode>(node.at(2).get<std::string>(), node.at(3).get<std::string>(), &target, pos);
+        decode_expression_list(node.at(4), loop->condition);
+        decode_block(node.at(5), loop->body, tmpl);
+        target.nodes.push_back(loop);
+      } break;
+      case If: {
+        auto condition = std::make_shared<IfStatementNode>(node.at(2).get<bool>(), &target, pos);
+        condition->has_false_statement = node.at(3).get<bool>();
+        decode_expression_list(node.at(4), condition->condition);
+        decode_block(node.at(5), condition->true_statement, tmpl);
+        decode_block(node.at(6), condition->false_statement, tmpl);
+        target.nodes.push_back(condition);
+      } break;
+      case Include: {
+        target.nodes.push_back(std::make_shared<IncludeStatementNode>(node.at(2).get<std::string>(), pos));
+      } break;
+      case Extends: {
+        target.nodes.push_back(std::make_shared<ExtendsStatementNode>(node.at(2).get<std::string>(), pos));
+      } break;
+      case Block: {
+        const auto name = node.at(2).get<std::string>();
+        auto block_statement = std::make_shared<BlockStatementNode>(&target, name, pos);
+        decode_block(node.at(3), block_statement->block, tmpl);
+        tmpl.block_storage.emplace(name, block_statement);
+        target.nodes.push_back(block_statement);
+      } break;
+      case Set: {
+        auto set = std::make_shared<SetStatementNode>(node.at(2).get<std::string>(), pos);
+        decode_expression_list(node.at(3), set->expression);
+        target.nodes.push_back(set);
+      } break;
+      case Raw: {
+        const size_t content_pos = node.at(2).get<size_t>();
+        const size_t content_length = node.at(3).get<size_t>();
+        check_source_range(tmpl, content_pos, content_length);
+        target.nodes.push_back(std::make_shared<RawStatementNode>(pos, content_pos, content_length));
+      } break;
+      default:
+        INJA_THROW(FileError("invalid node in template bundle"));
+      }
+    }
+  }
+
+public:
+  /// Version of the bundle format, bundles of other versions are rejected
+  static constexpr int version {1};
+
+  explicit TemplateBundle(const FunctionStorage& function_storage): function_storage(function_storage) {}
+
+  static void write(const std::filesystem::path& filename, const std::vector<BundleEntry>& entries, uint64_t config_hash) {
+    json templates = json::array();
+    for (const auto& entry : entries) {
+      templates.push_back({
+          {"name", entry.name},
+          {"path", entry.source_path},
+          {"mtime", entry.modification_time},
+          {"hash", entry.source_hash},
+          {"source", entry.tmpl.content},
+          {"root", encode(entry.tmpl.root)},
+      });
+    }
+
+    const json bundle {{"format", "inja-bundle"}, {"version", version}, {"config", config_hash}, {"templates", std::move(templates)}};
+    const auto bytes = json::to_cbor(bundle);
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (file.fail()) {
+      INJA_THROW(FileError("failed writing template bundle at '" + filename.string() + "'"));
+    }
+  }
+
+  /// Reads all templates of a bundle, returns false if it has another format version or parse configuration or is incomplete
+  bool read(const std::filesystem::path& filename, uint64_t config_hash, std::vector<BundleEntry>& entries) const {
+    const MappedFile file(filename);
+    const json bundle = json::from_cbor(reinterpret_cast<const uint8_t*>(file.data()), reinterpret_cast<const uint8_t*>(file.data()) + file.size(),
+                                        true, false);
+    if (bundle.is_discarded() || !bundle.is_object() || bundle.value("format", "") != "inja-bundle") {
+      INJA_THROW(FileError("invalid template bundle at '" + filename.string() + "'"));
+    }
+    if (bundle.value("version", json()) != version || bundle.value("config", json()) != config_hash) {
+      return false;
+    }
+
+    const auto templates = bundle.find("templates");
+    if (templates == bundle.end() || !templates->is_array()) {
+      return false;
+    }
+
+    std::vector<BundleEntry> result;
+    try {
+      for (const auto& stored : *templates) {
+        BundleEntry entry;
+        entry.name = stored.at("name").get<std::string>();
+        entry.source_path = stored.at("path").get<std::string>();
+        entry.modification_time = stored.at("mtime").get<int64_t>();
+        entry.source_hash = stored.at("hash").get<uint64_t>();
+        entry.tmpl = Template(stored.at("source").get<std::string>());
+        decode_block(stored.at("root"), entry.tmpl.root, entry.tmpl);
+        result.push_back(std::move(entry));
+      }
+    } catch (const json::exception&) {
+      return false;
+    }
+    entries.insert(entries.end(), std::make_move_iterator(result.begin()), std::make_move_iterator(result.end()));
+    return true;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_BUNDLE_HPP_
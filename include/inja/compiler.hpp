@@ -0,0 +1,126 @@
+#ifndef INCLUDE_INJA_COMPILER_HPP_
+#define INCLUDE_INJA_COMPILER_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "config.hpp"
+#include "function_storage.hpp"
+#include "json.hpp"
+#include "node.hpp"
+#include "optimizer.hpp"
+#include "specializer.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/*!
+ * \brief The optimized form of a template, valid for the storages it was compiled against.
+ */
+struct CompiledTemplate {
+  Template tmpl;
+  std::map<std::string, Template> includes; // Compiled included templates, linked into the include statements
+  std::shared_ptr<const TemplateStorage> template_storage;
+  std::shared_ptr<const FunctionStorage> function_storage;
+  bool html_autoescape;
+
+  /// Returns whether the template can be rendered instead of its source with the given storages and config
+  bool is_current(const TemplateStorage* templates, const FunctionStorage* functions, const RenderConfig& config) const {
+    return template_storage.get() == templates && function_storage.get() == functions && html_autoescape == config.html_autoescape;
+  }
+};
+
+/*!
+ * \brief Compiles a template into an optimized copy for frequent rendering.
+ *
+ * The copy has all constant expressions of literals and built-in functions
+ * folded, its loop-invariant and repeated expressions annotated by the
+ * Optimizer, and its include statements linked to compiled copies of the
+ * included templates. Callbacks are never called while compiling. The source
+ * template is not modified, so it can be rendered concurrently.
+ */
+class TemplateCompiler {
+  RenderConfig config;
+  std::shared_ptr<const TemplateStorage> template_storage;
+  std::shared_ptr<const FunctionStorage> function_storage;
+
+  CompiledTemplate* compiled {nullptr};
+
+  const Template* compile_include(const std::string& name) {
+    const auto it = compiled->includes.find(name);
+    if (it != compiled->includes.end()) {
+      return &it->second;
+    }
+
+    const auto source = template_storage->find(name);
+    if (source == template_storage->end()) {
+      return nullptr;
+    }
+
+    // Inserted before compiling, so that recursive includes link to the same template
+    auto& result = compiled->includes[name];
+    result = compile_single(source->second);
+    return &result;
+  }
+
+  void link(BlockNode& block) {
+    for (auto& node : block.nodes) {
+      if (const auto* include = dynamic_cast<const IncludeStatementNode*>(node.get())) {
+        if (include->linked == nullptr) {
+          auto linked = std::make_shared<IncludeStatementNode>(include->file, include->pos);
+          linked->linked = compile_include(include->file);
+          node = linked;
+        }
+      } else if (auto* condition = dynamic_cast<IfStatementNode*>(node.get())) {
+        link(condition->true_statement);
+        link(condition->false_statement);
+      } else if (auto* loop = dynamic_cast<ForStatementNode*>(node.get())) {
+        link(loop->body);
+      } else if (auto* block_statement = dynamic_cast<BlockStatementNode*>(node.get())) {
+        link(block_statement->block);
+      }
+    }
+  }
+
+  Template compile_single(const Template& tmpl) {
+    // Specializing without data folds the constant expressions into a separate AST. Callbacks are only
+    // deterministic within a render, so they are never called here.
+    Specializer specializer(config, *template_storage, *function_storage, true, false);
+    Template result = specializer.specialize(tmpl, json::object());
+    result.static_data = tmpl.static_data;
+
+    Optimizer optimizer(*function_storage);
+    optimizer.optimize(result);
+
+    link(result.root);
+    for (auto& [name, block_statement] : result.block_storage) {
+      link(block_statement->block);
+    }
+    return result;
+  }
+
+public:
+  explicit TemplateCompiler(const RenderConfig& config, std::shared_ptr<const TemplateStorage> template_storage,
+                            std::shared_ptr<const FunctionStorage> function_storage)
+      : config(config), template_storage(std::move(template_storage)), function_storage(std::move(function_storage)) {
+    this->config.instrumentation_callback = nullptr;
+  }
+
+  std::shared_ptr<const CompiledTemplate> compile(const Template& tmpl) {
+    auto result = std::make_shared<CompiledTemplate>();
+    result->template_storage = template_storage;
+    result->function_storage = function_storage;
+    result->html_autoescape = config.html_autoescape;
+
+    compiled = result.get();
+    result->tmpl = compile_single(tmpl);
+    compiled = nullptr;
+    return result;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_COMPILER_HPP_
@@ -3,9 +3,11 @@
 
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <string>
 
 #include "template.hpp"
+#include "thread_pool.hpp"
 #include "json.hpp"
 
 namespace inja {
@@ -40,6 +42,7 @@ enum class InstrumentationEvent {
   // In-place optimization events
   InplaceOptUsed,        // In-place optimization was successfully used
   InplaceOptSkipped,     // In-place optimization was skipped (with reason)
+  MemoHit,               // Cached result of an optimized expression was reused
 
   // Expression evaluation
   ExpressionEvalStart,   // Beginning of expression evaluation
@@ -133,12 +136,24 @@ struct LexerConfig {
   }
 };
 
+/*!
+ * \brief Limits on the estimated render cost of parsed templates.
+ *
+ * A limit of zero is disabled. Templates exceeding a limit are rejected at parse time.
+ */
+struct CostLimits {
+  size_t max_loop_depth {0};
+  double max_estimated_cost {0.0};
+  size_t assumed_loop_size {10}; // Iterations assumed for every loop when estimating the cost
+};
+
 /*!
  * \brief Class for parser configuration.
  */
 struct ParserConfig {
   bool search_included_templates_in_files {true};
   bool graceful_errors {false}; // If true, allow unknown functions at parse time
+  CostLimits cost_limits;
 
   std::function<Template(const std::filesystem::path&, const std::string&)> include_callback;
 };
@@ -177,6 +192,19 @@ struct RenderConfig {
    * to provide visibility into internal operations for debugging.
    */
   InstrumentationCallback instrumentation_callback;
+
+  /*!
+   * \brief Optional thread pool for rendering independent parts of a template concurrently.
+   *
+   * Sibling includes and block statements whose rendering cannot affect each
+   * other, as well as the iterations of large loops, are rendered on the pool
+   * into separate buffers, which are written in order, so that the output is
+   * the same as of a serial render.
+   */
+  std::shared_ptr<ThreadPool> thread_pool;
+
+  /// Minimum number of iterations of a loop over an array to render it in chunks on the thread pool, 0 never does
+  size_t concurrent_loop_size {1024};
 };
 
 } // namespace inja
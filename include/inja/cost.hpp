@@ -0,0 +1,203 @@
+#ifndef INCLUDE_INJA_COST_HPP_
+#define INCLUDE_INJA_COST_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "analysis.hpp"
+#include "exceptions.hpp"
+#include "function_storage.hpp"
+#include "json.hpp"
+#include "node.hpp"
+#include "template.hpp"
+#include "utils.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Static cost of a single for loop of a template.
+ */
+struct LoopCost {
+  std::string template_name;  // Template containing the loop ("" for the analyzed template itself)
+  SourceLocation location;
+  size_t depth;               // Nesting depth, starting at 1 for outermost loops
+  std::string iterated_path;  // Input path of the iterated container, empty if it is computed
+  size_t assumed_size;        // Iterations from the sample data, or the assumed default
+};
+
+/*!
+ * \brief Structured report of the estimated render cost of a Template.
+ */
+struct CostReport {
+  size_t max_loop_depth {0};
+  std::vector<LoopCost> loops;
+  /// Number of callback call sites per loop nesting level (index 0 is outside of loops)
+  std::vector<size_t> callbacks_per_depth;
+  /// Number of include and extends statements reached, including those of included templates
+  size_t include_fan_out {0};
+  /// Number of distinct templates reached through includes and extends
+  size_t included_templates {0};
+  /// Set statements inside loops that copy their value because they cannot use the in-place path
+  size_t set_copies_in_loops {0};
+  /// String concatenations (`+` with a string literal operand) inside loops
+  size_t string_concatenations_in_loops {0};
+  /// Estimated number of evaluation steps of a single render, weighted by loop sizes
+  double estimated_cost {0.0};
+};
+
+/*!
+ * \brief A visitor estimating the render cost of a Template from its AST.
+ *
+ * Each visited node costs one step, multiplied by the sizes of the loops
+ * around it. Loop sizes are taken from sample data if given, else a fixed
+ * size is assumed. Callbacks, includes and copying set statements are
+ * weighted as more expensive than builtin operations.
+ */
+class CostVisitor : public AnalysisVisitor {
+  static constexpr double callback_weight {10.0};
+  static constexpr double include_weight {5.0};
+  static constexpr double set_copy_weight {20.0};
+
+  const json* sample_data;
+  size_t assumed_loop_size;
+
+  CostReport report;
+  std::vector<double> multipliers {1.0};
+
+  double multiplier() const {
+    return multipliers.back();
+  }
+
+  static size_t container_size(const json& data, const DataPath& path, size_t depth) {
+    if (depth == path.size()) {
+      return (data.is_array() || data.is_object()) ? data.size() : 0;
+    }
+
+    const std::string& token = path[depth];
+    if (token == TemplateAnalysis::any_element) {
+      size_t result = 0;
+      for (const auto& element : data) {
+        result = std::max(result, container_size(element, path, depth + 1));
+      }
+      return result;
+    }
+
+    if (data.is_object()) {
+      const auto it = data.find(token);
+      return (it != data.end()) ? container_size(*it, path, depth + 1) : 0;
+    } else if (data.is_array() && !token.empty() && std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+      const size_t index = std::stoul(token);
+      return (index < data.size()) ? container_size(data[index], path, depth + 1) : 0;
+    }
+    return 0;
+  }
+
+  bool uses_inplace_path(const SetStatementNode& node) const {
+    const auto* function = dynamic_cast<const FunctionNode*>(node.expression.root.get());
+    if (function == nullptr || function->operation != Op::Callback || function->arguments.empty()) {
+      return false;
+    }
+    const auto* first = dynamic_cast<const DataNode*>(function->arguments[0].get());
+    if (first == nullptr || first->name != node.key) {
+      return false;
+    }
+    const auto function_data = function_storage.find_function(function->name, static_cast<int>(function->arguments.size()));
+    return static_cast<bool>(function_data.inplace_callback);
+  }
+
+  void enter_loop(const ForStatementNode& node, const ValueRef& container) override {
+    LoopCost loop;
+    loop.template_name = template_stack.back();
+    loop.location = get_source_location(template_chain.back()->content, node.pos);
+    loop.depth = loop_depth + 1;
+    loop.assumed_size = assumed_loop_size;
+    if (container.kind == ValueRef::Kind::Input) {
+      loop.iterated_path = join_json_pointer(container.path);
+      if (sample_data != nullptr) {
+        loop.assumed_size = container_size(*sample_data, container.path, 0);
+      }
+    }
+
+    report.max_loop_depth = std::max(report.max_loop_depth, loop.depth);
+    multipliers.push_back(multiplier() * static_cast<double>(std::max<size_t>(loop.assumed_size, 1)));
+    report.loops.push_back(std::move(loop));
+  }
+
+  void exit_loop(const ForStatementNode&) override {
+    multipliers.pop_back();
+  }
+
+  void visit(const BlockNode& node) override {
+    report.estimated_cost += multiplier() * static_cast<double>(node.nodes.size());
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const DataNode& node) override {
+    report.estimated_cost += multiplier();
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const FunctionNode& node) override {
+    if (node.operation == Op::Callback) {
+      if (report.callbacks_per_depth.size() <= loop_depth) {
+        report.callbacks_per_depth.resize(loop_depth + 1, 0);
+      }
+      report.callbacks_per_depth[loop_depth] += 1;
+      report.estimated_cost += multiplier() * callback_weight;
+    } else {
+      report.estimated_cost += multiplier();
+    }
+
+    if (node.operation == Op::Add && loop_depth > 0) {
+      const bool has_string_literal = std::any_of(node.arguments.begin(), node.arguments.end(), [](const std::shared_ptr<ExpressionNode>& argument) {
+        const auto* literal = dynamic_cast<const LiteralNode*>(argument.get());
+        return literal != nullptr && literal->value.is_string();
+      });
+      if (has_string_literal) {
+        report.string_concatenations_in_loops += 1;
+      }
+    }
+
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const IncludeStatementNode& node) override {
+    report.include_fan_out += 1;
+    report.estimated_cost += multiplier() * include_weight;
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const ExtendsStatementNode& node) override {
+    report.include_fan_out += 1;
+    report.estimated_cost += multiplier() * include_weight;
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const SetStatementNode& node) override {
+    if (loop_depth > 0 && !uses_inplace_path(node)) {
+      report.set_copies_in_loops += 1;
+      report.estimated_cost += multiplier() * set_copy_weight;
+    }
+    AnalysisVisitor::visit(node);
+  }
+
+public:
+  explicit CostVisitor(const TemplateStorage& template_storage, const FunctionStorage& function_storage, const json* sample_data = nullptr,
+                       size_t assumed_loop_size = 10)
+      : AnalysisVisitor(template_storage, function_storage), sample_data(sample_data), assumed_loop_size(assumed_loop_size) {}
+
+  CostReport estimate(const Template& tmpl) {
+    report = CostReport();
+    multipliers.assign(1, 1.0);
+
+    const auto analysis = analyze(tmpl);
+    report.included_templates = analysis.included_templates().size();
+    return std::move(report);
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_COST_HPP_
@@ -0,0 +1,189 @@
+#ifndef INCLUDE_INJA_DATA_FILE_HPP_
+#define INCLUDE_INJA_DATA_FILE_HPP_
+
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define INJA_HAS_MMAP 1
+#endif
+
+#include "exceptions.hpp"
+#include "json.hpp"
+#include "throw.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A read-only view of a whole file, memory mapped where supported.
+ */
+class MappedFile {
+  const char* data_ {nullptr};
+  size_t size_ {0};
+  bool mapped_ {false};
+  std::string buffer_; // Contents if the file could not be mapped
+
+public:
+  explicit MappedFile(const std::filesystem::path& filename) {
+#ifdef INJA_HAS_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      INJA_THROW(FileError("failed accessing file at '" + filename.string() + "'"));
+    }
+    struct stat info {};
+    const bool has_size = ::fstat(fd, &info) == 0;
+    if (has_size && info.st_size > 0) {
+      void* mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        ::madvise(mapped, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(mapped);
+        size_ = static_cast<size_t>(info.st_size);
+        mapped_ = true;
+      }
+    }
+    ::close(fd);
+    if (mapped_ || (has_size && S_ISREG(info.st_mode) && info.st_size == 0)) {
+      return;
+    }
+#endif
+    std::ifstream file(filename, std::ios::binary);
+    if (file.fail()) {
+      INJA_THROW(FileError("failed accessing file at '" + filename.string() + "'"));
+    }
+    buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+
+  ~MappedFile() {
+#ifdef INJA_HAS_MMAP
+    if (mapped_) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  std::string_view view() const {
+    return {data_, size_};
+  }
+};
+
+/*!
+ * \brief Formats of data files.
+ */
+enum class DataFormat {
+  Auto, // Detected from the file extension, or else the first bytes
+  Json,
+  Cbor,
+  MessagePack,
+  Bson,
+};
+
+/// Returns the format of data with the given file extension (including the dot), or Auto if unknown
+inline DataFormat data_format_from_extension(std::string extension) {
+  for (auto& ch : extension) {
+    ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+  }
+  if (extension == ".json") {
+    return DataFormat::Json;
+  } else if (extension == ".cbor") {
+    return DataFormat::Cbor;
+  } else if (extension == ".msgpack" || extension == ".mpk") {
+    return DataFormat::MessagePack;
+  } else if (extension == ".bson") {
+    return DataFormat::Bson;
+  }
+  return DataFormat::Auto;
+}
+
+/*!
+ * \brief Detects the format of data by its first bytes.
+ *
+ * BSON starts with its total length, CBOR with its self-describe tag or a
+ * map or array header, MessagePack with a map or array header. A small CBOR
+ * array and a small MessagePack map start with the same byte, these are
+ * detected as MessagePack if they parse as such. Everything else is JSON.
+ */
+inline DataFormat detect_data_format(std::string_view data) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  const size_t size = data.size();
+  if (size == 0) {
+    return DataFormat::Json;
+  }
+
+  if (size >= 5) {
+    const uint32_t length = static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) | (static_cast<uint32_t>(bytes[2]) << 16) |
+                            (static_cast<uint32_t>(bytes[3]) << 24);
+    if (length == size && bytes[size - 1] == 0x00) {
+      return DataFormat::Bson;
+    }
+  }
+
+  const uint8_t first = bytes[0];
+  if ((size >= 3 && first == 0xD9 && bytes[1] == 0xD9 && bytes[2] == 0xF7) || (first >= 0xA0 && first <= 0xBB) || first == 0xBF ||
+      (first >= 0x98 && first <= 0x9B) || first == 0x9F) {
+    return DataFormat::Cbor;
+  }
+  if (first == 0xDC || first == 0xDD || first == 0xDE || first == 0xDF) {
+    return DataFormat::MessagePack;
+  }
+  if (first >= 0x80 && first <= 0x97) {
+    const auto result = json::from_msgpack(bytes, bytes + size, true, false);
+    return result.is_discarded() ? DataFormat::Cbor : DataFormat::MessagePack;
+  }
+  return DataFormat::Json;
+}
+
+/// Parses data in the given format, Auto detects it by the first bytes
+inline json parse_data(std::string_view data, DataFormat format = DataFormat::Auto) {
+  if (format == DataFormat::Auto) {
+    format = detect_data_format(data);
+  }
+
+  const auto* begin = reinterpret_cast<const uint8_t*>(data.data());
+  const auto* end = begin + data.size();
+  switch (format) {
+  case DataFormat::Cbor:
+    return json::from_cbor(begin, end);
+  case DataFormat::MessagePack:
+    return json::from_msgpack(begin, end);
+  case DataFormat::Bson:
+    return json::from_bson(begin, end);
+  default:
+    return json::parse(data.begin(), data.end());
+  }
+}
+
+/// Loads a data file, Auto detects the format by the file extension or else the first bytes
+inline json load_data_file(const std::filesystem::path& filename, DataFormat format = DataFormat::Auto) {
+  if (format == DataFormat::Auto) {
+    format = data_format_from_extension(filename.extension().string());
+  }
+
+  const MappedFile file(filename);
+  return parse_data(file.view(), format);
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_DATA_FILE_HPP_
@@ -0,0 +1,113 @@
+#ifndef INCLUDE_INJA_DATA_PROVIDER_HPP_
+#define INCLUDE_INJA_DATA_PROVIDER_HPP_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Data of a render that is looked up on demand instead of being converted to json up front.
+ *
+ * Paths are the keys of a variable name split at dots, with array indices as
+ * decimal numbers, e.g. `{"actors", "3", "name"}` for `actors.3.name`. The
+ * renderer asks only for the paths a template actually reads and keeps every
+ * result until the end of the render. Loops over a provided array or object
+ * only ask for its size or keys, their elements are looked up one by one.
+ */
+class DataProvider {
+public:
+  using Path = std::vector<std::string>;
+
+  virtual ~DataProvider() = default;
+
+  /// Returns the value at the path, or std::nullopt if there is none
+  virtual std::optional<json> lookup(const Path& path) const = 0;
+
+  /// Returns the number of elements of the array at the path, or std::nullopt if it is no array
+  virtual std::optional<size_t> array_size(const Path& path) const {
+    const auto value = lookup(path);
+    if (!value || !value->is_array()) {
+      return std::nullopt;
+    }
+    return value->size();
+  }
+
+  /// Returns the keys of the object at the path in iteration order, or std::nullopt if it is no object
+  virtual std::optional<std::vector<std::string>> object_keys(const Path& path) const {
+    const auto value = lookup(path);
+    if (!value || !value->is_object()) {
+      return std::nullopt;
+    }
+
+    std::vector<std::string> keys;
+    keys.reserve(value->size());
+    for (auto it = value->begin(); it != value->end(); ++it) {
+      keys.push_back(it.key());
+    }
+    return keys;
+  }
+};
+
+/*!
+ * \brief Provides the values of a json document, e.g. to combine it with other providers.
+ */
+class JsonDataProvider : public DataProvider {
+  const json& data;
+
+  const json* find(const Path& path) const {
+    const json* value = &data;
+    for (const auto& key : path) {
+      if (value->is_object()) {
+        const auto it = value->find(key);
+        if (it == value->end()) {
+          return nullptr;
+        }
+        value = &*it;
+      } else if (value->is_array() && !key.empty() && key.find_first_not_of("0123456789") == std::string::npos) {
+        const size_t index = std::stoul(key);
+        if (index >= value->size()) {
+          return nullptr;
+        }
+        value = &(*value)[index];
+      } else {
+        return nullptr;
+      }
+    }
+    return value;
+  }
+
+public:
+  explicit JsonDataProvider(const json& data): data(data) {}
+
+  std::optional<json> lookup(const Path& path) const override {
+    const json* value = find(path);
+    return value ? std::optional<json>(*value) : std::nullopt;
+  }
+
+  std::optional<size_t> array_size(const Path& path) const override {
+    const json* value = find(path);
+    return (value && value->is_array()) ? std::optional<size_t>(value->size()) : std::nullopt;
+  }
+
+  std::optional<std::vector<std::string>> object_keys(const Path& path) const override {
+    const json* value = find(path);
+    if (!value || !value->is_object()) {
+      return std::nullopt;
+    }
+
+    std::vector<std::string> keys;
+    keys.reserve(value->size());
+    for (auto it = value->begin(); it != value->end(); ++it) {
+      keys.push_back(it.key());
+    }
+    return keys;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_DATA_PROVIDER_HPP_
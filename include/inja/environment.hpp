@@ -1,24 +1,53 @@
 #ifndef INCLUDE_INJA_ENVIRONMENT_HPP_
 #define INCLUDE_INJA_ENVIRONMENT_HPP_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <span>
 #include <sstream>
+#include <stop_token>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include "json.hpp"
+#include "analysis.hpp"
+#include "bundle.hpp"
 #include "config.hpp"
+#include "data_file.hpp"
+#include "data_provider.hpp"
 #include "callback_cache.hpp"
+#include "compiler.hpp"
+#include "cost.hpp"
+#include "executor.hpp"
 #include "function_storage.hpp"
+#include "globals.hpp"
+#include "include_cache.hpp"
+#include "native.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "preload.hpp"
+#include "projection.hpp"
+#include "reflect.hpp"
 #include "renderer.hpp"
+#include "specializer.hpp"
+#include "stream.hpp"
 #include "template.hpp"
+#include "thread_pool.hpp"
 #include "throw.hpp"
+#include "watcher.hpp"
 
 namespace inja {
 
@@ -49,11 +78,68 @@ class Environment {
   // Mutex for coordinating write operations (brief, rare)
   mutable std::mutex write_mutex_;
 
+  // Incremented with every change of render_config, guarded by write_mutex_
+  size_t render_config_version_ {0};
+
+  // Identifies the environment in the renderers reused by render_async()
+  static inline std::atomic<size_t> next_id_ {1};
+  const size_t id_ {next_id_.fetch_add(1, std::memory_order_relaxed)};
+
+  // Built-in executor of render_async(), started on first use
+  std::unique_ptr<ThreadPool> async_pool_;
+
   std::shared_ptr<CallbackCache> callback_cache_; // Optional callback cache
 
+  // How include names were resolved, shared by all parsers of this environment
+  std::shared_ptr<IncludeCache> include_cache_ {std::make_shared<IncludeCache>()};
+
+  // Variables of the setup template shared by all renders, see set_globals_from()
+  std::atomic<std::shared_ptr<const GlobalScope>> globals_;
+
+  // Number of renders after which a template is compiled in the background, 0 disables compilation
+  std::atomic<size_t> compile_threshold_ {0};
+
+  // Worker compiling hot templates, started on first use and joined by the destructor
+  std::unique_ptr<ThreadPool> compile_pool_;
+  std::shared_ptr<std::atomic<bool>> compile_cancelled_ {std::make_shared<std::atomic<bool>>(false)};
+
+  // Modification times of the template files loaded by load_bundle() or preload_directory(), by template name
+  std::map<std::string, int64_t> preloaded_modification_times_;
+
+  // Background thread reloading changed template files, see watch_templates()
+  std::thread watcher_thread_;
+  std::atomic<bool> stop_watching_ {false};
+
   // Thread-local storage for render errors (each thread sees its own errors)
   static inline thread_local std::vector<RenderErrorInfo> tl_render_errors_;
 
+  // A render submitted by render_async(), with the snapshot of the environment it was submitted with
+  struct AsyncRender {
+    Template tmpl;
+    json data;
+    std::shared_ptr<const CompiledTemplate> compiled;
+    std::shared_ptr<TemplateStorage> template_storage;
+    std::shared_ptr<FunctionStorage> function_storage;
+    std::shared_ptr<const GlobalScope> globals;
+    RenderConfig config;
+    size_t environment_id;
+    size_t config_version;
+    std::stop_token stop_token;
+    std::chrono::steady_clock::time_point deadline;
+    std::function<void(RenderResult, std::exception_ptr)> on_complete;
+    std::ostream* output {nullptr}; // Receives the output instead of the result, see render_stream()
+  };
+
+  // Renderer of asynchronous renders on this thread, reused as long as the environment is unchanged
+  struct ThreadRenderer {
+    size_t environment_id {0};
+    size_t config_version {0};
+    std::shared_ptr<TemplateStorage> template_storage;
+    std::shared_ptr<FunctionStorage> function_storage;
+    std::unique_ptr<Renderer> renderer;
+    bool in_use {false}; // Renders started while waiting inside another render get their own renderer
+  };
+
   // Thread-local cache for templates discovered during parsing
   // This allows lock-free parsing; templates are merged into shared storage after parse completes
   static inline thread_local TemplateStorage tl_parse_cache_;
@@ -71,6 +157,41 @@ private:
     register_array_functions(*this);
   }
 
+  // Count a render of the template and return its compiled form if it is current for the snapshots
+  std::shared_ptr<const CompiledTemplate> select_compiled(const Template& tmpl, const std::shared_ptr<TemplateStorage>& tmpl_storage,
+                                                          const std::shared_ptr<FunctionStorage>& func_storage, const RenderConfig& config) {
+    const size_t threshold = compile_threshold_.load(std::memory_order_relaxed);
+    if (threshold == 0 || !tmpl.tier) {
+      return nullptr;
+    }
+
+    auto compiled = tmpl.tier->compiled.load(std::memory_order_acquire);
+    if (compiled && compiled->is_current(tmpl_storage.get(), func_storage.get(), config)) {
+      return compiled;
+    }
+
+    // Cold or outdated: compile once the template got hot, without blocking the render
+    if (tmpl.tier->render_count.fetch_add(1, std::memory_order_relaxed) + 1 >= threshold && !tmpl.tier->compiling.exchange(true)) {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      if (!compile_pool_) {
+        compile_pool_ = std::make_unique<ThreadPool>(1);
+      }
+      compile_pool_->execute([tier = tmpl.tier, source = tmpl, config, tmpl_storage, func_storage, cancelled = compile_cancelled_]() {
+        if (!cancelled->load(std::memory_order_acquire)) {
+          try {
+            TemplateCompiler compiler(config, tmpl_storage, func_storage);
+            tier->compiled.store(compiler.compile(source), std::memory_order_release);
+          } catch (...) {
+            // Keep rendering the source template, and retry after the next threshold renders
+            tier->render_count.store(0, std::memory_order_relaxed);
+          }
+        }
+        tier->compiling.store(false, std::memory_order_release);
+      });
+    }
+    return nullptr;
+  }
+
   // Merge thread-local parse cache into shared template storage
   // Called after parse() completes to publish discovered templates
   void merge_parse_cache() {
@@ -93,6 +214,48 @@ private:
     tl_parse_cache_.clear();
   }
 
+  bool has_cost_limits() const {
+    const auto& limits = parser_config.cost_limits;
+    return limits.max_loop_depth > 0 || limits.max_estimated_cost > 0.0;
+  }
+
+  // Estimates the cost with includes looked up in the given storage
+  CostReport estimate_cost(const TemplateStorage& tmpl_storage, const Template& tmpl, size_t assumed_loop_size) const {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    CostVisitor visitor(tmpl_storage, *func_storage, nullptr, assumed_loop_size);
+    return visitor.estimate(tmpl);
+  }
+
+  // Reject templates whose estimated render cost exceeds the configured limits
+  // Includes are looked up in the storage, and in the templates discovered by the current parse that are not published yet
+  void check_cost_limits(const Template& tmpl, const TemplateStorage& storage, const TemplateStorage& discovered = {}) const {
+    if (!has_cost_limits()) {
+      return;
+    }
+    if (!discovered.empty()) {
+      TemplateStorage merged = storage;
+      for (const auto& [name, discovered_tmpl] : discovered) {
+        merged.try_emplace(name, discovered_tmpl);
+      }
+      check_cost_limits(tmpl, merged);
+      return;
+    }
+
+    const auto& limits = parser_config.cost_limits;
+    const auto report = estimate_cost(storage, tmpl, limits.assumed_loop_size);
+    if (limits.max_loop_depth > 0 && report.max_loop_depth > limits.max_loop_depth) {
+      const auto loop = std::find_if(report.loops.begin(), report.loops.end(), [&limits](const LoopCost& l) { return l.depth > limits.max_loop_depth; });
+      INJA_THROW(ParserError("loop nesting depth " + std::to_string(report.max_loop_depth) + " exceeds the limit of " + std::to_string(limits.max_loop_depth),
+                             loop->location));
+    }
+    if (limits.max_estimated_cost > 0.0 && report.estimated_cost > limits.max_estimated_cost) {
+      INJA_THROW(ParserError("estimated render cost " + std::to_string(static_cast<size_t>(report.estimated_cost)) + " exceeds the limit of " +
+                                 std::to_string(static_cast<size_t>(limits.max_estimated_cost)),
+                             SourceLocation {1, 1}));
+    }
+  }
+
 public:
   // Get thread-local errors from current thread's last render
   const std::vector<RenderErrorInfo>& get_last_render_errors() const {
@@ -166,10 +329,24 @@ public:
         std::memory_order_release);
     // Copy callback cache (shared, not deeply copied - new Environment uses same cache)
     callback_cache_ = other.callback_cache_;
+    globals_.store(other.globals_.load(std::memory_order_acquire), std::memory_order_release);
+    compile_threshold_.store(other.compile_threshold_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(other.write_mutex_);
+      preloaded_modification_times_ = other.preloaded_modification_times_;
+    }
     // Note: callback_wrapper_, cache_predicate_, and instrumentation_callback_
     // are function objects that should be re-registered on the new Environment
   }
 
+  ~Environment() {
+    stop_watching();
+
+    // Skip queued compilations and wait for a running one
+    compile_cancelled_->store(true, std::memory_order_release);
+    compile_pool_.reset();
+  }
+
   /// Sets the opener and closer for template statements
   void set_statement(const std::string& open, const std::string& close) {
     lexer_config.statement_open = open;
@@ -217,18 +394,26 @@ public:
   /// Sets the element notation syntax
   void set_search_included_templates_in_files(bool search_in_files) {
     parser_config.search_included_templates_in_files = search_in_files;
+    include_cache_->clear();
+  }
+
+  /// Sets the limits on the estimated render cost of parsed templates
+  void set_cost_limits(const CostLimits& limits) {
+    parser_config.cost_limits = limits;
   }
 
   /// Sets whether a missing include will throw an error (thread-safe)
   void set_throw_at_missing_includes(bool will_throw) {
     std::lock_guard<std::mutex> lock(write_mutex_);
     render_config.throw_at_missing_includes = will_throw;
+    ++render_config_version_;
   }
 
   /// Sets whether we'll automatically perform HTML escape (thread-safe)
   void set_html_autoescape(bool will_escape) {
     std::lock_guard<std::mutex> lock(write_mutex_);
     render_config.html_autoescape = will_escape;
+    ++render_config_version_;
   }
 
   /*!
@@ -251,12 +436,14 @@ public:
   void set_callback_wrapper(const CallbackWrapper& wrapper) {
     std::lock_guard<std::mutex> lock(write_mutex_);
     render_config.callback_wrapper = wrapper;
+    ++render_config_version_;
   }
 
   /// Clears the callback wrapper (disables instrumentation, thread-safe)
   void clear_callback_wrapper() {
     std::lock_guard<std::mutex> lock(write_mutex_);
     render_config.callback_wrapper = nullptr;
+    ++render_config_version_;
   }
 
   /*!
@@ -271,12 +458,14 @@ public:
   void set_instrumentation_callback(const InstrumentationCallback& callback) {
     std::lock_guard<std::mutex> lock(write_mutex_);
     render_config.instrumentation_callback = callback;
+    ++render_config_version_;
   }
 
   /// Clears the instrumentation callback (thread-safe)
   void clear_instrumentation_callback() {
     std::lock_guard<std::mutex> lock(write_mutex_);
     render_config.instrumentation_callback = nullptr;
+    ++render_config_version_;
   }
 
   /*!
@@ -300,6 +489,7 @@ public:
     std::lock_guard<std::mutex> lock(write_mutex_);
     callback_cache_ = std::make_shared<CallbackCache>(config);
     render_config.callback_wrapper = callback_cache_->make_caching_wrapper();
+    ++render_config_version_;
   }
 
   /*!
@@ -325,6 +515,7 @@ public:
     callback_cache_ = std::make_shared<CallbackCache>(config);
     callback_cache_->set_cache_predicate(std::move(predicate));
     render_config.callback_wrapper = callback_cache_->make_caching_wrapper();
+    ++render_config_version_;
   }
 
   /*!
@@ -360,6 +551,7 @@ public:
       callback_cache_->set_cache_predicate(std::move(predicate));
     }
     render_config.callback_wrapper = callback_cache_->make_caching_wrapper_with_inner(inner_wrapper);
+    ++render_config_version_;
   }
 
   /*!
@@ -392,8 +584,10 @@ public:
     }
     if (cache) {
       render_config.callback_wrapper = cache->make_caching_wrapper();
+      ++render_config_version_;
     } else {
       render_config.callback_wrapper = nullptr;
+      ++render_config_version_;
     }
   }
 
@@ -417,6 +611,7 @@ public:
       cache->set_cache_predicate(std::move(predicate));
     }
     render_config.callback_wrapper = wrapper;
+    ++render_config_version_;
   }
 
   /*!
@@ -429,6 +624,7 @@ public:
     std::lock_guard<std::mutex> lock(write_mutex_);
     callback_cache_.reset();
     render_config.callback_wrapper = nullptr;
+    ++render_config_version_;
   }
 
   /*!
@@ -473,8 +669,11 @@ public:
     // Parser writes discovered templates to thread-local cache,
     // but can also look up existing templates in shared storage (kept alive by shared_ptr)
     Parser parser(parser_config, lexer_config, tl_parse_cache_, *func_storage, tmpl_storage);
+    parser.set_include_cache(include_cache_.get());
     try {
       Template result = parser.parse(input, input_path);
+      // Reject the template before its includes are published to the shared storage
+      check_cost_limits(result, *tmpl_storage, tl_parse_cache_);
       // Merge any templates discovered during parsing into shared storage
       merge_parse_cache();
       return result;
@@ -494,10 +693,31 @@ public:
 
     // Parser writes discovered templates to thread-local cache,
     // but can also look up existing templates in shared storage (kept alive by shared_ptr)
+    // Preloaded templates are used as long as their file is unchanged
+    const std::string name = (input_path / filename).string();
+    int64_t bundled_modification_time {0};
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      const auto bundled = preloaded_modification_times_.find(name);
+      if (bundled != preloaded_modification_times_.end()) {
+        bundled_modification_time = bundled->second;
+      }
+    }
+    if (bundled_modification_time != 0 && file_modification_time(name) == bundled_modification_time) {
+      const auto bundled = tmpl_storage->find(name);
+      if (bundled != tmpl_storage->end()) {
+        return bundled->second;
+      }
+    }
+
     Parser parser(parser_config, lexer_config, tl_parse_cache_, *func_storage, tmpl_storage);
+
+    parser.set_include_cache(include_cache_.get());
     try {
       auto result = Template(Parser::load_file(input_path / filename));
       parser.parse_into_template(result, (input_path / filename).string());
+      // Reject the template before its includes are published to the shared storage
+      check_cost_limits(result, *tmpl_storage, tl_parse_cache_);
       // Merge any templates discovered during parsing into shared storage
       merge_parse_cache();
       return result;
@@ -513,6 +733,433 @@ public:
     return parse_template(filename);
   }
 
+  /*!
+   * \brief Parses all templates in a directory in parallel and adds them to the template storage (thread-safe).
+   *
+   * The directory is searched recursively relative to the input path, and
+   * files are matched against the glob relative to the directory (`*` and
+   * `?` stop at `/`, `**` does not). Templates included by several files are
+   * parsed only once. All templates are published with a single swap of the
+   * template storage, and parse_template() returns them as long as their file
+   * is unchanged. A thread count of 0 uses all hardware threads.
+   */
+  PreloadReport preload_directory(const std::filesystem::path& directory, const std::string& pattern = "**", size_t threads = 0) {
+    const auto start = std::chrono::steady_clock::now();
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    std::vector<std::string> names;
+    const auto root = input_path / directory;
+    for (const auto& file : std::filesystem::recursive_directory_iterator(root)) {
+      if (file.is_regular_file() && glob_match(pattern, file.path().lexically_relative(root).generic_string())) {
+        names.push_back((root / file.path().lexically_relative(root)).string());
+      }
+    }
+
+    ConcurrentTemplateStorage parsed;
+    std::mutex discovered_mutex;
+    TemplateStorage discovered_templates; // Templates from the include callback
+    {
+      ThreadPool pool(threads);
+      std::vector<std::future<void>> tasks;
+      tasks.reserve(names.size());
+      for (const auto& name : names) {
+        tasks.push_back(pool.submit([this, &parsed, &discovered_mutex, &discovered_templates, &name, &func_storage, &tmpl_storage]() {
+          if (parsed.find(name)) {
+            return; // Already parsed as an include of another template
+          }
+
+          const auto timer = ConcurrentTemplateStorage::start_parse();
+          TemplateStorage discovered;
+          Parser parser(parser_config, lexer_config, discovered, *func_storage, tmpl_storage);
+          parser.set_include_cache(include_cache_.get());
+          parser.set_concurrent_storage(&parsed);
+
+          auto tmpl = Template(Parser::load_file(name));
+          parser.parse_into_template(tmpl, name);
+          parsed.add(name, tmpl, timer);
+
+          std::lock_guard<std::mutex> lock(discovered_mutex);
+          for (const auto& [discovered_name, discovered_tmpl] : discovered) {
+            if (!parsed.find(discovered_name)) {
+              discovered_templates.try_emplace(discovered_name, discovered_tmpl);
+            }
+          }
+        }));
+      }
+      for (auto& task : tasks) {
+        task.get();
+      }
+    }
+
+    // Checked once all files are parsed, as their includes may be other files of the directory
+    if (has_cost_limits()) {
+      TemplateStorage merged = *tmpl_storage;
+      parsed.for_each([&merged](const std::string& name, const ConcurrentTemplateStorage::Entry& entry) {
+        merged.insert_or_assign(name, entry.tmpl);
+      });
+      for (const auto& [name, tmpl] : discovered_templates) {
+        merged.try_emplace(name, tmpl);
+      }
+      parsed.for_each([this, &merged](const std::string&, const ConcurrentTemplateStorage::Entry& entry) {
+        check_cost_limits(entry.tmpl, merged);
+      });
+    }
+
+    std::vector<std::pair<std::string, int64_t>> modification_times;
+    parsed.for_each([&modification_times](const std::string& name, const ConcurrentTemplateStorage::Entry&) {
+      modification_times.emplace_back(name, file_modification_time(name));
+    });
+
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+
+      // Copy-on-write: preloaded templates replace stored ones of the same name
+      auto new_storage = std::make_shared<TemplateStorage>(*template_storage_.load(std::memory_order_acquire));
+      parsed.for_each([&new_storage](const std::string& name, const ConcurrentTemplateStorage::Entry& entry) {
+        new_storage->insert_or_assign(name, entry.tmpl);
+      });
+      for (const auto& [name, tmpl] : discovered_templates) {
+        new_storage->try_emplace(name, tmpl);
+      }
+      for (const auto& [name, modification_time] : modification_times) {
+        if (modification_time != 0) {
+          preloaded_modification_times_[name] = modification_time;
+        }
+      }
+      template_storage_.store(new_storage, std::memory_order_release);
+    }
+
+    auto report = parsed.report();
+    report.total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return report;
+  }
+
+  /*!
+   * \brief Parses the given template files again and replaces them in the template storage (thread-safe).
+   *
+   * All templates are published with a single swap of the template storage,
+   * renders in progress keep using the previous templates. A file that fails
+   * to parse keeps its previous template. Returns the reloaded templates and
+   * all templates that include or extend them, which render the new version
+   * from now on as includes are looked up by name.
+   */
+  std::vector<std::string> reload_templates(const std::vector<std::string>& names) {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    TemplateStorage discovered;
+    TemplateStorage reloaded;
+    std::vector<std::string> reloaded_names;
+    Parser parser(parser_config, lexer_config, discovered, *func_storage, tmpl_storage);
+    parser.set_include_cache(include_cache_.get());
+    for (const auto& name : names) {
+      try {
+        auto tmpl = Template(Parser::load_file(name));
+        parser.parse_into_template(tmpl, name);
+        check_cost_limits(tmpl, *tmpl_storage, discovered);
+        reloaded.insert_or_assign(name, std::move(tmpl));
+        reloaded_names.push_back(name);
+      } catch (const InjaError&) {
+        // Keep the previous template, e.g. while the file is saved in the middle of an edit
+      }
+    }
+    if (reloaded.empty()) {
+      return {};
+    }
+
+    std::shared_ptr<TemplateStorage> new_storage;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+
+      // Copy-on-write: renders in progress keep using the old storage
+      new_storage = std::make_shared<TemplateStorage>(*template_storage_.load(std::memory_order_acquire));
+      for (auto& [name, tmpl] : reloaded) {
+        const int64_t modification_time = file_modification_time(name);
+        if (modification_time != 0 && preloaded_modification_times_.count(name) > 0) {
+          preloaded_modification_times_[name] = modification_time;
+        }
+        new_storage->insert_or_assign(name, std::move(tmpl));
+      }
+      for (const auto& [name, tmpl] : discovered) {
+        new_storage->try_emplace(name, tmpl);
+      }
+      template_storage_.store(new_storage, std::memory_order_release);
+    }
+    return dependent_templates(*new_storage, reloaded_names);
+  }
+
+  /*!
+   * \brief Starts a background thread that reloads changed template files (thread-safe).
+   *
+   * All templates in the template storage that were read from a file are
+   * watched, with inotify on Linux and by polling their modification time in
+   * the given interval otherwise. Changed templates are reloaded with
+   * reload_templates(), and the callback is called with its result from the
+   * watcher thread. Render threads are never blocked by the watcher.
+   */
+  void watch_templates(std::chrono::milliseconds poll_interval = std::chrono::milliseconds(500), const TemplateReloadCallback& callback = nullptr,
+                       bool use_notifications = true) {
+    stop_watching();
+    stop_watching_.store(false, std::memory_order_release);
+
+    watcher_thread_ = std::thread([this, poll_interval, callback, use_notifications]() {
+      // Short waits, so that stop_watching() returns quickly
+      const auto wait_time = std::min(poll_interval, std::chrono::milliseconds(50));
+
+      FileWatcher watcher(use_notifications);
+      std::shared_ptr<TemplateStorage> watched_storage;
+      auto next_poll = std::chrono::steady_clock::now();
+      while (!stop_watching_.load(std::memory_order_acquire)) {
+        auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+        if (tmpl_storage != watched_storage) {
+          for (const auto& [name, tmpl] : *tmpl_storage) {
+            if (!watcher.is_watching(name) && file_modification_time(name) != 0) {
+              watcher.watch(name);
+            }
+          }
+          watched_storage = tmpl_storage;
+        }
+
+        const bool notified = watcher.wait_for_notification(wait_time);
+        if (!notified && std::chrono::steady_clock::now() < next_poll) {
+          continue;
+        }
+        next_poll = std::chrono::steady_clock::now() + poll_interval;
+
+        const auto changed = watcher.changed_files();
+        if (!changed.empty()) {
+          const auto reloaded = reload_templates(changed);
+          if (callback && !reloaded.empty()) {
+            callback(reloaded);
+          }
+        }
+      }
+    });
+  }
+
+  /// Stops the thread started by watch_templates(), if any
+  void stop_watching() {
+    stop_watching_.store(true, std::memory_order_release);
+    if (watcher_thread_.joinable()) {
+      watcher_thread_.join();
+    }
+  }
+
+  /*!
+   * \brief Writes the parsed templates and all templates in the storage to a binary bundle file.
+   *
+   * Loading the bundle with load_bundle() skips lexing and parsing of all
+   * templates whose files did not change since.
+   */
+  void write_bundle(const std::filesystem::path& bundle_file, const std::vector<std::string>& filenames) {
+    TemplateStorage templates;
+    for (const auto& filename : filenames) {
+      templates.emplace((input_path / filename).string(), parse_template(filename));
+    }
+    for (const auto& [name, tmpl] : *template_storage_.load(std::memory_order_acquire)) {
+      templates.try_emplace(name, tmpl);
+    }
+
+    uint64_t config_hash;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_hash = parse_config_hash(lexer_config, parser_config);
+    }
+
+    std::vector<BundleEntry> entries;
+    entries.reserve(templates.size());
+    for (auto& [name, tmpl] : templates) {
+      BundleEntry entry;
+      entry.name = name;
+      entry.modification_time = file_modification_time(name);
+      if (entry.modification_time != 0) {
+        entry.source_path = name;
+      }
+      entry.source_hash = fnv1a_hash(tmpl.content);
+      entry.tmpl = std::move(tmpl);
+      entries.push_back(std::move(entry));
+    }
+    TemplateBundle::write(bundle_file, entries, config_hash);
+  }
+
+  /*!
+   * \brief Loads all templates of a bundle file into the template storage (thread-safe).
+   *
+   * Templates whose file changed since the bundle was written are parsed
+   * again from the file, unless only its modification time changed. Returns
+   * false without loading anything if the bundle does not exist or was
+   * written by another version or with other delimiters or parse settings.
+   */
+  bool load_bundle(const std::filesystem::path& bundle_file) {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    uint64_t config_hash;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_hash = parse_config_hash(lexer_config, parser_config);
+    }
+
+    std::vector<BundleEntry> entries;
+    if (!std::filesystem::exists(bundle_file) || !TemplateBundle(*func_storage).read(bundle_file, config_hash, entries)) {
+      return false;
+    }
+
+    TemplateStorage discovered;
+    Parser parser(parser_config, lexer_config, discovered, *func_storage, tmpl_storage);
+    parser.set_include_cache(include_cache_.get());
+    for (auto& entry : entries) {
+      const int64_t modification_time = entry.source_path.empty() ? 0 : file_modification_time(entry.source_path);
+      if (modification_time == 0 || modification_time == entry.modification_time) {
+        continue;
+      }
+
+      auto source = Parser::load_file(entry.source_path);
+      if (fnv1a_hash(source) != entry.source_hash) {
+        entry.tmpl = Template(std::move(source));
+        parser.parse_into_template(entry.tmpl, entry.source_path);
+        check_cost_limits(entry.tmpl, *tmpl_storage, discovered);
+      }
+      entry.modification_time = modification_time;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: bundled templates replace stored ones of the same name
+    auto new_storage = std::make_shared<TemplateStorage>(*template_storage_.load(std::memory_order_acquire));
+    for (auto& entry : entries) {
+      if (entry.modification_time != 0) {
+        preloaded_modification_times_[entry.name] = entry.modification_time;
+      }
+      new_storage->insert_or_assign(entry.name, std::move(entry.tmpl));
+    }
+    for (const auto& [name, tmpl] : discovered) {
+      new_storage->try_emplace(name, tmpl);
+    }
+
+    template_storage_.store(new_storage, std::memory_order_release);
+    return true;
+  }
+
+  /*!
+   * \brief Statically analyzes which data, callbacks and templates a template depends on.
+   *
+   * Included and extended templates are looked up in the template storage and
+   * analyzed transitively. The name is used for the template in the include graph.
+   */
+  TemplateAnalysis analyze(const Template& tmpl, const std::string& name = "") const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    AnalysisVisitor visitor(*tmpl_storage, *func_storage);
+    return visitor.analyze(tmpl, name);
+  }
+
+  /*!
+   * \brief Returns the prefix tree of all input paths a template can read.
+   *
+   * Element access with keys only known at render time (like `at(obj, key)`)
+   * requires all elements of the container. Use inja::project() to reduce
+   * the full input data to this tree.
+   */
+  DataPathTree required_paths(const Template& tmpl) const {
+    return DataPathTree::from_analysis(analyze(tmpl));
+  }
+
+  /*!
+   * \brief Statically estimates the render cost of a template.
+   *
+   * Every loop is assumed to run the given number of iterations.
+   */
+  CostReport estimate_cost(const Template& tmpl, size_t assumed_loop_size = 10) const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    return estimate_cost(*tmpl_storage, tmpl, assumed_loop_size);
+  }
+
+  /*!
+   * \brief Statically estimates the render cost of a template with loop sizes taken from sample data.
+   *
+   * Loops over computed values fall back to the assumed number of iterations.
+   */
+  CostReport estimate_cost(const Template& tmpl, const json& sample_data, size_t assumed_loop_size = 10) const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    CostVisitor visitor(*tmpl_storage, *func_storage, &sample_data, assumed_loop_size);
+    return visitor.estimate(tmpl);
+  }
+
+  /*!
+   * \brief Optimizes a template in place for repeated rendering.
+   *
+   * Loop-invariant expressions are evaluated once per loop instead of in
+   * every iteration, and repeated identical expressions reuse the result of
+   * their first evaluation until one of their variables is assigned.
+   * Callbacks are only considered if they were marked with
+   * set_callback_deterministic(). The output is unchanged.
+   */
+  OptimizerStats optimize(Template& tmpl) const {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    Optimizer optimizer(*func_storage);
+    return optimizer.optimize(tmpl);
+  }
+
+  /*!
+   * \brief Sets the number of renders after which a template is compiled in the background (thread-safe).
+   *
+   * Compiling folds constant expressions of literals and built-in functions,
+   * optimizes loop-invariant and repeated expressions, and links includes
+   * directly to compiled copies of the included templates. Callbacks are
+   * never called while compiling, as they are only deterministic within a
+   * render. Compilation runs on a worker owned by the environment. Renders
+   * keep using the source template until the compiled form is swapped in. It
+   * is dropped again as soon as templates, callbacks or the autoescape setting
+   * change, and recompiled on the next render. Copies of a template share
+   * their render count and compiled form. A threshold of 0 (the default)
+   * disables compilation.
+   */
+  void set_compile_threshold(size_t renders) {
+    compile_threshold_.store(renders, std::memory_order_relaxed);
+  }
+
+  /// Returns whether the template has a compiled form that is used by the next render
+  bool is_compiled(const Template& tmpl) const {
+    if (!tmpl.tier) {
+      return false;
+    }
+    const auto compiled = tmpl.tier->compiled.load(std::memory_order_acquire);
+    if (!compiled) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return compiled->is_current(template_storage_.load(std::memory_order_acquire).get(), function_storage_.load(std::memory_order_acquire).get(),
+                                render_config);
+  }
+
+  /*!
+   * \brief Returns a template partially evaluated against data that is known in advance.
+   *
+   * Rendering the result with the remaining data gives the same output as
+   * rendering the original template with both. The top-level keys of the
+   * static data must not appear in the data passed at render time.
+   */
+  Template specialize(const Template& tmpl, const json& static_data) const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    RenderConfig config_snapshot;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_snapshot = render_config;
+    }
+
+    Specializer specializer(config_snapshot, *tmpl_storage, *func_storage);
+    return specializer.specialize(tmpl, static_data);
+  }
+
   std::string render(std::string_view input, const json& data) {
     return render(parse(input), data);
   }
@@ -532,6 +1179,13 @@ public:
     return render_file(filename, data);
   }
 
+  /// Renders a template file with data from a JSON, CBOR, MessagePack or BSON file, see load_data()
+  std::string render_file_with_data_file(const std::filesystem::path& filename, const std::string& filename_data,
+                                         DataFormat format = DataFormat::Auto) {
+    const json data = load_data(filename_data, format);
+    return render_file(filename, data);
+  }
+
   void write(const std::filesystem::path& filename, const json& data, const std::string& filename_out) {
     std::ofstream file(output_path / filename_out);
     file << render_file(filename, data);
@@ -554,7 +1208,370 @@ public:
     write(temp, data, filename_out);
   }
 
+  void write_with_data_file(const std::filesystem::path& filename, const std::string& filename_data, const std::string& filename_out,
+                            DataFormat format = DataFormat::Auto) {
+    const json data = load_data(filename_data, format);
+    write(filename, data, filename_out);
+  }
+
+  void write_with_data_file(const Template& temp, const std::string& filename_data, const std::string& filename_out,
+                            DataFormat format = DataFormat::Auto) {
+    const json data = load_data(filename_data, format);
+    write(temp, data, filename_out);
+  }
+
   std::ostream& render_to(std::ostream& os, const Template& tmpl, const json& data) {
+    return render_to(os, tmpl, data, nullptr);
+  }
+
+  std::ostream& render_to(std::ostream& os, std::string_view input, const json& data) {
+    return render_to(os, parse(input), data);
+  }
+
+  /*!
+   * \brief Renders a template with data that is looked up on demand.
+   *
+   * Only the variables the template reads are requested from the provider,
+   * each of them once per render. Loops over provided arrays and objects
+   * request their elements one by one, see DataProvider.
+   */
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const DataProvider& data) {
+    static const json empty_data = json::object();
+    return render_to(os, tmpl, empty_data, &data);
+  }
+
+  std::string render(const Template& tmpl, const DataProvider& data) {
+    std::stringstream os;
+    render_to(os, tmpl, data);
+    return os.str();
+  }
+
+  std::string render(std::string_view input, const DataProvider& data) {
+    return render(parse(input), data);
+  }
+
+  /*!
+   * \brief Renders a template with data split into layers, e.g. global, per-actor and per-call data.
+   *
+   * Variables are looked up from the first layer to the last, without merging
+   * or copying them, so that layers can be shared by concurrent renders. Each
+   * variable is resolved by its full path, so `user.name` is found in a lower
+   * layer even if a higher one has another `user` object. Set statements only
+   * change the data of the render. Null layers are skipped.
+   */
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const std::vector<const json*>& layers) {
+    static const json empty_data = json::object();
+
+    std::vector<const json*> lower_layers;
+    lower_layers.reserve(layers.size());
+    std::copy_if(layers.begin(), layers.end(), std::back_inserter(lower_layers), [](const json* layer) { return layer != nullptr; });
+    if (lower_layers.empty()) {
+      return render_to(os, tmpl, empty_data, nullptr);
+    }
+
+    const json* top = lower_layers.front();
+    lower_layers.erase(lower_layers.begin());
+    return render_to(os, tmpl, *top, nullptr, std::move(lower_layers));
+  }
+
+  std::string render(const Template& tmpl, const std::vector<const json*>& layers) {
+    std::stringstream os;
+    render_to(os, tmpl, layers);
+    return os.str();
+  }
+
+  /*!
+   * \brief Renders a template with its native render function, see tools/inja_compile.cpp.
+   *
+   * The function uses the templates, callbacks, globals and settings of the
+   * environment. Graceful errors and the instrumentation callback need the
+   * interpreter, so with them the template is rendered by the Renderer instead.
+   */
+  std::ostream& render_to(std::ostream& os, NativeFunction function, const Template& tmpl, const json& data) {
+    const RenderConfig config_snapshot = render_config_snapshot();
+    if (config_snapshot.graceful_errors || config_snapshot.instrumentation_callback) {
+      return render_to(os, tmpl, data);
+    }
+
+    tl_render_errors_.clear();
+    const auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    const auto func_storage = function_storage_.load(std::memory_order_acquire);
+    const auto globals = globals_.load(std::memory_order_acquire);
+    std::vector<const json*> layers;
+    if (globals) {
+      layers.push_back(&globals->values);
+    }
+
+    NativeRender render(os, data, layers, config_snapshot, *tmpl_storage, *func_storage);
+    function(render);
+    return os;
+  }
+
+  std::string render(NativeFunction function, const Template& tmpl, const json& data) {
+    std::stringstream os;
+    render_to(os, function, tmpl, data);
+    return os.str();
+  }
+
+  /*!
+   * \brief Renders a template once per input, each into the sink of the same index (thread-safe).
+   *
+   * All renders share one snapshot of the environment, and every thread
+   * reuses a single renderer that is reset between inputs, so its buffers stay
+   * allocated. With a thread pool the inputs are rendered in parallel chunks,
+   * and the calling thread helps until all are done. Null inputs are rendered
+   * with empty data. Returns the errors of graceful error mode per input; an
+   * exception of any render is rethrown once all chunks finished.
+   */
+  std::vector<std::vector<RenderErrorInfo>> render_batch(const Template& tmpl, std::span<const json* const> inputs, std::span<std::ostream* const> sinks,
+                                                         ThreadPool* pool = nullptr) {
+    if (sinks.size() != inputs.size()) {
+      INJA_THROW(InjaError("render_error", "render_batch needs one sink per input, got " + std::to_string(sinks.size()) + " sinks for " +
+                                               std::to_string(inputs.size()) + " inputs"));
+    }
+
+    std::vector<std::vector<RenderErrorInfo>> errors(inputs.size());
+    render_batch_chunks(tmpl, inputs, pool, [&sinks, &errors](Renderer& renderer, const Template& render_template, const json& data, size_t index) {
+      renderer.render_to(*sinks[index], render_template, data);
+      errors[index] = renderer.get_render_errors();
+    });
+    return errors;
+  }
+
+  /// Renders a template once per input, returning the outputs and errors in the order of the inputs, see render_batch() with sinks
+  std::vector<RenderResult> render_batch(const Template& tmpl, std::span<const json* const> inputs, ThreadPool* pool = nullptr) {
+    std::vector<RenderResult> results(inputs.size());
+    render_batch_chunks(tmpl, inputs, pool, [&results](Renderer& renderer, const Template& render_template, const json& data, size_t index) {
+      std::ostringstream os;
+      renderer.render_to(os, render_template, data);
+      results[index].output = std::move(os).str();
+      results[index].errors = renderer.get_render_errors();
+    });
+    return results;
+  }
+
+  /*!
+   * \brief Renders a template on an executor, and calls the completion with the result or the exception (thread-safe).
+   *
+   * The render uses the templates, functions, config and globals of the
+   * environment at the time of the call, so the environment may change or be
+   * destroyed before it runs. Without an executor in the options, it runs on
+   * a thread pool of the environment. Every thread reuses one renderer for
+   * all renders with the same snapshot. The render is stopped with an
+   * InterruptError when the stop token of the options is stopped or the
+   * deadline passed. Errors of graceful error mode are part of the result,
+   * get_last_render_errors() is not changed. The completion is called on the
+   * thread of the render and must not throw.
+   */
+  void render_async(Template tmpl, json data, std::function<void(RenderResult, std::exception_ptr)> on_complete,
+                    const AsyncRenderOptions& options = AsyncRenderOptions()) {
+    auto job = prepare_async_render(std::move(tmpl), std::move(data));
+    job->stop_token = options.stop_token;
+    job->deadline = options.deadline;
+    job->on_complete = std::move(on_complete);
+
+    Executor* executor = options.executor;
+    if (executor == nullptr) {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      if (!async_pool_) {
+        async_pool_ = std::make_unique<ThreadPool>();
+      }
+      executor = async_pool_.get();
+    }
+    executor->execute([job]() { run_async_render(*job); });
+  }
+
+  /// Renders a template on an executor, the future holds the result or the exception, see render_async() with a completion
+  std::future<RenderResult> render_async(Template tmpl, json data, const AsyncRenderOptions& options = AsyncRenderOptions()) {
+    auto promise = std::make_shared<std::promise<RenderResult>>();
+    auto result = promise->get_future();
+    render_async(
+        std::move(tmpl), std::move(data),
+        [promise](RenderResult render_result, std::exception_ptr error) {
+          if (error) {
+            promise->set_exception(error);
+          } else {
+            promise->set_value(std::move(render_result));
+          }
+        },
+        options);
+    return result;
+  }
+
+  /*!
+   * \brief Renders a template on another thread and yields its output in chunks as it is rendered (thread-safe).
+   *
+   * The render starts right away with a snapshot of the environment, as
+   * render_async() does, and waits whenever a chunk is ready but was not
+   * pulled yet, so that at most two chunks are in memory. Each yielded view is
+   * valid until the next one is pulled. Exceptions of the render are thrown
+   * by the iteration. Destroying the generator stops the render. After the
+   * last chunk, get_last_render_errors() of the consuming thread returns the
+   * errors of graceful error mode.
+   */
+  Generator<std::string_view> render_stream(Template tmpl, json data, size_t chunk_size = 4096) {
+    auto job = prepare_async_render(std::move(tmpl), std::move(data));
+    auto channel = std::make_shared<OutputChannel>(chunk_size);
+    std::jthread producer([job, channel](std::stop_token stop_token) {
+      std::ostream os(channel.get());
+      os.exceptions(std::ios::badbit); // Rethrow the interruption by the channel
+      channel->set_stop_token(stop_token);
+      job->stop_token = std::move(stop_token);
+      job->deadline = std::chrono::steady_clock::time_point::max();
+      job->output = &os;
+
+      std::exception_ptr render_error;
+      std::vector<RenderErrorInfo> errors;
+      job->on_complete = [&render_error, &errors](RenderResult result, std::exception_ptr error) {
+        render_error = error;
+        errors = std::move(result.errors);
+      };
+      run_async_render(*job);
+      channel->close(render_error, std::move(errors));
+    });
+    return stream_chunks(std::move(channel), std::move(producer));
+  }
+
+private:
+  // The producer is owned by the coroutine, and stopped and joined when the generator is destroyed
+  static Generator<std::string_view> stream_chunks(std::shared_ptr<OutputChannel> channel, [[maybe_unused]] std::jthread producer) {
+    while (const auto chunk = channel->next()) {
+      co_yield *chunk;
+    }
+    tl_render_errors_ = channel->get_render_errors();
+  }
+
+  // Take the snapshot of the environment for an asynchronous render
+  std::shared_ptr<AsyncRender> prepare_async_render(Template tmpl, json data) {
+    auto job = std::make_shared<AsyncRender>();
+    job->template_storage = template_storage_.load(std::memory_order_acquire);
+    job->function_storage = function_storage_.load(std::memory_order_acquire);
+    job->globals = globals_.load(std::memory_order_acquire);
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      job->config = render_config;
+      job->config_version = render_config_version_;
+    }
+    job->compiled = select_compiled(tmpl, job->template_storage, job->function_storage, job->config);
+    job->tmpl = std::move(tmpl);
+    job->data = std::move(data);
+    job->environment_id = id_;
+    return job;
+  }
+
+  RenderConfig render_config_snapshot() const {
+    // Copied under lock to avoid torn reads of callback_wrapper
+    // (std::function assignment is not atomic - concurrent read/write causes heap corruption)
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return render_config;
+  }
+
+  static void run_async_render(AsyncRender& job) {
+    RenderResult result;
+    std::exception_ptr error;
+    static thread_local ThreadRenderer cached;
+    const bool reuse = !cached.in_use;
+    try {
+      if (job.stop_token.stop_requested()) {
+        INJA_THROW(InterruptError("render was cancelled"));
+      }
+      if (std::chrono::steady_clock::now() > job.deadline) {
+        INJA_THROW(InterruptError("render deadline exceeded"));
+      }
+
+      std::unique_ptr<Renderer> own_renderer;
+      Renderer* renderer;
+      if (reuse) {
+        if (cached.renderer && cached.environment_id == job.environment_id && cached.config_version == job.config_version &&
+            cached.template_storage == job.template_storage && cached.function_storage == job.function_storage) {
+          cached.renderer->reset();
+        } else {
+          cached.renderer = std::make_unique<Renderer>(job.config, *job.template_storage, *job.function_storage);
+          cached.environment_id = job.environment_id;
+          cached.config_version = job.config_version;
+          cached.template_storage = job.template_storage;
+          cached.function_storage = job.function_storage;
+        }
+        cached.in_use = true;
+        renderer = cached.renderer.get();
+      } else {
+        own_renderer = std::make_unique<Renderer>(job.config, *job.template_storage, *job.function_storage);
+        renderer = own_renderer.get();
+      }
+
+      renderer->set_data_layers(job.globals ? std::vector<const json*> {&job.globals->values} : std::vector<const json*> {});
+      renderer->set_interruption(job.stop_token, job.deadline);
+      const Template& render_template = job.compiled ? job.compiled->tmpl : job.tmpl;
+      if (job.output != nullptr) {
+        renderer->render_to(*job.output, render_template, job.data);
+      } else {
+        std::ostringstream os;
+        renderer->render_to(os, render_template, job.data);
+        result.output = std::move(os).str();
+      }
+      result.errors = renderer->get_render_errors();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (reuse) {
+      cached.in_use = false;
+    }
+    job.on_complete(std::move(result), error);
+  }
+
+  // Split the inputs of a batch into chunks, each rendered by one reused renderer
+  template <class RenderOne>
+  void render_batch_chunks(const Template& tmpl, std::span<const json* const> inputs, ThreadPool* pool, const RenderOne& render_one) {
+    static const json empty_data = json::object();
+    if (inputs.empty()) {
+      return;
+    }
+
+    const auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    const auto func_storage = function_storage_.load(std::memory_order_acquire);
+    const auto globals = globals_.load(std::memory_order_acquire);
+    const RenderConfig config_snapshot = render_config_snapshot();
+
+    const auto compiled = select_compiled(tmpl, tmpl_storage, func_storage, config_snapshot);
+    const Template& render_template = compiled ? compiled->tmpl : tmpl;
+
+    const auto render_chunk = [&](size_t begin, size_t end) {
+      Renderer renderer(config_snapshot, *tmpl_storage, *func_storage);
+      if (globals) {
+        renderer.set_data_layers({&globals->values});
+      }
+      for (size_t i = begin; i < end; ++i) {
+        renderer.reset();
+        render_one(renderer, render_template, inputs[i] ? *inputs[i] : empty_data, i);
+      }
+    };
+
+    if (!pool || inputs.size() == 1) {
+      render_chunk(0, inputs.size());
+      return;
+    }
+
+    // A few chunks per worker to balance inputs of different cost
+    const size_t chunk_count = std::min(inputs.size(), pool->size() * 4);
+    const size_t chunk_size = (inputs.size() + chunk_count - 1) / chunk_count;
+    std::vector<std::future<void>> tasks;
+    tasks.reserve(chunk_count);
+    for (size_t begin = 0; begin < inputs.size(); begin += chunk_size) {
+      const size_t end = std::min(begin + chunk_size, inputs.size());
+      tasks.push_back(pool->submit([&render_chunk, begin, end]() { render_chunk(begin, end); }));
+    }
+
+    // The chunks reference this frame, so wait for all of them before rethrowing
+    for (const auto& task : tasks) {
+      pool->wait(task);
+    }
+    for (auto& task : tasks) {
+      task.get();
+    }
+  }
+
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const json& data, const DataProvider* provider,
+                          std::vector<const json*> lower_layers = {}) {
     // Clear thread-local errors at start of render
     tl_render_errors_.clear();
 
@@ -562,17 +1579,26 @@ public:
     auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
     auto func_storage = function_storage_.load(std::memory_order_acquire);
 
-    // Snapshot render_config under lock to avoid torn reads of callback_wrapper
-    // (std::function assignment is not atomic - concurrent read/write causes heap corruption)
-    RenderConfig config_snapshot;
-    {
-      std::lock_guard<std::mutex> lock(write_mutex_);
-      config_snapshot = render_config;
+    const RenderConfig config_snapshot = render_config_snapshot();
+
+    // Hot templates are rendered in their compiled form once it is ready
+    const Template* render_template = &tmpl;
+    const auto compiled = select_compiled(tmpl, tmpl_storage, func_storage, config_snapshot);
+    if (compiled) {
+      render_template = &compiled->tmpl;
     }
 
     // Create renderer with snapshots
     Renderer renderer(config_snapshot, *tmpl_storage, *func_storage);
-    renderer.render_to(os, tmpl, data);
+    // Globals are the lowest layer, and stay alive until the render is done
+    const auto globals = globals_.load(std::memory_order_acquire);
+    if (globals) {
+      lower_layers.push_back(&globals->values);
+    }
+
+    renderer.set_data_provider(provider);
+    renderer.set_data_layers(std::move(lower_layers));
+    renderer.render_to(os, *render_template, data);
 
     // Copy errors from Renderer to thread-local storage for thread-safe access
     tl_render_errors_ = renderer.get_render_errors();
@@ -580,10 +1606,95 @@ public:
     return os;
   }
 
-  std::ostream& render_to(std::ostream& os, std::string_view input, const json& data) {
-    return render_to(os, parse(input), data);
+
+  // Render the setup template of the globals and publish the variables it set
+  GlobalsReport update_globals(const Template& setup, const json& data, size_t refresh_count) {
+    tl_render_errors_.clear();
+
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    RenderConfig config_snapshot;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_snapshot = render_config;
+    }
+
+    auto scope = std::make_shared<GlobalScope>();
+    scope->setup = setup;
+    scope->data = data;
+    scope->values = json::object();
+
+    Renderer renderer(config_snapshot, *tmpl_storage, *func_storage);
+    std::ostringstream discarded_output;
+    const auto start = std::chrono::steady_clock::now();
+    renderer.render_to(discarded_output, scope->setup, scope->data);
+    scope->report.setup_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    tl_render_errors_ = renderer.get_render_errors();
+
+    // Only assigned variables, without the loop data and loop variables
+    const auto assigned = assigned_variables(scope->setup);
+    const auto& local_data = renderer.get_local_data();
+    for (auto it = local_data.begin(); it != local_data.end(); ++it) {
+      if (assigned.count(it.key()) > 0) {
+        scope->values[it.key()] = it.value();
+      }
+    }
+
+    scope->report.estimated_cost = estimate_cost(scope->setup, scope->data).estimated_cost;
+    scope->report.variable_count = scope->values.size();
+    scope->report.refresh_count = refresh_count;
+
+    const auto report = scope->report;
+    globals_.store(std::move(scope), std::memory_order_release);
+    return report;
+  }
+
+public:
+  /*!
+   * \brief Renders a setup template once and makes the variables it sets visible to all later renders (thread-safe).
+   *
+   * The variables are shared read-only: they are looked up after the data and
+   * layers of a render, and set statements of a render only change its local
+   * copy. The output of the setup template is discarded. Renders in progress
+   * keep the globals they started with.
+   */
+  GlobalsReport set_globals_from(const Template& setup, const json& data) {
+    return update_globals(setup, data, 1);
+  }
+
+  /// Renders the setup template of the globals again, e.g. after callbacks it calls return new values
+  GlobalsReport refresh_globals() {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    if (!globals) {
+      return GlobalsReport {};
+    }
+    return update_globals(globals->setup, globals->data, globals->report.refresh_count + 1);
+  }
+
+  /// Renders the setup template of the globals again with new data
+  GlobalsReport refresh_globals(const json& data) {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    if (!globals) {
+      return GlobalsReport {};
+    }
+    return update_globals(globals->setup, data, globals->report.refresh_count + 1);
+  }
+
+  void clear_globals() {
+    globals_.store(nullptr, std::memory_order_release);
+  }
+
+  /// Returns the variables set by the setup template, or null if there are no globals
+  json get_globals() const {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    return globals ? globals->values : json();
   }
-  
+
+  GlobalsReport get_globals_report() const {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    return globals ? globals->report : GlobalsReport {};
+  }
+
   // Note: get_last_render_errors() and clear_render_errors() are defined above
   // and use thread-local storage for thread-safety
 
@@ -592,6 +1703,25 @@ public:
     std::lock_guard<std::mutex> lock(write_mutex_);
     parser_config.graceful_errors = graceful;
     render_config.graceful_errors = graceful;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Sets a thread pool for rendering independent includes, blocks and loop iterations of a template concurrently (thread-safe).
+   *
+   * Sibling includes and block statements are rendered concurrently if they
+   * call only callbacks marked deterministic (see set_callback_deterministic())
+   * and block statements set no variables. Loops over arrays with at least
+   * min_loop_size elements are rendered in chunks if their body calls only
+   * deterministic callbacks, sets no variables and doesn't read the
+   * variables of its inner loops outside of them. The output and the errors
+   * are the same as of a serial render. A null pool renders serially.
+   */
+  void set_render_thread_pool(std::shared_ptr<ThreadPool> pool, size_t min_loop_size = 1024) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.thread_pool = std::move(pool);
+    render_config.concurrent_loop_size = min_loop_size;
+    ++render_config_version_;
   }
 
   std::string load_file(const std::string& filename) {
@@ -600,13 +1730,18 @@ public:
   }
 
   json load_json(const std::string& filename) {
-    std::ifstream file;
-    file.open(input_path / filename);
-    if (file.fail()) {
-      INJA_THROW(FileError("failed accessing file at '" + (input_path / filename).string() + "'"));
-    }
+    return load_data_file(input_path / filename, DataFormat::Json);
+  }
 
-    return json::parse(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  /*!
+   * \brief Loads a JSON, CBOR, MessagePack or BSON data file.
+   *
+   * With DataFormat::Auto, the format is taken from the file extension
+   * (`.json`, `.cbor`, `.msgpack`, `.mpk`, `.bson`) or else detected from the
+   * first bytes of the file. The file is memory mapped where supported.
+   */
+  json load_data(const std::string& filename, DataFormat format = DataFormat::Auto) {
+    return load_data_file(input_path / filename, format);
   }
 
   /*!
@@ -682,6 +1817,24 @@ public:
     function_storage_.store(new_storage, std::memory_order_release);
   }
 
+  /*!
+  @brief Marks a callback as deterministic within a render (thread-safe via copy-on-write)
+
+  Deterministic callbacks return the same result for the same arguments, so
+  optimized templates may reuse their results instead of calling them again.
+  */
+  void set_callback_deterministic(const std::string& name, int num_args, bool deterministic = true) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with the updated callback
+    auto current = function_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<FunctionStorage>(*current);
+    new_storage->set_deterministic(name, num_args, deterministic);
+
+    // Atomic swap - renders in progress keep using old storage
+    function_storage_.store(new_storage, std::memory_order_release);
+  }
+
   /** Includes a template with a given name into the environment.
    * Then, a template can be rendered in another template using the
    * include "<name>" syntax.
@@ -704,6 +1857,29 @@ public:
   */
   void set_include_callback(const std::function<Template(const std::filesystem::path&, const std::string&)>& callback) {
     parser_config.include_callback = callback;
+    include_cache_->clear();
+  }
+
+  /*!
+   * \brief Forgets how include names were resolved (thread-safe).
+   *
+   * Parsers remember which file an include name refers to, which names could
+   * not be found and the results of the include callback. Failed lookups and
+   * callback results are also dropped automatically once a file is added to
+   * the directory in which it would be found.
+   */
+  void clear_include_cache() {
+    include_cache_->clear();
+  }
+
+  /// Sets how often the directories of failed include lookups are checked for new files (thread-safe)
+  void set_include_cache_revalidate_interval(std::chrono::milliseconds interval) {
+    include_cache_->set_revalidate_interval(interval);
+  }
+
+  /// Returns the number of remembered include resolutions
+  size_t include_cache_size() const {
+    return include_cache_->size();
   }
 };
 
@@ -43,6 +43,10 @@ struct DataError : public InjaError {
   explicit DataError(const std::string& message, SourceLocation location): InjaError("data_error", message, location) {}
 };
 
+struct InterruptError : public InjaError {
+  explicit InterruptError(const std::string& message): InjaError("interrupt_error", message) {}
+};
+
 /*!
  * \brief Structure for tracking render errors in graceful mode
  */
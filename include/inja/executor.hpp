@@ -0,0 +1,34 @@
+#ifndef INCLUDE_INJA_EXECUTOR_HPP_
+#define INCLUDE_INJA_EXECUTOR_HPP_
+
+#include <chrono>
+#include <functional>
+#include <stop_token>
+
+namespace inja {
+
+/*!
+ * \brief Runs the tasks of asynchronous renders, e.g. on an existing thread pool or event loop.
+ *
+ * Every task must be run exactly once. Tasks may run on any thread and in any
+ * order, and never wait for other tasks of the executor.
+ */
+class Executor {
+public:
+  virtual ~Executor() = default;
+
+  virtual void execute(std::function<void()> task) = 0;
+};
+
+/*!
+ * \brief Options of an asynchronous render, see Environment::render_async().
+ */
+struct AsyncRenderOptions {
+  Executor* executor {nullptr}; // Runs the render, nullptr uses the thread pool of the environment
+  std::stop_token stop_token;   // Cancels the render once a stop is requested
+  std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_EXECUTOR_HPP_
@@ -90,49 +90,77 @@ public:
 
   struct FunctionData {
     explicit FunctionData(const Operation& op, const CallbackFunction& cb = CallbackFunction {},
-                          const InPlaceCallbackFunction& inplace_cb = InPlaceCallbackFunction {})
-        : operation(op), callback(cb), inplace_callback(inplace_cb) {}
+                          const InPlaceCallbackFunction& inplace_cb = InPlaceCallbackFunction {}, bool deterministic = false)
+        : operation(op), callback(cb), inplace_callback(inplace_cb), deterministic(deterministic) {}
     const Operation operation;
     const CallbackFunction callback;
     const InPlaceCallbackFunction inplace_callback;  // Optional: for self-assignment optimization
+    const bool deterministic;                        // Same arguments give the same result within a render
   };
 
+  struct BuiltinFunction {
+    std::string_view name;
+    int num_args;
+    Operation operation;
+  };
+
+  /// The builtin functions every storage starts with
+  static constexpr BuiltinFunction builtin_functions[] {
+      {"at", 2, Operation::At},
+      {"capitalize", 1, Operation::Capitalize},
+      {"default", 2, Operation::Default},
+      {"divisibleBy", 2, Operation::DivisibleBy},
+      {"even", 1, Operation::Even},
+      {"exists", 1, Operation::Exists},
+      {"existsIn", 2, Operation::ExistsInObject},
+      {"first", 1, Operation::First},
+      {"float", 1, Operation::Float},
+      {"int", 1, Operation::Int},
+      {"isArray", 1, Operation::IsArray},
+      {"isBoolean", 1, Operation::IsBoolean},
+      {"isFloat", 1, Operation::IsFloat},
+      {"isInteger", 1, Operation::IsInteger},
+      {"isNumber", 1, Operation::IsNumber},
+      {"isObject", 1, Operation::IsObject},
+      {"isString", 1, Operation::IsString},
+      {"last", 1, Operation::Last},
+      {"length", 1, Operation::Length},
+      {"lower", 1, Operation::Lower},
+      {"max", 1, Operation::Max},
+      {"min", 1, Operation::Min},
+      {"odd", 1, Operation::Odd},
+      {"range", 1, Operation::Range},
+      {"replace", 3, Operation::Replace},
+      {"round", 2, Operation::Round},
+      {"sort", 1, Operation::Sort},
+      {"upper", 1, Operation::Upper},
+      {"super", 0, Operation::Super},
+      {"super", 1, Operation::Super},
+      {"join", 2, Operation::Join},
+  };
+
+  /// Returns the operation of the builtin function with the name and number of arguments, or Operation::None
+  static constexpr Operation find_builtin(std::string_view name, int num_args) {
+    for (const auto& builtin : builtin_functions) {
+      if (builtin.name == name && builtin.num_args == num_args) {
+        return builtin.operation;
+      }
+    }
+    return Operation::None;
+  }
+
 private:
   const int VARIADIC {-1};
 
-  std::map<std::pair<std::string, int>, FunctionData> function_storage = {
-      {std::make_pair("at", 2), FunctionData {Operation::At}},
-      {std::make_pair("capitalize", 1), FunctionData {Operation::Capitalize}},
-      {std::make_pair("default", 2), FunctionData {Operation::Default}},
-      {std::make_pair("divisibleBy", 2), FunctionData {Operation::DivisibleBy}},
-      {std::make_pair("even", 1), FunctionData {Operation::Even}},
-      {std::make_pair("exists", 1), FunctionData {Operation::Exists}},
-      {std::make_pair("existsIn", 2), FunctionData {Operation::ExistsInObject}},
-      {std::make_pair("first", 1), FunctionData {Operation::First}},
-      {std::make_pair("float", 1), FunctionData {Operation::Float}},
-      {std::make_pair("int", 1), FunctionData {Operation::Int}},
-      {std::make_pair("isArray", 1), FunctionData {Operation::IsArray}},
-      {std::make_pair("isBoolean", 1), FunctionData {Operation::IsBoolean}},
-      {std::make_pair("isFloat", 1), FunctionData {Operation::IsFloat}},
-      {std::make_pair("isInteger", 1), FunctionData {Operation::IsInteger}},
-      {std::make_pair("isNumber", 1), FunctionData {Operation::IsNumber}},
-      {std::make_pair("isObject", 1), FunctionData {Operation::IsObject}},
-      {std::make_pair("isString", 1), FunctionData {Operation::IsString}},
-      {std::make_pair("last", 1), FunctionData {Operation::Last}},
-      {std::make_pair("length", 1), FunctionData {Operation::Length}},
-      {std::make_pair("lower", 1), FunctionData {Operation::Lower}},
-      {std::make_pair("max", 1), FunctionData {Operation::Max}},
-      {std::make_pair("min", 1), FunctionData {Operation::Min}},
-      {std::make_pair("odd", 1), FunctionData {Operation::Odd}},
-      {std::make_pair("range", 1), FunctionData {Operation::Range}},
-      {std::make_pair("replace", 3), FunctionData {Operation::Replace}},
-      {std::make_pair("round", 2), FunctionData {Operation::Round}},
-      {std::make_pair("sort", 1), FunctionData {Operation::Sort}},
-      {std::make_pair("upper", 1), FunctionData {Operation::Upper}},
-      {std::make_pair("super", 0), FunctionData {Operation::Super}},
-      {std::make_pair("super", 1), FunctionData {Operation::Super}},
-      {std::make_pair("join", 2), FunctionData {Operation::Join}},
-  };
+  static std::map<std::pair<std::string, int>, FunctionData> builtin_storage() {
+    std::map<std::pair<std::string, int>, FunctionData> result;
+    for (const auto& builtin : builtin_functions) {
+      result.emplace(std::make_pair(static_cast<std::string>(builtin.name), builtin.num_args), FunctionData {builtin.operation});
+    }
+    return result;
+  }
+
+  std::map<std::pair<std::string, int>, FunctionData> function_storage = builtin_storage();
 
 public:
   void add_builtin(std::string_view name, int num_args, Operation op) {
@@ -163,6 +191,26 @@ public:
                              FunctionData {Operation::Callback, callback, inplace_callback});
   }
 
+  /*!
+   * \brief Marks a callback as deterministic within a render.
+   *
+   * A deterministic callback returns the same result for the same arguments
+   * and has no side effects that the template depends on, so the optimizer
+   * may evaluate it once and reuse the result. Builtin functions are always
+   * deterministic (except super()).
+   */
+  void set_deterministic(std::string_view name, int num_args, bool deterministic = true) {
+    const auto key = std::make_pair(static_cast<std::string>(name), num_args);
+    auto it = function_storage.find(key);
+    if (it == function_storage.end() || it->second.operation != Operation::Callback) {
+      return;
+    }
+
+    FunctionData data {it->second.operation, it->second.callback, it->second.inplace_callback, deterministic};
+    function_storage.erase(it);
+    function_storage.emplace(key, std::move(data));
+  }
+
   FunctionData find_function(std::string_view name, int num_args) const {
     auto it = function_storage.find(std::make_pair(static_cast<std::string>(name), num_args));
     if (it != function_storage.end()) {
@@ -0,0 +1,59 @@
+#ifndef INCLUDE_INJA_GLOBALS_HPP_
+#define INCLUDE_INJA_GLOBALS_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <set>
+#include <string>
+
+#include "json.hpp"
+#include "node.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Cost of the global variables of an environment, see Environment::set_globals_from().
+ */
+struct GlobalsReport {
+  std::chrono::nanoseconds setup_time {0}; // Time of the last render of the setup template
+  double estimated_cost {0.0};             // Estimated render cost of the setup template, saved by every render using the globals
+  size_t variable_count {0};               // Number of top-level variables set by the setup template
+  size_t refresh_count {0};                // Number of renders of the setup template
+};
+
+/// Returns the top-level names of all variables assigned by set statements of the template
+inline std::set<std::string> assigned_variables(const Template& tmpl) {
+  std::set<std::string> result;
+  std::function<void(const BlockNode&)> collect = [&result, &collect](const BlockNode& block) {
+    for (const auto& node : block.nodes) {
+      if (const auto* set = dynamic_cast<const SetStatementNode*>(node.get())) {
+        result.insert(set->key.substr(0, set->key.find('.')));
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node.get())) {
+        collect(condition->true_statement);
+        collect(condition->false_statement);
+      } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(node.get())) {
+        collect(loop->body);
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node.get())) {
+        collect(block_statement->block);
+      }
+    }
+  };
+  collect(tmpl.root);
+  return result;
+}
+
+/*!
+ * \brief Variables set by a setup template, shared read-only by all renders of an environment.
+ */
+struct GlobalScope {
+  Template setup;
+  json data;   // Data the setup template is rendered with
+  json values; // Top-level variables set by the setup template
+  GlobalsReport report;
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_GLOBALS_HPP_
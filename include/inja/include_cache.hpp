@@ -0,0 +1,147 @@
+#ifndef INCLUDE_INJA_INCLUDE_CACHE_HPP_
+#define INCLUDE_INJA_INCLUDE_CACHE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+
+#include "template.hpp"
+#include "utils.hpp"
+
+namespace inja {
+
+/*!
+ * \brief How an include name was resolved from a directory.
+ */
+struct IncludeResolution {
+  enum class Kind {
+    File,     // Found as a file, the template is in the template storage
+    Callback, // Returned by the include callback
+    Missing,  // Neither a file nor an include callback
+  };
+
+  Kind kind;
+  std::string name; // Name of the template in the template storage, or of the missing file
+  Template tmpl;    // Result of the include callback
+
+  // Directory that would contain the file, a new file there takes precedence over the callback or the error
+  std::string directory;
+  int64_t directory_modification_time {0};
+  mutable std::atomic<int64_t> checked_at {0}; // Steady clock time of the last check of the directory
+};
+
+/*!
+ * \brief Remembers how include names were resolved, keyed by the directory of the including template and the name.
+ *
+ * Parsing templates with many includes doesn't need to build paths, open
+ * missing files or call the include callback again. Failed lookups and
+ * callback results are dropped once the modification time of the directory
+ * changed, checked at most once per revalidation interval.
+ */
+class IncludeCache {
+  using Key = std::pair<std::string, std::string>;
+
+  mutable std::shared_mutex mutex;
+  std::map<Key, std::shared_ptr<const IncludeResolution>> entries;
+  std::atomic<int64_t> revalidate_interval {std::chrono::nanoseconds(std::chrono::seconds(1)).count()};
+
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void add(const std::filesystem::path& directory, const std::string& name, std::shared_ptr<IncludeResolution> entry) {
+    if (!entry->directory.empty()) {
+      entry->directory_modification_time = file_modification_time(entry->directory);
+      entry->checked_at.store(now(), std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    entries.insert_or_assign(Key {directory.string(), name}, std::move(entry));
+  }
+
+public:
+  /// Returns the resolution of the name, or nullptr if it is unknown or outdated
+  std::shared_ptr<const IncludeResolution> find(const std::filesystem::path& directory, const std::string& name) {
+    const Key key {directory.string(), name};
+    std::shared_ptr<const IncludeResolution> entry;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      const auto it = entries.find(key);
+      if (it == entries.end()) {
+        return nullptr;
+      }
+      entry = it->second;
+    }
+
+    if (entry->directory.empty()) {
+      return entry;
+    }
+
+    const int64_t time = now();
+    if (time - entry->checked_at.load(std::memory_order_relaxed) < revalidate_interval.load(std::memory_order_relaxed)) {
+      return entry;
+    }
+    if (file_modification_time(entry->directory) != entry->directory_modification_time) {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      const auto it = entries.find(key);
+      if (it != entries.end() && it->second == entry) {
+        entries.erase(it);
+      }
+      return nullptr;
+    }
+    entry->checked_at.store(time, std::memory_order_relaxed);
+    return entry;
+  }
+
+  void add_file(const std::filesystem::path& directory, const std::string& name, const std::string& resolved_name) {
+    auto entry = std::make_shared<IncludeResolution>();
+    entry->kind = IncludeResolution::Kind::File;
+    entry->name = resolved_name;
+    add(directory, name, std::move(entry));
+  }
+
+  /// Adds a result of the include callback, with the directory in which a file would take precedence (if any)
+  void add_callback(const std::filesystem::path& directory, const std::string& name, const std::string& resolved_name, const Template& tmpl,
+                    const std::string& file_directory) {
+    auto entry = std::make_shared<IncludeResolution>();
+    entry->kind = IncludeResolution::Kind::Callback;
+    entry->name = resolved_name;
+    entry->tmpl = tmpl;
+    entry->directory = file_directory;
+    add(directory, name, std::move(entry));
+  }
+
+  void add_missing(const std::filesystem::path& directory, const std::string& name, const std::string& resolved_name, const std::string& file_directory) {
+    auto entry = std::make_shared<IncludeResolution>();
+    entry->kind = IncludeResolution::Kind::Missing;
+    entry->name = resolved_name;
+    entry->directory = file_directory;
+    add(directory, name, std::move(entry));
+  }
+
+  /// Sets how often the directories of failed lookups and callback results are checked for changes
+  void set_revalidate_interval(std::chrono::nanoseconds interval) {
+    revalidate_interval.store(interval.count(), std::memory_order_relaxed);
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return entries.size();
+  }
+
+  void clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    entries.clear();
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_INCLUDE_CACHE_HPP_
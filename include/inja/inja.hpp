@@ -27,11 +27,30 @@ SOFTWARE.
 
 #include "json.hpp"
 #include "throw.hpp"
+#include "analysis.hpp"
+#include "bundle.hpp"
+#include "compiler.hpp"
+#include "cost.hpp"
+#include "data_file.hpp"
+#include "data_provider.hpp"
 #include "environment.hpp"
 #include "exceptions.hpp"
+#include "executor.hpp"
+#include "globals.hpp"
+#include "include_cache.hpp"
+#include "native.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "preload.hpp"
+#include "projection.hpp"
+#include "reflect.hpp"
 #include "renderer.hpp"
+#include "specializer.hpp"
+#include "static_template.hpp"
+#include "stream.hpp"
 #include "template.hpp"
+#include "thread_pool.hpp"
+#include "watcher.hpp"
 #include "callback_cache.hpp"
 
 #endif // INCLUDE_INJA_INJA_HPP_
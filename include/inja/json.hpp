@@ -4,6 +4,24 @@
 #include <nlohmann/json.hpp>
 
 namespace inja {
+/*!
+ * \brief The data type of inja, nlohmann::json unless INJA_DATA_TYPE is defined before including inja.
+ *
+ * Any specialization of nlohmann::basic_json can be used, e.g.
+ * nlohmann::ordered_json to keep the insertion order of objects and to look
+ * up keys of small objects by a linear search instead of a tree. The
+ * renderer doesn't keep references into objects it inserts into, so object
+ * types that move their values on insertion are fine.
+ *
+ * The data type is chosen once per program, not per environment: all inja
+ * classes use it directly instead of being templates on it. Every
+ * translation unit that includes inja must see the same INJA_DATA_TYPE, so
+ * define it for the whole target (e.g. with target_compile_definitions)
+ * instead of in a single source file. Translation units with different data
+ * types would give the same inja classes different layouts, which violates
+ * the one definition rule. In particular, environments with nlohmann::json
+ * and nlohmann::ordered_json can't be mixed in one program.
+ */
 #ifndef INJA_DATA_TYPE
 using json = nlohmann::json;
 #else
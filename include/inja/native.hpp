@@ -0,0 +1,578 @@
+#ifndef INCLUDE_INJA_NATIVE_HPP_
+#define INCLUDE_INJA_NATIVE_HPP_
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <numeric>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "function_storage.hpp"
+#include "node.hpp"
+#include "renderer.hpp"
+#include "template.hpp"
+#include "throw.hpp"
+#include "utils.hpp"
+
+namespace inja {
+
+class NativeRender;
+
+/// Render function of a template, generated by inja_compile
+using NativeFunction = void (*)(NativeRender&);
+
+/*!
+ * \brief State of a render by the native render functions that inja_compile generates from templates.
+ *
+ * The generated code writes the text of a template and evaluates its
+ * expressions and statements directly. It calls these helpers for variable
+ * lookups, builtin functions, callbacks and loops, which have the semantics of
+ * the Renderer. Templates that were not compiled, e.g. ones added to the
+ * environment at runtime, are rendered by a Renderer with the same data.
+ */
+class NativeRender {
+public:
+  using Path = std::span<const std::string_view>; // Keys of a variable, as in its json pointer
+
+private:
+  std::ostream* output_stream;
+  const json* data_input;
+  const std::vector<const json*>* data_layers; // Data below the input, from top to bottom
+  const RenderConfig* config;
+  const TemplateStorage* template_storage;
+  const FunctionStorage* function_storage;
+
+  /// Returns the value at the path, with the semantics of json::contains() for json pointers, or nullptr
+  static const json* find_in(const json& data, Path path) {
+    const json* result = &data;
+    for (const auto key : path) {
+      if (result->is_object()) {
+        const auto it = result->find(key);
+        if (it == result->end()) {
+          return nullptr;
+        }
+        result = &*it;
+
+      } else if (result->is_array()) {
+        if (key.empty() || (key.size() > 1 && key[0] == '0') ||
+            !std::all_of(key.begin(), key.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) {
+          return nullptr;
+        }
+        size_t index {0};
+        for (const char c : key) {
+          index = index * 10 + static_cast<size_t>(c - '0');
+        }
+        if (index >= result->size()) {
+          return nullptr;
+        }
+        result = &(*result)[index];
+
+      } else {
+        return nullptr;
+      }
+    }
+    return result;
+  }
+
+  static json::number_integer_t integer_value(const json& value) {
+    if (const auto* integer = value.get_ptr<const json::number_integer_t*>()) {
+      return *integer;
+    }
+    return static_cast<json::number_integer_t>(*value.get_ptr<const json::number_unsigned_t*>());
+  }
+
+  static json::number_float_t float_value(const json& value) {
+    if (const auto* number = value.get_ptr<const json::number_float_t*>()) {
+      return *number;
+    } else if (const auto* number_unsigned = value.get_ptr<const json::number_unsigned_t*>()) {
+      return static_cast<json::number_float_t>(*number_unsigned);
+    }
+    return static_cast<json::number_float_t>(*value.get_ptr<const json::number_integer_t*>());
+  }
+
+public:
+  json local = json::object({{"loop", nullptr}}); // Variables set by the template and the loop data, as the local data of the Renderer
+
+  explicit NativeRender(std::ostream& os, const json& data, const std::vector<const json*>& layers, const RenderConfig& config,
+                        const TemplateStorage& template_storage, const FunctionStorage& function_storage)
+      : output_stream(&os), data_input(&data), data_layers(&layers), config(&config), template_storage(&template_storage),
+        function_storage(&function_storage) {}
+
+  /// Returns the state for rendering an included template, which starts with a copy of the local data
+  NativeRender include_scope() const {
+    return *this;
+  }
+
+  /// Renders a template that was not compiled with the interpreter, as an include with the local data
+  void interpret(const Template& tmpl) {
+    Renderer renderer(*config, *template_storage, *function_storage);
+    renderer.set_data_layers(*data_layers);
+    renderer.render_to(*output_stream, tmpl, *data_input, &local);
+  }
+
+  /// Renders an include of a template that was not compiled, looking it up in the environment
+  void include(const std::string& name, const SourceLocation& loc) {
+    const auto it = template_storage->find(name);
+    if (it != template_storage->end()) {
+      include_scope().interpret(it->second);
+    } else if (config->throw_at_missing_includes) {
+      fail("include '" + name + "' not found", loc);
+    }
+  }
+
+  void write(std::string_view text) {
+    output_stream->write(text.data(), static_cast<std::streamsize>(text.size()));
+  }
+
+  void print(const json& value) {
+    if (value.is_string()) {
+      if (config->html_autoescape) {
+        *output_stream << htmlescape(value.get_ref<const json::string_t&>());
+      } else {
+        *output_stream << value.get_ref<const json::string_t&>();
+      }
+    } else if (value.is_number_unsigned()) {
+      *output_stream << value.get<const json::number_unsigned_t>();
+    } else if (value.is_number_integer()) {
+      *output_stream << value.get<const json::number_integer_t>();
+    } else if (!value.is_null()) {
+      *output_stream << value.dump();
+    }
+  }
+
+  void print(bool value) {
+    write(value ? "true" : "false");
+  }
+
+  /// Returns the variable from the local data or the input, or nullptr
+  const json* find(Path path) const {
+    if (const json* value = find_in(local, path)) {
+      return value;
+    }
+    if (const json* value = find_in(*data_input, path)) {
+      return value;
+    }
+    for (const json* layer : *data_layers) {
+      if (const json* value = find_in(*layer, path)) {
+        return value;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Returns the variable, or the result of a callback without arguments of its name stored in result, or nullptr
+  const json* lookup(Path path, std::string_view name, json& result) const {
+    if (const json* value = find(path)) {
+      return value;
+    }
+
+    const auto function_data = function_storage->find_function(name, 0);
+    if (function_data.operation != FunctionStorage::Operation::Callback) {
+      return nullptr;
+    }
+    result = call(function_data, static_cast<std::string>(name), {});
+    return &result;
+  }
+
+  /*!
+   * \brief Returns the variable like lookup(), but throws if it was not found.
+   *
+   * With copy_local, a value of the local data is copied into result, so that
+   * it stays valid while the local data changes, e.g. for the source of a loop.
+   */
+  const json& get(Path path, std::string_view name, json& result, const SourceLocation& loc, bool copy_local = false) const {
+    if (copy_local) {
+      if (const json* value = find_in(local, path)) {
+        result = *value;
+        return result;
+      }
+    }
+
+    const json* value = lookup(path, name, result);
+    if (value == nullptr) {
+      fail("variable '" + static_cast<std::string>(name) + "' not found", loc);
+    }
+    return *value;
+  }
+
+  /// Returns whether the variable of the given name is in the input data
+  bool exists(const json& name) const {
+    const auto ptr = json::json_pointer(DataNode::convert_dot_to_ptr(name.get_ref<const json::string_t&>()));
+    if (data_input->contains(ptr)) {
+      return true;
+    }
+    return std::any_of(data_layers->begin(), data_layers->end(), [&ptr](const json* layer) { return layer->contains(ptr); });
+  }
+
+  /// Returns the registered callback of the function, which is resolved at render time
+  FunctionStorage::FunctionData function(std::string_view name, int num_args, const SourceLocation& loc) const {
+    auto function_data = function_storage->find_function(name, num_args);
+    if (!function_data.callback) {
+      fail("function '" + static_cast<std::string>(name) + "' not found or has no callback", loc);
+    }
+    return function_data;
+  }
+
+  json call(const FunctionStorage::FunctionData& function_data, const std::string& name, Arguments args) const {
+    if (config->callback_wrapper) {
+      return config->callback_wrapper(name, args, [&]() { return function_data.callback(args); });
+    }
+    return function_data.callback(args);
+  }
+
+  void set(const json::json_pointer& ptr, json value) {
+    local[ptr] = std::move(value);
+  }
+
+  void bind(const std::string& name, const json& value) {
+    local[name] = value;
+  }
+
+  void unbind(const std::string& name) {
+    local[name].clear();
+  }
+
+  void enter_loop(size_t size) {
+    json& loop = local["loop"];
+    if (!loop.empty()) {
+      json parent = std::move(loop);
+      loop = json::object();
+      loop["parent"] = std::move(parent);
+    }
+    loop["is_first"] = true;
+    loop["is_last"] = (size <= 1);
+  }
+
+  void update_loop(size_t index, size_t size) {
+    json& loop = local["loop"];
+    loop["index"] = index;
+    loop["index1"] = index + 1;
+    if (index == 1) {
+      loop["is_first"] = false;
+    }
+    if (index == size - 1) {
+      loop["is_last"] = true;
+    }
+  }
+
+  void leave_loop() {
+    json& loop = local["loop"];
+    if (!loop["parent"].empty()) {
+      json parent = std::move(loop["parent"]);
+      loop = std::move(parent);
+    }
+  }
+
+  static bool truthy(const json& value) {
+    return Renderer::truthy(&value);
+  }
+
+  [[noreturn]] static void fail(const std::string& message, const SourceLocation& loc) {
+    INJA_THROW(RenderError(message, loc));
+  }
+
+  /// Rethrows the current exception as the failure of a builtin function
+  [[noreturn]] static void fail_operation(std::string_view name, const SourceLocation& loc) {
+    try {
+      throw;
+    } catch (const std::exception& e) {
+      fail("operation '" + static_cast<std::string>(name) + "' failed: " + e.what(), loc);
+    } catch (...) {
+      fail("operation '" + static_cast<std::string>(name) + "' failed with unknown exception", loc);
+    }
+  }
+
+  /// Rethrows the current exception as the failure of a set statement
+  [[noreturn]] static void fail_set(const std::string& key, const SourceLocation& loc) {
+    try {
+      throw;
+    } catch (const std::exception& e) {
+      fail("failed to set variable '" + key + "': " + e.what(), loc);
+    } catch (...) {
+      fail("failed to set variable '" + key + "' with unknown exception", loc);
+    }
+  }
+
+  /// Returns the name of a builtin function whose errors are reported as its failure, like in the Renderer, or nullptr
+  static constexpr const char* builtin_name(FunctionStorage::Operation operation) {
+    using Op = FunctionStorage::Operation;
+    switch (operation) {
+    case Op::Add:
+      return "add";
+    case Op::Subtract:
+      return "subtract";
+    case Op::Multiplication:
+      return "multiply";
+    case Op::Division:
+      return "division";
+    case Op::Power:
+      return "power";
+    case Op::Modulo:
+      return "modulo";
+    case Op::Capitalize:
+      return "capitalize";
+    case Op::DivisibleBy:
+      return "divisibleBy";
+    case Op::Even:
+      return "even";
+    case Op::Exists:
+      return "exists";
+    case Op::ExistsInObject:
+      return "existsIn";
+    case Op::First:
+      return "first";
+    case Op::Float:
+      return "float";
+    case Op::Int:
+      return "int";
+    case Op::Last:
+      return "last";
+    case Op::Length:
+      return "length";
+    case Op::Lower:
+      return "lower";
+    case Op::Max:
+      return "max";
+    case Op::Min:
+      return "min";
+    case Op::Odd:
+      return "odd";
+    case Op::Range:
+      return "range";
+    case Op::Replace:
+      return "replace";
+    case Op::Round:
+      return "round";
+    case Op::Sort:
+      return "sort";
+    case Op::Upper:
+      return "upper";
+    case Op::Join:
+      return "join";
+    default:
+      return nullptr;
+    }
+  }
+
+  /// Compares two values with the same semantics as the json comparison operators
+  template <typename Compare> static bool compare(const json& lhs, const json& rhs, Compare compare) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      if (lhs.is_number_unsigned() && rhs.is_number_unsigned()) {
+        return compare(lhs.get_ref<const json::number_unsigned_t&>(), rhs.get_ref<const json::number_unsigned_t&>());
+      }
+      return compare(integer_value(lhs), integer_value(rhs));
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return compare(float_value(lhs), float_value(rhs));
+    } else if (lhs.is_string() && rhs.is_string()) {
+      return compare(lhs.get_ref<const json::string_t&>(), rhs.get_ref<const json::string_t&>());
+    }
+    return compare(lhs, rhs);
+  }
+
+  static bool in(const json& value, const json& container) {
+    return std::find(container.begin(), container.end(), value) != container.end();
+  }
+
+  static json add(const json& lhs, const json& rhs) {
+    if (lhs.is_string() && rhs.is_string()) {
+      return lhs.get_ref<const json::string_t&>() + rhs.get_ref<const json::string_t&>();
+    } else if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return integer_value(lhs) + integer_value(rhs);
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return float_value(lhs) + float_value(rhs);
+    }
+    return lhs.get<const json::number_float_t>() + rhs.get<const json::number_float_t>();
+  }
+
+  static json subtract(const json& lhs, const json& rhs) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return integer_value(lhs) - integer_value(rhs);
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return float_value(lhs) - float_value(rhs);
+    }
+    return lhs.get<const json::number_float_t>() - rhs.get<const json::number_float_t>();
+  }
+
+  static json multiply(const json& lhs, const json& rhs) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return integer_value(lhs) * integer_value(rhs);
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return float_value(lhs) * float_value(rhs);
+    }
+    return lhs.get<const json::number_float_t>() * rhs.get<const json::number_float_t>();
+  }
+
+  static json divide(const json& lhs, const json& rhs, const SourceLocation& loc) {
+    if (rhs.get<const json::number_float_t>() == 0) {
+      fail("division by zero", loc);
+    }
+    return lhs.get<const json::number_float_t>() / rhs.get<const json::number_float_t>();
+  }
+
+  static json power(const json& base, const json& exponent) {
+    if (base.is_number_integer() && exponent.get<const json::number_integer_t>() >= 0) {
+      return static_cast<json::number_integer_t>(std::pow(base.get<const json::number_integer_t>(), exponent.get<const json::number_integer_t>()));
+    }
+    return std::pow(base.get<const json::number_float_t>(), exponent.get<const json::number_integer_t>());
+  }
+
+  static json modulo(const json& lhs, const json& rhs) {
+    return lhs.get<const json::number_integer_t>() % rhs.get<const json::number_integer_t>();
+  }
+
+  /// Returns the member of an object or the element of an array
+  static const json& at(const json& container, const json& key, const SourceLocation& loc) {
+    if (container.is_object()) {
+      const auto name = key.get<std::string>();
+      if (!container.contains(name)) {
+        fail("key '" + name + "' not found in object", loc);
+      }
+      return container.at(name);
+    } else if (container.is_array()) {
+      const auto index = key.get<int>();
+      if (index < 0 || static_cast<size_t>(index) >= container.size()) {
+        fail("index " + std::to_string(index) + " out of bounds", loc);
+      }
+      return container.at(static_cast<size_t>(index));
+    }
+    fail("cannot access element on non-container type", loc);
+  }
+
+  /// Returns the member of the container after a dot, which is null if the container was not found
+  static const json& member(const json* container, const std::string& name, const SourceLocation& loc) {
+    if (container == nullptr || !container->contains(name)) {
+      fail("member '" + name + "' not found in container", loc);
+    }
+    return container->at(name);
+  }
+
+  static json capitalize(const json& value) {
+    auto result = value.get<json::string_t>();
+    result[0] = static_cast<char>(::toupper(result[0]));
+    std::transform(result.begin() + 1, result.end(), result.begin() + 1, [](char c) { return static_cast<char>(::tolower(c)); });
+    return result;
+  }
+
+  static bool divisible_by(const json& value, const json& divisor) {
+    const auto number = divisor.get<const json::number_integer_t>();
+    return (number != 0) && (value.get<const json::number_integer_t>() % number == 0);
+  }
+
+  static bool even(const json& value) {
+    return value.get<const json::number_integer_t>() % 2 == 0;
+  }
+
+  static bool odd(const json& value) {
+    return value.get<const json::number_integer_t>() % 2 != 0;
+  }
+
+  static bool exists_in(const json& object, const json& name) {
+    return object.find(name.get_ref<const json::string_t&>()) != object.end();
+  }
+
+  static const json& first(const json& value, const SourceLocation& loc) {
+    if (value.empty()) {
+      fail("cannot get first element of empty array", loc);
+    }
+    return value.front();
+  }
+
+  static const json& last(const json& value, const SourceLocation& loc) {
+    if (value.empty()) {
+      fail("cannot get last element of empty array", loc);
+    }
+    return value.back();
+  }
+
+  static json to_float(const json& value) {
+    return std::stod(value.get_ref<const json::string_t&>());
+  }
+
+  static json to_int(const json& value) {
+    return std::stoi(value.get_ref<const json::string_t&>());
+  }
+
+  static json length(const json& value) {
+    if (value.is_string()) {
+      return value.get_ref<const json::string_t&>().length();
+    }
+    return value.size();
+  }
+
+  static json lower(const json& value) {
+    auto result = value.get<json::string_t>();
+    std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+    return result;
+  }
+
+  static json upper(const json& value) {
+    auto result = value.get<json::string_t>();
+    std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::toupper(c)); });
+    return result;
+  }
+
+  static const json& max(const json& value) {
+    return *std::max_element(value.begin(), value.end());
+  }
+
+  static const json& min(const json& value) {
+    return *std::min_element(value.begin(), value.end());
+  }
+
+  static json range(const json& value) {
+    std::vector<int> result(value.get<const json::number_integer_t>());
+    std::iota(result.begin(), result.end(), 0);
+    return result;
+  }
+
+  static json replace(const json& value, const json& from, const json& to) {
+    auto result = value.get<std::string>();
+    replace_substring(result, from.get<std::string>(), to.get<std::string>());
+    return result;
+  }
+
+  static json round(const json& value, const json& precision) {
+    const auto digits = precision.get<const json::number_integer_t>();
+    const double result = std::round(value.get<const json::number_float_t>() * std::pow(10.0, digits)) / std::pow(10.0, digits);
+    if (digits == 0) {
+      return static_cast<int>(result);
+    }
+    return result;
+  }
+
+  static json sort(const json& value) {
+    auto result = value.get<std::vector<json>>();
+    std::sort(result.begin(), result.end());
+    return json(std::move(result));
+  }
+
+  static json join(const json& values, const json& separator) {
+    const auto sep = separator.get<json::string_t>();
+    std::ostringstream os;
+    std::string current_sep;
+    for (const auto& value : values) {
+      os << current_sep;
+      if (value.is_string()) {
+        os << value.get<std::string>(); // otherwise the value is surrounded with ""
+      } else {
+        os << value.dump();
+      }
+      current_sep = sep;
+    }
+    return os.str();
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_NATIVE_HPP_
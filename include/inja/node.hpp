@@ -1,6 +1,7 @@
 #ifndef INCLUDE_INJA_NODE_HPP_
 #define INCLUDE_INJA_NODE_HPP_
 
+#include <atomic>
 #include <cstddef>
 #include <memory>
 #include <string>
@@ -14,6 +15,8 @@
 
 namespace inja {
 
+struct Template;
+
 class NodeVisitor;
 class BlockNode;
 class TextNode;
@@ -105,6 +108,7 @@ public:
   const json value;
 
   explicit LiteralNode(std::string_view data_text, size_t pos): ExpressionNode(pos), value(json::parse(data_text)) {}
+  explicit LiteralNode(const json& value, size_t pos): ExpressionNode(pos), value(value) {}
 
   void accept(NodeVisitor& v) const override {
     v.visit(*this);
@@ -115,6 +119,17 @@ class DataNode : public ExpressionNode {
 public:
   const std::string name;
   const json::json_pointer ptr;
+  const std::vector<std::string> path; // Keys of the name split at dots, for lookups in a DataProvider
+
+  static std::vector<std::string> split_dots(std::string_view ptr_name) {
+    std::vector<std::string> result;
+    do {
+      std::string_view part;
+      std::tie(part, ptr_name) = string_view::split(ptr_name, '.');
+      result.emplace_back(part);
+    } while (!ptr_name.empty());
+    return result;
+  }
 
   static std::string convert_dot_to_ptr(std::string_view ptr_name) {
     std::string result;
@@ -127,13 +142,51 @@ public:
     return result;
   }
 
-  explicit DataNode(std::string_view ptr_name, size_t pos): ExpressionNode(pos), name(ptr_name), ptr(json::json_pointer(convert_dot_to_ptr(ptr_name))) {}
+  explicit DataNode(std::string_view ptr_name, size_t pos): ExpressionNode(pos), name(ptr_name), ptr(json::json_pointer(convert_dot_to_ptr(ptr_name))), path(split_dots(ptr_name)) {}
 
   void accept(NodeVisitor& v) const override {
     v.visit(*this);
   }
 };
 
+/*!
+ * \brief Types of both operands of a binary operation.
+ */
+enum class OperandTypes : unsigned char {
+  Unknown,
+  Integer, // Both are integers (signed or unsigned)
+  Float,   // Both are numbers, at least one of them a float
+  String,  // Both are strings
+  Other,
+};
+
+/*!
+ * \brief Operand types last seen by an operation, to select a specialized kernel.
+ *
+ * Concurrent renders of the same template share the cache; a stale value
+ * only costs a failed type check.
+ */
+class OperandTypeCache {
+  std::atomic<OperandTypes> types {OperandTypes::Unknown};
+
+public:
+  OperandTypeCache() = default;
+  OperandTypeCache(const OperandTypeCache& other): types(other.get()) {}
+
+  OperandTypeCache& operator=(const OperandTypeCache& other) {
+    set(other.get());
+    return *this;
+  }
+
+  OperandTypes get() const {
+    return types.load(std::memory_order_relaxed);
+  }
+
+  void set(OperandTypes new_types) {
+    types.store(new_types, std::memory_order_relaxed);
+  }
+};
+
 class FunctionNode : public ExpressionNode {
   using Op = FunctionStorage::Operation;
 
@@ -153,102 +206,71 @@ public:
   std::vector<std::shared_ptr<ExpressionNode>> arguments;
   CallbackFunction callback;
 
-  explicit FunctionNode(std::string_view name, size_t pos)
-      : ExpressionNode(pos), precedence(8), associativity(Associativity::Left), operation(Op::Callback), name(name), number_args(0) {}
-  explicit FunctionNode(Op operation, size_t pos): ExpressionNode(pos), operation(operation), number_args(1) {
+  // Render-time memoization, annotated by the Optimizer (see optimizer.hpp)
+  mutable const FunctionNode* memo_key {nullptr};     // Nodes with the same key share their cached result
+  mutable std::vector<std::string> memo_dependencies; // Variables whose assignment invalidates the result
+
+  // Operand types of the last evaluation of a comparison or arithmetic operation
+  mutable OperandTypeCache operand_types;
+
+  struct OperatorProperties {
+    int number_args;
+    unsigned int precedence;
+    Associativity associativity;
+  };
+
+  /// Returns the number of arguments, precedence and associativity of an operator
+  static constexpr OperatorProperties operator_properties(Op operation) {
     switch (operation) {
-    case Op::Not: {
-      number_args = 1;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::And: {
-      number_args = 2;
-      precedence = 1;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Or: {
-      number_args = 2;
-      precedence = 1;
-      associativity = Associativity::Left;
-    } break;
-    case Op::In: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Equal: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::NotEqual: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Greater: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::GreaterEqual: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Less: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::LessEqual: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Add: {
-      number_args = 2;
-      precedence = 3;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Subtract: {
-      number_args = 2;
-      precedence = 3;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Multiplication: {
-      number_args = 2;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Division: {
-      number_args = 2;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Power: {
-      number_args = 2;
-      precedence = 5;
-      associativity = Associativity::Right;
-    } break;
-    case Op::Modulo: {
-      number_args = 2;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::AtId: {
-      number_args = 2;
-      precedence = 8;
-      associativity = Associativity::Left;
-    } break;
-    default: {
-      precedence = 1;
-      associativity = Associativity::Left;
-    }
+    case Op::Not:
+      return {1, 4, Associativity::Left};
+    case Op::And:
+      return {2, 1, Associativity::Left};
+    case Op::Or:
+      return {2, 1, Associativity::Left};
+    case Op::In:
+      return {2, 2, Associativity::Left};
+    case Op::Equal:
+      return {2, 2, Associativity::Left};
+    case Op::NotEqual:
+      return {2, 2, Associativity::Left};
+    case Op::Greater:
+      return {2, 2, Associativity::Left};
+    case Op::GreaterEqual:
+      return {2, 2, Associativity::Left};
+    case Op::Less:
+      return {2, 2, Associativity::Left};
+    case Op::LessEqual:
+      return {2, 2, Associativity::Left};
+    case Op::Add:
+      return {2, 3, Associativity::Left};
+    case Op::Subtract:
+      return {2, 3, Associativity::Left};
+    case Op::Multiplication:
+      return {2, 4, Associativity::Left};
+    case Op::Division:
+      return {2, 4, Associativity::Left};
+    case Op::Power:
+      return {2, 5, Associativity::Right};
+    case Op::Modulo:
+      return {2, 4, Associativity::Left};
+    case Op::AtId:
+      return {2, 8, Associativity::Left};
+    default:
+      return {1, 1, Associativity::Left};
     }
   }
 
+  explicit FunctionNode(std::string_view name, size_t pos)
+      : ExpressionNode(pos), precedence(8), associativity(Associativity::Left), operation(Op::Callback), name(name), number_args(0) {}
+
+  explicit FunctionNode(Op operation, size_t pos): ExpressionNode(pos), operation(operation) {
+    const auto properties = operator_properties(operation);
+    number_args = properties.number_args;
+    precedence = properties.precedence;
+    associativity = properties.associativity;
+  }
+
   void accept(NodeVisitor& v) const override {
     v.visit(*this);
   }
@@ -330,6 +352,7 @@ public:
 class IncludeStatementNode : public StatementNode {
 public:
   const std::string file;
+  const Template* linked {nullptr}; // Included template resolved ahead of time, see TemplateCompiler and inja_compile
 
   explicit IncludeStatementNode(const std::string& file, size_t pos): StatementNode(pos), file(file) {}
 
@@ -341,6 +364,7 @@ public:
 class ExtendsStatementNode : public StatementNode {
 public:
   const std::string file;
+  const Template* linked {nullptr}; // Parent template resolved ahead of time, see inja_compile
 
   explicit ExtendsStatementNode(const std::string& file, size_t pos): StatementNode(pos), file(file) {}
 
@@ -0,0 +1,338 @@
+#ifndef INCLUDE_INJA_OPTIMIZER_HPP_
+#define INCLUDE_INJA_OPTIMIZER_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "function_storage.hpp"
+#include "node.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Statistics of an optimizer run.
+ */
+struct OptimizerStats {
+  /// Expressions within loops that are evaluated once instead of in every iteration
+  size_t hoisted_expressions {0};
+  /// Repeated occurrences of identical expressions that reuse the result of the first one
+  size_t eliminated_evaluations {0};
+};
+
+/*!
+ * \brief Collects all variables assigned within a block.
+ *
+ * These are the targets of set statements, the loop variables and `loop`
+ * for every loop. Only the first part of a dotted name is recorded.
+ */
+class AssignmentCollector : public NodeVisitor {
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+  void visit(const LiteralNode&) override {}
+  void visit(const DataNode&) override {}
+  void visit(const FunctionNode&) override {}
+  void visit(const ExpressionListNode&) override {}
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    variables.insert(root_name(node.value));
+    node.body.accept(*this);
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    variables.insert(root_name(node.key));
+    variables.insert(root_name(node.value));
+    node.body.accept(*this);
+  }
+
+  void visit(const IfStatementNode& node) override {
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
+
+  void visit(const IncludeStatementNode&) override {}
+  void visit(const ExtendsStatementNode&) override {}
+
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+  }
+
+  void visit(const SetStatementNode& node) override {
+    variables.insert(root_name(node.key));
+  }
+
+  void visit(const RawStatementNode&) override {}
+
+public:
+  std::set<std::string> variables {"loop"};
+
+  static std::string root_name(std::string_view name) {
+    return static_cast<std::string>(name.substr(0, name.find_first_of("./")));
+  }
+};
+
+/*!
+ * \brief An AST pass annotating expressions for render-time memoization.
+ *
+ * Pure expressions within a loop body that do not depend on any variable
+ * assigned in the body (the loop variables, `loop` and set statements) are
+ * loop invariant. They are marked to be cached by the renderer at their first
+ * evaluation, so that following iterations reuse the value.
+ *
+ * Structurally identical pure expressions anywhere in the template share a
+ * single cache entry, so repeated occurrences reuse the first result.
+ *
+ * The renderer drops a cached value whenever one of its variables is
+ * assigned, so the output stays identical to the unoptimized template.
+ * Builtin functions are pure except for super(); callbacks are pure only if
+ * they were marked deterministic in the function storage.
+ */
+class Optimizer : public NodeVisitor {
+  using Op = FunctionStorage::Operation;
+
+  /// An expression of the template, with the variables assigned by its innermost loop body
+  struct Expression {
+    const ExpressionNode* root;
+    std::shared_ptr<const std::set<std::string>> loop_assignments;
+  };
+
+  /// Signature and dependencies of a pure function call
+  struct PureFunction {
+    std::string signature;
+    std::set<std::string> dependencies;
+  };
+
+  const FunctionStorage& function_storage;
+
+  OptimizerStats stats;
+  std::vector<Expression> expressions;
+  std::vector<std::shared_ptr<const std::set<std::string>>> loop_assignments;
+  std::map<const FunctionNode*, PureFunction> pure_functions;
+
+  static std::string root_name(std::string_view name) {
+    return AssignmentCollector::root_name(name);
+  }
+
+  /// Computes the structural signature and the variables of an expression; returns false if it is not pure
+  bool describe(const ExpressionNode& expression, std::string& signature, std::set<std::string>& dependencies) {
+    if (const auto* literal = dynamic_cast<const LiteralNode*>(&expression)) {
+      signature += literal->value.dump();
+      return true;
+
+    } else if (const auto* data = dynamic_cast<const DataNode*>(&expression)) {
+      // Unknown variables fall back to a callback without arguments
+      const auto function_data = function_storage.find_function(data->name, 0);
+      signature += "$" + data->name;
+      dependencies.insert(root_name(data->name));
+      return function_data.operation != Op::Callback || function_data.deterministic;
+
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(&expression)) {
+      function->memo_key = nullptr;
+      function->memo_dependencies.clear();
+
+      bool pure = (function->operation != Op::Super && function->operation != Op::None);
+      if (function->operation == Op::Callback) {
+        const auto function_data = function_storage.find_function(function->name, static_cast<int>(function->arguments.size()));
+        pure = (function_data.operation == Op::Callback && function_data.deterministic);
+      }
+
+      PureFunction result;
+      result.signature = function->name + "#" + std::to_string(static_cast<int>(function->operation)) + "(";
+      for (const auto& argument : function->arguments) {
+        pure = describe(*argument, result.signature, result.dependencies) && pure;
+        result.signature += ",";
+      }
+      result.signature += ")";
+
+      signature += result.signature;
+      dependencies.insert(result.dependencies.begin(), result.dependencies.end());
+      if (pure) {
+        pure_functions.emplace(function, std::move(result));
+      }
+      return pure;
+    }
+    return false;
+  }
+
+  void annotate(const FunctionNode& function, const FunctionNode* key) {
+    const auto& dependencies = pure_functions.at(&function).dependencies;
+    function.memo_key = key;
+    function.memo_dependencies.assign(dependencies.begin(), dependencies.end());
+  }
+
+  /// Marks the largest loop-invariant subexpressions for memoization
+  void hoist(const ExpressionNode& expression, const std::set<std::string>& assigned) {
+    const auto* function = dynamic_cast<const FunctionNode*>(&expression);
+    if (function == nullptr) {
+      return;
+    }
+
+    const auto pure = pure_functions.find(function);
+    if (pure != pure_functions.end()) {
+      const auto& dependencies = pure->second.dependencies;
+      const bool invariant = std::none_of(dependencies.begin(), dependencies.end(), [&assigned](const std::string& variable) {
+        return assigned.count(variable) > 0;
+      });
+      if (invariant) {
+        annotate(*function, function);
+        stats.hoisted_expressions += 1;
+        return;
+      }
+    }
+
+    for (const auto& argument : function->arguments) {
+      hoist(*argument, assigned);
+    }
+  }
+
+  /// Collects the largest pure subexpressions that occur more than once
+  void find_common(const ExpressionNode& expression, const std::map<std::string, size_t>& counts,
+                   std::map<std::string, std::vector<const FunctionNode*>>& groups) const {
+    const auto* function = dynamic_cast<const FunctionNode*>(&expression);
+    if (function == nullptr) {
+      return;
+    }
+
+    const auto pure = pure_functions.find(function);
+    if (pure != pure_functions.end() && counts.at(pure->second.signature) > 1) {
+      groups[pure->second.signature].push_back(function);
+      return;
+    }
+
+    for (const auto& argument : function->arguments) {
+      find_common(*argument, counts, groups);
+    }
+  }
+
+  void eliminate_common_subexpressions() {
+    std::map<std::string, size_t> counts;
+    for (const auto& [function, pure] : pure_functions) {
+      counts[pure.signature] += 1;
+    }
+
+    std::map<std::string, std::vector<const FunctionNode*>> groups;
+    for (const auto& expression : expressions) {
+      find_common(*expression.root, counts, groups);
+    }
+
+    for (const auto& [signature, functions] : groups) {
+      if (functions.size() < 2) {
+        continue;
+      }
+      for (const auto* function : functions) {
+        annotate(*function, functions.front());
+      }
+      stats.eliminated_evaluations += functions.size() - 1;
+    }
+  }
+
+  void visit_loop(const ForStatementNode& node) {
+    node.condition.accept(*this);
+
+    AssignmentCollector collector;
+    node.body.accept(collector);
+    loop_assignments.push_back(std::make_shared<const std::set<std::string>>(std::move(collector.variables)));
+    node.body.accept(*this);
+    loop_assignments.pop_back();
+  }
+
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+  void visit(const LiteralNode&) override {}
+  void visit(const DataNode&) override {}
+  void visit(const FunctionNode&) override {}
+
+  void visit(const ExpressionListNode& node) override {
+    if (node.root) {
+      expressions.push_back({node.root.get(), loop_assignments.empty() ? nullptr : loop_assignments.back()});
+    }
+  }
+
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    visit_loop(node);
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    visit_loop(node);
+  }
+
+  void visit(const IfStatementNode& node) override {
+    node.condition.accept(*this);
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
+
+  void visit(const IncludeStatementNode&) override {}
+  void visit(const ExtendsStatementNode&) override {}
+
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+  }
+
+  void visit(const SetStatementNode& node) override {
+    node.expression.accept(*this);
+  }
+
+  void visit(const RawStatementNode&) override {}
+
+public:
+  explicit Optimizer(const FunctionStorage& function_storage): function_storage(function_storage) {}
+
+  /*!
+   * \brief Annotates the AST of the template in place.
+   *
+   * Copies of a template share their AST, so they are optimized as well.
+   * Must not run concurrently with a render of the template.
+   */
+  OptimizerStats optimize(Template& tmpl) {
+    stats = OptimizerStats();
+    expressions.clear();
+    loop_assignments.clear();
+    pure_functions.clear();
+
+    tmpl.root.accept(*this);
+
+    // Also resets the annotations of previous runs
+    for (const auto& expression : expressions) {
+      std::string signature;
+      std::set<std::string> dependencies;
+      describe(*expression.root, signature, dependencies);
+    }
+
+    for (const auto& expression : expressions) {
+      if (expression.loop_assignments) {
+        hoist(*expression.root, *expression.loop_assignments);
+      }
+    }
+
+    eliminate_common_subexpressions();
+    return stats;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_OPTIMIZER_HPP_
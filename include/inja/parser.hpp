@@ -15,8 +15,10 @@
 #include "config.hpp"
 #include "exceptions.hpp"
 #include "function_storage.hpp"
+#include "include_cache.hpp"
 #include "lexer.hpp"
 #include "node.hpp"
+#include "preload.hpp"
 #include "template.hpp"
 #include "throw.hpp"
 #include "token.hpp"
@@ -40,6 +42,8 @@ class Parser {
   TemplateStorage& template_storage;  // Thread-local cache for discovered templates
   std::shared_ptr<const TemplateStorage> shared_template_storage;  // Shared storage kept alive during parsing
   const FunctionStorage& function_storage;
+  ConcurrentTemplateStorage* concurrent_storage {nullptr}; // Templates of parsers running in parallel, see Environment::preload_directory()
+  IncludeCache* include_cache {nullptr};
 
   Token tok, peek_tok;
   bool have_peek_tok {false};
@@ -112,11 +116,43 @@ class Parser {
 
     const std::string original_name = template_name;
 
+    const auto cached = include_cache ? include_cache->find(path, original_name) : nullptr;
+    if (cached && cached->kind != IncludeResolution::Kind::File) {
+      // A template added under the resolved name since, e.g. by include_template(), takes precedence
+      if (template_storage.find(cached->name) != template_storage.end()) {
+        template_name = cached->name;
+        return;
+      }
+      if (shared_template_storage) {
+        auto it = shared_template_storage->find(cached->name);
+        if (it != shared_template_storage->end()) {
+          template_name = cached->name;
+          template_storage[template_name] = it->second;
+          return;
+        }
+      }
+    }
+    if (cached && cached->kind == IncludeResolution::Kind::Callback) {
+      template_name = cached->name;
+      template_storage.emplace(template_name, cached->tmpl);
+      return;
+    } else if (cached && cached->kind == IncludeResolution::Kind::Missing) {
+      template_name = cached->name;
+      INJA_THROW(FileError("failed accessing file at '" + template_name + "'"));
+    }
+
+    // Directory in which a new file would take precedence over the include callback
+    std::string file_directory;
+
     if (config.search_included_templates_in_files) {
-      // Build the relative path
-      template_name = (path / original_name).string();
-      if (template_name.compare(0, 2, "./") == 0) {
-        template_name.erase(0, 2);
+      if (cached) {
+        template_name = cached->name;
+      } else {
+        // Build the relative path
+        template_name = (path / original_name).string();
+        if (template_name.compare(0, 2, "./") == 0) {
+          template_name.erase(0, 2);
+        }
       }
 
       // Check both caches with the modified name too
@@ -131,17 +167,40 @@ class Parser {
         }
       }
 
+      if (concurrent_storage) {
+        if (const auto parsed = concurrent_storage->find(template_name)) {
+          template_storage[template_name] = parsed->tmpl;
+          return;
+        }
+      }
+
       // Load file
       std::ifstream file;
       file.open(template_name);
       if (!file.fail()) {
+        const auto timer = ConcurrentTemplateStorage::start_parse();
         const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
         auto include_template = Template(text);
         template_storage.emplace(template_name, include_template);
         parse_into_template(template_storage[template_name], template_name);
+        if (concurrent_storage) {
+          concurrent_storage->add(template_name, template_storage[template_name], timer);
+        }
+        if (include_cache && !cached) {
+          include_cache->add_file(path, original_name, template_name);
+        }
         return;
-      } else if (!config.include_callback) {
+      }
+
+      file_directory = std::filesystem::path(template_name).parent_path().string();
+      if (file_directory.empty()) {
+        file_directory = ".";
+      }
+      if (!config.include_callback) {
+        if (include_cache) {
+          include_cache->add_missing(path, original_name, template_name, file_directory);
+        }
         INJA_THROW(FileError("failed accessing file at '" + template_name + "'"));
       }
     }
@@ -149,6 +208,9 @@ class Parser {
     // Try include callback
     if (config.include_callback) {
       auto include_template = config.include_callback(path, original_name);
+      if (include_cache) {
+        include_cache->add_callback(path, original_name, template_name, include_template, file_directory);
+      }
       template_storage.emplace(template_name, include_template);
     }
   }
@@ -798,8 +860,20 @@ public:
     return result;
   }
 
+  /// Shares the templates found in files with other parsers running in parallel
+  void set_concurrent_storage(ConcurrentTemplateStorage* storage) {
+    concurrent_storage = storage;
+  }
+
+  /// Remembers how include names were resolved across parsers
+  void set_include_cache(IncludeCache* cache) {
+    include_cache = cache;
+  }
+
   void parse_into_template(Template& tmpl, const std::filesystem::path& filename) {
     auto sub_parser = Parser(config, lexer.get_config(), template_storage, function_storage, shared_template_storage);
+    sub_parser.concurrent_storage = concurrent_storage;
+    sub_parser.include_cache = include_cache;
     sub_parser.parse_into(tmpl, filename.parent_path());
   }
 
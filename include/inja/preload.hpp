@@ -0,0 +1,229 @@
+#ifndef INCLUDE_INJA_PRELOAD_HPP_
+#define INCLUDE_INJA_PRELOAD_HPP_
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "node.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/// Matches a path with `/` separators against a glob with `*`, `**` and `?`
+inline bool glob_match(std::string_view pattern, std::string_view path) {
+  if (pattern.empty()) {
+    return path.empty();
+  }
+
+  if (pattern.substr(0, 2) == "**") {
+    // Also matches no directory at all, e.g. `**/*.txt` matches `a.txt`
+    if (pattern.substr(0, 3) == "**/" && glob_match(pattern.substr(3), path)) {
+      return true;
+    }
+    for (size_t i = 0; i <= path.size(); ++i) {
+      if (glob_match(pattern.substr(2), path.substr(i))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  if (pattern[0] == '*') {
+    for (size_t i = 0; i <= path.size(); ++i) {
+      if (glob_match(pattern.substr(1), path.substr(i))) {
+        return true;
+      }
+      if (i < path.size() && path[i] == '/') {
+        break;
+      }
+    }
+    return false;
+  }
+
+  if (path.empty() || (pattern[0] == '?' ? path[0] == '/' : pattern[0] != path[0])) {
+    return false;
+  }
+  return glob_match(pattern.substr(1), path.substr(1));
+}
+
+/// Returns the names of all templates included or extended by the template, in order of their statements
+inline std::vector<std::string> template_dependencies(const Template& tmpl) {
+  std::vector<std::string> result;
+  std::function<void(const BlockNode&)> collect = [&result, &collect](const BlockNode& block) {
+    for (const auto& node : block.nodes) {
+      if (const auto* include = dynamic_cast<const IncludeStatementNode*>(node.get())) {
+        result.push_back(include->file);
+      } else if (const auto* extends = dynamic_cast<const ExtendsStatementNode*>(node.get())) {
+        result.push_back(extends->file);
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node.get())) {
+        collect(condition->true_statement);
+        collect(condition->false_statement);
+      } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(node.get())) {
+        collect(loop->body);
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node.get())) {
+        collect(block_statement->block);
+      }
+    }
+  };
+  collect(tmpl.root);
+  return result;
+}
+
+/*!
+ * \brief Timings of Environment::preload_directory().
+ */
+struct PreloadReport {
+  struct File {
+    std::string name;
+    std::chrono::nanoseconds parse_time {0}; // Without the parse time of included templates
+    std::vector<std::string> dependencies;   // Included and extended templates
+  };
+
+  std::vector<File> files; // All parsed templates, including the ones only found as includes
+  std::chrono::nanoseconds total_time {0};
+
+  // Longest chain of templates that include each other, which bounds the parse time for any number of threads
+  std::vector<std::string> critical_path;
+  std::chrono::nanoseconds critical_path_time {0};
+};
+
+/*!
+ * \brief Templates parsed by concurrent parsers, to parse shared includes only once.
+ *
+ * Parsers look up templates before reading their file and add them after
+ * parsing. Two threads may parse the same template at the same time, then
+ * the first one added is kept.
+ */
+class ConcurrentTemplateStorage {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    Template tmpl;
+    std::vector<std::string> dependencies;
+    std::chrono::nanoseconds parse_time {0};
+  };
+
+  /// Start of a parse, to subtract the time spent parsing includes
+  struct ParseTimer {
+    Clock::time_point start;
+    std::chrono::nanoseconds nested_before;
+  };
+
+private:
+  static constexpr size_t shard_count {16};
+
+  struct Shard {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const Entry>> entries;
+  };
+
+  std::array<Shard, shard_count> shards;
+
+  // Time spent in the completed parses of this thread, nested parses are subtracted from their parent
+  static inline thread_local std::chrono::nanoseconds tl_parsed_time_ {0};
+
+  Shard& shard(const std::string& name) {
+    return shards[std::hash<std::string> {}(name) % shard_count];
+  }
+
+public:
+  std::shared_ptr<const Entry> find(const std::string& name) {
+    auto& s = shard(name);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    const auto it = s.entries.find(name);
+    return (it != s.entries.end()) ? it->second : nullptr;
+  }
+
+  static ParseTimer start_parse() {
+    return {Clock::now(), tl_parsed_time_};
+  }
+
+  void add(const std::string& name, const Template& tmpl, const ParseTimer& timer) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - timer.start);
+
+    auto entry = std::make_shared<Entry>();
+    entry->tmpl = tmpl;
+    entry->parse_time = elapsed - (tl_parsed_time_ - timer.nested_before);
+    entry->dependencies = template_dependencies(tmpl);
+    tl_parsed_time_ = timer.nested_before + elapsed;
+
+    auto& s = shard(name);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.entries.try_emplace(name, std::move(entry));
+  }
+
+  /// Calls the function with the name and entry of all templates, in order of their names within each shard
+  void for_each(const std::function<void(const std::string&, const Entry&)>& function) {
+    for (auto& s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      for (const auto& [name, entry] : s.entries) {
+        function(name, *entry);
+      }
+    }
+  }
+
+  /// Returns the report of all parsed templates with their critical path
+  PreloadReport report() {
+    PreloadReport result;
+    std::map<std::string, const Entry*> entries;
+    for_each([&](const std::string& name, const Entry& entry) {
+      entries.emplace(name, &entry);
+      result.files.push_back({name, entry.parse_time, entry.dependencies});
+    });
+
+    // Longest path through the include graph, a template on the current path ends a cycle
+    std::map<std::string, std::pair<std::chrono::nanoseconds, std::string>> longest; // Time from a template on, and the next template
+    std::set<std::string> on_path;
+    std::function<std::chrono::nanoseconds(const std::string&)> visit = [&](const std::string& name) -> std::chrono::nanoseconds {
+      const auto entry = entries.find(name);
+      if (entry == entries.end() || on_path.count(name) > 0) {
+        return std::chrono::nanoseconds {0};
+      }
+      const auto known = longest.find(name);
+      if (known != longest.end()) {
+        return known->second.first;
+      }
+
+      on_path.insert(name);
+      std::pair<std::chrono::nanoseconds, std::string> best {std::chrono::nanoseconds {0}, ""};
+      for (const auto& dependency : entry->second->dependencies) {
+        const auto time = visit(dependency);
+        if (time > best.first) {
+          best = {time, dependency};
+        }
+      }
+      on_path.erase(name);
+
+      best.first += entry->second->parse_time;
+      longest[name] = best;
+      return best.first;
+    };
+
+    std::string start;
+    for (const auto& [name, entry] : entries) {
+      const auto time = visit(name);
+      if (time > result.critical_path_time) {
+        result.critical_path_time = time;
+        start = name;
+      }
+    }
+    for (std::string name = start; !name.empty(); name = longest[name].second) {
+      result.critical_path.push_back(name);
+    }
+    return result;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_PRELOAD_HPP_
@@ -0,0 +1,197 @@
+#ifndef INCLUDE_INJA_PROJECTION_HPP_
+#define INCLUDE_INJA_PROJECTION_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "analysis.hpp"
+#include "json.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Prefix tree of the paths into the input data that a template can read.
+ *
+ * A node marked as whole needs the complete value at its path, an iterated
+ * node needs all elements of its container (but only the parts of each
+ * element given by the wildcard child `*`). All other nodes only need the
+ * children listed below them.
+ */
+struct DataPathTree {
+  bool whole {false};
+  bool iterated {false};
+  std::map<std::string, DataPathTree> children;
+
+  /// Adds a path; if whole is false only the shape of the container at the path is required
+  void insert(const DataPath& path, bool whole_value = true) {
+    DataPathTree* node = this;
+    for (const auto& token : path) {
+      if (node->whole) {
+        return;
+      }
+      node = &node->children[token];
+    }
+
+    if (whole_value) {
+      node->whole = true;
+      node->children.clear();
+    } else {
+      node->iterated = true;
+    }
+  }
+
+  /// Returns whether anything at or below the given path might be read
+  bool needs(const DataPath& path) const {
+    return needs(path, 0);
+  }
+
+  /// Returns the JSON pointers of all whole and iterated nodes
+  std::vector<std::string> paths() const {
+    std::vector<std::string> result;
+    DataPath prefix;
+    collect(prefix, result);
+    return result;
+  }
+
+  /// Builds the tree from a dependency analysis; dynamic lookups make the whole input required
+  static DataPathTree from_analysis(const TemplateAnalysis& analysis) {
+    DataPathTree tree;
+    if (analysis.has_dynamic_lookups) {
+      tree.whole = true;
+      return tree;
+    }
+    for (const auto& path : analysis.iterated_paths) {
+      tree.insert(split_json_pointer(path), false);
+    }
+    for (const auto& path : analysis.input_paths) {
+      tree.insert(split_json_pointer(path), true);
+    }
+    return tree;
+  }
+
+private:
+  bool needs(const DataPath& path, size_t depth) const {
+    if (whole || depth == path.size()) {
+      return true;
+    }
+    const auto it = children.find(path[depth]);
+    if (it != children.end() && it->second.needs(path, depth + 1)) {
+      return true;
+    }
+    const auto any = children.find(TemplateAnalysis::any_element);
+    return any != children.end() && any->second.needs(path, depth + 1);
+  }
+
+  void collect(DataPath& prefix, std::vector<std::string>& result) const {
+    if (whole || iterated) {
+      result.emplace_back(join_json_pointer(prefix));
+    }
+    for (const auto& [token, child] : children) {
+      prefix.push_back(token);
+      child.collect(prefix, result);
+      prefix.pop_back();
+    }
+  }
+};
+
+namespace detail {
+
+inline json project_nodes(const json& value, const std::vector<const DataPathTree*>& nodes) {
+  bool iterated = false;
+  for (const auto* node : nodes) {
+    if (node->whole) {
+      return value;
+    }
+    iterated = iterated || node->iterated;
+  }
+
+  // Collect the subtrees applying to a child, including the wildcard
+  const auto child_nodes = [&nodes](const std::string& token) {
+    std::vector<const DataPathTree*> result;
+    for (const auto* node : nodes) {
+      const auto named = node->children.find(token);
+      if (named != node->children.end()) {
+        result.push_back(&named->second);
+      }
+      const auto any = node->children.find(TemplateAnalysis::any_element);
+      if (any != node->children.end() && any != named) {
+        result.push_back(&any->second);
+      }
+    }
+    return result;
+  };
+
+  const bool has_wildcard = std::any_of(nodes.begin(), nodes.end(), [](const DataPathTree* node) {
+    return node->children.count(TemplateAnalysis::any_element) > 0;
+  });
+
+  if (value.is_object()) {
+    json result = json::object();
+    if (iterated || has_wildcard) {
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        const auto sub_nodes = child_nodes(it.key());
+        if (!sub_nodes.empty()) {
+          result[it.key()] = project_nodes(it.value(), sub_nodes);
+        } else if (iterated) {
+          result[it.key()] = nullptr; // Keep the key for iteration
+        }
+      }
+    } else {
+      for (const auto* node : nodes) {
+        for (const auto& [token, child] : node->children) {
+          const auto it = value.find(token);
+          if (it != value.end() && !result.contains(token)) {
+            result[token] = project_nodes(*it, child_nodes(token));
+          }
+        }
+      }
+    }
+    return result;
+
+  } else if (value.is_array()) {
+    size_t size = value.size();
+    if (!iterated && !has_wildcard) {
+      // Only keep the array up to the highest index that is read
+      size_t max_index = 0;
+      bool any_index = false;
+      for (const auto* node : nodes) {
+        for (const auto& [token, child] : node->children) {
+          if (!token.empty() && std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            max_index = std::max(max_index, static_cast<size_t>(std::stoull(token)));
+            any_index = true;
+          }
+        }
+      }
+      size = any_index ? std::min(size, max_index + 1) : 0;
+    }
+
+    json result = json::array();
+    for (size_t i = 0; i < size; ++i) {
+      const auto sub_nodes = child_nodes(std::to_string(i));
+      result.push_back(sub_nodes.empty() ? json(nullptr) : project_nodes(value[i], sub_nodes));
+    }
+    return result;
+  }
+
+  return value;
+}
+
+} // namespace detail
+
+/*!
+ * \brief Projects the input data down to the parts required by a path tree.
+ *
+ * Rendering a template with the projection of its required paths gives the
+ * same result as rendering it with the full data. Array elements that are
+ * not read are kept as null so that the indices of the others stay valid.
+ */
+inline json project(const json& data, const DataPathTree& tree) {
+  return detail::project_nodes(data, {&tree});
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_PROJECTION_HPP_
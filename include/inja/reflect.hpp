@@ -0,0 +1,315 @@
+#ifndef INCLUDE_INJA_REFLECT_HPP_
+#define INCLUDE_INJA_REFLECT_HPP_
+
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "data_provider.hpp"
+#include "json.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A member of a reflected struct, with its name in templates.
+ */
+template <class MemberPointer> struct ReflectedField {
+  std::string_view name;
+  MemberPointer pointer;
+};
+
+/*!
+ * \brief Members of a struct that templates can read, specialized by INJA_REFLECT.
+ *
+ * A specialization derives from std::true_type and has a static function
+ * fields() returning a tuple of ReflectedField.
+ */
+template <class T> struct Reflect : std::false_type {};
+
+namespace detail {
+
+template <class T> struct is_optional : std::false_type {};
+template <class T> struct is_optional<std::optional<T>> : std::true_type {};
+
+template <class T, class = void> struct is_pointer_like : std::is_pointer<T> {};
+template <class T> struct is_pointer_like<T, std::void_t<typename T::element_type, decltype(std::declval<const T&>().get())>> : std::true_type {};
+
+template <class T> constexpr bool is_string_like = std::is_convertible_v<const T&, std::string_view>;
+
+template <class T, class = void> struct is_string_map : std::false_type {};
+template <class T> struct is_string_map<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::is_same<typename T::key_type, std::string> {};
+
+template <class T, class = void> struct is_range : std::false_type {};
+template <class T>
+struct is_range<T, std::void_t<decltype(std::begin(std::declval<const T&>())), decltype(std::end(std::declval<const T&>()))>> : std::true_type {};
+
+template <class T> constexpr bool is_sequence = is_range<T>::value && !is_string_like<T> && !is_string_map<T>::value && !Reflect<T>::value;
+
+template <class> constexpr bool always_false = false;
+
+inline bool parse_index(const std::string& key, size_t& index) {
+  if (key.empty() || key.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  index = std::stoul(key);
+  return true;
+}
+
+/// Converts a value to json, reflected structs become objects of their fields
+template <class T> json to_json_value(const T& value) {
+  if constexpr (std::is_same_v<T, json>) {
+    return value;
+  } else if constexpr (is_optional<T>::value || is_pointer_like<T>::value) {
+    return value ? to_json_value(*value) : json();
+  } else if constexpr (Reflect<T>::value) {
+    json result = json::object();
+    std::apply([&](const auto&... field) { ((result[static_cast<std::string>(field.name)] = to_json_value(value.*field.pointer)), ...); },
+               Reflect<T>::fields());
+    return result;
+  } else if constexpr (is_string_like<T>) {
+    return json(std::string(std::string_view(value)));
+  } else if constexpr (std::is_arithmetic_v<T>) {
+    return json(value);
+  } else if constexpr (is_string_map<T>::value) {
+    json result = json::object();
+    for (const auto& [key, element] : value) {
+      result[key] = to_json_value(element);
+    }
+    return result;
+  } else if constexpr (is_range<T>::value) {
+    json result = json::array();
+    for (const auto& element : value) {
+      result.push_back(to_json_value(element));
+    }
+    return result;
+  } else if constexpr (std::is_constructible_v<json, const T&>) {
+    return json(value);
+  } else {
+    static_assert(always_false<T>, "type is neither reflected with INJA_REFLECT nor convertible to json");
+  }
+}
+
+/// Follows the path from the value and calls the function with the value at its end; returns false if there is none
+template <class T, class Function> bool navigate(const T& value, DataProvider::Path::const_iterator it, DataProvider::Path::const_iterator end, Function& function) {
+  if constexpr (is_optional<T>::value || is_pointer_like<T>::value) {
+    if (!value) {
+      if (it != end) {
+        return false;
+      }
+      function(json());
+      return true;
+    }
+    return navigate(*value, it, end, function);
+  } else {
+    if (it == end) {
+      function(value);
+      return true;
+    }
+
+    size_t index {0};
+    if constexpr (std::is_same_v<T, json>) {
+      if (value.is_object()) {
+        const auto element = value.find(*it);
+        return element != value.end() && navigate(*element, it + 1, end, function);
+      } else if (value.is_array() && parse_index(*it, index) && index < value.size()) {
+        return navigate(value[index], it + 1, end, function);
+      }
+      return false;
+    } else if constexpr (Reflect<T>::value) {
+      bool found = false;
+      std::apply([&](const auto&... field) { (void)((field.name == *it && (found = navigate(value.*field.pointer, it + 1, end, function), true)) || ...); },
+                 Reflect<T>::fields());
+      return found;
+    } else if constexpr (is_string_map<T>::value) {
+      const auto element = value.find(*it);
+      return element != value.end() && navigate(element->second, it + 1, end, function);
+    } else if constexpr (is_sequence<T>) {
+      if (!parse_index(*it, index) || index >= static_cast<size_t>(std::distance(std::begin(value), std::end(value)))) {
+        return false;
+      }
+      return navigate(*std::next(std::begin(value), static_cast<std::ptrdiff_t>(index)), it + 1, end, function);
+    } else {
+      return false;
+    }
+  }
+}
+
+} // namespace detail
+
+/*!
+ * \brief Provides C++ objects to templates without converting them to json first.
+ *
+ * Objects are bound by name, or as the root whose members are the top-level
+ * variables. Paths are resolved through structs reflected with INJA_REFLECT,
+ * optionals, pointers, maps with string keys and ranges. Only the values a
+ * template reads are converted to json, and loops over ranges only ask for
+ * their size. Objects bound as lvalues must outlive all renders with the
+ * provider, temporaries are moved into it.
+ */
+class ObjectDataProvider : public DataProvider {
+  struct Binding {
+    std::function<std::optional<json>(const Path&)> lookup;
+    std::function<std::optional<size_t>(const Path&)> array_size;
+    std::function<std::optional<std::vector<std::string>>(const Path&)> object_keys;
+  };
+
+  std::map<std::string, Binding, std::less<>> bindings;
+  std::optional<Binding> root;
+
+  // The owner keeps an object moved into the provider alive, it is null for objects owned by the caller
+  template <class T> static Binding make_binding(const T& object, size_t skip, std::shared_ptr<const void> owner = nullptr) {
+    Binding binding;
+    binding.lookup = [&object, skip, owner](const Path& path) -> std::optional<json> {
+      std::optional<json> result;
+      auto function = [&result](const auto& value) { result = detail::to_json_value(value); };
+      detail::navigate(object, path.begin() + skip, path.end(), function);
+      return result;
+    };
+    binding.array_size = [&object, skip, owner](const Path& path) -> std::optional<size_t> {
+      std::optional<size_t> result;
+      auto function = [&result](const auto& value) {
+        using U = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<U, json>) {
+          if (value.is_array()) {
+            result = value.size();
+          }
+        } else if constexpr (detail::is_sequence<U>) {
+          result = static_cast<size_t>(std::distance(std::begin(value), std::end(value)));
+        }
+      };
+      detail::navigate(object, path.begin() + skip, path.end(), function);
+      return result;
+    };
+    binding.object_keys = [&object, skip, owner](const Path& path) -> std::optional<std::vector<std::string>> {
+      std::optional<std::vector<std::string>> result;
+      auto function = [&result](const auto& value) {
+        using U = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<U, json>) {
+          if (value.is_object()) {
+            result.emplace();
+            for (auto it = value.begin(); it != value.end(); ++it) {
+              result->push_back(it.key());
+            }
+          }
+        } else if constexpr (Reflect<U>::value) {
+          result.emplace();
+          std::apply([&result](const auto&... field) { (result->emplace_back(field.name), ...); }, Reflect<U>::fields());
+        } else if constexpr (detail::is_string_map<U>::value) {
+          result.emplace();
+          for (const auto& element : value) {
+            result->push_back(element.first);
+          }
+        }
+      };
+      detail::navigate(object, path.begin() + skip, path.end(), function);
+      return result;
+    };
+    return binding;
+  }
+
+  /// Returns the binding the path starts in
+  const Binding* find_binding(const Path& path) const {
+    if (!path.empty()) {
+      const auto it = bindings.find(path.front());
+      if (it != bindings.end()) {
+        return &it->second;
+      }
+    }
+    return root ? &*root : nullptr;
+  }
+
+public:
+  ObjectDataProvider() = default;
+
+  /// Makes the members of the object the top-level variables, after the objects bound by name
+  template <class T> explicit ObjectDataProvider(const T& root_object): root(make_binding(root_object, 0)) {}
+
+  /// Makes the members of the temporary object the top-level variables, the object is moved into the provider
+  template <class T, std::enable_if_t<!std::is_lvalue_reference_v<T>, int> = 0> explicit ObjectDataProvider(T&& root_object) {
+    const auto owned = std::make_shared<const std::decay_t<T>>(std::move(root_object));
+    root = make_binding(*owned, 0, owned);
+  }
+
+  /// Makes the object available as the variable with the given name
+  template <class T> ObjectDataProvider& bind(const std::string& name, const T& object) {
+    bindings.insert_or_assign(name, make_binding(object, 1));
+    return *this;
+  }
+
+  /// Makes the temporary object available as the variable with the given name, the object is moved into the provider
+  template <class T, std::enable_if_t<!std::is_lvalue_reference_v<T>, int> = 0> ObjectDataProvider& bind(const std::string& name, T&& object) {
+    const auto owned = std::make_shared<const std::decay_t<T>>(std::move(object));
+    bindings.insert_or_assign(name, make_binding(*owned, 1, owned));
+    return *this;
+  }
+
+  std::optional<json> lookup(const Path& path) const override {
+    const auto* binding = find_binding(path);
+    return binding ? binding->lookup(path) : std::nullopt;
+  }
+
+  std::optional<size_t> array_size(const Path& path) const override {
+    const auto* binding = find_binding(path);
+    return binding ? binding->array_size(path) : std::nullopt;
+  }
+
+  std::optional<std::vector<std::string>> object_keys(const Path& path) const override {
+    const auto* binding = find_binding(path);
+    return binding ? binding->object_keys(path) : std::nullopt;
+  }
+};
+
+} // namespace inja
+
+/*!
+ * \brief Makes the listed public members of a struct readable by templates, e.g. `INJA_REFLECT(Actor, name, level)`.
+ *
+ * Must be used at global scope, for up to 24 members.
+ */
+#define INJA_REFLECT(Type, ...) \
+  template <> struct inja::Reflect<Type> : std::true_type { \
+    static constexpr auto fields() { \
+      return std::make_tuple(INJA_REFLECT_EXPAND(INJA_REFLECT_CONCAT(INJA_REFLECT_FIELDS_, INJA_REFLECT_COUNT(__VA_ARGS__))(Type, __VA_ARGS__))); \
+    } \
+  };
+
+#define INJA_REFLECT_FIELD(Type, field) inja::ReflectedField<decltype(&Type::field)> {#field, &Type::field}
+#define INJA_REFLECT_EXPAND(x) x
+#define INJA_REFLECT_CONCAT(a, b) INJA_REFLECT_CONCAT_(a, b)
+#define INJA_REFLECT_CONCAT_(a, b) a##b
+#define INJA_REFLECT_COUNT(...) INJA_REFLECT_EXPAND(INJA_REFLECT_COUNT_(__VA_ARGS__, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define INJA_REFLECT_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, N, ...) N
+#define INJA_REFLECT_FIELDS_1(Type, field) INJA_REFLECT_FIELD(Type, field)
+#define INJA_REFLECT_FIELDS_2(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_1(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_3(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_2(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_4(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_3(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_5(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_4(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_6(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_5(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_7(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_6(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_8(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_7(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_9(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_8(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_10(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_9(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_11(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_10(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_12(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_11(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_13(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_12(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_14(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_13(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_15(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_14(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_16(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_15(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_17(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_16(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_18(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_17(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_19(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_18(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_20(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_19(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_21(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_20(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_22(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_21(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_23(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_22(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_24(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_23(Type, __VA_ARGS__))
+
+#endif // INCLUDE_INJA_REFLECT_HPP_
@@ -4,18 +4,30 @@
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <ostream>
 #include <sstream>
 #include <stack>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "analysis.hpp"
 #include "config.hpp"
+#include "data_provider.hpp"
 #include "exceptions.hpp"
 #include "function_storage.hpp"
 #include "node.hpp"
@@ -35,6 +47,14 @@ struct NotFoundInfo {
   NotFoundInfo(const std::string& name, const AstNode* node) : name(name), node(node) {}
 };
 
+/*!
+@brief Output of a render together with the errors of graceful error mode
+*/
+struct RenderResult {
+  std::string output;
+  std::vector<RenderErrorInfo> errors;
+};
+
 /*!
 @brief Escapes HTML
 */
@@ -70,10 +90,16 @@ class Renderer : public NodeVisitor {
   std::vector<const BlockStatementNode*> block_statement_stack;
 
   const json* data_input;
+  std::vector<const json*> data_layers; // Data below the input, from top to bottom, shared with included templates
+  const json* static_data {nullptr}; // Data of a specialized template, shared with included templates
   std::ostream* output_stream;
 
-  json additional_data;
-  json* current_loop_data = &additional_data["loop"];
+  // Data looked up on demand, and its values looked up so far in this render (shared with included templates)
+  const DataProvider* data_provider {nullptr};
+  std::shared_ptr<std::map<DataProvider::Path, std::optional<json>>> provider_values;
+  std::unordered_map<std::string, DataProvider::Path> provider_aliases; // Loop variables bound to an element of the data provider
+
+  json additional_data = json::object({{"loop", nullptr}});
 
   std::vector<std::shared_ptr<json>> data_tmp_stack;
   std::stack<const json*> data_eval_stack;
@@ -81,21 +107,123 @@ class Renderer : public NodeVisitor {
 
   bool break_rendering {false};
 
+  // Cancellation and deadline of the render, checked between nodes
+  std::stop_token stop_token;
+  std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+  size_t nodes_since_deadline_check {0};
+
   std::vector<RenderErrorInfo> render_errors; // Track errors in graceful mode (per-instance)
 
-  static bool truthy(const json* data) {
-    // In graceful error mode, data can be nullptr for missing variables
-    if (!data) {
-      return false;
+  // Nodes that are rendered concurrently, by root template of the render
+  struct ConcurrentNodes {
+    std::mutex mutex;
+    std::map<std::pair<const BlockNode*, const Template*>, std::vector<size_t>> indices; // Indices of the nodes of a block
+    std::map<std::pair<const ForArrayStatementNode*, const Template*>, std::optional<std::vector<std::string>>> loops; // Loop variables of the body
+  };
+  std::shared_ptr<ConcurrentNodes> concurrent_nodes; // Shared with included templates and concurrent parts, if there is a thread pool
+
+  /// Output and errors of a node rendered concurrently, with the output of its block before it
+  struct ConcurrentPart {
+    std::string preceding_output;
+    size_t preceding_errors {0};
+    std::future<void> task;
+    std::string output;
+    std::vector<RenderErrorInfo> errors;
+    json local_data; // Variables after rendering a part of a loop
+  };
+
+  // Cached results of expressions annotated by the Optimizer, by memo key
+  std::unordered_map<const FunctionNode*, std::shared_ptr<json>> memo;
+  std::unordered_map<std::string, std::unordered_set<const FunctionNode*>> memo_by_dependency;
+
+  /// Drops all cached results depending on the given variable (or its children)
+  void invalidate_memo(std::string_view variable) {
+    if (memo.empty()) {
+      return;
     }
-    if (data->is_boolean()) {
-      return data->get<bool>();
-    } else if (data->is_number()) {
-      return (*data != 0);
-    } else if (data->is_null()) {
-      return false;
+
+    const auto root = variable.substr(0, variable.find_first_of("./"));
+    const auto it = memo_by_dependency.find(static_cast<std::string>(root));
+    if (it != memo_by_dependency.end()) {
+      for (const auto* key : it->second) {
+        memo.erase(key);
+      }
+      memo_by_dependency.erase(it);
     }
-    return !data->empty();
+  }
+
+  void clear_memo() {
+    memo.clear();
+    memo_by_dependency.clear();
+  }
+
+  /// Returns the value in the topmost layer of the input data that contains the pointer, or nullptr
+  const json* find_input(const json::json_pointer& ptr) const {
+    if (data_input->contains(ptr)) {
+      return &(*data_input)[ptr];
+    }
+    for (const json* layer : data_layers) {
+      if (layer->contains(ptr)) {
+        return &(*layer)[ptr];
+      }
+    }
+    return nullptr;
+  }
+
+  /// Returns the value at the path in the data provider, looking it up on first use
+  const json* provider_value(const DataProvider::Path& path) {
+    auto it = provider_values->find(path);
+    if (it == provider_values->end()) {
+      it = provider_values->emplace(path, data_provider->lookup(path)).first;
+    }
+    return it->second ? &*it->second : nullptr;
+  }
+
+  /// Returns the path in the data provider of a variable within a loop variable bound to it
+  std::optional<DataProvider::Path> aliased_path(const DataNode& node) const {
+    if (provider_aliases.empty()) {
+      return std::nullopt;
+    }
+    const auto it = provider_aliases.find(node.path.front());
+    if (it == provider_aliases.end()) {
+      return std::nullopt;
+    }
+
+    auto path = it->second;
+    path.insert(path.end(), node.path.begin() + 1, node.path.end());
+    return path;
+  }
+
+  /// Returns the path in the data provider of a loop condition that wasn't looked up as a whole yet
+  std::optional<DataProvider::Path> provider_loop_path(const ExpressionListNode& condition) const {
+    const auto* data = dynamic_cast<const DataNode*>(condition.root.get());
+    if (data_provider == nullptr || data == nullptr) {
+      return std::nullopt;
+    }
+
+    auto path = aliased_path(*data);
+    if (!path) {
+      if (additional_data.contains(data->ptr)) {
+        return std::nullopt;
+      }
+      path = data->path;
+    }
+    if (provider_values->count(*path) > 0) {
+      return std::nullopt;
+    }
+    return path;
+  }
+
+  /// Copies a loop variable bound to the data provider into the local data, before it is changed by a set statement
+  void materialize_alias(std::string_view key) {
+    const auto it = provider_aliases.find(static_cast<std::string>(key.substr(0, key.find('.'))));
+    if (it == provider_aliases.end()) {
+      return;
+    }
+
+    const json* value = provider_value(it->second);
+    additional_data[it->first] = (value != nullptr) ? *value : json();
+    provider_aliases.erase(it);
   }
 
   void emit_event(InstrumentationEvent event) {
@@ -202,6 +330,79 @@ class Renderer : public NodeVisitor {
     }
   }
 
+  static OperandTypes classify_operands(const json& lhs, const json& rhs) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return OperandTypes::Integer;
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return OperandTypes::Float;
+    } else if (lhs.is_string() && rhs.is_string()) {
+      return OperandTypes::String;
+    }
+    return OperandTypes::Other;
+  }
+
+  /// Returns the types of both operands, checking the types last seen by the node first
+  static OperandTypes operand_types(const FunctionNode& node, const json& lhs, const json& rhs) {
+    const auto cached = node.operand_types.get();
+    switch (cached) {
+    case OperandTypes::Integer: {
+      if (lhs.is_number_integer() && rhs.is_number_integer()) {
+        return cached;
+      }
+    } break;
+    case OperandTypes::Float: {
+      if ((lhs.is_number_float() && rhs.is_number()) || (lhs.is_number() && rhs.is_number_float())) {
+        return cached;
+      }
+    } break;
+    case OperandTypes::String: {
+      if (lhs.is_string() && rhs.is_string()) {
+        return cached;
+      }
+    } break;
+    default:
+      break;
+    }
+
+    const auto types = classify_operands(lhs, rhs);
+    node.operand_types.set(types);
+    return types;
+  }
+
+  static json::number_integer_t integer_value(const json& value) {
+    if (const auto* integer = value.get_ptr<const json::number_integer_t*>()) {
+      return *integer;
+    }
+    return static_cast<json::number_integer_t>(*value.get_ptr<const json::number_unsigned_t*>());
+  }
+
+  static json::number_float_t float_value(const json& value) {
+    if (const auto* number = value.get_ptr<const json::number_float_t*>()) {
+      return *number;
+    } else if (const auto* number_unsigned = value.get_ptr<const json::number_unsigned_t*>()) {
+      return static_cast<json::number_float_t>(*number_unsigned);
+    }
+    return static_cast<json::number_float_t>(*value.get_ptr<const json::number_integer_t*>());
+  }
+
+  /// Compares two values with the same semantics as the json comparison operators
+  template <typename Compare> bool compare(const FunctionNode& node, const json& lhs, const json& rhs, Compare compare) {
+    switch (operand_types(node, lhs, rhs)) {
+    case OperandTypes::Integer: {
+      if (lhs.is_number_unsigned() && rhs.is_number_unsigned()) {
+        return compare(lhs.get_ref<const json::number_unsigned_t&>(), rhs.get_ref<const json::number_unsigned_t&>());
+      }
+      return compare(integer_value(lhs), integer_value(rhs));
+    }
+    case OperandTypes::Float:
+      return compare(float_value(lhs), float_value(rhs));
+    case OperandTypes::String:
+      return compare(lhs.get_ref<const json::string_t&>(), rhs.get_ref<const json::string_t&>());
+    default:
+      return compare(lhs, rhs);
+    }
+  }
+
   void make_result(const json&& result) {
     auto result_ptr = std::make_shared<json>(result);
     data_tmp_stack.push_back(result_ptr);
@@ -283,8 +484,164 @@ class Renderer : public NodeVisitor {
     return result;
   }
 
+  void check_interrupt() {
+    if (stop_token.stop_requested()) {
+      INJA_THROW(InterruptError("render was cancelled"));
+    }
+    // Reading the clock costs more than rendering most nodes
+    if (deadline != std::chrono::steady_clock::time_point::max() && ++nodes_since_deadline_check >= 64) {
+      nodes_since_deadline_check = 0;
+      if (std::chrono::steady_clock::now() > deadline) {
+        INJA_THROW(InterruptError("render deadline exceeded"));
+      }
+    }
+  }
+
+  /// Returns the indices of the includes and block statements of the block that can be rendered concurrently to each other
+  const std::vector<size_t>& find_concurrent_nodes(const BlockNode& block) {
+    std::lock_guard<std::mutex> lock(concurrent_nodes->mutex);
+    const auto [it, inserted] = concurrent_nodes->indices.try_emplace({&block, template_stack.front()});
+    if (!inserted) {
+      return it->second;
+    }
+
+    std::vector<size_t> indices;
+    EffectVisitor visitor(template_storage, function_storage, template_stack);
+    for (size_t i = 0; i < block.nodes.size(); ++i) {
+      const AstNode* node = block.nodes[i].get();
+      if (dynamic_cast<const ExtendsStatementNode*>(node)) {
+        return it->second; // The rest of the block is not rendered
+      }
+
+      // Variables set by included templates are local to them, but block statements are rendered with the data of the block
+      const bool is_include = dynamic_cast<const IncludeStatementNode*>(node) != nullptr;
+      if (is_include || dynamic_cast<const BlockStatementNode*>(node)) {
+        const auto effects = visitor.analyze(*node);
+        if (!effects.has_side_effects && (is_include || effects.is_read_only())) {
+          indices.push_back(i);
+        }
+      }
+    }
+    if (indices.size() >= 2) {
+      it->second = std::move(indices);
+    }
+    return it->second;
+  }
+
+  /// Returns a renderer with a copy of the current state of this one, to render a part concurrently
+  std::shared_ptr<Renderer> fork() const {
+    auto result = std::make_shared<Renderer>(config, template_storage, function_storage);
+    result->current_template = current_template;
+    result->current_level = current_level;
+    result->template_stack = template_stack;
+    result->block_statement_stack = block_statement_stack;
+    result->data_input = data_input;
+    result->data_layers = data_layers;
+    result->static_data = static_data;
+    result->additional_data = additional_data;
+    result->stop_token = stop_token;
+    result->deadline = deadline;
+    result->concurrent_nodes = concurrent_nodes;
+    return result;
+  }
+
+  /// Waits for all parts, then rethrows the first exception in their order
+  void join(std::vector<ConcurrentPart>& parts) {
+    for (const auto& part : parts) {
+      if (part.task.valid()) {
+        config.thread_pool->wait(part.task);
+      }
+    }
+    for (auto& part : parts) {
+      if (part.task.valid()) {
+        part.task.get();
+      }
+    }
+  }
+
+  /// Renders a node on the thread pool into the part, with a copy of the current state of this renderer
+  std::future<void> render_concurrently(const AstNode& node, ConcurrentPart& part) {
+    return config.thread_pool->submit([fork = fork(), &node, &part]() {
+      std::ostringstream os;
+      fork->output_stream = &os;
+      node.accept(*fork);
+      part.output = std::move(os).str();
+      part.errors = std::move(fork->render_errors);
+    });
+  }
+
+  /*!
+   * \brief Renders the independent includes and block statements of the block concurrently, returns false if there are less than two.
+   *
+   * The other nodes are rendered on this thread in the meantime. All output
+   * is buffered and written in order once every part is done, and the errors
+   * are merged in the order of a serial render.
+   */
+  bool render_block_concurrently(const BlockNode& block) {
+    if (data_provider != nullptr || config.instrumentation_callback) {
+      return false; // The provided values are cached per render, and events are reported in order
+    }
+    const auto& indices = find_concurrent_nodes(block);
+    if (indices.empty()) {
+      return false;
+    }
+
+    std::ostream* const output = output_stream;
+    std::ostringstream segment;
+    output_stream = &segment;
+    std::vector<ConcurrentPart> parts(indices.size());
+    size_t next_part = 0;
+    try {
+      for (size_t i = 0; i < block.nodes.size(); ++i) {
+        check_interrupt();
+        if (next_part < indices.size() && indices[next_part] == i) {
+          auto& part = parts[next_part++];
+          part.preceding_output = std::move(segment).str();
+          segment.str(std::string());
+          part.preceding_errors = render_errors.size();
+          part.task = render_concurrently(*block.nodes[i], part);
+          continue;
+        }
+
+        block.nodes[i]->accept(*this);
+        if (break_rendering) {
+          break;
+        }
+      }
+    } catch (...) {
+      // The parts reference this frame
+      output_stream = output;
+      for (const auto& part : parts) {
+        if (part.task.valid()) {
+          config.thread_pool->wait(part.task);
+        }
+      }
+      throw;
+    }
+    output_stream = output;
+    join(parts);
+
+    std::vector<RenderErrorInfo> errors;
+    size_t error_index = 0;
+    for (auto& part : parts) {
+      *output_stream << part.preceding_output << part.output;
+      errors.insert(errors.end(), render_errors.begin() + error_index, render_errors.begin() + part.preceding_errors);
+      errors.insert(errors.end(), part.errors.begin(), part.errors.end());
+      error_index = part.preceding_errors;
+    }
+    *output_stream << segment.str();
+    errors.insert(errors.end(), render_errors.begin() + error_index, render_errors.end());
+    render_errors = std::move(errors);
+    return true;
+  }
+
   void visit(const BlockNode& node) override {
+    if (concurrent_nodes && render_block_concurrently(node)) {
+      return;
+    }
+
     for (const auto& n : node.nodes) {
+      check_interrupt();
       n->accept(*this);
 
       if (break_rendering) {
@@ -304,10 +661,24 @@ class Renderer : public NodeVisitor {
   }
 
   void visit(const DataNode& node) override {
+    if (const auto path = aliased_path(node)) {
+      const json* value = provider_value(*path);
+      data_eval_stack.push(value);
+      if (value == nullptr) {
+        not_found_stack.emplace(static_cast<std::string>(node.name), &node);
+      }
+      return;
+    }
+
+    const json* provided = nullptr;
     if (additional_data.contains(node.ptr)) {
       data_eval_stack.push(&(additional_data[node.ptr]));
-    } else if (data_input->contains(node.ptr)) {
-      data_eval_stack.push(&(*data_input)[node.ptr]);
+    } else if (data_provider != nullptr && (provided = provider_value(node.path)) != nullptr) {
+      data_eval_stack.push(provided);
+    } else if ((provided = find_input(node.ptr)) != nullptr) {
+      data_eval_stack.push(provided);
+    } else if (static_data != nullptr && static_data->contains(node.ptr)) {
+      data_eval_stack.push(&(*static_data)[node.ptr]);
     } else {
       // Try to evaluate as a no-argument callback
       const auto function_data = function_storage.find_function(node.name, 0);
@@ -351,6 +722,42 @@ class Renderer : public NodeVisitor {
     }
 
   void visit(const FunctionNode& node) override {
+    if (node.memo_key == nullptr) {
+      evaluate_function(node);
+      return;
+    }
+
+    const auto it = memo.find(node.memo_key);
+    if (it != memo.end()) {
+      emit_event(InstrumentationEvent::MemoHit, node.name);
+      data_eval_stack.push(it->second.get());
+      return;
+    }
+
+    const size_t eval_size = data_eval_stack.size();
+    const size_t not_found_size = not_found_stack.size();
+    const size_t errors_size = render_errors.size();
+
+    evaluate_function(node);
+
+    // Only cache a single, successfully computed value
+    if (data_eval_stack.size() != eval_size + 1 || not_found_stack.size() != not_found_size || render_errors.size() != errors_size) {
+      return;
+    }
+    const json* result = data_eval_stack.top();
+    if (result == nullptr) {
+      return;
+    }
+
+    // Fresh results are owned by the temporary stack, others point into the data and are copied
+    const auto value = (!data_tmp_stack.empty() && data_tmp_stack.back().get() == result) ? data_tmp_stack.back() : std::make_shared<json>(*result);
+    memo.emplace(node.memo_key, value);
+    for (const auto& dependency : node.memo_dependencies) {
+      memo_by_dependency[dependency].insert(node.memo_key);
+    }
+  }
+
+  void evaluate_function(const FunctionNode& node) {
     switch (node.operation) {
     case Op::Not: {
       const auto args = get_arguments<1>(node);
@@ -368,36 +775,42 @@ class Renderer : public NodeVisitor {
     } break;
     case Op::Equal: {
       const auto args = get_arguments<2>(node);
-      make_result(*args[0] == *args[1]);
+      make_result(compare(node, *args[0], *args[1], std::equal_to<>()));
     } break;
     case Op::NotEqual: {
       const auto args = get_arguments<2>(node);
-      make_result(*args[0] != *args[1]);
+      make_result(compare(node, *args[0], *args[1], std::not_equal_to<>()));
     } break;
     case Op::Greater: {
       const auto args = get_arguments<2>(node);
-      make_result(*args[0] > *args[1]);
+      make_result(compare(node, *args[0], *args[1], std::greater<>()));
     } break;
     case Op::GreaterEqual: {
       const auto args = get_arguments<2>(node);
-      make_result(*args[0] >= *args[1]);
+      make_result(compare(node, *args[0], *args[1], std::greater_equal<>()));
     } break;
     case Op::Less: {
       const auto args = get_arguments<2>(node);
-      make_result(*args[0] < *args[1]);
+      make_result(compare(node, *args[0], *args[1], std::less<>()));
     } break;
     case Op::LessEqual: {
       const auto args = get_arguments<2>(node);
-      make_result(*args[0] <= *args[1]);
+      make_result(compare(node, *args[0], *args[1], std::less_equal<>()));
     } break;
     case Op::Add: {
       INJA_OP_TRY_BEGIN
         const auto args = get_arguments<2>(node);
-        if (args[0]->is_string() && args[1]->is_string()) {
+        switch (operand_types(node, *args[0], *args[1])) {
+        case OperandTypes::String:
           make_result(args[0]->get_ref<const json::string_t&>() + args[1]->get_ref<const json::string_t&>());
-        } else if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-          make_result(args[0]->get<const json::number_integer_t>() + args[1]->get<const json::number_integer_t>());
-        } else {
+          break;
+        case OperandTypes::Integer:
+          make_result(integer_value(*args[0]) + integer_value(*args[1]));
+          break;
+        case OperandTypes::Float:
+          make_result(float_value(*args[0]) + float_value(*args[1]));
+          break;
+        default:
           make_result(args[0]->get<const json::number_float_t>() + args[1]->get<const json::number_float_t>());
         }
       INJA_OP_TRY_END_GRACEFUL("add")
@@ -405,9 +818,14 @@ class Renderer : public NodeVisitor {
     case Op::Subtract: {
       INJA_OP_TRY_BEGIN
         const auto args = get_arguments<2>(node);
-        if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-          make_result(args[0]->get<const json::number_integer_t>() - args[1]->get<const json::number_integer_t>());
-        } else {
+        switch (operand_types(node, *args[0], *args[1])) {
+        case OperandTypes::Integer:
+          make_result(integer_value(*args[0]) - integer_value(*args[1]));
+          break;
+        case OperandTypes::Float:
+          make_result(float_value(*args[0]) - float_value(*args[1]));
+          break;
+        default:
           make_result(args[0]->get<const json::number_float_t>() - args[1]->get<const json::number_float_t>());
         }
       INJA_OP_TRY_END_GRACEFUL("subtract")
@@ -415,9 +833,14 @@ class Renderer : public NodeVisitor {
     case Op::Multiplication: {
       INJA_OP_TRY_BEGIN
         const auto args = get_arguments<2>(node);
-        if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-          make_result(args[0]->get<const json::number_integer_t>() * args[1]->get<const json::number_integer_t>());
-        } else {
+        switch (operand_types(node, *args[0], *args[1])) {
+        case OperandTypes::Integer:
+          make_result(integer_value(*args[0]) * integer_value(*args[1]));
+          break;
+        case OperandTypes::Float:
+          make_result(float_value(*args[0]) * float_value(*args[1]));
+          break;
+        default:
           make_result(args[0]->get<const json::number_float_t>() * args[1]->get<const json::number_float_t>());
         }
       INJA_OP_TRY_END_GRACEFUL("multiply")
@@ -552,7 +975,9 @@ class Renderer : public NodeVisitor {
     case Op::Exists: {
       INJA_OP_TRY_BEGIN
         auto&& name = get_arguments<1>(node)[0]->get_ref<const json::string_t&>();
-        make_result(data_input->contains(json::json_pointer(DataNode::convert_dot_to_ptr(name))));
+        const auto ptr = json::json_pointer(DataNode::convert_dot_to_ptr(name));
+        make_result(find_input(ptr) != nullptr || (data_provider != nullptr && provider_value(DataNode::split_dots(name)) != nullptr) ||
+                    (static_data != nullptr && static_data->contains(ptr)));
       INJA_OP_TRY_END_GRACEFUL("exists")
     } break;
     case Op::ExistsInObject: {
@@ -704,7 +1129,15 @@ class Renderer : public NodeVisitor {
       make_result(get_arguments<1>(node)[0]->is_string());
     } break;
     case Op::Callback: {
+      const CallbackFunction* callback = &node.callback;
+      CallbackFunction registered_callback;
       if (!node.callback) {
+        // Templates compiled ahead of time resolve their callbacks at render time
+        registered_callback = function_storage.find_function(node.name, static_cast<int>(node.arguments.size())).callback;
+        callback = &registered_callback;
+      }
+
+      if (!*callback) {
         // Callback is null - function not found or not registered
         if (config.graceful_errors) {
           // Unknown function without callback in graceful mode
@@ -718,10 +1151,10 @@ class Renderer : public NodeVisitor {
         // If a callback wrapper is set (for tracing/instrumentation), use it
         if (config.callback_wrapper) {
           make_result(config.callback_wrapper(node.name, args, [&]() {
-            return node.callback(args);
+            return (*callback)(args);
           }));
         } else {
-          make_result(node.callback(args));
+          make_result((*callback)(args));
         }
       }
     } break;
@@ -797,57 +1230,231 @@ class Renderer : public NodeVisitor {
 
   void visit(const ForStatementNode&) override {}
 
-  void visit(const ForArrayStatementNode& node) override {
-    const auto result = eval_expression_list(node.condition);
-    // In graceful error mode, result can be nullptr if variable is missing
-    if (!result) {
-      if (config.graceful_errors) {
-        return; // Skip the loop if variable is missing in graceful mode
-      }
-      throw_renderer_error("expression could not be evaluated", node);
-    }
-    if (!result->is_array()) {
-      throw_renderer_error("object must be an array", node);
+  /// Returns the data of the innermost loop, must be looked up again after inserting into the local data (e.g. for ordered_json)
+  json& loop_data() {
+    return additional_data["loop"];
+  }
+
+  void enter_loop(size_t size) {
+    json& loop = loop_data();
+    if (!loop.empty()) {
+      json parent = std::move(loop);
+      loop = json::object();
+      loop["parent"] = std::move(parent);
     }
+    loop["is_first"] = true;
+    loop["is_last"] = (size <= 1);
+  }
 
-    emit_event(InstrumentationEvent::ForLoopStart, node.value, "array", result->size());
+  void update_loop(size_t index, size_t size) {
+    json& loop = loop_data();
+    loop["index"] = index;
+    loop["index1"] = index + 1;
+    if (index == 1) {
+      loop["is_first"] = false;
+    }
+    if (index == size - 1) {
+      loop["is_last"] = true;
+    }
+  }
 
-    if (!current_loop_data->empty()) {
-      auto tmp = *current_loop_data; // Because of clang-3
-      (*current_loop_data)["parent"] = std::move(tmp);
+  void leave_loop() {
+    json& loop = loop_data();
+    if (!loop["parent"].empty()) {
+      json parent = std::move(loop["parent"]);
+      loop = std::move(parent);
     }
+  }
+
+  /// Renders the body of an array loop for each element, bind assigns the element with the given index to the loop variable
+  template <class Bind> void render_array_loop(const ForArrayStatementNode& node, size_t size, Bind bind) {
+    emit_event(InstrumentationEvent::ForLoopStart, node.value, "array", size);
 
+    enter_loop(size);
     size_t index = 0;
-    (*current_loop_data)["is_first"] = true;
-    (*current_loop_data)["is_last"] = (result->size() <= 1);
-    for (auto it = result->begin(); it != result->end(); ++it) {
-      additional_data[static_cast<std::string>(node.value)] = *it;
+    for (; index < size; ++index) {
+      bind(index);
+      invalidate_memo(node.value);
+      invalidate_memo("loop");
 
-      (*current_loop_data)["index"] = index;
-      (*current_loop_data)["index1"] = index + 1;
-      if (index == 1) {
-        (*current_loop_data)["is_first"] = false;
-      }
-      if (index == result->size() - 1) {
-        (*current_loop_data)["is_last"] = true;
-      }
+      update_loop(index, size);
+      node.body.accept(*this);
+    }
 
+    additional_data[static_cast<std::string>(node.value)].clear();
+    leave_loop();
+    invalidate_memo(node.value);
+    invalidate_memo("loop");
+
+    emit_event(InstrumentationEvent::ForLoopEnd, node.value, "array", index);
+  }
+
+  /// Renders the body of an object loop for each element, bind assigns the key and value with the given index to the loop variables
+  template <class Bind> void render_object_loop(const ForObjectStatementNode& node, size_t size, Bind bind) {
+    emit_event(InstrumentationEvent::ForLoopStart, node.value, "object", size);
+
+    enter_loop(size);
+    size_t index = 0;
+    for (; index < size; ++index) {
+      bind(index);
+      invalidate_memo(node.key);
+      invalidate_memo(node.value);
+      invalidate_memo("loop");
+
+      update_loop(index, size);
       node.body.accept(*this);
-      ++index;
     }
 
+    additional_data[static_cast<std::string>(node.key)].clear();
     additional_data[static_cast<std::string>(node.value)].clear();
-    if (!(*current_loop_data)["parent"].empty()) {
-      const auto tmp = (*current_loop_data)["parent"];
-      *current_loop_data = tmp;
+    leave_loop();
+    invalidate_memo(node.key);
+    invalidate_memo(node.value);
+    invalidate_memo("loop");
+
+    emit_event(InstrumentationEvent::ForLoopEnd, node.value, "object", index);
+  }
+
+  /// Binds the loop variable to elements of the data provider while rendering the loop, without looking up the whole container
+  template <class Loop> void render_provider_loop(const std::string& name, Loop loop) {
+    const auto previous = provider_aliases.find(name);
+    std::optional<DataProvider::Path> outer;
+    if (previous != provider_aliases.end()) {
+      outer = previous->second;
+    }
+
+    loop();
+
+    if (outer) {
+      provider_aliases[name] = std::move(*outer);
     } else {
-      current_loop_data = &additional_data["loop"];
+      provider_aliases.erase(name);
     }
+  }
 
-    emit_event(InstrumentationEvent::ForLoopEnd, node.value, "array", index);
+  /// Returns the loop variables of the body if the iterations of the loop can be rendered concurrently, or std::nullopt
+  const std::optional<std::vector<std::string>>& find_concurrent_loop(const ForArrayStatementNode& node) {
+    std::lock_guard<std::mutex> lock(concurrent_nodes->mutex);
+    const auto [it, inserted] = concurrent_nodes->loops.try_emplace({&node, template_stack.front()});
+    if (!inserted) {
+      return it->second;
+    }
+
+    // An iteration must not see variables of the previous one, including loop variables of the body that are read outside of their loop
+    EffectVisitor visitor(template_storage, function_storage, template_stack);
+    const auto effects = visitor.analyze(node.body);
+    const bool reads_loop_variable = std::any_of(effects.loop_variables.begin(), effects.loop_variables.end(),
+                                                 [&effects](const std::string& name) { return effects.free_variables.count(name) > 0; });
+    if (!effects.has_side_effects && !effects.sets_variables && !reads_loop_variable && effects.loop_variables.count(node.value) == 0) {
+      it->second = std::vector<std::string>(effects.loop_variables.begin(), effects.loop_variables.end());
+    }
+    return it->second;
   }
 
-  void visit(const ForObjectStatementNode& node) override {
+  /*!
+   * \brief Renders the iterations of a large loop in chunks on the thread pool, returns false if they are not independent.
+   *
+   * Every chunk is rendered by a copy of this renderer, with the loop data of
+   * its first iteration. The outputs and errors are written in order, and the
+   * variables are left as after a serial render.
+   */
+  bool render_loop_concurrently(const ForArrayStatementNode& node, const json& array) {
+    if (data_provider != nullptr || config.instrumentation_callback) {
+      return false;
+    }
+    const auto& body_loop_variables = find_concurrent_loop(node);
+    if (!body_loop_variables) {
+      return false;
+    }
+
+    const size_t size = array.size();
+    const std::string value_name = static_cast<std::string>(node.value);
+    enter_loop(size);
+
+    const size_t chunk_count = std::min(size, config.thread_pool->size() * 4);
+    const size_t chunk_size = (size + chunk_count - 1) / chunk_count;
+    std::vector<ConcurrentPart> parts((size + chunk_size - 1) / chunk_size);
+    try {
+      for (size_t c = 0; c < parts.size(); ++c) {
+        auto chunk = fork();
+        const size_t begin = c * chunk_size;
+        const size_t end = std::min(begin + chunk_size, size);
+        if (begin > 1) {
+          chunk->update_loop(1, size);
+        }
+        // Marks the loop variables of the body that are not bound by the chunk
+        for (const auto& name : *body_loop_variables) {
+          chunk->additional_data[name] = json(json::value_t::discarded);
+        }
+
+        auto& part = parts[c];
+        part.task = config.thread_pool->submit([chunk, &node, &array, &part, &value_name, begin, end, size]() {
+          std::ostringstream os;
+          chunk->output_stream = &os;
+          for (size_t index = begin; index < end; ++index) {
+            chunk->additional_data[value_name] = array[index];
+            chunk->invalidate_memo(value_name);
+            chunk->invalidate_memo("loop");
+            chunk->update_loop(index, size);
+            node.body.accept(*chunk);
+          }
+          part.output = std::move(os).str();
+          part.errors = std::move(chunk->render_errors);
+          part.local_data = std::move(chunk->additional_data);
+        });
+      }
+    } catch (...) {
+      for (const auto& part : parts) {
+        if (part.task.valid()) {
+          config.thread_pool->wait(part.task);
+        }
+      }
+      throw;
+    }
+    join(parts);
+
+    for (auto& part : parts) {
+      *output_stream << part.output;
+      render_errors.insert(render_errors.end(), part.errors.begin(), part.errors.end());
+    }
+
+    // Loop variables of the body keep the value of the last chunk that bound them
+    for (const auto& name : *body_loop_variables) {
+      for (auto part = parts.rbegin(); part != parts.rend(); ++part) {
+        if (!part->local_data[name].is_discarded()) {
+          additional_data[name] = std::move(part->local_data[name]);
+          break;
+        }
+      }
+      invalidate_memo(name);
+    }
+
+    // The loop data as after the last iteration
+    additional_data[value_name] = array[size - 1];
+    additional_data[value_name].clear();
+    update_loop(0, size);
+    update_loop(1, size);
+    update_loop(size - 1, size);
+    leave_loop();
+    invalidate_memo(value_name);
+    invalidate_memo("loop");
+    return true;
+  }
+
+  void visit(const ForArrayStatementNode& node) override {
+    if (const auto path = provider_loop_path(node.condition)) {
+      if (const auto size = data_provider->array_size(*path)) {
+        render_provider_loop(node.value, [&] {
+          render_array_loop(node, *size, [&](size_t index) {
+            auto element = *path;
+            element.push_back(std::to_string(index));
+            provider_aliases[node.value] = std::move(element);
+          });
+        });
+        return;
+      }
+    }
+
     const auto result = eval_expression_list(node.condition);
     // In graceful error mode, result can be nullptr if variable is missing
     if (!result) {
@@ -856,45 +1463,59 @@ class Renderer : public NodeVisitor {
       }
       throw_renderer_error("expression could not be evaluated", node);
     }
-    if (!result->is_object()) {
-      throw_renderer_error("object must be an object", node);
+    if (!result->is_array()) {
+      throw_renderer_error("object must be an array", node);
     }
 
-    emit_event(InstrumentationEvent::ForLoopStart, node.value, "object", result->size());
-
-    if (!current_loop_data->empty()) {
-      (*current_loop_data)["parent"] = std::move(*current_loop_data);
+    if (concurrent_nodes && config.concurrent_loop_size > 0 && result->size() >= std::max<size_t>(config.concurrent_loop_size, 2) &&
+        render_loop_concurrently(node, *result)) {
+      return;
     }
 
-    size_t index = 0;
-    (*current_loop_data)["is_first"] = true;
-    (*current_loop_data)["is_last"] = (result->size() <= 1);
-    for (auto it = result->begin(); it != result->end(); ++it) {
-      additional_data[static_cast<std::string>(node.key)] = it.key();
-      additional_data[static_cast<std::string>(node.value)] = it.value();
-
-      (*current_loop_data)["index"] = index;
-      (*current_loop_data)["index1"] = index + 1;
-      if (index == 1) {
-        (*current_loop_data)["is_first"] = false;
-      }
-      if (index == result->size() - 1) {
-        (*current_loop_data)["is_last"] = true;
+    auto it = result->begin();
+    render_array_loop(node, result->size(), [&](size_t index) {
+      if (index > 0) {
+        ++it;
       }
+      additional_data[static_cast<std::string>(node.value)] = *it;
+    });
+  }
 
-      node.body.accept(*this);
-      ++index;
+  void visit(const ForObjectStatementNode& node) override {
+    if (const auto path = provider_loop_path(node.condition)) {
+      if (const auto keys = data_provider->object_keys(*path)) {
+        render_provider_loop(node.value, [&] {
+          render_object_loop(node, keys->size(), [&](size_t index) {
+            auto element = *path;
+            element.push_back((*keys)[index]);
+            additional_data[static_cast<std::string>(node.key)] = (*keys)[index];
+            provider_aliases[node.value] = std::move(element);
+          });
+        });
+        return;
+      }
     }
 
-    additional_data[static_cast<std::string>(node.key)].clear();
-    additional_data[static_cast<std::string>(node.value)].clear();
-    if (!(*current_loop_data)["parent"].empty()) {
-      *current_loop_data = std::move((*current_loop_data)["parent"]);
-    } else {
-      current_loop_data = &additional_data["loop"];
+    const auto result = eval_expression_list(node.condition);
+    // In graceful error mode, result can be nullptr if variable is missing
+    if (!result) {
+      if (config.graceful_errors) {
+        return; // Skip the loop if variable is missing in graceful mode
+      }
+      throw_renderer_error("expression could not be evaluated", node);
+    }
+    if (!result->is_object()) {
+      throw_renderer_error("object must be an object", node);
     }
 
-    emit_event(InstrumentationEvent::ForLoopEnd, node.value, "object", index);
+    auto it = result->begin();
+    render_object_loop(node, result->size(), [&](size_t index) {
+      if (index > 0) {
+        ++it;
+      }
+      additional_data[static_cast<std::string>(node.key)] = it.key();
+      additional_data[static_cast<std::string>(node.value)] = it.value();
+    });
   }
 
   void visit(const IfStatementNode& node) override {
@@ -911,9 +1532,23 @@ class Renderer : public NodeVisitor {
     emit_event(InstrumentationEvent::IncludeStart, node.file);
 
     auto sub_renderer = Renderer(config, template_storage, function_storage);
-    const auto included_template_it = template_storage.find(node.file);
-    if (included_template_it != template_storage.end()) {
-      sub_renderer.render_to(*output_stream, included_template_it->second, *data_input, &additional_data);
+    sub_renderer.static_data = static_data;
+    sub_renderer.data_layers = data_layers;
+    sub_renderer.data_provider = data_provider;
+    sub_renderer.provider_values = provider_values;
+    sub_renderer.provider_aliases = provider_aliases;
+    sub_renderer.stop_token = stop_token;
+    sub_renderer.deadline = deadline;
+    sub_renderer.concurrent_nodes = concurrent_nodes;
+    const Template* included_template = node.linked;
+    if (included_template == nullptr) {
+      const auto included_template_it = template_storage.find(node.file);
+      if (included_template_it != template_storage.end()) {
+        included_template = &included_template_it->second;
+      }
+    }
+    if (included_template != nullptr) {
+      sub_renderer.render_to(*output_stream, *included_template, *data_input, &additional_data);
       emit_event(InstrumentationEvent::IncludeEnd, node.file, "success");
     } else if (config.throw_at_missing_includes) {
       emit_event(InstrumentationEvent::IncludeEnd, node.file, "not_found");
@@ -924,9 +1559,14 @@ class Renderer : public NodeVisitor {
   }
 
   void visit(const ExtendsStatementNode& node) override {
-    const auto included_template_it = template_storage.find(node.file);
-    if (included_template_it != template_storage.end()) {
-      const Template* parent_template = &included_template_it->second;
+    const Template* parent_template = node.linked;
+    if (parent_template == nullptr) {
+      const auto parent_template_it = template_storage.find(node.file);
+      if (parent_template_it != template_storage.end()) {
+        parent_template = &parent_template_it->second;
+      }
+    }
+    if (parent_template != nullptr) {
       render_to(*output_stream, *parent_template, *data_input, &additional_data);
       break_rendering = true;
     } else if (config.throw_at_missing_includes) {
@@ -1046,9 +1686,14 @@ class Renderer : public NodeVisitor {
     replace_substring(ptr, ".", "/");
     ptr = "/" + ptr;
 
+    if (!provider_aliases.empty()) {
+      materialize_alias(node.key);
+    }
+
     try {
       // Try in-place optimization first
       if (try_inplace_self_assignment(node, ptr)) {
+        invalidate_memo(node.key);
         emit_event(InstrumentationEvent::SetStatementEnd, node.key, "inplace");
         return;  // Successfully used in-place optimization
       }
@@ -1082,6 +1727,7 @@ class Renderer : public NodeVisitor {
         throw_renderer_error("failed to set variable '" + node.key + "' with unknown exception", node);
       }
     }
+    invalidate_memo(node.key);
   }
 
   void visit(const RawStatementNode& node) override {
@@ -1091,15 +1737,87 @@ class Renderer : public NodeVisitor {
 
 public:
   explicit Renderer(const RenderConfig& config, const TemplateStorage& template_storage, const FunctionStorage& function_storage)
-      : config(config), template_storage(template_storage), function_storage(function_storage) {}
+      : config(config), template_storage(template_storage), function_storage(function_storage) {
+    if (config.thread_pool) {
+      concurrent_nodes = std::make_shared<ConcurrentNodes>();
+    }
+  }
+
+  static bool truthy(const json* data) {
+    // In graceful error mode, data can be nullptr for missing variables
+    if (!data) {
+      return false;
+    }
+    if (data->is_boolean()) {
+      return data->get<bool>();
+    } else if (data->is_number()) {
+      return (*data != 0);
+    } else if (data->is_null()) {
+      return false;
+    }
+    return !data->empty();
+  }
+
+  /// Looks up variables that are not set in the template in the provider before the json data, see DataProvider
+  void set_data_provider(const DataProvider* provider) {
+    data_provider = provider;
+    provider_values = (provider != nullptr) ? std::make_shared<std::map<DataProvider::Path, std::optional<json>>>() : nullptr;
+  }
+
+  /// Sets further data looked up after the data passed to render_to(), from top to bottom
+  void set_data_layers(std::vector<const json*> layers) {
+    data_layers = std::move(layers);
+  }
+
+  /// Stops rendering with an InterruptError once a stop is requested or the deadline passed
+  void set_interruption(std::stop_token token, std::chrono::steady_clock::time_point until) {
+    stop_token = std::move(token);
+    deadline = until;
+    nodes_since_deadline_check = 0;
+  }
+
+  /*!
+   * \brief Drops the state of the last render, so that the renderer can render again.
+   *
+   * The data provider and layers are kept, as are the capacities of the
+   * internal stacks and caches, so that repeated renders don't allocate them
+   * again.
+   */
+  void reset() {
+    current_level = 0;
+    template_stack.clear();
+    block_statement_stack.clear();
+    static_data = nullptr;
+    additional_data = json::object({{"loop", nullptr}});
+    data_tmp_stack.clear();
+    while (!data_eval_stack.empty()) {
+      data_eval_stack.pop();
+    }
+    while (!not_found_stack.empty()) {
+      not_found_stack.pop();
+    }
+    break_rendering = false;
+    render_errors.clear();
+    clear_memo();
+    if (provider_values) {
+      provider_values->clear();
+    }
+    provider_aliases.clear();
+    if (concurrent_nodes) {
+      concurrent_nodes = std::make_shared<ConcurrentNodes>();
+    }
+  }
 
   void render_to(std::ostream& os, const Template& tmpl, const json& data, json* loop_data = nullptr) {
     output_stream = &os;
     current_template = &tmpl;
     data_input = &data;
+    if (tmpl.static_data) {
+      static_data = tmpl.static_data.get();
+    }
     if (loop_data != nullptr) {
       additional_data = *loop_data;
-      current_loop_data = &additional_data["loop"];
+      clear_memo();
     }
 
     emit_event(InstrumentationEvent::RenderStart);
@@ -1112,6 +1830,27 @@ public:
     emit_event(InstrumentationEvent::RenderEnd);
   }
   
+  /*!
+   * \brief Evaluates a single expression of a template outside of a render.
+   *
+   * Returns nullptr if the expression could not be evaluated.
+   */
+  std::shared_ptr<json> evaluate(const Template& tmpl, const ExpressionListNode& expression, const json& data) {
+    current_template = &tmpl;
+    data_input = &data;
+    template_stack.assign(1, current_template);
+
+    const size_t errors_size = render_errors.size();
+    auto result = eval_expression_list(expression);
+    data_tmp_stack.clear();
+    return (render_errors.size() == errors_size) ? result : nullptr;
+  }
+
+  /// Returns the variables set by the template during the last render, including the loop data
+  const json& get_local_data() const {
+    return additional_data;
+  }
+
   const std::vector<RenderErrorInfo>& get_render_errors() const {
     return render_errors;
   }
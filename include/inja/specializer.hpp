@@ -0,0 +1,400 @@
+#ifndef INCLUDE_INJA_SPECIALIZER_HPP_
+#define INCLUDE_INJA_SPECIALIZER_HPP_
+
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "config.hpp"
+#include "function_storage.hpp"
+#include "json.hpp"
+#include "node.hpp"
+#include "optimizer.hpp"
+#include "renderer.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Partially evaluates a template against data that is known in advance.
+ *
+ * Everything that only depends on the static data is evaluated away:
+ * expressions are printed into the text or folded into literals, if
+ * statements with a static condition keep only the taken branch, and loops
+ * over static data without any dynamic part are unrolled into text. Adjacent
+ * text is merged.
+ *
+ * Rendering the specialized template with the dynamic data gives the same
+ * output as rendering the original with both, as long as the dynamic data
+ * does not contain the top-level keys of the static data. The static data is
+ * attached to the specialized template, so that remaining lookups and
+ * included templates can still read it.
+ */
+class Specializer {
+  using Op = FunctionStorage::Operation;
+
+  RenderConfig config;
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
+  const bool copy_expressions; // Never share function nodes with the source, so that they can be annotated separately
+  const bool fold_callbacks;   // Call deterministic callbacks with static arguments, their result is baked into the template
+
+  const Template* source;
+  std::shared_ptr<const json> static_data;
+  std::set<std::string> static_names;    // Top-level keys of the static data that are never assigned
+  std::map<std::string, size_t> reads;   // Number of reads of each variable in the whole template
+  bool has_includes {false};
+
+  Template result;
+  std::string pending_text;
+
+  static std::string root_name(std::string_view name) {
+    return AssignmentCollector::root_name(name);
+  }
+
+  static void count_reads(const ExpressionNode& expression, std::map<std::string, size_t>& counts) {
+    if (const auto* data = dynamic_cast<const DataNode*>(&expression)) {
+      counts[root_name(data->name)] += 1;
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(&expression)) {
+      for (const auto& argument : function->arguments) {
+        count_reads(*argument, counts);
+      }
+    }
+  }
+
+  static void count_reads(const AstNode& node, std::map<std::string, size_t>& counts, bool& has_includes) {
+    const auto count_expression = [&counts](const ExpressionListNode& expression) {
+      if (expression.root) {
+        count_reads(*expression.root, counts);
+      }
+    };
+
+    if (const auto* block = dynamic_cast<const BlockNode*>(&node)) {
+      for (const auto& n : block->nodes) {
+        count_reads(*n, counts, has_includes);
+      }
+    } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(&node)) {
+      count_expression(*expression);
+    } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(&node)) {
+      count_expression(loop->condition);
+      count_reads(loop->body, counts, has_includes);
+    } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(&node)) {
+      count_expression(condition->condition);
+      count_reads(condition->true_statement, counts, has_includes);
+      count_reads(condition->false_statement, counts, has_includes);
+    } else if (const auto* set = dynamic_cast<const SetStatementNode*>(&node)) {
+      count_expression(set->expression);
+    } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(&node)) {
+      count_reads(block_statement->block, counts, has_includes);
+    } else if (dynamic_cast<const IncludeStatementNode*>(&node) || dynamic_cast<const ExtendsStatementNode*>(&node)) {
+      has_includes = true;
+    }
+  }
+
+  /// Returns whether an expression only depends on static data and the given bound loop variables
+  bool is_static(const ExpressionNode& expression, const std::set<std::string>& bound) const {
+    if (dynamic_cast<const LiteralNode*>(&expression)) {
+      return true;
+
+    } else if (const auto* data = dynamic_cast<const DataNode*>(&expression)) {
+      const auto root = root_name(data->name);
+      if (root == "loop") {
+        // The parent loop might be dynamic
+        return bound.count(root) > 0 && data->name != "loop" && data->name.rfind("loop.parent", 0) != 0;
+      }
+      return static_names.count(root) > 0 || bound.count(root) > 0;
+
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(&expression)) {
+      switch (function->operation) {
+      case Op::Super:
+      case Op::None:
+      case Op::Exists:
+        return false;
+      case Op::AtId:
+        return is_static(*function->arguments[0], bound);
+      case Op::Callback: {
+        const auto function_data = function_storage.find_function(function->name, static_cast<int>(function->arguments.size()));
+        if (!fold_callbacks || function_data.operation != Op::Callback || !function_data.deterministic) {
+          return false;
+        }
+      } break;
+      default:
+        break;
+      }
+      return std::all_of(function->arguments.begin(), function->arguments.end(), [&](const std::shared_ptr<ExpressionNode>& argument) {
+        return is_static(*argument, bound);
+      });
+    }
+    return false;
+  }
+
+  /// Returns whether a statement can be rendered completely with the static data
+  bool is_static(const AstNode& node, const std::set<std::string>& bound) const {
+    if (const auto* block = dynamic_cast<const BlockNode*>(&node)) {
+      return std::all_of(block->nodes.begin(), block->nodes.end(), [&](const std::shared_ptr<AstNode>& n) {
+        return is_static(*n, bound);
+      });
+    } else if (dynamic_cast<const TextNode*>(&node) || dynamic_cast<const RawStatementNode*>(&node)) {
+      return true;
+    } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(&node)) {
+      return expression->root && is_static(*expression->root, bound);
+    } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(&node)) {
+      return condition->condition.root && is_static(*condition->condition.root, bound) && is_static(condition->true_statement, bound) &&
+             is_static(condition->false_statement, bound);
+    } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(&node)) {
+      if (!loop->condition.root || !is_static(*loop->condition.root, bound)) {
+        return false;
+      }
+
+      // The loop variables stay visible after the loop, so they must not be read anywhere else
+      std::set<std::string> variables {"loop"};
+      if (const auto* array_loop = dynamic_cast<const ForArrayStatementNode*>(loop)) {
+        variables.insert(root_name(array_loop->value));
+      } else if (const auto* object_loop = dynamic_cast<const ForObjectStatementNode*>(loop)) {
+        variables.insert(root_name(object_loop->key));
+        variables.insert(root_name(object_loop->value));
+      }
+      if (bound.empty()) {
+        if (has_includes) {
+          return false;
+        }
+        std::map<std::string, size_t> loop_reads;
+        bool loop_includes = false;
+        count_reads(*loop, loop_reads, loop_includes);
+        for (const auto& variable : variables) {
+          if (reads.count(variable) > 0 && reads.at(variable) != loop_reads[variable]) {
+            return false;
+          }
+        }
+      }
+
+      auto body_bound = bound;
+      body_bound.insert(variables.begin(), variables.end());
+      return is_static(loop->body, body_bound);
+    }
+    return false;
+  }
+
+  /// Renders a static statement with the static data, returns false if that fails
+  bool render_static(const std::shared_ptr<AstNode>& node, std::string& output) const {
+    Template tmpl(source->content);
+    tmpl.root.nodes.push_back(node);
+
+    std::ostringstream os;
+    Renderer renderer(config, template_storage, function_storage);
+    try {
+      renderer.render_to(os, tmpl, *static_data);
+    } catch (const std::exception&) {
+      return false;
+    }
+    if (!renderer.get_render_errors().empty()) {
+      return false;
+    }
+    output = os.str();
+    return true;
+  }
+
+  std::shared_ptr<json> evaluate(const std::shared_ptr<ExpressionNode>& expression) const {
+    ExpressionListNode expression_list(expression->pos);
+    expression_list.root = expression;
+
+    Renderer renderer(config, template_storage, function_storage);
+    try {
+      return renderer.evaluate(*source, expression_list, *static_data);
+    } catch (const std::exception&) {
+      return nullptr;
+    }
+  }
+
+  /// Replaces all static subexpressions by literals
+  std::shared_ptr<ExpressionNode> fold(const std::shared_ptr<ExpressionNode>& expression) const {
+    if (dynamic_cast<const LiteralNode*>(expression.get())) {
+      return expression;
+    }
+
+    if (is_static(*expression, {})) {
+      const auto value = evaluate(expression);
+      // Containers are kept as lookups into the static data instead of being copied
+      if (value && (dynamic_cast<const FunctionNode*>(expression.get()) || !value->is_structured())) {
+        return std::make_shared<LiteralNode>(*value, expression->pos);
+      }
+      if (!copy_expressions) {
+        return expression;
+      }
+    }
+
+    const auto* function = dynamic_cast<const FunctionNode*>(expression.get());
+    if (function == nullptr) {
+      return expression;
+    }
+
+    auto folded = std::make_shared<FunctionNode>(*function);
+    folded->memo_key = nullptr;
+    folded->memo_dependencies.clear();
+
+    bool changed = false;
+    const size_t foldable_arguments = (function->operation == Op::AtId) ? 1 : function->arguments.size();
+    for (size_t i = 0; i < foldable_arguments; ++i) {
+      folded->arguments[i] = fold(function->arguments[i]);
+      changed = changed || (folded->arguments[i] != function->arguments[i]);
+    }
+    return (changed || copy_expressions) ? folded : expression;
+  }
+
+  void fold(const ExpressionListNode& expression, ExpressionListNode& target) const {
+    target.pos = expression.pos;
+    target.length = expression.length;
+    target.root = expression.root ? fold(expression.root) : nullptr;
+  }
+
+  void flush(BlockNode& target) {
+    if (pending_text.empty()) {
+      return;
+    }
+    target.nodes.push_back(std::make_shared<TextNode>(result.content.size(), pending_text.size()));
+    result.content += pending_text;
+    pending_text.clear();
+  }
+
+  /// Appends the specialized nodes of a block to the target block, without flushing the text at the end
+  void specialize_nodes(const BlockNode& block, BlockNode& target) {
+    for (const auto& node : block.nodes) {
+      if (const auto* text = dynamic_cast<const TextNode*>(node.get())) {
+        pending_text.append(source->content, text->pos, text->length);
+
+      } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(node.get())) {
+        std::string output;
+        if (is_static(*expression, {}) && render_static(node, output)) {
+          pending_text += output;
+          continue;
+        }
+
+        flush(target);
+        auto specialized = std::make_shared<ExpressionListNode>();
+        fold(*expression, *specialized);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node.get())) {
+        if (condition->condition.root && is_static(*condition->condition.root, {})) {
+          const auto value = evaluate(condition->condition.root);
+          if (value) {
+            // Only the taken branch remains
+            if (Renderer::truthy(value.get())) {
+              specialize_nodes(condition->true_statement, target);
+            } else if (condition->has_false_statement) {
+              specialize_nodes(condition->false_statement, target);
+            }
+            continue;
+          }
+        }
+
+        flush(target);
+        auto specialized = std::make_shared<IfStatementNode>(condition->is_nested, &target, condition->pos);
+        fold(condition->condition, specialized->condition);
+        specialized->has_false_statement = condition->has_false_statement;
+        specialize_block(condition->true_statement, specialized->true_statement);
+        specialize_block(condition->false_statement, specialized->false_statement);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(node.get())) {
+        std::string output;
+        if (is_static(*loop, {}) && render_static(node, output)) {
+          pending_text += output;
+          continue;
+        }
+
+        flush(target);
+        std::shared_ptr<ForStatementNode> specialized;
+        if (const auto* array_loop = dynamic_cast<const ForArrayStatementNode*>(loop)) {
+          specialized = std::make_shared<ForArrayStatementNode>(array_loop->value, &target, loop->pos);
+        } else if (const auto* object_loop = dynamic_cast<const ForObjectStatementNode*>(loop)) {
+          specialized = std::make_shared<ForObjectStatementNode>(object_loop->key, object_loop->value, &target, loop->pos);
+        }
+        fold(loop->condition, specialized->condition);
+        specialize_block(loop->body, specialized->body);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* set = dynamic_cast<const SetStatementNode*>(node.get())) {
+        flush(target);
+        auto specialized = std::make_shared<SetStatementNode>(set->key, set->pos);
+        fold(set->expression, specialized->expression);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node.get())) {
+        flush(target);
+        auto specialized = std::make_shared<BlockStatementNode>(&target, block_statement->name, block_statement->pos);
+        specialize_block(block_statement->block, specialized->block);
+        result.block_storage[block_statement->name] = specialized;
+        target.nodes.push_back(specialized);
+
+      } else {
+        // Includes, extends and raw statements are kept as they are
+        flush(target);
+        target.nodes.push_back(node);
+      }
+    }
+  }
+
+  void specialize_block(const BlockNode& block, BlockNode& target) {
+    specialize_nodes(block, target);
+    flush(target);
+  }
+
+public:
+  explicit Specializer(const RenderConfig& config, const TemplateStorage& template_storage, const FunctionStorage& function_storage,
+                       bool copy_expressions = false, bool fold_callbacks = true)
+      : config(config), template_storage(template_storage), function_storage(function_storage), copy_expressions(copy_expressions),
+        fold_callbacks(fold_callbacks) {
+    this->config.instrumentation_callback = nullptr;
+  }
+
+  Template specialize(const Template& tmpl, const json& data) {
+    source = &tmpl;
+
+    // Specializing a specialized template again accumulates the static data
+    auto merged = std::make_shared<json>(tmpl.static_data ? *tmpl.static_data : json::object());
+    if (data.is_object()) {
+      merged->update(data);
+    }
+    static_data = merged;
+
+    // Assigned variables shadow the static data
+    AssignmentCollector assignments;
+    tmpl.root.accept(assignments);
+    static_names.clear();
+    for (auto it = static_data->begin(); it != static_data->end(); ++it) {
+      if (assignments.variables.count(it.key()) == 0) {
+        static_names.insert(it.key());
+      }
+    }
+
+    reads.clear();
+    has_includes = false;
+    count_reads(tmpl.root, reads, has_includes);
+
+    // Keep the original content, so that the positions of all kept nodes stay valid
+    result = Template(tmpl.content);
+    result.static_data = static_data;
+    pending_text.clear();
+    specialize_block(tmpl.root, result.root);
+
+    // Blocks in removed branches can still be rendered from a parent template
+    for (const auto& [name, block_statement] : tmpl.block_storage) {
+      if (result.block_storage.count(name) == 0) {
+        auto specialized = std::make_shared<BlockStatementNode>(nullptr, name, block_statement->pos);
+        specialize_block(block_statement->block, specialized->block);
+        result.block_storage[name] = specialized;
+      }
+    }
+    return std::move(result);
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_SPECIALIZER_HPP_
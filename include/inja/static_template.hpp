@@ -0,0 +1,988 @@
+#ifndef INCLUDE_INJA_STATIC_TEMPLATE_HPP_
+#define INCLUDE_INJA_STATIC_TEMPLATE_HPP_
+
+#include <version>
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L && defined(__cpp_lib_constexpr_vector) &&                \
+    defined(__cpp_lib_constexpr_string)
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "function_storage.hpp"
+#include "json.hpp"
+#include "lexer.hpp"
+#include "native.hpp"
+#include "node.hpp"
+#include "template.hpp"
+#include "token.hpp"
+#include "utils.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A string literal usable as a template argument.
+ */
+template <size_t N>
+struct fixed_string {
+  char data[N] {};
+
+  constexpr fixed_string(const char (&input)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+      data[i] = input[i];
+    }
+  }
+
+  constexpr std::string_view view() const {
+    return {data, N - 1};
+  }
+};
+
+namespace static_detail {
+
+// Parse errors call these non-constexpr functions, which makes them compile errors naming the problem
+inline void unexpected_token_in_static_template() {}
+inline void malformed_expression_in_static_template() {}
+inline void unknown_function_in_static_template() {}
+inline void unmatched_statement_in_static_template() {}
+inline void statement_is_not_supported_in_static_templates() {}
+inline void expression_is_not_supported_in_static_templates() {}
+
+struct Expression {
+  enum class Kind {
+    Literal,
+    Data,
+    Function,
+  };
+
+  Kind kind {Kind::Literal};
+  FunctionStorage::Operation operation {FunctionStorage::Operation::None};
+  size_t pos {0};    // Where errors are reported, and the start of a literal or variable name
+  size_t length {0}; // Of a literal or variable name
+  size_t first {0};  // First argument of a function in the lists, or first key of a variable
+  size_t count {0};
+};
+
+struct Node {
+  enum class Kind {
+    Text,
+    Expression,
+    If,
+    ForArray,
+    ForObject,
+    Set,
+  };
+
+  Kind kind {Kind::Text};
+  size_t pos {0};    // Where errors are reported, or the start of a text
+  size_t length {0}; // Of a text
+  size_t expression {0};
+  size_t value_pos {0}; // Loop value, or the key of a set statement
+  size_t value_length {0};
+  size_t key_pos {0}; // Loop key of an object
+  size_t key_length {0};
+  size_t first {0}; // Body or true statement in the lists
+  size_t count {0};
+  size_t else_first {0};
+  size_t else_count {0};
+};
+
+/// A key of a variable path within the source
+struct Key {
+  size_t pos {0};
+  size_t length {0};
+};
+
+struct ProgramSize {
+  size_t nodes;
+  size_t expressions;
+  size_t lists;
+  size_t keys;
+};
+
+/// A template parsed at compile time, whose children and arguments are each stored contiguously in the lists
+struct Program {
+  std::vector<Node> nodes;
+  std::vector<Expression> expressions;
+  std::vector<size_t> lists;
+  std::vector<Key> keys;
+  size_t root_first {0};
+  size_t root_count {0};
+
+  constexpr ProgramSize size() const {
+    return {nodes.size(), expressions.size(), lists.size(), keys.size()};
+  }
+
+  /// Stores the items in the lists, returns their first index
+  constexpr size_t store(const std::vector<size_t>& items) {
+    const size_t result = lists.size();
+    lists.insert(lists.end(), items.begin(), items.end());
+    return result;
+  }
+};
+
+/// Same as the Program, with a size that is known at compile time so that it can be stored in a constant
+template <ProgramSize Size>
+struct StaticProgram {
+  std::array<Node, Size.nodes> nodes {};
+  std::array<Expression, Size.expressions> expressions {};
+  std::array<size_t, Size.lists> lists {};
+  std::array<Key, Size.keys> keys {};
+  size_t root_first {0};
+  size_t root_count {0};
+};
+
+/*!
+ * \brief Parses a template with the default LexerConfig at compile time.
+ *
+ * This follows the Parser with the tokens of the Lexer, but supports only
+ * text, comments, expressions and the if, for and set statements. Expressions
+ * may use literals, variables, operators and the builtin functions, except
+ * for member access with a dot and super().
+ */
+class ProgramParser {
+  using Op = FunctionStorage::Operation;
+
+  /// The statement that ended a block
+  enum class End {
+    Eof,
+    Else,
+    ElseIf,
+    EndIf,
+    EndFor,
+  };
+
+  LexerConfig lexer_config;
+  Lexer lexer;
+  std::string_view input;
+  Program& program;
+
+  Token tok, peek_tok;
+  bool have_peek_tok {false};
+  std::string_view literal_start;
+  Token::Kind end_closing {Token::Kind::Eof}; // Closing of the statement that ended the last block
+
+  constexpr void get_next_token() {
+    if (have_peek_tok) {
+      tok = peek_tok;
+      have_peek_tok = false;
+    } else {
+      tok = lexer.scan();
+    }
+  }
+
+  constexpr void get_peek_token() {
+    if (!have_peek_tok) {
+      peek_tok = lexer.scan();
+      have_peek_tok = true;
+    }
+  }
+
+  constexpr size_t position() const {
+    return static_cast<size_t>(tok.text.data() - input.data());
+  }
+
+  constexpr void expect_close(Token::Kind closing) const {
+    if (tok.kind != closing && !(closing == Token::Kind::LineStatementClose && tok.kind == Token::Kind::Eof)) {
+      unexpected_token_in_static_template();
+    }
+  }
+
+  constexpr size_t add_expression(const Expression& expression) {
+    program.expressions.push_back(expression);
+    return program.expressions.size() - 1;
+  }
+
+  constexpr size_t add_node(const Node& node) {
+    program.nodes.push_back(node);
+    return program.nodes.size() - 1;
+  }
+
+  constexpr void add_literal(std::vector<size_t>& arguments) {
+    const size_t pos = static_cast<size_t>(literal_start.data() - input.data());
+    const size_t length = static_cast<size_t>(tok.text.data() - literal_start.data()) + tok.text.size();
+    arguments.push_back(add_expression(Expression {Expression::Kind::Literal, Op::None, pos, length}));
+  }
+
+  /// Splits the name into the keys of its json pointer, like DataNode::convert_dot_to_ptr
+  constexpr void add_data(std::vector<size_t>& arguments) {
+    std::string_view name = tok.text;
+    if (name.find('~') != std::string_view::npos) {
+      expression_is_not_supported_in_static_templates();
+    }
+
+    Expression expression {Expression::Kind::Data, Op::None, position(), name.size(), program.keys.size(), 0};
+    if (name.size() > 1 && name.back() == '.') {
+      name.remove_suffix(1);
+    }
+    size_t start = expression.pos;
+    for (size_t i = 0; i <= name.size(); ++i) {
+      if (i == name.size() || name[i] == '.' || name[i] == '/') {
+        program.keys.push_back(Key {start, expression.pos + i - start});
+        expression.count += 1;
+        start = expression.pos + i + 1;
+      }
+    }
+    arguments.push_back(add_expression(expression));
+  }
+
+  constexpr void add_operator(std::vector<size_t>& arguments, std::vector<size_t>& operators) {
+    const size_t function = operators.back();
+    operators.pop_back();
+
+    const size_t number_args = static_cast<size_t>(FunctionNode::operator_properties(program.expressions[function].operation).number_args);
+    if (arguments.size() < number_args) {
+      malformed_expression_in_static_template();
+      return;
+    }
+
+    const std::vector<size_t> function_arguments(arguments.end() - static_cast<std::ptrdiff_t>(number_args), arguments.end());
+    arguments.resize(arguments.size() - number_args);
+    program.expressions[function].first = program.store(function_arguments);
+    program.expressions[function].count = number_args;
+    arguments.push_back(function);
+  }
+
+  /// Parses the arguments of a function after its left parenthesis, and resolves it to a builtin
+  constexpr size_t add_function(std::string_view name, size_t pos, std::vector<size_t> function_arguments) {
+    do {
+      get_next_token();
+      const size_t expression = parse_expression();
+      if (expression == std::string_view::npos) {
+        break;
+      }
+      function_arguments.push_back(expression);
+    } while (tok.kind == Token::Kind::Comma);
+    if (tok.kind != Token::Kind::RightParen) {
+      unexpected_token_in_static_template();
+    }
+    return resolve_function(name, pos, function_arguments);
+  }
+
+  constexpr size_t resolve_function(std::string_view name, size_t pos, const std::vector<size_t>& function_arguments) {
+    const Op operation = FunctionStorage::find_builtin(name, static_cast<int>(function_arguments.size()));
+    if (operation == Op::None) {
+      unknown_function_in_static_template();
+    } else if (operation == Op::Super) {
+      expression_is_not_supported_in_static_templates();
+    }
+
+    const size_t first = program.store(function_arguments);
+    return add_expression(Expression {Expression::Kind::Function, operation, pos, 0, first, function_arguments.size()});
+  }
+
+  constexpr Op operator_of(const Token& token) const {
+    switch (token.kind) {
+    case Token::Kind::Id:
+      if (token.text == "and") {
+        return Op::And;
+      } else if (token.text == "or") {
+        return Op::Or;
+      } else if (token.text == "in") {
+        return Op::In;
+      }
+      return Op::Not;
+    case Token::Kind::Equal:
+      return Op::Equal;
+    case Token::Kind::NotEqual:
+      return Op::NotEqual;
+    case Token::Kind::GreaterThan:
+      return Op::Greater;
+    case Token::Kind::GreaterEqual:
+      return Op::GreaterEqual;
+    case Token::Kind::LessThan:
+      return Op::Less;
+    case Token::Kind::LessEqual:
+      return Op::LessEqual;
+    case Token::Kind::Plus:
+      return Op::Add;
+    case Token::Kind::Minus:
+      return Op::Subtract;
+    case Token::Kind::Times:
+      return Op::Multiplication;
+    case Token::Kind::Slash:
+      return Op::Division;
+    case Token::Kind::Power:
+      return Op::Power;
+    case Token::Kind::Percent:
+      return Op::Modulo;
+    default:
+      // Member access with a dot
+      expression_is_not_supported_in_static_templates();
+      return Op::AtId;
+    }
+  }
+
+  /// Returns the index of the expression, or npos if it is empty
+  constexpr size_t parse_expression() {
+    size_t current_bracket_level {0};
+    size_t current_brace_level {0};
+    std::vector<size_t> arguments;
+    std::vector<size_t> operators;
+
+    const auto add_operation = [&](Op operation) {
+      const auto properties = FunctionNode::operator_properties(operation);
+      while (!operators.empty()) {
+        const auto top = FunctionNode::operator_properties(program.expressions[operators.back()].operation);
+        if (top.precedence < properties.precedence ||
+            (top.precedence == properties.precedence && properties.associativity != FunctionNode::Associativity::Left)) {
+          break;
+        }
+        add_operator(arguments, operators);
+      }
+      operators.push_back(add_expression(Expression {Expression::Kind::Function, operation, position()}));
+    };
+
+    for (bool done = false; !done && tok.kind != Token::Kind::Eof;) {
+      switch (tok.kind) {
+      case Token::Kind::String:
+      case Token::Kind::Number: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+          add_literal(arguments);
+        }
+      } break;
+      case Token::Kind::LeftBracket: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+        }
+        current_bracket_level += 1;
+      } break;
+      case Token::Kind::LeftBrace: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+        }
+        current_brace_level += 1;
+      } break;
+      case Token::Kind::RightBracket: {
+        if (current_bracket_level == 0) {
+          unexpected_token_in_static_template();
+          break;
+        }
+        current_bracket_level -= 1;
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          add_literal(arguments);
+        }
+      } break;
+      case Token::Kind::RightBrace: {
+        if (current_brace_level == 0) {
+          unexpected_token_in_static_template();
+          break;
+        }
+        current_brace_level -= 1;
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          add_literal(arguments);
+        }
+      } break;
+      case Token::Kind::Id: {
+        get_peek_token();
+        if (tok.text == "true" || tok.text == "false" || tok.text == "null") {
+          if (current_brace_level == 0 && current_bracket_level == 0) {
+            literal_start = tok.text;
+            add_literal(arguments);
+          }
+        } else if (tok.text == "and" || tok.text == "or" || tok.text == "in" || tok.text == "not") {
+          add_operation(operator_of(tok));
+        } else if (peek_tok.kind == Token::Kind::LeftParen) {
+          const std::string_view name = tok.text;
+          const size_t pos = position();
+          get_next_token();
+          arguments.push_back(add_function(name, pos, {}));
+        } else {
+          add_data(arguments);
+        }
+      } break;
+      case Token::Kind::Equal:
+      case Token::Kind::NotEqual:
+      case Token::Kind::GreaterThan:
+      case Token::Kind::GreaterEqual:
+      case Token::Kind::LessThan:
+      case Token::Kind::LessEqual:
+      case Token::Kind::Plus:
+      case Token::Kind::Minus:
+      case Token::Kind::Times:
+      case Token::Kind::Slash:
+      case Token::Kind::Power:
+      case Token::Kind::Percent:
+      case Token::Kind::Dot: {
+        add_operation(operator_of(tok));
+      } break;
+      case Token::Kind::Comma: {
+        done = (current_brace_level == 0 && current_bracket_level == 0);
+      } break;
+      case Token::Kind::Colon: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          unexpected_token_in_static_template();
+        }
+      } break;
+      case Token::Kind::LeftParen: {
+        get_next_token();
+        const size_t expression = parse_expression();
+        if (tok.kind != Token::Kind::RightParen || expression == std::string_view::npos) {
+          malformed_expression_in_static_template();
+        }
+        arguments.push_back(expression);
+      } break;
+      case Token::Kind::Pipe: {
+        get_next_token();
+        if (tok.kind != Token::Kind::Id || arguments.empty()) {
+          malformed_expression_in_static_template();
+          break;
+        }
+        const std::string_view name = tok.text;
+        const size_t pos = position();
+        const std::vector<size_t> function_arguments {arguments.back()};
+        arguments.pop_back();
+        get_peek_token();
+        if (peek_tok.kind == Token::Kind::LeftParen) {
+          get_next_token();
+          arguments.push_back(add_function(name, pos, function_arguments));
+        } else {
+          arguments.push_back(resolve_function(name, pos, function_arguments));
+        }
+      } break;
+      default:
+        done = true;
+      }
+
+      if (!done) {
+        get_next_token();
+      }
+    }
+
+    while (!operators.empty()) {
+      add_operator(arguments, operators);
+    }
+
+    if (arguments.size() > 1) {
+      malformed_expression_in_static_template();
+    }
+    return arguments.empty() ? std::string_view::npos : arguments.front();
+  }
+
+  /// Parses an expression that must not be empty, followed by the closing of its statement
+  constexpr size_t parse_statement_expression(Token::Kind closing) {
+    const size_t expression = parse_expression();
+    if (expression == std::string_view::npos) {
+      malformed_expression_in_static_template();
+    }
+    expect_close(closing);
+    return expression;
+  }
+
+  /// Parses an if statement from its condition to the endif, which also ends its nested else if statements
+  constexpr void parse_if(std::vector<size_t>& nodes, Token::Kind closing) {
+    Node node {Node::Kind::If, position()};
+    node.expression = parse_statement_expression(closing);
+
+    std::vector<size_t> true_statement;
+    std::vector<size_t> false_statement;
+    switch (parse_block(true_statement)) {
+    case End::EndIf:
+      break;
+    case End::Else:
+      if (parse_block(false_statement) != End::EndIf) {
+        unmatched_statement_in_static_template();
+      }
+      break;
+    case End::ElseIf:
+      parse_if(false_statement, end_closing);
+      break;
+    default:
+      unmatched_statement_in_static_template();
+    }
+
+    node.first = program.store(true_statement);
+    node.count = true_statement.size();
+    node.else_first = program.store(false_statement);
+    node.else_count = false_statement.size();
+    nodes.push_back(add_node(node));
+  }
+
+  constexpr void parse_for(std::vector<size_t>& nodes, Token::Kind closing) {
+    if (tok.kind != Token::Kind::Id) {
+      unexpected_token_in_static_template();
+    }
+
+    Node node {Node::Kind::ForArray};
+    Token value_token = tok;
+    get_next_token();
+    if (tok.kind == Token::Kind::Comma) {
+      get_next_token();
+      if (tok.kind != Token::Kind::Id) {
+        unexpected_token_in_static_template();
+      }
+      node.kind = Node::Kind::ForObject;
+      node.key_pos = static_cast<size_t>(value_token.text.data() - input.data());
+      node.key_length = value_token.text.size();
+      value_token = tok;
+      get_next_token();
+    }
+    node.value_pos = static_cast<size_t>(value_token.text.data() - input.data());
+    node.value_length = value_token.text.size();
+    node.pos = position();
+
+    if (tok.kind != Token::Kind::Id || tok.text != "in") {
+      unexpected_token_in_static_template();
+    }
+    get_next_token();
+    node.expression = parse_statement_expression(closing);
+
+    std::vector<size_t> body;
+    if (parse_block(body) != End::EndFor) {
+      unmatched_statement_in_static_template();
+    }
+    node.first = program.store(body);
+    node.count = body.size();
+    nodes.push_back(add_node(node));
+  }
+
+  constexpr void parse_set(std::vector<size_t>& nodes, Token::Kind closing) {
+    if (tok.kind != Token::Kind::Id) {
+      unexpected_token_in_static_template();
+    }
+
+    Node node {Node::Kind::Set};
+    node.value_pos = position();
+    node.value_length = tok.text.size();
+    get_next_token();
+    node.pos = position();
+    if (tok.text != "=") {
+      unexpected_token_in_static_template();
+    }
+    get_next_token();
+    node.expression = parse_statement_expression(closing);
+    nodes.push_back(add_node(node));
+  }
+
+  /// Parses a statement after its keyword, returns whether it ends the current block
+  constexpr bool parse_statement(std::vector<size_t>& nodes, Token::Kind closing, End& end) {
+    if (tok.kind != Token::Kind::Id) {
+      unexpected_token_in_static_template();
+      return false;
+    }
+
+    const std::string_view keyword = tok.text;
+    get_next_token();
+    if (keyword == "if") {
+      parse_if(nodes, closing);
+    } else if (keyword == "elif" || (keyword == "else" && tok.kind == Token::Kind::Id && tok.text == "if")) {
+      if (keyword == "else") {
+        get_next_token();
+      }
+      end = End::ElseIf;
+      end_closing = closing;
+      return true;
+    } else if (keyword == "else" || keyword == "endif" || keyword == "endfor") {
+      expect_close(closing);
+      end = (keyword == "else") ? End::Else : (keyword == "endif") ? End::EndIf : End::EndFor;
+      return true;
+    } else if (keyword == "for") {
+      parse_for(nodes, closing);
+    } else if (keyword == "set") {
+      parse_set(nodes, closing);
+    } else if (keyword == "include" || keyword == "extends" || keyword == "block" || keyword == "endblock" || keyword == "raw") {
+      statement_is_not_supported_in_static_templates();
+    } else {
+      unexpected_token_in_static_template();
+    }
+    return false;
+  }
+
+  /// Parses nodes until the end of the template or a statement that ends a block
+  constexpr End parse_block(std::vector<size_t>& nodes) {
+    for (;;) {
+      get_next_token();
+      switch (tok.kind) {
+      case Token::Kind::Eof:
+        return End::Eof;
+      case Token::Kind::Text: {
+        nodes.push_back(add_node(Node {Node::Kind::Text, position(), tok.text.size()}));
+      } break;
+      case Token::Kind::StatementOpen:
+      case Token::Kind::LineStatementOpen: {
+        const auto closing = (tok.kind == Token::Kind::StatementOpen) ? Token::Kind::StatementClose : Token::Kind::LineStatementClose;
+        get_next_token();
+        End end {End::Eof};
+        if (parse_statement(nodes, closing, end)) {
+          return end;
+        }
+      } break;
+      case Token::Kind::ExpressionOpen: {
+        const size_t pos = position();
+        get_next_token();
+        const size_t expression = parse_expression();
+        if (tok.kind != Token::Kind::ExpressionClose || expression == std::string_view::npos) {
+          malformed_expression_in_static_template();
+        }
+        Node node {Node::Kind::Expression, pos};
+        node.expression = expression;
+        nodes.push_back(add_node(node));
+      } break;
+      case Token::Kind::CommentOpen: {
+        get_next_token();
+        if (tok.kind != Token::Kind::CommentClose) {
+          unexpected_token_in_static_template();
+        }
+      } break;
+      default:
+        unexpected_token_in_static_template();
+      }
+    }
+  }
+
+public:
+  constexpr ProgramParser(std::string_view input, Program& program): lexer(lexer_config), input(input), program(program) {}
+
+  constexpr void parse() {
+    lexer.start(input);
+    std::vector<size_t> root;
+    if (parse_block(root) != End::Eof) {
+      unmatched_statement_in_static_template();
+    }
+    program.root_first = program.store(root);
+    program.root_count = root.size();
+  }
+};
+
+constexpr Program parse(std::string_view input) {
+  Program result;
+  ProgramParser(input, result).parse();
+  return result;
+}
+
+template <ProgramSize Size>
+constexpr StaticProgram<Size> freeze(std::string_view input) {
+  const Program program = parse(input);
+  StaticProgram<Size> result;
+  std::copy(program.nodes.begin(), program.nodes.end(), result.nodes.begin());
+  std::copy(program.expressions.begin(), program.expressions.end(), result.expressions.begin());
+  std::copy(program.lists.begin(), program.lists.end(), result.lists.begin());
+  std::copy(program.keys.begin(), program.keys.end(), result.keys.begin());
+  result.root_first = program.root_first;
+  result.root_count = program.root_count;
+  return result;
+}
+
+/// The environment of static templates, with the default configuration and only the builtin functions
+struct StaticEnvironment {
+  RenderConfig config;
+  TemplateStorage templates;
+  FunctionStorage functions;
+  std::vector<const json*> layers;
+
+  static const StaticEnvironment& instance() {
+    static const StaticEnvironment result;
+    return result;
+  }
+};
+
+} // namespace static_detail
+
+/*!
+ * \brief A template that is parsed at compile time.
+ *
+ * The template is lexed by the Lexer with the default LexerConfig and parsed
+ * into a program that is stored in the type, so that its syntax errors are
+ * compile errors naming the problem. It may contain text, comments,
+ * expressions and the if, for and set statements. Expressions may use
+ * literals, variables, operators, pipes and the builtin functions; member
+ * access with a dot, callbacks, super() and the include, extends, block and
+ * raw statements are not supported. Rendering has the semantics and errors of
+ * the Renderer under the default RenderConfig, as it uses the NativeRender.
+ *
+ * \code
+ * inja::static_template<"{% for user in users %}{{ upper(user.name) }}{% endfor %}">::render(data);
+ * \endcode
+ */
+template <fixed_string Source>
+class static_template {
+  using Op = FunctionStorage::Operation;
+  using Expression = static_detail::Expression;
+  using Node = static_detail::Node;
+
+  static constexpr std::string_view input {Source.view()};
+  static constexpr auto program = static_detail::freeze<static_detail::parse(input).size()>(input);
+
+  template <size_t Pos>
+  static constexpr SourceLocation location = get_source_location(input, Pos);
+
+  template <size_t Pos, size_t Length>
+  static constexpr std::string_view text = input.substr(Pos, Length);
+
+  /// Keys of a variable
+  template <size_t E>
+  static constexpr auto path = [] {
+    constexpr Expression expression = program.expressions[E];
+    std::array<std::string_view, expression.count> result {};
+    for (size_t i = 0; i < expression.count; ++i) {
+      const auto key = program.keys[expression.first + i];
+      result[i] = input.substr(key.pos, key.length);
+    }
+    return result;
+  }();
+
+  static bool truthy(bool value) {
+    return value;
+  }
+
+  static bool truthy(const json& value) {
+    return NativeRender::truthy(value);
+  }
+
+  template <size_t E, size_t I>
+  static decltype(auto) argument(NativeRender& r) {
+    return evaluate<program.lists[program.expressions[E].first + I]>(r);
+  }
+
+  /// Calls the function with the arguments of the expression, which are evaluated from left to right like in the Renderer
+  template <size_t E, typename F>
+  static auto call(NativeRender& r, F function) {
+    return [&]<size_t... I>(std::index_sequence<I...>) {
+      std::tuple<decltype(argument<E, I>(r))...> arguments {argument<E, I>(r)...};
+      return std::apply(function, arguments);
+    }(std::make_index_sequence<program.expressions[E].count> {});
+  }
+
+  template <size_t E>
+  static auto builtin(NativeRender& r) {
+    constexpr Op operation = program.expressions[E].operation;
+    const auto& loc = location<program.expressions[E].pos>;
+    if constexpr (operation == Op::Add) {
+      return call<E>(r, &NativeRender::add);
+    } else if constexpr (operation == Op::Subtract) {
+      return call<E>(r, &NativeRender::subtract);
+    } else if constexpr (operation == Op::Multiplication) {
+      return call<E>(r, &NativeRender::multiply);
+    } else if constexpr (operation == Op::Division) {
+      return call<E>(r, [&loc](const json& lhs, const json& rhs) { return NativeRender::divide(lhs, rhs, loc); });
+    } else if constexpr (operation == Op::Power) {
+      return call<E>(r, &NativeRender::power);
+    } else if constexpr (operation == Op::Modulo) {
+      return call<E>(r, &NativeRender::modulo);
+    } else if constexpr (operation == Op::Capitalize) {
+      return call<E>(r, &NativeRender::capitalize);
+    } else if constexpr (operation == Op::DivisibleBy) {
+      return call<E>(r, &NativeRender::divisible_by);
+    } else if constexpr (operation == Op::Even) {
+      return call<E>(r, &NativeRender::even);
+    } else if constexpr (operation == Op::Exists) {
+      return call<E>(r, [&r](const json& name) { return r.exists(name); });
+    } else if constexpr (operation == Op::ExistsInObject) {
+      return call<E>(r, &NativeRender::exists_in);
+    } else if constexpr (operation == Op::First) {
+      return call<E>(r, [&loc](const json& value) -> json { return NativeRender::first(value, loc); });
+    } else if constexpr (operation == Op::Float) {
+      return call<E>(r, &NativeRender::to_float);
+    } else if constexpr (operation == Op::Int) {
+      return call<E>(r, &NativeRender::to_int);
+    } else if constexpr (operation == Op::Last) {
+      return call<E>(r, [&loc](const json& value) -> json { return NativeRender::last(value, loc); });
+    } else if constexpr (operation == Op::Length) {
+      return call<E>(r, &NativeRender::length);
+    } else if constexpr (operation == Op::Lower) {
+      return call<E>(r, &NativeRender::lower);
+    } else if constexpr (operation == Op::Max) {
+      return call<E>(r, [](const json& value) -> json { return NativeRender::max(value); });
+    } else if constexpr (operation == Op::Min) {
+      return call<E>(r, [](const json& value) -> json { return NativeRender::min(value); });
+    } else if constexpr (operation == Op::Odd) {
+      return call<E>(r, &NativeRender::odd);
+    } else if constexpr (operation == Op::Range) {
+      return call<E>(r, &NativeRender::range);
+    } else if constexpr (operation == Op::Replace) {
+      return call<E>(r, &NativeRender::replace);
+    } else if constexpr (operation == Op::Round) {
+      return call<E>(r, &NativeRender::round);
+    } else if constexpr (operation == Op::Sort) {
+      return call<E>(r, &NativeRender::sort);
+    } else if constexpr (operation == Op::Upper) {
+      return call<E>(r, &NativeRender::upper);
+    } else {
+      static_assert(operation == Op::Join);
+      return call<E>(r, &NativeRender::join);
+    }
+  }
+
+  template <size_t E, typename Compare>
+  static bool compare(NativeRender& r) {
+    return call<E>(r, [](const json& lhs, const json& rhs) { return NativeRender::compare(lhs, rhs, Compare()); });
+  }
+
+  template <size_t E>
+  static auto function(NativeRender& r) {
+    constexpr Expression expression = program.expressions[E];
+    constexpr Op operation = expression.operation;
+    if constexpr (constexpr const char* name = NativeRender::builtin_name(operation); name != nullptr) {
+      // The arguments are evaluated within the try block, as their errors are reported as failures of the function
+      try {
+        return builtin<E>(r);
+      } catch (...) {
+        NativeRender::fail_operation(name, location<expression.pos>);
+      }
+    } else if constexpr (operation == Op::Not) {
+      return !truthy(argument<E, 0>(r));
+    } else if constexpr (operation == Op::And) {
+      return truthy(argument<E, 0>(r)) && truthy(argument<E, 1>(r));
+    } else if constexpr (operation == Op::Or) {
+      return truthy(argument<E, 0>(r)) || truthy(argument<E, 1>(r));
+    } else if constexpr (operation == Op::In) {
+      return call<E>(r, &NativeRender::in);
+    } else if constexpr (operation == Op::Equal) {
+      return compare<E, std::equal_to<>>(r);
+    } else if constexpr (operation == Op::NotEqual) {
+      return compare<E, std::not_equal_to<>>(r);
+    } else if constexpr (operation == Op::Greater) {
+      return compare<E, std::greater<>>(r);
+    } else if constexpr (operation == Op::GreaterEqual) {
+      return compare<E, std::greater_equal<>>(r);
+    } else if constexpr (operation == Op::Less) {
+      return compare<E, std::less<>>(r);
+    } else if constexpr (operation == Op::LessEqual) {
+      return compare<E, std::less_equal<>>(r);
+    } else if constexpr (operation == Op::IsBoolean) {
+      return call<E>(r, [](const json& value) { return value.is_boolean(); });
+    } else if constexpr (operation == Op::IsNumber) {
+      return call<E>(r, [](const json& value) { return value.is_number(); });
+    } else if constexpr (operation == Op::IsInteger) {
+      return call<E>(r, [](const json& value) { return value.is_number_integer(); });
+    } else if constexpr (operation == Op::IsFloat) {
+      return call<E>(r, [](const json& value) { return value.is_number_float(); });
+    } else if constexpr (operation == Op::IsObject) {
+      return call<E>(r, [](const json& value) { return value.is_object(); });
+    } else if constexpr (operation == Op::IsArray) {
+      return call<E>(r, [](const json& value) { return value.is_array(); });
+    } else if constexpr (operation == Op::IsString) {
+      return call<E>(r, [](const json& value) { return value.is_string(); });
+    } else if constexpr (operation == Op::At) {
+      return call<E>(r, [](const json& container, const json& key) -> json {
+        return NativeRender::at(container, key, location<program.expressions[E].pos>);
+      });
+    } else {
+      static_assert(operation == Op::Default);
+      constexpr Expression variable = program.expressions[program.lists[expression.first]];
+      if constexpr (variable.kind == Expression::Kind::Data) {
+        json result;
+        if (const json* value = r.lookup(path<program.lists[expression.first]>, text<variable.pos, variable.length>, result)) {
+          return json(*value);
+        }
+        return json(argument<E, 1>(r));
+      } else {
+        return json(argument<E, 0>(r));
+      }
+    }
+  }
+
+  /// Returns the value of the expression, as a reference to the data for variables
+  template <size_t E>
+  static decltype(auto) evaluate(NativeRender& r) {
+    constexpr Expression expression = program.expressions[E];
+    if constexpr (expression.kind == Expression::Kind::Literal) {
+      static const json value = json::parse(text<expression.pos, expression.length>);
+      return (value);
+    } else if constexpr (expression.kind == Expression::Kind::Data) {
+      json result;
+      return r.get(path<E>, text<expression.pos, expression.length>, result, location<expression.pos>);
+    } else {
+      return function<E>(r);
+    }
+  }
+
+  template <size_t N>
+  static void render_node(NativeRender& r) {
+    constexpr Node node = program.nodes[N];
+    if constexpr (node.kind == Node::Kind::Text) {
+      r.write(text<node.pos, node.length>);
+    } else if constexpr (node.kind == Node::Kind::Expression) {
+      r.print(evaluate<node.expression>(r));
+    } else if constexpr (node.kind == Node::Kind::If) {
+      if (truthy(evaluate<node.expression>(r))) {
+        render_nodes<node.first>(r, std::make_index_sequence<node.count> {});
+      } else {
+        render_nodes<node.else_first>(r, std::make_index_sequence<node.else_count> {});
+      }
+    } else if constexpr (node.kind == Node::Kind::ForArray || node.kind == Node::Kind::ForObject) {
+      // The source is copied, as the local data changes within the loop
+      const json source = evaluate<node.expression>(r);
+      static const std::string value_name {text<node.value_pos, node.value_length>};
+      if constexpr (node.kind == Node::Kind::ForArray) {
+        if (!source.is_array()) {
+          NativeRender::fail("object must be an array", location<node.pos>);
+        }
+        r.enter_loop(source.size());
+        size_t index {0};
+        for (const auto& value : source) {
+          r.bind(value_name, value);
+          r.update_loop(index, source.size());
+          render_nodes<node.first>(r, std::make_index_sequence<node.count> {});
+          index += 1;
+        }
+      } else {
+        if (!source.is_object()) {
+          NativeRender::fail("object must be an object", location<node.pos>);
+        }
+        static const std::string key_name {text<node.key_pos, node.key_length>};
+        r.enter_loop(source.size());
+        size_t index {0};
+        for (auto it = source.begin(); it != source.end(); ++it) {
+          r.bind(key_name, it.key());
+          r.bind(value_name, it.value());
+          r.update_loop(index, source.size());
+          render_nodes<node.first>(r, std::make_index_sequence<node.count> {});
+          index += 1;
+        }
+        r.unbind(key_name);
+      }
+      r.unbind(value_name);
+      r.leave_loop();
+    } else {
+      static_assert(node.kind == Node::Kind::Set);
+      static const std::string key {text<node.value_pos, node.value_length>};
+      static const json::json_pointer ptr(DataNode::convert_dot_to_ptr(key));
+      try {
+        r.set(ptr, json(evaluate<node.expression>(r)));
+      } catch (...) {
+        NativeRender::fail_set(key, location<node.pos>);
+      }
+    }
+  }
+
+  template <size_t First, size_t... I>
+  static void render_nodes(NativeRender& r, std::index_sequence<I...>) {
+    (render_node<program.lists[First + I]>(r), ...);
+  }
+
+public:
+  /// The source of the template, e.g. to parse it at runtime as well
+  static constexpr std::string_view source() {
+    return input;
+  }
+
+  static std::ostream& render_to(std::ostream& os, const json& data) {
+    const auto& environment = static_detail::StaticEnvironment::instance();
+    NativeRender r(os, data, environment.layers, environment.config, environment.templates, environment.functions);
+    render_nodes<program.root_first>(r, std::make_index_sequence<program.root_count> {});
+    return os;
+  }
+
+  static std::string render(const json& data) {
+    std::ostringstream os;
+    render_to(os, data);
+    return os.str();
+  }
+};
+
+} // namespace inja
+
+#endif // __cpp_nontype_template_args
+
+#endif // INCLUDE_INJA_STATIC_TEMPLATE_HPP_
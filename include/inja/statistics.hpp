@@ -30,7 +30,9 @@ class StatisticsVisitor : public NodeVisitor {
   }
 
   void visit(const ExpressionListNode& node) override {
-    node.root->accept(*this);
+    if (node.root) {
+      node.root->accept(*this);
+    }
   }
 
   void visit(const StatementNode&) override {}
@@ -60,7 +62,9 @@ class StatisticsVisitor : public NodeVisitor {
     node.block.accept(*this);
   }
 
-  void visit(const SetStatementNode&) override {}
+  void visit(const SetStatementNode& node) override {
+    node.expression.accept(*this);
+  }
 
   void visit(const RawStatementNode&) override {}
 
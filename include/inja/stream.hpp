@@ -0,0 +1,245 @@
+#ifndef INCLUDE_INJA_STREAM_HPP_
+#define INCLUDE_INJA_STREAM_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "throw.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A coroutine yielding values one by one when they are pulled, e.g. by a range-based for loop.
+ */
+template <class T>
+class Generator {
+public:
+  struct promise_type {
+    T current {};
+    std::exception_ptr error;
+
+    Generator get_return_object() {
+      return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_always yield_value(T value) noexcept {
+      current = std::move(value);
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() {
+      error = std::current_exception();
+    }
+  };
+
+  class iterator {
+    std::coroutine_handle<promise_type> handle;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    explicit iterator(std::coroutine_handle<promise_type> handle = nullptr): handle(handle) {}
+
+    const T& operator*() const {
+      return handle.promise().current;
+    }
+
+    iterator& operator++() {
+      resume(handle);
+      return *this;
+    }
+
+    void operator++(int) {
+      ++*this;
+    }
+
+    bool operator==(std::default_sentinel_t) const {
+      return !handle || handle.done();
+    }
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Generator(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+  static void resume(std::coroutine_handle<promise_type> handle) {
+    handle.resume();
+    if (handle.promise().error) {
+      std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+    }
+  }
+
+public:
+  Generator(Generator&& other) noexcept: handle(std::exchange(other.handle, nullptr)) {}
+
+  Generator& operator=(Generator&& other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+
+  ~Generator() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  /// Runs the coroutine to its first value, so begin() must be called only once
+  iterator begin() {
+    if (handle) {
+      resume(handle);
+    }
+    return iterator(handle);
+  }
+
+  std::default_sentinel_t end() const noexcept {
+    return {};
+  }
+};
+
+/*!
+ * \brief A stream buffer handing chunks of output from a render to a consumer on another thread.
+ *
+ * At most one chunk waits for the consumer while the next one is written, so
+ * the memory is bounded by twice the chunk size. The render is blocked while
+ * the consumer is behind, and stopped with an InterruptError once its stop
+ * token is stopped.
+ */
+class OutputChannel : public std::streambuf {
+  const size_t chunk_size;
+  std::string filling;   // Written by the render
+  std::string ready;     // Read by the consumer
+  size_t ready_size {0};
+  bool has_ready {false};
+  bool consumed {false}; // The consumer holds a view of the ready chunk
+  bool closed {false};
+  std::exception_ptr error;
+  std::vector<RenderErrorInfo> render_errors;
+  std::stop_token stop_token;
+
+  std::mutex mutex;
+  std::condition_variable_any changed;
+
+  void publish() {
+    const size_t size = static_cast<size_t>(pptr() - pbase());
+    if (size == 0) {
+      return;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!changed.wait(lock, stop_token, [this] { return !has_ready; })) {
+        INJA_THROW(InterruptError("render was cancelled"));
+      }
+      std::swap(filling, ready);
+      ready_size = size;
+      has_ready = true;
+    }
+    changed.notify_all();
+
+    filling.resize(chunk_size);
+    setp(filling.data(), filling.data() + chunk_size);
+  }
+
+protected:
+  int_type overflow(int_type ch) override {
+    publish();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+public:
+  explicit OutputChannel(size_t chunk_size): chunk_size(std::max<size_t>(chunk_size, 1)) {
+    filling.resize(this->chunk_size);
+    setp(filling.data(), filling.data() + this->chunk_size);
+  }
+
+  /// Sets the token that cancels a render waiting for the consumer
+  void set_stop_token(std::stop_token token) {
+    stop_token = std::move(token);
+  }
+
+  /// Hands the rest of the output to the consumer and ends the stream, with the exception of the render if there was one
+  void close(std::exception_ptr render_error, std::vector<RenderErrorInfo> errors) {
+    if (!render_error) {
+      try {
+        publish();
+      } catch (...) {
+        render_error = std::current_exception();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = render_error;
+      render_errors = std::move(errors);
+      closed = true;
+    }
+    changed.notify_all();
+  }
+
+  /// Returns the next chunk, valid until the next call, or std::nullopt at the end; rethrows the exception of the render
+  std::optional<std::string_view> next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (consumed) {
+      consumed = false;
+      has_ready = false;
+      changed.notify_all();
+    }
+
+    changed.wait(lock, [this] { return has_ready || closed; });
+    if (has_ready) {
+      consumed = true;
+      return std::string_view(ready.data(), ready_size);
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return std::nullopt;
+  }
+
+  /// Errors of graceful error mode, once the stream ended
+  const std::vector<RenderErrorInfo>& get_render_errors() const {
+    return render_errors;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_STREAM_HPP_
@@ -1,15 +1,29 @@
 #ifndef INCLUDE_INJA_TEMPLATE_HPP_
 #define INCLUDE_INJA_TEMPLATE_HPP_
 
+#include <atomic>
+#include <cstddef>
 #include <map>
 #include <memory>
 #include <string>
 
+#include "json.hpp"
 #include "node.hpp"
 #include "statistics.hpp"
 
 namespace inja {
 
+struct CompiledTemplate;
+
+/*!
+ * \brief Render count and compiled form of a template, shared by all of its copies.
+ */
+struct TemplateTier {
+  std::atomic<size_t> render_count {0};
+  std::atomic<bool> compiling {false};
+  std::atomic<std::shared_ptr<const CompiledTemplate>> compiled;
+};
+
 /*!
  * \brief The main inja Template.
  */
@@ -17,6 +31,8 @@ struct Template {
   BlockNode root;
   std::string content;
   std::map<std::string, std::shared_ptr<BlockStatementNode>> block_storage;
+  std::shared_ptr<const json> static_data; // Data the template was specialized against, see Environment::specialize()
+  std::shared_ptr<TemplateTier> tier {std::make_shared<TemplateTier>()}; // See Environment::set_compile_threshold()
 
   explicit Template() {}
   explicit Template(std::string content): content(std::move(content)) {}
@@ -0,0 +1,180 @@
+#ifndef INCLUDE_INJA_THREAD_POOL_HPP_
+#define INCLUDE_INJA_THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "executor.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A work-stealing pool of worker threads.
+ *
+ * Every worker owns a queue of tasks. Tasks submitted from a worker are
+ * pushed to its own queue and run last-in first-out, while idle workers
+ * steal the oldest tasks from the other queues.
+ */
+class ThreadPool : public Executor {
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake_up;
+  std::atomic<size_t> pending {0};
+  std::atomic<size_t> next_queue {0};
+  bool stopping {false};
+
+  // Pool and queue index of the worker running on this thread
+  static inline thread_local const ThreadPool* tl_pool_ {nullptr};
+  static inline thread_local size_t tl_queue_ {0};
+
+  bool pop_task(size_t index, std::function<void()>& task) {
+    {
+      auto& own = *queues[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+
+    for (size_t i = 1; i < queues.size(); ++i) {
+      auto& other = *queues[(index + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      if (!other.tasks.empty()) {
+        task = std::move(other.tasks.front());
+        other.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run_task(std::function<void()>& task) {
+    pending.fetch_sub(1, std::memory_order_acq_rel);
+    task();
+  }
+
+  void work(size_t index) {
+    tl_pool_ = this;
+    tl_queue_ = index;
+
+    std::function<void()> task;
+    while (true) {
+      if (pop_task(index, task)) {
+        run_task(task);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      wake_up.wait(lock, [this] { return stopping || pending.load(std::memory_order_acquire) > 0; });
+      if (stopping && pending.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+    }
+  }
+
+  void push(std::function<void()> task) {
+    const size_t index = (tl_pool_ == this) ? tl_queue_ : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+      auto& queue = *queues[index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      pending.fetch_add(1, std::memory_order_acq_rel);
+    }
+    wake_up.notify_one();
+  }
+
+public:
+  /// Starts the given number of workers, 0 uses the number of hardware threads
+  explicit ThreadPool(size_t thread_count = 0) {
+    if (thread_count == 0) {
+      thread_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+      queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+      workers.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  /// Runs all remaining tasks and joins the workers
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    wake_up.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const {
+    return workers.size();
+  }
+
+  /// Queues a task, the returned future holds its result or exception
+  template <class Function>
+  std::future<std::invoke_result_t<Function>> submit(Function function) {
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Function>()>>(std::move(function));
+    auto result = task->get_future();
+    push([task] { (*task)(); });
+    return result;
+  }
+
+  void execute(std::function<void()> task) override {
+    push(std::move(task));
+  }
+
+  /// Runs one queued task on the calling thread, e.g. while waiting for another task; returns false if there was none
+  bool run_pending_task() {
+    std::function<void()> task;
+    if (!pop_task((tl_pool_ == this) ? tl_queue_ : 0, task)) {
+      return false;
+    }
+    run_task(task);
+    return true;
+  }
+
+  /// Waits for the result of a task, running queued tasks on the calling thread in the meantime
+  template <class T>
+  void wait(const std::future<T>& future) {
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      if (!run_pending_task()) {
+        future.wait();
+      }
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_THREAD_POOL_HPP_
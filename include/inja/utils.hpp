@@ -3,8 +3,11 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <utility>
 
 #include "exceptions.hpp"
@@ -12,13 +15,13 @@
 namespace inja {
 
 namespace string_view {
-inline std::string_view slice(std::string_view view, size_t start, size_t end) {
+constexpr std::string_view slice(std::string_view view, size_t start, size_t end) {
   start = std::min(start, view.size());
   end = std::min(std::max(start, end), view.size());
   return view.substr(start, end - start);
 }
 
-inline std::pair<std::string_view, std::string_view> split(std::string_view view, char Separator) {
+constexpr std::pair<std::string_view, std::string_view> split(std::string_view view, char Separator) {
   const size_t idx = view.find(Separator);
   if (idx == std::string_view::npos) {
     return std::make_pair(view, std::string_view());
@@ -26,12 +29,12 @@ inline std::pair<std::string_view, std::string_view> split(std::string_view view
   return std::make_pair(slice(view, 0, idx), slice(view, idx + 1, std::string_view::npos));
 }
 
-inline bool starts_with(std::string_view view, std::string_view prefix) {
+constexpr bool starts_with(std::string_view view, std::string_view prefix) {
   return (view.size() >= prefix.size() && view.compare(0, prefix.size(), prefix) == 0);
 }
 } // namespace string_view
 
-inline SourceLocation get_source_location(std::string_view content, size_t pos) {
+constexpr SourceLocation get_source_location(std::string_view content, size_t pos) {
   // Get line and offset position (starts at 1:1)
   auto sliced = string_view::slice(content, 0, pos);
   const std::size_t last_newline = sliced.rfind('\n');
@@ -65,6 +68,13 @@ inline void replace_substring(std::string& s, const std::string& f, const std::s
   {}
 }
 
+/// Modification time of a file as a plain number, or 0 if it does not exist
+inline int64_t file_modification_time(const std::filesystem::path& filename) {
+  std::error_code ec;
+  const auto time = std::filesystem::last_write_time(filename, ec);
+  return ec ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+
 } // namespace inja
 
 #endif // INCLUDE_INJA_UTILS_HPP_
@@ -0,0 +1,160 @@
+#ifndef INCLUDE_INJA_WATCHER_HPP_
+#define INCLUDE_INJA_WATCHER_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define INJA_HAS_INOTIFY 1
+#endif
+
+#include "bundle.hpp"
+#include "preload.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/// Called by the template watcher with the reloaded templates and all templates that include or extend them
+using TemplateReloadCallback = std::function<void(const std::vector<std::string>& reloaded)>;
+
+/*!
+ * \brief Watches files for changes of their modification time.
+ *
+ * On Linux, inotify on the directories of the files wakes the watcher up as
+ * soon as something changed. Elsewhere, or if inotify is not available, the
+ * files are polled. In both cases, a file counts as changed if its
+ * modification time differs from the last one seen.
+ */
+class FileWatcher {
+  std::map<std::string, int64_t> modification_times;
+
+#ifdef INJA_HAS_INOTIFY
+  int inotify_fd {-1};
+  std::set<std::string> watched_directories;
+#endif
+
+public:
+  /// Uses notifications of the operating system if available and enabled, and polling otherwise
+  explicit FileWatcher(bool use_notifications = true) {
+#ifdef INJA_HAS_INOTIFY
+    if (use_notifications) {
+      inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+#else
+    (void)use_notifications;
+#endif
+  }
+
+  ~FileWatcher() {
+#ifdef INJA_HAS_INOTIFY
+    if (inotify_fd >= 0) {
+      ::close(inotify_fd);
+    }
+#endif
+  }
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  /// Returns whether changes are notified instead of polled
+  bool uses_notifications() const {
+#ifdef INJA_HAS_INOTIFY
+    return inotify_fd >= 0;
+#else
+    return false;
+#endif
+  }
+
+  bool is_watching(const std::string& filename) const {
+    return modification_times.count(filename) > 0;
+  }
+
+  /// Starts watching a file, changes before this call are not reported
+  void watch(const std::string& filename) {
+    modification_times.insert_or_assign(filename, file_modification_time(filename));
+
+#ifdef INJA_HAS_INOTIFY
+    if (inotify_fd >= 0) {
+      auto directory = std::filesystem::path(filename).parent_path().string();
+      if (directory.empty()) {
+        directory = ".";
+      }
+      if (watched_directories.insert(directory).second) {
+        ::inotify_add_watch(inotify_fd, directory.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_TO);
+      }
+    }
+#endif
+  }
+
+  /// Waits up to the timeout for a notification of a change, always returns false after the timeout when polling
+  bool wait_for_notification(std::chrono::milliseconds timeout) {
+#ifdef INJA_HAS_INOTIFY
+    if (inotify_fd >= 0) {
+      pollfd descriptor {inotify_fd, POLLIN, 0};
+      if (::poll(&descriptor, 1, static_cast<int>(timeout.count())) <= 0) {
+        return false;
+      }
+
+      // Drain all events, the modification times tell which files changed
+      alignas(inotify_event) char buffer[4096];
+      while (::read(inotify_fd, buffer, sizeof(buffer)) > 0) {
+      }
+      return true;
+    }
+#endif
+    std::this_thread::sleep_for(timeout);
+    return false;
+  }
+
+  /// Returns the files whose modification time changed since the last call
+  std::vector<std::string> changed_files() {
+    std::vector<std::string> result;
+    for (auto& [filename, modification_time] : modification_times) {
+      const int64_t current = file_modification_time(filename);
+      if (current != modification_time) {
+        modification_time = current;
+        result.push_back(filename);
+      }
+    }
+    return result;
+  }
+};
+
+/// Returns the given templates and all templates that include or extend them, directly or indirectly
+inline std::vector<std::string> dependent_templates(const TemplateStorage& storage, const std::vector<std::string>& names) {
+  std::map<std::string, std::vector<std::string>> dependents;
+  for (const auto& [name, tmpl] : storage) {
+    for (const auto& dependency : template_dependencies(tmpl)) {
+      dependents[dependency].push_back(name);
+    }
+  }
+
+  std::set<std::string> found(names.begin(), names.end());
+  std::vector<std::string> result(names.begin(), names.end());
+  for (size_t i = 0; i < result.size(); ++i) {
+    const auto it = dependents.find(result[i]);
+    if (it == dependents.end()) {
+      continue;
+    }
+    for (const auto& dependent : it->second) {
+      if (found.insert(dependent).second) {
+        result.push_back(dependent);
+      }
+    }
+  }
+  return result;
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_WATCHER_HPP_
@@ -32,6 +32,24 @@ SOFTWARE.
 #include <nlohmann/json.hpp>
 
 namespace inja {
+/*!
+ * \brief The data type of inja, nlohmann::json unless INJA_DATA_TYPE is defined before including inja.
+ *
+ * Any specialization of nlohmann::basic_json can be used, e.g.
+ * nlohmann::ordered_json to keep the insertion order of objects and to look
+ * up keys of small objects by a linear search instead of a tree. The
+ * renderer doesn't keep references into objects it inserts into, so object
+ * types that move their values on insertion are fine.
+ *
+ * The data type is chosen once per program, not per environment: all inja
+ * classes use it directly instead of being templates on it. Every
+ * translation unit that includes inja must see the same INJA_DATA_TYPE, so
+ * define it for the whole target (e.g. with target_compile_definitions)
+ * instead of in a single source file. Translation units with different data
+ * types would give the same inja classes different layouts, which violates
+ * the one definition rule. In particular, environments with nlohmann::json
+ * and nlohmann::ordered_json can't be mixed in one program.
+ */
 #ifndef INJA_DATA_TYPE
 using json = nlohmann::json;
 #else
@@ -63,44 +81,17 @@ std::abort();                 \
 
 #endif // INCLUDE_INJA_THROW_HPP_
 
-// #include "environment.hpp"
-#ifndef INCLUDE_INJA_ENVIRONMENT_HPP_
-#define INCLUDE_INJA_ENVIRONMENT_HPP_
-
-#include <filesystem>
-#include <fstream>
-#include <iostream>
-#include <sstream>
-#include <string>
-#include <string_view>
-
-// #include "json.hpp"
-
-// #include "config.hpp"
-#ifndef INCLUDE_INJA_CONFIG_HPP_
-#define INCLUDE_INJA_CONFIG_HPP_
-
-#include <filesystem>
-#include <functional>
-#include <string>
-
-// #include "template.hpp"
-#ifndef INCLUDE_INJA_TEMPLATE_HPP_
-#define INCLUDE_INJA_TEMPLATE_HPP_
-
-#include <map>
-#include <memory>
-#include <string>
-
-// #include "node.hpp"
-#ifndef INCLUDE_INJA_NODE_HPP_
-#define INCLUDE_INJA_NODE_HPP_
+// #include "analysis.hpp"
+#ifndef INCLUDE_INJA_ANALYSIS_HPP_
+#define INCLUDE_INJA_ANALYSIS_HPP_
 
+#include <algorithm>
 #include <cstddef>
-#include <memory>
+#include <map>
+#include <set>
 #include <string>
 #include <string_view>
-#include <tuple>
+#include <utility>
 #include <vector>
 
 // #include "function_storage.hpp"
@@ -123,6 +114,21 @@ using Arguments = std::vector<const json*>;
 using CallbackFunction = std::function<json(Arguments& args)>;
 using VoidCallbackFunction = std::function<void(Arguments& args)>;
 
+/*!
+ * \brief Callback function type for in-place mutation optimization.
+ *
+ * This is used when the renderer detects a self-assignment pattern like:
+ *   {% set items = append(items, x) %}
+ *
+ * Instead of copying the array, the in-place callback mutates the first
+ * argument directly. The callback receives:
+ *   - first_arg: Mutable reference to the first argument (the array being modified)
+ *   - remaining_args: Vector of const pointers to remaining arguments
+ *
+ * The callback should mutate first_arg in place and not return anything.
+ */
+using InPlaceCallbackFunction = std::function<void(json& first_arg, Arguments& remaining_args)>;
+
 /*!
  * \brief Class for builtin functions and user-defined callbacks.
  */
@@ -181,47 +187,78 @@ public:
   };
 
   struct FunctionData {
-    explicit FunctionData(const Operation& op, const CallbackFunction& cb = CallbackFunction {}): operation(op), callback(cb) {}
+    explicit FunctionData(const Operation& op, const CallbackFunction& cb = CallbackFunction {},
+                          const InPlaceCallbackFunction& inplace_cb = InPlaceCallbackFunction {}, bool deterministic = false)
+        : operation(op), callback(cb), inplace_callback(inplace_cb), deterministic(deterministic) {}
     const Operation operation;
     const CallbackFunction callback;
+    const InPlaceCallbackFunction inplace_callback;  // Optional: for self-assignment optimization
+    const bool deterministic;                        // Same arguments give the same result within a render
+  };
+
+  struct BuiltinFunction {
+    std::string_view name;
+    int num_args;
+    Operation operation;
   };
 
+  /// The builtin functions every storage starts with
+  static constexpr BuiltinFunction builtin_functions[] {
+      {"at", 2, Operation::At},
+      {"capitalize", 1, Operation::Capitalize},
+      {"default", 2, Operation::Default},
+      {"divisibleBy", 2, Operation::DivisibleBy},
+      {"even", 1, Operation::Even},
+      {"exists", 1, Operation::Exists},
+      {"existsIn", 2, Operation::ExistsInObject},
+      {"first", 1, Operation::First},
+      {"float", 1, Operation::Float},
+      {"int", 1, Operation::Int},
+      {"isArray", 1, Operation::IsArray},
+      {"isBoolean", 1, Operation::IsBoolean},
+      {"isFloat", 1, Operation::IsFloat},
+      {"isInteger", 1, Operation::IsInteger},
+      {"isNumber", 1, Operation::IsNumber},
+      {"isObject", 1, Operation::IsObject},
+      {"isString", 1, Operation::IsString},
+      {"last", 1, Operation::Last},
+      {"length", 1, Operation::Length},
+      {"lower", 1, Operation::Lower},
+      {"max", 1, Operation::Max},
+      {"min", 1, Operation::Min},
+      {"odd", 1, Operation::Odd},
+      {"range", 1, Operation::Range},
+      {"replace", 3, Operation::Replace},
+      {"round", 2, Operation::Round},
+      {"sort", 1, Operation::Sort},
+      {"upper", 1, Operation::Upper},
+      {"super", 0, Operation::Super},
+      {"super", 1, Operation::Super},
+      {"join", 2, Operation::Join},
+  };
+
+  /// Returns the operation of the builtin function with the name and number of arguments, or Operation::None
+  static constexpr Operation find_builtin(std::string_view name, int num_args) {
+    for (const auto& builtin : builtin_functions) {
+      if (builtin.name == name && builtin.num_args == num_args) {
+        return builtin.operation;
+      }
+    }
+    return Operation::None;
+  }
+
 private:
   const int VARIADIC {-1};
 
-  std::map<std::pair<std::string, int>, FunctionData> function_storage = {
-      {std::make_pair("at", 2), FunctionData {Operation::At}},
-      {std::make_pair("capitalize", 1), FunctionData {Operation::Capitalize}},
-      {std::make_pair("default", 2), FunctionData {Operation::Default}},
-      {std::make_pair("divisibleBy", 2), FunctionData {Operation::DivisibleBy}},
-      {std::make_pair("even", 1), FunctionData {Operation::Even}},
-      {std::make_pair("exists", 1), FunctionData {Operation::Exists}},
-      {std::make_pair("existsIn", 2), FunctionData {Operation::ExistsInObject}},
-      {std::make_pair("first", 1), FunctionData {Operation::First}},
-      {std::make_pair("float", 1), FunctionData {Operation::Float}},
-      {std::make_pair("int", 1), FunctionData {Operation::Int}},
-      {std::make_pair("isArray", 1), FunctionData {Operation::IsArray}},
-      {std::make_pair("isBoolean", 1), FunctionData {Operation::IsBoolean}},
-      {std::make_pair("isFloat", 1), FunctionData {Operation::IsFloat}},
-      {std::make_pair("isInteger", 1), FunctionData {Operation::IsInteger}},
-      {std::make_pair("isNumber", 1), FunctionData {Operation::IsNumber}},
-      {std::make_pair("isObject", 1), FunctionData {Operation::IsObject}},
-      {std::make_pair("isString", 1), FunctionData {Operation::IsString}},
-      {std::make_pair("last", 1), FunctionData {Operation::Last}},
-      {std::make_pair("length", 1), FunctionData {Operation::Length}},
-      {std::make_pair("lower", 1), FunctionData {Operation::Lower}},
-      {std::make_pair("max", 1), FunctionData {Operation::Max}},
-      {std::make_pair("min", 1), FunctionData {Operation::Min}},
-      {std::make_pair("odd", 1), FunctionData {Operation::Odd}},
-      {std::make_pair("range", 1), FunctionData {Operation::Range}},
-      {std::make_pair("replace", 3), FunctionData {Operation::Replace}},
-      {std::make_pair("round", 2), FunctionData {Operation::Round}},
-      {std::make_pair("sort", 1), FunctionData {Operation::Sort}},
-      {std::make_pair("upper", 1), FunctionData {Operation::Upper}},
-      {std::make_pair("super", 0), FunctionData {Operation::Super}},
-      {std::make_pair("super", 1), FunctionData {Operation::Super}},
-      {std::make_pair("join", 2), FunctionData {Operation::Join}},
-  };
+  static std::map<std::pair<std::string, int>, FunctionData> builtin_storage() {
+    std::map<std::pair<std::string, int>, FunctionData> result;
+    for (const auto& builtin : builtin_functions) {
+      result.emplace(std::make_pair(static_cast<std::string>(builtin.name), builtin.num_args), FunctionData {builtin.operation});
+    }
+    return result;
+  }
+
+  std::map<std::pair<std::string, int>, FunctionData> function_storage = builtin_storage();
 
 public:
   void add_builtin(std::string_view name, int num_args, Operation op) {
@@ -232,6 +269,46 @@ public:
     function_storage.emplace(std::make_pair(static_cast<std::string>(name), num_args), FunctionData {Operation::Callback, callback});
   }
 
+  /*!
+   * \brief Adds a callback with an optional in-place mutation optimization.
+   *
+   * The in-place callback is used when the renderer detects a self-assignment pattern:
+   *   {% set x = func(x, ...) %}
+   *
+   * In this case, instead of copying x and then assigning the result back,
+   * the in-place callback mutates x directly, avoiding the copy.
+   *
+   * @param name Function name
+   * @param num_args Number of arguments
+   * @param callback The normal callback (used when not in self-assignment context)
+   * @param inplace_callback The in-place callback (used for self-assignment optimization)
+   */
+  void add_callback(std::string_view name, int num_args, const CallbackFunction& callback,
+                    const InPlaceCallbackFunction& inplace_callback) {
+    function_storage.emplace(std::make_pair(static_cast<std::string>(name), num_args),
+                             FunctionData {Operation::Callback, callback, inplace_callback});
+  }
+
+  /*!
+   * \brief Marks a callback as deterministic within a render.
+   *
+   * A deterministic callback returns the same result for the same arguments
+   * and has no side effects that the template depends on, so the optimizer
+   * may evaluate it once and reuse the result. Builtin functions are always
+   * deterministic (except super()).
+   */
+  void set_deterministic(std::string_view name, int num_args, bool deterministic = true) {
+    const auto key = std::make_pair(static_cast<std::string>(name), num_args);
+    auto it = function_storage.find(key);
+    if (it == function_storage.end() || it->second.operation != Operation::Callback) {
+      return;
+    }
+
+    FunctionData data {it->second.operation, it->second.callback, it->second.inplace_callback, deterministic};
+    function_storage.erase(it);
+    function_storage.emplace(key, std::move(data));
+  }
+
   FunctionData find_function(std::string_view name, int num_args) const {
     auto it = function_storage.find(std::make_pair(static_cast<std::string>(name), num_args));
     if (it != function_storage.end()) {
@@ -253,14 +330,31 @@ public:
 
 #endif // INCLUDE_INJA_FUNCTION_STORAGE_HPP_
 
+// #include "node.hpp"
+#ifndef INCLUDE_INJA_NODE_HPP_
+#define INCLUDE_INJA_NODE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// #include "function_storage.hpp"
+
 // #include "utils.hpp"
 #ifndef INCLUDE_INJA_UTILS_HPP_
 #define INCLUDE_INJA_UTILS_HPP_
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <utility>
 
 // #include "exceptions.hpp"
@@ -309,6 +403,10 @@ struct DataError : public InjaError {
   explicit DataError(const std::string& message, SourceLocation location): InjaError("data_error", message, location) {}
 };
 
+struct InterruptError : public InjaError {
+  explicit InterruptError(const std::string& message): InjaError("interrupt_error", message) {}
+};
+
 /*!
  * \brief Structure for tracking render errors in graceful mode
  */
@@ -329,13 +427,13 @@ struct RenderErrorInfo {
 namespace inja {
 
 namespace string_view {
-inline std::string_view slice(std::string_view view, size_t start, size_t end) {
+constexpr std::string_view slice(std::string_view view, size_t start, size_t end) {
   start = std::min(start, view.size());
   end = std::min(std::max(start, end), view.size());
   return view.substr(start, end - start);
 }
 
-inline std::pair<std::string_view, std::string_view> split(std::string_view view, char Separator) {
+constexpr std::pair<std::string_view, std::string_view> split(std::string_view view, char Separator) {
   const size_t idx = view.find(Separator);
   if (idx == std::string_view::npos) {
     return std::make_pair(view, std::string_view());
@@ -343,12 +441,12 @@ inline std::pair<std::string_view, std::string_view> split(std::string_view view
   return std::make_pair(slice(view, 0, idx), slice(view, idx + 1, std::string_view::npos));
 }
 
-inline bool starts_with(std::string_view view, std::string_view prefix) {
+constexpr bool starts_with(std::string_view view, std::string_view prefix) {
   return (view.size() >= prefix.size() && view.compare(0, prefix.size(), prefix) == 0);
 }
 } // namespace string_view
 
-inline SourceLocation get_source_location(std::string_view content, size_t pos) {
+constexpr SourceLocation get_source_location(std::string_view content, size_t pos) {
   // Get line and offset position (starts at 1:1)
   auto sliced = string_view::slice(content, 0, pos);
   const std::size_t last_newline = sliced.rfind('\n');
@@ -382,6 +480,13 @@ inline void replace_substring(std::string& s, const std::string& f, const std::s
   {}
 }
 
+/// Modification time of a file as a plain number, or 0 if it does not exist
+inline int64_t file_modification_time(const std::filesystem::path& filename) {
+  std::error_code ec;
+  const auto time = std::filesystem::last_write_time(filename, ec);
+  return ec ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+
 } // namespace inja
 
 #endif // INCLUDE_INJA_UTILS_HPP_
@@ -391,6 +496,8 @@ inline void replace_substring(std::string& s, const std::string& f, const std::s
 
 namespace inja {
 
+struct Template;
+
 class NodeVisitor;
 class BlockNode;
 class TextNode;
@@ -482,6 +589,7 @@ public:
   const json value;
 
   explicit LiteralNode(std::string_view data_text, size_t pos): ExpressionNode(pos), value(json::parse(data_text)) {}
+  explicit LiteralNode(const json& value, size_t pos): ExpressionNode(pos), value(value) {}
 
   void accept(NodeVisitor& v) const override {
     v.visit(*this);
@@ -492,6 +600,17 @@ class DataNode : public ExpressionNode {
 public:
   const std::string name;
   const json::json_pointer ptr;
+  const std::vector<std::string> path; // Keys of the name split at dots, for lookups in a DataProvider
+
+  static std::vector<std::string> split_dots(std::string_view ptr_name) {
+    std::vector<std::string> result;
+    do {
+      std::string_view part;
+      std::tie(part, ptr_name) = string_view::split(ptr_name, '.');
+      result.emplace_back(part);
+    } while (!ptr_name.empty());
+    return result;
+  }
 
   static std::string convert_dot_to_ptr(std::string_view ptr_name) {
     std::string result;
@@ -504,13 +623,51 @@ public:
     return result;
   }
 
-  explicit DataNode(std::string_view ptr_name, size_t pos): ExpressionNode(pos), name(ptr_name), ptr(json::json_pointer(convert_dot_to_ptr(ptr_name))) {}
+  explicit DataNode(std::string_view ptr_name, size_t pos): ExpressionNode(pos), name(ptr_name), ptr(json::json_pointer(convert_dot_to_ptr(ptr_name))), path(split_dots(ptr_name)) {}
 
   void accept(NodeVisitor& v) const override {
     v.visit(*this);
   }
 };
 
+/*!
+ * \brief Types of both operands of a binary operation.
+ */
+enum class OperandTypes : unsigned char {
+  Unknown,
+  Integer, // Both are integers (signed or unsigned)
+  Float,   // Both are numbers, at least one of them a float
+  String,  // Both are strings
+  Other,
+};
+
+/*!
+ * \brief Operand types last seen by an operation, to select a specialized kernel.
+ *
+ * Concurrent renders of the same template share the cache; a stale value
+ * only costs a failed type check.
+ */
+class OperandTypeCache {
+  std::atomic<OperandTypes> types {OperandTypes::Unknown};
+
+public:
+  OperandTypeCache() = default;
+  OperandTypeCache(const OperandTypeCache& other): types(other.get()) {}
+
+  OperandTypeCache& operator=(const OperandTypeCache& other) {
+    set(other.get());
+    return *this;
+  }
+
+  OperandTypes get() const {
+    return types.load(std::memory_order_relaxed);
+  }
+
+  void set(OperandTypes new_types) {
+    types.store(new_types, std::memory_order_relaxed);
+  }
+};
+
 class FunctionNode : public ExpressionNode {
   using Op = FunctionStorage::Operation;
 
@@ -530,102 +687,71 @@ public:
   std::vector<std::shared_ptr<ExpressionNode>> arguments;
   CallbackFunction callback;
 
-  explicit FunctionNode(std::string_view name, size_t pos)
-      : ExpressionNode(pos), precedence(8), associativity(Associativity::Left), operation(Op::Callback), name(name), number_args(0) {}
-  explicit FunctionNode(Op operation, size_t pos): ExpressionNode(pos), operation(operation), number_args(1) {
+  // Render-time memoization, annotated by the Optimizer (see optimizer.hpp)
+  mutable const FunctionNode* memo_key {nullptr};     // Nodes with the same key share their cached result
+  mutable std::vector<std::string> memo_dependencies; // Variables whose assignment invalidates the result
+
+  // Operand types of the last evaluation of a comparison or arithmetic operation
+  mutable OperandTypeCache operand_types;
+
+  struct OperatorProperties {
+    int number_args;
+    unsigned int precedence;
+    Associativity associativity;
+  };
+
+  /// Returns the number of arguments, precedence and associativity of an operator
+  static constexpr OperatorProperties operator_properties(Op operation) {
     switch (operation) {
-    case Op::Not: {
-      number_args = 1;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::And: {
-      number_args = 2;
-      precedence = 1;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Or: {
-      number_args = 2;
-      precedence = 1;
-      associativity = Associativity::Left;
-    } break;
-    case Op::In: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Equal: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::NotEqual: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Greater: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::GreaterEqual: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Less: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::LessEqual: {
-      number_args = 2;
-      precedence = 2;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Add: {
-      number_args = 2;
-      precedence = 3;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Subtract: {
-      number_args = 2;
-      precedence = 3;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Multiplication: {
-      number_args = 2;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Division: {
-      number_args = 2;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::Power: {
-      number_args = 2;
-      precedence = 5;
-      associativity = Associativity::Right;
-    } break;
-    case Op::Modulo: {
-      number_args = 2;
-      precedence = 4;
-      associativity = Associativity::Left;
-    } break;
-    case Op::AtId: {
-      number_args = 2;
-      precedence = 8;
-      associativity = Associativity::Left;
-    } break;
-    default: {
-      precedence = 1;
-      associativity = Associativity::Left;
-    }
+    case Op::Not:
+      return {1, 4, Associativity::Left};
+    case Op::And:
+      return {2, 1, Associativity::Left};
+    case Op::Or:
+      return {2, 1, Associativity::Left};
+    case Op::In:
+      return {2, 2, Associativity::Left};
+    case Op::Equal:
+      return {2, 2, Associativity::Left};
+    case Op::NotEqual:
+      return {2, 2, Associativity::Left};
+    case Op::Greater:
+      return {2, 2, Associativity::Left};
+    case Op::GreaterEqual:
+      return {2, 2, Associativity::Left};
+    case Op::Less:
+      return {2, 2, Associativity::Left};
+    case Op::LessEqual:
+      return {2, 2, Associativity::Left};
+    case Op::Add:
+      return {2, 3, Associativity::Left};
+    case Op::Subtract:
+      return {2, 3, Associativity::Left};
+    case Op::Multiplication:
+      return {2, 4, Associativity::Left};
+    case Op::Division:
+      return {2, 4, Associativity::Left};
+    case Op::Power:
+      return {2, 5, Associativity::Right};
+    case Op::Modulo:
+      return {2, 4, Associativity::Left};
+    case Op::AtId:
+      return {2, 8, Associativity::Left};
+    default:
+      return {1, 1, Associativity::Left};
     }
   }
 
+  explicit FunctionNode(std::string_view name, size_t pos)
+      : ExpressionNode(pos), precedence(8), associativity(Associativity::Left), operation(Op::Callback), name(name), number_args(0) {}
+
+  explicit FunctionNode(Op operation, size_t pos): ExpressionNode(pos), operation(operation) {
+    const auto properties = operator_properties(operation);
+    number_args = properties.number_args;
+    precedence = properties.precedence;
+    associativity = properties.associativity;
+  }
+
   void accept(NodeVisitor& v) const override {
     v.visit(*this);
   }
@@ -707,6 +833,7 @@ public:
 class IncludeStatementNode : public StatementNode {
 public:
   const std::string file;
+  const Template* linked {nullptr}; // Included template resolved ahead of time, see TemplateCompiler and inja_compile
 
   explicit IncludeStatementNode(const std::string& file, size_t pos): StatementNode(pos), file(file) {}
 
@@ -718,6 +845,7 @@ public:
 class ExtendsStatementNode : public StatementNode {
 public:
   const std::string file;
+  const Template* linked {nullptr}; // Parent template resolved ahead of time, see inja_compile
 
   explicit ExtendsStatementNode(const std::string& file, size_t pos): StatementNode(pos), file(file) {}
 
@@ -768,6 +896,20 @@ public:
 
 #endif // INCLUDE_INJA_NODE_HPP_
 
+// #include "template.hpp"
+#ifndef INCLUDE_INJA_TEMPLATE_HPP_
+#define INCLUDE_INJA_TEMPLATE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+
+// #include "json.hpp"
+
+// #include "node.hpp"
+
 // #include "statistics.hpp"
 #ifndef INCLUDE_INJA_STATISTICS_HPP_
 #define INCLUDE_INJA_STATISTICS_HPP_
@@ -802,7 +944,9 @@ class StatisticsVisitor : public NodeVisitor {
   }
 
   void visit(const ExpressionListNode& node) override {
-    node.root->accept(*this);
+    if (node.root) {
+      node.root->accept(*this);
+    }
   }
 
   void visit(const StatementNode&) override {}
@@ -832,7 +976,9 @@ class StatisticsVisitor : public NodeVisitor {
     node.block.accept(*this);
   }
 
-  void visit(const SetStatementNode&) override {}
+  void visit(const SetStatementNode& node) override {
+    node.expression.accept(*this);
+  }
 
   void visit(const RawStatementNode&) override {}
 
@@ -849,6 +995,17 @@ public:
 
 namespace inja {
 
+struct CompiledTemplate;
+
+/*!
+ * \brief Render count and compiled form of a template, shared by all of its copies.
+ */
+struct TemplateTier {
+  std::atomic<size_t> render_count {0};
+  std::atomic<bool> compiling {false};
+  std::atomic<std::shared_ptr<const CompiledTemplate>> compiled;
+};
+
 /*!
  * \brief The main inja Template.
  */
@@ -856,6 +1013,8 @@ struct Template {
   BlockNode root;
   std::string content;
   std::map<std::string, std::shared_ptr<BlockStatementNode>> block_storage;
+  std::shared_ptr<const json> static_data; // Data the template was specialized against, see Environment::specialize()
+  std::shared_ptr<TemplateTier> tier {std::make_shared<TemplateTier>()}; // See Environment::set_compile_threshold()
 
   explicit Template() {}
   explicit Template(std::string content): content(std::move(content)) {}
@@ -877,2439 +1036,11786 @@ using TemplateStorage = std::map<std::string, Template>;
 
 namespace inja {
 
+/// A path into the input data, split into its reference tokens
+using DataPath = std::vector<std::string>;
+
 /*!
- * \brief Class for lexer configuration.
+ * \brief Splits a JSON pointer string into its (unescaped) reference tokens.
  */
-struct LexerConfig {
-  std::string statement_open {"{%"};
-  std::string statement_open_no_lstrip {"{%+"};
-  std::string statement_open_force_lstrip {"{%-"};
-  std::string statement_close {"%}"};
-  std::string statement_close_force_rstrip {"-%}"};
-  std::string line_statement {"##"};
-  std::string expression_open {"{{"};
-  std::string expression_open_force_lstrip {"{{-"};
-  std::string expression_close {"}}"};
-  std::string expression_close_force_rstrip {"-}}"};
-  std::string comment_open {"{#"};
-  std::string comment_open_force_lstrip {"{#-"};
-  std::string comment_close {"#}"};
-  std::string comment_close_force_rstrip {"-#}"};
-  std::string open_chars {"#{"};
-
-  bool trim_blocks {false};
-  bool lstrip_blocks {false};
-
-  void update_open_chars() {
-    open_chars = "";
-    if (open_chars.find(line_statement[0]) == std::string::npos) {
-      open_chars += line_statement[0];
-    }
-    if (open_chars.find(statement_open[0]) == std::string::npos) {
-      open_chars += statement_open[0];
-    }
-    if (open_chars.find(statement_open_no_lstrip[0]) == std::string::npos) {
-      open_chars += statement_open_no_lstrip[0];
-    }
-    if (open_chars.find(statement_open_force_lstrip[0]) == std::string::npos) {
-      open_chars += statement_open_force_lstrip[0];
-    }
-    if (open_chars.find(expression_open[0]) == std::string::npos) {
-      open_chars += expression_open[0];
-    }
-    if (open_chars.find(expression_open_force_lstrip[0]) == std::string::npos) {
-      open_chars += expression_open_force_lstrip[0];
-    }
-    if (open_chars.find(comment_open[0]) == std::string::npos) {
-      open_chars += comment_open[0];
-    }
-    if (open_chars.find(comment_open_force_lstrip[0]) == std::string::npos) {
-      open_chars += comment_open_force_lstrip[0];
+inline DataPath split_json_pointer(std::string_view pointer) {
+  DataPath result;
+  if (pointer.empty()) {
+    return result;
+  }
+  size_t start = 1;
+  for (;;) {
+    const size_t end = pointer.find('/', start);
+    std::string token {string_view::slice(pointer, start, end)};
+    replace_substring(token, "~1", "/");
+    replace_substring(token, "~0", "~");
+    result.emplace_back(std::move(token));
+    if (end == std::string_view::npos) {
+      break;
     }
+    start = end + 1;
   }
-};
+  return result;
+}
 
 /*!
- * \brief Class for parser configuration.
+ * \brief Joins reference tokens into an escaped JSON pointer string.
  */
-struct ParserConfig {
-  bool search_included_templates_in_files {true};
-  bool graceful_errors {false}; // If true, allow unknown functions at parse time
+inline std::string join_json_pointer(const DataPath& path) {
+  std::string result;
+  for (const auto& segment : path) {
+    std::string token = segment;
+    replace_substring(token, "~", "~0");
+    replace_substring(token, "/", "~1");
+    result.push_back('/');
+    result.append(token);
+  }
+  return result;
+}
 
-  std::function<Template(const std::filesystem::path&, const std::string&)> include_callback;
+/*!
+ * \brief Result of the static dependency analysis of a Template.
+ *
+ * Paths are JSON pointers into the input data. Elements of iterated
+ * containers are written with the wildcard token `*`, so reading `a.name`
+ * inside `{% for a in actors %}` is reported as the pointer to `name` below
+ * `actors` with `*` as the element token in between.
+ */
+struct TemplateAnalysis {
+  /// Wildcard reference token standing for every element of a container
+  static constexpr const char* any_element = "*";
+
+  /// Distinct paths read from the input data
+  std::set<std::string> input_paths;
+  /// Input containers that are iterated by for loops (their shape is needed, not necessarily their values)
+  std::set<std::string> iterated_paths;
+  /// Variables assigned by set statements
+  std::set<std::string> set_locals;
+  /// Variables bound by for loops
+  std::set<std::string> loop_locals;
+  /// Called callbacks with all argument counts they are called with
+  std::map<std::string, std::set<int>> callbacks;
+  /// Include and extends graph, from a template name to the templates it includes or extends directly
+  std::map<std::string, std::set<std::string>> includes;
+  /// Included or extended templates that could not be found in the template storage
+  std::set<std::string> missing_templates;
+  /// True if the template looks up input data by a name only known at render time (e.g. `exists(name)`)
+  bool has_dynamic_lookups {false};
+
+  /// Returns all templates reachable from the analyzed template through includes and extends
+  std::set<std::string> included_templates() const {
+    std::set<std::string> result;
+    for (const auto& [name, targets] : includes) {
+      result.insert(targets.begin(), targets.end());
+    }
+    return result;
+  }
 };
 
 /*!
- * \brief Class for render configuration.
+ * \brief A visitor collecting the data, callback and include dependencies of a Template.
+ *
+ * Included and extended templates are analyzed in the context of their call
+ * site, so that loop variables and set variables of the including template are
+ * resolved to the input paths they refer to. The analysis is conservative:
+ * a variable assigned in a branch or loop body that might not run is still
+ * reported as an input read afterwards.
  */
-struct RenderConfig {
-  bool throw_at_missing_includes {true};
-  bool html_autoescape {false};
-  bool graceful_errors {false}; // If true, missing variables/functions render as original template text
-};
+class AnalysisVisitor : public NodeVisitor {
+protected:
+  using Op = FunctionStorage::Operation;
 
-} // namespace inja
+  struct ValueRef {
+    enum class Kind {
+      Input,    // A path into the input data
+      Local,    // A set or loop variable of the template
+      Computed, // A temporary result of a function
+    };
 
-#endif // INCLUDE_INJA_CONFIG_HPP_
+    Kind kind;
+    DataPath path;
+  };
 
-// #include "function_storage.hpp"
+  struct LoopBinding {
+    std::string name;
+    ValueRef value;
+  };
 
-// #include "parser.hpp"
-#ifndef INCLUDE_INJA_PARSER_HPP_
-#define INCLUDE_INJA_PARSER_HPP_
-
-#include <cstddef>
-#include <filesystem>
-#include <fstream>
-#include <iterator>
-#include <memory>
-#include <stack>
-#include <string>
-#include <string_view>
-#include <utility>
-#include <vector>
-
-// #include "config.hpp"
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
 
-// #include "exceptions.hpp"
+  TemplateAnalysis result;
+  ValueRef last_value {ValueRef::Kind::Computed, {}};
 
-// #include "function_storage.hpp"
+  std::vector<std::string> template_stack;
+  std::vector<const Template*> template_chain;
+  std::vector<LoopBinding> loop_bindings;
+  std::vector<std::vector<DataPath>> set_scopes;
+  size_t loop_depth {0};
 
-// #include "lexer.hpp"
-#ifndef INCLUDE_INJA_LEXER_HPP_
-#define INCLUDE_INJA_LEXER_HPP_
+  static bool is_prefix(const DataPath& prefix, const DataPath& path) {
+    return prefix.size() <= path.size() && std::equal(prefix.begin(), prefix.end(), path.begin());
+  }
 
-#include <cctype>
-#include <cstddef>
-#include <string_view>
+  bool is_set_local(const DataPath& path) const {
+    for (const auto& scope : set_scopes) {
+      for (const auto& key : scope) {
+        if (is_prefix(key, path)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
 
-// #include "config.hpp"
+  ValueRef eval(const ExpressionNode& node) {
+    last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    node.accept(*this);
+    return last_value;
+  }
 
-// #include "exceptions.hpp"
+  void use(const ValueRef& value) {
+    if (value.kind == ValueRef::Kind::Input) {
+      result.input_paths.insert(join_json_pointer(value.path));
+    }
+  }
 
-// #include "token.hpp"
-#ifndef INCLUDE_INJA_TOKEN_HPP_
-#define INCLUDE_INJA_TOKEN_HPP_
+  void use_arguments(const FunctionNode& node, size_t start = 0) {
+    for (size_t i = start; i < node.arguments.size(); ++i) {
+      use(eval(*node.arguments[i]));
+    }
+  }
 
-#include <string>
-#include <string_view>
+  static bool literal_token(const ExpressionNode& node, std::string& token) {
+    const auto* literal = dynamic_cast<const LiteralNode*>(&node);
+    if (literal == nullptr) {
+      return false;
+    }
+    if (literal->value.is_string()) {
+      token = literal->value.get<std::string>();
+      return true;
+    } else if (literal->value.is_number_integer()) {
+      token = std::to_string(literal->value.get<json::number_integer_t>());
+      return true;
+    }
+    return false;
+  }
 
-namespace inja {
+  static ValueRef child_of(const ValueRef& container, const DataPath& tokens) {
+    if (container.kind != ValueRef::Kind::Input) {
+      return ValueRef {container.kind == ValueRef::Kind::Local ? ValueRef::Kind::Local : ValueRef::Kind::Computed, {}};
+    }
+    ValueRef child = container;
+    child.path.insert(child.path.end(), tokens.begin(), tokens.end());
+    return child;
+  }
 
-/*!
- * \brief Helper-class for the inja Lexer.
- */
-struct Token {
-  enum class Kind {
-    Text,
-    ExpressionOpen,     // {{
-    ExpressionClose,    // }}
-    LineStatementOpen,  // ##
-    LineStatementClose, // \n
-    StatementOpen,      // {%
-    StatementClose,     // %}
-    CommentOpen,        // {#
-    CommentClose,       // #}
-    Id,                 // this, this.foo
-    Number,             // 1, 2, -1, 5.2, -5.3
-    String,             // "this"
-    Plus,               // +
-    Minus,              // -
-    Times,              // *
-    Slash,              // /
-    Percent,            // %
-    Power,              // ^
-    Comma,              // ,
-    Dot,                // .
-    Colon,              // :
-    LeftParen,          // (
-    RightParen,         // )
-    LeftBracket,        // [
-    RightBracket,       // ]
-    LeftBrace,          // {
-    RightBrace,         // }
-    Equal,              // ==
-    NotEqual,           // !=
-    GreaterThan,        // >
-    GreaterEqual,       // >=
-    LessThan,           // <
-    LessEqual,          // <=
-    Pipe,               // |
-    Unknown,
-    Eof,
-  };
+  /// Called before the body of a loop is analyzed, with the iterated container
+  virtual void enter_loop(const ForStatementNode&, const ValueRef&) {}
 
-  Kind kind {Kind::Unknown};
-  std::string_view text;
+  /// Called after the body of a loop was analyzed
+  virtual void exit_loop(const ForStatementNode&) {}
 
-  explicit constexpr Token() = default;
-  explicit constexpr Token(Kind kind, std::string_view text): kind(kind), text(text) {}
+  void bind_loop(const ForStatementNode& node, const std::string& value_name, const std::string& key_name) {
+    ValueRef container {ValueRef::Kind::Computed, {}};
+    ValueRef element {ValueRef::Kind::Local, {}};
+    if (node.condition.root) {
+      container = eval(*node.condition.root);
+      if (container.kind == ValueRef::Kind::Input) {
+        result.iterated_paths.insert(join_json_pointer(container.path));
+        element = child_of(container, {TemplateAnalysis::any_element});
+      }
+    }
+    enter_loop(node, container);
 
-  std::string describe() const {
-    switch (kind) {
-    case Kind::Text:
-      return "<text>";
-    case Kind::LineStatementClose:
-      return "<eol>";
-    case Kind::Eof:
-      return "<eof>";
-    default:
-      return static_cast<std::string>(text);
+    if (!key_name.empty()) {
+      result.loop_locals.insert(key_name);
+      loop_bindings.push_back(LoopBinding {key_name, ValueRef {ValueRef::Kind::Local, {}}});
     }
+    result.loop_locals.insert(value_name);
+    loop_bindings.push_back(LoopBinding {value_name, element});
   }
-};
-
-} // namespace inja
-
-#endif // INCLUDE_INJA_TOKEN_HPP_
 
-// #include "utils.hpp"
+  void analyze_template(const std::string& name, const Template& tmpl) {
+    template_stack.push_back(name);
+    template_chain.push_back(&tmpl);
+    tmpl.root.accept(*this);
+    template_chain.pop_back();
+    template_stack.pop_back();
+  }
 
+  const Template* follow(const std::string& file) {
+    result.includes[template_stack.back()].insert(file);
+    if (std::find(template_stack.begin(), template_stack.end(), file) != template_stack.end()) {
+      return nullptr; // Recursive include, already being analyzed
+    }
 
-namespace inja {
+    const auto it = template_storage.find(file);
+    if (it == template_storage.end()) {
+      result.missing_templates.insert(file);
+      return nullptr;
+    }
+    return &it->second;
+  }
 
-/*!
- * \brief Class for lexing an inja Template.
- */
-class Lexer {
-  enum class State {
-    Text,
-    ExpressionStart,
-    ExpressionStartForceLstrip,
-    ExpressionBody,
-    LineStart,
-    LineBody,
-    StatementStart,
-    StatementStartNoLstrip,
-    StatementStartForceLstrip,
-    StatementBody,
-    CommentStart,
-    CommentStartForceLstrip,
-    CommentBody,
-  };
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
 
-  enum class MinusState {
-    Operator,
-    Number,
-  };
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
 
-  const LexerConfig& config;
+  void visit(const LiteralNode&) override {
+    last_value = ValueRef {ValueRef::Kind::Computed, {}};
+  }
 
-  State state;
-  MinusState minus_state;
-  std::string_view m_in;
-  size_t tok_start;
-  size_t pos;
+  void visit(const DataNode& node) override {
+    const DataPath path = split_json_pointer(node.ptr.to_string());
+    if (path.empty()) {
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+      return;
+    }
 
-  Token scan_body(std::string_view close, Token::Kind closeKind, std::string_view close_trim = std::string_view(), bool trim = false) {
-  again:
-    // skip whitespace (except for \n as it might be a close)
-    if (tok_start >= m_in.size()) {
-      return make_token(Token::Kind::Eof);
+    // Innermost loop binding first
+    for (auto it = loop_bindings.rbegin(); it != loop_bindings.rend(); ++it) {
+      if (it->name == path.front()) {
+        last_value = child_of(it->value, DataPath(path.begin() + 1, path.end()));
+        return;
+      }
     }
-    const char ch = m_in[tok_start];
-    if (ch == ' ' || ch == '\t' || ch == '\r') {
-      tok_start += 1;
-      goto again;
+
+    if ((loop_depth > 0 && path.front() == "loop") || is_set_local(path)) {
+      last_value = ValueRef {ValueRef::Kind::Local, {}};
+      return;
     }
 
-    // check for close
-    if (!close_trim.empty() && inja::string_view::starts_with(m_in.substr(tok_start), close_trim)) {
-      state = State::Text;
-      pos = tok_start + close_trim.size();
-      const Token tok = make_token(closeKind);
-      skip_whitespaces_and_newlines();
-      return tok;
+    // Names missing in the data fall back to a callback without arguments
+    if (function_storage.find_function(node.name, 0).operation == Op::Callback) {
+      result.callbacks[node.name].insert(0);
     }
+    last_value = ValueRef {ValueRef::Kind::Input, path};
+  }
 
-    if (inja::string_view::starts_with(m_in.substr(tok_start), close)) {
-      state = State::Text;
-      pos = tok_start + close.size();
-      const Token tok = make_token(closeKind);
-      if (trim) {
-        skip_whitespaces_and_first_newline();
+  void visit(const FunctionNode& node) override {
+    switch (node.operation) {
+    case Op::AtId: {
+      if (node.arguments.size() != 2) {
+        use_arguments(node);
+        break;
+      }
+      const ValueRef container = eval(*node.arguments[0]);
+      const auto* member = dynamic_cast<const DataNode*>(node.arguments[1].get());
+      if (member == nullptr) {
+        use(container);
+        use(eval(*node.arguments[1]));
+        last_value = ValueRef {ValueRef::Kind::Computed, {}};
+        break;
+      }
+      last_value = child_of(container, split_json_pointer(member->ptr.to_string()));
+    } break;
+    case Op::At: {
+      if (node.arguments.size() != 2) {
+        use_arguments(node);
+        break;
+      }
+      const ValueRef container = eval(*node.arguments[0]);
+      std::string token;
+      if (!literal_token(*node.arguments[1], token)) {
+        // Dynamic key: any element of the container might be read
+        use(eval(*node.arguments[1]));
+        token = TemplateAnalysis::any_element;
+      }
+      last_value = child_of(container, {token});
+    } break;
+    case Op::Exists: {
+      std::string name;
+      if (!node.arguments.empty() && literal_token(*node.arguments[0], name)) {
+        // exists() only looks into the input data, never into local variables
+        result.input_paths.insert(join_json_pointer(split_json_pointer(DataNode::convert_dot_to_ptr(name))));
+      } else {
+        use_arguments(node);
+        result.has_dynamic_lookups = true;
+      }
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    } break;
+    case Op::ExistsInObject: {
+      std::string key;
+      if (node.arguments.size() == 2 && literal_token(*node.arguments[1], key)) {
+        const ValueRef container = eval(*node.arguments[0]);
+        if (container.kind == ValueRef::Kind::Input) {
+          use(child_of(container, {key}));
+        }
+      } else {
+        use_arguments(node);
       }
-      return tok;
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    } break;
+    case Op::Callback: {
+      result.callbacks[node.name].insert(static_cast<int>(node.arguments.size()));
+      use_arguments(node);
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
+    } break;
+    default: {
+      use_arguments(node);
+      last_value = ValueRef {ValueRef::Kind::Computed, {}};
     }
+    }
+  }
 
-    // skip \n
-    if (ch == '\n') {
-      tok_start += 1;
-      goto again;
+  void visit(const ExpressionListNode& node) override {
+    if (node.root) {
+      use(eval(*node.root));
     }
+  }
 
-    pos = tok_start + 1;
-    if (std::isalpha(ch)) {
-      minus_state = MinusState::Operator;
-      return scan_id();
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    const size_t bindings = loop_bindings.size();
+    bind_loop(node, node.value, "");
+
+    loop_depth += 1;
+    set_scopes.emplace_back();
+    node.body.accept(*this);
+    set_scopes.pop_back();
+    loop_depth -= 1;
+    exit_loop(node);
+
+    loop_bindings.resize(bindings);
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    const size_t bindings = loop_bindings.size();
+    bind_loop(node, node.value, node.key);
+
+    loop_depth += 1;
+    set_scopes.emplace_back();
+    node.body.accept(*this);
+    set_scopes.pop_back();
+    loop_depth -= 1;
+    exit_loop(node);
+
+    loop_bindings.resize(bindings);
+  }
+
+  void visit(const IfStatementNode& node) override {
+    node.condition.accept(*this);
+
+    set_scopes.emplace_back();
+    node.true_statement.accept(*this);
+    set_scopes.pop_back();
+
+    set_scopes.emplace_back();
+    node.false_statement.accept(*this);
+    set_scopes.pop_back();
+  }
+
+  void visit(const IncludeStatementNode& node) override {
+    const Template* included = follow(node.file);
+    if (included != nullptr) {
+      // Set statements of an included template do not leak into the including one
+      set_scopes.emplace_back();
+      analyze_template(node.file, *included);
+      set_scopes.pop_back();
     }
+  }
 
-    const MinusState current_minus_state = minus_state;
-    if (minus_state == MinusState::Operator) {
-      minus_state = MinusState::Number;
+  void visit(const ExtendsStatementNode& node) override {
+    const Template* parent = follow(node.file);
+    if (parent != nullptr) {
+      analyze_template(node.file, *parent);
     }
+  }
 
-    switch (ch) {
-    case '+':
-      return make_token(Token::Kind::Plus);
-    case '-':
-      if (current_minus_state == MinusState::Operator) {
-        return make_token(Token::Kind::Minus);
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+
+    // Blocks can be overridden by any template of the extends chain (and reached through super())
+    for (const Template* tmpl : template_chain) {
+      const auto it = tmpl->block_storage.find(node.name);
+      if (it != tmpl->block_storage.end() && it->second.get() != &node) {
+        it->second->block.accept(*this);
       }
-      return scan_number();
-    case '*':
-      return make_token(Token::Kind::Times);
-    case '/':
-      return make_token(Token::Kind::Slash);
-    case '^':
-      return make_token(Token::Kind::Power);
-    case '%':
-      return make_token(Token::Kind::Percent);
-    case '.':
-      return make_token(Token::Kind::Dot);
-    case ',':
-      return make_token(Token::Kind::Comma);
-    case ':':
-      return make_token(Token::Kind::Colon);
-    case '|':
-      return make_token(Token::Kind::Pipe);
-    case '(':
-      return make_token(Token::Kind::LeftParen);
-    case ')':
-      minus_state = MinusState::Operator;
-      return make_token(Token::Kind::RightParen);
-    case '[':
-      return make_token(Token::Kind::LeftBracket);
-    case ']':
-      minus_state = MinusState::Operator;
-      return make_token(Token::Kind::RightBracket);
-    case '{':
-      return make_token(Token::Kind::LeftBrace);
-    case '}':
-      minus_state = MinusState::Operator;
-      return make_token(Token::Kind::RightBrace);
-    case '>':
-      if (pos < m_in.size() && m_in[pos] == '=') {
-        pos += 1;
-        return make_token(Token::Kind::GreaterEqual);
-      }
-      return make_token(Token::Kind::GreaterThan);
-    case '<':
-      if (pos < m_in.size() && m_in[pos] == '=') {
-        pos += 1;
-        return make_token(Token::Kind::LessEqual);
-      }
-      return make_token(Token::Kind::LessThan);
-    case '=':
-      if (pos < m_in.size() && m_in[pos] == '=') {
-        pos += 1;
-        return make_token(Token::Kind::Equal);
-      }
-      return make_token(Token::Kind::Unknown);
-    case '!':
-      if (pos < m_in.size() && m_in[pos] == '=') {
-        pos += 1;
-        return make_token(Token::Kind::NotEqual);
-      }
-      return make_token(Token::Kind::Unknown);
-    case '\"':
-      return scan_string();
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-      minus_state = MinusState::Operator;
-      return scan_number();
-    case '_':
-    case '@':
-    case '$':
-      minus_state = MinusState::Operator;
-      return scan_id();
-    default:
-      return make_token(Token::Kind::Unknown);
     }
   }
 
-  Token scan_id() {
-    for (;;) {
-      if (pos >= m_in.size()) {
-        break;
-      }
-      const char ch = m_in[pos];
-      if (!std::isalnum(ch) && ch != '.' && ch != '/' && ch != '_' && ch != '-') {
-        break;
-      }
-      pos += 1;
-    }
-    return make_token(Token::Kind::Id);
+  void visit(const SetStatementNode& node) override {
+    node.expression.accept(*this);
+
+    std::string ptr = node.key;
+    replace_substring(ptr, ".", "/");
+    result.set_locals.insert(node.key);
+    set_scopes.back().emplace_back(split_json_pointer("/" + ptr));
   }
 
-  Token scan_number() {
-    for (;;) {
-      if (pos >= m_in.size()) {
-        break;
-      }
-      const char ch = m_in[pos];
-      // be very permissive in lexer (we'll catch errors when conversion happens)
-      if (!(std::isdigit(ch) || ch == '.' || ch == 'e' || ch == 'E' || (ch == '+' && (pos == 0 || m_in[pos-1] == 'e' || m_in[pos-1] == 'E')) || (ch == '-' && (pos == 0 || m_in[pos-1] == 'e' || m_in[pos-1] == 'E')))) {
-        break;
-      }
-      pos += 1;
-    }
-    return make_token(Token::Kind::Number);
+  void visit(const RawStatementNode&) override {}
+
+public:
+  explicit AnalysisVisitor(const TemplateStorage& template_storage, const FunctionStorage& function_storage)
+      : template_storage(template_storage), function_storage(function_storage) {}
+
+  /// Analyzes the template; name is used as the root of the include graph
+  TemplateAnalysis analyze(const Template& tmpl, const std::string& name = "") {
+    result = TemplateAnalysis();
+    set_scopes.assign(1, {});
+    loop_bindings.clear();
+    loop_depth = 0;
+
+    analyze_template(name, tmpl);
+    return std::move(result);
   }
+};
 
-  Token scan_string() {
-    bool escape {false};
-    for (;;) {
-      if (pos >= m_in.size()) {
-        break;
-      }
-      const char ch = m_in[pos++];
-      if (ch == '\\') {
-        escape = !escape;
-      } else if (!escape && ch == m_in[tok_start]) {
-        break;
-      } else {
-        escape = false;
-      }
+/*!
+ * \brief What rendering a node could change besides its output.
+ */
+struct RenderEffects {
+  bool sets_variables {false};             // Set statements, whose variables stay visible to the rest of the render
+  std::set<std::string> loop_variables;    // Variables bound by loops, which keep their last value after the loop
+  std::set<std::string> free_variables;    // Top-level names read outside of the loops binding them
+  bool has_side_effects {false};           // Callbacks not marked deterministic, super() or extends, which depend on the order of rendering
+
+  /// Returns whether the node changes no variables of the render
+  bool is_read_only() const {
+    return !sets_variables && loop_variables.empty();
+  }
+};
+
+/*!
+ * \brief A visitor finding the effects of rendering a node, e.g. to render independent nodes concurrently.
+ *
+ * Included templates are followed, but their set and loop variables are not
+ * reported as they are local to the include. Block statements are analyzed with all
+ * blocks of the same name in the given extends chain, which might override
+ * them. The analysis is conservative: a callback that is only called if a
+ * variable is missing in the data is still reported.
+ */
+class EffectVisitor : public NodeVisitor {
+  using Op = FunctionStorage::Operation;
+
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
+  const std::vector<const Template*>& template_chain;
+
+  RenderEffects result;
+  std::vector<const Template*> include_stack;
+  std::vector<std::string> bound_variables; // Variables of the loops around the visited node
+
+  void check_callback(std::string_view name, int number_args) {
+    const auto function_data = function_storage.find_function(name, number_args);
+    if (function_data.operation == Op::Callback && !function_data.deterministic) {
+      result.has_side_effects = true;
     }
-    return make_token(Token::Kind::String);
   }
 
-  Token make_token(Token::Kind kind) const {
-    return Token(kind, string_view::slice(m_in, tok_start, pos));
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+    }
   }
 
-  void skip_whitespaces_and_newlines() {
-    if (pos < m_in.size()) {
-      while (pos < m_in.size() && (m_in[pos] == ' ' || m_in[pos] == '\t' || m_in[pos] == '\n' || m_in[pos] == '\r')) {
-        pos += 1;
-      }
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+  void visit(const LiteralNode&) override {}
+
+  void visit(const DataNode& node) override {
+    if (std::find(bound_variables.begin(), bound_variables.end(), node.path.front()) == bound_variables.end()) {
+      result.free_variables.insert(node.path.front());
     }
+    // Names missing in the data fall back to a callback without arguments
+    check_callback(node.name, 0);
   }
 
-  void skip_whitespaces_and_first_newline() {
-    if (pos < m_in.size()) {
-      while (pos < m_in.size() && (m_in[pos] == ' ' || m_in[pos] == '\t')) {
-        pos += 1;
-      }
+  void visit_loop(const ForStatementNode& node, const std::vector<std::string>& variables) {
+    node.condition.accept(*this);
+    if (include_stack.empty()) {
+      result.loop_variables.insert(variables.begin(), variables.end());
     }
+    bound_variables.insert(bound_variables.end(), variables.begin(), variables.end());
+    bound_variables.push_back("loop");
+    node.body.accept(*this);
+    bound_variables.resize(bound_variables.size() - variables.size() - 1);
+  }
 
-    if (pos < m_in.size()) {
-      const char ch = m_in[pos];
-      if (ch == '\n') {
-        pos += 1;
-      } else if (ch == '\r') {
-        pos += 1;
-        if (pos < m_in.size() && m_in[pos] == '\n') {
-          pos += 1;
-        }
-      }
+  void visit(const FunctionNode& node) override {
+    if (node.operation == Op::Super || node.operation == Op::None) {
+      result.has_side_effects = true;
+    } else if (node.operation == Op::Callback) {
+      check_callback(node.name, static_cast<int>(node.arguments.size()));
+    }
+    for (const auto& argument : node.arguments) {
+      argument->accept(*this);
     }
   }
 
-  static std::string_view clear_final_line_if_whitespace(std::string_view text) {
-    std::string_view result = text;
-    while (!result.empty()) {
-      const char ch = result.back();
-      if (ch == ' ' || ch == '\t') {
-        result.remove_suffix(1);
-      } else if (ch == '\n' || ch == '\r') {
-        break;
-      } else {
-        return text;
-      }
+  void visit(const ExpressionListNode& node) override {
+    if (node.root) {
+      node.root->accept(*this);
     }
-    return result;
   }
 
-public:
-  explicit Lexer(const LexerConfig& config): config(config), state(State::Text), minus_state(MinusState::Number), tok_start(0), pos(0) {}
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
 
-  SourceLocation current_position() const {
-    return get_source_location(m_in, tok_start);
+  void visit(const ForArrayStatementNode& node) override {
+    visit_loop(node, {node.value});
   }
 
-  void start(std::string_view input) {
-    m_in = input;
-    tok_start = 0;
-    pos = 0;
-    state = State::Text;
-    minus_state = MinusState::Number;
-
-    // Consume byte order mark (BOM) for UTF-8
-    if (inja::string_view::starts_with(m_in, "\xEF\xBB\xBF")) {
-      m_in = m_in.substr(3);
-    }
+  void visit(const ForObjectStatementNode& node) override {
+    visit_loop(node, {node.key, node.value});
   }
 
-  Token scan() {
-    tok_start = pos;
+  void visit(const IfStatementNode& node) override {
+    node.condition.accept(*this);
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
 
-  again:
-    if (tok_start >= m_in.size()) {
-      return make_token(Token::Kind::Eof);
+  void visit(const IncludeStatementNode& node) override {
+    const Template* included = node.linked;
+    if (included == nullptr) {
+      const auto it = template_storage.find(node.file);
+      included = (it != template_storage.end()) ? &it->second : nullptr;
+    }
+    if (included == nullptr || std::find(include_stack.begin(), include_stack.end(), included) != include_stack.end()) {
+      return;
     }
 
-    switch (state) {
-    default:
-    case State::Text: {
-      // fast-scan to first open character
-      const size_t open_start = m_in.substr(pos).find_first_of(config.open_chars);
-      if (open_start == std::string_view::npos) {
-        // didn't find open, return remaining text as text token
-        pos = m_in.size();
-        return make_token(Token::Kind::Text);
-      }
-      pos += open_start;
-
-      // try to match one of the opening sequences, and get the close
-      const std::string_view open_str = m_in.substr(pos);
-      bool must_lstrip = false;
-      if (inja::string_view::starts_with(open_str, config.expression_open)) {
-        if (inja::string_view::starts_with(open_str, config.expression_open_force_lstrip)) {
-          state = State::ExpressionStartForceLstrip;
-          must_lstrip = true;
-        } else {
-          state = State::ExpressionStart;
-        }
-      } else if (inja::string_view::starts_with(open_str, config.statement_open)) {
-        if (inja::string_view::starts_with(open_str, config.statement_open_no_lstrip)) {
-          state = State::StatementStartNoLstrip;
-        } else if (inja::string_view::starts_with(open_str, config.statement_open_force_lstrip)) {
-          state = State::StatementStartForceLstrip;
-          must_lstrip = true;
-        } else {
-          state = State::StatementStart;
-          must_lstrip = config.lstrip_blocks;
-        }
-      } else if (inja::string_view::starts_with(open_str, config.comment_open)) {
-        if (inja::string_view::starts_with(open_str, config.comment_open_force_lstrip)) {
-          state = State::CommentStartForceLstrip;
-          must_lstrip = true;
-        } else {
-          state = State::CommentStart;
-          must_lstrip = config.lstrip_blocks;
-        }
-      } else if ((pos == 0 || m_in[pos - 1] == '\n') && inja::string_view::starts_with(open_str, config.line_statement)) {
-        state = State::LineStart;
-      } else {
-        pos += 1; // wasn't actually an opening sequence
-        goto again;
-      }
-
-      std::string_view text = string_view::slice(m_in, tok_start, pos);
-      if (must_lstrip) {
-        text = clear_final_line_if_whitespace(text);
-      }
-
-      if (text.empty()) {
-        goto again; // don't generate empty token
-      }
-      return Token(Token::Kind::Text, text);
-    }
-    case State::ExpressionStart: {
-      state = State::ExpressionBody;
-      pos += config.expression_open.size();
-      return make_token(Token::Kind::ExpressionOpen);
-    }
-    case State::ExpressionStartForceLstrip: {
-      state = State::ExpressionBody;
-      pos += config.expression_open_force_lstrip.size();
-      return make_token(Token::Kind::ExpressionOpen);
-    }
-    case State::LineStart: {
-      state = State::LineBody;
-      pos += config.line_statement.size();
-      return make_token(Token::Kind::LineStatementOpen);
-    }
-    case State::StatementStart: {
-      state = State::StatementBody;
-      pos += config.statement_open.size();
-      return make_token(Token::Kind::StatementOpen);
-    }
-    case State::StatementStartNoLstrip: {
-      state = State::StatementBody;
-      pos += config.statement_open_no_lstrip.size();
-      return make_token(Token::Kind::StatementOpen);
-    }
-    case State::StatementStartForceLstrip: {
-      state = State::StatementBody;
-      pos += config.statement_open_force_lstrip.size();
-      return make_token(Token::Kind::StatementOpen);
-    }
-    case State::CommentStart: {
-      state = State::CommentBody;
-      pos += config.comment_open.size();
-      return make_token(Token::Kind::CommentOpen);
-    }
-    case State::CommentStartForceLstrip: {
-      state = State::CommentBody;
-      pos += config.comment_open_force_lstrip.size();
-      return make_token(Token::Kind::CommentOpen);
-    }
-    case State::ExpressionBody:
-      return scan_body(config.expression_close, Token::Kind::ExpressionClose, config.expression_close_force_rstrip);
-    case State::LineBody:
-      return scan_body("\n", Token::Kind::LineStatementClose);
-    case State::StatementBody:
-      return scan_body(config.statement_close, Token::Kind::StatementClose, config.statement_close_force_rstrip, config.trim_blocks);
-    case State::CommentBody: {
-      // fast-scan to comment close
-      const size_t end = m_in.substr(pos).find(config.comment_close);
-      if (end == std::string_view::npos) {
-        pos = m_in.size();
-        return make_token(Token::Kind::Eof);
-      }
-
-      // Check for trim pattern
-      const bool must_rstrip = inja::string_view::starts_with(m_in.substr(pos + end - 1), config.comment_close_force_rstrip);
+    // Variables of an included template do not leak into the including one
+    const bool sets_variables = result.sets_variables;
+    include_stack.push_back(included);
+    included->root.accept(*this);
+    include_stack.pop_back();
+    result.sets_variables = sets_variables;
+  }
 
-      // return the entire comment in the close token
-      state = State::Text;
-      pos += end + config.comment_close.size();
-      Token tok = make_token(Token::Kind::CommentClose);
+  void visit(const ExtendsStatementNode&) override {
+    result.has_side_effects = true;
+  }
 
-      if (must_rstrip || config.trim_blocks) {
-        skip_whitespaces_and_first_newline();
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+    for (const Template* tmpl : template_chain) {
+      const auto it = tmpl->block_storage.find(node.name);
+      if (it != tmpl->block_storage.end() && it->second.get() != &node) {
+        it->second->block.accept(*this);
       }
-      return tok;
-    }
     }
   }
 
-  const LexerConfig& get_config() const {
-    return config;
+  void visit(const SetStatementNode& node) override {
+    result.sets_variables = true;
+    node.expression.accept(*this);
+  }
+
+  void visit(const RawStatementNode&) override {}
+
+public:
+  explicit EffectVisitor(const TemplateStorage& template_storage, const FunctionStorage& function_storage,
+                         const std::vector<const Template*>& template_chain)
+      : template_storage(template_storage), function_storage(function_storage), template_chain(template_chain) {}
+
+  RenderEffects analyze(const AstNode& node) {
+    result = RenderEffects();
+    include_stack.clear();
+    bound_variables.clear();
+    node.accept(*this);
+    return result;
   }
 };
 
 } // namespace inja
 
-#endif // INCLUDE_INJA_LEXER_HPP_
+#endif // INCLUDE_INJA_ANALYSIS_HPP_
 
-// #include "node.hpp"
+// #include "bundle.hpp"
+#ifndef INCLUDE_INJA_BUNDLE_HPP_
+#define INCLUDE_INJA_BUNDLE_HPP_
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// #include "config.hpp"
+#ifndef INCLUDE_INJA_CONFIG_HPP_
+#define INCLUDE_INJA_CONFIG_HPP_
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
 
 // #include "template.hpp"
 
-// #include "throw.hpp"
+// #include "thread_pool.hpp"
+#ifndef INCLUDE_INJA_THREAD_POOL_HPP_
+#define INCLUDE_INJA_THREAD_POOL_HPP_
 
-// #include "token.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// #include "executor.hpp"
+#ifndef INCLUDE_INJA_EXECUTOR_HPP_
+#define INCLUDE_INJA_EXECUTOR_HPP_
 
+#include <chrono>
+#include <functional>
+#include <stop_token>
 
 namespace inja {
 
 /*!
- * \brief Class for parsing an inja Template.
+ * \brief Runs the tasks of asynchronous renders, e.g. on an existing thread pool or event loop.
+ *
+ * Every task must be run exactly once. Tasks may run on any thread and in any
+ * order, and never wait for other tasks of the executor.
  */
-class Parser {
-  using Arguments = std::vector<std::shared_ptr<ExpressionNode>>;
-  using OperatorStack = std::stack<std::shared_ptr<FunctionNode>>;
+class Executor {
+public:
+  virtual ~Executor() = default;
 
-  const ParserConfig& config;
+  virtual void execute(std::function<void()> task) = 0;
+};
 
-  Lexer lexer;
-  TemplateStorage& template_storage;
-  const FunctionStorage& function_storage;
+/*!
+ * \brief Options of an asynchronous render, see Environment::render_async().
+ */
+struct AsyncRenderOptions {
+  Executor* executor {nullptr}; // Runs the render, nullptr uses the thread pool of the environment
+  std::stop_token stop_token;   // Cancels the render once a stop is requested
+  std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+};
 
-  Token tok, peek_tok;
-  bool have_peek_tok {false};
+} // namespace inja
 
-  std::string_view literal_start;
+#endif // INCLUDE_INJA_EXECUTOR_HPP_
 
-  BlockNode* current_block {nullptr};
-  ExpressionListNode* current_expression_list {nullptr};
 
-  std::stack<IfStatementNode*> if_statement_stack;
-  std::stack<ForStatementNode*> for_statement_stack;
-  std::stack<BlockStatementNode*> block_statement_stack;
+namespace inja {
 
-  void throw_parser_error(const std::string& message) const {
-    INJA_THROW(ParserError(message, lexer.current_position()));
-  }
+/*!
+ * \brief A work-stealing pool of worker threads.
+ *
+ * Every worker owns a queue of tasks. Tasks submitted from a worker are
+ * pushed to its own queue and run last-in first-out, while idle workers
+ * steal the oldest tasks from the other queues.
+ */
+class ThreadPool : public Executor {
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
 
-  void get_next_token() {
-    if (have_peek_tok) {
-      tok = peek_tok;
-      have_peek_tok = false;
-    } else {
-      tok = lexer.scan();
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake_up;
+  std::atomic<size_t> pending {0};
+  std::atomic<size_t> next_queue {0};
+  bool stopping {false};
+
+  // Pool and queue index of the worker running on this thread
+  static inline thread_local const ThreadPool* tl_pool_ {nullptr};
+  static inline thread_local size_t tl_queue_ {0};
+
+  bool pop_task(size_t index, std::function<void()>& task) {
+    {
+      auto& own = *queues[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
     }
-  }
 
-  void get_peek_token() {
-    if (!have_peek_tok) {
-      peek_tok = lexer.scan();
-      have_peek_tok = true;
+    for (size_t i = 1; i < queues.size(); ++i) {
+      auto& other = *queues[(index + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      if (!other.tasks.empty()) {
+        task = std::move(other.tasks.front());
+        other.tasks.pop_front();
+        return true;
+      }
     }
+    return false;
   }
 
-  void add_literal(Arguments &arguments, const char* content_ptr) {
-    const std::string_view data_text(literal_start.data(), tok.text.data() - literal_start.data() + tok.text.size());
-    arguments.emplace_back(std::make_shared<LiteralNode>(data_text, data_text.data() - content_ptr));
+  void run_task(std::function<void()>& task) {
+    pending.fetch_sub(1, std::memory_order_acq_rel);
+    task();
   }
 
-  void add_operator(Arguments &arguments, OperatorStack &operator_stack) {
-    auto function = operator_stack.top();
-    operator_stack.pop();
+  void work(size_t index) {
+    tl_pool_ = this;
+    tl_queue_ = index;
 
-    if (static_cast<int>(arguments.size()) < function->number_args) {
-      throw_parser_error("too few arguments");
-    }
+    std::function<void()> task;
+    while (true) {
+      if (pop_task(index, task)) {
+        run_task(task);
+        continue;
+      }
 
-    for (int i = 0; i < function->number_args; ++i) {
-      function->arguments.insert(function->arguments.begin(), arguments.back());
-      arguments.pop_back();
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      wake_up.wait(lock, [this] { return stopping || pending.load(std::memory_order_acquire) > 0; });
+      if (stopping && pending.load(std::memory_order_acquire) == 0) {
+        return;
+      }
     }
-    arguments.emplace_back(function);
   }
 
-  void add_to_template_storage(const std::filesystem::path& path, std::string& template_name) {
-    if (template_storage.find(template_name) != template_storage.end()) {
-      return;
+  void push(std::function<void()> task) {
+    const size_t index = (tl_pool_ == this) ? tl_queue_ : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+      auto& queue = *queues[index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
     }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      pending.fetch_add(1, std::memory_order_acq_rel);
+    }
+    wake_up.notify_one();
+  }
 
-    const std::string original_name = template_name;
-
-    if (config.search_included_templates_in_files) {
-      // Build the relative path
-      template_name = (path / original_name).string();
-      if (template_name.compare(0, 2, "./") == 0) {
-        template_name.erase(0, 2);
-      }
-
-      if (template_storage.find(template_name) == template_storage.end()) {
-        // Load file
-        std::ifstream file;
-        file.open(template_name);
-        if (!file.fail()) {
-          const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-
-          auto include_template = Template(text);
-          template_storage.emplace(template_name, include_template);
-          parse_into_template(template_storage[template_name], template_name);
-          return;
-        } else if (!config.include_callback) {
-          INJA_THROW(FileError("failed accessing file at '" + template_name + "'"));
-        }
-      }
+public:
+  /// Starts the given number of workers, 0 uses the number of hardware threads
+  explicit ThreadPool(size_t thread_count = 0) {
+    if (thread_count == 0) {
+      thread_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
     }
 
-    // Try include callback
-    if (config.include_callback) {
-      auto include_template = config.include_callback(path, original_name);
-      template_storage.emplace(template_name, include_template);
+    for (size_t i = 0; i < thread_count; ++i) {
+      queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+      workers.emplace_back([this, i] { work(i); });
     }
   }
 
-  std::string parse_filename() const {
-    if (tok.kind != Token::Kind::String) {
-      throw_parser_error("expected string, got '" + tok.describe() + "'");
+  /// Runs all remaining tasks and joins the workers
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
     }
-
-    if (tok.text.length() < 2) {
-      throw_parser_error("expected filename, got '" + static_cast<std::string>(tok.text) + "'");
+    wake_up.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
     }
+  }
 
-    // Remove first and last character ""
-    return std::string {tok.text.substr(1, tok.text.length() - 2)};
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const {
+    return workers.size();
   }
 
-  bool parse_expression(Template& tmpl, Token::Kind closing) {
-    current_expression_list->root = parse_expression(tmpl);
-    return tok.kind == closing;
+  /// Queues a task, the returned future holds its result or exception
+  template <class Function>
+  std::future<std::invoke_result_t<Function>> submit(Function function) {
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Function>()>>(std::move(function));
+    auto result = task->get_future();
+    push([task] { (*task)(); });
+    return result;
   }
 
-  std::shared_ptr<ExpressionNode> parse_expression(Template& tmpl) {
-    size_t current_bracket_level {0};
-    size_t current_brace_level {0};
-    Arguments arguments;
-    OperatorStack operator_stack;
+  void execute(std::function<void()> task) override {
+    push(std::move(task));
+  }
 
-    while (tok.kind != Token::Kind::Eof) {
-      // Literals
-      switch (tok.kind) {
-      case Token::Kind::String: {
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          literal_start = tok.text;
-          add_literal(arguments, tmpl.content.c_str());
-        }
-      } break;
-      case Token::Kind::Number: {
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          literal_start = tok.text;
-          add_literal(arguments, tmpl.content.c_str());
-        }
-      } break;
-      case Token::Kind::LeftBracket: {
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          literal_start = tok.text;
-        }
-        current_bracket_level += 1;
-      } break;
-      case Token::Kind::LeftBrace: {
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          literal_start = tok.text;
-        }
-        current_brace_level += 1;
-      } break;
-      case Token::Kind::RightBracket: {
-        if (current_bracket_level == 0) {
-          throw_parser_error("unexpected ']'");
-        }
+  /// Runs one queued task on the calling thread, e.g. while waiting for another task; returns false if there was none
+  bool run_pending_task() {
+    std::function<void()> task;
+    if (!pop_task((tl_pool_ == this) ? tl_queue_ : 0, task)) {
+      return false;
+    }
+    run_task(task);
+    return true;
+  }
 
-        current_bracket_level -= 1;
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          add_literal(arguments, tmpl.content.c_str());
-        }
-      } break;
-      case Token::Kind::RightBrace: {
-        if (current_brace_level == 0) {
-          throw_parser_error("unexpected '}'");
-        }
+  /// Waits for the result of a task, running queued tasks on the calling thread in the meantime
+  template <class T>
+  void wait(const std::future<T>& future) {
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      if (!run_pending_task()) {
+        future.wait();
+      }
+    }
+  }
+};
 
-        current_brace_level -= 1;
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          add_literal(arguments, tmpl.content.c_str());
-        }
-      } break;
-      case Token::Kind::Id: {
-        get_peek_token();
+} // namespace inja
 
-        // Data Literal
-        if (tok.text == static_cast<decltype(tok.text)>("true") || tok.text == static_cast<decltype(tok.text)>("false") ||
-            tok.text == static_cast<decltype(tok.text)>("null")) {
-          if (current_brace_level == 0 && current_bracket_level == 0) {
-            literal_start = tok.text;
-            add_literal(arguments, tmpl.content.c_str());
-          }
+#endif // INCLUDE_INJA_THREAD_POOL_HPP_
 
-          // Operator
-        } else if (tok.text == "and" || tok.text == "or" || tok.text == "in" || tok.text == "not") {
-          goto parse_operator;
+// #include "json.hpp"
 
-          // Functions
-        } else if (peek_tok.kind == Token::Kind::LeftParen) {
-          auto func = std::make_shared<FunctionNode>(tok.text, tok.text.data() - tmpl.content.c_str());
-          get_next_token();
-          do {
-            get_next_token();
-            auto expr = parse_expression(tmpl);
-            if (!expr) {
-              break;
-            }
-            func->number_args += 1;
-            func->arguments.emplace_back(expr);
-          } while (tok.kind == Token::Kind::Comma);
-          if (tok.kind != Token::Kind::RightParen) {
-            throw_parser_error("expected right parenthesis, got '" + tok.describe() + "'");
-          }
 
-          auto function_data = function_storage.find_function(func->name, func->number_args);
-          if (function_data.operation == FunctionStorage::Operation::None) {
-            if (!config.graceful_errors) {
-              throw_parser_error("unknown function " + func->name);
-            }
-            // In graceful mode, explicitly set operation to None to be handled at render time
-            func->operation = FunctionStorage::Operation::None;
-          } else {
-            func->operation = function_data.operation;
-            if (function_data.operation == FunctionStorage::Operation::Callback) {
-              func->callback = function_data.callback;
-            }
-          }
-          arguments.emplace_back(func);
+namespace inja {
 
-          // Variables
-        } else {
-          arguments.emplace_back(std::make_shared<DataNode>(static_cast<std::string>(tok.text), tok.text.data() - tmpl.content.c_str()));
-        }
+/*!
+ * \brief Type for callback wrapper function used for tracing/instrumentation.
+ *
+ * The wrapper receives the function name, the arguments passed to the callback,
+ * and a thunk that executes the actual callback.
+ * This allows external code to wrap callback execution with timing, tracing,
+ * argument logging, return value inspection, etc.
+ *
+ * Usage: wrapper("function_name", args, [&]() { return actual_callback(args); })
+ */
+using CallbackWrapper = std::function<json(const std::string& function_name, const Arguments& args, const std::function<json()>& callback_thunk)>;
 
-        // Operators
-      } break;
-      case Token::Kind::Equal:
-      case Token::Kind::NotEqual:
-      case Token::Kind::GreaterThan:
-      case Token::Kind::GreaterEqual:
-      case Token::Kind::LessThan:
-      case Token::Kind::LessEqual:
-      case Token::Kind::Plus:
-      case Token::Kind::Minus:
-      case Token::Kind::Times:
-      case Token::Kind::Slash:
-      case Token::Kind::Power:
-      case Token::Kind::Percent:
-      case Token::Kind::Dot: {
+/*!
+ * \brief Event types for Inja instrumentation.
+ *
+ * These events are emitted during template rendering to provide visibility
+ * into internal operations for debugging and performance analysis.
+ */
+enum class InstrumentationEvent {
+  // Template rendering lifecycle
+  RenderStart,           // Template rendering started
+  RenderEnd,             // Template rendering completed
+
+  // Set statement events
+  SetStatementStart,     // Beginning of set statement evaluation
+  SetStatementEnd,       // End of set statement evaluation
+
+  // In-place optimization events
+  InplaceOptUsed,        // In-place optimization was successfully used
+  InplaceOptSkipped,     // In-place optimization was skipped (with reason)
+  MemoHit,               // Cached result of an optimized expression was reused
+
+  // Expression evaluation
+  ExpressionEvalStart,   // Beginning of expression evaluation
+  ExpressionEvalEnd,     // End of expression evaluation
+
+  // Loop events
+  ForLoopStart,          // Beginning of for loop
+  ForLoopIteration,      // Each iteration of a for loop
+  ForLoopEnd,            // End of for loop
+
+  // Include/block events
+  IncludeStart,          // Including another template
+  IncludeEnd,            // Finished including template
+};
 
-      parse_operator:
-        FunctionStorage::Operation operation;
-        switch (tok.kind) {
-        case Token::Kind::Id: {
-          if (tok.text == "and") {
-            operation = FunctionStorage::Operation::And;
-          } else if (tok.text == "or") {
-            operation = FunctionStorage::Operation::Or;
-          } else if (tok.text == "in") {
-            operation = FunctionStorage::Operation::In;
-          } else if (tok.text == "not") {
-            operation = FunctionStorage::Operation::Not;
-          } else {
-            throw_parser_error("unknown operator in parser.");
-          }
-        } break;
-        case Token::Kind::Equal: {
-          operation = FunctionStorage::Operation::Equal;
-        } break;
-        case Token::Kind::NotEqual: {
-          operation = FunctionStorage::Operation::NotEqual;
-        } break;
-        case Token::Kind::GreaterThan: {
-          operation = FunctionStorage::Operation::Greater;
-        } break;
-        case Token::Kind::GreaterEqual: {
-          operation = FunctionStorage::Operation::GreaterEqual;
-        } break;
-        case Token::Kind::LessThan: {
-          operation = FunctionStorage::Operation::Less;
-        } break;
-        case Token::Kind::LessEqual: {
-          operation = FunctionStorage::Operation::LessEqual;
-        } break;
-        case Token::Kind::Plus: {
-          operation = FunctionStorage::Operation::Add;
-        } break;
-        case Token::Kind::Minus: {
-          operation = FunctionStorage::Operation::Subtract;
-        } break;
-        case Token::Kind::Times: {
-          operation = FunctionStorage::Operation::Multiplication;
-        } break;
-        case Token::Kind::Slash: {
-          operation = FunctionStorage::Operation::Division;
-        } break;
-        case Token::Kind::Power: {
-          operation = FunctionStorage::Operation::Power;
-        } break;
-        case Token::Kind::Percent: {
-          operation = FunctionStorage::Operation::Modulo;
-        } break;
-        case Token::Kind::Dot: {
-          operation = FunctionStorage::Operation::AtId;
-        } break;
-        default: {
-          throw_parser_error("unknown operator in parser.");
-        }
-        }
-        auto function_node = std::make_shared<FunctionNode>(operation, tok.text.data() - tmpl.content.c_str());
+/*!
+ * \brief Data associated with instrumentation events.
+ */
+struct InstrumentationData {
+  InstrumentationEvent event;
+  std::string name;              // Variable name, template name, function name, etc.
+  std::string detail;            // Additional detail (e.g., skip reason, loop count)
+  size_t count {0};              // Numeric data (e.g., iteration count, array size)
+
+  InstrumentationData(InstrumentationEvent e) : event(e) {}
+  InstrumentationData(InstrumentationEvent e, const std::string& n) : event(e), name(n) {}
+  InstrumentationData(InstrumentationEvent e, const std::string& n, const std::string& d)
+      : event(e), name(n), detail(d) {}
+  InstrumentationData(InstrumentationEvent e, const std::string& n, const std::string& d, size_t c)
+      : event(e), name(n), detail(d), count(c) {}
+};
 
-        while (!operator_stack.empty() &&
-               ((operator_stack.top()->precedence > function_node->precedence) ||
-                (operator_stack.top()->precedence == function_node->precedence && function_node->associativity == FunctionNode::Associativity::Left))) {
-          add_operator(arguments, operator_stack);
-        }
+/*!
+ * \brief Callback type for receiving instrumentation events.
+ *
+ * The callback receives an InstrumentationData struct with event details.
+ * This is called synchronously during rendering, so implementations should
+ * be fast to avoid impacting render performance.
+ */
+using InstrumentationCallback = std::function<void(const InstrumentationData& data)>;
 
-        operator_stack.emplace(function_node);
-      } break;
-      case Token::Kind::Comma: {
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          goto break_loop;
-        }
-      } break;
-      case Token::Kind::Colon: {
-        if (current_brace_level == 0 && current_bracket_level == 0) {
-          throw_parser_error("unexpected ':'");
-        }
-      } break;
-      case Token::Kind::LeftParen: {
-        get_next_token();
-        auto expr = parse_expression(tmpl);
-        if (tok.kind != Token::Kind::RightParen) {
-            throw_parser_error("expected right parenthesis, got '" + tok.describe() + "'");
-        }
-        if (!expr) {
-          throw_parser_error("empty expression in parentheses");
-        }
-        arguments.emplace_back(expr);
-      } break;
+/*!
+ * \brief Class for lexer configuration.
+ */
+struct LexerConfig {
+  std::string statement_open {"{%"};
+  std::string statement_open_no_lstrip {"{%+"};
+  std::string statement_open_force_lstrip {"{%-"};
+  std::string statement_close {"%}"};
+  std::string statement_close_force_rstrip {"-%}"};
+  std::string line_statement {"##"};
+  std::string expression_open {"{{"};
+  std::string expression_open_force_lstrip {"{{-"};
+  std::string expression_close {"}}"};
+  std::string expression_close_force_rstrip {"-}}"};
+  std::string comment_open {"{#"};
+  std::string comment_open_force_lstrip {"{#-"};
+  std::string comment_close {"#}"};
+  std::string comment_close_force_rstrip {"-#}"};
+  std::string open_chars {"#{"};
 
-      // parse function call pipe syntax
-      case Token::Kind::Pipe: {
-        // get function name
-        get_next_token();
-        if (tok.kind != Token::Kind::Id) {
-          throw_parser_error("expected function name, got '" + tok.describe() + "'");
-        }
-        auto func = std::make_shared<FunctionNode>(tok.text, tok.text.data() - tmpl.content.c_str());
-        // add first parameter as last value from arguments
-        func->number_args += 1;
-        func->arguments.emplace_back(arguments.back());
-        arguments.pop_back();
-        get_peek_token();
-        if (peek_tok.kind == Token::Kind::LeftParen) {
-          get_next_token();
-          // parse additional parameters
-          do {
-            get_next_token();
-            auto expr = parse_expression(tmpl);
-            if (!expr) {
-              break;
-            }
-            func->number_args += 1;
-            func->arguments.emplace_back(expr);
-          } while (tok.kind == Token::Kind::Comma);
-          if (tok.kind != Token::Kind::RightParen) {
-            throw_parser_error("expected right parenthesis, got '" + tok.describe() + "'");
-          }
-        }
-        // search store for defined function with such name and number of args
-        auto function_data = function_storage.find_function(func->name, func->number_args);
-        if (function_data.operation == FunctionStorage::Operation::None) {
-          if (!config.graceful_errors) {
-            throw_parser_error("unknown function " + func->name);
-          }
-          // In graceful mode, explicitly set operation to None to be handled at render time
-          func->operation = FunctionStorage::Operation::None;
-        } else {
-          func->operation = function_data.operation;
-          if (function_data.operation == FunctionStorage::Operation::Callback) {
-            func->callback = function_data.callback;
-          }
-        }
-        arguments.emplace_back(func);
-      } break;
-      default:
-        goto break_loop;
-      }
+  bool trim_blocks {false};
+  bool lstrip_blocks {false};
 
-      get_next_token();
+  void update_open_chars() {
+    open_chars = "";
+    if (open_chars.find(line_statement[0]) == std::string::npos) {
+      open_chars += line_statement[0];
     }
-
-  break_loop:
-    while (!operator_stack.empty()) {
-      add_operator(arguments, operator_stack);
+    if (open_chars.find(statement_open[0]) == std::string::npos) {
+      open_chars += statement_open[0];
     }
-
-    std::shared_ptr<ExpressionNode> expr;
-    if (arguments.size() == 1) {
-      expr = arguments[0];
-      arguments = {};
-    } else if (arguments.size() > 1) {
-      throw_parser_error("malformed expression");
+    if (open_chars.find(statement_open_no_lstrip[0]) == std::string::npos) {
+      open_chars += statement_open_no_lstrip[0];
     }
-    return expr;
-  }
-
-  bool parse_statement(Template& tmpl, Token::Kind closing, const std::filesystem::path& path) {
-    if (tok.kind != Token::Kind::Id) {
-      return false;
+    if (open_chars.find(statement_open_force_lstrip[0]) == std::string::npos) {
+      open_chars += statement_open_force_lstrip[0];
+    }
+    if (open_chars.find(expression_open[0]) == std::string::npos) {
+      open_chars += expression_open[0];
     }
+    if (open_chars.find(expression_open_force_lstrip[0]) == std::string::npos) {
+      open_chars += expression_open_force_lstrip[0];
+    }
+    if (open_chars.find(comment_open[0]) == std::string::npos) {
+      open_chars += comment_open[0];
+    }
+    if (open_chars.find(comment_open_force_lstrip[0]) == std::string::npos) {
+      open_chars += comment_open_force_lstrip[0];
+    }
+  }
+};
 
-    if (tok.text == static_cast<decltype(tok.text)>("if")) {
-      get_next_token();
+/*!
+ * \brief Limits on the estimated render cost of parsed templates.
+ *
+ * A limit of zero is disabled. Templates exceeding a limit are rejected at parse time.
+ */
+struct CostLimits {
+  size_t max_loop_depth {0};
+  double max_estimated_cost {0.0};
+  size_t assumed_loop_size {10}; // Iterations assumed for every loop when estimating the cost
+};
 
-      auto if_statement_node = std::make_shared<IfStatementNode>(current_block, tok.text.data() - tmpl.content.c_str());
-      current_block->nodes.emplace_back(if_statement_node);
-      if_statement_stack.emplace(if_statement_node.get());
-      current_block = &if_statement_node->true_statement;
-      current_expression_list = &if_statement_node->condition;
+/*!
+ * \brief Class for parser configuration.
+ */
+struct ParserConfig {
+  bool search_included_templates_in_files {true};
+  bool graceful_errors {false}; // If true, allow unknown functions at parse time
+  CostLimits cost_limits;
 
-      if (!parse_expression(tmpl, closing)) {
-        return false;
-      }
-    } else if (tok.text == static_cast<decltype(tok.text)>("elif")) {
-      // Handle elif as a direct alternative to else if
-      if (if_statement_stack.empty()) {
-        throw_parser_error("elif without matching if");
-      }
-      auto& if_statement_data = if_statement_stack.top();
-      get_next_token();
+  std::function<Template(const std::filesystem::path&, const std::string&)> include_callback;
+};
 
-      if_statement_data->has_false_statement = true;
-      current_block = &if_statement_data->false_statement;
+/*!
+ * \brief Class for render configuration.
+ */
+struct RenderConfig {
+  bool throw_at_missing_includes {true};
+  bool html_autoescape {false};
+  bool graceful_errors {false}; // If true, missing variables/functions render as original template text
+  
+  /*!
+   * \brief Optional callback wrapper for instrumenting callback execution.
+   *
+   * When set, all user-defined callbacks will be invoked through this wrapper,
+   * allowing external code to measure timing, add tracing spans, etc.
+   *
+   * The wrapper receives the callback function name and a thunk that executes
+   * the actual callback. Example usage for tracing:
+   *
+   * render_config.callback_wrapper = [&](const std::string& name, const std::function<json()>& thunk) {
+   *     auto span = trace_context.StartSpan("decorator:" + name);
+   *     auto result = thunk();
+   *     trace_context.EndSpan(span);
+   *     return result;
+   * };
+   */
+  CallbackWrapper callback_wrapper;
 
-      auto if_statement_node = std::make_shared<IfStatementNode>(true, current_block, tok.text.data() - tmpl.content.c_str());
-      current_block->nodes.emplace_back(if_statement_node);
-      if_statement_stack.emplace(if_statement_node.get());
-      current_block = &if_statement_node->true_statement;
-      current_expression_list = &if_statement_node->condition;
+  /*!
+   * \brief Optional instrumentation callback for receiving internal events.
+   *
+   * When set, the renderer emits events at key points during template
+   * processing (set statements, loops, includes, in-place optimizations, etc.)
+   * to provide visibility into internal operations for debugging.
+   */
+  InstrumentationCallback instrumentation_callback;
 
-      if (!parse_expression(tmpl, closing)) {
-        return false;
-      }
-    } else if (tok.text == static_cast<decltype(tok.text)>("else")) {
-      if (if_statement_stack.empty()) {
-        throw_parser_error("else without matching if");
-      }
-      auto& if_statement_data = if_statement_stack.top();
-      get_next_token();
+  /*!
+   * \brief Optional thread pool for rendering independent parts of a template concurrently.
+   *
+   * Sibling includes and block statements whose rendering cannot affect each
+   * other, as well as the iterations of large loops, are rendered on the pool
+   * into separate buffers, which are written in order, so that the output is
+   * the same as of a serial render.
+   */
+  std::shared_ptr<ThreadPool> thread_pool;
 
-      if_statement_data->has_false_statement = true;
-      current_block = &if_statement_data->false_statement;
+  /// Minimum number of iterations of a loop over an array to render it in chunks on the thread pool, 0 never does
+  size_t concurrent_loop_size {1024};
+};
 
-      // Chained else if
-      if (tok.kind == Token::Kind::Id && tok.text == static_cast<decltype(tok.text)>("if")) {
-        get_next_token();
+} // namespace inja
 
-        auto if_statement_node = std::make_shared<IfStatementNode>(true, current_block, tok.text.data() - tmpl.content.c_str());
-        current_block->nodes.emplace_back(if_statement_node);
-        if_statement_stack.emplace(if_statement_node.get());
-        current_block = &if_statement_node->true_statement;
-        current_expression_list = &if_statement_node->condition;
+#endif // INCLUDE_INJA_CONFIG_HPP_
 
-        if (!parse_expression(tmpl, closing)) {
-          return false;
-        }
-      }
-    } else if (tok.text == static_cast<decltype(tok.text)>("endif")) {
-      if (if_statement_stack.empty()) {
-        throw_parser_error("endif without matching if");
-      }
+// #include "data_file.hpp"
+#ifndef INCLUDE_INJA_DATA_FILE_HPP_
+#define INCLUDE_INJA_DATA_FILE_HPP_
 
-      // Nested if statements
-      while (if_statement_stack.top()->is_nested) {
-        if_statement_stack.pop();
-      }
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
 
-      auto& if_statement_data = if_statement_stack.top();
-      get_next_token();
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define INJA_HAS_MMAP 1
+#endif
 
-      current_block = if_statement_data->parent;
-      if_statement_stack.pop();
-    } else if (tok.text == static_cast<decltype(tok.text)>("block")) {
-      get_next_token();
+// #include "exceptions.hpp"
 
-      if (tok.kind != Token::Kind::Id) {
-        throw_parser_error("expected block name, got '" + tok.describe() + "'");
-      }
+// #include "json.hpp"
 
-      const std::string block_name = static_cast<std::string>(tok.text);
+// #include "throw.hpp"
 
-      auto block_statement_node = std::make_shared<BlockStatementNode>(current_block, block_name, tok.text.data() - tmpl.content.c_str());
-      current_block->nodes.emplace_back(block_statement_node);
-      block_statement_stack.emplace(block_statement_node.get());
-      current_block = &block_statement_node->block;
-      auto success = tmpl.block_storage.emplace(block_name, block_statement_node);
-      if (!success.second) {
-        throw_parser_error("block with the name '" + block_name + "' does already exist");
-      }
 
-      get_next_token();
-    } else if (tok.text == static_cast<decltype(tok.text)>("endblock")) {
-      if (block_statement_stack.empty()) {
-        throw_parser_error("endblock without matching block");
-      }
+namespace inja {
 
-      auto& block_statement_data = block_statement_stack.top();
-      get_next_token();
-
-      current_block = block_statement_data->parent;
-      block_statement_stack.pop();
-    } else if (tok.text == static_cast<decltype(tok.text)>("for")) {
-      get_next_token();
+/*!
+ * \brief A read-only view of a whole file, memory mapped where supported.
+ */
+class MappedFile {
+  const char* data_ {nullptr};
+  size_t size_ {0};
+  bool mapped_ {false};
+  std::string buffer_; // Contents if the file could not be mapped
 
-      // options: for a in arr; for a, b in obj
-      if (tok.kind != Token::Kind::Id) {
-        throw_parser_error("expected id, got '" + tok.describe() + "'");
+public:
+  explicit MappedFile(const std::filesystem::path& filename) {
+#ifdef INJA_HAS_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      INJA_THROW(FileError("failed accessing file at '" + filename.string() + "'"));
+    }
+    struct stat info {};
+    const bool has_size = ::fstat(fd, &info) == 0;
+    if (has_size && info.st_size > 0) {
+      void* mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        ::madvise(mapped, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(mapped);
+        size_ = static_cast<size_t>(info.st_size);
+        mapped_ = true;
       }
+    }
+    ::close(fd);
+    if (mapped_ || (has_size && S_ISREG(info.st_mode) && info.st_size == 0)) {
+      return;
+    }
+#endif
+    std::ifstream file(filename, std::ios::binary);
+    if (file.fail()) {
+      INJA_THROW(FileError("failed accessing file at '" + filename.string() + "'"));
+    }
+    buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
 
-      Token value_token = tok;
-      get_next_token();
+  ~MappedFile() {
+#ifdef INJA_HAS_MMAP
+    if (mapped_) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
 
-      // Object type
-      std::shared_ptr<ForStatementNode> for_statement_node;
-      if (tok.kind == Token::Kind::Comma) {
-        get_next_token();
-        if (tok.kind != Token::Kind::Id) {
-          throw_parser_error("expected id, got '" + tok.describe() + "'");
-        }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
 
-        const Token key_token = value_token;
-        value_token = tok;
-        get_next_token();
+  const char* data() const {
+    return data_;
+  }
 
-        for_statement_node = std::make_shared<ForObjectStatementNode>(static_cast<std::string>(key_token.text), static_cast<std::string>(value_token.text),
-                                                                      current_block, tok.text.data() - tmpl.content.c_str());
+  size_t size() const {
+    return size_;
+  }
 
-        // Array type
-      } else {
-        for_statement_node =
-            std::make_shared<ForArrayStatementNode>(static_cast<std::string>(value_token.text), current_block, tok.text.data() - tmpl.content.c_str());
-      }
+  std::string_view view() const {
+    return {data_, size_};
+  }
+};
 
-      current_block->nodes.emplace_back(for_statement_node);
-      for_statement_stack.emplace(for_statement_node.get());
-      current_block = &for_statement_node->body;
-      current_expression_list = &for_statement_node->condition;
+/*!
+ * \brief Formats of data files.
+ */
+enum class DataFormat {
+  Auto, // Detected from the file extension, or else the first bytes
+  Json,
+  Cbor,
+  MessagePack,
+  Bson,
+};
 
-      if (tok.kind != Token::Kind::Id || tok.text != static_cast<decltype(tok.text)>("in")) {
-        throw_parser_error("expected 'in', got '" + tok.describe() + "'");
-      }
-      get_next_token();
+/// Returns the format of data with the given file extension (including the dot), or Auto if unknown
+inline DataFormat data_format_from_extension(std::string extension) {
+  for (auto& ch : extension) {
+    ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+  }
+  if (extension == ".json") {
+    return DataFormat::Json;
+  } else if (extension == ".cbor") {
+    return DataFormat::Cbor;
+  } else if (extension == ".msgpack" || extension == ".mpk") {
+    return DataFormat::MessagePack;
+  } else if (extension == ".bson") {
+    return DataFormat::Bson;
+  }
+  return DataFormat::Auto;
+}
 
-      if (!parse_expression(tmpl, closing)) {
-        return false;
-      }
-    } else if (tok.text == static_cast<decltype(tok.text)>("endfor")) {
-      if (for_statement_stack.empty()) {
-        throw_parser_error("endfor without matching for");
-      }
+/*!
+ * \brief Detects the format of data by its first bytes.
+ *
+ * BSON starts with its total length, CBOR with its self-describe tag or a
+ * map or array header, MessagePack with a map or array header. A small CBOR
+ * array and a small MessagePack map start with the same byte, these are
+ * detected as MessagePack if they parse as such. Everything else is JSON.
+ */
+inline DataFormat detect_data_format(std::string_view data) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  const size_t size = data.size();
+  if (size == 0) {
+    return DataFormat::Json;
+  }
 
-      auto& for_statement_data = for_statement_stack.top();
-      get_next_token();
+  if (size >= 5) {
+    const uint32_t length = static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) | (static_cast<uint32_t>(bytes[2]) << 16) |
+                            (static_cast<uint32_t>(bytes[3]) << 24);
+    if (length == size && bytes[size - 1] == 0x00) {
+      return DataFormat::Bson;
+    }
+  }
 
-      current_block = for_statement_data->parent;
-      for_statement_stack.pop();
-    } else if (tok.text == static_cast<decltype(tok.text)>("include")) {
-      get_next_token();
+  const uint8_t first = bytes[0];
+  if ((size >= 3 && first == 0xD9 && bytes[1] == 0xD9 && bytes[2] == 0xF7) || (first >= 0xA0 && first <= 0xBB) || first == 0xBF ||
+      (first >= 0x98 && first <= 0x9B) || first == 0x9F) {
+    return DataFormat::Cbor;
+  }
+  if (first == 0xDC || first == 0xDD || first == 0xDE || first == 0xDF) {
+    return DataFormat::MessagePack;
+  }
+  if (first >= 0x80 && first <= 0x97) {
+    const auto result = json::from_msgpack(bytes, bytes + size, true, false);
+    return result.is_discarded() ? DataFormat::Cbor : DataFormat::MessagePack;
+  }
+  return DataFormat::Json;
+}
 
-      std::string template_name = parse_filename();
-      add_to_template_storage(path, template_name);
+/// Parses data in the given format, Auto detects it by the first bytes
+inline json parse_data(std::string_view data, DataFormat format = DataFormat::Auto) {
+  if (format == DataFormat::Auto) {
+    format = detect_data_format(data);
+  }
 
-      current_block->nodes.emplace_back(std::make_shared<IncludeStatementNode>(template_name, tok.text.data() - tmpl.content.c_str()));
+  const auto* begin = reinterpret_cast<const uint8_t*>(data.data());
+  const auto* end = begin + data.size();
+  switch (format) {
+  case DataFormat::Cbor:
+    return json::from_cbor(begin, end);
+  case DataFormat::MessagePack:
+    return json::from_msgpack(begin, end);
+  case DataFormat::Bson:
+    return json::from_bson(begin, end);
+  default:
+    return json::parse(data.begin(), data.end());
+  }
+}
 
-      get_next_token();
-    } else if (tok.text == static_cast<decltype(tok.text)>("extends")) {
-      get_next_token();
+/// Loads a data file, Auto detects the format by the file extension or else the first bytes
+inline json load_data_file(const std::filesystem::path& filename, DataFormat format = DataFormat::Auto) {
+  if (format == DataFormat::Auto) {
+    format = data_format_from_extension(filename.extension().string());
+  }
 
-      std::string template_name = parse_filename();
-      add_to_template_storage(path, template_name);
+  const MappedFile file(filename);
+  return parse_data(file.view(), format);
+}
 
-      current_block->nodes.emplace_back(std::make_shared<ExtendsStatementNode>(template_name, tok.text.data() - tmpl.content.c_str()));
+} // namespace inja
 
-      get_next_token();
-    } else if (tok.text == static_cast<decltype(tok.text)>("set")) {
-      get_next_token();
+#endif // INCLUDE_INJA_DATA_FILE_HPP_
 
-      if (tok.kind != Token::Kind::Id) {
-        throw_parser_error("expected variable name, got '" + tok.describe() + "'");
-      }
+// #include "exceptions.hpp"
 
-      const std::string key = static_cast<std::string>(tok.text);
-      get_next_token();
+// #include "function_storage.hpp"
 
-      auto set_statement_node = std::make_shared<SetStatementNode>(key, tok.text.data() - tmpl.content.c_str());
-      current_block->nodes.emplace_back(set_statement_node);
-      current_expression_list = &set_statement_node->expression;
+// #include "json.hpp"
 
-      if (tok.text != static_cast<decltype(tok.text)>("=")) {
-        throw_parser_error("expected '=', got '" + tok.describe() + "'");
-      }
-      get_next_token();
+// #include "node.hpp"
 
-      if (!parse_expression(tmpl, closing)) {
-        return false;
-      }
-    } else if (tok.text == static_cast<decltype(tok.text)>("raw")) {
-      // For raw blocks, we need to capture literal content without parsing
-      // First, consume the closing %} of {% raw %}
-      get_next_token();
-      if (tok.kind != closing) {
-        throw_parser_error("expected statement close after 'raw'");
+// #include "template.hpp"
+
+// #include "throw.hpp"
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+/// FNV-1a hash, used to detect changed template sources
+inline uint64_t fnv1a_hash(std::string_view text, uint64_t hash = 14695981039346656037ull) {
+  for (const char ch : text) {
+    hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/// Hash of all settings that change the result of parsing a template
+inline uint64_t parse_config_hash(const LexerConfig& lexer_config, const ParserConfig& parser_config) {
+  uint64_t hash = fnv1a_hash("inja");
+  for (const auto* delimiter :
+       {&lexer_config.statement_open, &lexer_config.statement_open_no_lstrip, &lexer_config.statement_open_force_lstrip, &lexer_config.statement_close,
+        &lexer_config.statement_close_force_rstrip, &lexer_config.line_statement, &lexer_config.expression_open, &lexer_config.expression_open_force_lstrip,
+        &lexer_config.expression_close, &lexer_config.expression_close_force_rstrip, &lexer_config.comment_open, &lexer_config.comment_open_force_lstrip,
+        &lexer_config.comment_close, &lexer_config.comment_close_force_rstrip}) {
+    hash = fnv1a_hash(*delimiter + '\0', hash);
+  }
+  const char flags[] = {lexer_config.trim_blocks ? '1' : '0', lexer_config.lstrip_blocks ? '1' : '0',
+                        parser_config.search_included_templates_in_files ? '1' : '0', parser_config.graceful_errors ? '1' : '0'};
+  return fnv1a_hash(std::string_view(flags, sizeof(flags)), hash);
+}
+
+/*!
+ * \brief A parsed template in a bundle, with the source file it was parsed from.
+ */
+struct BundleEntry {
+  std::string name;
+  std::string source_path; // Empty for templates not parsed from a file
+  int64_t modification_time {0};
+  uint64_t source_hash {0};
+  Template tmpl;
+};
+
+/*!
+ * \brief Converts parsed templates to and from a binary bundle.
+ *
+ * A bundle is a CBOR document with the format version, a hash of the parse
+ * configuration and all templates. Each template stores its source, the AST
+ * as compact arrays with literals as native CBOR values, and the file it was
+ * parsed from. Loading a bundle rebuilds the AST without lexing or parsing.
+ */
+class TemplateBundle {
+  using Op = FunctionStorage::Operation;
+
+  enum NodeKind {
+    Text,
+    Expression,
+    ForArray,
+    ForObject,
+    If,
+    Include,
+    Extends,
+    Block,
+    Set,
+    Raw,
+  };
+
+  enum ExpressionKind {
+    Literal,
+    Data,
+    Function,
+  };
+
+  static json encode(const std::shared_ptr<ExpressionNode>& node) {
+    if (const auto* literal = dynamic_cast<const LiteralNode*>(node.get())) {
+      return json::array({Literal, literal->pos, literal->value});
+    } else if (const auto* data = dynamic_cast<const DataNode*>(node.get())) {
+      return json::array({Data, data->pos, data->name});
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(node.get())) {
+      json arguments = json::array();
+      for (const auto& argument : function->arguments) {
+        arguments.push_back(encode(argument));
       }
-      
-      // Now manually find {% endraw %} in the template content
-      const char* raw_start = tok.text.data() + tok.text.size();  // Start after %}
-      const char* search_pos = raw_start;
-      const char* content_end = tmpl.content.c_str() + tmpl.content.size();
-      const char* endraw_pos = nullptr;
-      
-      // Search for {% endraw
-      while (search_pos < content_end - 10) {  // Need at least 10 chars for "{% endraw"
-        if (search_pos[0] == '{' && search_pos[1] == '%') {
-          // Check if this is "endraw"
-          const char* check = search_pos + 2;
-          // Skip whitespace
-          while (check < content_end && (*check == ' ' || *check == '\t')) check++;
-          // Check for "endraw"
-          if (check + 6 <= content_end && 
-              check[0] == 'e' && check[1] == 'n' && check[2] == 'd' && 
-              check[3] == 'r' && check[4] == 'a' && check[5] == 'w') {
-            endraw_pos = search_pos;
-            break;
-          }
-        }
-        search_pos++;
+      return json::array({Function, function->pos, static_cast<int>(function->operation), function->name, function->number_args, std::move(arguments)});
+    }
+    return nullptr;
+  }
+
+  static json encode(const ExpressionListNode& node) {
+    return json::array({node.pos, node.length, encode(node.root)});
+  }
+
+  static json encode(const BlockNode& block) {
+    json result = json::array();
+    for (const auto& n : block.nodes) {
+      const AstNode* node = n.get();
+      if (const auto* text = dynamic_cast<const TextNode*>(node)) {
+        result.push_back(json::array({Text, text->pos, text->length}));
+      } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(node)) {
+        result.push_back(json::array({Expression, expression->pos, encode(*expression)}));
+      } else if (const auto* array_loop = dynamic_cast<const ForArrayStatementNode*>(node)) {
+        result.push_back(json::array({ForArray, array_loop->pos, array_loop->value, encode(array_loop->condition), encode(array_loop->body)}));
+      } else if (const auto* object_loop = dynamic_cast<const ForObjectStatementNode*>(node)) {
+        result.push_back(json::array(
+            {ForObject, object_loop->pos, object_loop->key, object_loop->value, encode(object_loop->condition), encode(object_loop->body)}));
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node)) {
+        result.push_back(json::array({If, condition->pos, condition->is_nested, condition->has_false_statement, encode(condition->condition),
+                                      encode(condition->true_statement), encode(condition->false_statement)}));
+      } else if (const auto* include = dynamic_cast<const IncludeStatementNode*>(node)) {
+        result.push_back(json::array({Include, include->pos, include->file}));
+      } else if (const auto* extends = dynamic_cast<const ExtendsStatementNode*>(node)) {
+        result.push_back(json::array({Extends, extends->pos, extends->file}));
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node)) {
+        result.push_back(json::array({Block, block_statement->pos, block_statement->name, encode(block_statement->block)}));
+      } else if (const auto* set = dynamic_cast<const SetStatementNode*>(node)) {
+        result.push_back(json::array({Set, set->pos, set->key, encode(set->expression)}));
+      } else if (const auto* raw = dynamic_cast<const RawStatementNode*>(node)) {
+        result.push_back(json::array({Raw, raw->pos, raw->content_pos, raw->content_length}));
       }
-      
-      if (!endraw_pos) {
-        throw_parser_error("unmatched raw");
+    }
+    return result;
+  }
+
+  const FunctionStorage& function_storage;
+
+  std::shared_ptr<ExpressionNode> decode_expression(const json& value) const {
+    if (value.is_null()) {
+      return nullptr;
+    }
+
+    const size_t pos = value.at(1).get<size_t>();
+    switch (value.at(0).get<int>()) {
+    case Literal:
+      return std::make_shared<LiteralNode>(value.at(2), pos);
+    case Data:
+      return std::make_shared<DataNode>(value.at(2).get<std::string>(), pos);
+    case Function: {
+      const auto operation = static_cast<Op>(value.at(2).get<int>());
+      const auto& name = value.at(3).get_ref<const json::string_t&>();
+      auto function = name.empty() ? std::make_shared<FunctionNode>(operation, pos) : std::make_shared<FunctionNode>(name, pos);
+      function->operation = operation;
+      function->number_args = value.at(4).get<int>();
+      for (const auto& argument : value.at(5)) {
+        function->arguments.push_back(decode_expression(argument));
       }
-      
-      // Create raw statement node with the captured content
-      const size_t content_pos = raw_start - tmpl.content.c_str();
-      const size_t content_length = endraw_pos - raw_start;
-      auto raw_statement_node = std::make_shared<RawStatementNode>(
-          content_pos, content_pos, content_length);
-      current_block->nodes.emplace_back(raw_statement_node);
-      
-      // Now we need to advance the lexer past {% endraw %}
-      // Scan through tokens until we find "endraw"
-      bool found_endraw = false;
-      while (!found_endraw) {
-        get_next_token();
-        if (tok.kind == Token::Kind::Eof) {
-          throw_parser_error("unmatched raw");
-        }
-        if (tok.kind == Token::Kind::Id && tok.text == static_cast<decltype(tok.text)>("endraw")) {
-          found_endraw = true;
-          get_next_token();  // Consume the closing %}
-          if (tok.kind != Token::Kind::StatementClose && tok.kind != Token::Kind::LineStatementClose) {
-            throw_parser_error("expected statement close after 'endraw'");
-          }
-        }
+      if (operation == Op::Callback) {
+        function->callback = function_storage.find_function(name, static_cast<int>(function->arguments.size())).callback;
       }
-    } else if (tok.text == static_cast<decltype(tok.text)>("endraw")) {
-      // endraw without matching raw
-      throw_parser_error("endraw without matching raw");
-    } else {
-      return false;
+      return function;
+    }
+    default:
+      INJA_THROW(FileError("invalid expression in template bundle"));
     }
-    return true;
   }
 
-  void parse_into(Template& tmpl, const std::filesystem::path& path) {
-    lexer.start(tmpl.content);
-    current_block = &tmpl.root;
+  void decode_expression_list(const json& value, ExpressionListNode& target) const {
+    target.pos = value.at(0).get<size_t>();
+    target.length = value.at(1).get<size_t>();
+    target.root = decode_expression(value.at(2));
+  }
 
-    for (;;) {
-      get_next_token();
-      switch (tok.kind) {
-      case Token::Kind::Eof: {
-        if (!if_statement_stack.empty()) {
-          throw_parser_error("unmatched if");
-        }
-        if (!for_statement_stack.empty()) {
-          throw_parser_error("unmatched for");
-        }
-        current_block = nullptr;
-        return;
-      }
-      case Token::Kind::Text: {
-        current_block->nodes.emplace_back(std::make_shared<TextNode>(tok.text.data() - tmpl.content.c_str(), tok.text.size()));
+  // Throws if a node refers to text outside of the template source
+  static void check_source_range(const Template& tmpl, size_t pos, size_t length) {
+    if (pos > tmpl.content.size() || length > tmpl.content.size() - pos) {
+      INJA_THROW(FileError("invalid node in template bundle"));
+    }
+  }
+
+  void decode_block(const json& value, BlockNode& target, Template& tmpl) const {
+    for (const auto& node : value) {
+      const size_t pos = node.at(1).get<size_t>();
+      switch (node.at(0).get<int>()) {
+      case Text: {
+        const size_t length = node.at(2).get<size_t>();
+        check_source_range(tmpl, pos, length);
+        target.nodes.push_back(std::make_shared<TextNode>(pos, length));
       } break;
-      case Token::Kind::StatementOpen: {
-        get_next_token();
-        if (!parse_statement(tmpl, Token::Kind::StatementClose, path)) {
-          throw_parser_error("expected statement, got '" + tok.describe() + "'");
-        }
-        if (tok.kind != Token::Kind::StatementClose) {
-          throw_parser_error("expected statement close, got '" + tok.describe() + "'");
-        }
+      case Expression: {
+        auto expression = std::make_shared<ExpressionListNode>(pos);
+        decode_expression_list(node.at(2), *expression);
+        target.nodes.push_back(expression);
       } break;
-      case Token::Kind::LineStatementOpen: {
-        get_next_token();
-        if (!parse_statement(tmpl, Token::Kind::LineStatementClose, path)) {
-          throw_parser_error("expected statement, got '" + tok.describe() + "'");
-        }
-        if (tok.kind != Token::Kind::LineStatementClose && tok.kind != Token::Kind::Eof) {
-          throw_parser_error("expected line statement close, got '" + tok.describe() + "'");
-        }
+      case ForArray: {
+        auto loop = std::make_shared<ForArrayStatementNode>(node.at(2).get<std::string>(), &target, pos);
+        decode_expression_list(node.at(3), loop->condition);
+        decode_block(node.at(4), loop->body, tmpl);
+        target.nodes.push_back(loop);
       } break;
-      case Token::Kind::ExpressionOpen: {
-        const size_t expr_start = tok.text.data() - tmpl.content.c_str();
-        get_next_token();
-
-        auto expression_list_node = std::make_shared<ExpressionListNode>(expr_start);
-        current_block->nodes.emplace_back(expression_list_node);
-        current_expression_list = expression_list_node.get();
-
-        if (!parse_expression(tmpl, Token::Kind::ExpressionClose)) {
-          throw_parser_error("expected expression close, got '" + tok.describe() + "'");
-        }
-        
-        // Calculate the length of the expression including delimiters
-        const size_t expr_end = tok.text.data() - tmpl.content.c_str() + tok.text.length();
-        current_expression_list->length = expr_end - expr_start;
+      case ForObject: {
+        auto loop = std::make_shared<ForObjectStatementNode>(node.at(2).get<std::string>(), node.at(3).get<std::string>(), &target, pos);
+        decode_expression_list(node.at(4), loop->condition);
+        decode_block(node.at(5), loop->body, tmpl);
+        target.nodes.push_back(loop);
       } break;
-      case Token::Kind::CommentOpen: {
-        get_next_token();
-        if (tok.kind != Token::Kind::CommentClose) {
-          throw_parser_error("expected comment close, got '" + tok.describe() + "'");
-        }
+      case If: {
+        auto condition = std::make_shared<IfStatementNode>(node.at(2).get<bool>(), &target, pos);
+        condition->has_false_statement = node.at(3).get<bool>();
+        decode_expression_list(node.at(4), condition->condition);
+        decode_block(node.at(5), condition->true_statement, tmpl);
+        decode_block(node.at(6), condition->false_statement, tmpl);
+        target.nodes.push_back(condition);
       } break;
-      default: {
-        throw_parser_error("unexpected token '" + tok.describe() + "'");
+      case Include: {
+        target.nodes.push_back(std::make_shared<IncludeStatementNode>(node.at(2).get<std::string>(), pos));
       } break;
+      case Extends: {
+        target.nodes.push_back(std::make_shared<ExtendsStatementNode>(node.at(2).get<std::string>(), pos));
+      } break;
+      case Block: {
+        const auto name = node.at(2).get<std::string>();
+        auto block_statement = std::make_shared<BlockStatementNode>(&target, name, pos);
+        decode_block(node.at(3), block_statement->block, tmpl);
+        tmpl.block_storage.emplace(name, block_statement);
+        target.nodes.push_back(block_statement);
+      } break;
+      case Set: {
+        auto set = std::make_shared<SetStatementNode>(node.at(2).get<std::string>(), pos);
+        decode_expression_list(node.at(3), set->expression);
+        target.nodes.push_back(set);
+      } break;
+      case Raw: {
+        const size_t content_pos = node.at(2).get<size_t>();
+        const size_t content_length = node.at(3).get<size_t>();
+        check_source_range(tmpl, content_pos, content_length);
+        target.nodes.push_back(std::make_shared<RawStatementNode>(pos, content_pos, content_length));
+      } break;
+      default:
+        INJA_THROW(FileError("invalid node in template bundle"));
       }
     }
-    current_block = nullptr;
   }
 
 public:
-  explicit Parser(const ParserConfig& parser_config, const LexerConfig& lexer_config, TemplateStorage& template_storage,
-                  const FunctionStorage& function_storage)
-      : config(parser_config), lexer(lexer_config), template_storage(template_storage), function_storage(function_storage) {}
+  /// Version of the bundle format, bundles of other versions are rejected
+  static constexpr int version {1};
+
+  explicit TemplateBundle(const FunctionStorage& function_storage): function_storage(function_storage) {}
+
+  static void write(const std::filesystem::path& filename, const std::vector<BundleEntry>& entries, uint64_t config_hash) {
+    json templates = json::array();
+    for (const auto& entry : entries) {
+      templates.push_back({
+          {"name", entry.name},
+          {"path", entry.source_path},
+          {"mtime", entry.modification_time},
+          {"hash", entry.source_hash},
+          {"source", entry.tmpl.content},
+          {"root", encode(entry.tmpl.root)},
+      });
+    }
 
-  Template parse(std::string_view input, const std::filesystem::path& path) {
-    auto result = Template(std::string(input));
-    parse_into(result, path);
-    return result;
-  }
+    const json bundle {{"format", "inja-bundle"}, {"version", version}, {"config", config_hash}, {"templates", std::move(templates)}};
+    const auto bytes = json::to_cbor(bundle);
 
-  void parse_into_template(Template& tmpl, const std::filesystem::path& filename) {
-    auto sub_parser = Parser(config, lexer.get_config(), template_storage, function_storage);
-    sub_parser.parse_into(tmpl, filename.parent_path());
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (file.fail()) {
+      INJA_THROW(FileError("failed writing template bundle at '" + filename.string() + "'"));
+    }
   }
 
-  static std::string load_file(const std::filesystem::path& filename) {
-    std::ifstream file;
-    file.open(filename);
-    if (file.fail()) {
-      INJA_THROW(FileError("failed accessing file at '" + filename.string() + "'"));
+  /// Reads all templates of a bundle, returns false if it has another format version or parse configuration or is incomplete
+  bool read(const std::filesystem::path& filename, uint64_t config_hash, std::vector<BundleEntry>& entries) const {
+    const MappedFile file(filename);
+    const json bundle = json::from_cbor(reinterpret_cast<const uint8_t*>(file.data()), reinterpret_cast<const uint8_t*>(file.data()) + file.size(),
+                                        true, false);
+    if (bundle.is_discarded() || !bundle.is_object() || bundle.value("format", "") != "inja-bundle") {
+      INJA_THROW(FileError("invalid template bundle at '" + filename.string() + "'"));
     }
-    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    return text;
+    if (bundle.value("version", json()) != version || bundle.value("config", json()) != config_hash) {
+      return false;
+    }
+
+    const auto templates = bundle.find("templates");
+    if (templates == bundle.end() || !templates->is_array()) {
+      return false;
+    }
+
+    std::vector<BundleEntry> result;
+    try {
+      for (const auto& stored : *templates) {
+        BundleEntry entry;
+        entry.name = stored.at("name").get<std::string>();
+        entry.source_path = stored.at("path").get<std::string>();
+        entry.modification_time = stored.at("mtime").get<int64_t>();
+        entry.source_hash = stored.at("hash").get<uint64_t>();
+        entry.tmpl = Template(stored.at("source").get<std::string>());
+        decode_block(stored.at("root"), entry.tmpl.root, entry.tmpl);
+        result.push_back(std::move(entry));
+      }
+    } catch (const json::exception&) {
+      return false;
+    }
+    entries.insert(entries.end(), std::make_move_iterator(result.begin()), std::make_move_iterator(result.end()));
+    return true;
   }
 };
 
 } // namespace inja
 
-#endif // INCLUDE_INJA_PARSER_HPP_
+#endif // INCLUDE_INJA_BUNDLE_HPP_
 
-// #include "renderer.hpp"
-#ifndef INCLUDE_INJA_RENDERER_HPP_
-#define INCLUDE_INJA_RENDERER_HPP_
+// #include "compiler.hpp"
+#ifndef INCLUDE_INJA_COMPILER_HPP_
+#define INCLUDE_INJA_COMPILER_HPP_
 
-#include <algorithm>
-#include <array>
-#include <cctype>
-#include <cmath>
-#include <cstddef>
+#include <map>
 #include <memory>
-#include <numeric>
-#include <ostream>
-#include <sstream>
-#include <stack>
 #include <string>
 #include <utility>
-#include <vector>
 
 // #include "config.hpp"
 
-// #include "exceptions.hpp"
-
 // #include "function_storage.hpp"
 
+// #include "json.hpp"
+
 // #include "node.hpp"
 
-// #include "template.hpp"
+// #include "optimizer.hpp"
+#ifndef INCLUDE_INJA_OPTIMIZER_HPP_
+#define INCLUDE_INJA_OPTIMIZER_HPP_
 
-// #include "throw.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
 
-// #include "utils.hpp"
+// #include "function_storage.hpp"
+
+// #include "node.hpp"
+
+// #include "template.hpp"
 
 
 namespace inja {
 
 /*!
-@brief Helper struct for tracking not found variables/functions
-*/
-struct NotFoundInfo {
-  std::string name;
-  const AstNode* node;
-  
-  NotFoundInfo(const std::string& name, const AstNode* node) : name(name), node(node) {}
+ * \brief Statistics of an optimizer run.
+ */
+struct OptimizerStats {
+  /// Expressions within loops that are evaluated once instead of in every iteration
+  size_t hoisted_expressions {0};
+  /// Repeated occurrences of identical expressions that reuse the result of the first one
+  size_t eliminated_evaluations {0};
 };
 
 /*!
-@brief Escapes HTML
-*/
-inline std::string htmlescape(const std::string& data) {
-  std::string buffer;
-  buffer.reserve(static_cast<size_t>(1.1 * data.size()));
-  for (size_t pos = 0; pos != data.size(); ++pos) {
-    switch (data[pos]) {
-      case '&':  buffer.append("&amp;");       break;
-      case '\"': buffer.append("&quot;");      break;
-      case '\'': buffer.append("&apos;");      break;
-      case '<':  buffer.append("&lt;");        break;
-      case '>':  buffer.append("&gt;");        break;
-      default:   buffer.append(&data[pos], 1); break;
+ * \brief Collects all variables assigned within a block.
+ *
+ * These are the targets of set statements, the loop variables and `loop`
+ * for every loop. Only the first part of a dotted name is recorded.
+ */
+class AssignmentCollector : public NodeVisitor {
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
     }
   }
-  return buffer;
-}
+
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+  void visit(const LiteralNode&) override {}
+  void visit(const DataNode&) override {}
+  void visit(const FunctionNode&) override {}
+  void visit(const ExpressionListNode&) override {}
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    variables.insert(root_name(node.value));
+    node.body.accept(*this);
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    variables.insert(root_name(node.key));
+    variables.insert(root_name(node.value));
+    node.body.accept(*this);
+  }
+
+  void visit(const IfStatementNode& node) override {
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
+
+  void visit(const IncludeStatementNode&) override {}
+  void visit(const ExtendsStatementNode&) override {}
+
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+  }
+
+  void visit(const SetStatementNode& node) override {
+    variables.insert(root_name(node.key));
+  }
+
+  void visit(const RawStatementNode&) override {}
+
+public:
+  std::set<std::string> variables {"loop"};
+
+  static std::string root_name(std::string_view name) {
+    return static_cast<std::string>(name.substr(0, name.find_first_of("./")));
+  }
+};
 
 /*!
- * \brief Class for rendering a Template with data.
+ * \brief An AST pass annotating expressions for render-time memoization.
+ *
+ * Pure expressions within a loop body that do not depend on any variable
+ * assigned in the body (the loop variables, `loop` and set statements) are
+ * loop invariant. They are marked to be cached by the renderer at their first
+ * evaluation, so that following iterations reuse the value.
+ *
+ * Structurally identical pure expressions anywhere in the template share a
+ * single cache entry, so repeated occurrences reuse the first result.
+ *
+ * The renderer drops a cached value whenever one of its variables is
+ * assigned, so the output stays identical to the unoptimized template.
+ * Builtin functions are pure except for super(); callbacks are pure only if
+ * they were marked deterministic in the function storage.
  */
-class Renderer : public NodeVisitor {
+class Optimizer : public NodeVisitor {
   using Op = FunctionStorage::Operation;
 
-  const RenderConfig config;
-  const TemplateStorage& template_storage;
-  const FunctionStorage& function_storage;
+  /// An expression of the template, with the variables assigned by its innermost loop body
+  struct Expression {
+    const ExpressionNode* root;
+    std::shared_ptr<const std::set<std::string>> loop_assignments;
+  };
 
-  const Template* current_template;
-  size_t current_level {0};
-  std::vector<const Template*> template_stack;
-  std::vector<const BlockStatementNode*> block_statement_stack;
+  /// Signature and dependencies of a pure function call
+  struct PureFunction {
+    std::string signature;
+    std::set<std::string> dependencies;
+  };
 
-  const json* data_input;
-  std::ostream* output_stream;
+  const FunctionStorage& function_storage;
 
-  json additional_data;
-  json* current_loop_data = &additional_data["loop"];
+  OptimizerStats stats;
+  std::vector<Expression> expressions;
+  std::vector<std::shared_ptr<const std::set<std::string>>> loop_assignments;
+  std::map<const FunctionNode*, PureFunction> pure_functions;
 
-  std::vector<std::shared_ptr<json>> data_tmp_stack;
-  std::stack<const json*> data_eval_stack;
-  std::stack<NotFoundInfo> not_found_stack; // Can hold DataNode or FunctionNode for error reporting
+  static std::string root_name(std::string_view name) {
+    return AssignmentCollector::root_name(name);
+  }
 
-  bool break_rendering {false};
-  
-  std::vector<RenderErrorInfo> render_errors; // Track errors in graceful mode
+  /// Computes the structural signature and the variables of an expression; returns false if it is not pure
+  bool describe(const ExpressionNode& expression, std::string& signature, std::set<std::string>& dependencies) {
+    if (const auto* literal = dynamic_cast<const LiteralNode*>(&expression)) {
+      signature += literal->value.dump();
+      return true;
+
+    } else if (const auto* data = dynamic_cast<const DataNode*>(&expression)) {
+      // Unknown variables fall back to a callback without arguments
+      const auto function_data = function_storage.find_function(data->name, 0);
+      signature += "$" + data->name;
+      dependencies.insert(root_name(data->name));
+      return function_data.operation != Op::Callback || function_data.deterministic;
+
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(&expression)) {
+      function->memo_key = nullptr;
+      function->memo_dependencies.clear();
+
+      bool pure = (function->operation != Op::Super && function->operation != Op::None);
+      if (function->operation == Op::Callback) {
+        const auto function_data = function_storage.find_function(function->name, static_cast<int>(function->arguments.size()));
+        pure = (function_data.operation == Op::Callback && function_data.deterministic);
+      }
 
-  static bool truthy(const json* data) {
-    if (data->is_boolean()) {
-      return data->get<bool>();
-    } else if (data->is_number()) {
-      return (*data != 0);
-    } else if (data->is_null()) {
-      return false;
+      PureFunction result;
+      result.signature = function->name + "#" + std::to_string(static_cast<int>(function->operation)) + "(";
+      for (const auto& argument : function->arguments) {
+        pure = describe(*argument, result.signature, result.dependencies) && pure;
+        result.signature += ",";
+      }
+      result.signature += ")";
+
+      signature += result.signature;
+      dependencies.insert(result.dependencies.begin(), result.dependencies.end());
+      if (pure) {
+        pure_functions.emplace(function, std::move(result));
+      }
+      return pure;
     }
-    return !data->empty();
+    return false;
   }
 
-  void print_data(const std::shared_ptr<json>& value) {
-    if (value->is_string()) {
-      if (config.html_autoescape) {
-        *output_stream << htmlescape(value->get_ref<const json::string_t&>());
-      } else {
-        *output_stream << value->get_ref<const json::string_t&>();
+  void annotate(const FunctionNode& function, const FunctionNode* key) {
+    const auto& dependencies = pure_functions.at(&function).dependencies;
+    function.memo_key = key;
+    function.memo_dependencies.assign(dependencies.begin(), dependencies.end());
+  }
+
+  /// Marks the largest loop-invariant subexpressions for memoization
+  void hoist(const ExpressionNode& expression, const std::set<std::string>& assigned) {
+    const auto* function = dynamic_cast<const FunctionNode*>(&expression);
+    if (function == nullptr) {
+      return;
+    }
+
+    const auto pure = pure_functions.find(function);
+    if (pure != pure_functions.end()) {
+      const auto& dependencies = pure->second.dependencies;
+      const bool invariant = std::none_of(dependencies.begin(), dependencies.end(), [&assigned](const std::string& variable) {
+        return assigned.count(variable) > 0;
+      });
+      if (invariant) {
+        annotate(*function, function);
+        stats.hoisted_expressions += 1;
+        return;
       }
-    } else if (value->is_number_unsigned()) {
-      *output_stream << value->get<const json::number_unsigned_t>();
-    } else if (value->is_number_integer()) {
-      *output_stream << value->get<const json::number_integer_t>();
-    } else if (value->is_null()) {
-    } else {
-      *output_stream << value->dump();
+    }
+
+    for (const auto& argument : function->arguments) {
+      hoist(*argument, assigned);
     }
   }
 
-  const std::shared_ptr<json> eval_expression_list(const ExpressionListNode& expression_list) {
-    if (!expression_list.root) {
-      std::string original_text;
-      if (config.graceful_errors && expression_list.length > 0) {
-        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
-      }
-      throw_renderer_error("empty expression", expression_list, original_text);
-      return nullptr;
+  /// Collects the largest pure subexpressions that occur more than once
+  void find_common(const ExpressionNode& expression, const std::map<std::string, size_t>& counts,
+                   std::map<std::string, std::vector<const FunctionNode*>>& groups) const {
+    const auto* function = dynamic_cast<const FunctionNode*>(&expression);
+    if (function == nullptr) {
+      return;
     }
 
-    expression_list.root->accept(*this);
+    const auto pure = pure_functions.find(function);
+    if (pure != pure_functions.end() && counts.at(pure->second.signature) > 1) {
+      groups[pure->second.signature].push_back(function);
+      return;
+    }
 
-    if (data_eval_stack.empty()) {
-      std::string original_text;
-      if (config.graceful_errors && expression_list.length > 0) {
-        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
+    for (const auto& argument : function->arguments) {
+      find_common(*argument, counts, groups);
+    }
+  }
+
+  void eliminate_common_subexpressions() {
+    std::map<std::string, size_t> counts;
+    for (const auto& [function, pure] : pure_functions) {
+      counts[pure.signature] += 1;
+    }
+
+    std::map<std::string, std::vector<const FunctionNode*>> groups;
+    for (const auto& expression : expressions) {
+      find_common(*expression.root, counts, groups);
+    }
+
+    for (const auto& [signature, functions] : groups) {
+      if (functions.size() < 2) {
+        continue;
       }
-      throw_renderer_error("empty expression", expression_list, original_text);
-      return nullptr;
-    } else if (data_eval_stack.size() != 1) {
-      std::string original_text;
-      if (config.graceful_errors && expression_list.length > 0) {
-        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
+      for (const auto* function : functions) {
+        annotate(*function, functions.front());
       }
-      throw_renderer_error("malformed expression", expression_list, original_text);
-      return nullptr;
+      stats.eliminated_evaluations += functions.size() - 1;
     }
+  }
 
-    const auto result = data_eval_stack.top();
-    data_eval_stack.pop();
+  void visit_loop(const ForStatementNode& node) {
+    node.condition.accept(*this);
 
-    if (result == nullptr) {
-      if (not_found_stack.empty()) {
-        std::string original_text;
-        if (config.graceful_errors && expression_list.length > 0) {
-          original_text = current_template->content.substr(expression_list.pos, expression_list.length);
-        }
-        throw_renderer_error("expression could not be evaluated", expression_list, original_text);
-        return nullptr;
-      }
-
-      const auto not_found = not_found_stack.top();
-      not_found_stack.pop();
+    AssignmentCollector collector;
+    node.body.accept(collector);
+    loop_assignments.push_back(std::make_shared<const std::set<std::string>>(std::move(collector.variables)));
+    node.body.accept(*this);
+    loop_assignments.pop_back();
+  }
 
-      std::string original_text;
-      if (config.graceful_errors && expression_list.length > 0) {
-        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
-      }
-      throw_renderer_error("variable '" + not_found.name + "' not found", *not_found.node, original_text);
-      return nullptr;
+  void visit(const BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
     }
-    return std::make_shared<json>(*result);
   }
 
-  void throw_renderer_error(const std::string& message, const AstNode& node, const std::string& original_text = "") {
-    const SourceLocation loc = get_source_location(current_template->content, node.pos);
-    if (config.graceful_errors) {
-      render_errors.emplace_back(message, loc, original_text);
-    } else {
-      INJA_THROW(RenderError(message, loc));
+  void visit(const TextNode&) override {}
+  void visit(const ExpressionNode&) override {}
+  void visit(const LiteralNode&) override {}
+  void visit(const DataNode&) override {}
+  void visit(const FunctionNode&) override {}
+
+  void visit(const ExpressionListNode& node) override {
+    if (node.root) {
+      expressions.push_back({node.root.get(), loop_assignments.empty() ? nullptr : loop_assignments.back()});
     }
   }
 
-  void make_result(const json&& result) {
-    auto result_ptr = std::make_shared<json>(result);
-    data_tmp_stack.push_back(result_ptr);
-    data_eval_stack.push(result_ptr.get());
+  void visit(const StatementNode&) override {}
+  void visit(const ForStatementNode&) override {}
+
+  void visit(const ForArrayStatementNode& node) override {
+    visit_loop(node);
   }
 
-  template <size_t N, size_t N_start = 0, bool throw_not_found = true> std::array<const json*, N> get_arguments(const FunctionNode& node) {
-    if (node.arguments.size() < N_start + N) {
-      throw_renderer_error("function needs " + std::to_string(N_start + N) + " variables, but has only found " + std::to_string(node.arguments.size()), node);
-    }
+  void visit(const ForObjectStatementNode& node) override {
+    visit_loop(node);
+  }
 
-    for (size_t i = N_start; i < N_start + N; i += 1) {
-      node.arguments[i]->accept(*this);
-    }
+  void visit(const IfStatementNode& node) override {
+    node.condition.accept(*this);
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
 
-    if (data_eval_stack.size() < N) {
-      throw_renderer_error("function needs " + std::to_string(N) + " variables, but has only found " + std::to_string(data_eval_stack.size()), node);
-    }
+  void visit(const IncludeStatementNode&) override {}
+  void visit(const ExtendsStatementNode&) override {}
 
-    std::array<const json*, N> result;
-    for (size_t i = 0; i < N; i += 1) {
-      result[N - i - 1] = data_eval_stack.top();
-      data_eval_stack.pop();
+  void visit(const BlockStatementNode& node) override {
+    node.block.accept(*this);
+  }
 
-      if (!result[N - i - 1]) {
-        const auto not_found = not_found_stack.top();
-        not_found_stack.pop();
+  void visit(const SetStatementNode& node) override {
+    node.expression.accept(*this);
+  }
 
-        if (throw_not_found) {
-          throw_renderer_error("variable '" + not_found.name + "' not found", *not_found.node);
-        }
-        
-        // In graceful error mode, always provide a safe default instead of nullptr
-        // This prevents null pointer dereferences even when throw_not_found is false
-        if (config.graceful_errors) {
-          static const json empty_json;
-          result[N - i - 1] = &empty_json;
-        }
+  void visit(const RawStatementNode&) override {}
+
+public:
+  explicit Optimizer(const FunctionStorage& function_storage): function_storage(function_storage) {}
+
+  /*!
+   * \brief Annotates the AST of the template in place.
+   *
+   * Copies of a template share their AST, so they are optimized as well.
+   * Must not run concurrently with a render of the template.
+   */
+  OptimizerStats optimize(Template& tmpl) {
+    stats = OptimizerStats();
+    expressions.clear();
+    loop_assignments.clear();
+    pure_functions.clear();
+
+    tmpl.root.accept(*this);
+
+    // Also resets the annotations of previous runs
+    for (const auto& expression : expressions) {
+      std::string signature;
+      std::set<std::string> dependencies;
+      describe(*expression.root, signature, dependencies);
+    }
+
+    for (const auto& expression : expressions) {
+      if (expression.loop_assignments) {
+        hoist(*expression.root, *expression.loop_assignments);
       }
     }
-    return result;
+
+    eliminate_common_subexpressions();
+    return stats;
   }
+};
 
-  template <bool throw_not_found = true> Arguments get_argument_vector(const FunctionNode& node) {
-    const size_t N = node.arguments.size();
-    for (const auto& a : node.arguments) {
-      a->accept(*this);
-    }
+} // namespace inja
 
-    if (data_eval_stack.size() < N) {
-      throw_renderer_error("function needs " + std::to_string(N) + " variables, but has only found " + std::to_string(data_eval_stack.size()), node);
+#endif // INCLUDE_INJA_OPTIMIZER_HPP_
+
+// #include "specializer.hpp"
+#ifndef INCLUDE_INJA_SPECIALIZER_HPP_
+#define INCLUDE_INJA_SPECIALIZER_HPP_
+
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// #include "config.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "json.hpp"
+
+// #include "node.hpp"
+
+// #include "optimizer.hpp"
+
+// #include "renderer.hpp"
+#ifndef INCLUDE_INJA_RENDERER_HPP_
+#define INCLUDE_INJA_RENDERER_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stack>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// #include "analysis.hpp"
+
+// #include "config.hpp"
+
+// #include "data_provider.hpp"
+#ifndef INCLUDE_INJA_DATA_PROVIDER_HPP_
+#define INCLUDE_INJA_DATA_PROVIDER_HPP_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// #include "json.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Data of a render that is looked up on demand instead of being converted to json up front.
+ *
+ * Paths are the keys of a variable name split at dots, with array indices as
+ * decimal numbers, e.g. `{"actors", "3", "name"}` for `actors.3.name`. The
+ * renderer asks only for the paths a template actually reads and keeps every
+ * result until the end of the render. Loops over a provided array or object
+ * only ask for its size or keys, their elements are looked up one by one.
+ */
+class DataProvider {
+public:
+  using Path = std::vector<std::string>;
+
+  virtual ~DataProvider() = default;
+
+  /// Returns the value at the path, or std::nullopt if there is none
+  virtual std::optional<json> lookup(const Path& path) const = 0;
+
+  /// Returns the number of elements of the array at the path, or std::nullopt if it is no array
+  virtual std::optional<size_t> array_size(const Path& path) const {
+    const auto value = lookup(path);
+    if (!value || !value->is_array()) {
+      return std::nullopt;
     }
+    return value->size();
+  }
 
-    Arguments result {N};
-    for (size_t i = 0; i < N; i += 1) {
-      result[N - i - 1] = data_eval_stack.top();
-      data_eval_stack.pop();
+  /// Returns the keys of the object at the path in iteration order, or std::nullopt if it is no object
+  virtual std::optional<std::vector<std::string>> object_keys(const Path& path) const {
+    const auto value = lookup(path);
+    if (!value || !value->is_object()) {
+      return std::nullopt;
+    }
 
-      if (!result[N - i - 1]) {
-        const auto not_found = not_found_stack.top();
-        not_found_stack.pop();
+    std::vector<std::string> keys;
+    keys.reserve(value->size());
+    for (auto it = value->begin(); it != value->end(); ++it) {
+      keys.push_back(it.key());
+    }
+    return keys;
+  }
+};
 
-        if (throw_not_found) {
-          throw_renderer_error("variable '" + not_found.name + "' not found", *not_found.node);
+/*!
+ * \brief Provides the values of a json document, e.g. to combine it with other providers.
+ */
+class JsonDataProvider : public DataProvider {
+  const json& data;
+
+  const json* find(const Path& path) const {
+    const json* value = &data;
+    for (const auto& key : path) {
+      if (value->is_object()) {
+        const auto it = value->find(key);
+        if (it == value->end()) {
+          return nullptr;
         }
-        
-        // In graceful error mode, always provide a safe default instead of nullptr
-        // This prevents null pointer dereferences even when throw_not_found is false
-        if (config.graceful_errors) {
-          static const json empty_json;
-          result[N - i - 1] = &empty_json;
+        value = &*it;
+      } else if (value->is_array() && !key.empty() && key.find_first_not_of("0123456789") == std::string::npos) {
+        const size_t index = std::stoul(key);
+        if (index >= value->size()) {
+          return nullptr;
         }
+        value = &(*value)[index];
+      } else {
+        return nullptr;
       }
     }
-    return result;
+    return value;
   }
 
-  void visit(const BlockNode& node) override {
-    for (const auto& n : node.nodes) {
-      n->accept(*this);
+public:
+  explicit JsonDataProvider(const json& data): data(data) {}
 
-      if (break_rendering) {
-        break;
-      }
-    }
+  std::optional<json> lookup(const Path& path) const override {
+    const json* value = find(path);
+    return value ? std::optional<json>(*value) : std::nullopt;
   }
 
-  void visit(const TextNode& node) override {
-    output_stream->write(current_template->content.c_str() + node.pos, node.length);
+  std::optional<size_t> array_size(const Path& path) const override {
+    const json* value = find(path);
+    return (value && value->is_array()) ? std::optional<size_t>(value->size()) : std::nullopt;
   }
 
-  void visit(const ExpressionNode&) override {}
+  std::optional<std::vector<std::string>> object_keys(const Path& path) const override {
+    const json* value = find(path);
+    if (!value || !value->is_object()) {
+      return std::nullopt;
+    }
 
-  void visit(const LiteralNode& node) override {
-    data_eval_stack.push(&node.value);
+    std::vector<std::string> keys;
+    keys.reserve(value->size());
+    for (auto it = value->begin(); it != value->end(); ++it) {
+      keys.push_back(it.key());
+    }
+    return keys;
   }
+};
 
-  void visit(const DataNode& node) override {
-    if (additional_data.contains(node.ptr)) {
-      data_eval_stack.push(&(additional_data[node.ptr]));
-    } else if (data_input->contains(node.ptr)) {
-      data_eval_stack.push(&(*data_input)[node.ptr]);
-    } else {
-      // Try to evaluate as a no-argument callback
-      const auto function_data = function_storage.find_function(node.name, 0);
-      if (function_data.operation == FunctionStorage::Operation::Callback) {
-        Arguments empty_args {};
-        const auto value = std::make_shared<json>(function_data.callback(empty_args));
-        data_tmp_stack.push_back(value);
-        data_eval_stack.push(value.get());
-      } else {
-        data_eval_stack.push(nullptr);
-        not_found_stack.emplace(static_cast<std::string>(node.name), &node);
-      }
+} // namespace inja
+
+#endif // INCLUDE_INJA_DATA_PROVIDER_HPP_
+
+// #include "exceptions.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "node.hpp"
+
+// #include "template.hpp"
+
+// #include "throw.hpp"
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+/*!
+@brief Helper struct for tracking not found variables/functions
+*/
+struct NotFoundInfo {
+  std::string name;
+  const AstNode* node;
+  
+  NotFoundInfo(const std::string& name, const AstNode* node) : name(name), node(node) {}
+};
+
+/*!
+@brief Output of a render together with the errors of graceful error mode
+*/
+struct RenderResult {
+  std::string output;
+  std::vector<RenderErrorInfo> errors;
+};
+
+/*!
+@brief Escapes HTML
+*/
+inline std::string htmlescape(const std::string& data) {
+  std::string buffer;
+  buffer.reserve(static_cast<size_t>(1.1 * data.size()));
+  for (size_t pos = 0; pos != data.size(); ++pos) {
+    switch (data[pos]) {
+      case '&':  buffer.append("&amp;");       break;
+      case '\"': buffer.append("&quot;");      break;
+      case '\'': buffer.append("&apos;");      break;
+      case '<':  buffer.append("&lt;");        break;
+      case '>':  buffer.append("&gt;");        break;
+      default:   buffer.append(&data[pos], 1); break;
     }
   }
+  return buffer;
+}
 
-  void visit(const FunctionNode& node) override {
-    switch (node.operation) {
-    case Op::Not: {
-      const auto args = get_arguments<1>(node);
-      make_result(!truthy(args[0]));
-    } break;
-    case Op::And: {
-      make_result(truthy(get_arguments<1, 0>(node)[0]) && truthy(get_arguments<1, 1>(node)[0]));
-    } break;
-    case Op::Or: {
-      make_result(truthy(get_arguments<1, 0>(node)[0]) || truthy(get_arguments<1, 1>(node)[0]));
-    } break;
-    case Op::In: {
-      const auto args = get_arguments<2>(node);
-      make_result(std::find(args[1]->begin(), args[1]->end(), *args[0]) != args[1]->end());
-    } break;
-    case Op::Equal: {
-      const auto args = get_arguments<2>(node);
-      make_result(*args[0] == *args[1]);
-    } break;
-    case Op::NotEqual: {
-      const auto args = get_arguments<2>(node);
-      make_result(*args[0] != *args[1]);
-    } break;
-    case Op::Greater: {
-      const auto args = get_arguments<2>(node);
-      make_result(*args[0] > *args[1]);
-    } break;
-    case Op::GreaterEqual: {
-      const auto args = get_arguments<2>(node);
-      make_result(*args[0] >= *args[1]);
-    } break;
-    case Op::Less: {
-      const auto args = get_arguments<2>(node);
-      make_result(*args[0] < *args[1]);
-    } break;
-    case Op::LessEqual: {
-      const auto args = get_arguments<2>(node);
-      make_result(*args[0] <= *args[1]);
-    } break;
-    case Op::Add: {
-      const auto args = get_arguments<2>(node);
-      if (args[0]->is_string() && args[1]->is_string()) {
-        make_result(args[0]->get_ref<const json::string_t&>() + args[1]->get_ref<const json::string_t&>());
-      } else if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-        make_result(args[0]->get<const json::number_integer_t>() + args[1]->get<const json::number_integer_t>());
-      } else {
-        make_result(args[0]->get<const json::number_float_t>() + args[1]->get<const json::number_float_t>());
+/*!
+ * \brief Class for rendering a Template with data.
+ */
+class Renderer : public NodeVisitor {
+  using Op = FunctionStorage::Operation;
+
+  const RenderConfig config;
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
+
+  const Template* current_template;
+  size_t current_level {0};
+  std::vector<const Template*> template_stack;
+  std::vector<const BlockStatementNode*> block_statement_stack;
+
+  const json* data_input;
+  std::vector<const json*> data_layers; // Data below the input, from top to bottom, shared with included templates
+  const json* static_data {nullptr}; // Data of a specialized template, shared with included templates
+  std::ostream* output_stream;
+
+  // Data looked up on demand, and its values looked up so far in this render (shared with included templates)
+  const DataProvider* data_provider {nullptr};
+  std::shared_ptr<std::map<DataProvider::Path, std::optional<json>>> provider_values;
+  std::unordered_map<std::string, DataProvider::Path> provider_aliases; // Loop variables bound to an element of the data provider
+
+  json additional_data = json::object({{"loop", nullptr}});
+
+  std::vector<std::shared_ptr<json>> data_tmp_stack;
+  std::stack<const json*> data_eval_stack;
+  std::stack<NotFoundInfo> not_found_stack; // Can hold DataNode or FunctionNode for error reporting
+
+  bool break_rendering {false};
+
+  // Cancellation and deadline of the render, checked between nodes
+  std::stop_token stop_token;
+  std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+  size_t nodes_since_deadline_check {0};
+
+  std::vector<RenderErrorInfo> render_errors; // Track errors in graceful mode (per-instance)
+
+  // Nodes that are rendered concurrently, by root template of the render
+  struct ConcurrentNodes {
+    std::mutex mutex;
+    std::map<std::pair<const BlockNode*, const Template*>, std::vector<size_t>> indices; // Indices of the nodes of a block
+    std::map<std::pair<const ForArrayStatementNode*, const Template*>, std::optional<std::vector<std::string>>> loops; // Loop variables of the body
+  };
+  std::shared_ptr<ConcurrentNodes> concurrent_nodes; // Shared with included templates and concurrent parts, if there is a thread pool
+
+  /// Output and errors of a node rendered concurrently, with the output of its block before it
+  struct ConcurrentPart {
+    std::string preceding_output;
+    size_t preceding_errors {0};
+    std::future<void> task;
+    std::string output;
+    std::vector<RenderErrorInfo> errors;
+    json local_data; // Variables after rendering a part of a loop
+  };
+
+  // Cached results of expressions annotated by the Optimizer, by memo key
+  std::unordered_map<const FunctionNode*, std::shared_ptr<json>> memo;
+  std::unordered_map<std::string, std::unordered_set<const FunctionNode*>> memo_by_dependency;
+
+  /// Drops all cached results depending on the given variable (or its children)
+  void invalidate_memo(std::string_view variable) {
+    if (memo.empty()) {
+      return;
+    }
+
+    const auto root = variable.substr(0, variable.find_first_of("./"));
+    const auto it = memo_by_dependency.find(static_cast<std::string>(root));
+    if (it != memo_by_dependency.end()) {
+      for (const auto* key : it->second) {
+        memo.erase(key);
       }
-    } break;
-    case Op::Subtract: {
-      const auto args = get_arguments<2>(node);
-      if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-        make_result(args[0]->get<const json::number_integer_t>() - args[1]->get<const json::number_integer_t>());
-      } else {
-        make_result(args[0]->get<const json::number_float_t>() - args[1]->get<const json::number_float_t>());
+      memo_by_dependency.erase(it);
+    }
+  }
+
+  void clear_memo() {
+    memo.clear();
+    memo_by_dependency.clear();
+  }
+
+  /// Returns the value in the topmost layer of the input data that contains the pointer, or nullptr
+  const json* find_input(const json::json_pointer& ptr) const {
+    if (data_input->contains(ptr)) {
+      return &(*data_input)[ptr];
+    }
+    for (const json* layer : data_layers) {
+      if (layer->contains(ptr)) {
+        return &(*layer)[ptr];
       }
-    } break;
-    case Op::Multiplication: {
-      const auto args = get_arguments<2>(node);
-      if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-        make_result(args[0]->get<const json::number_integer_t>() * args[1]->get<const json::number_integer_t>());
+    }
+    return nullptr;
+  }
+
+  /// Returns the value at the path in the data provider, looking it up on first use
+  const json* provider_value(const DataProvider::Path& path) {
+    auto it = provider_values->find(path);
+    if (it == provider_values->end()) {
+      it = provider_values->emplace(path, data_provider->lookup(path)).first;
+    }
+    return it->second ? &*it->second : nullptr;
+  }
+
+  /// Returns the path in the data provider of a variable within a loop variable bound to it
+  std::optional<DataProvider::Path> aliased_path(const DataNode& node) const {
+    if (provider_aliases.empty()) {
+      return std::nullopt;
+    }
+    const auto it = provider_aliases.find(node.path.front());
+    if (it == provider_aliases.end()) {
+      return std::nullopt;
+    }
+
+    auto path = it->second;
+    path.insert(path.end(), node.path.begin() + 1, node.path.end());
+    return path;
+  }
+
+  /// Returns the path in the data provider of a loop condition that wasn't looked up as a whole yet
+  std::optional<DataProvider::Path> provider_loop_path(const ExpressionListNode& condition) const {
+    const auto* data = dynamic_cast<const DataNode*>(condition.root.get());
+    if (data_provider == nullptr || data == nullptr) {
+      return std::nullopt;
+    }
+
+    auto path = aliased_path(*data);
+    if (!path) {
+      if (additional_data.contains(data->ptr)) {
+        return std::nullopt;
+      }
+      path = data->path;
+    }
+    if (provider_values->count(*path) > 0) {
+      return std::nullopt;
+    }
+    return path;
+  }
+
+  /// Copies a loop variable bound to the data provider into the local data, before it is changed by a set statement
+  void materialize_alias(std::string_view key) {
+    const auto it = provider_aliases.find(static_cast<std::string>(key.substr(0, key.find('.'))));
+    if (it == provider_aliases.end()) {
+      return;
+    }
+
+    const json* value = provider_value(it->second);
+    additional_data[it->first] = (value != nullptr) ? *value : json();
+    provider_aliases.erase(it);
+  }
+
+  void emit_event(InstrumentationEvent event) {
+    if (config.instrumentation_callback) {
+      config.instrumentation_callback(InstrumentationData(event));
+    }
+  }
+
+  void emit_event(InstrumentationEvent event, const std::string& name) {
+    if (config.instrumentation_callback) {
+      config.instrumentation_callback(InstrumentationData(event, name));
+    }
+  }
+
+  void emit_event(InstrumentationEvent event, const std::string& name, const std::string& detail) {
+    if (config.instrumentation_callback) {
+      config.instrumentation_callback(InstrumentationData(event, name, detail));
+    }
+  }
+
+  void emit_event(InstrumentationEvent event, const std::string& name, const std::string& detail, size_t count) {
+    if (config.instrumentation_callback) {
+      config.instrumentation_callback(InstrumentationData(event, name, detail, count));
+    }
+  }
+
+  void print_data(const std::shared_ptr<json>& value) {
+    if (value->is_string()) {
+      if (config.html_autoescape) {
+        *output_stream << htmlescape(value->get_ref<const json::string_t&>());
       } else {
-        make_result(args[0]->get<const json::number_float_t>() * args[1]->get<const json::number_float_t>());
+        *output_stream << value->get_ref<const json::string_t&>();
       }
-    } break;
-    case Op::Division: {
-      const auto args = get_arguments<2>(node);
-      if (args[1]->get<const json::number_float_t>() == 0) {
-        throw_renderer_error("division by zero", node);
+    } else if (value->is_number_unsigned()) {
+      *output_stream << value->get<const json::number_unsigned_t>();
+    } else if (value->is_number_integer()) {
+      *output_stream << value->get<const json::number_integer_t>();
+    } else if (value->is_null()) {
+    } else {
+      *output_stream << value->dump();
+    }
+  }
+
+  const std::shared_ptr<json> eval_expression_list(const ExpressionListNode& expression_list) {
+    if (!expression_list.root) {
+      std::string original_text;
+      if (config.graceful_errors && expression_list.length > 0) {
+        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
       }
-      make_result(args[0]->get<const json::number_float_t>() / args[1]->get<const json::number_float_t>());
-    } break;
-    case Op::Power: {
-      const auto args = get_arguments<2>(node);
-      if (args[0]->is_number_integer() && args[1]->get<const json::number_integer_t>() >= 0) {
-        const auto result = static_cast<json::number_integer_t>(std::pow(args[0]->get<const json::number_integer_t>(), args[1]->get<const json::number_integer_t>()));
-        make_result(result);
-      } else {
-        const auto result = std::pow(args[0]->get<const json::number_float_t>(), args[1]->get<const json::number_integer_t>());
-        make_result(result);
+      throw_renderer_error("empty expression", expression_list, original_text);
+      return nullptr;
+    }
+
+    expression_list.root->accept(*this);
+
+    if (data_eval_stack.empty()) {
+      std::string original_text;
+      if (config.graceful_errors && expression_list.length > 0) {
+        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
       }
-    } break;
-    case Op::Modulo: {
-      const auto args = get_arguments<2>(node);
-      make_result(args[0]->get<const json::number_integer_t>() % args[1]->get<const json::number_integer_t>());
-    } break;
-    case Op::AtId: {
-      const auto container = get_arguments<1, 0, false>(node)[0];
-      node.arguments[1]->accept(*this);
+      throw_renderer_error("empty expression", expression_list, original_text);
+      return nullptr;
+    } else if (data_eval_stack.size() != 1) {
+      std::string original_text;
+      if (config.graceful_errors && expression_list.length > 0) {
+        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
+      }
+      throw_renderer_error("malformed expression", expression_list, original_text);
+      return nullptr;
+    }
+
+    const auto result = data_eval_stack.top();
+    data_eval_stack.pop();
+
+    if (result == nullptr) {
       if (not_found_stack.empty()) {
-        throw_renderer_error("could not find element with given name", node);
+        std::string original_text;
+        if (config.graceful_errors && expression_list.length > 0) {
+          original_text = current_template->content.substr(expression_list.pos, expression_list.length);
+        }
+        throw_renderer_error("expression could not be evaluated", expression_list, original_text);
+        return nullptr;
       }
+
       const auto not_found = not_found_stack.top();
       not_found_stack.pop();
-      data_eval_stack.pop();
-      data_eval_stack.push(&container->at(not_found.name));
-    } break;
-    case Op::At: {
-      const auto args = get_arguments<2>(node);
-      if (args[0]->is_object()) {
-        data_eval_stack.push(&args[0]->at(args[1]->get<std::string>()));
-      } else {
-        data_eval_stack.push(&args[0]->at(args[1]->get<int>()));
+
+      std::string original_text;
+      if (config.graceful_errors && expression_list.length > 0) {
+        original_text = current_template->content.substr(expression_list.pos, expression_list.length);
       }
-    } break;
-    case Op::Capitalize: {
-      auto result = get_arguments<1>(node)[0]->get<json::string_t>();
-      result[0] = static_cast<char>(::toupper(result[0]));
-      std::transform(result.begin() + 1, result.end(), result.begin() + 1, [](char c) { return static_cast<char>(::tolower(c)); });
-      make_result(std::move(result));
-    } break;
-    case Op::Default: {
-      const auto test_arg = get_arguments<1, 0, false>(node)[0];
-      data_eval_stack.push((test_arg != nullptr) ? test_arg : get_arguments<1, 1>(node)[0]);
-    } break;
-    case Op::DivisibleBy: {
-      const auto args = get_arguments<2>(node);
-      const auto divisor = args[1]->get<const json::number_integer_t>();
-      make_result((divisor != 0) && (args[0]->get<const json::number_integer_t>() % divisor == 0));
-    } break;
-    case Op::Even: {
-      make_result(get_arguments<1>(node)[0]->get<const json::number_integer_t>() % 2 == 0);
-    } break;
-    case Op::Exists: {
-      auto&& name = get_arguments<1>(node)[0]->get_ref<const json::string_t&>();
-      make_result(data_input->contains(json::json_pointer(DataNode::convert_dot_to_ptr(name))));
-    } break;
-    case Op::ExistsInObject: {
-      const auto args = get_arguments<2>(node);
-      auto&& name = args[1]->get_ref<const json::string_t&>();
-      make_result(args[0]->find(name) != args[0]->end());
-    } break;
-    case Op::First: {
-      const auto result = &get_arguments<1>(node)[0]->front();
-      data_eval_stack.push(result);
-    } break;
-    case Op::Float: {
-      make_result(std::stod(get_arguments<1>(node)[0]->get_ref<const json::string_t&>()));
-    } break;
-    case Op::Int: {
-      make_result(std::stoi(get_arguments<1>(node)[0]->get_ref<const json::string_t&>()));
-    } break;
-    case Op::Last: {
-      const auto result = &get_arguments<1>(node)[0]->back();
-      data_eval_stack.push(result);
-    } break;
-    case Op::Length: {
-      const auto val = get_arguments<1>(node)[0];
-      if (val->is_string()) {
-        make_result(val->get_ref<const json::string_t&>().length());
-      } else {
-        make_result(val->size());
+      throw_renderer_error("variable '" + not_found.name + "' not found", *not_found.node, original_text);
+      return nullptr;
+    }
+    return std::make_shared<json>(*result);
+  }
+
+  void throw_renderer_error(const std::string& message, const AstNode& node, const std::string& original_text = "") {
+    const SourceLocation loc = get_source_location(current_template->content, node.pos);
+    if (config.graceful_errors) {
+      render_errors.emplace_back(message, loc, original_text);
+    } else {
+      INJA_THROW(RenderError(message, loc));
+    }
+  }
+
+  static OperandTypes classify_operands(const json& lhs, const json& rhs) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return OperandTypes::Integer;
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return OperandTypes::Float;
+    } else if (lhs.is_string() && rhs.is_string()) {
+      return OperandTypes::String;
+    }
+    return OperandTypes::Other;
+  }
+
+  /// Returns the types of both operands, checking the types last seen by the node first
+  static OperandTypes operand_types(const FunctionNode& node, const json& lhs, const json& rhs) {
+    const auto cached = node.operand_types.get();
+    switch (cached) {
+    case OperandTypes::Integer: {
+      if (lhs.is_number_integer() && rhs.is_number_integer()) {
+        return cached;
       }
     } break;
-    case Op::Lower: {
-      auto result = get_arguments<1>(node)[0]->get<json::string_t>();
-      std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
-      make_result(std::move(result));
-    } break;
-    case Op::Max: {
-      const auto args = get_arguments<1>(node);
-      const auto result = std::max_element(args[0]->begin(), args[0]->end());
-      data_eval_stack.push(&(*result));
-    } break;
-    case Op::Min: {
-      const auto args = get_arguments<1>(node);
-      const auto result = std::min_element(args[0]->begin(), args[0]->end());
-      data_eval_stack.push(&(*result));
-    } break;
-    case Op::Odd: {
-      make_result(get_arguments<1>(node)[0]->get<const json::number_integer_t>() % 2 != 0);
-    } break;
-    case Op::Range: {
-      std::vector<int> result(get_arguments<1>(node)[0]->get<const json::number_integer_t>());
-      std::iota(result.begin(), result.end(), 0);
-      make_result(std::move(result));
-    } break;
-    case Op::Replace: {
-      const auto args = get_arguments<3>(node);
-      auto result = args[0]->get<std::string>();
-      replace_substring(result, args[1]->get<std::string>(), args[2]->get<std::string>());
-      make_result(std::move(result));
+    case OperandTypes::Float: {
+      if ((lhs.is_number_float() && rhs.is_number()) || (lhs.is_number() && rhs.is_number_float())) {
+        return cached;
+      }
     } break;
-    case Op::Round: {
-      const auto args = get_arguments<2>(node);
-      const auto precision = args[1]->get<const json::number_integer_t>();
-      const double result = std::round(args[0]->get<const json::number_float_t>() * std::pow(10.0, precision)) / std::pow(10.0, precision);
-      if (precision == 0) {
-        make_result(static_cast<int>(result));
-      } else {
-        make_result(result);
+    case OperandTypes::String: {
+      if (lhs.is_string() && rhs.is_string()) {
+        return cached;
       }
     } break;
-    case Op::Sort: {
-      auto result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->get<std::vector<json>>());
-      std::sort(result_ptr->begin(), result_ptr->end());
-      data_tmp_stack.push_back(result_ptr);
-      data_eval_stack.push(result_ptr.get());
-    } break;
-    case Op::Upper: {
-      auto result = get_arguments<1>(node)[0]->get<json::string_t>();
-      std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::toupper(c)); });
-      make_result(std::move(result));
-    } break;
-    case Op::IsBoolean: {
-      make_result(get_arguments<1>(node)[0]->is_boolean());
-    } break;
-    case Op::IsNumber: {
-      make_result(get_arguments<1>(node)[0]->is_number());
-    } break;
-    case Op::IsInteger: {
-      make_result(get_arguments<1>(node)[0]->is_number_integer());
-    } break;
-    case Op::IsFloat: {
-      make_result(get_arguments<1>(node)[0]->is_number_float());
-    } break;
-    case Op::IsObject: {
-      make_result(get_arguments<1>(node)[0]->is_object());
-    } break;
-    case Op::IsArray: {
-      make_result(get_arguments<1>(node)[0]->is_array());
-    } break;
-    case Op::IsString: {
-      make_result(get_arguments<1>(node)[0]->is_string());
-    } break;
-    case Op::Callback: {
-      if (!node.callback) {
-        // Callback is null - function not found or not registered
-        if (config.graceful_errors) {
-          // Unknown function without callback in graceful mode
-          data_eval_stack.push(nullptr);
-          not_found_stack.emplace(node.name, &node);
-        } else {
-          throw_renderer_error("function '" + node.name + "' not found or has no callback", node);
+    default:
+      break;
+    }
+
+    const auto types = classify_operands(lhs, rhs);
+    node.operand_types.set(types);
+    return types;
+  }
+
+  static json::number_integer_t integer_value(const json& value) {
+    if (const auto* integer = value.get_ptr<const json::number_integer_t*>()) {
+      return *integer;
+    }
+    return static_cast<json::number_integer_t>(*value.get_ptr<const json::number_unsigned_t*>());
+  }
+
+  static json::number_float_t float_value(const json& value) {
+    if (const auto* number = value.get_ptr<const json::number_float_t*>()) {
+      return *number;
+    } else if (const auto* number_unsigned = value.get_ptr<const json::number_unsigned_t*>()) {
+      return static_cast<json::number_float_t>(*number_unsigned);
+    }
+    return static_cast<json::number_float_t>(*value.get_ptr<const json::number_integer_t*>());
+  }
+
+  /// Compares two values with the same semantics as the json comparison operators
+  template <typename Compare> bool compare(const FunctionNode& node, const json& lhs, const json& rhs, Compare compare) {
+    switch (operand_types(node, lhs, rhs)) {
+    case OperandTypes::Integer: {
+      if (lhs.is_number_unsigned() && rhs.is_number_unsigned()) {
+        return compare(lhs.get_ref<const json::number_unsigned_t&>(), rhs.get_ref<const json::number_unsigned_t&>());
+      }
+      return compare(integer_value(lhs), integer_value(rhs));
+    }
+    case OperandTypes::Float:
+      return compare(float_value(lhs), float_value(rhs));
+    case OperandTypes::String:
+      return compare(lhs.get_ref<const json::string_t&>(), rhs.get_ref<const json::string_t&>());
+    default:
+      return compare(lhs, rhs);
+    }
+  }
+
+  void make_result(const json&& result) {
+    auto result_ptr = std::make_shared<json>(result);
+    data_tmp_stack.push_back(result_ptr);
+    data_eval_stack.push(result_ptr.get());
+  }
+
+  template <size_t N, size_t N_start = 0, bool throw_not_found = true> std::array<const json*, N> get_arguments(const FunctionNode& node) {
+    if (node.arguments.size() < N_start + N) {
+      throw_renderer_error("function needs " + std::to_string(N_start + N) + " variables, but has only found " + std::to_string(node.arguments.size()), node);
+    }
+
+    for (size_t i = N_start; i < N_start + N; i += 1) {
+      node.arguments[i]->accept(*this);
+    }
+
+    if (data_eval_stack.size() < N) {
+      throw_renderer_error("function needs " + std::to_string(N) + " variables, but has only found " + std::to_string(data_eval_stack.size()), node);
+    }
+
+    std::array<const json*, N> result;
+    for (size_t i = 0; i < N; i += 1) {
+      result[N - i - 1] = data_eval_stack.top();
+      data_eval_stack.pop();
+
+      if (!result[N - i - 1]) {
+        const auto not_found = not_found_stack.top();
+        not_found_stack.pop();
+
+        if (throw_not_found) {
+          throw_renderer_error("variable '" + not_found.name + "' not found", *not_found.node);
         }
-      } else {
-        auto args = get_argument_vector(node);
-        make_result(node.callback(args));
+        
+        // In graceful error mode, provide a safe default to prevent null pointer dereferences
+        // But only when the caller expects to throw - if throw_not_found is false, the caller
+        // explicitly wants to handle nullptr (e.g., the Default filter)
+        if (config.graceful_errors && throw_not_found) {
+          static const json empty_json;
+          result[N - i - 1] = &empty_json;
+        }
+        // If throw_not_found is false, leave as nullptr so caller can detect missing value
       }
-    } break;
-    case Op::Super: {
-      const auto args = get_argument_vector(node);
-      const size_t old_level = current_level;
-      const size_t level_diff = (args.size() == 1) ? args[0]->get<int>() : 1;
-      const size_t level = current_level + level_diff;
+    }
+    return result;
+  }
 
-      if (block_statement_stack.empty()) {
-        throw_renderer_error("super() call is not within a block", node);
+  template <bool throw_not_found = true> Arguments get_argument_vector(const FunctionNode& node) {
+    const size_t N = node.arguments.size();
+    for (const auto& a : node.arguments) {
+      a->accept(*this);
+    }
+
+    if (data_eval_stack.size() < N) {
+      throw_renderer_error("function needs " + std::to_string(N) + " variables, but has only found " + std::to_string(data_eval_stack.size()), node);
+    }
+
+    Arguments result {N};
+    for (size_t i = 0; i < N; i += 1) {
+      result[N - i - 1] = data_eval_stack.top();
+      data_eval_stack.pop();
+
+      if (!result[N - i - 1]) {
+        const auto not_found = not_found_stack.top();
+        not_found_stack.pop();
+
+        if (throw_not_found) {
+          throw_renderer_error("variable '" + not_found.name + "' not found", *not_found.node);
+        }
+        
+        // In graceful error mode, provide a safe default to prevent null pointer dereferences
+        // But only when the caller expects to throw - if throw_not_found is false, the caller
+        // explicitly wants to handle nullptr (e.g., the Default filter)
+        if (config.graceful_errors && throw_not_found) {
+          static const json empty_json;
+          result[N - i - 1] = &empty_json;
+        }
+        // If throw_not_found is false, leave as nullptr so caller can detect missing value
+      }
+    }
+    return result;
+  }
+
+  void check_interrupt() {
+    if (stop_token.stop_requested()) {
+      INJA_THROW(InterruptError("render was cancelled"));
+    }
+    // Reading the clock costs more than rendering most nodes
+    if (deadline != std::chrono::steady_clock::time_point::max() && ++nodes_since_deadline_check >= 64) {
+      nodes_since_deadline_check = 0;
+      if (std::chrono::steady_clock::now() > deadline) {
+        INJA_THROW(InterruptError("render deadline exceeded"));
       }
+    }
+  }
 
-      if (level < 1 || level > template_stack.size() - 1) {
-        throw_renderer_error("level of super() call does not match parent templates (between 1 and " + std::to_string(template_stack.size() - 1) + ")", node);
+  /// Returns the indices of the includes and block statements of the block that can be rendered concurrently to each other
+  const std::vector<size_t>& find_concurrent_nodes(const BlockNode& block) {
+    std::lock_guard<std::mutex> lock(concurrent_nodes->mutex);
+    const auto [it, inserted] = concurrent_nodes->indices.try_emplace({&block, template_stack.front()});
+    if (!inserted) {
+      return it->second;
+    }
+
+    std::vector<size_t> indices;
+    EffectVisitor visitor(template_storage, function_storage, template_stack);
+    for (size_t i = 0; i < block.nodes.size(); ++i) {
+      const AstNode* node = block.nodes[i].get();
+      if (dynamic_cast<const ExtendsStatementNode*>(node)) {
+        return it->second; // The rest of the block is not rendered
       }
 
-      const auto current_block_statement = block_statement_stack.back();
-      const Template* new_template = template_stack.at(level);
-      const Template* old_template = current_template;
-      const auto block_it = new_template->block_storage.find(current_block_statement->name);
-      if (block_it != new_template->block_storage.end()) {
-        current_template = new_template;
-        current_level = level;
-        block_it->second->block.accept(*this);
-        current_level = old_level;
-        current_template = old_template;
-      } else {
-        throw_renderer_error("could not find block with name '" + current_block_statement->name + "'", node);
+      // Variables set by included templates are local to them, but block statements are rendered with the data of the block
+      const bool is_include = dynamic_cast<const IncludeStatementNode*>(node) != nullptr;
+      if (is_include || dynamic_cast<const BlockStatementNode*>(node)) {
+        const auto effects = visitor.analyze(*node);
+        if (!effects.has_side_effects && (is_include || effects.is_read_only())) {
+          indices.push_back(i);
+        }
       }
-      make_result(nullptr);
-    } break;
-    case Op::Join: {
-      const auto args = get_arguments<2>(node);
-      const auto separator = args[1]->get<json::string_t>();
+    }
+    if (indices.size() >= 2) {
+      it->second = std::move(indices);
+    }
+    return it->second;
+  }
+
+  /// Returns a renderer with a copy of the current state of this one, to render a part concurrently
+  std::shared_ptr<Renderer> fork() const {
+    auto result = std::make_shared<Renderer>(config, template_storage, function_storage);
+    result->current_template = current_template;
+    result->current_level = current_level;
+    result->template_stack = template_stack;
+    result->block_statement_stack = block_statement_stack;
+    result->data_input = data_input;
+    result->data_layers = data_layers;
+    result->static_data = static_data;
+    result->additional_data = additional_data;
+    result->stop_token = stop_token;
+    result->deadline = deadline;
+    result->concurrent_nodes = concurrent_nodes;
+    return result;
+  }
+
+  /// Waits for all parts, then rethrows the first exception in their order
+  void join(std::vector<ConcurrentPart>& parts) {
+    for (const auto& part : parts) {
+      if (part.task.valid()) {
+        config.thread_pool->wait(part.task);
+      }
+    }
+    for (auto& part : parts) {
+      if (part.task.valid()) {
+        part.task.get();
+      }
+    }
+  }
+
+  /// Renders a node on the thread pool into the part, with a copy of the current state of this renderer
+  std::future<void> render_concurrently(const AstNode& node, ConcurrentPart& part) {
+    return config.thread_pool->submit([fork = fork(), &node, &part]() {
       std::ostringstream os;
-      std::string sep;
-      for (const auto& value : *args[0]) {
-        os << sep;
-        if (value.is_string()) {
-          os << value.get<std::string>(); // otherwise the value is surrounded with ""
-        } else {
-          os << value.dump();
+      fork->output_stream = &os;
+      node.accept(*fork);
+      part.output = std::move(os).str();
+      part.errors = std::move(fork->render_errors);
+    });
+  }
+
+  /*!
+   * \brief Renders the independent includes and block statements of the block concurrently, returns false if there are less than two.
+   *
+   * The other nodes are rendered on this thread in the meantime. All output
+   * is buffered and written in order once every part is done, and the errors
+   * are merged in the order of a serial render.
+   */
+  bool render_block_concurrently(const BlockNode& block) {
+    if (data_provider != nullptr || config.instrumentation_callback) {
+      return false; // The provided values are cached per render, and events are reported in order
+    }
+    const auto& indices = find_concurrent_nodes(block);
+    if (indices.empty()) {
+      return false;
+    }
+
+    std::ostream* const output = output_stream;
+    std::ostringstream segment;
+    output_stream = &segment;
+    std::vector<ConcurrentPart> parts(indices.size());
+    size_t next_part = 0;
+    try {
+      for (size_t i = 0; i < block.nodes.size(); ++i) {
+        check_interrupt();
+        if (next_part < indices.size() && indices[next_part] == i) {
+          auto& part = parts[next_part++];
+          part.preceding_output = std::move(segment).str();
+          segment.str(std::string());
+          part.preceding_errors = render_errors.size();
+          part.task = render_concurrently(*block.nodes[i], part);
+          continue;
+        }
+
+        block.nodes[i]->accept(*this);
+        if (break_rendering) {
+          break;
         }
-        sep = separator;
       }
-      make_result(os.str());
-    } break;
-    case Op::None: {
-      // Unknown function in graceful error mode
-      if (config.graceful_errors) {
-        // Push nullptr to trigger graceful error handling
+    } catch (...) {
+      // The parts reference this frame
+      output_stream = output;
+      for (const auto& part : parts) {
+        if (part.task.valid()) {
+          config.thread_pool->wait(part.task);
+        }
+      }
+      throw;
+    }
+    output_stream = output;
+    join(parts);
+
+    std::vector<RenderErrorInfo> errors;
+    size_t error_index = 0;
+    for (auto& part : parts) {
+      *output_stream << part.preceding_output << part.output;
+      errors.insert(errors.end(), render_errors.begin() + error_index, render_errors.begin() + part.preceding_errors);
+      errors.insert(errors.end(), part.errors.begin(), part.errors.end());
+      error_index = part.preceding_errors;
+    }
+    *output_stream << segment.str();
+    errors.insert(errors.end(), render_errors.begin() + error_index, render_errors.end());
+    render_errors = std::move(errors);
+    return true;
+  }
+
+  void visit(const BlockNode& node) override {
+    if (concurrent_nodes && render_block_concurrently(node)) {
+      return;
+    }
+
+    for (const auto& n : node.nodes) {
+      check_interrupt();
+      n->accept(*this);
+
+      if (break_rendering) {
+        break;
+      }
+    }
+  }
+
+  void visit(const TextNode& node) override {
+    output_stream->write(current_template->content.c_str() + node.pos, node.length);
+  }
+
+  void visit(const ExpressionNode&) override {}
+
+  void visit(const LiteralNode& node) override {
+    data_eval_stack.push(&node.value);
+  }
+
+  void visit(const DataNode& node) override {
+    if (const auto path = aliased_path(node)) {
+      const json* value = provider_value(*path);
+      data_eval_stack.push(value);
+      if (value == nullptr) {
+        not_found_stack.emplace(static_cast<std::string>(node.name), &node);
+      }
+      return;
+    }
+
+    const json* provided = nullptr;
+    if (additional_data.contains(node.ptr)) {
+      data_eval_stack.push(&(additional_data[node.ptr]));
+    } else if (data_provider != nullptr && (provided = provider_value(node.path)) != nullptr) {
+      data_eval_stack.push(provided);
+    } else if ((provided = find_input(node.ptr)) != nullptr) {
+      data_eval_stack.push(provided);
+    } else if (static_data != nullptr && static_data->contains(node.ptr)) {
+      data_eval_stack.push(&(*static_data)[node.ptr]);
+    } else {
+      // Try to evaluate as a no-argument callback
+      const auto function_data = function_storage.find_function(node.name, 0);
+      if (function_data.operation == FunctionStorage::Operation::Callback) {
+        Arguments empty_args {};
+        // If a callback wrapper is set (for tracing/instrumentation), use it
+        std::shared_ptr<json> value;
+        if (config.callback_wrapper) {
+          value = std::make_shared<json>(config.callback_wrapper(static_cast<std::string>(node.name), empty_args, [&]() {
+            return function_data.callback(empty_args);
+          }));
+        } else {
+          value = std::make_shared<json>(function_data.callback(empty_args));
+        }
+        data_tmp_stack.push_back(value);
+        data_eval_stack.push(value.get());
+      } else {
         data_eval_stack.push(nullptr);
-        not_found_stack.emplace(node.name, &node);
+        not_found_stack.emplace(static_cast<std::string>(node.name), &node);
       }
-    } break;
     }
   }
 
-  void visit(const ExpressionListNode& node) override {
-    auto result = eval_expression_list(node);
-    if (result) {
-      print_data(result);
-    } else if (config.graceful_errors && node.length > 0) {
-      // In graceful mode, output the original template text
-      *output_stream << current_template->content.substr(node.pos, node.length);
-    }
+  // Helper macro for graceful error handling in operations
+  #define INJA_OP_TRY_BEGIN try {
+  #define INJA_OP_TRY_END_GRACEFUL(op_name) \
+    } catch (const std::exception& e) { \
+      if (config.graceful_errors) { \
+        data_eval_stack.push(nullptr); \
+        not_found_stack.emplace(op_name, &node); \
+      } else { \
+        throw_renderer_error(std::string("operation '") + op_name + "' failed: " + e.what(), node); \
+      } \
+    } catch (...) { \
+      if (config.graceful_errors) { \
+        data_eval_stack.push(nullptr); \
+        not_found_stack.emplace(op_name, &node); \
+      } else { \
+        throw_renderer_error(std::string("operation '") + op_name + "' failed with unknown exception", node); \
+      } \
+    }
+
+  void visit(const FunctionNode& node) override {
+    if (node.memo_key == nullptr) {
+      evaluate_function(node);
+      return;
+    }
+
+    const auto it = memo.find(node.memo_key);
+    if (it != memo.end()) {
+      emit_event(InstrumentationEvent::MemoHit, node.name);
+      data_eval_stack.push(it->second.get());
+      return;
+    }
+
+    const size_t eval_size = data_eval_stack.size();
+    const size_t not_found_size = not_found_stack.size();
+    const size_t errors_size = render_errors.size();
+
+    evaluate_function(node);
+
+    // Only cache a single, successfully computed value
+    if (data_eval_stack.size() != eval_size + 1 || not_found_stack.size() != not_found_size || render_errors.size() != errors_size) {
+      return;
+    }
+    const json* result = data_eval_stack.top();
+    if (result == nullptr) {
+      return;
+    }
+
+    // Fresh results are owned by the temporary stack, others point into the data and are copied
+    const auto value = (!data_tmp_stack.empty() && data_tmp_stack.back().get() == result) ? data_tmp_stack.back() : std::make_shared<json>(*result);
+    memo.emplace(node.memo_key, value);
+    for (const auto& dependency : node.memo_dependencies) {
+      memo_by_dependency[dependency].insert(node.memo_key);
+    }
+  }
+
+  void evaluate_function(const FunctionNode& node) {
+    switch (node.operation) {
+    case Op::Not: {
+      const auto args = get_arguments<1>(node);
+      make_result(!truthy(args[0]));
+    } break;
+    case Op::And: {
+      make_result(truthy(get_arguments<1, 0>(node)[0]) && truthy(get_arguments<1, 1>(node)[0]));
+    } break;
+    case Op::Or: {
+      make_result(truthy(get_arguments<1, 0>(node)[0]) || truthy(get_arguments<1, 1>(node)[0]));
+    } break;
+    case Op::In: {
+      const auto args = get_arguments<2>(node);
+      make_result(std::find(args[1]->begin(), args[1]->end(), *args[0]) != args[1]->end());
+    } break;
+    case Op::Equal: {
+      const auto args = get_arguments<2>(node);
+      make_result(compare(node, *args[0], *args[1], std::equal_to<>()));
+    } break;
+    case Op::NotEqual: {
+      const auto args = get_arguments<2>(node);
+      make_result(compare(node, *args[0], *args[1], std::not_equal_to<>()));
+    } break;
+    case Op::Greater: {
+      const auto args = get_arguments<2>(node);
+      make_result(compare(node, *args[0], *args[1], std::greater<>()));
+    } break;
+    case Op::GreaterEqual: {
+      const auto args = get_arguments<2>(node);
+      make_result(compare(node, *args[0], *args[1], std::greater_equal<>()));
+    } break;
+    case Op::Less: {
+      const auto args = get_arguments<2>(node);
+      make_result(compare(node, *args[0], *args[1], std::less<>()));
+    } break;
+    case Op::LessEqual: {
+      const auto args = get_arguments<2>(node);
+      make_result(compare(node, *args[0], *args[1], std::less_equal<>()));
+    } break;
+    case Op::Add: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        switch (operand_types(node, *args[0], *args[1])) {
+        case OperandTypes::String:
+          make_result(args[0]->get_ref<const json::string_t&>() + args[1]->get_ref<const json::string_t&>());
+          break;
+        case OperandTypes::Integer:
+          make_result(integer_value(*args[0]) + integer_value(*args[1]));
+          break;
+        case OperandTypes::Float:
+          make_result(float_value(*args[0]) + float_value(*args[1]));
+          break;
+        default:
+          make_result(args[0]->get<const json::number_float_t>() + args[1]->get<const json::number_float_t>());
+        }
+      INJA_OP_TRY_END_GRACEFUL("add")
+    } break;
+    case Op::Subtract: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        switch (operand_types(node, *args[0], *args[1])) {
+        case OperandTypes::Integer:
+          make_result(integer_value(*args[0]) - integer_value(*args[1]));
+          break;
+        case OperandTypes::Float:
+          make_result(float_value(*args[0]) - float_value(*args[1]));
+          break;
+        default:
+          make_result(args[0]->get<const json::number_float_t>() - args[1]->get<const json::number_float_t>());
+        }
+      INJA_OP_TRY_END_GRACEFUL("subtract")
+    } break;
+    case Op::Multiplication: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        switch (operand_types(node, *args[0], *args[1])) {
+        case OperandTypes::Integer:
+          make_result(integer_value(*args[0]) * integer_value(*args[1]));
+          break;
+        case OperandTypes::Float:
+          make_result(float_value(*args[0]) * float_value(*args[1]));
+          break;
+        default:
+          make_result(args[0]->get<const json::number_float_t>() * args[1]->get<const json::number_float_t>());
+        }
+      INJA_OP_TRY_END_GRACEFUL("multiply")
+    } break;
+    case Op::Division: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        if (args[1]->get<const json::number_float_t>() == 0) {
+          throw_renderer_error("division by zero", node);
+        }
+        make_result(args[0]->get<const json::number_float_t>() / args[1]->get<const json::number_float_t>());
+      INJA_OP_TRY_END_GRACEFUL("division")
+    } break;
+    case Op::Power: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        if (args[0]->is_number_integer() && args[1]->get<const json::number_integer_t>() >= 0) {
+          const auto result = static_cast<json::number_integer_t>(std::pow(args[0]->get<const json::number_integer_t>(), args[1]->get<const json::number_integer_t>()));
+          make_result(result);
+        } else {
+          const auto result = std::pow(args[0]->get<const json::number_float_t>(), args[1]->get<const json::number_integer_t>());
+          make_result(result);
+        }
+      INJA_OP_TRY_END_GRACEFUL("power")
+    } break;
+    case Op::Modulo: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        make_result(args[0]->get<const json::number_integer_t>() % args[1]->get<const json::number_integer_t>());
+      INJA_OP_TRY_END_GRACEFUL("modulo")
+    } break;
+    case Op::AtId: {
+      const auto container = get_arguments<1, 0, false>(node)[0];
+      node.arguments[1]->accept(*this);
+      if (not_found_stack.empty()) {
+        throw_renderer_error("could not find element with given name", node);
+      }
+      const auto not_found = not_found_stack.top();
+      not_found_stack.pop();
+      data_eval_stack.pop();
+      
+      // Safe access with graceful error handling
+      try {
+        if (container && container->contains(not_found.name)) {
+          data_eval_stack.push(&container->at(not_found.name));
+        } else {
+          // Member not found
+          if (config.graceful_errors) {
+            data_eval_stack.push(nullptr);
+            not_found_stack.push(not_found);
+          } else {
+            throw_renderer_error("member '" + not_found.name + "' not found in container", node);
+          }
+        }
+      } catch (const std::exception&) {
+        if (config.graceful_errors) {
+          data_eval_stack.push(nullptr);
+          not_found_stack.push(not_found);
+        } else {
+          throw;
+        }
+      }
+    } break;
+    case Op::At: {
+      const auto args = get_arguments<2>(node);
+      try {
+        if (args[0]->is_object()) {
+          const auto key = args[1]->get<std::string>();
+          if (args[0]->contains(key)) {
+            data_eval_stack.push(&args[0]->at(key));
+          } else {
+            if (config.graceful_errors) {
+              data_eval_stack.push(nullptr);
+              not_found_stack.emplace(key, &node);
+            } else {
+              throw_renderer_error("key '" + key + "' not found in object", node);
+            }
+          }
+        } else if (args[0]->is_array()) {
+          const auto index = args[1]->get<int>();
+          if (index >= 0 && static_cast<size_t>(index) < args[0]->size()) {
+            data_eval_stack.push(&args[0]->at(index));
+          } else {
+            if (config.graceful_errors) {
+              data_eval_stack.push(nullptr);
+              not_found_stack.emplace("index[" + std::to_string(index) + "]", &node);
+            } else {
+              throw_renderer_error("index " + std::to_string(index) + " out of bounds", node);
+            }
+          }
+        } else {
+          if (config.graceful_errors) {
+            data_eval_stack.push(nullptr);
+            not_found_stack.emplace("at", &node);
+          } else {
+            throw_renderer_error("cannot access element on non-container type", node);
+          }
+        }
+      } catch (const std::exception&) {
+        if (config.graceful_errors) {
+          data_eval_stack.push(nullptr);
+          not_found_stack.emplace("at", &node);
+        } else {
+          throw;
+        }
+      }
+    } break;
+    case Op::Capitalize: {
+      INJA_OP_TRY_BEGIN
+        auto result = get_arguments<1>(node)[0]->get<json::string_t>();
+        result[0] = static_cast<char>(::toupper(result[0]));
+        std::transform(result.begin() + 1, result.end(), result.begin() + 1, [](char c) { return static_cast<char>(::tolower(c)); });
+        make_result(std::move(result));
+      INJA_OP_TRY_END_GRACEFUL("capitalize")
+    } break;
+    case Op::Default: {
+      const auto test_arg = get_arguments<1, 0, false>(node)[0];
+      data_eval_stack.push((test_arg != nullptr) ? test_arg : get_arguments<1, 1>(node)[0]);
+    } break;
+    case Op::DivisibleBy: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        const auto divisor = args[1]->get<const json::number_integer_t>();
+        make_result((divisor != 0) && (args[0]->get<const json::number_integer_t>() % divisor == 0));
+      INJA_OP_TRY_END_GRACEFUL("divisibleBy")
+    } break;
+    case Op::Even: {
+      INJA_OP_TRY_BEGIN
+        make_result(get_arguments<1>(node)[0]->get<const json::number_integer_t>() % 2 == 0);
+      INJA_OP_TRY_END_GRACEFUL("even")
+    } break;
+    case Op::Exists: {
+      INJA_OP_TRY_BEGIN
+        auto&& name = get_arguments<1>(node)[0]->get_ref<const json::string_t&>();
+        const auto ptr = json::json_pointer(DataNode::convert_dot_to_ptr(name));
+        make_result(find_input(ptr) != nullptr || (data_provider != nullptr && provider_value(DataNode::split_dots(name)) != nullptr) ||
+                    (static_data != nullptr && static_data->contains(ptr)));
+      INJA_OP_TRY_END_GRACEFUL("exists")
+    } break;
+    case Op::ExistsInObject: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        auto&& name = args[1]->get_ref<const json::string_t&>();
+        make_result(args[0]->find(name) != args[0]->end());
+      INJA_OP_TRY_END_GRACEFUL("existsIn")
+    } break;
+    case Op::First: {
+      INJA_OP_TRY_BEGIN
+        const auto arr = get_arguments<1>(node)[0];
+        if (arr->empty()) {
+          if (config.graceful_errors) {
+            data_eval_stack.push(nullptr);
+            not_found_stack.emplace("first", &node);
+          } else {
+            throw_renderer_error("cannot get first element of empty array", node);
+          }
+        } else {
+          const auto result = &arr->front();
+          data_eval_stack.push(result);
+        }
+      INJA_OP_TRY_END_GRACEFUL("first")
+    } break;
+    case Op::Float: {
+      INJA_OP_TRY_BEGIN
+        make_result(std::stod(get_arguments<1>(node)[0]->get_ref<const json::string_t&>()));
+      INJA_OP_TRY_END_GRACEFUL("float")
+    } break;
+    case Op::Int: {
+      INJA_OP_TRY_BEGIN
+        make_result(std::stoi(get_arguments<1>(node)[0]->get_ref<const json::string_t&>()));
+      INJA_OP_TRY_END_GRACEFUL("int")
+    } break;
+    case Op::Last: {
+      INJA_OP_TRY_BEGIN
+        const auto arr = get_arguments<1>(node)[0];
+        if (arr->empty()) {
+          if (config.graceful_errors) {
+            data_eval_stack.push(nullptr);
+            not_found_stack.emplace("last", &node);
+          } else {
+            throw_renderer_error("cannot get last element of empty array", node);
+          }
+        } else {
+          const auto result = &arr->back();
+          data_eval_stack.push(result);
+        }
+      INJA_OP_TRY_END_GRACEFUL("last")
+    } break;
+    case Op::Length: {
+      INJA_OP_TRY_BEGIN
+        const auto val = get_arguments<1>(node)[0];
+        if (val->is_string()) {
+          make_result(val->get_ref<const json::string_t&>().length());
+        } else {
+          make_result(val->size());
+        }
+      INJA_OP_TRY_END_GRACEFUL("length")
+    } break;
+    case Op::Lower: {
+      INJA_OP_TRY_BEGIN
+        auto result = get_arguments<1>(node)[0]->get<json::string_t>();
+        std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+        make_result(std::move(result));
+      INJA_OP_TRY_END_GRACEFUL("lower")
+    } break;
+    case Op::Max: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<1>(node);
+        const auto result = std::max_element(args[0]->begin(), args[0]->end());
+        data_eval_stack.push(&(*result));
+      INJA_OP_TRY_END_GRACEFUL("max")
+    } break;
+    case Op::Min: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<1>(node);
+        const auto result = std::min_element(args[0]->begin(), args[0]->end());
+        data_eval_stack.push(&(*result));
+      INJA_OP_TRY_END_GRACEFUL("min")
+    } break;
+    case Op::Odd: {
+      INJA_OP_TRY_BEGIN
+        make_result(get_arguments<1>(node)[0]->get<const json::number_integer_t>() % 2 != 0);
+      INJA_OP_TRY_END_GRACEFUL("odd")
+    } break;
+    case Op::Range: {
+      INJA_OP_TRY_BEGIN
+        std::vector<int> result(get_arguments<1>(node)[0]->get<const json::number_integer_t>());
+        std::iota(result.begin(), result.end(), 0);
+        make_result(std::move(result));
+      INJA_OP_TRY_END_GRACEFUL("range")
+    } break;
+    case Op::Replace: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<3>(node);
+        auto result = args[0]->get<std::string>();
+        replace_substring(result, args[1]->get<std::string>(), args[2]->get<std::string>());
+        make_result(std::move(result));
+      INJA_OP_TRY_END_GRACEFUL("replace")
+    } break;
+    case Op::Round: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        const auto precision = args[1]->get<const json::number_integer_t>();
+        const double result = std::round(args[0]->get<const json::number_float_t>() * std::pow(10.0, precision)) / std::pow(10.0, precision);
+        if (precision == 0) {
+          make_result(static_cast<int>(result));
+        } else {
+          make_result(result);
+        }
+      INJA_OP_TRY_END_GRACEFUL("round")
+    } break;
+    case Op::Sort: {
+      INJA_OP_TRY_BEGIN
+        auto result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->get<std::vector<json>>());
+        std::sort(result_ptr->begin(), result_ptr->end());
+        data_tmp_stack.push_back(result_ptr);
+        data_eval_stack.push(result_ptr.get());
+      INJA_OP_TRY_END_GRACEFUL("sort")
+    } break;
+    case Op::Upper: {
+      INJA_OP_TRY_BEGIN
+        auto result = get_arguments<1>(node)[0]->get<json::string_t>();
+        std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::toupper(c)); });
+        make_result(std::move(result));
+      INJA_OP_TRY_END_GRACEFUL("upper")
+    } break;
+    case Op::IsBoolean: {
+      make_result(get_arguments<1>(node)[0]->is_boolean());
+    } break;
+    case Op::IsNumber: {
+      make_result(get_arguments<1>(node)[0]->is_number());
+    } break;
+    case Op::IsInteger: {
+      make_result(get_arguments<1>(node)[0]->is_number_integer());
+    } break;
+    case Op::IsFloat: {
+      make_result(get_arguments<1>(node)[0]->is_number_float());
+    } break;
+    case Op::IsObject: {
+      make_result(get_arguments<1>(node)[0]->is_object());
+    } break;
+    case Op::IsArray: {
+      make_result(get_arguments<1>(node)[0]->is_array());
+    } break;
+    case Op::IsString: {
+      make_result(get_arguments<1>(node)[0]->is_string());
+    } break;
+    case Op::Callback: {
+      const CallbackFunction* callback = &node.callback;
+      CallbackFunction registered_callback;
+      if (!node.callback) {
+        // Templates compiled ahead of time resolve their callbacks at render time
+        registered_callback = function_storage.find_function(node.name, static_cast<int>(node.arguments.size())).callback;
+        callback = &registered_callback;
+      }
+
+      if (!*callback) {
+        // Callback is null - function not found or not registered
+        if (config.graceful_errors) {
+          // Unknown function without callback in graceful mode
+          data_eval_stack.push(nullptr);
+          not_found_stack.emplace(node.name, &node);
+        } else {
+          throw_renderer_error("function '" + node.name + "' not found or has no callback", node);
+        }
+      } else {
+        auto args = get_argument_vector(node);
+        // If a callback wrapper is set (for tracing/instrumentation), use it
+        if (config.callback_wrapper) {
+          make_result(config.callback_wrapper(node.name, args, [&]() {
+            return (*callback)(args);
+          }));
+        } else {
+          make_result((*callback)(args));
+        }
+      }
+    } break;
+    case Op::Super: {
+      const auto args = get_argument_vector(node);
+      const size_t old_level = current_level;
+      const size_t level_diff = (args.size() == 1) ? args[0]->get<int>() : 1;
+      const size_t level = current_level + level_diff;
+
+      if (block_statement_stack.empty()) {
+        throw_renderer_error("super() call is not within a block", node);
+      }
+
+      if (level < 1 || level > template_stack.size() - 1) {
+        throw_renderer_error("level of super() call does not match parent templates (between 1 and " + std::to_string(template_stack.size() - 1) + ")", node);
+      }
+
+      const auto current_block_statement = block_statement_stack.back();
+      const Template* new_template = template_stack.at(level);
+      const Template* old_template = current_template;
+      const auto block_it = new_template->block_storage.find(current_block_statement->name);
+      if (block_it != new_template->block_storage.end()) {
+        current_template = new_template;
+        current_level = level;
+        block_it->second->block.accept(*this);
+        current_level = old_level;
+        current_template = old_template;
+      } else {
+        throw_renderer_error("could not find block with name '" + current_block_statement->name + "'", node);
+      }
+      make_result(nullptr);
+    } break;
+    case Op::Join: {
+      INJA_OP_TRY_BEGIN
+        const auto args = get_arguments<2>(node);
+        const auto separator = args[1]->get<json::string_t>();
+        std::ostringstream os;
+        std::string sep;
+        for (const auto& value : *args[0]) {
+          os << sep;
+          if (value.is_string()) {
+            os << value.get<std::string>(); // otherwise the value is surrounded with ""
+          } else {
+            os << value.dump();
+          }
+          sep = separator;
+        }
+        make_result(os.str());
+      INJA_OP_TRY_END_GRACEFUL("join")
+    } break;
+    case Op::None: {
+      // Unknown function in graceful error mode
+      if (config.graceful_errors) {
+        // Push nullptr to trigger graceful error handling
+        data_eval_stack.push(nullptr);
+        not_found_stack.emplace(node.name, &node);
+      }
+    } break;
+    }
+  }
+
+  void visit(const ExpressionListNode& node) override {
+    auto result = eval_expression_list(node);
+    if (result) {
+      print_data(result);
+    } else if (config.graceful_errors && node.length > 0) {
+      // In graceful mode, output the original template text
+      *output_stream << current_template->content.substr(node.pos, node.length);
+    }
+  }
+
+  void visit(const StatementNode&) override {}
+
+  void visit(const ForStatementNode&) override {}
+
+  /// Returns the data of the innermost loop, must be looked up again after inserting into the local data (e.g. for ordered_json)
+  json& loop_data() {
+    return additional_data["loop"];
+  }
+
+  void enter_loop(size_t size) {
+    json& loop = loop_data();
+    if (!loop.empty()) {
+      json parent = std::move(loop);
+      loop = json::object();
+      loop["parent"] = std::move(parent);
+    }
+    loop["is_first"] = true;
+    loop["is_last"] = (size <= 1);
+  }
+
+  void update_loop(size_t index, size_t size) {
+    json& loop = loop_data();
+    loop["index"] = index;
+    loop["index1"] = index + 1;
+    if (index == 1) {
+      loop["is_first"] = false;
+    }
+    if (index == size - 1) {
+      loop["is_last"] = true;
+    }
+  }
+
+  void leave_loop() {
+    json& loop = loop_data();
+    if (!loop["parent"].empty()) {
+      json parent = std::move(loop["parent"]);
+      loop = std::move(parent);
+    }
+  }
+
+  /// Renders the body of an array loop for each element, bind assigns the element with the given index to the loop variable
+  template <class Bind> void render_array_loop(const ForArrayStatementNode& node, size_t size, Bind bind) {
+    emit_event(InstrumentationEvent::ForLoopStart, node.value, "array", size);
+
+    enter_loop(size);
+    size_t index = 0;
+    for (; index < size; ++index) {
+      bind(index);
+      invalidate_memo(node.value);
+      invalidate_memo("loop");
+
+      update_loop(index, size);
+      node.body.accept(*this);
+    }
+
+    additional_data[static_cast<std::string>(node.value)].clear();
+    leave_loop();
+    invalidate_memo(node.value);
+    invalidate_memo("loop");
+
+    emit_event(InstrumentationEvent::ForLoopEnd, node.value, "array", index);
+  }
+
+  /// Renders the body of an object loop for each element, bind assigns the key and value with the given index to the loop variables
+  template <class Bind> void render_object_loop(const ForObjectStatementNode& node, size_t size, Bind bind) {
+    emit_event(InstrumentationEvent::ForLoopStart, node.value, "object", size);
+
+    enter_loop(size);
+    size_t index = 0;
+    for (; index < size; ++index) {
+      bind(index);
+      invalidate_memo(node.key);
+      invalidate_memo(node.value);
+      invalidate_memo("loop");
+
+      update_loop(index, size);
+      node.body.accept(*this);
+    }
+
+    additional_data[static_cast<std::string>(node.key)].clear();
+    additional_data[static_cast<std::string>(node.value)].clear();
+    leave_loop();
+    invalidate_memo(node.key);
+    invalidate_memo(node.value);
+    invalidate_memo("loop");
+
+    emit_event(InstrumentationEvent::ForLoopEnd, node.value, "object", index);
+  }
+
+  /// Binds the loop variable to elements of the data provider while rendering the loop, without looking up the whole container
+  template <class Loop> void render_provider_loop(const std::string& name, Loop loop) {
+    const auto previous = provider_aliases.find(name);
+    std::optional<DataProvider::Path> outer;
+    if (previous != provider_aliases.end()) {
+      outer = previous->second;
+    }
+
+    loop();
+
+    if (outer) {
+      provider_aliases[name] = std::move(*outer);
+    } else {
+      provider_aliases.erase(name);
+    }
+  }
+
+  /// Returns the loop variables of the body if the iterations of the loop can be rendered concurrently, or std::nullopt
+  const std::optional<std::vector<std::string>>& find_concurrent_loop(const ForArrayStatementNode& node) {
+    std::lock_guard<std::mutex> lock(concurrent_nodes->mutex);
+    const auto [it, inserted] = concurrent_nodes->loops.try_emplace({&node, template_stack.front()});
+    if (!inserted) {
+      return it->second;
+    }
+
+    // An iteration must not see variables of the previous one, including loop variables of the body that are read outside of their loop
+    EffectVisitor visitor(template_storage, function_storage, template_stack);
+    const auto effects = visitor.analyze(node.body);
+    const bool reads_loop_variable = std::any_of(effects.loop_variables.begin(), effects.loop_variables.end(),
+                                                 [&effects](const std::string& name) { return effects.free_variables.count(name) > 0; });
+    if (!effects.has_side_effects && !effects.sets_variables && !reads_loop_variable && effects.loop_variables.count(node.value) == 0) {
+      it->second = std::vector<std::string>(effects.loop_variables.begin(), effects.loop_variables.end());
+    }
+    return it->second;
+  }
+
+  /*!
+   * \brief Renders the iterations of a large loop in chunks on the thread pool, returns false if they are not independent.
+   *
+   * Every chunk is rendered by a copy of this renderer, with the loop data of
+   * its first iteration. The outputs and errors are written in order, and the
+   * variables are left as after a serial render.
+   */
+  bool render_loop_concurrently(const ForArrayStatementNode& node, const json& array) {
+    if (data_provider != nullptr || config.instrumentation_callback) {
+      return false;
+    }
+    const auto& body_loop_variables = find_concurrent_loop(node);
+    if (!body_loop_variables) {
+      return false;
+    }
+
+    const size_t size = array.size();
+    const std::string value_name = static_cast<std::string>(node.value);
+    enter_loop(size);
+
+    const size_t chunk_count = std::min(size, config.thread_pool->size() * 4);
+    const size_t chunk_size = (size + chunk_count - 1) / chunk_count;
+    std::vector<ConcurrentPart> parts((size + chunk_size - 1) / chunk_size);
+    try {
+      for (size_t c = 0; c < parts.size(); ++c) {
+        auto chunk = fork();
+        const size_t begin = c * chunk_size;
+        const size_t end = std::min(begin + chunk_size, size);
+        if (begin > 1) {
+          chunk->update_loop(1, size);
+        }
+        // Marks the loop variables of the body that are not bound by the chunk
+        for (const auto& name : *body_loop_variables) {
+          chunk->additional_data[name] = json(json::value_t::discarded);
+        }
+
+        auto& part = parts[c];
+        part.task = config.thread_pool->submit([chunk, &node, &array, &part, &value_name, begin, end, size]() {
+          std::ostringstream os;
+          chunk->output_stream = &os;
+          for (size_t index = begin; index < end; ++index) {
+            chunk->additional_data[value_name] = array[index];
+            chunk->invalidate_memo(value_name);
+            chunk->invalidate_memo("loop");
+            chunk->update_loop(index, size);
+            node.body.accept(*chunk);
+          }
+          part.output = std::move(os).str();
+          part.errors = std::move(chunk->render_errors);
+          part.local_data = std::move(chunk->additional_data);
+        });
+      }
+    } catch (...) {
+      for (const auto& part : parts) {
+        if (part.task.valid()) {
+          config.thread_pool->wait(part.task);
+        }
+      }
+      throw;
+    }
+    join(parts);
+
+    for (auto& part : parts) {
+      *output_stream << part.output;
+      render_errors.insert(render_errors.end(), part.errors.begin(), part.errors.end());
+    }
+
+    // Loop variables of the body keep the value of the last chunk that bound them
+    for (const auto& name : *body_loop_variables) {
+      for (auto part = parts.rbegin(); part != parts.rend(); ++part) {
+        if (!part->local_data[name].is_discarded()) {
+          additional_data[name] = std::move(part->local_data[name]);
+          break;
+        }
+      }
+      invalidate_memo(name);
+    }
+
+    // The loop data as after the last iteration
+    additional_data[value_name] = array[size - 1];
+    additional_data[value_name].clear();
+    update_loop(0, size);
+    update_loop(1, size);
+    update_loop(size - 1, size);
+    leave_loop();
+    invalidate_memo(value_name);
+    invalidate_memo("loop");
+    return true;
+  }
+
+  void visit(const ForArrayStatementNode& node) override {
+    if (const auto path = provider_loop_path(node.condition)) {
+      if (const auto size = data_provider->array_size(*path)) {
+        render_provider_loop(node.value, [&] {
+          render_array_loop(node, *size, [&](size_t index) {
+            auto element = *path;
+            element.push_back(std::to_string(index));
+            provider_aliases[node.value] = std::move(element);
+          });
+        });
+        return;
+      }
+    }
+
+    const auto result = eval_expression_list(node.condition);
+    // In graceful error mode, result can be nullptr if variable is missing
+    if (!result) {
+      if (config.graceful_errors) {
+        return; // Skip the loop if variable is missing in graceful mode
+      }
+      throw_renderer_error("expression could not be evaluated", node);
+    }
+    if (!result->is_array()) {
+      throw_renderer_error("object must be an array", node);
+    }
+
+    if (concurrent_nodes && config.concurrent_loop_size > 0 && result->size() >= std::max<size_t>(config.concurrent_loop_size, 2) &&
+        render_loop_concurrently(node, *result)) {
+      return;
+    }
+
+    auto it = result->begin();
+    render_array_loop(node, result->size(), [&](size_t index) {
+      if (index > 0) {
+        ++it;
+      }
+      additional_data[static_cast<std::string>(node.value)] = *it;
+    });
+  }
+
+  void visit(const ForObjectStatementNode& node) override {
+    if (const auto path = provider_loop_path(node.condition)) {
+      if (const auto keys = data_provider->object_keys(*path)) {
+        render_provider_loop(node.value, [&] {
+          render_object_loop(node, keys->size(), [&](size_t index) {
+            auto element = *path;
+            element.push_back((*keys)[index]);
+            additional_data[static_cast<std::string>(node.key)] = (*keys)[index];
+            provider_aliases[node.value] = std::move(element);
+          });
+        });
+        return;
+      }
+    }
+
+    const auto result = eval_expression_list(node.condition);
+    // In graceful error mode, result can be nullptr if variable is missing
+    if (!result) {
+      if (config.graceful_errors) {
+        return; // Skip the loop if variable is missing in graceful mode
+      }
+      throw_renderer_error("expression could not be evaluated", node);
+    }
+    if (!result->is_object()) {
+      throw_renderer_error("object must be an object", node);
+    }
+
+    auto it = result->begin();
+    render_object_loop(node, result->size(), [&](size_t index) {
+      if (index > 0) {
+        ++it;
+      }
+      additional_data[static_cast<std::string>(node.key)] = it.key();
+      additional_data[static_cast<std::string>(node.value)] = it.value();
+    });
+  }
+
+  void visit(const IfStatementNode& node) override {
+    const auto result = eval_expression_list(node.condition);
+    // In graceful error mode, result can be nullptr if variable is missing
+    if (result && truthy(result.get())) {
+      node.true_statement.accept(*this);
+    } else if (node.has_false_statement) {
+      node.false_statement.accept(*this);
+    }
+  }
+
+  void visit(const IncludeStatementNode& node) override {
+    emit_event(InstrumentationEvent::IncludeStart, node.file);
+
+    auto sub_renderer = Renderer(config, template_storage, function_storage);
+    sub_renderer.static_data = static_data;
+    sub_renderer.data_layers = data_layers;
+    sub_renderer.data_provider = data_provider;
+    sub_renderer.provider_values = provider_values;
+    sub_renderer.provider_aliases = provider_aliases;
+    sub_renderer.stop_token = stop_token;
+    sub_renderer.deadline = deadline;
+    sub_renderer.concurrent_nodes = concurrent_nodes;
+    const Template* included_template = node.linked;
+    if (included_template == nullptr) {
+      const auto included_template_it = template_storage.find(node.file);
+      if (included_template_it != template_storage.end()) {
+        included_template = &included_template_it->second;
+      }
+    }
+    if (included_template != nullptr) {
+      sub_renderer.render_to(*output_stream, *included_template, *data_input, &additional_data);
+      emit_event(InstrumentationEvent::IncludeEnd, node.file, "success");
+    } else if (config.throw_at_missing_includes) {
+      emit_event(InstrumentationEvent::IncludeEnd, node.file, "not_found");
+      throw_renderer_error("include '" + node.file + "' not found", node);
+    } else {
+      emit_event(InstrumentationEvent::IncludeEnd, node.file, "not_found_ignored");
+    }
+  }
+
+  void visit(const ExtendsStatementNode& node) override {
+    const Template* parent_template = node.linked;
+    if (parent_template == nullptr) {
+      const auto parent_template_it = template_storage.find(node.file);
+      if (parent_template_it != template_storage.end()) {
+        parent_template = &parent_template_it->second;
+      }
+    }
+    if (parent_template != nullptr) {
+      render_to(*output_stream, *parent_template, *data_input, &additional_data);
+      break_rendering = true;
+    } else if (config.throw_at_missing_includes) {
+      throw_renderer_error("extends '" + node.file + "' not found", node);
+    }
+  }
+
+  void visit(const BlockStatementNode& node) override {
+    const size_t old_level = current_level;
+    current_level = 0;
+    current_template = template_stack.front();
+    const auto block_it = current_template->block_storage.find(node.name);
+    if (block_it != current_template->block_storage.end()) {
+      block_statement_stack.emplace_back(&node);
+      block_it->second->block.accept(*this);
+      block_statement_stack.pop_back();
+    }
+    current_level = old_level;
+    current_template = template_stack.back();
+  }
+
+  /*!
+   * \brief Attempts to use in-place optimization for self-assignment patterns.
+   *
+   * Detects patterns like: {% set items = append(items, x) %}
+   * When the first argument of the function is the same variable being assigned,
+   * and the function has an in-place callback registered, we can mutate directly
+   * instead of copying.
+   *
+   * @return true if in-place optimization was used, false otherwise
+   */
+  bool try_inplace_self_assignment(const SetStatementNode& node, const std::string& ptr) {
+    // Check if the expression is a function call
+    // (Don't emit events for these common non-interesting cases)
+    if (!node.expression.root) {
+      return false;
+    }
+
+    auto* func_node = dynamic_cast<const FunctionNode*>(node.expression.root.get());
+    if (!func_node || func_node->operation != FunctionStorage::Operation::Callback) {
+      return false;
+    }
+
+    // Check if the function has at least one argument
+    if (func_node->arguments.empty()) {
+      return false;
+    }
+
+    // Check if the first argument is a simple variable reference matching our key
+    auto* data_node = dynamic_cast<const DataNode*>(func_node->arguments[0].get());
+    if (!data_node || data_node->name != node.key) {
+      return false;
+    }
+
+    // Look up the function and check if it has an in-place callback
+    auto func_data = function_storage.find_function(func_node->name, static_cast<int>(func_node->arguments.size()));
+    if (func_data.operation != FunctionStorage::Operation::Callback || !func_data.inplace_callback) {
+      // This IS interesting - self-assignment pattern detected but function doesn't have in-place variant
+      emit_event(InstrumentationEvent::InplaceOptSkipped, node.key, "no_inplace_cb:" + func_node->name);
+      return false;
+    }
+
+    // Get a mutable reference to the variable
+    json::json_pointer json_ptr(ptr);
+
+    // Ensure the variable exists (initialize to null if not)
+    if (!additional_data.contains(json_ptr)) {
+      // Variable doesn't exist yet - can't do in-place mutation
+      // Fall back to normal evaluation which will create it
+      emit_event(InstrumentationEvent::InplaceOptSkipped, node.key, "var_not_exists:" + func_node->name);
+      return false;
+    }
+
+    json& target = additional_data[json_ptr];
+
+    // Evaluate remaining arguments (skip first one since we're using the target directly)
+    Arguments remaining_args;
+    remaining_args.reserve(func_node->arguments.size() - 1);
+
+    for (size_t i = 1; i < func_node->arguments.size(); ++i) {
+      func_node->arguments[i]->accept(*this);
+      remaining_args.push_back(data_eval_stack.top());
+      data_eval_stack.pop();
+    }
+
+    // Call the in-place callback
+    if (config.callback_wrapper) {
+      // Wrap for tracing/instrumentation
+      // Note: we pass a dummy thunk since in-place doesn't return a value
+      // IMPORTANT: We return a small placeholder instead of target to avoid copying
+      // the potentially large array just for tracing purposes.
+      Arguments all_args;
+      all_args.push_back(&target);
+      for (const auto* arg : remaining_args) {
+        all_args.push_back(arg);
+      }
+      config.callback_wrapper(func_node->name, all_args, [&]() {
+        func_data.inplace_callback(target, remaining_args);
+        // Return size info instead of full array to avoid O(n) copy
+        return json{{"_inplace", true}, {"size", target.is_array() ? target.size() : 0}};
+      });
+    } else {
+      func_data.inplace_callback(target, remaining_args);
+    }
+
+    // Emit success event with array size for performance tracking
+    size_t target_size = target.is_array() ? target.size() : 0;
+    emit_event(InstrumentationEvent::InplaceOptUsed, node.key, func_node->name, target_size);
+
+    return true;
+  }
+
+  void visit(const SetStatementNode& node) override {
+    emit_event(InstrumentationEvent::SetStatementStart, node.key);
+
+    std::string ptr = node.key;
+    replace_substring(ptr, ".", "/");
+    ptr = "/" + ptr;
+
+    if (!provider_aliases.empty()) {
+      materialize_alias(node.key);
+    }
+
+    try {
+      // Try in-place optimization first
+      if (try_inplace_self_assignment(node, ptr)) {
+        invalidate_memo(node.key);
+        emit_event(InstrumentationEvent::SetStatementEnd, node.key, "inplace");
+        return;  // Successfully used in-place optimization
+      }
+
+      // Fall back to normal evaluation
+      auto result = eval_expression_list(node.expression);
+      if (result) {
+        additional_data[json::json_pointer(ptr)] = *result;
+        emit_event(InstrumentationEvent::SetStatementEnd, node.key, "copy");
+      } else if (config.graceful_errors) {
+        // In graceful error mode, set to null if expression failed
+        additional_data[json::json_pointer(ptr)] = nullptr;
+        emit_event(InstrumentationEvent::SetStatementEnd, node.key, "null_graceful");
+      } else {
+        throw_renderer_error("failed to evaluate expression for variable '" + node.key + "'", node);
+      }
+    } catch (const std::exception& e) {
+      if (config.graceful_errors) {
+        // In graceful error mode, set to null on exception
+        additional_data[json::json_pointer(ptr)] = nullptr;
+        emit_event(InstrumentationEvent::SetStatementEnd, node.key, "exception_graceful");
+      } else {
+        throw_renderer_error("failed to set variable '" + node.key + "': " + e.what(), node);
+      }
+    } catch (...) {
+      if (config.graceful_errors) {
+        // Catch all exceptions including SEH
+        additional_data[json::json_pointer(ptr)] = nullptr;
+        emit_event(InstrumentationEvent::SetStatementEnd, node.key, "unknown_exception");
+      } else {
+        throw_renderer_error("failed to set variable '" + node.key + "' with unknown exception", node);
+      }
+    }
+    invalidate_memo(node.key);
+  }
+
+  void visit(const RawStatementNode& node) override {
+    // Output raw content without any parsing or processing
+    output_stream->write(current_template->content.c_str() + node.content_pos, node.content_length);
+  }
+
+public:
+  explicit Renderer(const RenderConfig& config, const TemplateStorage& template_storage, const FunctionStorage& function_storage)
+      : config(config), template_storage(template_storage), function_storage(function_storage) {
+    if (config.thread_pool) {
+      concurrent_nodes = std::make_shared<ConcurrentNodes>();
+    }
+  }
+
+  static bool truthy(const json* data) {
+    // In graceful error mode, data can be nullptr for missing variables
+    if (!data) {
+      return false;
+    }
+    if (data->is_boolean()) {
+      return data->get<bool>();
+    } else if (data->is_number()) {
+      return (*data != 0);
+    } else if (data->is_null()) {
+      return false;
+    }
+    return !data->empty();
+  }
+
+  /// Looks up variables that are not set in the template in the provider before the json data, see DataProvider
+  void set_data_provider(const DataProvider* provider) {
+    data_provider = provider;
+    provider_values = (provider != nullptr) ? std::make_shared<std::map<DataProvider::Path, std::optional<json>>>() : nullptr;
+  }
+
+  /// Sets further data looked up after the data passed to render_to(), from top to bottom
+  void set_data_layers(std::vector<const json*> layers) {
+    data_layers = std::move(layers);
+  }
+
+  /// Stops rendering with an InterruptError once a stop is requested or the deadline passed
+  void set_interruption(std::stop_token token, std::chrono::steady_clock::time_point until) {
+    stop_token = std::move(token);
+    deadline = until;
+    nodes_since_deadline_check = 0;
+  }
+
+  /*!
+   * \brief Drops the state of the last render, so that the renderer can render again.
+   *
+   * The data provider and layers are kept, as are the capacities of the
+   * internal stacks and caches, so that repeated renders don't allocate them
+   * again.
+   */
+  void reset() {
+    current_level = 0;
+    template_stack.clear();
+    block_statement_stack.clear();
+    static_data = nullptr;
+    additional_data = json::object({{"loop", nullptr}});
+    data_tmp_stack.clear();
+    while (!data_eval_stack.empty()) {
+      data_eval_stack.pop();
+    }
+    while (!not_found_stack.empty()) {
+      not_found_stack.pop();
+    }
+    break_rendering = false;
+    render_errors.clear();
+    clear_memo();
+    if (provider_values) {
+      provider_values->clear();
+    }
+    provider_aliases.clear();
+    if (concurrent_nodes) {
+      concurrent_nodes = std::make_shared<ConcurrentNodes>();
+    }
+  }
+
+  void render_to(std::ostream& os, const Template& tmpl, const json& data, json* loop_data = nullptr) {
+    output_stream = &os;
+    current_template = &tmpl;
+    data_input = &data;
+    if (tmpl.static_data) {
+      static_data = tmpl.static_data.get();
+    }
+    if (loop_data != nullptr) {
+      additional_data = *loop_data;
+      clear_memo();
+    }
+
+    emit_event(InstrumentationEvent::RenderStart);
+
+    template_stack.emplace_back(current_template);
+    current_template->root.accept(*this);
+
+    data_tmp_stack.clear();
+
+    emit_event(InstrumentationEvent::RenderEnd);
+  }
+  
+  /*!
+   * \brief Evaluates a single expression of a template outside of a render.
+   *
+   * Returns nullptr if the expression could not be evaluated.
+   */
+  std::shared_ptr<json> evaluate(const Template& tmpl, const ExpressionListNode& expression, const json& data) {
+    current_template = &tmpl;
+    data_input = &data;
+    template_stack.assign(1, current_template);
+
+    const size_t errors_size = render_errors.size();
+    auto result = eval_expression_list(expression);
+    data_tmp_stack.clear();
+    return (render_errors.size() == errors_size) ? result : nullptr;
+  }
+
+  /// Returns the variables set by the template during the last render, including the loop data
+  const json& get_local_data() const {
+    return additional_data;
+  }
+
+  const std::vector<RenderErrorInfo>& get_render_errors() const {
+    return render_errors;
+  }
+  
+  void clear_render_errors() {
+    render_errors.clear();
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_RENDERER_HPP_
+
+// #include "template.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Partially evaluates a template against data that is known in advance.
+ *
+ * Everything that only depends on the static data is evaluated away:
+ * expressions are printed into the text or folded into literals, if
+ * statements with a static condition keep only the taken branch, and loops
+ * over static data without any dynamic part are unrolled into text. Adjacent
+ * text is merged.
+ *
+ * Rendering the specialized template with the dynamic data gives the same
+ * output as rendering the original with both, as long as the dynamic data
+ * does not contain the top-level keys of the static data. The static data is
+ * attached to the specialized template, so that remaining lookups and
+ * included templates can still read it.
+ */
+class Specializer {
+  using Op = FunctionStorage::Operation;
+
+  RenderConfig config;
+  const TemplateStorage& template_storage;
+  const FunctionStorage& function_storage;
+  const bool copy_expressions; // Never share function nodes with the source, so that they can be annotated separately
+  const bool fold_callbacks;   // Call deterministic callbacks with static arguments, their result is baked into the template
+
+  const Template* source;
+  std::shared_ptr<const json> static_data;
+  std::set<std::string> static_names;    // Top-level keys of the static data that are never assigned
+  std::map<std::string, size_t> reads;   // Number of reads of each variable in the whole template
+  bool has_includes {false};
+
+  Template result;
+  std::string pending_text;
+
+  static std::string root_name(std::string_view name) {
+    return AssignmentCollector::root_name(name);
+  }
+
+  static void count_reads(const ExpressionNode& expression, std::map<std::string, size_t>& counts) {
+    if (const auto* data = dynamic_cast<const DataNode*>(&expression)) {
+      counts[root_name(data->name)] += 1;
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(&expression)) {
+      for (const auto& argument : function->arguments) {
+        count_reads(*argument, counts);
+      }
+    }
+  }
+
+  static void count_reads(const AstNode& node, std::map<std::string, size_t>& counts, bool& has_includes) {
+    const auto count_expression = [&counts](const ExpressionListNode& expression) {
+      if (expression.root) {
+        count_reads(*expression.root, counts);
+      }
+    };
+
+    if (const auto* block = dynamic_cast<const BlockNode*>(&node)) {
+      for (const auto& n : block->nodes) {
+        count_reads(*n, counts, has_includes);
+      }
+    } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(&node)) {
+      count_expression(*expression);
+    } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(&node)) {
+      count_expression(loop->condition);
+      count_reads(loop->body, counts, has_includes);
+    } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(&node)) {
+      count_expression(condition->condition);
+      count_reads(condition->true_statement, counts, has_includes);
+      count_reads(condition->false_statement, counts, has_includes);
+    } else if (const auto* set = dynamic_cast<const SetStatementNode*>(&node)) {
+      count_expression(set->expression);
+    } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(&node)) {
+      count_reads(block_statement->block, counts, has_includes);
+    } else if (dynamic_cast<const IncludeStatementNode*>(&node) || dynamic_cast<const ExtendsStatementNode*>(&node)) {
+      has_includes = true;
+    }
+  }
+
+  /// Returns whether an expression only depends on static data and the given bound loop variables
+  bool is_static(const ExpressionNode& expression, const std::set<std::string>& bound) const {
+    if (dynamic_cast<const LiteralNode*>(&expression)) {
+      return true;
+
+    } else if (const auto* data = dynamic_cast<const DataNode*>(&expression)) {
+      const auto root = root_name(data->name);
+      if (root == "loop") {
+        // The parent loop might be dynamic
+        return bound.count(root) > 0 && data->name != "loop" && data->name.rfind("loop.parent", 0) != 0;
+      }
+      return static_names.count(root) > 0 || bound.count(root) > 0;
+
+    } else if (const auto* function = dynamic_cast<const FunctionNode*>(&expression)) {
+      switch (function->operation) {
+      case Op::Super:
+      case Op::None:
+      case Op::Exists:
+        return false;
+      case Op::AtId:
+        return is_static(*function->arguments[0], bound);
+      case Op::Callback: {
+        const auto function_data = function_storage.find_function(function->name, static_cast<int>(function->arguments.size()));
+        if (!fold_callbacks || function_data.operation != Op::Callback || !function_data.deterministic) {
+          return false;
+        }
+      } break;
+      default:
+        break;
+      }
+      return std::all_of(function->arguments.begin(), function->arguments.end(), [&](const std::shared_ptr<ExpressionNode>& argument) {
+        return is_static(*argument, bound);
+      });
+    }
+    return false;
+  }
+
+  /// Returns whether a statement can be rendered completely with the static data
+  bool is_static(const AstNode& node, const std::set<std::string>& bound) const {
+    if (const auto* block = dynamic_cast<const BlockNode*>(&node)) {
+      return std::all_of(block->nodes.begin(), block->nodes.end(), [&](const std::shared_ptr<AstNode>& n) {
+        return is_static(*n, bound);
+      });
+    } else if (dynamic_cast<const TextNode*>(&node) || dynamic_cast<const RawStatementNode*>(&node)) {
+      return true;
+    } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(&node)) {
+      return expression->root && is_static(*expression->root, bound);
+    } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(&node)) {
+      return condition->condition.root && is_static(*condition->condition.root, bound) && is_static(condition->true_statement, bound) &&
+             is_static(condition->false_statement, bound);
+    } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(&node)) {
+      if (!loop->condition.root || !is_static(*loop->condition.root, bound)) {
+        return false;
+      }
+
+      // The loop variables stay visible after the loop, so they must not be read anywhere else
+      std::set<std::string> variables {"loop"};
+      if (const auto* array_loop = dynamic_cast<const ForArrayStatementNode*>(loop)) {
+        variables.insert(root_name(array_loop->value));
+      } else if (const auto* object_loop = dynamic_cast<const ForObjectStatementNode*>(loop)) {
+        variables.insert(root_name(object_loop->key));
+        variables.insert(root_name(object_loop->value));
+      }
+      if (bound.empty()) {
+        if (has_includes) {
+          return false;
+        }
+        std::map<std::string, size_t> loop_reads;
+        bool loop_includes = false;
+        count_reads(*loop, loop_reads, loop_includes);
+        for (const auto& variable : variables) {
+          if (reads.count(variable) > 0 && reads.at(variable) != loop_reads[variable]) {
+            return false;
+          }
+        }
+      }
+
+      auto body_bound = bound;
+      body_bound.insert(variables.begin(), variables.end());
+      return is_static(loop->body, body_bound);
+    }
+    return false;
+  }
+
+  /// Renders a static statement with the static data, returns false if that fails
+  bool render_static(const std::shared_ptr<AstNode>& node, std::string& output) const {
+    Template tmpl(source->content);
+    tmpl.root.nodes.push_back(node);
+
+    std::ostringstream os;
+    Renderer renderer(config, template_storage, function_storage);
+    try {
+      renderer.render_to(os, tmpl, *static_data);
+    } catch (const std::exception&) {
+      return false;
+    }
+    if (!renderer.get_render_errors().empty()) {
+      return false;
+    }
+    output = os.str();
+    return true;
+  }
+
+  std::shared_ptr<json> evaluate(const std::shared_ptr<ExpressionNode>& expression) const {
+    ExpressionListNode expression_list(expression->pos);
+    expression_list.root = expression;
+
+    Renderer renderer(config, template_storage, function_storage);
+    try {
+      return renderer.evaluate(*source, expression_list, *static_data);
+    } catch (const std::exception&) {
+      return nullptr;
+    }
+  }
+
+  /// Replaces all static subexpressions by literals
+  std::shared_ptr<ExpressionNode> fold(const std::shared_ptr<ExpressionNode>& expression) const {
+    if (dynamic_cast<const LiteralNode*>(expression.get())) {
+      return expression;
+    }
+
+    if (is_static(*expression, {})) {
+      const auto value = evaluate(expression);
+      // Containers are kept as lookups into the static data instead of being copied
+      if (value && (dynamic_cast<const FunctionNode*>(expression.get()) || !value->is_structured())) {
+        return std::make_shared<LiteralNode>(*value, expression->pos);
+      }
+      if (!copy_expressions) {
+        return expression;
+      }
+    }
+
+    const auto* function = dynamic_cast<const FunctionNode*>(expression.get());
+    if (function == nullptr) {
+      return expression;
+    }
+
+    auto folded = std::make_shared<FunctionNode>(*function);
+    folded->memo_key = nullptr;
+    folded->memo_dependencies.clear();
+
+    bool changed = false;
+    const size_t foldable_arguments = (function->operation == Op::AtId) ? 1 : function->arguments.size();
+    for (size_t i = 0; i < foldable_arguments; ++i) {
+      folded->arguments[i] = fold(function->arguments[i]);
+      changed = changed || (folded->arguments[i] != function->arguments[i]);
+    }
+    return (changed || copy_expressions) ? folded : expression;
+  }
+
+  void fold(const ExpressionListNode& expression, ExpressionListNode& target) const {
+    target.pos = expression.pos;
+    target.length = expression.length;
+    target.root = expression.root ? fold(expression.root) : nullptr;
+  }
+
+  void flush(BlockNode& target) {
+    if (pending_text.empty()) {
+      return;
+    }
+    target.nodes.push_back(std::make_shared<TextNode>(result.content.size(), pending_text.size()));
+    result.content += pending_text;
+    pending_text.clear();
+  }
+
+  /// Appends the specialized nodes of a block to the target block, without flushing the text at the end
+  void specialize_nodes(const BlockNode& block, BlockNode& target) {
+    for (const auto& node : block.nodes) {
+      if (const auto* text = dynamic_cast<const TextNode*>(node.get())) {
+        pending_text.append(source->content, text->pos, text->length);
+
+      } else if (const auto* expression = dynamic_cast<const ExpressionListNode*>(node.get())) {
+        std::string output;
+        if (is_static(*expression, {}) && render_static(node, output)) {
+          pending_text += output;
+          continue;
+        }
+
+        flush(target);
+        auto specialized = std::make_shared<ExpressionListNode>();
+        fold(*expression, *specialized);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node.get())) {
+        if (condition->condition.root && is_static(*condition->condition.root, {})) {
+          const auto value = evaluate(condition->condition.root);
+          if (value) {
+            // Only the taken branch remains
+            if (Renderer::truthy(value.get())) {
+              specialize_nodes(condition->true_statement, target);
+            } else if (condition->has_false_statement) {
+              specialize_nodes(condition->false_statement, target);
+            }
+            continue;
+          }
+        }
+
+        flush(target);
+        auto specialized = std::make_shared<IfStatementNode>(condition->is_nested, &target, condition->pos);
+        fold(condition->condition, specialized->condition);
+        specialized->has_false_statement = condition->has_false_statement;
+        specialize_block(condition->true_statement, specialized->true_statement);
+        specialize_block(condition->false_statement, specialized->false_statement);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(node.get())) {
+        std::string output;
+        if (is_static(*loop, {}) && render_static(node, output)) {
+          pending_text += output;
+          continue;
+        }
+
+        flush(target);
+        std::shared_ptr<ForStatementNode> specialized;
+        if (const auto* array_loop = dynamic_cast<const ForArrayStatementNode*>(loop)) {
+          specialized = std::make_shared<ForArrayStatementNode>(array_loop->value, &target, loop->pos);
+        } else if (const auto* object_loop = dynamic_cast<const ForObjectStatementNode*>(loop)) {
+          specialized = std::make_shared<ForObjectStatementNode>(object_loop->key, object_loop->value, &target, loop->pos);
+        }
+        fold(loop->condition, specialized->condition);
+        specialize_block(loop->body, specialized->body);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* set = dynamic_cast<const SetStatementNode*>(node.get())) {
+        flush(target);
+        auto specialized = std::make_shared<SetStatementNode>(set->key, set->pos);
+        fold(set->expression, specialized->expression);
+        target.nodes.push_back(specialized);
+
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node.get())) {
+        flush(target);
+        auto specialized = std::make_shared<BlockStatementNode>(&target, block_statement->name, block_statement->pos);
+        specialize_block(block_statement->block, specialized->block);
+        result.block_storage[block_statement->name] = specialized;
+        target.nodes.push_back(specialized);
+
+      } else {
+        // Includes, extends and raw statements are kept as they are
+        flush(target);
+        target.nodes.push_back(node);
+      }
+    }
+  }
+
+  void specialize_block(const BlockNode& block, BlockNode& target) {
+    specialize_nodes(block, target);
+    flush(target);
+  }
+
+public:
+  explicit Specializer(const RenderConfig& config, const TemplateStorage& template_storage, const FunctionStorage& function_storage,
+                       bool copy_expressions = false, bool fold_callbacks = true)
+      : config(config), template_storage(template_storage), function_storage(function_storage), copy_expressions(copy_expressions),
+        fold_callbacks(fold_callbacks) {
+    this->config.instrumentation_callback = nullptr;
+  }
+
+  Template specialize(const Template& tmpl, const json& data) {
+    source = &tmpl;
+
+    // Specializing a specialized template again accumulates the static data
+    auto merged = std::make_shared<json>(tmpl.static_data ? *tmpl.static_data : json::object());
+    if (data.is_object()) {
+      merged->update(data);
+    }
+    static_data = merged;
+
+    // Assigned variables shadow the static data
+    AssignmentCollector assignments;
+    tmpl.root.accept(assignments);
+    static_names.clear();
+    for (auto it = static_data->begin(); it != static_data->end(); ++it) {
+      if (assignments.variables.count(it.key()) == 0) {
+        static_names.insert(it.key());
+      }
+    }
+
+    reads.clear();
+    has_includes = false;
+    count_reads(tmpl.root, reads, has_includes);
+
+    // Keep the original content, so that the positions of all kept nodes stay valid
+    result = Template(tmpl.content);
+    result.static_data = static_data;
+    pending_text.clear();
+    specialize_block(tmpl.root, result.root);
+
+    // Blocks in removed branches can still be rendered from a parent template
+    for (const auto& [name, block_statement] : tmpl.block_storage) {
+      if (result.block_storage.count(name) == 0) {
+        auto specialized = std::make_shared<BlockStatementNode>(nullptr, name, block_statement->pos);
+        specialize_block(block_statement->block, specialized->block);
+        result.block_storage[name] = specialized;
+      }
+    }
+    return std::move(result);
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_SPECIALIZER_HPP_
+
+// #include "template.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief The optimized form of a template, valid for the storages it was compiled against.
+ */
+struct CompiledTemplate {
+  Template tmpl;
+  std::map<std::string, Template> includes; // Compiled included templates, linked into the include statements
+  std::shared_ptr<const TemplateStorage> template_storage;
+  std::shared_ptr<const FunctionStorage> function_storage;
+  bool html_autoescape;
+
+  /// Returns whether the template can be rendered instead of its source with the given storages and config
+  bool is_current(const TemplateStorage* templates, const FunctionStorage* functions, const RenderConfig& config) const {
+    return template_storage.get() == templates && function_storage.get() == functions && html_autoescape == config.html_autoescape;
+  }
+};
+
+/*!
+ * \brief Compiles a template into an optimized copy for frequent rendering.
+ *
+ * The copy has all constant expressions of literals and built-in functions
+ * folded, its loop-invariant and repeated expressions annotated by the
+ * Optimizer, and its include statements linked to compiled copies of the
+ * included templates. Callbacks are never called while compiling. The source
+ * template is not modified, so it can be rendered concurrently.
+ */
+class TemplateCompiler {
+  RenderConfig config;
+  std::shared_ptr<const TemplateStorage> template_storage;
+  std::shared_ptr<const FunctionStorage> function_storage;
+
+  CompiledTemplate* compiled {nullptr};
+
+  const Template* compile_include(const std::string& name) {
+    const auto it = compiled->includes.find(name);
+    if (it != compiled->includes.end()) {
+      return &it->second;
+    }
+
+    const auto source = template_storage->find(name);
+    if (source == template_storage->end()) {
+      return nullptr;
+    }
+
+    // Inserted before compiling, so that recursive includes link to the same template
+    auto& result = compiled->includes[name];
+    result = compile_single(source->second);
+    return &result;
+  }
+
+  void link(BlockNode& block) {
+    for (auto& node : block.nodes) {
+      if (const auto* include = dynamic_cast<const IncludeStatementNode*>(node.get())) {
+        if (include->linked == nullptr) {
+          auto linked = std::make_shared<IncludeStatementNode>(include->file, include->pos);
+          linked->linked = compile_include(include->file);
+          node = linked;
+        }
+      } else if (auto* condition = dynamic_cast<IfStatementNode*>(node.get())) {
+        link(condition->true_statement);
+        link(condition->false_statement);
+      } else if (auto* loop = dynamic_cast<ForStatementNode*>(node.get())) {
+        link(loop->body);
+      } else if (auto* block_statement = dynamic_cast<BlockStatementNode*>(node.get())) {
+        link(block_statement->block);
+      }
+    }
+  }
+
+  Template compile_single(const Template& tmpl) {
+    // Specializing without data folds the constant expressions into a separate AST. Callbacks are only
+    // deterministic within a render, so they are never called here.
+    Specializer specializer(config, *template_storage, *function_storage, true, false);
+    Template result = specializer.specialize(tmpl, json::object());
+    result.static_data = tmpl.static_data;
+
+    Optimizer optimizer(*function_storage);
+    optimizer.optimize(result);
+
+    link(result.root);
+    for (auto& [name, block_statement] : result.block_storage) {
+      link(block_statement->block);
+    }
+    return result;
+  }
+
+public:
+  explicit TemplateCompiler(const RenderConfig& config, std::shared_ptr<const TemplateStorage> template_storage,
+                            std::shared_ptr<const FunctionStorage> function_storage)
+      : config(config), template_storage(std::move(template_storage)), function_storage(std::move(function_storage)) {
+    this->config.instrumentation_callback = nullptr;
+  }
+
+  std::shared_ptr<const CompiledTemplate> compile(const Template& tmpl) {
+    auto result = std::make_shared<CompiledTemplate>();
+    result->template_storage = template_storage;
+    result->function_storage = function_storage;
+    result->html_autoescape = config.html_autoescape;
+
+    compiled = result.get();
+    result->tmpl = compile_single(tmpl);
+    compiled = nullptr;
+    return result;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_COMPILER_HPP_
+
+// #include "cost.hpp"
+#ifndef INCLUDE_INJA_COST_HPP_
+#define INCLUDE_INJA_COST_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// #include "analysis.hpp"
+
+// #include "exceptions.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "json.hpp"
+
+// #include "node.hpp"
+
+// #include "template.hpp"
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Static cost of a single for loop of a template.
+ */
+struct LoopCost {
+  std::string template_name;  // Template containing the loop ("" for the analyzed template itself)
+  SourceLocation location;
+  size_t depth;               // Nesting depth, starting at 1 for outermost loops
+  std::string iterated_path;  // Input path of the iterated container, empty if it is computed
+  size_t assumed_size;        // Iterations from the sample data, or the assumed default
+};
+
+/*!
+ * \brief Structured report of the estimated render cost of a Template.
+ */
+struct CostReport {
+  size_t max_loop_depth {0};
+  std::vector<LoopCost> loops;
+  /// Number of callback call sites per loop nesting level (index 0 is outside of loops)
+  std::vector<size_t> callbacks_per_depth;
+  /// Number of include and extends statements reached, including those of included templates
+  size_t include_fan_out {0};
+  /// Number of distinct templates reached through includes and extends
+  size_t included_templates {0};
+  /// Set statements inside loops that copy their value because they cannot use the in-place path
+  size_t set_copies_in_loops {0};
+  /// String concatenations (`+` with a string literal operand) inside loops
+  size_t string_concatenations_in_loops {0};
+  /// Estimated number of evaluation steps of a single render, weighted by loop sizes
+  double estimated_cost {0.0};
+};
+
+/*!
+ * \brief A visitor estimating the render cost of a Template from its AST.
+ *
+ * Each visited node costs one step, multiplied by the sizes of the loops
+ * around it. Loop sizes are taken from sample data if given, else a fixed
+ * size is assumed. Callbacks, includes and copying set statements are
+ * weighted as more expensive than builtin operations.
+ */
+class CostVisitor : public AnalysisVisitor {
+  static constexpr double callback_weight {10.0};
+  static constexpr double include_weight {5.0};
+  static constexpr double set_copy_weight {20.0};
+
+  const json* sample_data;
+  size_t assumed_loop_size;
+
+  CostReport report;
+  std::vector<double> multipliers {1.0};
+
+  double multiplier() const {
+    return multipliers.back();
+  }
+
+  static size_t container_size(const json& data, const DataPath& path, size_t depth) {
+    if (depth == path.size()) {
+      return (data.is_array() || data.is_object()) ? data.size() : 0;
+    }
+
+    const std::string& token = path[depth];
+    if (token == TemplateAnalysis::any_element) {
+      size_t result = 0;
+      for (const auto& element : data) {
+        result = std::max(result, container_size(element, path, depth + 1));
+      }
+      return result;
+    }
+
+    if (data.is_object()) {
+      const auto it = data.find(token);
+      return (it != data.end()) ? container_size(*it, path, depth + 1) : 0;
+    } else if (data.is_array() && !token.empty() && std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+      const size_t index = std::stoul(token);
+      return (index < data.size()) ? container_size(data[index], path, depth + 1) : 0;
+    }
+    return 0;
+  }
+
+  bool uses_inplace_path(const SetStatementNode& node) const {
+    const auto* function = dynamic_cast<const FunctionNode*>(node.expression.root.get());
+    if (function == nullptr || function->operation != Op::Callback || function->arguments.empty()) {
+      return false;
+    }
+    const auto* first = dynamic_cast<const DataNode*>(function->arguments[0].get());
+    if (first == nullptr || first->name != node.key) {
+      return false;
+    }
+    const auto function_data = function_storage.find_function(function->name, static_cast<int>(function->arguments.size()));
+    return static_cast<bool>(function_data.inplace_callback);
+  }
+
+  void enter_loop(const ForStatementNode& node, const ValueRef& container) override {
+    LoopCost loop;
+    loop.template_name = template_stack.back();
+    loop.location = get_source_location(template_chain.back()->content, node.pos);
+    loop.depth = loop_depth + 1;
+    loop.assumed_size = assumed_loop_size;
+    if (container.kind == ValueRef::Kind::Input) {
+      loop.iterated_path = join_json_pointer(container.path);
+      if (sample_data != nullptr) {
+        loop.assumed_size = container_size(*sample_data, container.path, 0);
+      }
+    }
+
+    report.max_loop_depth = std::max(report.max_loop_depth, loop.depth);
+    multipliers.push_back(multiplier() * static_cast<double>(std::max<size_t>(loop.assumed_size, 1)));
+    report.loops.push_back(std::move(loop));
+  }
+
+  void exit_loop(const ForStatementNode&) override {
+    multipliers.pop_back();
+  }
+
+  void visit(const BlockNode& node) override {
+    report.estimated_cost += multiplier() * static_cast<double>(node.nodes.size());
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const DataNode& node) override {
+    report.estimated_cost += multiplier();
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const FunctionNode& node) override {
+    if (node.operation == Op::Callback) {
+      if (report.callbacks_per_depth.size() <= loop_depth) {
+        report.callbacks_per_depth.resize(loop_depth + 1, 0);
+      }
+      report.callbacks_per_depth[loop_depth] += 1;
+      report.estimated_cost += multiplier() * callback_weight;
+    } else {
+      report.estimated_cost += multiplier();
+    }
+
+    if (node.operation == Op::Add && loop_depth > 0) {
+      const bool has_string_literal = std::any_of(node.arguments.begin(), node.arguments.end(), [](const std::shared_ptr<ExpressionNode>& argument) {
+        const auto* literal = dynamic_cast<const LiteralNode*>(argument.get());
+        return literal != nullptr && literal->value.is_string();
+      });
+      if (has_string_literal) {
+        report.string_concatenations_in_loops += 1;
+      }
+    }
+
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const IncludeStatementNode& node) override {
+    report.include_fan_out += 1;
+    report.estimated_cost += multiplier() * include_weight;
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const ExtendsStatementNode& node) override {
+    report.include_fan_out += 1;
+    report.estimated_cost += multiplier() * include_weight;
+    AnalysisVisitor::visit(node);
+  }
+
+  void visit(const SetStatementNode& node) override {
+    if (loop_depth > 0 && !uses_inplace_path(node)) {
+      report.set_copies_in_loops += 1;
+      report.estimated_cost += multiplier() * set_copy_weight;
+    }
+    AnalysisVisitor::visit(node);
+  }
+
+public:
+  explicit CostVisitor(const TemplateStorage& template_storage, const FunctionStorage& function_storage, const json* sample_data = nullptr,
+                       size_t assumed_loop_size = 10)
+      : AnalysisVisitor(template_storage, function_storage), sample_data(sample_data), assumed_loop_size(assumed_loop_size) {}
+
+  CostReport estimate(const Template& tmpl) {
+    report = CostReport();
+    multipliers.assign(1, 1.0);
+
+    const auto analysis = analyze(tmpl);
+    report.included_templates = analysis.included_templates().size();
+    return std::move(report);
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_COST_HPP_
+
+// #include "data_file.hpp"
+
+// #include "data_provider.hpp"
+
+// #include "environment.hpp"
+#ifndef INCLUDE_INJA_ENVIRONMENT_HPP_
+#define INCLUDE_INJA_ENVIRONMENT_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// #include "json.hpp"
+
+// #include "analysis.hpp"
+
+// #include "bundle.hpp"
+
+// #include "config.hpp"
+
+// #include "data_file.hpp"
+
+// #include "data_provider.hpp"
+
+// #include "callback_cache.hpp"
+#ifndef INCLUDE_INJA_CALLBACK_CACHE_HPP_
+#define INCLUDE_INJA_CALLBACK_CACHE_HPP_
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// #include "json.hpp"
+
+// #include "config.hpp"
+
+// #include "function_storage.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Configuration for callback caching behavior.
+ */
+struct CallbackCacheConfig {
+  /// Time-to-live for cached entries (default: 5 seconds)
+  std::chrono::milliseconds ttl{5000};
+
+  /// Maximum number of entries in the cache (0 = unlimited)
+  size_t max_entries{10000};
+
+  /// Whether to cache void callbacks (callbacks that return empty json)
+  /// Generally should be false since void callbacks are for side effects
+  bool cache_void_callbacks{false};
+};
+
+/*!
+ * \brief Thread-safe LRU cache with TTL for callback results.
+ *
+ * This cache stores the results of callback function calls, keyed by
+ * the function name and serialized arguments. It uses:
+ * - LRU eviction when max_entries is reached
+ * - TTL-based expiration for freshness
+ * - Read-write locking for thread safety (readers don't block each other)
+ *
+ * Usage:
+ * @code
+ * CallbackCache cache(CallbackCacheConfig{
+ *     .ttl = std::chrono::seconds(5),
+ *     .max_entries = 10000
+ * });
+ *
+ * // Use as a callback wrapper
+ * env.set_callback_wrapper(cache.make_caching_wrapper());
+ * @endcode
+ */
+class CallbackCache {
+public:
+  using Clock = std::chrono::steady_clock;
+  using TimePoint = Clock::time_point;
+
+  /// Predicate function to determine if a callback should be cached
+  /// Return true to cache, false to skip caching
+  using CachePredicate = std::function<bool(const std::string& function_name)>;
+
+private:
+  struct CacheEntry {
+    json value;
+    TimePoint expiry;
+    std::string key;
+  };
+
+  // LRU list: front = most recently used, back = least recently used
+  using LruList = std::list<CacheEntry>;
+  using LruIterator = LruList::iterator;
+
+  // Map from cache key to LRU list iterator
+  std::unordered_map<std::string, LruIterator> cache_map_;
+  LruList lru_list_;
+
+  mutable std::shared_mutex mutex_;
+  CallbackCacheConfig config_;
+  CachePredicate should_cache_;
+
+  // Statistics
+  mutable std::atomic<uint64_t> hits_{0};
+  mutable std::atomic<uint64_t> misses_{0};
+  mutable std::atomic<uint64_t> evictions_{0};
+
+  /*!
+   * \brief Generates a cache key from function name and arguments.
+   *
+   * The key format is: "function_name:arg1_json,arg2_json,..."
+   * Arguments are serialized to compact JSON strings.
+   */
+  static std::string make_cache_key(const std::string& function_name, const Arguments& args) {
+    std::string key = function_name;
+    key.reserve(function_name.size() + args.size() * 32); // Estimate
+
+    key += ':';
+    bool first = true;
+    for (const auto* arg : args) {
+      if (!first) {
+        key += ',';
+      }
+      first = false;
+
+      if (arg) {
+        // Use compact JSON serialization
+        key += arg->dump(-1);
+      } else {
+        key += "null";
+      }
+    }
+
+    return key;
+  }
+
+  /*!
+   * \brief Removes expired entries (called while holding write lock).
+   */
+  void remove_expired_entries_locked() {
+    const auto now = Clock::now();
+
+    // Remove from back (least recently used) while expired
+    while (!lru_list_.empty() && lru_list_.back().expiry <= now) {
+      cache_map_.erase(lru_list_.back().key);
+      lru_list_.pop_back();
+      ++evictions_;
+    }
+  }
+
+  /*!
+   * \brief Evicts entries if over capacity (called while holding write lock).
+   */
+  void evict_if_needed_locked() {
+    if (config_.max_entries == 0) {
+      return; // Unlimited
+    }
+
+    while (cache_map_.size() >= config_.max_entries && !lru_list_.empty()) {
+      cache_map_.erase(lru_list_.back().key);
+      lru_list_.pop_back();
+      ++evictions_;
+    }
+  }
+
+public:
+  /*!
+   * \brief Constructs a callback cache with the given configuration.
+   */
+  explicit CallbackCache(const CallbackCacheConfig& config = CallbackCacheConfig{})
+      : config_(config) {}
+
+  /*!
+   * \brief Sets a predicate function to determine which callbacks should be cached.
+   *
+   * @param predicate Function that returns true if the callback should be cached.
+   *                  If not set, all callbacks are cached.
+   *
+   * Example:
+   * @code
+   * cache.set_cache_predicate([](const std::string& name) {
+   *     // Don't cache callbacks with side effects
+   *     return name != "random" && name != "capture_screenshot";
+   * });
+   * @endcode
+   */
+  void set_cache_predicate(CachePredicate predicate) {
+    should_cache_ = std::move(predicate);
+  }
+
+  /*!
+   * \brief Attempts to get a cached value.
+   *
+   * @param function_name The name of the callback function
+   * @param args The arguments passed to the callback
+   * @param[out] result The cached result if found and not expired
+   * @return true if a valid cached value was found, false otherwise
+   */
+  bool try_get(const std::string& function_name, const Arguments& args, json& result) {
+    const std::string key = make_cache_key(function_name, args);
+    const auto now = Clock::now();
+
+    // Try read lock first for cache hit (common case)
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+
+      auto it = cache_map_.find(key);
+      if (it != cache_map_.end() && it->second->expiry > now) {
+        result = it->second->value;
+        ++hits_;
+        return true;
+      }
+    }
+
+    ++misses_;
+    return false;
+  }
+
+  /*!
+   * \brief Stores a value in the cache.
+   *
+   * @param function_name The name of the callback function
+   * @param args The arguments passed to the callback
+   * @param value The result to cache
+   */
+  void put(const std::string& function_name, const Arguments& args, const json& value) {
+    const std::string key = make_cache_key(function_name, args);
+    put_with_key(key, value);
+  }
+
+  /*!
+   * \brief Attempts to get a cached value using a pre-computed cache key.
+   *
+   * This variant is useful when the cache key includes additional context
+   * beyond function name and arguments (e.g., actor-specific context variables).
+   *
+   * @param key The pre-computed cache key
+   * @param[out] result The cached result if found and not expired
+   * @return true if a valid cached value was found, false otherwise
+   */
+  bool try_get_with_key(const std::string& key, json& result) {
+    const auto now = Clock::now();
+
+    // Try read lock first for cache hit (common case)
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+
+      auto it = cache_map_.find(key);
+      if (it != cache_map_.end() && it->second->expiry > now) {
+        result = it->second->value;
+        ++hits_;
+        return true;
+      }
+    }
+
+    ++misses_;
+    return false;
+  }
+
+  /*!
+   * \brief Stores a value in the cache using a pre-computed cache key.
+   *
+   * This variant is useful when the cache key includes additional context
+   * beyond function name and arguments (e.g., actor-specific context variables).
+   *
+   * @param key The pre-computed cache key
+   * @param value The result to cache
+   */
+  void put_with_key(const std::string& key, const json& value) {
+    // Don't cache void/empty results unless configured to
+    if (!config_.cache_void_callbacks && value.is_null()) {
+      return;
+    }
+
+    const auto expiry = Clock::now() + config_.ttl;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+
+    // Remove expired entries periodically
+    remove_expired_entries_locked();
+
+    // Check if key already exists
+    auto it = cache_map_.find(key);
+    if (it != cache_map_.end()) {
+      // Update existing entry and move to front
+      it->second->value = value;
+      it->second->expiry = expiry;
+      lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+    } else {
+      // Evict if needed before inserting
+      evict_if_needed_locked();
+
+      // Insert new entry at front
+      lru_list_.push_front(CacheEntry{value, expiry, key});
+      cache_map_[key] = lru_list_.begin();
+    }
+  }
+
+  /*!
+   * \brief Clears all cached entries.
+   */
+  void clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    cache_map_.clear();
+    lru_list_.clear();
+  }
+
+  /*!
+   * \brief Invalidates a specific callback's cached entries.
+   *
+   * This removes all cached entries for the given function name,
+   * regardless of arguments.
+   *
+   * @param function_name The callback function name to invalidate
+   * @return Number of entries removed
+   */
+  size_t invalidate(const std::string& function_name) {
+    const std::string prefix = function_name + ":";
+    size_t removed = 0;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+
+    for (auto it = lru_list_.begin(); it != lru_list_.end(); ) {
+      if (it->key.compare(0, prefix.size(), prefix) == 0) {
+        cache_map_.erase(it->key);
+        it = lru_list_.erase(it);
+        ++removed;
+      } else {
+        ++it;
+      }
+    }
+
+    return removed;
+  }
+
+  /*!
+   * \brief Creates a CallbackWrapper that caches callback results.
+   *
+   * This wrapper can be passed to Environment::set_callback_wrapper().
+   * It will cache results based on function name and arguments.
+   *
+   * @return A CallbackWrapper function that provides caching
+   *
+   * Example:
+   * @code
+   * auto cache = std::make_shared<CallbackCache>();
+   * env.set_callback_wrapper(cache->make_caching_wrapper());
+   * @endcode
+   */
+  CallbackWrapper make_caching_wrapper() {
+    return [this](const std::string& function_name,
+                  const Arguments& args,
+                  const std::function<json()>& callback_thunk) -> json {
+      // Check predicate first
+      if (should_cache_ && !should_cache_(function_name)) {
+        return callback_thunk();
+      }
+
+      // Try to get from cache
+      json cached_result;
+      if (try_get(function_name, args, cached_result)) {
+        return cached_result;
+      }
+
+      // Cache miss - execute callback
+      json result = callback_thunk();
+
+      // Store in cache
+      put(function_name, args, result);
+
+      return result;
+    };
+  }
+
+  /*!
+   * \brief Creates a CallbackWrapper that combines caching with another wrapper.
+   *
+   * This allows chaining caching with other instrumentation (e.g., tracing).
+   * The inner wrapper is called on cache misses.
+   *
+   * @param inner_wrapper The wrapper to call on cache misses (e.g., for tracing)
+   * @return A CallbackWrapper that caches and delegates to inner_wrapper
+   *
+   * Example:
+   * @code
+   * auto cache = std::make_shared<CallbackCache>();
+   * auto tracing_wrapper = [&ctx](const std::string& name, const Arguments& args,
+   *                               const std::function<json()>& thunk) {
+   *     auto span = ctx.StartSpan("decorator:" + name);
+   *     auto result = thunk();
+   *     ctx.EndSpan(span);
+   *     return result;
+   * };
+   * env.set_callback_wrapper(cache->make_caching_wrapper_with_inner(tracing_wrapper));
+   * @endcode
+   */
+  CallbackWrapper make_caching_wrapper_with_inner(const CallbackWrapper& inner_wrapper) {
+    return [this, inner_wrapper](const std::string& function_name,
+                                  const Arguments& args,
+                                  const std::function<json()>& callback_thunk) -> json {
+      // Check predicate first
+      if (should_cache_ && !should_cache_(function_name)) {
+        if (inner_wrapper) {
+          return inner_wrapper(function_name, args, callback_thunk);
+        }
+        return callback_thunk();
+      }
+
+      // Try to get from cache
+      json cached_result;
+      if (try_get(function_name, args, cached_result)) {
+        return cached_result;
+      }
+
+      // Cache miss - execute through inner wrapper if present
+      json result;
+      if (inner_wrapper) {
+        result = inner_wrapper(function_name, args, callback_thunk);
+      } else {
+        result = callback_thunk();
+      }
+
+      // Store in cache
+      put(function_name, args, result);
+
+      return result;
+    };
+  }
+
+  // Statistics accessors
+
+  /// Returns the number of cache hits
+  uint64_t hits() const { return hits_.load(); }
+
+  /// Returns the number of cache misses
+  uint64_t misses() const { return misses_.load(); }
+
+  /// Returns the number of evictions (TTL expiry or LRU eviction)
+  uint64_t evictions() const { return evictions_.load(); }
+
+  /// Returns the current number of entries in the cache
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return cache_map_.size();
+  }
+
+  /// Returns the hit rate as a percentage (0.0 to 1.0)
+  double hit_rate() const {
+    const uint64_t h = hits_.load();
+    const uint64_t m = misses_.load();
+    const uint64_t total = h + m;
+    return total > 0 ? static_cast<double>(h) / static_cast<double>(total) : 0.0;
+  }
+
+  /// Resets all statistics counters
+  void reset_stats() {
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+  }
+
+  /// Returns the cache configuration
+  const CallbackCacheConfig& config() const { return config_; }
+};
+
+/*!
+ * \brief Factory function to create a caching callback wrapper.
+ *
+ * This is a convenience function for simple use cases where you don't
+ * need to manage the cache separately.
+ *
+ * @param config Cache configuration
+ * @param predicate Optional predicate to filter which callbacks are cached
+ * @return A pair of {CallbackWrapper, shared_ptr<CallbackCache>}
+ *
+ * Example:
+ * @code
+ * auto [wrapper, cache] = inja::make_caching_callback_wrapper(
+ *     CallbackCacheConfig{.ttl = std::chrono::seconds(5)},
+ *     [](const std::string& name) { return name != "random"; }
+ * );
+ * env.set_callback_wrapper(wrapper);
+ *
+ * // Later, check statistics
+ * std::cout << "Hit rate: " << cache->hit_rate() * 100 << "%" << std::endl;
+ * @endcode
+ */
+inline std::pair<CallbackWrapper, std::shared_ptr<CallbackCache>>
+make_caching_callback_wrapper(
+    const CallbackCacheConfig& config = CallbackCacheConfig{},
+    CallbackCache::CachePredicate predicate = nullptr) {
+
+  auto cache = std::make_shared<CallbackCache>(config);
+  if (predicate) {
+    cache->set_cache_predicate(std::move(predicate));
+  }
+  return std::make_pair(cache->make_caching_wrapper(), cache);
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_CALLBACK_CACHE_HPP_
+
+// #include "compiler.hpp"
+
+// #include "cost.hpp"
+
+// #include "executor.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "globals.hpp"
+#ifndef INCLUDE_INJA_GLOBALS_HPP_
+#define INCLUDE_INJA_GLOBALS_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <set>
+#include <string>
+
+// #include "json.hpp"
+
+// #include "node.hpp"
+
+// #include "template.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Cost of the global variables of an environment, see Environment::set_globals_from().
+ */
+struct GlobalsReport {
+  std::chrono::nanoseconds setup_time {0}; // Time of the last render of the setup template
+  double estimated_cost {0.0};             // Estimated render cost of the setup template, saved by every render using the globals
+  size_t variable_count {0};               // Number of top-level variables set by the setup template
+  size_t refresh_count {0};                // Number of renders of the setup template
+};
+
+/// Returns the top-level names of all variables assigned by set statements of the template
+inline std::set<std::string> assigned_variables(const Template& tmpl) {
+  std::set<std::string> result;
+  std::function<void(const BlockNode&)> collect = [&result, &collect](const BlockNode& block) {
+    for (const auto& node : block.nodes) {
+      if (const auto* set = dynamic_cast<const SetStatementNode*>(node.get())) {
+        result.insert(set->key.substr(0, set->key.find('.')));
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node.get())) {
+        collect(condition->true_statement);
+        collect(condition->false_statement);
+      } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(node.get())) {
+        collect(loop->body);
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node.get())) {
+        collect(block_statement->block);
+      }
+    }
+  };
+  collect(tmpl.root);
+  return result;
+}
+
+/*!
+ * \brief Variables set by a setup template, shared read-only by all renders of an environment.
+ */
+struct GlobalScope {
+  Template setup;
+  json data;   // Data the setup template is rendered with
+  json values; // Top-level variables set by the setup template
+  GlobalsReport report;
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_GLOBALS_HPP_
+
+// #include "include_cache.hpp"
+#ifndef INCLUDE_INJA_INCLUDE_CACHE_HPP_
+#define INCLUDE_INJA_INCLUDE_CACHE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+
+// #include "template.hpp"
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief How an include name was resolved from a directory.
+ */
+struct IncludeResolution {
+  enum class Kind {
+    File,     // Found as a file, the template is in the template storage
+    Callback, // Returned by the include callback
+    Missing,  // Neither a file nor an include callback
+  };
+
+  Kind kind;
+  std::string name; // Name of the template in the template storage, or of the missing file
+  Template tmpl;    // Result of the include callback
+
+  // Directory that would contain the file, a new file there takes precedence over the callback or the error
+  std::string directory;
+  int64_t directory_modification_time {0};
+  mutable std::atomic<int64_t> checked_at {0}; // Steady clock time of the last check of the directory
+};
+
+/*!
+ * \brief Remembers how include names were resolved, keyed by the directory of the including template and the name.
+ *
+ * Parsing templates with many includes doesn't need to build paths, open
+ * missing files or call the include callback again. Failed lookups and
+ * callback results are dropped once the modification time of the directory
+ * changed, checked at most once per revalidation interval.
+ */
+class IncludeCache {
+  using Key = std::pair<std::string, std::string>;
+
+  mutable std::shared_mutex mutex;
+  std::map<Key, std::shared_ptr<const IncludeResolution>> entries;
+  std::atomic<int64_t> revalidate_interval {std::chrono::nanoseconds(std::chrono::seconds(1)).count()};
+
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void add(const std::filesystem::path& directory, const std::string& name, std::shared_ptr<IncludeResolution> entry) {
+    if (!entry->directory.empty()) {
+      entry->directory_modification_time = file_modification_time(entry->directory);
+      entry->checked_at.store(now(), std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    entries.insert_or_assign(Key {directory.string(), name}, std::move(entry));
+  }
+
+public:
+  /// Returns the resolution of the name, or nullptr if it is unknown or outdated
+  std::shared_ptr<const IncludeResolution> find(const std::filesystem::path& directory, const std::string& name) {
+    const Key key {directory.string(), name};
+    std::shared_ptr<const IncludeResolution> entry;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      const auto it = entries.find(key);
+      if (it == entries.end()) {
+        return nullptr;
+      }
+      entry = it->second;
+    }
+
+    if (entry->directory.empty()) {
+      return entry;
+    }
+
+    const int64_t time = now();
+    if (time - entry->checked_at.load(std::memory_order_relaxed) < revalidate_interval.load(std::memory_order_relaxed)) {
+      return entry;
+    }
+    if (file_modification_time(entry->directory) != entry->directory_modification_time) {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      const auto it = entries.find(key);
+      if (it != entries.end() && it->second == entry) {
+        entries.erase(it);
+      }
+      return nullptr;
+    }
+    entry->checked_at.store(time, std::memory_order_relaxed);
+    return entry;
+  }
+
+  void add_file(const std::filesystem::path& directory, const std::string& name, const std::string& resolved_name) {
+    auto entry = std::make_shared<IncludeResolution>();
+    entry->kind = IncludeResolution::Kind::File;
+    entry->name = resolved_name;
+    add(directory, name, std::move(entry));
+  }
+
+  /// Adds a result of the include callback, with the directory in which a file would take precedence (if any)
+  void add_callback(const std::filesystem::path& directory, const std::string& name, const std::string& resolved_name, const Template& tmpl,
+                    const std::string& file_directory) {
+    auto entry = std::make_shared<IncludeResolution>();
+    entry->kind = IncludeResolution::Kind::Callback;
+    entry->name = resolved_name;
+    entry->tmpl = tmpl;
+    entry->directory = file_directory;
+    add(directory, name, std::move(entry));
+  }
+
+  void add_missing(const std::filesystem::path& directory, const std::string& name, const std::string& resolved_name, const std::string& file_directory) {
+    auto entry = std::make_shared<IncludeResolution>();
+    entry->kind = IncludeResolution::Kind::Missing;
+    entry->name = resolved_name;
+    entry->directory = file_directory;
+    add(directory, name, std::move(entry));
+  }
+
+  /// Sets how often the directories of failed lookups and callback results are checked for changes
+  void set_revalidate_interval(std::chrono::nanoseconds interval) {
+    revalidate_interval.store(interval.count(), std::memory_order_relaxed);
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return entries.size();
+  }
+
+  void clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    entries.clear();
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_INCLUDE_CACHE_HPP_
+
+// #include "native.hpp"
+#ifndef INCLUDE_INJA_NATIVE_HPP_
+#define INCLUDE_INJA_NATIVE_HPP_
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <numeric>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// #include "config.hpp"
+
+// #include "exceptions.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "node.hpp"
+
+// #include "renderer.hpp"
+
+// #include "template.hpp"
+
+// #include "throw.hpp"
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+class NativeRender;
+
+/// Render function of a template, generated by inja_compile
+using NativeFunction = void (*)(NativeRender&);
+
+/*!
+ * \brief State of a render by the native render functions that inja_compile generates from templates.
+ *
+ * The generated code writes the text of a template and evaluates its
+ * expressions and statements directly. It calls these helpers for variable
+ * lookups, builtin functions, callbacks and loops, which have the semantics of
+ * the Renderer. Templates that were not compiled, e.g. ones added to the
+ * environment at runtime, are rendered by a Renderer with the same data.
+ */
+class NativeRender {
+public:
+  using Path = std::span<const std::string_view>; // Keys of a variable, as in its json pointer
+
+private:
+  std::ostream* output_stream;
+  const json* data_input;
+  const std::vector<const json*>* data_layers; // Data below the input, from top to bottom
+  const RenderConfig* config;
+  const TemplateStorage* template_storage;
+  const FunctionStorage* function_storage;
+
+  /// Returns the value at the path, with the semantics of json::contains() for json pointers, or nullptr
+  static const json* find_in(const json& data, Path path) {
+    const json* result = &data;
+    for (const auto key : path) {
+      if (result->is_object()) {
+        const auto it = result->find(key);
+        if (it == result->end()) {
+          return nullptr;
+        }
+        result = &*it;
+
+      } else if (result->is_array()) {
+        if (key.empty() || (key.size() > 1 && key[0] == '0') ||
+            !std::all_of(key.begin(), key.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) {
+          return nullptr;
+        }
+        size_t index {0};
+        for (const char c : key) {
+          index = index * 10 + static_cast<size_t>(c - '0');
+        }
+        if (index >= result->size()) {
+          return nullptr;
+        }
+        result = &(*result)[index];
+
+      } else {
+        return nullptr;
+      }
+    }
+    return result;
+  }
+
+  static json::number_integer_t integer_value(const json& value) {
+    if (const auto* integer = value.get_ptr<const json::number_integer_t*>()) {
+      return *integer;
+    }
+    return static_cast<json::number_integer_t>(*value.get_ptr<const json::number_unsigned_t*>());
+  }
+
+  static json::number_float_t float_value(const json& value) {
+    if (const auto* number = value.get_ptr<const json::number_float_t*>()) {
+      return *number;
+    } else if (const auto* number_unsigned = value.get_ptr<const json::number_unsigned_t*>()) {
+      return static_cast<json::number_float_t>(*number_unsigned);
+    }
+    return static_cast<json::number_float_t>(*value.get_ptr<const json::number_integer_t*>());
+  }
+
+public:
+  json local = json::object({{"loop", nullptr}}); // Variables set by the template and the loop data, as the local data of the Renderer
+
+  explicit NativeRender(std::ostream& os, const json& data, const std::vector<const json*>& layers, const RenderConfig& config,
+                        const TemplateStorage& template_storage, const FunctionStorage& function_storage)
+      : output_stream(&os), data_input(&data), data_layers(&layers), config(&config), template_storage(&template_storage),
+        function_storage(&function_storage) {}
+
+  /// Returns the state for rendering an included template, which starts with a copy of the local data
+  NativeRender include_scope() const {
+    return *this;
+  }
+
+  /// Renders a template that was not compiled with the interpreter, as an include with the local data
+  void interpret(const Template& tmpl) {
+    Renderer renderer(*config, *template_storage, *function_storage);
+    renderer.set_data_layers(*data_layers);
+    renderer.render_to(*output_stream, tmpl, *data_input, &local);
+  }
+
+  /// Renders an include of a template that was not compiled, looking it up in the environment
+  void include(const std::string& name, const SourceLocation& loc) {
+    const auto it = template_storage->find(name);
+    if (it != template_storage->end()) {
+      include_scope().interpret(it->second);
+    } else if (config->throw_at_missing_includes) {
+      fail("include '" + name + "' not found", loc);
+    }
+  }
+
+  void write(std::string_view text) {
+    output_stream->write(text.data(), static_cast<std::streamsize>(text.size()));
+  }
+
+  void print(const json& value) {
+    if (value.is_string()) {
+      if (config->html_autoescape) {
+        *output_stream << htmlescape(value.get_ref<const json::string_t&>());
+      } else {
+        *output_stream << value.get_ref<const json::string_t&>();
+      }
+    } else if (value.is_number_unsigned()) {
+      *output_stream << value.get<const json::number_unsigned_t>();
+    } else if (value.is_number_integer()) {
+      *output_stream << value.get<const json::number_integer_t>();
+    } else if (!value.is_null()) {
+      *output_stream << value.dump();
+    }
+  }
+
+  void print(bool value) {
+    write(value ? "true" : "false");
+  }
+
+  /// Returns the variable from the local data or the input, or nullptr
+  const json* find(Path path) const {
+    if (const json* value = find_in(local, path)) {
+      return value;
+    }
+    if (const json* value = find_in(*data_input, path)) {
+      return value;
+    }
+    for (const json* layer : *data_layers) {
+      if (const json* value = find_in(*layer, path)) {
+        return value;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Returns the variable, or the result of a callback without arguments of its name stored in result, or nullptr
+  const json* lookup(Path path, std::string_view name, json& result) const {
+    if (const json* value = find(path)) {
+      return value;
+    }
+
+    const auto function_data = function_storage->find_function(name, 0);
+    if (function_data.operation != FunctionStorage::Operation::Callback) {
+      return nullptr;
+    }
+    result = call(function_data, static_cast<std::string>(name), {});
+    return &result;
+  }
+
+  /*!
+   * \brief Returns the variable like lookup(), but throws if it was not found.
+   *
+   * With copy_local, a value of the local data is copied into result, so that
+   * it stays valid while the local data changes, e.g. for the source of a loop.
+   */
+  const json& get(Path path, std::string_view name, json& result, const SourceLocation& loc, bool copy_local = false) const {
+    if (copy_local) {
+      if (const json* value = find_in(local, path)) {
+        result = *value;
+        return result;
+      }
+    }
+
+    const json* value = lookup(path, name, result);
+    if (value == nullptr) {
+      fail("variable '" + static_cast<std::string>(name) + "' not found", loc);
+    }
+    return *value;
+  }
+
+  /// Returns whether the variable of the given name is in the input data
+  bool exists(const json& name) const {
+    const auto ptr = json::json_pointer(DataNode::convert_dot_to_ptr(name.get_ref<const json::string_t&>()));
+    if (data_input->contains(ptr)) {
+      return true;
+    }
+    return std::any_of(data_layers->begin(), data_layers->end(), [&ptr](const json* layer) { return layer->contains(ptr); });
+  }
+
+  /// Returns the registered callback of the function, which is resolved at render time
+  FunctionStorage::FunctionData function(std::string_view name, int num_args, const SourceLocation& loc) const {
+    auto function_data = function_storage->find_function(name, num_args);
+    if (!function_data.callback) {
+      fail("function '" + static_cast<std::string>(name) + "' not found or has no callback", loc);
+    }
+    return function_data;
+  }
+
+  json call(const FunctionStorage::FunctionData& function_data, const std::string& name, Arguments args) const {
+    if (config->callback_wrapper) {
+      return config->callback_wrapper(name, args, [&]() { return function_data.callback(args); });
+    }
+    return function_data.callback(args);
+  }
+
+  void set(const json::json_pointer& ptr, json value) {
+    local[ptr] = std::move(value);
+  }
+
+  void bind(const std::string& name, const json& value) {
+    local[name] = value;
+  }
+
+  void unbind(const std::string& name) {
+    local[name].clear();
+  }
+
+  void enter_loop(size_t size) {
+    json& loop = local["loop"];
+    if (!loop.empty()) {
+      json parent = std::move(loop);
+      loop = json::object();
+      loop["parent"] = std::move(parent);
+    }
+    loop["is_first"] = true;
+    loop["is_last"] = (size <= 1);
+  }
+
+  void update_loop(size_t index, size_t size) {
+    json& loop = local["loop"];
+    loop["index"] = index;
+    loop["index1"] = index + 1;
+    if (index == 1) {
+      loop["is_first"] = false;
+    }
+    if (index == size - 1) {
+      loop["is_last"] = true;
+    }
+  }
+
+  void leave_loop() {
+    json& loop = local["loop"];
+    if (!loop["parent"].empty()) {
+      json parent = std::move(loop["parent"]);
+      loop = std::move(parent);
+    }
+  }
+
+  static bool truthy(const json& value) {
+    return Renderer::truthy(&value);
+  }
+
+  [[noreturn]] static void fail(const std::string& message, const SourceLocation& loc) {
+    INJA_THROW(RenderError(message, loc));
+  }
+
+  /// Rethrows the current exception as the failure of a builtin function
+  [[noreturn]] static void fail_operation(std::string_view name, const SourceLocation& loc) {
+    try {
+      throw;
+    } catch (const std::exception& e) {
+      fail("operation '" + static_cast<std::string>(name) + "' failed: " + e.what(), loc);
+    } catch (...) {
+      fail("operation '" + static_cast<std::string>(name) + "' failed with unknown exception", loc);
+    }
+  }
+
+  /// Rethrows the current exception as the failure of a set statement
+  [[noreturn]] static void fail_set(const std::string& key, const SourceLocation& loc) {
+    try {
+      throw;
+    } catch (const std::exception& e) {
+      fail("failed to set variable '" + key + "': " + e.what(), loc);
+    } catch (...) {
+      fail("failed to set variable '" + key + "' with unknown exception", loc);
+    }
+  }
+
+  /// Returns the name of a builtin function whose errors are reported as its failure, like in the Renderer, or nullptr
+  static constexpr const char* builtin_name(FunctionStorage::Operation operation) {
+    using Op = FunctionStorage::Operation;
+    switch (operation) {
+    case Op::Add:
+      return "add";
+    case Op::Subtract:
+      return "subtract";
+    case Op::Multiplication:
+      return "multiply";
+    case Op::Division:
+      return "division";
+    case Op::Power:
+      return "power";
+    case Op::Modulo:
+      return "modulo";
+    case Op::Capitalize:
+      return "capitalize";
+    case Op::DivisibleBy:
+      return "divisibleBy";
+    case Op::Even:
+      return "even";
+    case Op::Exists:
+      return "exists";
+    case Op::ExistsInObject:
+      return "existsIn";
+    case Op::First:
+      return "first";
+    case Op::Float:
+      return "float";
+    case Op::Int:
+      return "int";
+    case Op::Last:
+      return "last";
+    case Op::Length:
+      return "length";
+    case Op::Lower:
+      return "lower";
+    case Op::Max:
+      return "max";
+    case Op::Min:
+      return "min";
+    case Op::Odd:
+      return "odd";
+    case Op::Range:
+      return "range";
+    case Op::Replace:
+      return "replace";
+    case Op::Round:
+      return "round";
+    case Op::Sort:
+      return "sort";
+    case Op::Upper:
+      return "upper";
+    case Op::Join:
+      return "join";
+    default:
+      return nullptr;
+    }
+  }
+
+  /// Compares two values with the same semantics as the json comparison operators
+  template <typename Compare> static bool compare(const json& lhs, const json& rhs, Compare compare) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      if (lhs.is_number_unsigned() && rhs.is_number_unsigned()) {
+        return compare(lhs.get_ref<const json::number_unsigned_t&>(), rhs.get_ref<const json::number_unsigned_t&>());
+      }
+      return compare(integer_value(lhs), integer_value(rhs));
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return compare(float_value(lhs), float_value(rhs));
+    } else if (lhs.is_string() && rhs.is_string()) {
+      return compare(lhs.get_ref<const json::string_t&>(), rhs.get_ref<const json::string_t&>());
+    }
+    return compare(lhs, rhs);
+  }
+
+  static bool in(const json& value, const json& container) {
+    return std::find(container.begin(), container.end(), value) != container.end();
+  }
+
+  static json add(const json& lhs, const json& rhs) {
+    if (lhs.is_string() && rhs.is_string()) {
+      return lhs.get_ref<const json::string_t&>() + rhs.get_ref<const json::string_t&>();
+    } else if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return integer_value(lhs) + integer_value(rhs);
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return float_value(lhs) + float_value(rhs);
+    }
+    return lhs.get<const json::number_float_t>() + rhs.get<const json::number_float_t>();
+  }
+
+  static json subtract(const json& lhs, const json& rhs) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return integer_value(lhs) - integer_value(rhs);
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return float_value(lhs) - float_value(rhs);
+    }
+    return lhs.get<const json::number_float_t>() - rhs.get<const json::number_float_t>();
+  }
+
+  static json multiply(const json& lhs, const json& rhs) {
+    if (lhs.is_number_integer() && rhs.is_number_integer()) {
+      return integer_value(lhs) * integer_value(rhs);
+    } else if (lhs.is_number() && rhs.is_number()) {
+      return float_value(lhs) * float_value(rhs);
+    }
+    return lhs.get<const json::number_float_t>() * rhs.get<const json::number_float_t>();
+  }
+
+  static json divide(const json& lhs, const json& rhs, const SourceLocation& loc) {
+    if (rhs.get<const json::number_float_t>() == 0) {
+      fail("division by zero", loc);
+    }
+    return lhs.get<const json::number_float_t>() / rhs.get<const json::number_float_t>();
+  }
+
+  static json power(const json& base, const json& exponent) {
+    if (base.is_number_integer() && exponent.get<const json::number_integer_t>() >= 0) {
+      return static_cast<json::number_integer_t>(std::pow(base.get<const json::number_integer_t>(), exponent.get<const json::number_integer_t>()));
+    }
+    return std::pow(base.get<const json::number_float_t>(), exponent.get<const json::number_integer_t>());
+  }
+
+  static json modulo(const json& lhs, const json& rhs) {
+    return lhs.get<const json::number_integer_t>() % rhs.get<const json::number_integer_t>();
+  }
+
+  /// Returns the member of an object or the element of an array
+  static const json& at(const json& container, const json& key, const SourceLocation& loc) {
+    if (container.is_object()) {
+      const auto name = key.get<std::string>();
+      if (!container.contains(name)) {
+        fail("key '" + name + "' not found in object", loc);
+      }
+      return container.at(name);
+    } else if (container.is_array()) {
+      const auto index = key.get<int>();
+      if (index < 0 || static_cast<size_t>(index) >= container.size()) {
+        fail("index " + std::to_string(index) + " out of bounds", loc);
+      }
+      return container.at(static_cast<size_t>(index));
+    }
+    fail("cannot access element on non-container type", loc);
+  }
+
+  /// Returns the member of the container after a dot, which is null if the container was not found
+  static const json& member(const json* container, const std::string& name, const SourceLocation& loc) {
+    if (container == nullptr || !container->contains(name)) {
+      fail("member '" + name + "' not found in container", loc);
+    }
+    return container->at(name);
+  }
+
+  static json capitalize(const json& value) {
+    auto result = value.get<json::string_t>();
+    result[0] = static_cast<char>(::toupper(result[0]));
+    std::transform(result.begin() + 1, result.end(), result.begin() + 1, [](char c) { return static_cast<char>(::tolower(c)); });
+    return result;
+  }
+
+  static bool divisible_by(const json& value, const json& divisor) {
+    const auto number = divisor.get<const json::number_integer_t>();
+    return (number != 0) && (value.get<const json::number_integer_t>() % number == 0);
+  }
+
+  static bool even(const json& value) {
+    return value.get<const json::number_integer_t>() % 2 == 0;
+  }
+
+  static bool odd(const json& value) {
+    return value.get<const json::number_integer_t>() % 2 != 0;
+  }
+
+  static bool exists_in(const json& object, const json& name) {
+    return object.find(name.get_ref<const json::string_t&>()) != object.end();
+  }
+
+  static const json& first(const json& value, const SourceLocation& loc) {
+    if (value.empty()) {
+      fail("cannot get first element of empty array", loc);
+    }
+    return value.front();
+  }
+
+  static const json& last(const json& value, const SourceLocation& loc) {
+    if (value.empty()) {
+      fail("cannot get last element of empty array", loc);
+    }
+    return value.back();
+  }
+
+  static json to_float(const json& value) {
+    return std::stod(value.get_ref<const json::string_t&>());
+  }
+
+  static json to_int(const json& value) {
+    return std::stoi(value.get_ref<const json::string_t&>());
+  }
+
+  static json length(const json& value) {
+    if (value.is_string()) {
+      return value.get_ref<const json::string_t&>().length();
+    }
+    return value.size();
+  }
+
+  static json lower(const json& value) {
+    auto result = value.get<json::string_t>();
+    std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+    return result;
+  }
+
+  static json upper(const json& value) {
+    auto result = value.get<json::string_t>();
+    std::transform(result.begin(), result.end(), result.begin(), [](char c) { return static_cast<char>(::toupper(c)); });
+    return result;
+  }
+
+  static const json& max(const json& value) {
+    return *std::max_element(value.begin(), value.end());
+  }
+
+  static const json& min(const json& value) {
+    return *std::min_element(value.begin(), value.end());
+  }
+
+  static json range(const json& value) {
+    std::vector<int> result(value.get<const json::number_integer_t>());
+    std::iota(result.begin(), result.end(), 0);
+    return result;
+  }
+
+  static json replace(const json& value, const json& from, const json& to) {
+    auto result = value.get<std::string>();
+    replace_substring(result, from.get<std::string>(), to.get<std::string>());
+    return result;
+  }
+
+  static json round(const json& value, const json& precision) {
+    const auto digits = precision.get<const json::number_integer_t>();
+    const double result = std::round(value.get<const json::number_float_t>() * std::pow(10.0, digits)) / std::pow(10.0, digits);
+    if (digits == 0) {
+      return static_cast<int>(result);
+    }
+    return result;
+  }
+
+  static json sort(const json& value) {
+    auto result = value.get<std::vector<json>>();
+    std::sort(result.begin(), result.end());
+    return json(std::move(result));
+  }
+
+  static json join(const json& values, const json& separator) {
+    const auto sep = separator.get<json::string_t>();
+    std::ostringstream os;
+    std::string current_sep;
+    for (const auto& value : values) {
+      os << current_sep;
+      if (value.is_string()) {
+        os << value.get<std::string>(); // otherwise the value is surrounded with ""
+      } else {
+        os << value.dump();
+      }
+      current_sep = sep;
+    }
+    return os.str();
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_NATIVE_HPP_
+
+// #include "optimizer.hpp"
+
+// #include "parser.hpp"
+#ifndef INCLUDE_INJA_PARSER_HPP_
+#define INCLUDE_INJA_PARSER_HPP_
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// #include "config.hpp"
+
+// #include "exceptions.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "include_cache.hpp"
+
+// #include "lexer.hpp"
+#ifndef INCLUDE_INJA_LEXER_HPP_
+#define INCLUDE_INJA_LEXER_HPP_
+
+#include <cstddef>
+#include <string_view>
+
+// #include "config.hpp"
+
+// #include "exceptions.hpp"
+
+// #include "token.hpp"
+#ifndef INCLUDE_INJA_TOKEN_HPP_
+#define INCLUDE_INJA_TOKEN_HPP_
+
+#include <string>
+#include <string_view>
+
+namespace inja {
+
+/*!
+ * \brief Helper-class for the inja Lexer.
+ */
+struct Token {
+  enum class Kind {
+    Text,
+    ExpressionOpen,     // {{
+    ExpressionClose,    // }}
+    LineStatementOpen,  // ##
+    LineStatementClose, // \n
+    StatementOpen,      // {%
+    StatementClose,     // %}
+    CommentOpen,        // {#
+    CommentClose,       // #}
+    Id,                 // this, this.foo
+    Number,             // 1, 2, -1, 5.2, -5.3
+    String,             // "this"
+    Plus,               // +
+    Minus,              // -
+    Times,              // *
+    Slash,              // /
+    Percent,            // %
+    Power,              // ^
+    Comma,              // ,
+    Dot,                // .
+    Colon,              // :
+    LeftParen,          // (
+    RightParen,         // )
+    LeftBracket,        // [
+    RightBracket,       // ]
+    LeftBrace,          // {
+    RightBrace,         // }
+    Equal,              // ==
+    NotEqual,           // !=
+    GreaterThan,        // >
+    GreaterEqual,       // >=
+    LessThan,           // <
+    LessEqual,          // <=
+    Pipe,               // |
+    Unknown,
+    Eof,
+  };
+
+  Kind kind {Kind::Unknown};
+  std::string_view text;
+
+  explicit constexpr Token() = default;
+  explicit constexpr Token(Kind kind, std::string_view text): kind(kind), text(text) {}
+
+  std::string describe() const {
+    switch (kind) {
+    case Kind::Text:
+      return "<text>";
+    case Kind::LineStatementClose:
+      return "<eol>";
+    case Kind::Eof:
+      return "<eof>";
+    default:
+      return static_cast<std::string>(text);
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_TOKEN_HPP_
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Class for lexing an inja Template.
+ */
+class Lexer {
+  enum class State {
+    Text,
+    ExpressionStart,
+    ExpressionStartForceLstrip,
+    ExpressionBody,
+    LineStart,
+    LineBody,
+    StatementStart,
+    StatementStartNoLstrip,
+    StatementStartForceLstrip,
+    StatementBody,
+    CommentStart,
+    CommentStartForceLstrip,
+    CommentBody,
+  };
+
+  enum class MinusState {
+    Operator,
+    Number,
+  };
+
+  const LexerConfig& config;
+
+  State state;
+  MinusState minus_state;
+  std::string_view m_in;
+  size_t tok_start;
+  size_t pos;
+
+  static constexpr bool is_alpha(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+  }
+
+  static constexpr bool is_digit(char ch) {
+    return ch >= '0' && ch <= '9';
+  }
+
+  constexpr Token scan_body(std::string_view close, Token::Kind closeKind, std::string_view close_trim = std::string_view(), bool trim = false) {
+    for (;;) {
+      // skip whitespace (except for \n as it might be a close)
+      if (tok_start >= m_in.size()) {
+        return make_token(Token::Kind::Eof);
+      }
+      const char ch = m_in[tok_start];
+      if (ch == ' ' || ch == '\t' || ch == '\r') {
+        tok_start += 1;
+        continue;
+      }
+
+      // check for close
+      if (!close_trim.empty() && inja::string_view::starts_with(m_in.substr(tok_start), close_trim)) {
+        state = State::Text;
+        pos = tok_start + close_trim.size();
+        const Token tok = make_token(closeKind);
+        skip_whitespaces_and_newlines();
+        return tok;
+      }
+
+      if (inja::string_view::starts_with(m_in.substr(tok_start), close)) {
+        state = State::Text;
+        pos = tok_start + close.size();
+        const Token tok = make_token(closeKind);
+        if (trim) {
+          skip_whitespaces_and_first_newline();
+        }
+        return tok;
+      }
+
+      // skip \n
+      if (ch == '\n') {
+        tok_start += 1;
+        continue;
+      }
+      break;
+    }
+
+    const char ch = m_in[tok_start];
+    pos = tok_start + 1;
+    if (is_alpha(ch)) {
+      minus_state = MinusState::Operator;
+      return scan_id();
+    }
+
+    const MinusState current_minus_state = minus_state;
+    if (minus_state == MinusState::Operator) {
+      minus_state = MinusState::Number;
+    }
+
+    switch (ch) {
+    case '+':
+      return make_token(Token::Kind::Plus);
+    case '-':
+      if (current_minus_state == MinusState::Operator) {
+        return make_token(Token::Kind::Minus);
+      }
+      return scan_number();
+    case '*':
+      return make_token(Token::Kind::Times);
+    case '/':
+      return make_token(Token::Kind::Slash);
+    case '^':
+      return make_token(Token::Kind::Power);
+    case '%':
+      return make_token(Token::Kind::Percent);
+    case '.':
+      return make_token(Token::Kind::Dot);
+    case ',':
+      return make_token(Token::Kind::Comma);
+    case ':':
+      return make_token(Token::Kind::Colon);
+    case '|':
+      return make_token(Token::Kind::Pipe);
+    case '(':
+      return make_token(Token::Kind::LeftParen);
+    case ')':
+      minus_state = MinusState::Operator;
+      return make_token(Token::Kind::RightParen);
+    case '[':
+      return make_token(Token::Kind::LeftBracket);
+    case ']':
+      minus_state = MinusState::Operator;
+      return make_token(Token::Kind::RightBracket);
+    case '{':
+      return make_token(Token::Kind::LeftBrace);
+    case '}':
+      minus_state = MinusState::Operator;
+      return make_token(Token::Kind::RightBrace);
+    case '>':
+      if (pos < m_in.size() && m_in[pos] == '=') {
+        pos += 1;
+        return make_token(Token::Kind::GreaterEqual);
+      }
+      return make_token(Token::Kind::GreaterThan);
+    case '<':
+      if (pos < m_in.size() && m_in[pos] == '=') {
+        pos += 1;
+        return make_token(Token::Kind::LessEqual);
+      }
+      return make_token(Token::Kind::LessThan);
+    case '=':
+      if (pos < m_in.size() && m_in[pos] == '=') {
+        pos += 1;
+        return make_token(Token::Kind::Equal);
+      }
+      return make_token(Token::Kind::Unknown);
+    case '!':
+      if (pos < m_in.size() && m_in[pos] == '=') {
+        pos += 1;
+        return make_token(Token::Kind::NotEqual);
+      }
+      return make_token(Token::Kind::Unknown);
+    case '\"':
+      return scan_string();
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      minus_state = MinusState::Operator;
+      return scan_number();
+    case '_':
+    case '@':
+    case '$':
+      minus_state = MinusState::Operator;
+      return scan_id();
+    default:
+      return make_token(Token::Kind::Unknown);
+    }
+  }
+
+  constexpr Token scan_id() {
+    for (;;) {
+      if (pos >= m_in.size()) {
+        break;
+      }
+      const char ch = m_in[pos];
+      if (!is_alpha(ch) && !is_digit(ch) && ch != '.' && ch != '/' && ch != '_' && ch != '-') {
+        break;
+      }
+      pos += 1;
+    }
+    return make_token(Token::Kind::Id);
+  }
+
+  constexpr Token scan_number() {
+    for (;;) {
+      if (pos >= m_in.size()) {
+        break;
+      }
+      const char ch = m_in[pos];
+      // be very permissive in lexer (we'll catch errors when conversion happens)
+      if (!(is_digit(ch) || ch == '.' || ch == 'e' || ch == 'E' || (ch == '+' && (pos == 0 || m_in[pos-1] == 'e' || m_in[pos-1] == 'E')) || (ch == '-' && (pos == 0 || m_in[pos-1] == 'e' || m_in[pos-1] == 'E')))) {
+        break;
+      }
+      pos += 1;
+    }
+    return make_token(Token::Kind::Number);
+  }
+
+  constexpr Token scan_string() {
+    bool escape {false};
+    for (;;) {
+      if (pos >= m_in.size()) {
+        break;
+      }
+      const char ch = m_in[pos++];
+      if (ch == '\\') {
+        escape = !escape;
+      } else if (!escape && ch == m_in[tok_start]) {
+        break;
+      } else {
+        escape = false;
+      }
+    }
+    return make_token(Token::Kind::String);
+  }
+
+  constexpr Token make_token(Token::Kind kind) const {
+    return Token(kind, string_view::slice(m_in, tok_start, pos));
+  }
+
+  constexpr void skip_whitespaces_and_newlines() {
+    if (pos < m_in.size()) {
+      while (pos < m_in.size() && (m_in[pos] == ' ' || m_in[pos] == '\t' || m_in[pos] == '\n' || m_in[pos] == '\r')) {
+        pos += 1;
+      }
+    }
+  }
+
+  constexpr void skip_whitespaces_and_first_newline() {
+    if (pos < m_in.size()) {
+      while (pos < m_in.size() && (m_in[pos] == ' ' || m_in[pos] == '\t')) {
+        pos += 1;
+      }
+    }
+
+    if (pos < m_in.size()) {
+      const char ch = m_in[pos];
+      if (ch == '\n') {
+        pos += 1;
+      } else if (ch == '\r') {
+        pos += 1;
+        if (pos < m_in.size() && m_in[pos] == '\n') {
+          pos += 1;
+        }
+      }
+    }
+  }
+
+  static constexpr std::string_view clear_final_line_if_whitespace(std::string_view text) {
+    std::string_view result = text;
+    while (!result.empty()) {
+      const char ch = result.back();
+      if (ch == ' ' || ch == '\t') {
+        result.remove_suffix(1);
+      } else if (ch == '\n' || ch == '\r') {
+        break;
+      } else {
+        return text;
+      }
+    }
+    return result;
+  }
+
+public:
+  explicit constexpr Lexer(const LexerConfig& config): config(config), state(State::Text), minus_state(MinusState::Number), tok_start(0), pos(0) {}
+
+  constexpr SourceLocation current_position() const {
+    return get_source_location(m_in, tok_start);
+  }
+
+  constexpr void start(std::string_view input) {
+    m_in = input;
+    tok_start = 0;
+    pos = 0;
+    state = State::Text;
+    minus_state = MinusState::Number;
+
+    // Consume byte order mark (BOM) for UTF-8
+    if (inja::string_view::starts_with(m_in, "\xEF\xBB\xBF")) {
+      m_in = m_in.substr(3);
+    }
+  }
+
+  constexpr Token scan() {
+    tok_start = pos;
+
+    for (;;) {
+      if (tok_start >= m_in.size()) {
+        return make_token(Token::Kind::Eof);
+      }
+
+      switch (state) {
+      default:
+      case State::Text: {
+        // fast-scan to first open character
+        const size_t open_start = m_in.substr(pos).find_first_of(config.open_chars);
+        if (open_start == std::string_view::npos) {
+          // didn't find open, return remaining text as text token
+          pos = m_in.size();
+          return make_token(Token::Kind::Text);
+        }
+        pos += open_start;
+
+        // try to match one of the opening sequences, and get the close
+        const std::string_view open_str = m_in.substr(pos);
+        bool must_lstrip = false;
+        if (inja::string_view::starts_with(open_str, config.expression_open)) {
+          if (inja::string_view::starts_with(open_str, config.expression_open_force_lstrip)) {
+            state = State::ExpressionStartForceLstrip;
+            must_lstrip = true;
+          } else {
+            state = State::ExpressionStart;
+          }
+        } else if (inja::string_view::starts_with(open_str, config.statement_open)) {
+          if (inja::string_view::starts_with(open_str, config.statement_open_no_lstrip)) {
+            state = State::StatementStartNoLstrip;
+          } else if (inja::string_view::starts_with(open_str, config.statement_open_force_lstrip)) {
+            state = State::StatementStartForceLstrip;
+            must_lstrip = true;
+          } else {
+            state = State::StatementStart;
+            must_lstrip = config.lstrip_blocks;
+          }
+        } else if (inja::string_view::starts_with(open_str, config.comment_open)) {
+          if (inja::string_view::starts_with(open_str, config.comment_open_force_lstrip)) {
+            state = State::CommentStartForceLstrip;
+            must_lstrip = true;
+          } else {
+            state = State::CommentStart;
+            must_lstrip = config.lstrip_blocks;
+          }
+        } else if ((pos == 0 || m_in[pos - 1] == '\n') && inja::string_view::starts_with(open_str, config.line_statement)) {
+          state = State::LineStart;
+        } else {
+          pos += 1; // wasn't actually an opening sequence
+          continue;
+        }
+
+        std::string_view text = string_view::slice(m_in, tok_start, pos);
+        if (must_lstrip) {
+          text = clear_final_line_if_whitespace(text);
+        }
+
+        if (text.empty()) {
+          continue; // don't generate empty token
+        }
+        return Token(Token::Kind::Text, text);
+      }
+      case State::ExpressionStart: {
+        state = State::ExpressionBody;
+        pos += config.expression_open.size();
+        return make_token(Token::Kind::ExpressionOpen);
+      }
+      case State::ExpressionStartForceLstrip: {
+        state = State::ExpressionBody;
+        pos += config.expression_open_force_lstrip.size();
+        return make_token(Token::Kind::ExpressionOpen);
+      }
+      case State::LineStart: {
+        state = State::LineBody;
+        pos += config.line_statement.size();
+        return make_token(Token::Kind::LineStatementOpen);
+      }
+      case State::StatementStart: {
+        state = State::StatementBody;
+        pos += config.statement_open.size();
+        return make_token(Token::Kind::StatementOpen);
+      }
+      case State::StatementStartNoLstrip: {
+        state = State::StatementBody;
+        pos += config.statement_open_no_lstrip.size();
+        return make_token(Token::Kind::StatementOpen);
+      }
+      case State::StatementStartForceLstrip: {
+        state = State::StatementBody;
+        pos += config.statement_open_force_lstrip.size();
+        return make_token(Token::Kind::StatementOpen);
+      }
+      case State::CommentStart: {
+        state = State::CommentBody;
+        pos += config.comment_open.size();
+        return make_token(Token::Kind::CommentOpen);
+      }
+      case State::CommentStartForceLstrip: {
+        state = State::CommentBody;
+        pos += config.comment_open_force_lstrip.size();
+        return make_token(Token::Kind::CommentOpen);
+      }
+      case State::ExpressionBody:
+        return scan_body(config.expression_close, Token::Kind::ExpressionClose, config.expression_close_force_rstrip);
+      case State::LineBody:
+        return scan_body("\n", Token::Kind::LineStatementClose);
+      case State::StatementBody:
+        return scan_body(config.statement_close, Token::Kind::StatementClose, config.statement_close_force_rstrip, config.trim_blocks);
+      case State::CommentBody: {
+        // fast-scan to comment close
+        const size_t end = m_in.substr(pos).find(config.comment_close);
+        if (end == std::string_view::npos) {
+          pos = m_in.size();
+          return make_token(Token::Kind::Eof);
+        }
+
+        // Check for trim pattern
+        const bool must_rstrip = inja::string_view::starts_with(m_in.substr(pos + end - 1), config.comment_close_force_rstrip);
+
+        // return the entire comment in the close token
+        state = State::Text;
+        pos += end + config.comment_close.size();
+        Token tok = make_token(Token::Kind::CommentClose);
+
+        if (must_rstrip || config.trim_blocks) {
+          skip_whitespaces_and_first_newline();
+        }
+        return tok;
+      }
+      }
+    }
+  }
+
+  constexpr const LexerConfig& get_config() const {
+    return config;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_LEXER_HPP_
+
+// #include "node.hpp"
+
+// #include "preload.hpp"
+#ifndef INCLUDE_INJA_PRELOAD_HPP_
+#define INCLUDE_INJA_PRELOAD_HPP_
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// #include "node.hpp"
+
+// #include "template.hpp"
+
+
+namespace inja {
+
+/// Matches a path with `/` separators against a glob with `*`, `**` and `?`
+inline bool glob_match(std::string_view pattern, std::string_view path) {
+  if (pattern.empty()) {
+    return path.empty();
+  }
+
+  if (pattern.substr(0, 2) == "**") {
+    // Also matches no directory at all, e.g. `**/*.txt` matches `a.txt`
+    if (pattern.substr(0, 3) == "**/" && glob_match(pattern.substr(3), path)) {
+      return true;
+    }
+    for (size_t i = 0; i <= path.size(); ++i) {
+      if (glob_match(pattern.substr(2), path.substr(i))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  if (pattern[0] == '*') {
+    for (size_t i = 0; i <= path.size(); ++i) {
+      if (glob_match(pattern.substr(1), path.substr(i))) {
+        return true;
+      }
+      if (i < path.size() && path[i] == '/') {
+        break;
+      }
+    }
+    return false;
+  }
+
+  if (path.empty() || (pattern[0] == '?' ? path[0] == '/' : pattern[0] != path[0])) {
+    return false;
+  }
+  return glob_match(pattern.substr(1), path.substr(1));
+}
+
+/// Returns the names of all templates included or extended by the template, in order of their statements
+inline std::vector<std::string> template_dependencies(const Template& tmpl) {
+  std::vector<std::string> result;
+  std::function<void(const BlockNode&)> collect = [&result, &collect](const BlockNode& block) {
+    for (const auto& node : block.nodes) {
+      if (const auto* include = dynamic_cast<const IncludeStatementNode*>(node.get())) {
+        result.push_back(include->file);
+      } else if (const auto* extends = dynamic_cast<const ExtendsStatementNode*>(node.get())) {
+        result.push_back(extends->file);
+      } else if (const auto* condition = dynamic_cast<const IfStatementNode*>(node.get())) {
+        collect(condition->true_statement);
+        collect(condition->false_statement);
+      } else if (const auto* loop = dynamic_cast<const ForStatementNode*>(node.get())) {
+        collect(loop->body);
+      } else if (const auto* block_statement = dynamic_cast<const BlockStatementNode*>(node.get())) {
+        collect(block_statement->block);
+      }
+    }
+  };
+  collect(tmpl.root);
+  return result;
+}
+
+/*!
+ * \brief Timings of Environment::preload_directory().
+ */
+struct PreloadReport {
+  struct File {
+    std::string name;
+    std::chrono::nanoseconds parse_time {0}; // Without the parse time of included templates
+    std::vector<std::string> dependencies;   // Included and extended templates
+  };
+
+  std::vector<File> files; // All parsed templates, including the ones only found as includes
+  std::chrono::nanoseconds total_time {0};
+
+  // Longest chain of templates that include each other, which bounds the parse time for any number of threads
+  std::vector<std::string> critical_path;
+  std::chrono::nanoseconds critical_path_time {0};
+};
+
+/*!
+ * \brief Templates parsed by concurrent parsers, to parse shared includes only once.
+ *
+ * Parsers look up templates before reading their file and add them after
+ * parsing. Two threads may parse the same template at the same time, then
+ * the first one added is kept.
+ */
+class ConcurrentTemplateStorage {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    Template tmpl;
+    std::vector<std::string> dependencies;
+    std::chrono::nanoseconds parse_time {0};
+  };
+
+  /// Start of a parse, to subtract the time spent parsing includes
+  struct ParseTimer {
+    Clock::time_point start;
+    std::chrono::nanoseconds nested_before;
+  };
+
+private:
+  static constexpr size_t shard_count {16};
+
+  struct Shard {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const Entry>> entries;
+  };
+
+  std::array<Shard, shard_count> shards;
+
+  // Time spent in the completed parses of this thread, nested parses are subtracted from their parent
+  static inline thread_local std::chrono::nanoseconds tl_parsed_time_ {0};
+
+  Shard& shard(const std::string& name) {
+    return shards[std::hash<std::string> {}(name) % shard_count];
+  }
+
+public:
+  std::shared_ptr<const Entry> find(const std::string& name) {
+    auto& s = shard(name);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    const auto it = s.entries.find(name);
+    return (it != s.entries.end()) ? it->second : nullptr;
+  }
+
+  static ParseTimer start_parse() {
+    return {Clock::now(), tl_parsed_time_};
+  }
+
+  void add(const std::string& name, const Template& tmpl, const ParseTimer& timer) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - timer.start);
+
+    auto entry = std::make_shared<Entry>();
+    entry->tmpl = tmpl;
+    entry->parse_time = elapsed - (tl_parsed_time_ - timer.nested_before);
+    entry->dependencies = template_dependencies(tmpl);
+    tl_parsed_time_ = timer.nested_before + elapsed;
+
+    auto& s = shard(name);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.entries.try_emplace(name, std::move(entry));
+  }
+
+  /// Calls the function with the name and entry of all templates, in order of their names within each shard
+  void for_each(const std::function<void(const std::string&, const Entry&)>& function) {
+    for (auto& s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      for (const auto& [name, entry] : s.entries) {
+        function(name, *entry);
+      }
+    }
+  }
+
+  /// Returns the report of all parsed templates with their critical path
+  PreloadReport report() {
+    PreloadReport result;
+    std::map<std::string, const Entry*> entries;
+    for_each([&](const std::string& name, const Entry& entry) {
+      entries.emplace(name, &entry);
+      result.files.push_back({name, entry.parse_time, entry.dependencies});
+    });
+
+    // Longest path through the include graph, a template on the current path ends a cycle
+    std::map<std::string, std::pair<std::chrono::nanoseconds, std::string>> longest; // Time from a template on, and the next template
+    std::set<std::string> on_path;
+    std::function<std::chrono::nanoseconds(const std::string&)> visit = [&](const std::string& name) -> std::chrono::nanoseconds {
+      const auto entry = entries.find(name);
+      if (entry == entries.end() || on_path.count(name) > 0) {
+        return std::chrono::nanoseconds {0};
+      }
+      const auto known = longest.find(name);
+      if (known != longest.end()) {
+        return known->second.first;
+      }
+
+      on_path.insert(name);
+      std::pair<std::chrono::nanoseconds, std::string> best {std::chrono::nanoseconds {0}, ""};
+      for (const auto& dependency : entry->second->dependencies) {
+        const auto time = visit(dependency);
+        if (time > best.first) {
+          best = {time, dependency};
+        }
+      }
+      on_path.erase(name);
+
+      best.first += entry->second->parse_time;
+      longest[name] = best;
+      return best.first;
+    };
+
+    std::string start;
+    for (const auto& [name, entry] : entries) {
+      const auto time = visit(name);
+      if (time > result.critical_path_time) {
+        result.critical_path_time = time;
+        start = name;
+      }
+    }
+    for (std::string name = start; !name.empty(); name = longest[name].second) {
+      result.critical_path.push_back(name);
+    }
+    return result;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_PRELOAD_HPP_
+
+// #include "template.hpp"
+
+// #include "throw.hpp"
+
+// #include "token.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Class for parsing an inja Template.
+ *
+ * Thread-safety: Parser writes discovered templates to the provided TemplateStorage reference,
+ * which should be a thread-local cache when used from Environment::parse().
+ * The Environment merges this cache into shared storage after parse completes.
+ */
+class Parser {
+  using Arguments = std::vector<std::shared_ptr<ExpressionNode>>;
+  using OperatorStack = std::stack<std::shared_ptr<FunctionNode>>;
+
+  const ParserConfig& config;
+
+  Lexer lexer;
+  TemplateStorage& template_storage;  // Thread-local cache for discovered templates
+  std::shared_ptr<const TemplateStorage> shared_template_storage;  // Shared storage kept alive during parsing
+  const FunctionStorage& function_storage;
+  ConcurrentTemplateStorage* concurrent_storage {nullptr}; // Templates of parsers running in parallel, see Environment::preload_directory()
+  IncludeCache* include_cache {nullptr};
+
+  Token tok, peek_tok;
+  bool have_peek_tok {false};
+
+  std::string_view literal_start;
+
+  BlockNode* current_block {nullptr};
+  ExpressionListNode* current_expression_list {nullptr};
+
+  std::stack<IfStatementNode*> if_statement_stack;
+  std::stack<ForStatementNode*> for_statement_stack;
+  std::stack<BlockStatementNode*> block_statement_stack;
+
+  void throw_parser_error(const std::string& message) const {
+    INJA_THROW(ParserError(message, lexer.current_position()));
+  }
+
+  void get_next_token() {
+    if (have_peek_tok) {
+      tok = peek_tok;
+      have_peek_tok = false;
+    } else {
+      tok = lexer.scan();
+    }
+  }
+
+  void get_peek_token() {
+    if (!have_peek_tok) {
+      peek_tok = lexer.scan();
+      have_peek_tok = true;
+    }
+  }
+
+  void add_literal(Arguments &arguments, const char* content_ptr) {
+    const std::string_view data_text(literal_start.data(), tok.text.data() - literal_start.data() + tok.text.size());
+    arguments.emplace_back(std::make_shared<LiteralNode>(data_text, data_text.data() - content_ptr));
+  }
+
+  void add_operator(Arguments &arguments, OperatorStack &operator_stack) {
+    auto function = operator_stack.top();
+    operator_stack.pop();
+
+    if (static_cast<int>(arguments.size()) < function->number_args) {
+      throw_parser_error("too few arguments");
+    }
+
+    for (int i = 0; i < function->number_args; ++i) {
+      function->arguments.insert(function->arguments.begin(), arguments.back());
+      arguments.pop_back();
+    }
+    arguments.emplace_back(function);
+  }
+
+  void add_to_template_storage(const std::filesystem::path& path, std::string& template_name) {
+    // Check thread-local cache first
+    if (template_storage.find(template_name) != template_storage.end()) {
+      return;
+    }
+
+    // Check shared storage for existing templates (e.g., from include_template())
+    // shared_template_storage is a shared_ptr that keeps the storage alive during parsing
+    if (shared_template_storage) {
+      auto it = shared_template_storage->find(template_name);
+      if (it != shared_template_storage->end()) {
+        // Copy from shared storage to local cache so Renderer can find it
+        template_storage[template_name] = it->second;
+        return;
+      }
+    }
+
+    const std::string original_name = template_name;
+
+    const auto cached = include_cache ? include_cache->find(path, original_name) : nullptr;
+    if (cached && cached->kind != IncludeResolution::Kind::File) {
+      // A template added under the resolved name since, e.g. by include_template(), takes precedence
+      if (template_storage.find(cached->name) != template_storage.end()) {
+        template_name = cached->name;
+        return;
+      }
+      if (shared_template_storage) {
+        auto it = shared_template_storage->find(cached->name);
+        if (it != shared_template_storage->end()) {
+          template_name = cached->name;
+          template_storage[template_name] = it->second;
+          return;
+        }
+      }
+    }
+    if (cached && cached->kind == IncludeResolution::Kind::Callback) {
+      template_name = cached->name;
+      template_storage.emplace(template_name, cached->tmpl);
+      return;
+    } else if (cached && cached->kind == IncludeResolution::Kind::Missing) {
+      template_name = cached->name;
+      INJA_THROW(FileError("failed accessing file at '" + template_name + "'"));
+    }
+
+    // Directory in which a new file would take precedence over the include callback
+    std::string file_directory;
+
+    if (config.search_included_templates_in_files) {
+      if (cached) {
+        template_name = cached->name;
+      } else {
+        // Build the relative path
+        template_name = (path / original_name).string();
+        if (template_name.compare(0, 2, "./") == 0) {
+          template_name.erase(0, 2);
+        }
+      }
+
+      // Check both caches with the modified name too
+      if (template_storage.find(template_name) != template_storage.end()) {
+        return;
+      }
+      if (shared_template_storage) {
+        auto it = shared_template_storage->find(template_name);
+        if (it != shared_template_storage->end()) {
+          template_storage[template_name] = it->second;
+          return;
+        }
+      }
+
+      if (concurrent_storage) {
+        if (const auto parsed = concurrent_storage->find(template_name)) {
+          template_storage[template_name] = parsed->tmpl;
+          return;
+        }
+      }
+
+      // Load file
+      std::ifstream file;
+      file.open(template_name);
+      if (!file.fail()) {
+        const auto timer = ConcurrentTemplateStorage::start_parse();
+        const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        auto include_template = Template(text);
+        template_storage.emplace(template_name, include_template);
+        parse_into_template(template_storage[template_name], template_name);
+        if (concurrent_storage) {
+          concurrent_storage->add(template_name, template_storage[template_name], timer);
+        }
+        if (include_cache && !cached) {
+          include_cache->add_file(path, original_name, template_name);
+        }
+        return;
+      }
+
+      file_directory = std::filesystem::path(template_name).parent_path().string();
+      if (file_directory.empty()) {
+        file_directory = ".";
+      }
+      if (!config.include_callback) {
+        if (include_cache) {
+          include_cache->add_missing(path, original_name, template_name, file_directory);
+        }
+        INJA_THROW(FileError("failed accessing file at '" + template_name + "'"));
+      }
+    }
+
+    // Try include callback
+    if (config.include_callback) {
+      auto include_template = config.include_callback(path, original_name);
+      if (include_cache) {
+        include_cache->add_callback(path, original_name, template_name, include_template, file_directory);
+      }
+      template_storage.emplace(template_name, include_template);
+    }
+  }
+
+  std::string parse_filename() const {
+    if (tok.kind != Token::Kind::String) {
+      throw_parser_error("expected string, got '" + tok.describe() + "'");
+    }
+
+    if (tok.text.length() < 2) {
+      throw_parser_error("expected filename, got '" + static_cast<std::string>(tok.text) + "'");
+    }
+
+    // Remove first and last character ""
+    return std::string {tok.text.substr(1, tok.text.length() - 2)};
+  }
+
+  bool parse_expression(Template& tmpl, Token::Kind closing) {
+    current_expression_list->root = parse_expression(tmpl);
+    return tok.kind == closing;
+  }
+
+  std::shared_ptr<ExpressionNode> parse_expression(Template& tmpl) {
+    size_t current_bracket_level {0};
+    size_t current_brace_level {0};
+    Arguments arguments;
+    OperatorStack operator_stack;
+
+    while (tok.kind != Token::Kind::Eof) {
+      // Literals
+      switch (tok.kind) {
+      case Token::Kind::String: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+          add_literal(arguments, tmpl.content.c_str());
+        }
+      } break;
+      case Token::Kind::Number: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+          add_literal(arguments, tmpl.content.c_str());
+        }
+      } break;
+      case Token::Kind::LeftBracket: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+        }
+        current_bracket_level += 1;
+      } break;
+      case Token::Kind::LeftBrace: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+        }
+        current_brace_level += 1;
+      } break;
+      case Token::Kind::RightBracket: {
+        if (current_bracket_level == 0) {
+          throw_parser_error("unexpected ']'");
+        }
+
+        current_bracket_level -= 1;
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          add_literal(arguments, tmpl.content.c_str());
+        }
+      } break;
+      case Token::Kind::RightBrace: {
+        if (current_brace_level == 0) {
+          throw_parser_error("unexpected '}'");
+        }
+
+        current_brace_level -= 1;
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          add_literal(arguments, tmpl.content.c_str());
+        }
+      } break;
+      case Token::Kind::Id: {
+        get_peek_token();
+
+        // Data Literal
+        if (tok.text == static_cast<decltype(tok.text)>("true") || tok.text == static_cast<decltype(tok.text)>("false") ||
+            tok.text == static_cast<decltype(tok.text)>("null")) {
+          if (current_brace_level == 0 && current_bracket_level == 0) {
+            literal_start = tok.text;
+            add_literal(arguments, tmpl.content.c_str());
+          }
+
+          // Operator
+        } else if (tok.text == "and" || tok.text == "or" || tok.text == "in" || tok.text == "not") {
+          goto parse_operator;
+
+          // Functions
+        } else if (peek_tok.kind == Token::Kind::LeftParen) {
+          auto func = std::make_shared<FunctionNode>(tok.text, tok.text.data() - tmpl.content.c_str());
+          get_next_token();
+          do {
+            get_next_token();
+            auto expr = parse_expression(tmpl);
+            if (!expr) {
+              break;
+            }
+            func->number_args += 1;
+            func->arguments.emplace_back(expr);
+          } while (tok.kind == Token::Kind::Comma);
+          if (tok.kind != Token::Kind::RightParen) {
+            throw_parser_error("expected right parenthesis, got '" + tok.describe() + "'");
+          }
+
+          auto function_data = function_storage.find_function(func->name, func->number_args);
+          if (function_data.operation == FunctionStorage::Operation::None) {
+            if (!config.graceful_errors) {
+              throw_parser_error("unknown function " + func->name);
+            }
+            // In graceful mode, explicitly set operation to None to be handled at render time
+            func->operation = FunctionStorage::Operation::None;
+          } else {
+            func->operation = function_data.operation;
+            if (function_data.operation == FunctionStorage::Operation::Callback) {
+              func->callback = function_data.callback;
+            }
+          }
+          arguments.emplace_back(func);
+
+          // Variables
+        } else {
+          arguments.emplace_back(std::make_shared<DataNode>(static_cast<std::string>(tok.text), tok.text.data() - tmpl.content.c_str()));
+        }
+
+        // Operators
+      } break;
+      case Token::Kind::Equal:
+      case Token::Kind::NotEqual:
+      case Token::Kind::GreaterThan:
+      case Token::Kind::GreaterEqual:
+      case Token::Kind::LessThan:
+      case Token::Kind::LessEqual:
+      case Token::Kind::Plus:
+      case Token::Kind::Minus:
+      case Token::Kind::Times:
+      case Token::Kind::Slash:
+      case Token::Kind::Power:
+      case Token::Kind::Percent:
+      case Token::Kind::Dot: {
+
+      parse_operator:
+        FunctionStorage::Operation operation;
+        switch (tok.kind) {
+        case Token::Kind::Id: {
+          if (tok.text == "and") {
+            operation = FunctionStorage::Operation::And;
+          } else if (tok.text == "or") {
+            operation = FunctionStorage::Operation::Or;
+          } else if (tok.text == "in") {
+            operation = FunctionStorage::Operation::In;
+          } else if (tok.text == "not") {
+            operation = FunctionStorage::Operation::Not;
+          } else {
+            throw_parser_error("unknown operator in parser.");
+          }
+        } break;
+        case Token::Kind::Equal: {
+          operation = FunctionStorage::Operation::Equal;
+        } break;
+        case Token::Kind::NotEqual: {
+          operation = FunctionStorage::Operation::NotEqual;
+        } break;
+        case Token::Kind::GreaterThan: {
+          operation = FunctionStorage::Operation::Greater;
+        } break;
+        case Token::Kind::GreaterEqual: {
+          operation = FunctionStorage::Operation::GreaterEqual;
+        } break;
+        case Token::Kind::LessThan: {
+          operation = FunctionStorage::Operation::Less;
+        } break;
+        case Token::Kind::LessEqual: {
+          operation = FunctionStorage::Operation::LessEqual;
+        } break;
+        case Token::Kind::Plus: {
+          operation = FunctionStorage::Operation::Add;
+        } break;
+        case Token::Kind::Minus: {
+          operation = FunctionStorage::Operation::Subtract;
+        } break;
+        case Token::Kind::Times: {
+          operation = FunctionStorage::Operation::Multiplication;
+        } break;
+        case Token::Kind::Slash: {
+          operation = FunctionStorage::Operation::Division;
+        } break;
+        case Token::Kind::Power: {
+          operation = FunctionStorage::Operation::Power;
+        } break;
+        case Token::Kind::Percent: {
+          operation = FunctionStorage::Operation::Modulo;
+        } break;
+        case Token::Kind::Dot: {
+          operation = FunctionStorage::Operation::AtId;
+        } break;
+        default: {
+          throw_parser_error("unknown operator in parser.");
+        }
+        }
+        auto function_node = std::make_shared<FunctionNode>(operation, tok.text.data() - tmpl.content.c_str());
+
+        while (!operator_stack.empty() &&
+               ((operator_stack.top()->precedence > function_node->precedence) ||
+                (operator_stack.top()->precedence == function_node->precedence && function_node->associativity == FunctionNode::Associativity::Left))) {
+          add_operator(arguments, operator_stack);
+        }
+
+        operator_stack.emplace(function_node);
+      } break;
+      case Token::Kind::Comma: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          goto break_loop;
+        }
+      } break;
+      case Token::Kind::Colon: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          throw_parser_error("unexpected ':'");
+        }
+      } break;
+      case Token::Kind::LeftParen: {
+        get_next_token();
+        auto expr = parse_expression(tmpl);
+        if (tok.kind != Token::Kind::RightParen) {
+            throw_parser_error("expected right parenthesis, got '" + tok.describe() + "'");
+        }
+        if (!expr) {
+          throw_parser_error("empty expression in parentheses");
+        }
+        arguments.emplace_back(expr);
+      } break;
+
+      // parse function call pipe syntax
+      case Token::Kind::Pipe: {
+        // get function name
+        get_next_token();
+        if (tok.kind != Token::Kind::Id) {
+          throw_parser_error("expected function name, got '" + tok.describe() + "'");
+        }
+        auto func = std::make_shared<FunctionNode>(tok.text, tok.text.data() - tmpl.content.c_str());
+        // add first parameter as last value from arguments
+        func->number_args += 1;
+        func->arguments.emplace_back(arguments.back());
+        arguments.pop_back();
+        get_peek_token();
+        if (peek_tok.kind == Token::Kind::LeftParen) {
+          get_next_token();
+          // parse additional parameters
+          do {
+            get_next_token();
+            auto expr = parse_expression(tmpl);
+            if (!expr) {
+              break;
+            }
+            func->number_args += 1;
+            func->arguments.emplace_back(expr);
+          } while (tok.kind == Token::Kind::Comma);
+          if (tok.kind != Token::Kind::RightParen) {
+            throw_parser_error("expected right parenthesis, got '" + tok.describe() + "'");
+          }
+        }
+        // search store for defined function with such name and number of args
+        auto function_data = function_storage.find_function(func->name, func->number_args);
+        if (function_data.operation == FunctionStorage::Operation::None) {
+          if (!config.graceful_errors) {
+            throw_parser_error("unknown function " + func->name);
+          }
+          // In graceful mode, explicitly set operation to None to be handled at render time
+          func->operation = FunctionStorage::Operation::None;
+        } else {
+          func->operation = function_data.operation;
+          if (function_data.operation == FunctionStorage::Operation::Callback) {
+            func->callback = function_data.callback;
+          }
+        }
+        arguments.emplace_back(func);
+      } break;
+      default:
+        goto break_loop;
+      }
+
+      get_next_token();
+    }
+
+  break_loop:
+    while (!operator_stack.empty()) {
+      add_operator(arguments, operator_stack);
+    }
+
+    std::shared_ptr<ExpressionNode> expr;
+    if (arguments.size() == 1) {
+      expr = arguments[0];
+      arguments = {};
+    } else if (arguments.size() > 1) {
+      throw_parser_error("malformed expression");
+    }
+    return expr;
+  }
+
+  bool parse_statement(Template& tmpl, Token::Kind closing, const std::filesystem::path& path) {
+    if (tok.kind != Token::Kind::Id) {
+      return false;
+    }
+
+    if (tok.text == static_cast<decltype(tok.text)>("if")) {
+      get_next_token();
+
+      auto if_statement_node = std::make_shared<IfStatementNode>(current_block, tok.text.data() - tmpl.content.c_str());
+      current_block->nodes.emplace_back(if_statement_node);
+      if_statement_stack.emplace(if_statement_node.get());
+      current_block = &if_statement_node->true_statement;
+      current_expression_list = &if_statement_node->condition;
+
+      if (!parse_expression(tmpl, closing)) {
+        return false;
+      }
+    } else if (tok.text == static_cast<decltype(tok.text)>("elif")) {
+      // Handle elif as a direct alternative to else if
+      if (if_statement_stack.empty()) {
+        throw_parser_error("elif without matching if");
+      }
+      auto& if_statement_data = if_statement_stack.top();
+      get_next_token();
+
+      if_statement_data->has_false_statement = true;
+      current_block = &if_statement_data->false_statement;
+
+      auto if_statement_node = std::make_shared<IfStatementNode>(true, current_block, tok.text.data() - tmpl.content.c_str());
+      current_block->nodes.emplace_back(if_statement_node);
+      if_statement_stack.emplace(if_statement_node.get());
+      current_block = &if_statement_node->true_statement;
+      current_expression_list = &if_statement_node->condition;
+
+      if (!parse_expression(tmpl, closing)) {
+        return false;
+      }
+    } else if (tok.text == static_cast<decltype(tok.text)>("else")) {
+      if (if_statement_stack.empty()) {
+        throw_parser_error("else without matching if");
+      }
+      auto& if_statement_data = if_statement_stack.top();
+      get_next_token();
+
+      if_statement_data->has_false_statement = true;
+      current_block = &if_statement_data->false_statement;
+
+      // Chained else if
+      if (tok.kind == Token::Kind::Id && tok.text == static_cast<decltype(tok.text)>("if")) {
+        get_next_token();
+
+        auto if_statement_node = std::make_shared<IfStatementNode>(true, current_block, tok.text.data() - tmpl.content.c_str());
+        current_block->nodes.emplace_back(if_statement_node);
+        if_statement_stack.emplace(if_statement_node.get());
+        current_block = &if_statement_node->true_statement;
+        current_expression_list = &if_statement_node->condition;
+
+        if (!parse_expression(tmpl, closing)) {
+          return false;
+        }
+      }
+    } else if (tok.text == static_cast<decltype(tok.text)>("endif")) {
+      if (if_statement_stack.empty()) {
+        throw_parser_error("endif without matching if");
+      }
+
+      // Nested if statements
+      while (if_statement_stack.top()->is_nested) {
+        if_statement_stack.pop();
+      }
+
+      auto& if_statement_data = if_statement_stack.top();
+      get_next_token();
+
+      current_block = if_statement_data->parent;
+      if_statement_stack.pop();
+    } else if (tok.text == static_cast<decltype(tok.text)>("block")) {
+      get_next_token();
+
+      if (tok.kind != Token::Kind::Id) {
+        throw_parser_error("expected block name, got '" + tok.describe() + "'");
+      }
+
+      const std::string block_name = static_cast<std::string>(tok.text);
+
+      auto block_statement_node = std::make_shared<BlockStatementNode>(current_block, block_name, tok.text.data() - tmpl.content.c_str());
+      current_block->nodes.emplace_back(block_statement_node);
+      block_statement_stack.emplace(block_statement_node.get());
+      current_block = &block_statement_node->block;
+      auto success = tmpl.block_storage.emplace(block_name, block_statement_node);
+      if (!success.second) {
+        throw_parser_error("block with the name '" + block_name + "' does already exist");
+      }
+
+      get_next_token();
+    } else if (tok.text == static_cast<decltype(tok.text)>("endblock")) {
+      if (block_statement_stack.empty()) {
+        throw_parser_error("endblock without matching block");
+      }
+
+      auto& block_statement_data = block_statement_stack.top();
+      get_next_token();
+
+      current_block = block_statement_data->parent;
+      block_statement_stack.pop();
+    } else if (tok.text == static_cast<decltype(tok.text)>("for")) {
+      get_next_token();
+
+      // options: for a in arr; for a, b in obj
+      if (tok.kind != Token::Kind::Id) {
+        throw_parser_error("expected id, got '" + tok.describe() + "'");
+      }
+
+      Token value_token = tok;
+      get_next_token();
+
+      // Object type
+      std::shared_ptr<ForStatementNode> for_statement_node;
+      if (tok.kind == Token::Kind::Comma) {
+        get_next_token();
+        if (tok.kind != Token::Kind::Id) {
+          throw_parser_error("expected id, got '" + tok.describe() + "'");
+        }
+
+        const Token key_token = value_token;
+        value_token = tok;
+        get_next_token();
+
+        for_statement_node = std::make_shared<ForObjectStatementNode>(static_cast<std::string>(key_token.text), static_cast<std::string>(value_token.text),
+                                                                      current_block, tok.text.data() - tmpl.content.c_str());
+
+        // Array type
+      } else {
+        for_statement_node =
+            std::make_shared<ForArrayStatementNode>(static_cast<std::string>(value_token.text), current_block, tok.text.data() - tmpl.content.c_str());
+      }
+
+      current_block->nodes.emplace_back(for_statement_node);
+      for_statement_stack.emplace(for_statement_node.get());
+      current_block = &for_statement_node->body;
+      current_expression_list = &for_statement_node->condition;
+
+      if (tok.kind != Token::Kind::Id || tok.text != static_cast<decltype(tok.text)>("in")) {
+        throw_parser_error("expected 'in', got '" + tok.describe() + "'");
+      }
+      get_next_token();
+
+      if (!parse_expression(tmpl, closing)) {
+        return false;
+      }
+    } else if (tok.text == static_cast<decltype(tok.text)>("endfor")) {
+      if (for_statement_stack.empty()) {
+        throw_parser_error("endfor without matching for");
+      }
+
+      auto& for_statement_data = for_statement_stack.top();
+      get_next_token();
+
+      current_block = for_statement_data->parent;
+      for_statement_stack.pop();
+    } else if (tok.text == static_cast<decltype(tok.text)>("include")) {
+      get_next_token();
+
+      std::string template_name = parse_filename();
+      add_to_template_storage(path, template_name);
+
+      current_block->nodes.emplace_back(std::make_shared<IncludeStatementNode>(template_name, tok.text.data() - tmpl.content.c_str()));
+
+      get_next_token();
+    } else if (tok.text == static_cast<decltype(tok.text)>("extends")) {
+      get_next_token();
+
+      std::string template_name = parse_filename();
+      add_to_template_storage(path, template_name);
+
+      current_block->nodes.emplace_back(std::make_shared<ExtendsStatementNode>(template_name, tok.text.data() - tmpl.content.c_str()));
+
+      get_next_token();
+    } else if (tok.text == static_cast<decltype(tok.text)>("set")) {
+      get_next_token();
+
+      if (tok.kind != Token::Kind::Id) {
+        throw_parser_error("expected variable name, got '" + tok.describe() + "'");
+      }
+
+      const std::string key = static_cast<std::string>(tok.text);
+      get_next_token();
+
+      auto set_statement_node = std::make_shared<SetStatementNode>(key, tok.text.data() - tmpl.content.c_str());
+      current_block->nodes.emplace_back(set_statement_node);
+      current_expression_list = &set_statement_node->expression;
+
+      if (tok.text != static_cast<decltype(tok.text)>("=")) {
+        throw_parser_error("expected '=', got '" + tok.describe() + "'");
+      }
+      get_next_token();
+
+      if (!parse_expression(tmpl, closing)) {
+        return false;
+      }
+    } else if (tok.text == static_cast<decltype(tok.text)>("raw")) {
+      // For raw blocks, we need to capture literal content without parsing
+      // First, consume the closing %} of {% raw %}
+      get_next_token();
+      if (tok.kind != closing) {
+        throw_parser_error("expected statement close after 'raw'");
+      }
+      
+      // Now manually find {% endraw %} in the template content
+      const char* raw_start = tok.text.data() + tok.text.size();  // Start after %}
+      const char* search_pos = raw_start;
+      const char* content_end = tmpl.content.c_str() + tmpl.content.size();
+      const char* endraw_pos = nullptr;
+      
+      // Search for {% endraw
+      while (search_pos < content_end - 10) {  // Need at least 10 chars for "{% endraw"
+        if (search_pos[0] == '{' && search_pos[1] == '%') {
+          // Check if this is "endraw"
+          const char* check = search_pos + 2;
+          // Skip whitespace
+          while (check < content_end && (*check == ' ' || *check == '\t')) check++;
+          // Check for "endraw"
+          if (check + 6 <= content_end && 
+              check[0] == 'e' && check[1] == 'n' && check[2] == 'd' && 
+              check[3] == 'r' && check[4] == 'a' && check[5] == 'w') {
+            endraw_pos = search_pos;
+            break;
+          }
+        }
+        search_pos++;
+      }
+      
+      if (!endraw_pos) {
+        throw_parser_error("unmatched raw");
+      }
+      
+      // Create raw statement node with the captured content
+      const size_t content_pos = raw_start - tmpl.content.c_str();
+      const size_t content_length = endraw_pos - raw_start;
+      auto raw_statement_node = std::make_shared<RawStatementNode>(
+          content_pos, content_pos, content_length);
+      current_block->nodes.emplace_back(raw_statement_node);
+      
+      // Now we need to advance the lexer past {% endraw %}
+      // Scan through tokens until we find "endraw"
+      bool found_endraw = false;
+      while (!found_endraw) {
+        get_next_token();
+        if (tok.kind == Token::Kind::Eof) {
+          throw_parser_error("unmatched raw");
+        }
+        if (tok.kind == Token::Kind::Id && tok.text == static_cast<decltype(tok.text)>("endraw")) {
+          found_endraw = true;
+          get_next_token();  // Consume the closing %}
+          if (tok.kind != Token::Kind::StatementClose && tok.kind != Token::Kind::LineStatementClose) {
+            throw_parser_error("expected statement close after 'endraw'");
+          }
+        }
+      }
+    } else if (tok.text == static_cast<decltype(tok.text)>("endraw")) {
+      // endraw without matching raw
+      throw_parser_error("endraw without matching raw");
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void parse_into(Template& tmpl, const std::filesystem::path& path) {
+    lexer.start(tmpl.content);
+    current_block = &tmpl.root;
+
+    for (;;) {
+      get_next_token();
+      switch (tok.kind) {
+      case Token::Kind::Eof: {
+        if (!if_statement_stack.empty()) {
+          throw_parser_error("unmatched if");
+        }
+        if (!for_statement_stack.empty()) {
+          throw_parser_error("unmatched for");
+        }
+        current_block = nullptr;
+        return;
+      }
+      case Token::Kind::Text: {
+        current_block->nodes.emplace_back(std::make_shared<TextNode>(tok.text.data() - tmpl.content.c_str(), tok.text.size()));
+      } break;
+      case Token::Kind::StatementOpen: {
+        get_next_token();
+        if (!parse_statement(tmpl, Token::Kind::StatementClose, path)) {
+          throw_parser_error("expected statement, got '" + tok.describe() + "'");
+        }
+        if (tok.kind != Token::Kind::StatementClose) {
+          throw_parser_error("expected statement close, got '" + tok.describe() + "'");
+        }
+      } break;
+      case Token::Kind::LineStatementOpen: {
+        get_next_token();
+        if (!parse_statement(tmpl, Token::Kind::LineStatementClose, path)) {
+          throw_parser_error("expected statement, got '" + tok.describe() + "'");
+        }
+        if (tok.kind != Token::Kind::LineStatementClose && tok.kind != Token::Kind::Eof) {
+          throw_parser_error("expected line statement close, got '" + tok.describe() + "'");
+        }
+      } break;
+      case Token::Kind::ExpressionOpen: {
+        const size_t expr_start = tok.text.data() - tmpl.content.c_str();
+        get_next_token();
+
+        auto expression_list_node = std::make_shared<ExpressionListNode>(expr_start);
+        current_block->nodes.emplace_back(expression_list_node);
+        current_expression_list = expression_list_node.get();
+
+        if (!parse_expression(tmpl, Token::Kind::ExpressionClose)) {
+          throw_parser_error("expected expression close, got '" + tok.describe() + "'");
+        }
+        
+        // Calculate the length of the expression including delimiters
+        const size_t expr_end = tok.text.data() - tmpl.content.c_str() + tok.text.length();
+        current_expression_list->length = expr_end - expr_start;
+      } break;
+      case Token::Kind::CommentOpen: {
+        get_next_token();
+        if (tok.kind != Token::Kind::CommentClose) {
+          throw_parser_error("expected comment close, got '" + tok.describe() + "'");
+        }
+      } break;
+      default: {
+        throw_parser_error("unexpected token '" + tok.describe() + "'");
+      } break;
+      }
+    }
+    current_block = nullptr;
+  }
+
+public:
+  explicit Parser(const ParserConfig& parser_config, const LexerConfig& lexer_config, TemplateStorage& template_storage,
+                  const FunctionStorage& function_storage, std::shared_ptr<const TemplateStorage> shared_storage = nullptr)
+      : config(parser_config), lexer(lexer_config), template_storage(template_storage),
+        shared_template_storage(std::move(shared_storage)), function_storage(function_storage) {}
+
+  Template parse(std::string_view input, const std::filesystem::path& path) {
+    auto result = Template(std::string(input));
+    parse_into(result, path);
+    return result;
+  }
+
+  /// Shares the templates found in files with other parsers running in parallel
+  void set_concurrent_storage(ConcurrentTemplateStorage* storage) {
+    concurrent_storage = storage;
+  }
+
+  /// Remembers how include names were resolved across parsers
+  void set_include_cache(IncludeCache* cache) {
+    include_cache = cache;
+  }
+
+  void parse_into_template(Template& tmpl, const std::filesystem::path& filename) {
+    auto sub_parser = Parser(config, lexer.get_config(), template_storage, function_storage, shared_template_storage);
+    sub_parser.concurrent_storage = concurrent_storage;
+    sub_parser.include_cache = include_cache;
+    sub_parser.parse_into(tmpl, filename.parent_path());
+  }
+
+  static std::string load_file(const std::filesystem::path& filename) {
+    std::ifstream file;
+    file.open(filename);
+    if (file.fail()) {
+      INJA_THROW(FileError("failed accessing file at '" + filename.string() + "'"));
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return text;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_PARSER_HPP_
+
+// #include "preload.hpp"
+
+// #include "projection.hpp"
+#ifndef INCLUDE_INJA_PROJECTION_HPP_
+#define INCLUDE_INJA_PROJECTION_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// #include "analysis.hpp"
+
+// #include "json.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief Prefix tree of the paths into the input data that a template can read.
+ *
+ * A node marked as whole needs the complete value at its path, an iterated
+ * node needs all elements of its container (but only the parts of each
+ * element given by the wildcard child `*`). All other nodes only need the
+ * children listed below them.
+ */
+struct DataPathTree {
+  bool whole {false};
+  bool iterated {false};
+  std::map<std::string, DataPathTree> children;
+
+  /// Adds a path; if whole is false only the shape of the container at the path is required
+  void insert(const DataPath& path, bool whole_value = true) {
+    DataPathTree* node = this;
+    for (const auto& token : path) {
+      if (node->whole) {
+        return;
+      }
+      node = &node->children[token];
+    }
+
+    if (whole_value) {
+      node->whole = true;
+      node->children.clear();
+    } else {
+      node->iterated = true;
+    }
+  }
+
+  /// Returns whether anything at or below the given path might be read
+  bool needs(const DataPath& path) const {
+    return needs(path, 0);
+  }
+
+  /// Returns the JSON pointers of all whole and iterated nodes
+  std::vector<std::string> paths() const {
+    std::vector<std::string> result;
+    DataPath prefix;
+    collect(prefix, result);
+    return result;
+  }
+
+  /// Builds the tree from a dependency analysis; dynamic lookups make the whole input required
+  static DataPathTree from_analysis(const TemplateAnalysis& analysis) {
+    DataPathTree tree;
+    if (analysis.has_dynamic_lookups) {
+      tree.whole = true;
+      return tree;
+    }
+    for (const auto& path : analysis.iterated_paths) {
+      tree.insert(split_json_pointer(path), false);
+    }
+    for (const auto& path : analysis.input_paths) {
+      tree.insert(split_json_pointer(path), true);
+    }
+    return tree;
+  }
+
+private:
+  bool needs(const DataPath& path, size_t depth) const {
+    if (whole || depth == path.size()) {
+      return true;
+    }
+    const auto it = children.find(path[depth]);
+    if (it != children.end() && it->second.needs(path, depth + 1)) {
+      return true;
+    }
+    const auto any = children.find(TemplateAnalysis::any_element);
+    return any != children.end() && any->second.needs(path, depth + 1);
+  }
+
+  void collect(DataPath& prefix, std::vector<std::string>& result) const {
+    if (whole || iterated) {
+      result.emplace_back(join_json_pointer(prefix));
+    }
+    for (const auto& [token, child] : children) {
+      prefix.push_back(token);
+      child.collect(prefix, result);
+      prefix.pop_back();
+    }
+  }
+};
+
+namespace detail {
+
+inline json project_nodes(const json& value, const std::vector<const DataPathTree*>& nodes) {
+  bool iterated = false;
+  for (const auto* node : nodes) {
+    if (node->whole) {
+      return value;
+    }
+    iterated = iterated || node->iterated;
+  }
+
+  // Collect the subtrees applying to a child, including the wildcard
+  const auto child_nodes = [&nodes](const std::string& token) {
+    std::vector<const DataPathTree*> result;
+    for (const auto* node : nodes) {
+      const auto named = node->children.find(token);
+      if (named != node->children.end()) {
+        result.push_back(&named->second);
+      }
+      const auto any = node->children.find(TemplateAnalysis::any_element);
+      if (any != node->children.end() && any != named) {
+        result.push_back(&any->second);
+      }
+    }
+    return result;
+  };
+
+  const bool has_wildcard = std::any_of(nodes.begin(), nodes.end(), [](const DataPathTree* node) {
+    return node->children.count(TemplateAnalysis::any_element) > 0;
+  });
+
+  if (value.is_object()) {
+    json result = json::object();
+    if (iterated || has_wildcard) {
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        const auto sub_nodes = child_nodes(it.key());
+        if (!sub_nodes.empty()) {
+          result[it.key()] = project_nodes(it.value(), sub_nodes);
+        } else if (iterated) {
+          result[it.key()] = nullptr; // Keep the key for iteration
+        }
+      }
+    } else {
+      for (const auto* node : nodes) {
+        for (const auto& [token, child] : node->children) {
+          const auto it = value.find(token);
+          if (it != value.end() && !result.contains(token)) {
+            result[token] = project_nodes(*it, child_nodes(token));
+          }
+        }
+      }
+    }
+    return result;
+
+  } else if (value.is_array()) {
+    size_t size = value.size();
+    if (!iterated && !has_wildcard) {
+      // Only keep the array up to the highest index that is read
+      size_t max_index = 0;
+      bool any_index = false;
+      for (const auto* node : nodes) {
+        for (const auto& [token, child] : node->children) {
+          if (!token.empty() && std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            max_index = std::max(max_index, static_cast<size_t>(std::stoull(token)));
+            any_index = true;
+          }
+        }
+      }
+      size = any_index ? std::min(size, max_index + 1) : 0;
+    }
+
+    json result = json::array();
+    for (size_t i = 0; i < size; ++i) {
+      const auto sub_nodes = child_nodes(std::to_string(i));
+      result.push_back(sub_nodes.empty() ? json(nullptr) : project_nodes(value[i], sub_nodes));
+    }
+    return result;
+  }
+
+  return value;
+}
+
+} // namespace detail
+
+/*!
+ * \brief Projects the input data down to the parts required by a path tree.
+ *
+ * Rendering a template with the projection of its required paths gives the
+ * same result as rendering it with the full data. Array elements that are
+ * not read are kept as null so that the indices of the others stay valid.
+ */
+inline json project(const json& data, const DataPathTree& tree) {
+  return detail::project_nodes(data, {&tree});
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_PROJECTION_HPP_
+
+// #include "reflect.hpp"
+#ifndef INCLUDE_INJA_REFLECT_HPP_
+#define INCLUDE_INJA_REFLECT_HPP_
+
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// #include "data_provider.hpp"
+
+// #include "json.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief A member of a reflected struct, with its name in templates.
+ */
+template <class MemberPointer> struct ReflectedField {
+  std::string_view name;
+  MemberPointer pointer;
+};
+
+/*!
+ * \brief Members of a struct that templates can read, specialized by INJA_REFLECT.
+ *
+ * A specialization derives from std::true_type and has a static function
+ * fields() returning a tuple of ReflectedField.
+ */
+template <class T> struct Reflect : std::false_type {};
+
+namespace detail {
+
+template <class T> struct is_optional : std::false_type {};
+template <class T> struct is_optional<std::optional<T>> : std::true_type {};
+
+template <class T, class = void> struct is_pointer_like : std::is_pointer<T> {};
+template <class T> struct is_pointer_like<T, std::void_t<typename T::element_type, decltype(std::declval<const T&>().get())>> : std::true_type {};
+
+template <class T> constexpr bool is_string_like = std::is_convertible_v<const T&, std::string_view>;
+
+template <class T, class = void> struct is_string_map : std::false_type {};
+template <class T> struct is_string_map<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::is_same<typename T::key_type, std::string> {};
+
+template <class T, class = void> struct is_range : std::false_type {};
+template <class T>
+struct is_range<T, std::void_t<decltype(std::begin(std::declval<const T&>())), decltype(std::end(std::declval<const T&>()))>> : std::true_type {};
+
+template <class T> constexpr bool is_sequence = is_range<T>::value && !is_string_like<T> && !is_string_map<T>::value && !Reflect<T>::value;
+
+template <class> constexpr bool always_false = false;
+
+inline bool parse_index(const std::string& key, size_t& index) {
+  if (key.empty() || key.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  index = std::stoul(key);
+  return true;
+}
+
+/// Converts a value to json, reflected structs become objects of their fields
+template <class T> json to_json_value(const T& value) {
+  if constexpr (std::is_same_v<T, json>) {
+    return value;
+  } else if constexpr (is_optional<T>::value || is_pointer_like<T>::value) {
+    return value ? to_json_value(*value) : json();
+  } else if constexpr (Reflect<T>::value) {
+    json result = json::object();
+    std::apply([&](const auto&... field) { ((result[static_cast<std::string>(field.name)] = to_json_value(value.*field.pointer)), ...); },
+               Reflect<T>::fields());
+    return result;
+  } else if constexpr (is_string_like<T>) {
+    return json(std::string(std::string_view(value)));
+  } else if constexpr (std::is_arithmetic_v<T>) {
+    return json(value);
+  } else if constexpr (is_string_map<T>::value) {
+    json result = json::object();
+    for (const auto& [key, element] : value) {
+      result[key] = to_json_value(element);
+    }
+    return result;
+  } else if constexpr (is_range<T>::value) {
+    json result = json::array();
+    for (const auto& element : value) {
+      result.push_back(to_json_value(element));
+    }
+    return result;
+  } else if constexpr (std::is_constructible_v<json, const T&>) {
+    return json(value);
+  } else {
+    static_assert(always_false<T>, "type is neither reflected with INJA_REFLECT nor convertible to json");
+  }
+}
+
+/// Follows the path from the value and calls the function with the value at its end; returns false if there is none
+template <class T, class Function> bool navigate(const T& value, DataProvider::Path::const_iterator it, DataProvider::Path::const_iterator end, Function& function) {
+  if constexpr (is_optional<T>::value || is_pointer_like<T>::value) {
+    if (!value) {
+      if (it != end) {
+        return false;
+      }
+      function(json());
+      return true;
+    }
+    return navigate(*value, it, end, function);
+  } else {
+    if (it == end) {
+      function(value);
+      return true;
+    }
+
+    size_t index {0};
+    if constexpr (std::is_same_v<T, json>) {
+      if (value.is_object()) {
+        const auto element = value.find(*it);
+        return element != value.end() && navigate(*element, it + 1, end, function);
+      } else if (value.is_array() && parse_index(*it, index) && index < value.size()) {
+        return navigate(value[index], it + 1, end, function);
+      }
+      return false;
+    } else if constexpr (Reflect<T>::value) {
+      bool found = false;
+      std::apply([&](const auto&... field) { (void)((field.name == *it && (found = navigate(value.*field.pointer, it + 1, end, function), true)) || ...); },
+                 Reflect<T>::fields());
+      return found;
+    } else if constexpr (is_string_map<T>::value) {
+      const auto element = value.find(*it);
+      return element != value.end() && navigate(element->second, it + 1, end, function);
+    } else if constexpr (is_sequence<T>) {
+      if (!parse_index(*it, index) || index >= static_cast<size_t>(std::distance(std::begin(value), std::end(value)))) {
+        return false;
+      }
+      return navigate(*std::next(std::begin(value), static_cast<std::ptrdiff_t>(index)), it + 1, end, function);
+    } else {
+      return false;
+    }
+  }
+}
+
+} // namespace detail
+
+/*!
+ * \brief Provides C++ objects to templates without converting them to json first.
+ *
+ * Objects are bound by name, or as the root whose members are the top-level
+ * variables. Paths are resolved through structs reflected with INJA_REFLECT,
+ * optionals, pointers, maps with string keys and ranges. Only the values a
+ * template reads are converted to json, and loops over ranges only ask for
+ * their size. Objects bound as lvalues must outlive all renders with the
+ * provider, temporaries are moved into it.
+ */
+class ObjectDataProvider : public DataProvider {
+  struct Binding {
+    std::function<std::optional<json>(const Path&)> lookup;
+    std::function<std::optional<size_t>(const Path&)> array_size;
+    std::function<std::optional<std::vector<std::string>>(const Path&)> object_keys;
+  };
+
+  std::map<std::string, Binding, std::less<>> bindings;
+  std::optional<Binding> root;
+
+  // The owner keeps an object moved into the provider alive, it is null for objects owned by the caller
+  template <class T> static Binding make_binding(const T& object, size_t skip, std::shared_ptr<const void> owner = nullptr) {
+    Binding binding;
+    binding.lookup = [&object, skip, owner](const Path& path) -> std::optional<json> {
+      std::optional<json> result;
+      auto function = [&result](const auto& value) { result = detail::to_json_value(value); };
+      detail::navigate(object, path.begin() + skip, path.end(), function);
+      return result;
+    };
+    binding.array_size = [&object, skip, owner](const Path& path) -> std::optional<size_t> {
+      std::optional<size_t> result;
+      auto function = [&result](const auto& value) {
+        using U = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<U, json>) {
+          if (value.is_array()) {
+            result = value.size();
+          }
+        } else if constexpr (detail::is_sequence<U>) {
+          result = static_cast<size_t>(std::distance(std::begin(value), std::end(value)));
+        }
+      };
+      detail::navigate(object, path.begin() + skip, path.end(), function);
+      return result;
+    };
+    binding.object_keys = [&object, skip, owner](const Path& path) -> std::optional<std::vector<std::string>> {
+      std::optional<std::vector<std::string>> result;
+      auto function = [&result](const auto& value) {
+        using U = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<U, json>) {
+          if (value.is_object()) {
+            result.emplace();
+            for (auto it = value.begin(); it != value.end(); ++it) {
+              result->push_back(it.key());
+            }
+          }
+        } else if constexpr (Reflect<U>::value) {
+          result.emplace();
+          std::apply([&result](const auto&... field) { (result->emplace_back(field.name), ...); }, Reflect<U>::fields());
+        } else if constexpr (detail::is_string_map<U>::value) {
+          result.emplace();
+          for (const auto& element : value) {
+            result->push_back(element.first);
+          }
+        }
+      };
+      detail::navigate(object, path.begin() + skip, path.end(), function);
+      return result;
+    };
+    return binding;
+  }
+
+  /// Returns the binding the path starts in
+  const Binding* find_binding(const Path& path) const {
+    if (!path.empty()) {
+      const auto it = bindings.find(path.front());
+      if (it != bindings.end()) {
+        return &it->second;
+      }
+    }
+    return root ? &*root : nullptr;
+  }
+
+public:
+  ObjectDataProvider() = default;
+
+  /// Makes the members of the object the top-level variables, after the objects bound by name
+  template <class T> explicit ObjectDataProvider(const T& root_object): root(make_binding(root_object, 0)) {}
+
+  /// Makes the members of the temporary object the top-level variables, the object is moved into the provider
+  template <class T, std::enable_if_t<!std::is_lvalue_reference_v<T>, int> = 0> explicit ObjectDataProvider(T&& root_object) {
+    const auto owned = std::make_shared<const std::decay_t<T>>(std::move(root_object));
+    root = make_binding(*owned, 0, owned);
+  }
+
+  /// Makes the object available as the variable with the given name
+  template <class T> ObjectDataProvider& bind(const std::string& name, const T& object) {
+    bindings.insert_or_assign(name, make_binding(object, 1));
+    return *this;
+  }
+
+  /// Makes the temporary object available as the variable with the given name, the object is moved into the provider
+  template <class T, std::enable_if_t<!std::is_lvalue_reference_v<T>, int> = 0> ObjectDataProvider& bind(const std::string& name, T&& object) {
+    const auto owned = std::make_shared<const std::decay_t<T>>(std::move(object));
+    bindings.insert_or_assign(name, make_binding(*owned, 1, owned));
+    return *this;
+  }
+
+  std::optional<json> lookup(const Path& path) const override {
+    const auto* binding = find_binding(path);
+    return binding ? binding->lookup(path) : std::nullopt;
+  }
+
+  std::optional<size_t> array_size(const Path& path) const override {
+    const auto* binding = find_binding(path);
+    return binding ? binding->array_size(path) : std::nullopt;
+  }
+
+  std::optional<std::vector<std::string>> object_keys(const Path& path) const override {
+    const auto* binding = find_binding(path);
+    return binding ? binding->object_keys(path) : std::nullopt;
+  }
+};
+
+} // namespace inja
+
+/*!
+ * \brief Makes the listed public members of a struct readable by templates, e.g. `INJA_REFLECT(Actor, name, level)`.
+ *
+ * Must be used at global scope, for up to 24 members.
+ */
+#define INJA_REFLECT(Type, ...) \
+  template <> struct inja::Reflect<Type> : std::true_type { \
+    static constexpr auto fields() { \
+      return std::make_tuple(INJA_REFLECT_EXPAND(INJA_REFLECT_CONCAT(INJA_REFLECT_FIELDS_, INJA_REFLECT_COUNT(__VA_ARGS__))(Type, __VA_ARGS__))); \
+    } \
+  };
+
+#define INJA_REFLECT_FIELD(Type, field) inja::ReflectedField<decltype(&Type::field)> {#field, &Type::field}
+#define INJA_REFLECT_EXPAND(x) x
+#define INJA_REFLECT_CONCAT(a, b) INJA_REFLECT_CONCAT_(a, b)
+#define INJA_REFLECT_CONCAT_(a, b) a##b
+#define INJA_REFLECT_COUNT(...) INJA_REFLECT_EXPAND(INJA_REFLECT_COUNT_(__VA_ARGS__, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define INJA_REFLECT_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, N, ...) N
+#define INJA_REFLECT_FIELDS_1(Type, field) INJA_REFLECT_FIELD(Type, field)
+#define INJA_REFLECT_FIELDS_2(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_1(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_3(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_2(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_4(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_3(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_5(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_4(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_6(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_5(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_7(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_6(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_8(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_7(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_9(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_8(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_10(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_9(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_11(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_10(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_12(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_11(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_13(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_12(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_14(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_13(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_15(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_14(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_16(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_15(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_17(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_16(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_18(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_17(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_19(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_18(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_20(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_19(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_21(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_20(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_22(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_21(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_23(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_22(Type, __VA_ARGS__))
+#define INJA_REFLECT_FIELDS_24(Type, field, ...) INJA_REFLECT_FIELD(Type, field), INJA_REFLECT_EXPAND(INJA_REFLECT_FIELDS_23(Type, __VA_ARGS__))
+
+#endif // INCLUDE_INJA_REFLECT_HPP_
+
+// #include "renderer.hpp"
+
+// #include "specializer.hpp"
+
+// #include "stream.hpp"
+#ifndef INCLUDE_INJA_STREAM_HPP_
+#define INCLUDE_INJA_STREAM_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// #include "exceptions.hpp"
+
+// #include "throw.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief A coroutine yielding values one by one when they are pulled, e.g. by a range-based for loop.
+ */
+template <class T>
+class Generator {
+public:
+  struct promise_type {
+    T current {};
+    std::exception_ptr error;
+
+    Generator get_return_object() {
+      return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_always yield_value(T value) noexcept {
+      current = std::move(value);
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() {
+      error = std::current_exception();
+    }
+  };
+
+  class iterator {
+    std::coroutine_handle<promise_type> handle;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    explicit iterator(std::coroutine_handle<promise_type> handle = nullptr): handle(handle) {}
+
+    const T& operator*() const {
+      return handle.promise().current;
+    }
+
+    iterator& operator++() {
+      resume(handle);
+      return *this;
+    }
+
+    void operator++(int) {
+      ++*this;
+    }
+
+    bool operator==(std::default_sentinel_t) const {
+      return !handle || handle.done();
+    }
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Generator(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+  static void resume(std::coroutine_handle<promise_type> handle) {
+    handle.resume();
+    if (handle.promise().error) {
+      std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+    }
+  }
+
+public:
+  Generator(Generator&& other) noexcept: handle(std::exchange(other.handle, nullptr)) {}
+
+  Generator& operator=(Generator&& other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+
+  ~Generator() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  /// Runs the coroutine to its first value, so begin() must be called only once
+  iterator begin() {
+    if (handle) {
+      resume(handle);
+    }
+    return iterator(handle);
+  }
+
+  std::default_sentinel_t end() const noexcept {
+    return {};
+  }
+};
+
+/*!
+ * \brief A stream buffer handing chunks of output from a render to a consumer on another thread.
+ *
+ * At most one chunk waits for the consumer while the next one is written, so
+ * the memory is bounded by twice the chunk size. The render is blocked while
+ * the consumer is behind, and stopped with an InterruptError once its stop
+ * token is stopped.
+ */
+class OutputChannel : public std::streambuf {
+  const size_t chunk_size;
+  std::string filling;   // Written by the render
+  std::string ready;     // Read by the consumer
+  size_t ready_size {0};
+  bool has_ready {false};
+  bool consumed {false}; // The consumer holds a view of the ready chunk
+  bool closed {false};
+  std::exception_ptr error;
+  std::vector<RenderErrorInfo> render_errors;
+  std::stop_token stop_token;
+
+  std::mutex mutex;
+  std::condition_variable_any changed;
+
+  void publish() {
+    const size_t size = static_cast<size_t>(pptr() - pbase());
+    if (size == 0) {
+      return;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!changed.wait(lock, stop_token, [this] { return !has_ready; })) {
+        INJA_THROW(InterruptError("render was cancelled"));
+      }
+      std::swap(filling, ready);
+      ready_size = size;
+      has_ready = true;
+    }
+    changed.notify_all();
+
+    filling.resize(chunk_size);
+    setp(filling.data(), filling.data() + chunk_size);
+  }
+
+protected:
+  int_type overflow(int_type ch) override {
+    publish();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+public:
+  explicit OutputChannel(size_t chunk_size): chunk_size(std::max<size_t>(chunk_size, 1)) {
+    filling.resize(this->chunk_size);
+    setp(filling.data(), filling.data() + this->chunk_size);
+  }
+
+  /// Sets the token that cancels a render waiting for the consumer
+  void set_stop_token(std::stop_token token) {
+    stop_token = std::move(token);
+  }
+
+  /// Hands the rest of the output to the consumer and ends the stream, with the exception of the render if there was one
+  void close(std::exception_ptr render_error, std::vector<RenderErrorInfo> errors) {
+    if (!render_error) {
+      try {
+        publish();
+      } catch (...) {
+        render_error = std::current_exception();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = render_error;
+      render_errors = std::move(errors);
+      closed = true;
+    }
+    changed.notify_all();
+  }
+
+  /// Returns the next chunk, valid until the next call, or std::nullopt at the end; rethrows the exception of the render
+  std::optional<std::string_view> next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (consumed) {
+      consumed = false;
+      has_ready = false;
+      changed.notify_all();
+    }
+
+    changed.wait(lock, [this] { return has_ready || closed; });
+    if (has_ready) {
+      consumed = true;
+      return std::string_view(ready.data(), ready_size);
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return std::nullopt;
+  }
+
+  /// Errors of graceful error mode, once the stream ended
+  const std::vector<RenderErrorInfo>& get_render_errors() const {
+    return render_errors;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_STREAM_HPP_
+
+// #include "template.hpp"
+
+// #include "thread_pool.hpp"
+
+// #include "throw.hpp"
+
+// #include "watcher.hpp"
+#ifndef INCLUDE_INJA_WATCHER_HPP_
+#define INCLUDE_INJA_WATCHER_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define INJA_HAS_INOTIFY 1
+#endif
+
+// #include "bundle.hpp"
+
+// #include "preload.hpp"
+
+// #include "template.hpp"
+
+
+namespace inja {
+
+/// Called by the template watcher with the reloaded templates and all templates that include or extend them
+using TemplateReloadCallback = std::function<void(const std::vector<std::string>& reloaded)>;
+
+/*!
+ * \brief Watches files for changes of their modification time.
+ *
+ * On Linux, inotify on the directories of the files wakes the watcher up as
+ * soon as something changed. Elsewhere, or if inotify is not available, the
+ * files are polled. In both cases, a file counts as changed if its
+ * modification time differs from the last one seen.
+ */
+class FileWatcher {
+  std::map<std::string, int64_t> modification_times;
+
+#ifdef INJA_HAS_INOTIFY
+  int inotify_fd {-1};
+  std::set<std::string> watched_directories;
+#endif
+
+public:
+  /// Uses notifications of the operating system if available and enabled, and polling otherwise
+  explicit FileWatcher(bool use_notifications = true) {
+#ifdef INJA_HAS_INOTIFY
+    if (use_notifications) {
+      inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+#else
+    (void)use_notifications;
+#endif
+  }
+
+  ~FileWatcher() {
+#ifdef INJA_HAS_INOTIFY
+    if (inotify_fd >= 0) {
+      ::close(inotify_fd);
+    }
+#endif
+  }
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  /// Returns whether changes are notified instead of polled
+  bool uses_notifications() const {
+#ifdef INJA_HAS_INOTIFY
+    return inotify_fd >= 0;
+#else
+    return false;
+#endif
+  }
+
+  bool is_watching(const std::string& filename) const {
+    return modification_times.count(filename) > 0;
+  }
+
+  /// Starts watching a file, changes before this call are not reported
+  void watch(const std::string& filename) {
+    modification_times.insert_or_assign(filename, file_modification_time(filename));
+
+#ifdef INJA_HAS_INOTIFY
+    if (inotify_fd >= 0) {
+      auto directory = std::filesystem::path(filename).parent_path().string();
+      if (directory.empty()) {
+        directory = ".";
+      }
+      if (watched_directories.insert(directory).second) {
+        ::inotify_add_watch(inotify_fd, directory.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_TO);
+      }
+    }
+#endif
+  }
+
+  /// Waits up to the timeout for a notification of a change, always returns false after the timeout when polling
+  bool wait_for_notification(std::chrono::milliseconds timeout) {
+#ifdef INJA_HAS_INOTIFY
+    if (inotify_fd >= 0) {
+      pollfd descriptor {inotify_fd, POLLIN, 0};
+      if (::poll(&descriptor, 1, static_cast<int>(timeout.count())) <= 0) {
+        return false;
+      }
+
+      // Drain all events, the modification times tell which files changed
+      alignas(inotify_event) char buffer[4096];
+      while (::read(inotify_fd, buffer, sizeof(buffer)) > 0) {
+      }
+      return true;
+    }
+#endif
+    std::this_thread::sleep_for(timeout);
+    return false;
+  }
+
+  /// Returns the files whose modification time changed since the last call
+  std::vector<std::string> changed_files() {
+    std::vector<std::string> result;
+    for (auto& [filename, modification_time] : modification_times) {
+      const int64_t current = file_modification_time(filename);
+      if (current != modification_time) {
+        modification_time = current;
+        result.push_back(filename);
+      }
+    }
+    return result;
+  }
+};
+
+/// Returns the given templates and all templates that include or extend them, directly or indirectly
+inline std::vector<std::string> dependent_templates(const TemplateStorage& storage, const std::vector<std::string>& names) {
+  std::map<std::string, std::vector<std::string>> dependents;
+  for (const auto& [name, tmpl] : storage) {
+    for (const auto& dependency : template_dependencies(tmpl)) {
+      dependents[dependency].push_back(name);
+    }
+  }
+
+  std::set<std::string> found(names.begin(), names.end());
+  std::vector<std::string> result(names.begin(), names.end());
+  for (size_t i = 0; i < result.size(); ++i) {
+    const auto it = dependents.find(result[i]);
+    if (it == dependents.end()) {
+      continue;
+    }
+    for (const auto& dependent : it->second) {
+      if (found.insert(dependent).second) {
+        result.push_back(dependent);
+      }
+    }
+  }
+  return result;
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_WATCHER_HPP_
+
+
+namespace inja {
+
+// Forward declaration
+class Environment;
+void register_array_functions(Environment& env);
+
+/*!
+ * \brief Class for changing the configuration.
+ *
+ * Thread-safety design:
+ * - function_storage and template_storage use atomic shared_ptr for lock-free reads
+ * - Write operations (add_callback, include_template) use copy-on-write with a mutex
+ * - Render errors are thread-local so each thread sees its own errors
+ * - Parse operations use a thread-local cache that merges into shared storage after completion
+ */
+class Environment {
+  // Atomic shared_ptr for lock-free read access to functions during render
+  std::atomic<std::shared_ptr<FunctionStorage>> function_storage_{
+      std::make_shared<FunctionStorage>()
+  };
+
+  // Atomic shared_ptr for lock-free read access to templates during render
+  std::atomic<std::shared_ptr<TemplateStorage>> template_storage_{
+      std::make_shared<TemplateStorage>()
+  };
+
+  // Mutex for coordinating write operations (brief, rare)
+  mutable std::mutex write_mutex_;
+
+  // Incremented with every change of render_config, guarded by write_mutex_
+  size_t render_config_version_ {0};
+
+  // Identifies the environment in the renderers reused by render_async()
+  static inline std::atomic<size_t> next_id_ {1};
+  const size_t id_ {next_id_.fetch_add(1, std::memory_order_relaxed)};
+
+  // Built-in executor of render_async(), started on first use
+  std::unique_ptr<ThreadPool> async_pool_;
+
+  std::shared_ptr<CallbackCache> callback_cache_; // Optional callback cache
+
+  // How include names were resolved, shared by all parsers of this environment
+  std::shared_ptr<IncludeCache> include_cache_ {std::make_shared<IncludeCache>()};
+
+  // Variables of the setup template shared by all renders, see set_globals_from()
+  std::atomic<std::shared_ptr<const GlobalScope>> globals_;
+
+  // Number of renders after which a template is compiled in the background, 0 disables compilation
+  std::atomic<size_t> compile_threshold_ {0};
+
+  // Worker compiling hot templates, started on first use and joined by the destructor
+  std::unique_ptr<ThreadPool> compile_pool_;
+  std::shared_ptr<std::atomic<bool>> compile_cancelled_ {std::make_shared<std::atomic<bool>>(false)};
+
+  // Modification times of the template files loaded by load_bundle() or preload_directory(), by template name
+  std::map<std::string, int64_t> preloaded_modification_times_;
+
+  // Background thread reloading changed template files, see watch_templates()
+  std::thread watcher_thread_;
+  std::atomic<bool> stop_watching_ {false};
+
+  // Thread-local storage for render errors (each thread sees its own errors)
+  static inline thread_local std::vector<RenderErrorInfo> tl_render_errors_;
+
+  // A render submitted by render_async(), with the snapshot of the environment it was submitted with
+  struct AsyncRender {
+    Template tmpl;
+    json data;
+    std::shared_ptr<const CompiledTemplate> compiled;
+    std::shared_ptr<TemplateStorage> template_storage;
+    std::shared_ptr<FunctionStorage> function_storage;
+    std::shared_ptr<const GlobalScope> globals;
+    RenderConfig config;
+    size_t environment_id;
+    size_t config_version;
+    std::stop_token stop_token;
+    std::chrono::steady_clock::time_point deadline;
+    std::function<void(RenderResult, std::exception_ptr)> on_complete;
+    std::ostream* output {nullptr}; // Receives the output instead of the result, see render_stream()
+  };
+
+  // Renderer of asynchronous renders on this thread, reused as long as the environment is unchanged
+  struct ThreadRenderer {
+    size_t environment_id {0};
+    size_t config_version {0};
+    std::shared_ptr<TemplateStorage> template_storage;
+    std::shared_ptr<FunctionStorage> function_storage;
+    std::unique_ptr<Renderer> renderer;
+    bool in_use {false}; // Renders started while waiting inside another render get their own renderer
+  };
+
+  // Thread-local cache for templates discovered during parsing
+  // This allows lock-free parsing; templates are merged into shared storage after parse completes
+  static inline thread_local TemplateStorage tl_parse_cache_;
+
+protected:
+  LexerConfig lexer_config;
+  ParserConfig parser_config;
+  RenderConfig render_config;
+
+  std::filesystem::path input_path;
+  std::filesystem::path output_path;
+
+private:
+  void init_default_functions() {
+    register_array_functions(*this);
+  }
+
+  // Count a render of the template and return its compiled form if it is current for the snapshots
+  std::shared_ptr<const CompiledTemplate> select_compiled(const Template& tmpl, const std::shared_ptr<TemplateStorage>& tmpl_storage,
+                                                          const std::shared_ptr<FunctionStorage>& func_storage, const RenderConfig& config) {
+    const size_t threshold = compile_threshold_.load(std::memory_order_relaxed);
+    if (threshold == 0 || !tmpl.tier) {
+      return nullptr;
+    }
+
+    auto compiled = tmpl.tier->compiled.load(std::memory_order_acquire);
+    if (compiled && compiled->is_current(tmpl_storage.get(), func_storage.get(), config)) {
+      return compiled;
+    }
+
+    // Cold or outdated: compile once the template got hot, without blocking the render
+    if (tmpl.tier->render_count.fetch_add(1, std::memory_order_relaxed) + 1 >= threshold && !tmpl.tier->compiling.exchange(true)) {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      if (!compile_pool_) {
+        compile_pool_ = std::make_unique<ThreadPool>(1);
+      }
+      compile_pool_->execute([tier = tmpl.tier, source = tmpl, config, tmpl_storage, func_storage, cancelled = compile_cancelled_]() {
+        if (!cancelled->load(std::memory_order_acquire)) {
+          try {
+            TemplateCompiler compiler(config, tmpl_storage, func_storage);
+            tier->compiled.store(compiler.compile(source), std::memory_order_release);
+          } catch (...) {
+            // Keep rendering the source template, and retry after the next threshold renders
+            tier->render_count.store(0, std::memory_order_relaxed);
+          }
+        }
+        tier->compiling.store(false, std::memory_order_release);
+      });
+    }
+    return nullptr;
+  }
+
+  // Merge thread-local parse cache into shared template storage
+  // Called after parse() completes to publish discovered templates
+  void merge_parse_cache() {
+    if (tl_parse_cache_.empty()) return;
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with merged templates
+    auto current = template_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<TemplateStorage>(*current);
+
+    // Copy templates from thread-local cache to new storage
+    // (structured binding keys are const, so we copy rather than move)
+    for (const auto& [name, tmpl] : tl_parse_cache_) {
+      new_storage->try_emplace(name, tmpl);
+    }
+
+    // Atomic swap - renders in progress keep using old storage
+    template_storage_.store(new_storage, std::memory_order_release);
+    tl_parse_cache_.clear();
+  }
+
+  bool has_cost_limits() const {
+    const auto& limits = parser_config.cost_limits;
+    return limits.max_loop_depth > 0 || limits.max_estimated_cost > 0.0;
+  }
+
+  // Estimates the cost with includes looked up in the given storage
+  CostReport estimate_cost(const TemplateStorage& tmpl_storage, const Template& tmpl, size_t assumed_loop_size) const {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    CostVisitor visitor(tmpl_storage, *func_storage, nullptr, assumed_loop_size);
+    return visitor.estimate(tmpl);
+  }
+
+  // Reject templates whose estimated render cost exceeds the configured limits
+  // Includes are looked up in the storage, and in the templates discovered by the current parse that are not published yet
+  void check_cost_limits(const Template& tmpl, const TemplateStorage& storage, const TemplateStorage& discovered = {}) const {
+    if (!has_cost_limits()) {
+      return;
+    }
+    if (!discovered.empty()) {
+      TemplateStorage merged = storage;
+      for (const auto& [name, discovered_tmpl] : discovered) {
+        merged.try_emplace(name, discovered_tmpl);
+      }
+      check_cost_limits(tmpl, merged);
+      return;
+    }
+
+    const auto& limits = parser_config.cost_limits;
+    const auto report = estimate_cost(storage, tmpl, limits.assumed_loop_size);
+    if (limits.max_loop_depth > 0 && report.max_loop_depth > limits.max_loop_depth) {
+      const auto loop = std::find_if(report.loops.begin(), report.loops.end(), [&limits](const LoopCost& l) { return l.depth > limits.max_loop_depth; });
+      INJA_THROW(ParserError("loop nesting depth " + std::to_string(report.max_loop_depth) + " exceeds the limit of " + std::to_string(limits.max_loop_depth),
+                             loop->location));
+    }
+    if (limits.max_estimated_cost > 0.0 && report.estimated_cost > limits.max_estimated_cost) {
+      INJA_THROW(ParserError("estimated render cost " + std::to_string(static_cast<size_t>(report.estimated_cost)) + " exceeds the limit of " +
+                                 std::to_string(static_cast<size_t>(limits.max_estimated_cost)),
+                             SourceLocation {1, 1}));
+    }
+  }
+
+public:
+  // Get thread-local errors from current thread's last render
+  const std::vector<RenderErrorInfo>& get_last_render_errors() const {
+    return tl_render_errors_;
+  }
+
+  // Clear thread-local errors (called at start of render)
+  void clear_render_errors() {
+    tl_render_errors_.clear();
+  }
+
+  // Add error to thread-local storage (called by Renderer)
+  static void add_render_error(const RenderErrorInfo& error) {
+    tl_render_errors_.push_back(error);
+  }
+
+  // Get function storage snapshot for lock-free reads (used by Parser/Renderer)
+  std::shared_ptr<FunctionStorage> get_function_storage_snapshot() const {
+    return function_storage_.load(std::memory_order_acquire);
+  }
+
+  // Get template storage snapshot for lock-free reads (used by Renderer)
+  std::shared_ptr<TemplateStorage> get_template_storage_snapshot() const {
+    return template_storage_.load(std::memory_order_acquire);
+  }
+
+  // Add template to thread-local parse cache (called during parsing)
+  static void add_to_parse_cache(const std::string& name, Template tmpl) {
+    tl_parse_cache_[name] = std::move(tmpl);
+  }
+
+  // Find template - check thread-local cache first, then shared storage
+  // Returns nullptr if not found
+  const Template* find_template(const std::string& name) const {
+    // Check thread-local parse cache first (no lock, no atomic)
+    auto it = tl_parse_cache_.find(name);
+    if (it != tl_parse_cache_.end()) {
+      return &it->second;
+    }
+
+    // Atomic load - lock free
+    auto storage = template_storage_.load(std::memory_order_acquire);
+    auto shared_it = storage->find(name);
+    return (shared_it != storage->end()) ? &shared_it->second : nullptr;
+  }
+
+  Environment(): Environment("") {}
+
+  explicit Environment(const std::filesystem::path& global_path): input_path(global_path), output_path(global_path) {
+    init_default_functions();
+  }
+
+  Environment(const std::filesystem::path& input_path, const std::filesystem::path& output_path): input_path(input_path), output_path(output_path) {
+    init_default_functions();
+  }
+
+  // Copy constructor - needed because std::atomic is not copyable
+  // Copies the current state of atomic members (snapshot semantics)
+  Environment(const Environment& other)
+      : lexer_config(other.lexer_config),
+        parser_config(other.parser_config),
+        render_config(other.render_config),
+        input_path(other.input_path),
+        output_path(other.output_path) {
+    // Copy atomic shared_ptr contents (load current value, store in new atomic)
+    function_storage_.store(
+        std::make_shared<FunctionStorage>(*other.function_storage_.load(std::memory_order_acquire)),
+        std::memory_order_release);
+    template_storage_.store(
+        std::make_shared<TemplateStorage>(*other.template_storage_.load(std::memory_order_acquire)),
+        std::memory_order_release);
+    // Copy callback cache (shared, not deeply copied - new Environment uses same cache)
+    callback_cache_ = other.callback_cache_;
+    globals_.store(other.globals_.load(std::memory_order_acquire), std::memory_order_release);
+    compile_threshold_.store(other.compile_threshold_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(other.write_mutex_);
+      preloaded_modification_times_ = other.preloaded_modification_times_;
+    }
+    // Note: callback_wrapper_, cache_predicate_, and instrumentation_callback_
+    // are function objects that should be re-registered on the new Environment
+  }
+
+  ~Environment() {
+    stop_watching();
+
+    // Skip queued compilations and wait for a running one
+    compile_cancelled_->store(true, std::memory_order_release);
+    compile_pool_.reset();
+  }
+
+  /// Sets the opener and closer for template statements
+  void set_statement(const std::string& open, const std::string& close) {
+    lexer_config.statement_open = open;
+    lexer_config.statement_open_no_lstrip = open + "+";
+    lexer_config.statement_open_force_lstrip = open + "-";
+    lexer_config.statement_close = close;
+    lexer_config.statement_close_force_rstrip = "-" + close;
+    lexer_config.update_open_chars();
+  }
+
+  /// Sets the opener for template line statements
+  void set_line_statement(const std::string& open) {
+    lexer_config.line_statement = open;
+    lexer_config.update_open_chars();
+  }
+
+  /// Sets the opener and closer for template expressions
+  void set_expression(const std::string& open, const std::string& close) {
+    lexer_config.expression_open = open;
+    lexer_config.expression_open_force_lstrip = open + "-";
+    lexer_config.expression_close = close;
+    lexer_config.expression_close_force_rstrip = "-" + close;
+    lexer_config.update_open_chars();
+  }
+
+  /// Sets the opener and closer for template comments
+  void set_comment(const std::string& open, const std::string& close) {
+    lexer_config.comment_open = open;
+    lexer_config.comment_open_force_lstrip = open + "-";
+    lexer_config.comment_close = close;
+    lexer_config.comment_close_force_rstrip = "-" + close;
+    lexer_config.update_open_chars();
+  }
+
+  /// Sets whether to remove the first newline after a block
+  void set_trim_blocks(bool trim_blocks) {
+    lexer_config.trim_blocks = trim_blocks;
+  }
+
+  /// Sets whether to strip the spaces and tabs from the start of a line to a block
+  void set_lstrip_blocks(bool lstrip_blocks) {
+    lexer_config.lstrip_blocks = lstrip_blocks;
+  }
+
+  /// Sets the element notation syntax
+  void set_search_included_templates_in_files(bool search_in_files) {
+    parser_config.search_included_templates_in_files = search_in_files;
+    include_cache_->clear();
+  }
+
+  /// Sets the limits on the estimated render cost of parsed templates
+  void set_cost_limits(const CostLimits& limits) {
+    parser_config.cost_limits = limits;
+  }
+
+  /// Sets whether a missing include will throw an error (thread-safe)
+  void set_throw_at_missing_includes(bool will_throw) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.throw_at_missing_includes = will_throw;
+    ++render_config_version_;
+  }
+
+  /// Sets whether we'll automatically perform HTML escape (thread-safe)
+  void set_html_autoescape(bool will_escape) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.html_autoescape = will_escape;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Sets a callback wrapper for instrumenting callback execution.
+   * 
+   * When set, all user-defined callbacks will be invoked through this wrapper,
+   * allowing external code to measure timing, add tracing spans, etc.
+   * Pass an empty/null function to disable wrapping.
+   * 
+   * Example usage for tracing:
+   * @code
+   * env.set_callback_wrapper([&ctx](const std::string& name, const std::function<json()>& thunk) {
+   *     auto span_id = ctx.StartSpan("decorator:" + name);
+   *     auto result = thunk();
+   *     ctx.EndSpan(span_id);
+   *     return result;
+   * });
+   * @endcode
+   */
+  void set_callback_wrapper(const CallbackWrapper& wrapper) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.callback_wrapper = wrapper;
+    ++render_config_version_;
+  }
+
+  /// Clears the callback wrapper (disables instrumentation, thread-safe)
+  void clear_callback_wrapper() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.callback_wrapper = nullptr;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Sets an instrumentation callback for receiving internal events.
+   *
+   * When set, the renderer emits events at key points during template
+   * processing (set statements, loops, includes, in-place optimizations, etc.)
+   * to provide visibility into internal operations for debugging.
+   *
+   * @param callback The callback to receive instrumentation events
+   */
+  void set_instrumentation_callback(const InstrumentationCallback& callback) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.instrumentation_callback = callback;
+    ++render_config_version_;
+  }
+
+  /// Clears the instrumentation callback (thread-safe)
+  void clear_instrumentation_callback() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.instrumentation_callback = nullptr;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Enables callback caching with the given configuration.
+   *
+   * When enabled, callback results will be cached based on function name
+   * and arguments, providing significant performance improvements for
+   * repeated calls with the same arguments.
+   *
+   * @param config Cache configuration (TTL, max entries, etc.)
+   *
+   * Example:
+   * @code
+   * env.enable_callback_cache(CallbackCacheConfig{
+   *     .ttl = std::chrono::seconds(5),
+   *     .max_entries = 10000
+   * });
+   * @endcode
+   */
+  void enable_callback_cache(const CallbackCacheConfig& config = CallbackCacheConfig{}) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    callback_cache_ = std::make_shared<CallbackCache>(config);
+    render_config.callback_wrapper = callback_cache_->make_caching_wrapper();
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Enables callback caching with a predicate to filter which callbacks are cached.
+   *
+   * @param config Cache configuration
+   * @param predicate Function returning true for callbacks that should be cached
+   *
+   * Example:
+   * @code
+   * env.enable_callback_cache(
+   *     CallbackCacheConfig{.ttl = std::chrono::seconds(5)},
+   *     [](const std::string& name) {
+   *         // Don't cache callbacks with side effects or non-deterministic results
+   *         return name != "random" && name != "capture_screenshot";
+   *     }
+   * );
+   * @endcode
+   */
+  void enable_callback_cache(const CallbackCacheConfig& config,
+                              CallbackCache::CachePredicate predicate) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    callback_cache_ = std::make_shared<CallbackCache>(config);
+    callback_cache_->set_cache_predicate(std::move(predicate));
+    render_config.callback_wrapper = callback_cache_->make_caching_wrapper();
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Enables callback caching with an inner wrapper for chained instrumentation.
+   *
+   * This allows combining caching with other instrumentation like tracing.
+   * The inner wrapper is called only on cache misses.
+   *
+   * @param config Cache configuration
+   * @param inner_wrapper Wrapper to call on cache misses (e.g., for tracing)
+   * @param predicate Optional predicate to filter which callbacks are cached
+   *
+   * Example:
+   * @code
+   * env.enable_callback_cache_with_wrapper(
+   *     CallbackCacheConfig{.ttl = std::chrono::seconds(5)},
+   *     [&ctx](const std::string& name, const Arguments& args,
+   *            const std::function<json()>& thunk) {
+   *         auto span = ctx.StartSpan("decorator:" + name);
+   *         auto result = thunk();
+   *         ctx.EndSpan(span);
+   *         return result;
+   *     }
+   * );
+   * @endcode
+   */
+  void enable_callback_cache_with_wrapper(const CallbackCacheConfig& config,
+                                           const CallbackWrapper& inner_wrapper,
+                                           CallbackCache::CachePredicate predicate = nullptr) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    callback_cache_ = std::make_shared<CallbackCache>(config);
+    if (predicate) {
+      callback_cache_->set_cache_predicate(std::move(predicate));
+    }
+    render_config.callback_wrapper = callback_cache_->make_caching_wrapper_with_inner(inner_wrapper);
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Sets an external callback cache instance.
+   *
+   * This allows sharing a cache between multiple Environment instances (e.g., when
+   * copying a PromptEngine for different ContextEngine renders within the same dialogue turn).
+   *
+   * @param cache The external cache instance to use
+   * @param predicate Optional predicate to filter which callbacks are cached
+   *
+   * Example:
+   * @code
+   * auto shared_cache = std::make_shared<CallbackCache>(CallbackCacheConfig{
+   *     .ttl = std::chrono::seconds(5),
+   *     .max_entries = 10000
+   * });
+   *
+   * // Both environments share the same cache
+   * env1.set_callback_cache(shared_cache, my_predicate);
+   * env2.set_callback_cache(shared_cache, my_predicate);
+   * @endcode
+   */
+  void set_callback_cache(std::shared_ptr<CallbackCache> cache,
+                          CallbackCache::CachePredicate predicate = nullptr) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    callback_cache_ = cache;
+    if (predicate && cache) {
+      cache->set_cache_predicate(std::move(predicate));
+    }
+    if (cache) {
+      render_config.callback_wrapper = cache->make_caching_wrapper();
+      ++render_config_version_;
+    } else {
+      render_config.callback_wrapper = nullptr;
+      ++render_config_version_;
+    }
+  }
+
+  /*!
+   * \brief Sets an external callback cache and a custom wrapper atomically.
+   *
+   * This avoids a race condition where setting cache and wrapper in two separate
+   * lock acquisitions could allow a concurrent render to snapshot the intermediate
+   * state (inja's caching wrapper without the custom wrapper).
+   *
+   * @param cache The shared cache instance to use
+   * @param wrapper The custom callback wrapper (e.g., with tracing)
+   * @param predicate Optional function returning true for callbacks that should be cached
+   */
+  void set_callback_cache_and_wrapper(std::shared_ptr<CallbackCache> cache,
+                                      const CallbackWrapper& wrapper,
+                                      CallbackCache::CachePredicate predicate = nullptr) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    callback_cache_ = cache;
+    if (predicate && cache) {
+      cache->set_cache_predicate(std::move(predicate));
+    }
+    render_config.callback_wrapper = wrapper;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Disables callback caching.
+   *
+   * Clears the cache and removes the caching wrapper.
+   * Note: If you had a callback wrapper set before enabling caching, you'll need to re-set it.
+   */
+  void disable_callback_cache() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    callback_cache_.reset();
+    render_config.callback_wrapper = nullptr;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Gets the callback cache instance.
+   *
+   * @return Shared pointer to the cache, or nullptr if caching is not enabled
+   */
+  std::shared_ptr<CallbackCache> get_callback_cache() const {
+    return callback_cache_;
+  }
+
+  /*!
+   * \brief Clears all entries in the callback cache.
+   *
+   * Does nothing if caching is not enabled.
+   */
+  void clear_callback_cache() {
+    if (callback_cache_) {
+      callback_cache_->clear();
+    }
+  }
+
+  /*!
+   * \brief Invalidates cached entries for a specific callback.
+   *
+   * @param function_name The callback to invalidate
+   * @return Number of entries removed
+   */
+  size_t invalidate_callback_cache(const std::string& function_name) {
+    if (callback_cache_) {
+      return callback_cache_->invalidate(function_name);
+    }
+    return 0;
+  }
+
+  Template parse(std::string_view input) {
+    // Get snapshots for lock-free access
+    // The shared_ptr keeps the storage alive for the duration of parsing
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    // Parser writes discovered templates to thread-local cache,
+    // but can also look up existing templates in shared storage (kept alive by shared_ptr)
+    Parser parser(parser_config, lexer_config, tl_parse_cache_, *func_storage, tmpl_storage);
+    parser.set_include_cache(include_cache_.get());
+    try {
+      Template result = parser.parse(input, input_path);
+      // Reject the template before its includes are published to the shared storage
+      check_cost_limits(result, *tmpl_storage, tl_parse_cache_);
+      // Merge any templates discovered during parsing into shared storage
+      merge_parse_cache();
+      return result;
+    } catch (...) {
+      // Clear thread-local cache on exception to prevent stale templates
+      // from leaking into subsequent parse operations on this thread
+      tl_parse_cache_.clear();
+      throw;
+    }
+  }
+
+  Template parse_template(const std::filesystem::path& filename) {
+    // Get snapshots for lock-free access
+    // The shared_ptr keeps the storage alive for the duration of parsing
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    // Parser writes discovered templates to thread-local cache,
+    // but can also look up existing templates in shared storage (kept alive by shared_ptr)
+    // Preloaded templates are used as long as their file is unchanged
+    const std::string name = (input_path / filename).string();
+    int64_t bundled_modification_time {0};
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      const auto bundled = preloaded_modification_times_.find(name);
+      if (bundled != preloaded_modification_times_.end()) {
+        bundled_modification_time = bundled->second;
+      }
+    }
+    if (bundled_modification_time != 0 && file_modification_time(name) == bundled_modification_time) {
+      const auto bundled = tmpl_storage->find(name);
+      if (bundled != tmpl_storage->end()) {
+        return bundled->second;
+      }
+    }
+
+    Parser parser(parser_config, lexer_config, tl_parse_cache_, *func_storage, tmpl_storage);
+
+    parser.set_include_cache(include_cache_.get());
+    try {
+      auto result = Template(Parser::load_file(input_path / filename));
+      parser.parse_into_template(result, (input_path / filename).string());
+      // Reject the template before its includes are published to the shared storage
+      check_cost_limits(result, *tmpl_storage, tl_parse_cache_);
+      // Merge any templates discovered during parsing into shared storage
+      merge_parse_cache();
+      return result;
+    } catch (...) {
+      // Clear thread-local cache on exception to prevent stale templates
+      // from leaking into subsequent parse operations on this thread
+      tl_parse_cache_.clear();
+      throw;
+    }
+  }
+
+  Template parse_file(const std::filesystem::path& filename) {
+    return parse_template(filename);
+  }
+
+  /*!
+   * \brief Parses all templates in a directory in parallel and adds them to the template storage (thread-safe).
+   *
+   * The directory is searched recursively relative to the input path, and
+   * files are matched against the glob relative to the directory (`*` and
+   * `?` stop at `/`, `**` does not). Templates included by several files are
+   * parsed only once. All templates are published with a single swap of the
+   * template storage, and parse_template() returns them as long as their file
+   * is unchanged. A thread count of 0 uses all hardware threads.
+   */
+  PreloadReport preload_directory(const std::filesystem::path& directory, const std::string& pattern = "**", size_t threads = 0) {
+    const auto start = std::chrono::steady_clock::now();
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    std::vector<std::string> names;
+    const auto root = input_path / directory;
+    for (const auto& file : std::filesystem::recursive_directory_iterator(root)) {
+      if (file.is_regular_file() && glob_match(pattern, file.path().lexically_relative(root).generic_string())) {
+        names.push_back((root / file.path().lexically_relative(root)).string());
+      }
+    }
+
+    ConcurrentTemplateStorage parsed;
+    std::mutex discovered_mutex;
+    TemplateStorage discovered_templates; // Templates from the include callback
+    {
+      ThreadPool pool(threads);
+      std::vector<std::future<void>> tasks;
+      tasks.reserve(names.size());
+      for (const auto& name : names) {
+        tasks.push_back(pool.submit([this, &parsed, &discovered_mutex, &discovered_templates, &name, &func_storage, &tmpl_storage]() {
+          if (parsed.find(name)) {
+            return; // Already parsed as an include of another template
+          }
+
+          const auto timer = ConcurrentTemplateStorage::start_parse();
+          TemplateStorage discovered;
+          Parser parser(parser_config, lexer_config, discovered, *func_storage, tmpl_storage);
+          parser.set_include_cache(include_cache_.get());
+          parser.set_concurrent_storage(&parsed);
+
+          auto tmpl = Template(Parser::load_file(name));
+          parser.parse_into_template(tmpl, name);
+          parsed.add(name, tmpl, timer);
+
+          std::lock_guard<std::mutex> lock(discovered_mutex);
+          for (const auto& [discovered_name, discovered_tmpl] : discovered) {
+            if (!parsed.find(discovered_name)) {
+              discovered_templates.try_emplace(discovered_name, discovered_tmpl);
+            }
+          }
+        }));
+      }
+      for (auto& task : tasks) {
+        task.get();
+      }
+    }
+
+    // Checked once all files are parsed, as their includes may be other files of the directory
+    if (has_cost_limits()) {
+      TemplateStorage merged = *tmpl_storage;
+      parsed.for_each([&merged](const std::string& name, const ConcurrentTemplateStorage::Entry& entry) {
+        merged.insert_or_assign(name, entry.tmpl);
+      });
+      for (const auto& [name, tmpl] : discovered_templates) {
+        merged.try_emplace(name, tmpl);
+      }
+      parsed.for_each([this, &merged](const std::string&, const ConcurrentTemplateStorage::Entry& entry) {
+        check_cost_limits(entry.tmpl, merged);
+      });
+    }
+
+    std::vector<std::pair<std::string, int64_t>> modification_times;
+    parsed.for_each([&modification_times](const std::string& name, const ConcurrentTemplateStorage::Entry&) {
+      modification_times.emplace_back(name, file_modification_time(name));
+    });
+
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+
+      // Copy-on-write: preloaded templates replace stored ones of the same name
+      auto new_storage = std::make_shared<TemplateStorage>(*template_storage_.load(std::memory_order_acquire));
+      parsed.for_each([&new_storage](const std::string& name, const ConcurrentTemplateStorage::Entry& entry) {
+        new_storage->insert_or_assign(name, entry.tmpl);
+      });
+      for (const auto& [name, tmpl] : discovered_templates) {
+        new_storage->try_emplace(name, tmpl);
+      }
+      for (const auto& [name, modification_time] : modification_times) {
+        if (modification_time != 0) {
+          preloaded_modification_times_[name] = modification_time;
+        }
+      }
+      template_storage_.store(new_storage, std::memory_order_release);
+    }
+
+    auto report = parsed.report();
+    report.total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return report;
+  }
+
+  /*!
+   * \brief Parses the given template files again and replaces them in the template storage (thread-safe).
+   *
+   * All templates are published with a single swap of the template storage,
+   * renders in progress keep using the previous templates. A file that fails
+   * to parse keeps its previous template. Returns the reloaded templates and
+   * all templates that include or extend them, which render the new version
+   * from now on as includes are looked up by name.
+   */
+  std::vector<std::string> reload_templates(const std::vector<std::string>& names) {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    TemplateStorage discovered;
+    TemplateStorage reloaded;
+    std::vector<std::string> reloaded_names;
+    Parser parser(parser_config, lexer_config, discovered, *func_storage, tmpl_storage);
+    parser.set_include_cache(include_cache_.get());
+    for (const auto& name : names) {
+      try {
+        auto tmpl = Template(Parser::load_file(name));
+        parser.parse_into_template(tmpl, name);
+        check_cost_limits(tmpl, *tmpl_storage, discovered);
+        reloaded.insert_or_assign(name, std::move(tmpl));
+        reloaded_names.push_back(name);
+      } catch (const InjaError&) {
+        // Keep the previous template, e.g. while the file is saved in the middle of an edit
+      }
+    }
+    if (reloaded.empty()) {
+      return {};
+    }
+
+    std::shared_ptr<TemplateStorage> new_storage;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+
+      // Copy-on-write: renders in progress keep using the old storage
+      new_storage = std::make_shared<TemplateStorage>(*template_storage_.load(std::memory_order_acquire));
+      for (auto& [name, tmpl] : reloaded) {
+        const int64_t modification_time = file_modification_time(name);
+        if (modification_time != 0 && preloaded_modification_times_.count(name) > 0) {
+          preloaded_modification_times_[name] = modification_time;
+        }
+        new_storage->insert_or_assign(name, std::move(tmpl));
+      }
+      for (const auto& [name, tmpl] : discovered) {
+        new_storage->try_emplace(name, tmpl);
+      }
+      template_storage_.store(new_storage, std::memory_order_release);
+    }
+    return dependent_templates(*new_storage, reloaded_names);
+  }
+
+  /*!
+   * \brief Starts a background thread that reloads changed template files (thread-safe).
+   *
+   * All templates in the template storage that were read from a file are
+   * watched, with inotify on Linux and by polling their modification time in
+   * the given interval otherwise. Changed templates are reloaded with
+   * reload_templates(), and the callback is called with its result from the
+   * watcher thread. Render threads are never blocked by the watcher.
+   */
+  void watch_templates(std::chrono::milliseconds poll_interval = std::chrono::milliseconds(500), const TemplateReloadCallback& callback = nullptr,
+                       bool use_notifications = true) {
+    stop_watching();
+    stop_watching_.store(false, std::memory_order_release);
+
+    watcher_thread_ = std::thread([this, poll_interval, callback, use_notifications]() {
+      // Short waits, so that stop_watching() returns quickly
+      const auto wait_time = std::min(poll_interval, std::chrono::milliseconds(50));
+
+      FileWatcher watcher(use_notifications);
+      std::shared_ptr<TemplateStorage> watched_storage;
+      auto next_poll = std::chrono::steady_clock::now();
+      while (!stop_watching_.load(std::memory_order_acquire)) {
+        auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+        if (tmpl_storage != watched_storage) {
+          for (const auto& [name, tmpl] : *tmpl_storage) {
+            if (!watcher.is_watching(name) && file_modification_time(name) != 0) {
+              watcher.watch(name);
+            }
+          }
+          watched_storage = tmpl_storage;
+        }
+
+        const bool notified = watcher.wait_for_notification(wait_time);
+        if (!notified && std::chrono::steady_clock::now() < next_poll) {
+          continue;
+        }
+        next_poll = std::chrono::steady_clock::now() + poll_interval;
+
+        const auto changed = watcher.changed_files();
+        if (!changed.empty()) {
+          const auto reloaded = reload_templates(changed);
+          if (callback && !reloaded.empty()) {
+            callback(reloaded);
+          }
+        }
+      }
+    });
+  }
+
+  /// Stops the thread started by watch_templates(), if any
+  void stop_watching() {
+    stop_watching_.store(true, std::memory_order_release);
+    if (watcher_thread_.joinable()) {
+      watcher_thread_.join();
+    }
+  }
+
+  /*!
+   * \brief Writes the parsed templates and all templates in the storage to a binary bundle file.
+   *
+   * Loading the bundle with load_bundle() skips lexing and parsing of all
+   * templates whose files did not change since.
+   */
+  void write_bundle(const std::filesystem::path& bundle_file, const std::vector<std::string>& filenames) {
+    TemplateStorage templates;
+    for (const auto& filename : filenames) {
+      templates.emplace((input_path / filename).string(), parse_template(filename));
+    }
+    for (const auto& [name, tmpl] : *template_storage_.load(std::memory_order_acquire)) {
+      templates.try_emplace(name, tmpl);
+    }
+
+    uint64_t config_hash;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_hash = parse_config_hash(lexer_config, parser_config);
+    }
+
+    std::vector<BundleEntry> entries;
+    entries.reserve(templates.size());
+    for (auto& [name, tmpl] : templates) {
+      BundleEntry entry;
+      entry.name = name;
+      entry.modification_time = file_modification_time(name);
+      if (entry.modification_time != 0) {
+        entry.source_path = name;
+      }
+      entry.source_hash = fnv1a_hash(tmpl.content);
+      entry.tmpl = std::move(tmpl);
+      entries.push_back(std::move(entry));
+    }
+    TemplateBundle::write(bundle_file, entries, config_hash);
+  }
+
+  /*!
+   * \brief Loads all templates of a bundle file into the template storage (thread-safe).
+   *
+   * Templates whose file changed since the bundle was written are parsed
+   * again from the file, unless only its modification time changed. Returns
+   * false without loading anything if the bundle does not exist or was
+   * written by another version or with other delimiters or parse settings.
+   */
+  bool load_bundle(const std::filesystem::path& bundle_file) {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+
+    uint64_t config_hash;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_hash = parse_config_hash(lexer_config, parser_config);
+    }
+
+    std::vector<BundleEntry> entries;
+    if (!std::filesystem::exists(bundle_file) || !TemplateBundle(*func_storage).read(bundle_file, config_hash, entries)) {
+      return false;
+    }
+
+    TemplateStorage discovered;
+    Parser parser(parser_config, lexer_config, discovered, *func_storage, tmpl_storage);
+    parser.set_include_cache(include_cache_.get());
+    for (auto& entry : entries) {
+      const int64_t modification_time = entry.source_path.empty() ? 0 : file_modification_time(entry.source_path);
+      if (modification_time == 0 || modification_time == entry.modification_time) {
+        continue;
+      }
+
+      auto source = Parser::load_file(entry.source_path);
+      if (fnv1a_hash(source) != entry.source_hash) {
+        entry.tmpl = Template(std::move(source));
+        parser.parse_into_template(entry.tmpl, entry.source_path);
+        check_cost_limits(entry.tmpl, *tmpl_storage, discovered);
+      }
+      entry.modification_time = modification_time;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: bundled templates replace stored ones of the same name
+    auto new_storage = std::make_shared<TemplateStorage>(*template_storage_.load(std::memory_order_acquire));
+    for (auto& entry : entries) {
+      if (entry.modification_time != 0) {
+        preloaded_modification_times_[entry.name] = entry.modification_time;
+      }
+      new_storage->insert_or_assign(entry.name, std::move(entry.tmpl));
+    }
+    for (const auto& [name, tmpl] : discovered) {
+      new_storage->try_emplace(name, tmpl);
+    }
+
+    template_storage_.store(new_storage, std::memory_order_release);
+    return true;
+  }
+
+  /*!
+   * \brief Statically analyzes which data, callbacks and templates a template depends on.
+   *
+   * Included and extended templates are looked up in the template storage and
+   * analyzed transitively. The name is used for the template in the include graph.
+   */
+  TemplateAnalysis analyze(const Template& tmpl, const std::string& name = "") const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    AnalysisVisitor visitor(*tmpl_storage, *func_storage);
+    return visitor.analyze(tmpl, name);
+  }
+
+  /*!
+   * \brief Returns the prefix tree of all input paths a template can read.
+   *
+   * Element access with keys only known at render time (like `at(obj, key)`)
+   * requires all elements of the container. Use inja::project() to reduce
+   * the full input data to this tree.
+   */
+  DataPathTree required_paths(const Template& tmpl) const {
+    return DataPathTree::from_analysis(analyze(tmpl));
+  }
+
+  /*!
+   * \brief Statically estimates the render cost of a template.
+   *
+   * Every loop is assumed to run the given number of iterations.
+   */
+  CostReport estimate_cost(const Template& tmpl, size_t assumed_loop_size = 10) const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    return estimate_cost(*tmpl_storage, tmpl, assumed_loop_size);
+  }
+
+  /*!
+   * \brief Statically estimates the render cost of a template with loop sizes taken from sample data.
+   *
+   * Loops over computed values fall back to the assumed number of iterations.
+   */
+  CostReport estimate_cost(const Template& tmpl, const json& sample_data, size_t assumed_loop_size = 10) const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    CostVisitor visitor(*tmpl_storage, *func_storage, &sample_data, assumed_loop_size);
+    return visitor.estimate(tmpl);
+  }
+
+  /*!
+   * \brief Optimizes a template in place for repeated rendering.
+   *
+   * Loop-invariant expressions are evaluated once per loop instead of in
+   * every iteration, and repeated identical expressions reuse the result of
+   * their first evaluation until one of their variables is assigned.
+   * Callbacks are only considered if they were marked with
+   * set_callback_deterministic(). The output is unchanged.
+   */
+  OptimizerStats optimize(Template& tmpl) const {
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    Optimizer optimizer(*func_storage);
+    return optimizer.optimize(tmpl);
+  }
+
+  /*!
+   * \brief Sets the number of renders after which a template is compiled in the background (thread-safe).
+   *
+   * Compiling folds constant expressions of literals and built-in functions,
+   * optimizes loop-invariant and repeated expressions, and links includes
+   * directly to compiled copies of the included templates. Callbacks are
+   * never called while compiling, as they are only deterministic within a
+   * render. Compilation runs on a worker owned by the environment. Renders
+   * keep using the source template until the compiled form is swapped in. It
+   * is dropped again as soon as templates, callbacks or the autoescape setting
+   * change, and recompiled on the next render. Copies of a template share
+   * their render count and compiled form. A threshold of 0 (the default)
+   * disables compilation.
+   */
+  void set_compile_threshold(size_t renders) {
+    compile_threshold_.store(renders, std::memory_order_relaxed);
+  }
+
+  /// Returns whether the template has a compiled form that is used by the next render
+  bool is_compiled(const Template& tmpl) const {
+    if (!tmpl.tier) {
+      return false;
+    }
+    const auto compiled = tmpl.tier->compiled.load(std::memory_order_acquire);
+    if (!compiled) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return compiled->is_current(template_storage_.load(std::memory_order_acquire).get(), function_storage_.load(std::memory_order_acquire).get(),
+                                render_config);
+  }
+
+  /*!
+   * \brief Returns a template partially evaluated against data that is known in advance.
+   *
+   * Rendering the result with the remaining data gives the same output as
+   * rendering the original template with both. The top-level keys of the
+   * static data must not appear in the data passed at render time.
+   */
+  Template specialize(const Template& tmpl, const json& static_data) const {
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    RenderConfig config_snapshot;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_snapshot = render_config;
+    }
+
+    Specializer specializer(config_snapshot, *tmpl_storage, *func_storage);
+    return specializer.specialize(tmpl, static_data);
+  }
+
+  std::string render(std::string_view input, const json& data) {
+    return render(parse(input), data);
+  }
+
+  std::string render(const Template& tmpl, const json& data) {
+    std::stringstream os;
+    render_to(os, tmpl, data);
+    return os.str();
+  }
+
+  std::string render_file(const std::filesystem::path& filename, const json& data) {
+    return render(parse_template(filename), data);
+  }
+
+  std::string render_file_with_json_file(const std::filesystem::path& filename, const std::string& filename_data) {
+    const json data = load_json(filename_data);
+    return render_file(filename, data);
+  }
+
+  /// Renders a template file with data from a JSON, CBOR, MessagePack or BSON file, see load_data()
+  std::string render_file_with_data_file(const std::filesystem::path& filename, const std::string& filename_data,
+                                         DataFormat format = DataFormat::Auto) {
+    const json data = load_data(filename_data, format);
+    return render_file(filename, data);
+  }
+
+  void write(const std::filesystem::path& filename, const json& data, const std::string& filename_out) {
+    std::ofstream file(output_path / filename_out);
+    file << render_file(filename, data);
+    file.close();
+  }
+
+  void write(const Template& temp, const json& data, const std::string& filename_out) {
+    std::ofstream file(output_path / filename_out);
+    file << render(temp, data);
+    file.close();
+  }
+
+  void write_with_json_file(const std::filesystem::path& filename, const std::string& filename_data, const std::string& filename_out) {
+    const json data = load_json(filename_data);
+    write(filename, data, filename_out);
+  }
+
+  void write_with_json_file(const Template& temp, const std::string& filename_data, const std::string& filename_out) {
+    const json data = load_json(filename_data);
+    write(temp, data, filename_out);
+  }
+
+  void write_with_data_file(const std::filesystem::path& filename, const std::string& filename_data, const std::string& filename_out,
+                            DataFormat format = DataFormat::Auto) {
+    const json data = load_data(filename_data, format);
+    write(filename, data, filename_out);
+  }
+
+  void write_with_data_file(const Template& temp, const std::string& filename_data, const std::string& filename_out,
+                            DataFormat format = DataFormat::Auto) {
+    const json data = load_data(filename_data, format);
+    write(temp, data, filename_out);
+  }
+
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const json& data) {
+    return render_to(os, tmpl, data, nullptr);
+  }
+
+  std::ostream& render_to(std::ostream& os, std::string_view input, const json& data) {
+    return render_to(os, parse(input), data);
+  }
+
+  /*!
+   * \brief Renders a template with data that is looked up on demand.
+   *
+   * Only the variables the template reads are requested from the provider,
+   * each of them once per render. Loops over provided arrays and objects
+   * request their elements one by one, see DataProvider.
+   */
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const DataProvider& data) {
+    static const json empty_data = json::object();
+    return render_to(os, tmpl, empty_data, &data);
+  }
+
+  std::string render(const Template& tmpl, const DataProvider& data) {
+    std::stringstream os;
+    render_to(os, tmpl, data);
+    return os.str();
+  }
+
+  std::string render(std::string_view input, const DataProvider& data) {
+    return render(parse(input), data);
+  }
+
+  /*!
+   * \brief Renders a template with data split into layers, e.g. global, per-actor and per-call data.
+   *
+   * Variables are looked up from the first layer to the last, without merging
+   * or copying them, so that layers can be shared by concurrent renders. Each
+   * variable is resolved by its full path, so `user.name` is found in a lower
+   * layer even if a higher one has another `user` object. Set statements only
+   * change the data of the render. Null layers are skipped.
+   */
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const std::vector<const json*>& layers) {
+    static const json empty_data = json::object();
+
+    std::vector<const json*> lower_layers;
+    lower_layers.reserve(layers.size());
+    std::copy_if(layers.begin(), layers.end(), std::back_inserter(lower_layers), [](const json* layer) { return layer != nullptr; });
+    if (lower_layers.empty()) {
+      return render_to(os, tmpl, empty_data, nullptr);
+    }
+
+    const json* top = lower_layers.front();
+    lower_layers.erase(lower_layers.begin());
+    return render_to(os, tmpl, *top, nullptr, std::move(lower_layers));
+  }
+
+  std::string render(const Template& tmpl, const std::vector<const json*>& layers) {
+    std::stringstream os;
+    render_to(os, tmpl, layers);
+    return os.str();
+  }
+
+  /*!
+   * \brief Renders a template with its native render function, see tools/inja_compile.cpp.
+   *
+   * The function uses the templates, callbacks, globals and settings of the
+   * environment. Graceful errors and the instrumentation callback need the
+   * interpreter, so with them the template is rendered by the Renderer instead.
+   */
+  std::ostream& render_to(std::ostream& os, NativeFunction function, const Template& tmpl, const json& data) {
+    const RenderConfig config_snapshot = render_config_snapshot();
+    if (config_snapshot.graceful_errors || config_snapshot.instrumentation_callback) {
+      return render_to(os, tmpl, data);
+    }
+
+    tl_render_errors_.clear();
+    const auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    const auto func_storage = function_storage_.load(std::memory_order_acquire);
+    const auto globals = globals_.load(std::memory_order_acquire);
+    std::vector<const json*> layers;
+    if (globals) {
+      layers.push_back(&globals->values);
+    }
+
+    NativeRender render(os, data, layers, config_snapshot, *tmpl_storage, *func_storage);
+    function(render);
+    return os;
+  }
+
+  std::string render(NativeFunction function, const Template& tmpl, const json& data) {
+    std::stringstream os;
+    render_to(os, function, tmpl, data);
+    return os.str();
+  }
+
+  /*!
+   * \brief Renders a template once per input, each into the sink of the same index (thread-safe).
+   *
+   * All renders share one snapshot of the environment, and every thread
+   * reuses a single renderer that is reset between inputs, so its buffers stay
+   * allocated. With a thread pool the inputs are rendered in parallel chunks,
+   * and the calling thread helps until all are done. Null inputs are rendered
+   * with empty data. Returns the errors of graceful error mode per input; an
+   * exception of any render is rethrown once all chunks finished.
+   */
+  std::vector<std::vector<RenderErrorInfo>> render_batch(const Template& tmpl, std::span<const json* const> inputs, std::span<std::ostream* const> sinks,
+                                                         ThreadPool* pool = nullptr) {
+    if (sinks.size() != inputs.size()) {
+      INJA_THROW(InjaError("render_error", "render_batch needs one sink per input, got " + std::to_string(sinks.size()) + " sinks for " +
+                                               std::to_string(inputs.size()) + " inputs"));
+    }
+
+    std::vector<std::vector<RenderErrorInfo>> errors(inputs.size());
+    render_batch_chunks(tmpl, inputs, pool, [&sinks, &errors](Renderer& renderer, const Template& render_template, const json& data, size_t index) {
+      renderer.render_to(*sinks[index], render_template, data);
+      errors[index] = renderer.get_render_errors();
+    });
+    return errors;
+  }
+
+  /// Renders a template once per input, returning the outputs and errors in the order of the inputs, see render_batch() with sinks
+  std::vector<RenderResult> render_batch(const Template& tmpl, std::span<const json* const> inputs, ThreadPool* pool = nullptr) {
+    std::vector<RenderResult> results(inputs.size());
+    render_batch_chunks(tmpl, inputs, pool, [&results](Renderer& renderer, const Template& render_template, const json& data, size_t index) {
+      std::ostringstream os;
+      renderer.render_to(os, render_template, data);
+      results[index].output = std::move(os).str();
+      results[index].errors = renderer.get_render_errors();
+    });
+    return results;
+  }
+
+  /*!
+   * \brief Renders a template on an executor, and calls the completion with the result or the exception (thread-safe).
+   *
+   * The render uses the templates, functions, config and globals of the
+   * environment at the time of the call, so the environment may change or be
+   * destroyed before it runs. Without an executor in the options, it runs on
+   * a thread pool of the environment. Every thread reuses one renderer for
+   * all renders with the same snapshot. The render is stopped with an
+   * InterruptError when the stop token of the options is stopped or the
+   * deadline passed. Errors of graceful error mode are part of the result,
+   * get_last_render_errors() is not changed. The completion is called on the
+   * thread of the render and must not throw.
+   */
+  void render_async(Template tmpl, json data, std::function<void(RenderResult, std::exception_ptr)> on_complete,
+                    const AsyncRenderOptions& options = AsyncRenderOptions()) {
+    auto job = prepare_async_render(std::move(tmpl), std::move(data));
+    job->stop_token = options.stop_token;
+    job->deadline = options.deadline;
+    job->on_complete = std::move(on_complete);
+
+    Executor* executor = options.executor;
+    if (executor == nullptr) {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      if (!async_pool_) {
+        async_pool_ = std::make_unique<ThreadPool>();
+      }
+      executor = async_pool_.get();
+    }
+    executor->execute([job]() { run_async_render(*job); });
+  }
+
+  /// Renders a template on an executor, the future holds the result or the exception, see render_async() with a completion
+  std::future<RenderResult> render_async(Template tmpl, json data, const AsyncRenderOptions& options = AsyncRenderOptions()) {
+    auto promise = std::make_shared<std::promise<RenderResult>>();
+    auto result = promise->get_future();
+    render_async(
+        std::move(tmpl), std::move(data),
+        [promise](RenderResult render_result, std::exception_ptr error) {
+          if (error) {
+            promise->set_exception(error);
+          } else {
+            promise->set_value(std::move(render_result));
+          }
+        },
+        options);
+    return result;
+  }
+
+  /*!
+   * \brief Renders a template on another thread and yields its output in chunks as it is rendered (thread-safe).
+   *
+   * The render starts right away with a snapshot of the environment, as
+   * render_async() does, and waits whenever a chunk is ready but was not
+   * pulled yet, so that at most two chunks are in memory. Each yielded view is
+   * valid until the next one is pulled. Exceptions of the render are thrown
+   * by the iteration. Destroying the generator stops the render. After the
+   * last chunk, get_last_render_errors() of the consuming thread returns the
+   * errors of graceful error mode.
+   */
+  Generator<std::string_view> render_stream(Template tmpl, json data, size_t chunk_size = 4096) {
+    auto job = prepare_async_render(std::move(tmpl), std::move(data));
+    auto channel = std::make_shared<OutputChannel>(chunk_size);
+    std::jthread producer([job, channel](std::stop_token stop_token) {
+      std::ostream os(channel.get());
+      os.exceptions(std::ios::badbit); // Rethrow the interruption by the channel
+      channel->set_stop_token(stop_token);
+      job->stop_token = std::move(stop_token);
+      job->deadline = std::chrono::steady_clock::time_point::max();
+      job->output = &os;
+
+      std::exception_ptr render_error;
+      std::vector<RenderErrorInfo> errors;
+      job->on_complete = [&render_error, &errors](RenderResult result, std::exception_ptr error) {
+        render_error = error;
+        errors = std::move(result.errors);
+      };
+      run_async_render(*job);
+      channel->close(render_error, std::move(errors));
+    });
+    return stream_chunks(std::move(channel), std::move(producer));
+  }
+
+private:
+  // The producer is owned by the coroutine, and stopped and joined when the generator is destroyed
+  static Generator<std::string_view> stream_chunks(std::shared_ptr<OutputChannel> channel, [[maybe_unused]] std::jthread producer) {
+    while (const auto chunk = channel->next()) {
+      co_yield *chunk;
+    }
+    tl_render_errors_ = channel->get_render_errors();
+  }
+
+  // Take the snapshot of the environment for an asynchronous render
+  std::shared_ptr<AsyncRender> prepare_async_render(Template tmpl, json data) {
+    auto job = std::make_shared<AsyncRender>();
+    job->template_storage = template_storage_.load(std::memory_order_acquire);
+    job->function_storage = function_storage_.load(std::memory_order_acquire);
+    job->globals = globals_.load(std::memory_order_acquire);
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      job->config = render_config;
+      job->config_version = render_config_version_;
+    }
+    job->compiled = select_compiled(tmpl, job->template_storage, job->function_storage, job->config);
+    job->tmpl = std::move(tmpl);
+    job->data = std::move(data);
+    job->environment_id = id_;
+    return job;
+  }
+
+  RenderConfig render_config_snapshot() const {
+    // Copied under lock to avoid torn reads of callback_wrapper
+    // (std::function assignment is not atomic - concurrent read/write causes heap corruption)
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return render_config;
+  }
+
+  static void run_async_render(AsyncRender& job) {
+    RenderResult result;
+    std::exception_ptr error;
+    static thread_local ThreadRenderer cached;
+    const bool reuse = !cached.in_use;
+    try {
+      if (job.stop_token.stop_requested()) {
+        INJA_THROW(InterruptError("render was cancelled"));
+      }
+      if (std::chrono::steady_clock::now() > job.deadline) {
+        INJA_THROW(InterruptError("render deadline exceeded"));
+      }
+
+      std::unique_ptr<Renderer> own_renderer;
+      Renderer* renderer;
+      if (reuse) {
+        if (cached.renderer && cached.environment_id == job.environment_id && cached.config_version == job.config_version &&
+            cached.template_storage == job.template_storage && cached.function_storage == job.function_storage) {
+          cached.renderer->reset();
+        } else {
+          cached.renderer = std::make_unique<Renderer>(job.config, *job.template_storage, *job.function_storage);
+          cached.environment_id = job.environment_id;
+          cached.config_version = job.config_version;
+          cached.template_storage = job.template_storage;
+          cached.function_storage = job.function_storage;
+        }
+        cached.in_use = true;
+        renderer = cached.renderer.get();
+      } else {
+        own_renderer = std::make_unique<Renderer>(job.config, *job.template_storage, *job.function_storage);
+        renderer = own_renderer.get();
+      }
+
+      renderer->set_data_layers(job.globals ? std::vector<const json*> {&job.globals->values} : std::vector<const json*> {});
+      renderer->set_interruption(job.stop_token, job.deadline);
+      const Template& render_template = job.compiled ? job.compiled->tmpl : job.tmpl;
+      if (job.output != nullptr) {
+        renderer->render_to(*job.output, render_template, job.data);
+      } else {
+        std::ostringstream os;
+        renderer->render_to(os, render_template, job.data);
+        result.output = std::move(os).str();
+      }
+      result.errors = renderer->get_render_errors();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (reuse) {
+      cached.in_use = false;
+    }
+    job.on_complete(std::move(result), error);
+  }
+
+  // Split the inputs of a batch into chunks, each rendered by one reused renderer
+  template <class RenderOne>
+  void render_batch_chunks(const Template& tmpl, std::span<const json* const> inputs, ThreadPool* pool, const RenderOne& render_one) {
+    static const json empty_data = json::object();
+    if (inputs.empty()) {
+      return;
+    }
+
+    const auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    const auto func_storage = function_storage_.load(std::memory_order_acquire);
+    const auto globals = globals_.load(std::memory_order_acquire);
+    const RenderConfig config_snapshot = render_config_snapshot();
+
+    const auto compiled = select_compiled(tmpl, tmpl_storage, func_storage, config_snapshot);
+    const Template& render_template = compiled ? compiled->tmpl : tmpl;
+
+    const auto render_chunk = [&](size_t begin, size_t end) {
+      Renderer renderer(config_snapshot, *tmpl_storage, *func_storage);
+      if (globals) {
+        renderer.set_data_layers({&globals->values});
+      }
+      for (size_t i = begin; i < end; ++i) {
+        renderer.reset();
+        render_one(renderer, render_template, inputs[i] ? *inputs[i] : empty_data, i);
+      }
+    };
+
+    if (!pool || inputs.size() == 1) {
+      render_chunk(0, inputs.size());
+      return;
+    }
+
+    // A few chunks per worker to balance inputs of different cost
+    const size_t chunk_count = std::min(inputs.size(), pool->size() * 4);
+    const size_t chunk_size = (inputs.size() + chunk_count - 1) / chunk_count;
+    std::vector<std::future<void>> tasks;
+    tasks.reserve(chunk_count);
+    for (size_t begin = 0; begin < inputs.size(); begin += chunk_size) {
+      const size_t end = std::min(begin + chunk_size, inputs.size());
+      tasks.push_back(pool->submit([&render_chunk, begin, end]() { render_chunk(begin, end); }));
+    }
+
+    // The chunks reference this frame, so wait for all of them before rethrowing
+    for (const auto& task : tasks) {
+      pool->wait(task);
+    }
+    for (auto& task : tasks) {
+      task.get();
+    }
+  }
+
+  std::ostream& render_to(std::ostream& os, const Template& tmpl, const json& data, const DataProvider* provider,
+                          std::vector<const json*> lower_layers = {}) {
+    // Clear thread-local errors at start of render
+    tl_render_errors_.clear();
+
+    // Get storage snapshots for lock-free access
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+
+    const RenderConfig config_snapshot = render_config_snapshot();
+
+    // Hot templates are rendered in their compiled form once it is ready
+    const Template* render_template = &tmpl;
+    const auto compiled = select_compiled(tmpl, tmpl_storage, func_storage, config_snapshot);
+    if (compiled) {
+      render_template = &compiled->tmpl;
+    }
+
+    // Create renderer with snapshots
+    Renderer renderer(config_snapshot, *tmpl_storage, *func_storage);
+    // Globals are the lowest layer, and stay alive until the render is done
+    const auto globals = globals_.load(std::memory_order_acquire);
+    if (globals) {
+      lower_layers.push_back(&globals->values);
+    }
+
+    renderer.set_data_provider(provider);
+    renderer.set_data_layers(std::move(lower_layers));
+    renderer.render_to(os, *render_template, data);
+
+    // Copy errors from Renderer to thread-local storage for thread-safe access
+    tl_render_errors_ = renderer.get_render_errors();
+
+    return os;
+  }
+
+
+  // Render the setup template of the globals and publish the variables it set
+  GlobalsReport update_globals(const Template& setup, const json& data, size_t refresh_count) {
+    tl_render_errors_.clear();
+
+    auto tmpl_storage = template_storage_.load(std::memory_order_acquire);
+    auto func_storage = function_storage_.load(std::memory_order_acquire);
+    RenderConfig config_snapshot;
+    {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      config_snapshot = render_config;
+    }
+
+    auto scope = std::make_shared<GlobalScope>();
+    scope->setup = setup;
+    scope->data = data;
+    scope->values = json::object();
+
+    Renderer renderer(config_snapshot, *tmpl_storage, *func_storage);
+    std::ostringstream discarded_output;
+    const auto start = std::chrono::steady_clock::now();
+    renderer.render_to(discarded_output, scope->setup, scope->data);
+    scope->report.setup_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    tl_render_errors_ = renderer.get_render_errors();
+
+    // Only assigned variables, without the loop data and loop variables
+    const auto assigned = assigned_variables(scope->setup);
+    const auto& local_data = renderer.get_local_data();
+    for (auto it = local_data.begin(); it != local_data.end(); ++it) {
+      if (assigned.count(it.key()) > 0) {
+        scope->values[it.key()] = it.value();
+      }
+    }
+
+    scope->report.estimated_cost = estimate_cost(scope->setup, scope->data).estimated_cost;
+    scope->report.variable_count = scope->values.size();
+    scope->report.refresh_count = refresh_count;
+
+    const auto report = scope->report;
+    globals_.store(std::move(scope), std::memory_order_release);
+    return report;
+  }
+
+public:
+  /*!
+   * \brief Renders a setup template once and makes the variables it sets visible to all later renders (thread-safe).
+   *
+   * The variables are shared read-only: they are looked up after the data and
+   * layers of a render, and set statements of a render only change its local
+   * copy. The output of the setup template is discarded. Renders in progress
+   * keep the globals they started with.
+   */
+  GlobalsReport set_globals_from(const Template& setup, const json& data) {
+    return update_globals(setup, data, 1);
+  }
+
+  /// Renders the setup template of the globals again, e.g. after callbacks it calls return new values
+  GlobalsReport refresh_globals() {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    if (!globals) {
+      return GlobalsReport {};
+    }
+    return update_globals(globals->setup, globals->data, globals->report.refresh_count + 1);
+  }
+
+  /// Renders the setup template of the globals again with new data
+  GlobalsReport refresh_globals(const json& data) {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    if (!globals) {
+      return GlobalsReport {};
+    }
+    return update_globals(globals->setup, data, globals->report.refresh_count + 1);
+  }
+
+  void clear_globals() {
+    globals_.store(nullptr, std::memory_order_release);
+  }
+
+  /// Returns the variables set by the setup template, or null if there are no globals
+  json get_globals() const {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    return globals ? globals->values : json();
+  }
+
+  GlobalsReport get_globals_report() const {
+    const auto globals = globals_.load(std::memory_order_acquire);
+    return globals ? globals->report : GlobalsReport {};
+  }
+
+  // Note: get_last_render_errors() and clear_render_errors() are defined above
+  // and use thread-local storage for thread-safety
+
+  /// Sets whether to use graceful error handling (missing variables/functions render as original text, thread-safe)
+  void set_graceful_errors(bool graceful) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    parser_config.graceful_errors = graceful;
+    render_config.graceful_errors = graceful;
+    ++render_config_version_;
+  }
+
+  /*!
+   * \brief Sets a thread pool for rendering independent includes, blocks and loop iterations of a template concurrently (thread-safe).
+   *
+   * Sibling includes and block statements are rendered concurrently if they
+   * call only callbacks marked deterministic (see set_callback_deterministic())
+   * and block statements set no variables. Loops over arrays with at least
+   * min_loop_size elements are rendered in chunks if their body calls only
+   * deterministic callbacks, sets no variables and doesn't read the
+   * variables of its inner loops outside of them. The output and the errors
+   * are the same as of a serial render. A null pool renders serially.
+   */
+  void set_render_thread_pool(std::shared_ptr<ThreadPool> pool, size_t min_loop_size = 1024) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    render_config.thread_pool = std::move(pool);
+    render_config.concurrent_loop_size = min_loop_size;
+    ++render_config_version_;
+  }
+
+  std::string load_file(const std::string& filename) {
+    // Note: load_file is a static method that doesn't need storage references
+    return Parser::load_file(input_path / filename);
+  }
+
+  json load_json(const std::string& filename) {
+    return load_data_file(input_path / filename, DataFormat::Json);
+  }
+
+  /*!
+   * \brief Loads a JSON, CBOR, MessagePack or BSON data file.
+   *
+   * With DataFormat::Auto, the format is taken from the file extension
+   * (`.json`, `.cbor`, `.msgpack`, `.mpk`, `.bson`) or else detected from the
+   * first bytes of the file. The file is memory mapped where supported.
+   */
+  json load_data(const std::string& filename, DataFormat format = DataFormat::Auto) {
+    return load_data_file(input_path / filename, format);
+  }
+
+  /*!
+  @brief Adds a variadic callback (thread-safe via copy-on-write)
+  */
+  void add_callback(const std::string& name, const CallbackFunction& callback) {
+    add_callback(name, -1, callback);
+  }
+
+  /*!
+  @brief Adds a variadic void callback (thread-safe via copy-on-write)
+  */
+  void add_void_callback(const std::string& name, const VoidCallbackFunction& callback) {
+    add_void_callback(name, -1, callback);
+  }
+
+  /*!
+  @brief Adds a callback with given number or arguments (thread-safe via copy-on-write)
+
+  Uses copy-on-write to ensure thread safety. Renders in progress will continue
+  using the old function storage, while new renders will see the updated version.
+  */
+  void add_callback(const std::string& name, int num_args, const CallbackFunction& callback) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with the callback added
+    auto current = function_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<FunctionStorage>(*current);
+    new_storage->add_callback(name, num_args, callback);
+
+    // Atomic swap - renders in progress keep using old storage
+    function_storage_.store(new_storage, std::memory_order_release);
+  }
+
+  /*!
+  @brief Adds a callback with an optional in-place mutation optimization.
+  (thread-safe via copy-on-write)
+
+  The in-place callback is used when the renderer detects a self-assignment pattern:
+    {% set x = func(x, ...) %}
+
+  In this case, instead of copying x and then assigning the result back,
+  the in-place callback mutates x directly, avoiding the copy.
+  */
+  void add_callback(const std::string& name, int num_args, const CallbackFunction& callback,
+                    const InPlaceCallbackFunction& inplace_callback) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with the callback added
+    auto current = function_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<FunctionStorage>(*current);
+    new_storage->add_callback(name, num_args, callback, inplace_callback);
+
+    // Atomic swap - renders in progress keep using old storage
+    function_storage_.store(new_storage, std::memory_order_release);
+  }
+
+  /*!
+  @brief Adds a void callback with given number or arguments (thread-safe via copy-on-write)
+  */
+  void add_void_callback(const std::string& name, int num_args, const VoidCallbackFunction& callback) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with the callback added
+    auto current = function_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<FunctionStorage>(*current);
+    new_storage->add_callback(name, num_args, [callback](Arguments& args) {
+      callback(args);
+      return json();
+    });
+
+    // Atomic swap - renders in progress keep using old storage
+    function_storage_.store(new_storage, std::memory_order_release);
+  }
+
+  /*!
+  @brief Marks a callback as deterministic within a render (thread-safe via copy-on-write)
+
+  Deterministic callbacks return the same result for the same arguments, so
+  optimized templates may reuse their results instead of calling them again.
+  */
+  void set_callback_deterministic(const std::string& name, int num_args, bool deterministic = true) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with the updated callback
+    auto current = function_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<FunctionStorage>(*current);
+    new_storage->set_deterministic(name, num_args, deterministic);
+
+    // Atomic swap - renders in progress keep using old storage
+    function_storage_.store(new_storage, std::memory_order_release);
+  }
+
+  /** Includes a template with a given name into the environment.
+   * Then, a template can be rendered in another template using the
+   * include "<name>" syntax.
+   * Thread-safe via copy-on-write.
+   */
+  void include_template(const std::string& name, const Template& tmpl) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Copy-on-write: create new storage with the template added
+    auto current = template_storage_.load(std::memory_order_acquire);
+    auto new_storage = std::make_shared<TemplateStorage>(*current);
+    (*new_storage)[name] = tmpl;
+
+    // Atomic swap - renders in progress keep using old storage
+    template_storage_.store(new_storage, std::memory_order_release);
+  }
+
+  /*!
+  @brief Sets a function that is called when an included file is not found
+  */
+  void set_include_callback(const std::function<Template(const std::filesystem::path&, const std::string&)>& callback) {
+    parser_config.include_callback = callback;
+    include_cache_->clear();
+  }
+
+  /*!
+   * \brief Forgets how include names were resolved (thread-safe).
+   *
+   * Parsers remember which file an include name refers to, which names could
+   * not be found and the results of the include callback. Failed lookups and
+   * callback results are also dropped automatically once a file is added to
+   * the directory in which it would be found.
+   */
+  void clear_include_cache() {
+    include_cache_->clear();
+  }
+
+  /// Sets how often the directories of failed include lookups are checked for new files (thread-safe)
+  void set_include_cache_revalidate_interval(std::chrono::milliseconds interval) {
+    include_cache_->set_revalidate_interval(interval);
+  }
+
+  /// Returns the number of remembered include resolutions
+  size_t include_cache_size() const {
+    return include_cache_->size();
+  }
+};
+
+/*!
+@brief render with default settings to a string
+*/
+inline std::string render(std::string_view input, const json& data) {
+  return Environment().render(input, data);
+}
+
+/*!
+@brief render with default settings to the given output stream
+*/
+inline void render_to(std::ostream& os, std::string_view input, const json& data) {
+  Environment env;
+  env.render_to(os, env.parse(input), data);
+}
+
+} // namespace inja
+
+// Include array functions implementation after Environment is fully defined
+// #include "array_functions.hpp"
+// Copyright (c) 2024. Additional array manipulation functions for inja templates.
+
+#ifndef INCLUDE_INJA_ARRAY_FUNCTIONS_HPP_
+#define INCLUDE_INJA_ARRAY_FUNCTIONS_HPP_
+
+// #include "environment.hpp"
+
+#include <algorithm>
+#include <set>
+#include <functional>
+
+namespace inja {
+
+/*!
+ * @brief Register common array and object manipulation functions
+ * These functions provide Jinja2-like array/list manipulation capabilities
+ */
+inline void register_array_functions(Environment& env) {
+  
+  // append(array, item) - Add item to end of array and return the array
+  // Normal callback (makes a copy)
+  auto append_callback = [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0]; // Return unchanged if not an array
+    }
+    json result = *args[0]; // Make a copy
+    result.push_back(*args[1]);
+    return result;
+  };
+  // In-place callback (mutates directly, used for self-assignment optimization)
+  auto append_inplace = [](json& arr, Arguments& remaining_args) {
+    if (arr.is_array() && !remaining_args.empty()) {
+      arr.push_back(*remaining_args[0]);
+    }
+  };
+  env.add_callback("append", 2, append_callback, append_inplace);
+
+  // push(array, item) - Alias for append
+  auto push_callback = [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    result.push_back(*args[1]);
+    return result;
+  };
+  auto push_inplace = [](json& arr, Arguments& remaining_args) {
+    if (arr.is_array() && !remaining_args.empty()) {
+      arr.push_back(*remaining_args[0]);
+    }
+  };
+  env.add_callback("push", 2, push_callback, push_inplace);
+
+  // extend(array, items) - Add multiple items to array
+  auto extend_callback = [](Arguments& args) {
+    if (!args[0]->is_array() || !args[1]->is_array()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    for (const auto& item : *args[1]) {
+      result.push_back(item);
+    }
+    return result;
+  };
+  auto extend_inplace = [](json& arr, Arguments& remaining_args) {
+    if (arr.is_array() && !remaining_args.empty() && remaining_args[0]->is_array()) {
+      for (const auto& item : *remaining_args[0]) {
+        arr.push_back(item);
+      }
+    }
+  };
+  env.add_callback("extend", 2, extend_callback, extend_inplace);
+
+  // insert(array, index, item) - Insert item at specific position
+  env.add_callback("insert", 3, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    try {
+      int index = args[1]->get<int>();
+      if (index < 0) {
+        index = static_cast<int>(result.size()) + index;
+      }
+      if (index >= 0 && static_cast<size_t>(index) <= result.size()) {
+        result.insert(result.begin() + index, *args[2]);
+      }
+    } catch (...) {
+      // Return unchanged on error
+    }
+    return result;
+  });
+
+  // pop(array) or pop(array, index) - Remove and return item
+  // Note: Since we can't return multiple values, just return the modified array
+  env.add_callback("pop", 1, [](Arguments& args) {
+    if (!args[0]->is_array() || args[0]->empty()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    result.erase(result.end() - 1);
+    return result;
+  });
+
+  env.add_callback("pop", 2, [](Arguments& args) {
+    if (!args[0]->is_array() || args[0]->empty()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    try {
+      int index = args[1]->get<int>();
+      if (index < 0) {
+        index = static_cast<int>(result.size()) + index;
+      }
+      if (index >= 0 && static_cast<size_t>(index) < result.size()) {
+        result.erase(result.begin() + index);
+      }
+    } catch (...) {
+      // Return unchanged on error
+    }
+    return result;
+  });
+
+  // remove(array, value) - Remove first occurrence of value
+  env.add_callback("remove", 2, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    auto it = std::find(result.begin(), result.end(), *args[1]);
+    if (it != result.end()) {
+      result.erase(it);
+    }
+    return result;
+  });
+
+  // clear(array) - Remove all items
+  env.add_callback("clear", 1, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    return json::array();
+  });
+
+  // reverse(array) - Reverse array order
+  env.add_callback("reverse", 1, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    std::reverse(result.begin(), result.end());
+    return result;
+  });
+
+  // index(array, value) - Find index of value (-1 if not found)
+  env.add_callback("index", 2, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return json(-1);
+    }
+    auto it = std::find(args[0]->begin(), args[0]->end(), *args[1]);
+    if (it != args[0]->end()) {
+      return json(static_cast<int>(std::distance(args[0]->begin(), it)));
+    }
+    return json(-1);
+  });
+
+  // count(array, value) - Count occurrences of value
+  env.add_callback("count", 2, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return json(0);
+    }
+    return json(static_cast<int>(std::count(args[0]->begin(), args[0]->end(), *args[1])));
+  });
+
+  // unique(array) - Return array with duplicate values removed
+  env.add_callback("unique", 1, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = json::array();
+    std::set<json> seen;
+    for (const auto& item : *args[0]) {
+      if (seen.insert(item).second) {
+        result.push_back(item);
+      }
+    }
+    return result;
+  });
+
+  // flatten(array, depth=1) - Flatten nested arrays
+  env.add_callback("flatten", 1, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = json::array();
+    std::function<void(const json&, int)> flatten_helper = [&](const json& arr, int depth) {
+      for (const auto& item : arr) {
+        if (item.is_array() && depth > 0) {
+          flatten_helper(item, depth - 1);
+        } else {
+          result.push_back(item);
+        }
+      }
+    };
+    flatten_helper(*args[0], 1);
+    return result;
+  });
+
+  env.add_callback("flatten", 2, [](Arguments& args) {
+    if (!args[0]->is_array()) {
+      return *args[0];
+    }
+    json result = json::array();
+    int max_depth = args[1]->get<int>();
+    std::function<void(const json&, int)> flatten_helper = [&](const json& arr, int depth) {
+      for (const auto& item : arr) {
+        if (item.is_array() && depth > 0) {
+          flatten_helper(item, depth - 1);
+        } else {
+          result.push_back(item);
+        }
+      }
+    };
+    flatten_helper(*args[0], max_depth);
+    return result;
+  });
+
+  // Object/Dict functions
+
+  // update(object, other) - Merge two objects
+  env.add_callback("update", 2, [](Arguments& args) {
+    if (!args[0]->is_object()) {
+      return *args[0];
+    }
+    json result = *args[0];
+    if (args[1]->is_object()) {
+      result.update(*args[1]);
+    }
+    return result;
+  });
+
+  // keys(object) - Get array of object keys
+  env.add_callback("keys", 1, [](Arguments& args) {
+    if (!args[0]->is_object()) {
+      return json::array();
+    }
+    json result = json::array();
+    for (auto it = args[0]->begin(); it != args[0]->end(); ++it) {
+      result.push_back(it.key());
+    }
+    return result;
+  });
+
+  // values(object) - Get array of object values
+  env.add_callback("values", 1, [](Arguments& args) {
+    if (!args[0]->is_object()) {
+      return json::array();
+    }
+    json result = json::array();
+    for (auto it = args[0]->begin(); it != args[0]->end(); ++it) {
+      result.push_back(it.value());
+    }
+    return result;
+  });
+
+  // items(object) - Get array of [key, value] pairs
+  env.add_callback("items", 1, [](Arguments& args) {
+    if (!args[0]->is_object()) {
+      return json::array();
+    }
+    json result = json::array();
+    for (auto it = args[0]->begin(); it != args[0]->end(); ++it) {
+      result.push_back(json::array({it.key(), it.value()}));
+    }
+    return result;
+  });
+
+  // get(object, key, default=null) - Get value with default
+  env.add_callback("get", 2, [](Arguments& args) {
+    if (args[0]->is_object() && args[1]->is_string()) {
+      auto key = args[1]->get<std::string>();
+      if (args[0]->contains(key)) {
+        return (*args[0])[key];
+      }
+    }
+    return json(nullptr);
+  });
+
+  env.add_callback("get", 3, [](Arguments& args) {
+    if (args[0]->is_object() && args[1]->is_string()) {
+      auto key = args[1]->get<std::string>();
+      if (args[0]->contains(key)) {
+        return (*args[0])[key];
+      }
+    }
+    return *args[2]; // Return default value
+  });
+
+  // has_key(object, key) - Check if object has key
+  env.add_callback("has_key", 2, [](Arguments& args) {
+    if (args[0]->is_object() && args[1]->is_string()) {
+      return json(args[0]->contains(args[1]->get<std::string>()));
+    }
+    return json(false);
+  });
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_ARRAY_FUNCTIONS_HPP_
+
+
+
+#endif // INCLUDE_INJA_ENVIRONMENT_HPP_
+
+// #include "exceptions.hpp"
+
+// #include "executor.hpp"
+
+// #include "globals.hpp"
+
+// #include "include_cache.hpp"
+
+// #include "native.hpp"
+
+// #include "optimizer.hpp"
+
+// #include "parser.hpp"
+
+// #include "preload.hpp"
+
+// #include "projection.hpp"
+
+// #include "reflect.hpp"
+
+// #include "renderer.hpp"
+
+// #include "specializer.hpp"
+
+// #include "static_template.hpp"
+#ifndef INCLUDE_INJA_STATIC_TEMPLATE_HPP_
+#define INCLUDE_INJA_STATIC_TEMPLATE_HPP_
+
+#include <version>
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L && defined(__cpp_lib_constexpr_vector) &&                \
+    defined(__cpp_lib_constexpr_string)
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// #include "config.hpp"
+
+// #include "function_storage.hpp"
+
+// #include "json.hpp"
+
+// #include "lexer.hpp"
+
+// #include "native.hpp"
+
+// #include "node.hpp"
+
+// #include "template.hpp"
+
+// #include "token.hpp"
+
+// #include "utils.hpp"
+
+
+namespace inja {
+
+/*!
+ * \brief A string literal usable as a template argument.
+ */
+template <size_t N>
+struct fixed_string {
+  char data[N] {};
+
+  constexpr fixed_string(const char (&input)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+      data[i] = input[i];
+    }
+  }
+
+  constexpr std::string_view view() const {
+    return {data, N - 1};
   }
+};
 
-  void visit(const StatementNode&) override {}
+namespace static_detail {
 
-  void visit(const ForStatementNode&) override {}
+// Parse errors call these non-constexpr functions, which makes them compile errors naming the problem
+inline void unexpected_token_in_static_template() {}
+inline void malformed_expression_in_static_template() {}
+inline void unknown_function_in_static_template() {}
+inline void unmatched_statement_in_static_template() {}
+inline void statement_is_not_supported_in_static_templates() {}
+inline void expression_is_not_supported_in_static_templates() {}
 
-  void visit(const ForArrayStatementNode& node) override {
-    const auto result = eval_expression_list(node.condition);
-    if (!result->is_array()) {
-      throw_renderer_error("object must be an array", node);
-    }
+struct Expression {
+  enum class Kind {
+    Literal,
+    Data,
+    Function,
+  };
 
-    if (!current_loop_data->empty()) {
-      auto tmp = *current_loop_data; // Because of clang-3
-      (*current_loop_data)["parent"] = std::move(tmp);
-    }
+  Kind kind {Kind::Literal};
+  FunctionStorage::Operation operation {FunctionStorage::Operation::None};
+  size_t pos {0};    // Where errors are reported, and the start of a literal or variable name
+  size_t length {0}; // Of a literal or variable name
+  size_t first {0};  // First argument of a function in the lists, or first key of a variable
+  size_t count {0};
+};
 
-    size_t index = 0;
-    (*current_loop_data)["is_first"] = true;
-    (*current_loop_data)["is_last"] = (result->size() <= 1);
-    for (auto it = result->begin(); it != result->end(); ++it) {
-      additional_data[static_cast<std::string>(node.value)] = *it;
+struct Node {
+  enum class Kind {
+    Text,
+    Expression,
+    If,
+    ForArray,
+    ForObject,
+    Set,
+  };
 
-      (*current_loop_data)["index"] = index;
-      (*current_loop_data)["index1"] = index + 1;
-      if (index == 1) {
-        (*current_loop_data)["is_first"] = false;
-      }
-      if (index == result->size() - 1) {
-        (*current_loop_data)["is_last"] = true;
-      }
+  Kind kind {Kind::Text};
+  size_t pos {0};    // Where errors are reported, or the start of a text
+  size_t length {0}; // Of a text
+  size_t expression {0};
+  size_t value_pos {0}; // Loop value, or the key of a set statement
+  size_t value_length {0};
+  size_t key_pos {0}; // Loop key of an object
+  size_t key_length {0};
+  size_t first {0}; // Body or true statement in the lists
+  size_t count {0};
+  size_t else_first {0};
+  size_t else_count {0};
+};
 
-      node.body.accept(*this);
-      ++index;
-    }
+/// A key of a variable path within the source
+struct Key {
+  size_t pos {0};
+  size_t length {0};
+};
 
-    additional_data[static_cast<std::string>(node.value)].clear();
-    if (!(*current_loop_data)["parent"].empty()) {
-      const auto tmp = (*current_loop_data)["parent"];
-      *current_loop_data = tmp;
-    } else {
-      current_loop_data = &additional_data["loop"];
-    }
+struct ProgramSize {
+  size_t nodes;
+  size_t expressions;
+  size_t lists;
+  size_t keys;
+};
+
+/// A template parsed at compile time, whose children and arguments are each stored contiguously in the lists
+struct Program {
+  std::vector<Node> nodes;
+  std::vector<Expression> expressions;
+  std::vector<size_t> lists;
+  std::vector<Key> keys;
+  size_t root_first {0};
+  size_t root_count {0};
+
+  constexpr ProgramSize size() const {
+    return {nodes.size(), expressions.size(), lists.size(), keys.size()};
   }
 
-  void visit(const ForObjectStatementNode& node) override {
-    const auto result = eval_expression_list(node.condition);
-    if (!result->is_object()) {
-      throw_renderer_error("object must be an object", node);
-    }
+  /// Stores the items in the lists, returns their first index
+  constexpr size_t store(const std::vector<size_t>& items) {
+    const size_t result = lists.size();
+    lists.insert(lists.end(), items.begin(), items.end());
+    return result;
+  }
+};
 
-    if (!current_loop_data->empty()) {
-      (*current_loop_data)["parent"] = std::move(*current_loop_data);
-    }
+/// Same as the Program, with a size that is known at compile time so that it can be stored in a constant
+template <ProgramSize Size>
+struct StaticProgram {
+  std::array<Node, Size.nodes> nodes {};
+  std::array<Expression, Size.expressions> expressions {};
+  std::array<size_t, Size.lists> lists {};
+  std::array<Key, Size.keys> keys {};
+  size_t root_first {0};
+  size_t root_count {0};
+};
 
-    size_t index = 0;
-    (*current_loop_data)["is_first"] = true;
-    (*current_loop_data)["is_last"] = (result->size() <= 1);
-    for (auto it = result->begin(); it != result->end(); ++it) {
-      additional_data[static_cast<std::string>(node.key)] = it.key();
-      additional_data[static_cast<std::string>(node.value)] = it.value();
+/*!
+ * \brief Parses a template with the default LexerConfig at compile time.
+ *
+ * This follows the Parser with the tokens of the Lexer, but supports only
+ * text, comments, expressions and the if, for and set statements. Expressions
+ * may use literals, variables, operators and the builtin functions, except
+ * for member access with a dot and super().
+ */
+class ProgramParser {
+  using Op = FunctionStorage::Operation;
 
-      (*current_loop_data)["index"] = index;
-      (*current_loop_data)["index1"] = index + 1;
-      if (index == 1) {
-        (*current_loop_data)["is_first"] = false;
-      }
-      if (index == result->size() - 1) {
-        (*current_loop_data)["is_last"] = true;
-      }
+  /// The statement that ended a block
+  enum class End {
+    Eof,
+    Else,
+    ElseIf,
+    EndIf,
+    EndFor,
+  };
 
-      node.body.accept(*this);
-      ++index;
-    }
+  LexerConfig lexer_config;
+  Lexer lexer;
+  std::string_view input;
+  Program& program;
 
-    additional_data[static_cast<std::string>(node.key)].clear();
-    additional_data[static_cast<std::string>(node.value)].clear();
-    if (!(*current_loop_data)["parent"].empty()) {
-      *current_loop_data = std::move((*current_loop_data)["parent"]);
+  Token tok, peek_tok;
+  bool have_peek_tok {false};
+  std::string_view literal_start;
+  Token::Kind end_closing {Token::Kind::Eof}; // Closing of the statement that ended the last block
+
+  constexpr void get_next_token() {
+    if (have_peek_tok) {
+      tok = peek_tok;
+      have_peek_tok = false;
     } else {
-      current_loop_data = &additional_data["loop"];
+      tok = lexer.scan();
     }
   }
 
-  void visit(const IfStatementNode& node) override {
-    const auto result = eval_expression_list(node.condition);
-    // In graceful error mode, result can be nullptr if variable is missing
-    if (result && truthy(result.get())) {
-      node.true_statement.accept(*this);
-    } else if (node.has_false_statement) {
-      node.false_statement.accept(*this);
+  constexpr void get_peek_token() {
+    if (!have_peek_tok) {
+      peek_tok = lexer.scan();
+      have_peek_tok = true;
     }
   }
 
-  void visit(const IncludeStatementNode& node) override {
-    auto sub_renderer = Renderer(config, template_storage, function_storage);
-    const auto included_template_it = template_storage.find(node.file);
-    if (included_template_it != template_storage.end()) {
-      sub_renderer.render_to(*output_stream, included_template_it->second, *data_input, &additional_data);
-    } else if (config.throw_at_missing_includes) {
-      throw_renderer_error("include '" + node.file + "' not found", node);
-    }
+  constexpr size_t position() const {
+    return static_cast<size_t>(tok.text.data() - input.data());
   }
 
-  void visit(const ExtendsStatementNode& node) override {
-    const auto included_template_it = template_storage.find(node.file);
-    if (included_template_it != template_storage.end()) {
-      const Template* parent_template = &included_template_it->second;
-      render_to(*output_stream, *parent_template, *data_input, &additional_data);
-      break_rendering = true;
-    } else if (config.throw_at_missing_includes) {
-      throw_renderer_error("extends '" + node.file + "' not found", node);
+  constexpr void expect_close(Token::Kind closing) const {
+    if (tok.kind != closing && !(closing == Token::Kind::LineStatementClose && tok.kind == Token::Kind::Eof)) {
+      unexpected_token_in_static_template();
     }
   }
 
-  void visit(const BlockStatementNode& node) override {
-    const size_t old_level = current_level;
-    current_level = 0;
-    current_template = template_stack.front();
-    const auto block_it = current_template->block_storage.find(node.name);
-    if (block_it != current_template->block_storage.end()) {
-      block_statement_stack.emplace_back(&node);
-      block_it->second->block.accept(*this);
-      block_statement_stack.pop_back();
-    }
-    current_level = old_level;
-    current_template = template_stack.back();
+  constexpr size_t add_expression(const Expression& expression) {
+    program.expressions.push_back(expression);
+    return program.expressions.size() - 1;
   }
 
-  void visit(const SetStatementNode& node) override {
-    std::string ptr = node.key;
-    replace_substring(ptr, ".", "/");
-    ptr = "/" + ptr;
-    additional_data[json::json_pointer(ptr)] = *eval_expression_list(node.expression);
+  constexpr size_t add_node(const Node& node) {
+    program.nodes.push_back(node);
+    return program.nodes.size() - 1;
   }
 
-  void visit(const RawStatementNode& node) override {
-    // Output raw content without any parsing or processing
-    output_stream->write(current_template->content.c_str() + node.content_pos, node.content_length);
+  constexpr void add_literal(std::vector<size_t>& arguments) {
+    const size_t pos = static_cast<size_t>(literal_start.data() - input.data());
+    const size_t length = static_cast<size_t>(tok.text.data() - literal_start.data()) + tok.text.size();
+    arguments.push_back(add_expression(Expression {Expression::Kind::Literal, Op::None, pos, length}));
   }
 
-public:
-  explicit Renderer(const RenderConfig& config, const TemplateStorage& template_storage, const FunctionStorage& function_storage)
-      : config(config), template_storage(template_storage), function_storage(function_storage) {}
+  /// Splits the name into the keys of its json pointer, like DataNode::convert_dot_to_ptr
+  constexpr void add_data(std::vector<size_t>& arguments) {
+    std::string_view name = tok.text;
+    if (name.find('~') != std::string_view::npos) {
+      expression_is_not_supported_in_static_templates();
+    }
 
-  void render_to(std::ostream& os, const Template& tmpl, const json& data, json* loop_data = nullptr) {
-    output_stream = &os;
-    current_template = &tmpl;
-    data_input = &data;
-    if (loop_data != nullptr) {
-      additional_data = *loop_data;
-      current_loop_data = &additional_data["loop"];
+    Expression expression {Expression::Kind::Data, Op::None, position(), name.size(), program.keys.size(), 0};
+    if (name.size() > 1 && name.back() == '.') {
+      name.remove_suffix(1);
+    }
+    size_t start = expression.pos;
+    for (size_t i = 0; i <= name.size(); ++i) {
+      if (i == name.size() || name[i] == '.' || name[i] == '/') {
+        program.keys.push_back(Key {start, expression.pos + i - start});
+        expression.count += 1;
+        start = expression.pos + i + 1;
+      }
     }
+    arguments.push_back(add_expression(expression));
+  }
 
-    template_stack.emplace_back(current_template);
-    current_template->root.accept(*this);
+  constexpr void add_operator(std::vector<size_t>& arguments, std::vector<size_t>& operators) {
+    const size_t function = operators.back();
+    operators.pop_back();
 
-    data_tmp_stack.clear();
-  }
-  
-  const std::vector<RenderErrorInfo>& get_render_errors() const {
-    return render_errors;
+    const size_t number_args = static_cast<size_t>(FunctionNode::operator_properties(program.expressions[function].operation).number_args);
+    if (arguments.size() < number_args) {
+      malformed_expression_in_static_template();
+      return;
+    }
+
+    const std::vector<size_t> function_arguments(arguments.end() - static_cast<std::ptrdiff_t>(number_args), arguments.end());
+    arguments.resize(arguments.size() - number_args);
+    program.expressions[function].first = program.store(function_arguments);
+    program.expressions[function].count = number_args;
+    arguments.push_back(function);
   }
-  
-  void clear_render_errors() {
-    render_errors.clear();
+
+  /// Parses the arguments of a function after its left parenthesis, and resolves it to a builtin
+  constexpr size_t add_function(std::string_view name, size_t pos, std::vector<size_t> function_arguments) {
+    do {
+      get_next_token();
+      const size_t expression = parse_expression();
+      if (expression == std::string_view::npos) {
+        break;
+      }
+      function_arguments.push_back(expression);
+    } while (tok.kind == Token::Kind::Comma);
+    if (tok.kind != Token::Kind::RightParen) {
+      unexpected_token_in_static_template();
+    }
+    return resolve_function(name, pos, function_arguments);
   }
-};
 
-} // namespace inja
+  constexpr size_t resolve_function(std::string_view name, size_t pos, const std::vector<size_t>& function_arguments) {
+    const Op operation = FunctionStorage::find_builtin(name, static_cast<int>(function_arguments.size()));
+    if (operation == Op::None) {
+      unknown_function_in_static_template();
+    } else if (operation == Op::Super) {
+      expression_is_not_supported_in_static_templates();
+    }
 
-#endif // INCLUDE_INJA_RENDERER_HPP_
+    const size_t first = program.store(function_arguments);
+    return add_expression(Expression {Expression::Kind::Function, operation, pos, 0, first, function_arguments.size()});
+  }
 
-// #include "template.hpp"
+  constexpr Op operator_of(const Token& token) const {
+    switch (token.kind) {
+    case Token::Kind::Id:
+      if (token.text == "and") {
+        return Op::And;
+      } else if (token.text == "or") {
+        return Op::Or;
+      } else if (token.text == "in") {
+        return Op::In;
+      }
+      return Op::Not;
+    case Token::Kind::Equal:
+      return Op::Equal;
+    case Token::Kind::NotEqual:
+      return Op::NotEqual;
+    case Token::Kind::GreaterThan:
+      return Op::Greater;
+    case Token::Kind::GreaterEqual:
+      return Op::GreaterEqual;
+    case Token::Kind::LessThan:
+      return Op::Less;
+    case Token::Kind::LessEqual:
+      return Op::LessEqual;
+    case Token::Kind::Plus:
+      return Op::Add;
+    case Token::Kind::Minus:
+      return Op::Subtract;
+    case Token::Kind::Times:
+      return Op::Multiplication;
+    case Token::Kind::Slash:
+      return Op::Division;
+    case Token::Kind::Power:
+      return Op::Power;
+    case Token::Kind::Percent:
+      return Op::Modulo;
+    default:
+      // Member access with a dot
+      expression_is_not_supported_in_static_templates();
+      return Op::AtId;
+    }
+  }
 
-// #include "throw.hpp"
+  /// Returns the index of the expression, or npos if it is empty
+  constexpr size_t parse_expression() {
+    size_t current_bracket_level {0};
+    size_t current_brace_level {0};
+    std::vector<size_t> arguments;
+    std::vector<size_t> operators;
+
+    const auto add_operation = [&](Op operation) {
+      const auto properties = FunctionNode::operator_properties(operation);
+      while (!operators.empty()) {
+        const auto top = FunctionNode::operator_properties(program.expressions[operators.back()].operation);
+        if (top.precedence < properties.precedence ||
+            (top.precedence == properties.precedence && properties.associativity != FunctionNode::Associativity::Left)) {
+          break;
+        }
+        add_operator(arguments, operators);
+      }
+      operators.push_back(add_expression(Expression {Expression::Kind::Function, operation, position()}));
+    };
+
+    for (bool done = false; !done && tok.kind != Token::Kind::Eof;) {
+      switch (tok.kind) {
+      case Token::Kind::String:
+      case Token::Kind::Number: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+          add_literal(arguments);
+        }
+      } break;
+      case Token::Kind::LeftBracket: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+        }
+        current_bracket_level += 1;
+      } break;
+      case Token::Kind::LeftBrace: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          literal_start = tok.text;
+        }
+        current_brace_level += 1;
+      } break;
+      case Token::Kind::RightBracket: {
+        if (current_bracket_level == 0) {
+          unexpected_token_in_static_template();
+          break;
+        }
+        current_bracket_level -= 1;
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          add_literal(arguments);
+        }
+      } break;
+      case Token::Kind::RightBrace: {
+        if (current_brace_level == 0) {
+          unexpected_token_in_static_template();
+          break;
+        }
+        current_brace_level -= 1;
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          add_literal(arguments);
+        }
+      } break;
+      case Token::Kind::Id: {
+        get_peek_token();
+        if (tok.text == "true" || tok.text == "false" || tok.text == "null") {
+          if (current_brace_level == 0 && current_bracket_level == 0) {
+            literal_start = tok.text;
+            add_literal(arguments);
+          }
+        } else if (tok.text == "and" || tok.text == "or" || tok.text == "in" || tok.text == "not") {
+          add_operation(operator_of(tok));
+        } else if (peek_tok.kind == Token::Kind::LeftParen) {
+          const std::string_view name = tok.text;
+          const size_t pos = position();
+          get_next_token();
+          arguments.push_back(add_function(name, pos, {}));
+        } else {
+          add_data(arguments);
+        }
+      } break;
+      case Token::Kind::Equal:
+      case Token::Kind::NotEqual:
+      case Token::Kind::GreaterThan:
+      case Token::Kind::GreaterEqual:
+      case Token::Kind::LessThan:
+      case Token::Kind::LessEqual:
+      case Token::Kind::Plus:
+      case Token::Kind::Minus:
+      case Token::Kind::Times:
+      case Token::Kind::Slash:
+      case Token::Kind::Power:
+      case Token::Kind::Percent:
+      case Token::Kind::Dot: {
+        add_operation(operator_of(tok));
+      } break;
+      case Token::Kind::Comma: {
+        done = (current_brace_level == 0 && current_bracket_level == 0);
+      } break;
+      case Token::Kind::Colon: {
+        if (current_brace_level == 0 && current_bracket_level == 0) {
+          unexpected_token_in_static_template();
+        }
+      } break;
+      case Token::Kind::LeftParen: {
+        get_next_token();
+        const size_t expression = parse_expression();
+        if (tok.kind != Token::Kind::RightParen || expression == std::string_view::npos) {
+          malformed_expression_in_static_template();
+        }
+        arguments.push_back(expression);
+      } break;
+      case Token::Kind::Pipe: {
+        get_next_token();
+        if (tok.kind != Token::Kind::Id || arguments.empty()) {
+          malformed_expression_in_static_template();
+          break;
+        }
+        const std::string_view name = tok.text;
+        const size_t pos = position();
+        const std::vector<size_t> function_arguments {arguments.back()};
+        arguments.pop_back();
+        get_peek_token();
+        if (peek_tok.kind == Token::Kind::LeftParen) {
+          get_next_token();
+          arguments.push_back(add_function(name, pos, function_arguments));
+        } else {
+          arguments.push_back(resolve_function(name, pos, function_arguments));
+        }
+      } break;
+      default:
+        done = true;
+      }
 
+      if (!done) {
+        get_next_token();
+      }
+    }
 
-namespace inja {
+    while (!operators.empty()) {
+      add_operator(arguments, operators);
+    }
 
-/*!
- * \brief Class for changing the configuration.
- */
-class Environment {
-  FunctionStorage function_storage;
-  TemplateStorage template_storage;
-  std::vector<RenderErrorInfo> last_render_errors; // Track errors from last render
+    if (arguments.size() > 1) {
+      malformed_expression_in_static_template();
+    }
+    return arguments.empty() ? std::string_view::npos : arguments.front();
+  }
 
-protected:
-  LexerConfig lexer_config;
-  ParserConfig parser_config;
-  RenderConfig render_config;
+  /// Parses an expression that must not be empty, followed by the closing of its statement
+  constexpr size_t parse_statement_expression(Token::Kind closing) {
+    const size_t expression = parse_expression();
+    if (expression == std::string_view::npos) {
+      malformed_expression_in_static_template();
+    }
+    expect_close(closing);
+    return expression;
+  }
 
-  std::filesystem::path input_path;
-  std::filesystem::path output_path;
+  /// Parses an if statement from its condition to the endif, which also ends its nested else if statements
+  constexpr void parse_if(std::vector<size_t>& nodes, Token::Kind closing) {
+    Node node {Node::Kind::If, position()};
+    node.expression = parse_statement_expression(closing);
 
-public:
-  Environment(): Environment("") {}
-  explicit Environment(const std::filesystem::path& global_path): input_path(global_path), output_path(global_path) {}
-  Environment(const std::filesystem::path& input_path, const std::filesystem::path& output_path): input_path(input_path), output_path(output_path) {}
+    std::vector<size_t> true_statement;
+    std::vector<size_t> false_statement;
+    switch (parse_block(true_statement)) {
+    case End::EndIf:
+      break;
+    case End::Else:
+      if (parse_block(false_statement) != End::EndIf) {
+        unmatched_statement_in_static_template();
+      }
+      break;
+    case End::ElseIf:
+      parse_if(false_statement, end_closing);
+      break;
+    default:
+      unmatched_statement_in_static_template();
+    }
 
-  /// Sets the opener and closer for template statements
-  void set_statement(const std::string& open, const std::string& close) {
-    lexer_config.statement_open = open;
-    lexer_config.statement_open_no_lstrip = open + "+";
-    lexer_config.statement_open_force_lstrip = open + "-";
-    lexer_config.statement_close = close;
-    lexer_config.statement_close_force_rstrip = "-" + close;
-    lexer_config.update_open_chars();
+    node.first = program.store(true_statement);
+    node.count = true_statement.size();
+    node.else_first = program.store(false_statement);
+    node.else_count = false_statement.size();
+    nodes.push_back(add_node(node));
   }
 
-  /// Sets the opener for template line statements
-  void set_line_statement(const std::string& open) {
-    lexer_config.line_statement = open;
-    lexer_config.update_open_chars();
-  }
+  constexpr void parse_for(std::vector<size_t>& nodes, Token::Kind closing) {
+    if (tok.kind != Token::Kind::Id) {
+      unexpected_token_in_static_template();
+    }
 
-  /// Sets the opener and closer for template expressions
-  void set_expression(const std::string& open, const std::string& close) {
-    lexer_config.expression_open = open;
-    lexer_config.expression_open_force_lstrip = open + "-";
-    lexer_config.expression_close = close;
-    lexer_config.expression_close_force_rstrip = "-" + close;
-    lexer_config.update_open_chars();
-  }
+    Node node {Node::Kind::ForArray};
+    Token value_token = tok;
+    get_next_token();
+    if (tok.kind == Token::Kind::Comma) {
+      get_next_token();
+      if (tok.kind != Token::Kind::Id) {
+        unexpected_token_in_static_template();
+      }
+      node.kind = Node::Kind::ForObject;
+      node.key_pos = static_cast<size_t>(value_token.text.data() - input.data());
+      node.key_length = value_token.text.size();
+      value_token = tok;
+      get_next_token();
+    }
+    node.value_pos = static_cast<size_t>(value_token.text.data() - input.data());
+    node.value_length = value_token.text.size();
+    node.pos = position();
 
-  /// Sets the opener and closer for template comments
-  void set_comment(const std::string& open, const std::string& close) {
-    lexer_config.comment_open = open;
-    lexer_config.comment_open_force_lstrip = open + "-";
-    lexer_config.comment_close = close;
-    lexer_config.comment_close_force_rstrip = "-" + close;
-    lexer_config.update_open_chars();
-  }
+    if (tok.kind != Token::Kind::Id || tok.text != "in") {
+      unexpected_token_in_static_template();
+    }
+    get_next_token();
+    node.expression = parse_statement_expression(closing);
 
-  /// Sets whether to remove the first newline after a block
-  void set_trim_blocks(bool trim_blocks) {
-    lexer_config.trim_blocks = trim_blocks;
+    std::vector<size_t> body;
+    if (parse_block(body) != End::EndFor) {
+      unmatched_statement_in_static_template();
+    }
+    node.first = program.store(body);
+    node.count = body.size();
+    nodes.push_back(add_node(node));
   }
 
-  /// Sets whether to strip the spaces and tabs from the start of a line to a block
-  void set_lstrip_blocks(bool lstrip_blocks) {
-    lexer_config.lstrip_blocks = lstrip_blocks;
-  }
+  constexpr void parse_set(std::vector<size_t>& nodes, Token::Kind closing) {
+    if (tok.kind != Token::Kind::Id) {
+      unexpected_token_in_static_template();
+    }
 
-  /// Sets the element notation syntax
-  void set_search_included_templates_in_files(bool search_in_files) {
-    parser_config.search_included_templates_in_files = search_in_files;
+    Node node {Node::Kind::Set};
+    node.value_pos = position();
+    node.value_length = tok.text.size();
+    get_next_token();
+    node.pos = position();
+    if (tok.text != "=") {
+      unexpected_token_in_static_template();
+    }
+    get_next_token();
+    node.expression = parse_statement_expression(closing);
+    nodes.push_back(add_node(node));
   }
 
-  /// Sets whether a missing include will throw an error
-  void set_throw_at_missing_includes(bool will_throw) {
-    render_config.throw_at_missing_includes = will_throw;
-  }
+  /// Parses a statement after its keyword, returns whether it ends the current block
+  constexpr bool parse_statement(std::vector<size_t>& nodes, Token::Kind closing, End& end) {
+    if (tok.kind != Token::Kind::Id) {
+      unexpected_token_in_static_template();
+      return false;
+    }
 
-  /// Sets whether we'll automatically perform HTML escape
-  void set_html_autoescape(bool will_escape) {
-    render_config.html_autoescape = will_escape;
+    const std::string_view keyword = tok.text;
+    get_next_token();
+    if (keyword == "if") {
+      parse_if(nodes, closing);
+    } else if (keyword == "elif" || (keyword == "else" && tok.kind == Token::Kind::Id && tok.text == "if")) {
+      if (keyword == "else") {
+        get_next_token();
+      }
+      end = End::ElseIf;
+      end_closing = closing;
+      return true;
+    } else if (keyword == "else" || keyword == "endif" || keyword == "endfor") {
+      expect_close(closing);
+      end = (keyword == "else") ? End::Else : (keyword == "endif") ? End::EndIf : End::EndFor;
+      return true;
+    } else if (keyword == "for") {
+      parse_for(nodes, closing);
+    } else if (keyword == "set") {
+      parse_set(nodes, closing);
+    } else if (keyword == "include" || keyword == "extends" || keyword == "block" || keyword == "endblock" || keyword == "raw") {
+      statement_is_not_supported_in_static_templates();
+    } else {
+      unexpected_token_in_static_template();
+    }
+    return false;
   }
 
-  Template parse(std::string_view input) {
-    Parser parser(parser_config, lexer_config, template_storage, function_storage);
-    return parser.parse(input, input_path);
+  /// Parses nodes until the end of the template or a statement that ends a block
+  constexpr End parse_block(std::vector<size_t>& nodes) {
+    for (;;) {
+      get_next_token();
+      switch (tok.kind) {
+      case Token::Kind::Eof:
+        return End::Eof;
+      case Token::Kind::Text: {
+        nodes.push_back(add_node(Node {Node::Kind::Text, position(), tok.text.size()}));
+      } break;
+      case Token::Kind::StatementOpen:
+      case Token::Kind::LineStatementOpen: {
+        const auto closing = (tok.kind == Token::Kind::StatementOpen) ? Token::Kind::StatementClose : Token::Kind::LineStatementClose;
+        get_next_token();
+        End end {End::Eof};
+        if (parse_statement(nodes, closing, end)) {
+          return end;
+        }
+      } break;
+      case Token::Kind::ExpressionOpen: {
+        const size_t pos = position();
+        get_next_token();
+        const size_t expression = parse_expression();
+        if (tok.kind != Token::Kind::ExpressionClose || expression == std::string_view::npos) {
+          malformed_expression_in_static_template();
+        }
+        Node node {Node::Kind::Expression, pos};
+        node.expression = expression;
+        nodes.push_back(add_node(node));
+      } break;
+      case Token::Kind::CommentOpen: {
+        get_next_token();
+        if (tok.kind != Token::Kind::CommentClose) {
+          unexpected_token_in_static_template();
+        }
+      } break;
+      default:
+        unexpected_token_in_static_template();
+      }
+    }
   }
 
-  Template parse_template(const std::filesystem::path& filename) {
-    Parser parser(parser_config, lexer_config, template_storage, function_storage);
-    auto result = Template(Parser::load_file(input_path / filename));
-    parser.parse_into_template(result, (input_path / filename).string());
-    return result;
-  }
+public:
+  constexpr ProgramParser(std::string_view input, Program& program): lexer(lexer_config), input(input), program(program) {}
 
-  Template parse_file(const std::filesystem::path& filename) {
-    return parse_template(filename);
+  constexpr void parse() {
+    lexer.start(input);
+    std::vector<size_t> root;
+    if (parse_block(root) != End::Eof) {
+      unmatched_statement_in_static_template();
+    }
+    program.root_first = program.store(root);
+    program.root_count = root.size();
   }
+};
 
-  std::string render(std::string_view input, const json& data) {
-    return render(parse(input), data);
-  }
+constexpr Program parse(std::string_view input) {
+  Program result;
+  ProgramParser(input, result).parse();
+  return result;
+}
 
-  std::string render(const Template& tmpl, const json& data) {
-    std::stringstream os;
-    render_to(os, tmpl, data);
-    return os.str();
-  }
+template <ProgramSize Size>
+constexpr StaticProgram<Size> freeze(std::string_view input) {
+  const Program program = parse(input);
+  StaticProgram<Size> result;
+  std::copy(program.nodes.begin(), program.nodes.end(), result.nodes.begin());
+  std::copy(program.expressions.begin(), program.expressions.end(), result.expressions.begin());
+  std::copy(program.lists.begin(), program.lists.end(), result.lists.begin());
+  std::copy(program.keys.begin(), program.keys.end(), result.keys.begin());
+  result.root_first = program.root_first;
+  result.root_count = program.root_count;
+  return result;
+}
 
-  std::string render_file(const std::filesystem::path& filename, const json& data) {
-    return render(parse_template(filename), data);
-  }
+/// The environment of static templates, with the default configuration and only the builtin functions
+struct StaticEnvironment {
+  RenderConfig config;
+  TemplateStorage templates;
+  FunctionStorage functions;
+  std::vector<const json*> layers;
 
-  std::string render_file_with_json_file(const std::filesystem::path& filename, const std::string& filename_data) {
-    const json data = load_json(filename_data);
-    return render_file(filename, data);
+  static const StaticEnvironment& instance() {
+    static const StaticEnvironment result;
+    return result;
   }
+};
 
-  void write(const std::filesystem::path& filename, const json& data, const std::string& filename_out) {
-    std::ofstream file(output_path / filename_out);
-    file << render_file(filename, data);
-    file.close();
-  }
+} // namespace static_detail
 
-  void write(const Template& temp, const json& data, const std::string& filename_out) {
-    std::ofstream file(output_path / filename_out);
-    file << render(temp, data);
-    file.close();
-  }
+/*!
+ * \brief A template that is parsed at compile time.
+ *
+ * The template is lexed by the Lexer with the default LexerConfig and parsed
+ * into a program that is stored in the type, so that its syntax errors are
+ * compile errors naming the problem. It may contain text, comments,
+ * expressions and the if, for and set statements. Expressions may use
+ * literals, variables, operators, pipes and the builtin functions; member
+ * access with a dot, callbacks, super() and the include, extends, block and
+ * raw statements are not supported. Rendering has the semantics and errors of
+ * the Renderer under the default RenderConfig, as it uses the NativeRender.
+ *
+ * \code
+ * inja::static_template<"{% for user in users %}{{ upper(user.name) }}{% endfor %}">::render(data);
+ * \endcode
+ */
+template <fixed_string Source>
+class static_template {
+  using Op = FunctionStorage::Operation;
+  using Expression = static_detail::Expression;
+  using Node = static_detail::Node;
+
+  static constexpr std::string_view input {Source.view()};
+  static constexpr auto program = static_detail::freeze<static_detail::parse(input).size()>(input);
+
+  template <size_t Pos>
+  static constexpr SourceLocation location = get_source_location(input, Pos);
+
+  template <size_t Pos, size_t Length>
+  static constexpr std::string_view text = input.substr(Pos, Length);
+
+  /// Keys of a variable
+  template <size_t E>
+  static constexpr auto path = [] {
+    constexpr Expression expression = program.expressions[E];
+    std::array<std::string_view, expression.count> result {};
+    for (size_t i = 0; i < expression.count; ++i) {
+      const auto key = program.keys[expression.first + i];
+      result[i] = input.substr(key.pos, key.length);
+    }
+    return result;
+  }();
 
-  void write_with_json_file(const std::filesystem::path& filename, const std::string& filename_data, const std::string& filename_out) {
-    const json data = load_json(filename_data);
-    write(filename, data, filename_out);
+  static bool truthy(bool value) {
+    return value;
   }
 
-  void write_with_json_file(const Template& temp, const std::string& filename_data, const std::string& filename_out) {
-    const json data = load_json(filename_data);
-    write(temp, data, filename_out);
+  static bool truthy(const json& value) {
+    return NativeRender::truthy(value);
   }
 
-  std::ostream& render_to(std::ostream& os, const Template& tmpl, const json& data) {
-    Renderer renderer(render_config, template_storage, function_storage);
-    renderer.render_to(os, tmpl, data);
-    last_render_errors = renderer.get_render_errors();
-    return os;
+  template <size_t E, size_t I>
+  static decltype(auto) argument(NativeRender& r) {
+    return evaluate<program.lists[program.expressions[E].first + I]>(r);
   }
 
-  std::ostream& render_to(std::ostream& os, const std::string_view input, const json& data) {
-    return render_to(os, parse(input), data);
+  /// Calls the function with the arguments of the expression, which are evaluated from left to right like in the Renderer
+  template <size_t E, typename F>
+  static auto call(NativeRender& r, F function) {
+    return [&]<size_t... I>(std::index_sequence<I...>) {
+      std::tuple<decltype(argument<E, I>(r))...> arguments {argument<E, I>(r)...};
+      return std::apply(function, arguments);
+    }(std::make_index_sequence<program.expressions[E].count> {});
   }
-  
-  /// Gets the errors from the last render operation (only populated in graceful_errors mode)
-  const std::vector<RenderErrorInfo>& get_last_render_errors() const {
-    return last_render_errors;
-  }
-  
-  /// Clears the stored render errors
-  void clear_render_errors() {
-    last_render_errors.clear();
-  }
-  
-  /// Sets whether to use graceful error handling (missing variables/functions render as original text)
-  void set_graceful_errors(bool graceful) {
-    parser_config.graceful_errors = graceful;
-    render_config.graceful_errors = graceful;
+
+  template <size_t E>
+  static auto builtin(NativeRender& r) {
+    constexpr Op operation = program.expressions[E].operation;
+    const auto& loc = location<program.expressions[E].pos>;
+    if constexpr (operation == Op::Add) {
+      return call<E>(r, &NativeRender::add);
+    } else if constexpr (operation == Op::Subtract) {
+      return call<E>(r, &NativeRender::subtract);
+    } else if constexpr (operation == Op::Multiplication) {
+      return call<E>(r, &NativeRender::multiply);
+    } else if constexpr (operation == Op::Division) {
+      return call<E>(r, [&loc](const json& lhs, const json& rhs) { return NativeRender::divide(lhs, rhs, loc); });
+    } else if constexpr (operation == Op::Power) {
+      return call<E>(r, &NativeRender::power);
+    } else if constexpr (operation == Op::Modulo) {
+      return call<E>(r, &NativeRender::modulo);
+    } else if constexpr (operation == Op::Capitalize) {
+      return call<E>(r, &NativeRender::capitalize);
+    } else if constexpr (operation == Op::DivisibleBy) {
+      return call<E>(r, &NativeRender::divisible_by);
+    } else if constexpr (operation == Op::Even) {
+      return call<E>(r, &NativeRender::even);
+    } else if constexpr (operation == Op::Exists) {
+      return call<E>(r, [&r](const json& name) { return r.exists(name); });
+    } else if constexpr (operation == Op::ExistsInObject) {
+      return call<E>(r, &NativeRender::exists_in);
+    } else if constexpr (operation == Op::First) {
+      return call<E>(r, [&loc](const json& value) -> json { return NativeRender::first(value, loc); });
+    } else if constexpr (operation == Op::Float) {
+      return call<E>(r, &NativeRender::to_float);
+    } else if constexpr (operation == Op::Int) {
+      return call<E>(r, &NativeRender::to_int);
+    } else if constexpr (operation == Op::Last) {
+      return call<E>(r, [&loc](const json& value) -> json { return NativeRender::last(value, loc); });
+    } else if constexpr (operation == Op::Length) {
+      return call<E>(r, &NativeRender::length);
+    } else if constexpr (operation == Op::Lower) {
+      return call<E>(r, &NativeRender::lower);
+    } else if constexpr (operation == Op::Max) {
+      return call<E>(r, [](const json& value) -> json { return NativeRender::max(value); });
+    } else if constexpr (operation == Op::Min) {
+      return call<E>(r, [](const json& value) -> json { return NativeRender::min(value); });
+    } else if constexpr (operation == Op::Odd) {
+      return call<E>(r, &NativeRender::odd);
+    } else if constexpr (operation == Op::Range) {
+      return call<E>(r, &NativeRender::range);
+    } else if constexpr (operation == Op::Replace) {
+      return call<E>(r, &NativeRender::replace);
+    } else if constexpr (operation == Op::Round) {
+      return call<E>(r, &NativeRender::round);
+    } else if constexpr (operation == Op::Sort) {
+      return call<E>(r, &NativeRender::sort);
+    } else if constexpr (operation == Op::Upper) {
+      return call<E>(r, &NativeRender::upper);
+    } else {
+      static_assert(operation == Op::Join);
+      return call<E>(r, &NativeRender::join);
+    }
   }
 
-  std::string load_file(const std::string& filename) {
-    const Parser parser(parser_config, lexer_config, template_storage, function_storage);
-    return Parser::load_file(input_path / filename);
+  template <size_t E, typename Compare>
+  static bool compare(NativeRender& r) {
+    return call<E>(r, [](const json& lhs, const json& rhs) { return NativeRender::compare(lhs, rhs, Compare()); });
   }
 
-  json load_json(const std::string& filename) {
-    std::ifstream file;
-    file.open(input_path / filename);
-    if (file.fail()) {
-      INJA_THROW(FileError("failed accessing file at '" + (input_path / filename).string() + "'"));
+  template <size_t E>
+  static auto function(NativeRender& r) {
+    constexpr Expression expression = program.expressions[E];
+    constexpr Op operation = expression.operation;
+    if constexpr (constexpr const char* name = NativeRender::builtin_name(operation); name != nullptr) {
+      // The arguments are evaluated within the try block, as their errors are reported as failures of the function
+      try {
+        return builtin<E>(r);
+      } catch (...) {
+        NativeRender::fail_operation(name, location<expression.pos>);
+      }
+    } else if constexpr (operation == Op::Not) {
+      return !truthy(argument<E, 0>(r));
+    } else if constexpr (operation == Op::And) {
+      return truthy(argument<E, 0>(r)) && truthy(argument<E, 1>(r));
+    } else if constexpr (operation == Op::Or) {
+      return truthy(argument<E, 0>(r)) || truthy(argument<E, 1>(r));
+    } else if constexpr (operation == Op::In) {
+      return call<E>(r, &NativeRender::in);
+    } else if constexpr (operation == Op::Equal) {
+      return compare<E, std::equal_to<>>(r);
+    } else if constexpr (operation == Op::NotEqual) {
+      return compare<E, std::not_equal_to<>>(r);
+    } else if constexpr (operation == Op::Greater) {
+      return compare<E, std::greater<>>(r);
+    } else if constexpr (operation == Op::GreaterEqual) {
+      return compare<E, std::greater_equal<>>(r);
+    } else if constexpr (operation == Op::Less) {
+      return compare<E, std::less<>>(r);
+    } else if constexpr (operation == Op::LessEqual) {
+      return compare<E, std::less_equal<>>(r);
+    } else if constexpr (operation == Op::IsBoolean) {
+      return call<E>(r, [](const json& value) { return value.is_boolean(); });
+    } else if constexpr (operation == Op::IsNumber) {
+      return call<E>(r, [](const json& value) { return value.is_number(); });
+    } else if constexpr (operation == Op::IsInteger) {
+      return call<E>(r, [](const json& value) { return value.is_number_integer(); });
+    } else if constexpr (operation == Op::IsFloat) {
+      return call<E>(r, [](const json& value) { return value.is_number_float(); });
+    } else if constexpr (operation == Op::IsObject) {
+      return call<E>(r, [](const json& value) { return value.is_object(); });
+    } else if constexpr (operation == Op::IsArray) {
+      return call<E>(r, [](const json& value) { return value.is_array(); });
+    } else if constexpr (operation == Op::IsString) {
+      return call<E>(r, [](const json& value) { return value.is_string(); });
+    } else if constexpr (operation == Op::At) {
+      return call<E>(r, [](const json& container, const json& key) -> json {
+        return NativeRender::at(container, key, location<program.expressions[E].pos>);
+      });
+    } else {
+      static_assert(operation == Op::Default);
+      constexpr Expression variable = program.expressions[program.lists[expression.first]];
+      if constexpr (variable.kind == Expression::Kind::Data) {
+        json result;
+        if (const json* value = r.lookup(path<program.lists[expression.first]>, text<variable.pos, variable.length>, result)) {
+          return json(*value);
+        }
+        return json(argument<E, 1>(r));
+      } else {
+        return json(argument<E, 0>(r));
+      }
     }
-
-    return json::parse(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
   }
 
-  /*!
-  @brief Adds a variadic callback
-  */
-  void add_callback(const std::string& name, const CallbackFunction& callback) {
-    add_callback(name, -1, callback);
+  /// Returns the value of the expression, as a reference to the data for variables
+  template <size_t E>
+  static decltype(auto) evaluate(NativeRender& r) {
+    constexpr Expression expression = program.expressions[E];
+    if constexpr (expression.kind == Expression::Kind::Literal) {
+      static const json value = json::parse(text<expression.pos, expression.length>);
+      return (value);
+    } else if constexpr (expression.kind == Expression::Kind::Data) {
+      json result;
+      return r.get(path<E>, text<expression.pos, expression.length>, result, location<expression.pos>);
+    } else {
+      return function<E>(r);
+    }
   }
 
-  /*!
-  @brief Adds a variadic void callback
-  */
-  void add_void_callback(const std::string& name, const VoidCallbackFunction& callback) {
-    add_void_callback(name, -1, callback);
+  template <size_t N>
+  static void render_node(NativeRender& r) {
+    constexpr Node node = program.nodes[N];
+    if constexpr (node.kind == Node::Kind::Text) {
+      r.write(text<node.pos, node.length>);
+    } else if constexpr (node.kind == Node::Kind::Expression) {
+      r.print(evaluate<node.expression>(r));
+    } else if constexpr (node.kind == Node::Kind::If) {
+      if (truthy(evaluate<node.expression>(r))) {
+        render_nodes<node.first>(r, std::make_index_sequence<node.count> {});
+      } else {
+        render_nodes<node.else_first>(r, std::make_index_sequence<node.else_count> {});
+      }
+    } else if constexpr (node.kind == Node::Kind::ForArray || node.kind == Node::Kind::ForObject) {
+      // The source is copied, as the local data changes within the loop
+      const json source = evaluate<node.expression>(r);
+      static const std::string value_name {text<node.value_pos, node.value_length>};
+      if constexpr (node.kind == Node::Kind::ForArray) {
+        if (!source.is_array()) {
+          NativeRender::fail("object must be an array", location<node.pos>);
+        }
+        r.enter_loop(source.size());
+        size_t index {0};
+        for (const auto& value : source) {
+          r.bind(value_name, value);
+          r.update_loop(index, source.size());
+          render_nodes<node.first>(r, std::make_index_sequence<node.count> {});
+          index += 1;
+        }
+      } else {
+        if (!source.is_object()) {
+          NativeRender::fail("object must be an object", location<node.pos>);
+        }
+        static const std::string key_name {text<node.key_pos, node.key_length>};
+        r.enter_loop(source.size());
+        size_t index {0};
+        for (auto it = source.begin(); it != source.end(); ++it) {
+          r.bind(key_name, it.key());
+          r.bind(value_name, it.value());
+          r.update_loop(index, source.size());
+          render_nodes<node.first>(r, std::make_index_sequence<node.count> {});
+          index += 1;
+        }
+        r.unbind(key_name);
+      }
+      r.unbind(value_name);
+      r.leave_loop();
+    } else {
+      static_assert(node.kind == Node::Kind::Set);
+      static const std::string key {text<node.value_pos, node.value_length>};
+      static const json::json_pointer ptr(DataNode::convert_dot_to_ptr(key));
+      try {
+        r.set(ptr, json(evaluate<node.expression>(r)));
+      } catch (...) {
+        NativeRender::fail_set(key, location<node.pos>);
+      }
+    }
   }
 
-  /*!
-  @brief Adds a callback with given number or arguments
-  */
-  void add_callback(const std::string& name, int num_args, const CallbackFunction& callback) {
-    function_storage.add_callback(name, num_args, callback);
+  template <size_t First, size_t... I>
+  static void render_nodes(NativeRender& r, std::index_sequence<I...>) {
+    (render_node<program.lists[First + I]>(r), ...);
   }
 
-  /*!
-  @brief Adds a void callback with given number or arguments
-  */
-  void add_void_callback(const std::string& name, int num_args, const VoidCallbackFunction& callback) {
-    function_storage.add_callback(name, num_args, [callback](Arguments& args) {
-      callback(args);
-      return json();
-    });
+public:
+  /// The source of the template, e.g. to parse it at runtime as well
+  static constexpr std::string_view source() {
+    return input;
   }
 
-  /** Includes a template with a given name into the environment.
-   * Then, a template can be rendered in another template using the
-   * include "<name>" syntax.
-   */
-  void include_template(const std::string& name, const Template& tmpl) {
-    template_storage[name] = tmpl;
+  static std::ostream& render_to(std::ostream& os, const json& data) {
+    const auto& environment = static_detail::StaticEnvironment::instance();
+    NativeRender r(os, data, environment.layers, environment.config, environment.templates, environment.functions);
+    render_nodes<program.root_first>(r, std::make_index_sequence<program.root_count> {});
+    return os;
   }
 
-  /*!
-  @brief Sets a function that is called when an included file is not found
-  */
-  void set_include_callback(const std::function<Template(const std::filesystem::path&, const std::string&)>& callback) {
-    parser_config.include_callback = callback;
+  static std::string render(const json& data) {
+    std::ostringstream os;
+    render_to(os, data);
+    return os.str();
   }
 };
 
-/*!
-@brief render with default settings to a string
-*/
-inline std::string render(std::string_view input, const json& data) {
-  return Environment().render(input, data);
-}
+} // namespace inja
 
-/*!
-@brief render with default settings to the given output stream
-*/
-inline void render_to(std::ostream& os, std::string_view input, const json& data) {
-  Environment env;
-  env.render_to(os, env.parse(input), data);
-}
+#endif // __cpp_nontype_template_args
 
-} // namespace inja
+#endif // INCLUDE_INJA_STATIC_TEMPLATE_HPP_
 
-#endif // INCLUDE_INJA_ENVIRONMENT_HPP_
+// #include "stream.hpp"
 
-// #include "exceptions.hpp"
+// #include "template.hpp"
 
-// #include "parser.hpp"
+// #include "thread_pool.hpp"
 
-// #include "renderer.hpp"
+// #include "watcher.hpp"
 
-// #include "template.hpp"
+// #include "callback_cache.hpp"
 
 
 #endif // INCLUDE_INJA_INJA_HPP_
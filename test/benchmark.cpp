@@ -11,6 +11,7 @@ const auto small_data = env.load_json((test_file_directory / "small_data.json").
 const auto large_data = env.load_json((test_file_directory / "large_data.json").string());
 const std::string medium_template = env.load_file((test_file_directory / "medium_template.txt").string());
 const std::string large_template = env.load_file((test_file_directory / "large_template.txt").string());
+const std::string arithmetic_template = env.load_file((test_file_directory / "arithmetic_template.txt").string());
 
 BENCHMARK(SmallDataMediumTemplate, render, 5, 30) {
   env.render(medium_template, small_data);
@@ -21,6 +22,9 @@ BENCHMARK(LargeDataMediumTemplate, render, 5, 15) {
 BENCHMARK(LargeDataLargeTemplate, render, 5, 5) {
   env.render(large_template, large_data);
 }
+BENCHMARK(SmallDataArithmeticTemplate, render, 5, 30) {
+  env.render(arithmetic_template, small_data);
+}
 
 int main() {
   hayai::ConsoleOutputter consoleOutputter;
@@ -0,0 +1,88 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "compiled_templates.hpp"
+#include "compiled_whitespace_templates.hpp"
+
+#define xstr(s) str(s)
+#define str(s) #s
+
+const std::filesystem::path test_file_directory {std::filesystem::path(xstr(__TEST_DIR__)) / "data"};
+
+TEST_CASE("compiled templates render like parsed ones") {
+  inja::Environment env {test_file_directory.string() + "/"};
+  env.include_template("body", env.parse("Bye {{ name }}."));
+
+  inja::json name_data;
+  name_data["name"] = "Jeff";
+
+  const std::vector<std::pair<std::string, std::string>> files {
+      {"simple.txt", ""},
+      {"include.txt", ""},
+      {"include-both.txt", ""},
+      {"simple-file/template.txt", "simple-file/data.json"},
+      {"nested/template.txt", "nested/data.json"},
+      {"nested-line/template.txt", "nested-line/data.json"},
+      {"nested-whitespace/template.txt", "nested-whitespace/data.json"},
+      {"html/template.txt", "html/data.json"},
+      {"html/header.txt", "html/data.json"},
+      {"html/footer.txt", "html/data.json"},
+      {"html-extend/template.txt", "html-extend/data.json"},
+      {"html-extend/inter.txt", "html-extend/data.json"},
+      {"html-extend/base.txt", "html-extend/data.json"},
+      {"benchmark/medium_template.txt", "benchmark/small_data.json"},
+      {"benchmark/arithmetic_template.txt", "benchmark/small_data.json"},
+      {"benchmark/large_template.txt", "benchmark/large_data.json"},
+  };
+
+  for (const auto& [file, data_file] : files) {
+    SUBCASE(file.c_str()) {
+      const inja::json data = data_file.empty() ? name_data : env.load_json(data_file);
+      CHECK(compiled_templates::render(env, file, data) == env.render_file(file, data));
+    }
+  }
+
+  SUBCASE("whitespace control") {
+    inja::Environment whitespace_env {test_file_directory.string() + "/"};
+    whitespace_env.set_trim_blocks(true);
+    whitespace_env.set_lstrip_blocks(true);
+
+    const inja::json data = env.load_json("nested-whitespace/data.json");
+    CHECK(compiled_whitespace_templates::render(whitespace_env, "nested-whitespace/template.txt", data) ==
+          env.load_file("nested-whitespace/result.txt"));
+  }
+
+  SUBCASE("graceful errors fall back to the interpreter") {
+    inja::Environment graceful_env;
+    graceful_env.set_graceful_errors(true);
+    CHECK(compiled_templates::render_simple_txt(graceful_env, inja::json::object()) ==
+          graceful_env.render("Hello {{ name }}.", inja::json::object()));
+  }
+
+  SUBCASE("generated functions") {
+    CHECK(compiled_templates::render_simple_txt(name_data) == "Hello Jeff.");
+    CHECK(compiled_templates::template_include_txt().content == env.load_file("include.txt"));
+
+    // Includes and extends are linked, so the templates also render without the others in the environment
+    inja::Environment other_env;
+    CHECK(compiled_templates::render_include_txt(other_env, name_data) == "Answer: Hello Jeff.");
+    CHECK(compiled_templates::render_html_extend_template_txt(other_env, env.load_json("html-extend/data.json")) ==
+          env.load_file("html-extend/result.txt"));
+  }
+
+  SUBCASE("callbacks are resolved at render time") {
+    inja::Environment callback_env;
+    callback_env.add_callback("name", 0, [](inja::Arguments&) { return "Callback"; });
+    CHECK(compiled_templates::render_simple_txt(callback_env, inja::json::object()) == "Hello Callback.");
+  }
+
+  CHECK_THROWS_WITH(compiled_templates::render("missing.txt", name_data), "[inja.exception.file_error] template 'missing.txt' was not compiled");
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include <string>
+#include <type_traits>
+
+#include <doctest/doctest.h>
+
+#include "inja/environment.hpp"
+
+// INJA_DATA_TYPE is defined for the whole test target
+static_assert(std::is_same_v<inja::json, nlohmann::ordered_json>);
+
+TEST_CASE("ordered json backend") {
+  inja::Environment env;
+  inja::json data;
+  data["name"] = "Peter";
+  data["relatives"]["sister"] = "Jenny";
+  data["relatives"]["mother"] = "Maria";
+  data["relatives"]["brother"] = "Chris";
+  data["items"] = {{{"name", "b"}, {"tags", {"x", "y"}}}, {{"name", "a"}, {"tags", {"z"}}}};
+
+  SUBCASE("objects keep their insertion order") {
+    CHECK(env.render("{% for type, name in relatives %}{{ type }}={{ name }};{% endfor %}", data) == "sister=Jenny;mother=Maria;brother=Chris;");
+    CHECK(env.render("{{ relatives }}", data) == R"({"sister":"Jenny","mother":"Maria","brother":"Chris"})");
+  }
+
+  SUBCASE("loops and set statements") {
+    CHECK(env.render("{% for item in items %}{% for tag in item.tags %}{{ loop.parent.index }}{{ loop.index }}{{ item.name }}{{ tag }} {% endfor %}{% endfor %}",
+                     data) == "00bx 01by 10az ");
+    CHECK(env.render("{% set names = [] %}{% for item in items %}{% set names = append(names, item.name) %}{% set last = item.name %}{% endfor %}"
+                     "{{ names }} {{ last }} {{ loop.index }}",
+                     data) == R"(["b","a"] a 1)");
+  }
+
+  SUBCASE("includes, callbacks and layers") {
+    env.add_callback("double", 1, [](inja::Arguments& args) { return args.at(0)->get<int>() * 2; });
+    env.include_template("item", env.parse("{{ item.name }}{{ double(loop.index1) }}"));
+    CHECK(env.render("{% for item in items %}{% include \"item\" %};{% endfor %}", data) == "b2;a4;");
+
+    const inja::json call {{"name", "Jeff"}};
+    CHECK(env.render(env.parse("{{ name }} {{ relatives.sister }}"), {&call, &data}) == "Jeff Jenny");
+  }
+}
@@ -0,0 +1,7 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#include "inja/static_template.hpp"
+
+int main() {
+  return static_cast<int>(inja::static_template<"{% if is_happy %}{{ unknown(name) }}{% endif %}">::render(inja::json()).size());
+}
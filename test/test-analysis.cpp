@@ -0,0 +1,199 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#include <filesystem>
+#include <fstream>
+
+#include "inja/environment.hpp"
+
+#include "test-common.hpp"
+
+TEST_CASE("dependency analysis") {
+  inja::Environment env;
+  env.add_callback("greet", 1, [](inja::Arguments& args) { return "Hi " + args.at(0)->get<std::string>(); });
+  env.add_callback("now", 0, [](inja::Arguments&) { return 42; });
+
+  SUBCASE("input paths") {
+    const auto analysis = env.analyze(env.parse("{{ name }} {{ brother.name }} {% if is_happy %}{{ upper(city) }}{% endif %}"));
+    CHECK(analysis.input_paths == std::set<std::string> {"/name", "/brother/name", "/is_happy", "/city"});
+    CHECK(analysis.set_locals.empty());
+    CHECK(analysis.loop_locals.empty());
+  }
+
+  SUBCASE("set and loop locals") {
+    const auto analysis = env.analyze(env.parse("{% set total = length(items) %}{{ total }}"
+                                                "{% for item in items %}{{ loop.index }}: {{ item.name }} {{ item.tags.0 }}{% endfor %}"
+                                                "{% for key, value in settings %}{{ key }}={{ value.enabled }}{% endfor %}"));
+    CHECK(analysis.input_paths == std::set<std::string> {"/items", "/items/*/name", "/items/*/tags/0", "/settings/*/enabled"});
+    CHECK(analysis.iterated_paths == std::set<std::string> {"/items", "/settings"});
+    CHECK(analysis.set_locals == std::set<std::string> {"total"});
+    CHECK(analysis.loop_locals == std::set<std::string> {"item", "key", "value"});
+  }
+
+  SUBCASE("conditionally assigned variables stay input reads") {
+    const auto analysis = env.analyze(env.parse("{% if flag %}{% set title = \"x\" %}{{ title }}{% endif %}{{ title }}"));
+    CHECK(analysis.input_paths == std::set<std::string> {"/flag", "/title"});
+  }
+
+  SUBCASE("element access") {
+    const auto analysis = env.analyze(env.parse("{{ at(users, \"bob\").age }} {{ at(list, index) }} {{ exists(\"a.b\") }} {{ existsIn(obj, \"key\") }}"));
+    CHECK(analysis.input_paths == std::set<std::string> {"/users/bob/age", "/list/*", "/index", "/a/b", "/obj/key"});
+    CHECK_FALSE(analysis.has_dynamic_lookups);
+
+    CHECK(env.analyze(env.parse("{{ exists(name) }}")).has_dynamic_lookups);
+  }
+
+  SUBCASE("callbacks") {
+    const auto analysis = env.analyze(env.parse("{{ greet(name) }}{% set x = greet(\"Bob\") %}{{ now }}"));
+    REQUIRE(analysis.callbacks.size() == 2);
+    CHECK(analysis.callbacks.at("greet") == std::set<int> {1});
+    CHECK(analysis.callbacks.at("now") == std::set<int> {0});
+    CHECK(analysis.input_paths == std::set<std::string> {"/name", "/now"});
+  }
+
+  SUBCASE("includes") {
+    env.include_template("cell", env.parse("{{ loop.index }}{{ footer }}"));
+    env.include_template("row", env.parse("{{ row.name }}{% include \"cell\" %}"));
+
+    const auto analysis = env.analyze(env.parse("{% for row in rows %}{% include \"row\" %}{% endfor %}"), "main");
+    CHECK(analysis.input_paths == std::set<std::string> {"/rows/*/name", "/footer"});
+    CHECK(analysis.includes.at("main") == std::set<std::string> {"row"});
+    CHECK(analysis.includes.at("row") == std::set<std::string> {"cell"});
+    CHECK(analysis.included_templates() == std::set<std::string> {"row", "cell"});
+    CHECK(analysis.missing_templates.empty());
+  }
+
+  SUBCASE("extends") {
+    env.include_template("base", env.parse("<title>{% block title %}{{ site }}{% endblock %}</title>"));
+
+    const auto analysis = env.analyze(env.parse("{% extends \"base\" %}{% block title %}{{ page.title }}{% endblock %}"), "page");
+    CHECK(analysis.input_paths == std::set<std::string> {"/site", "/page/title"});
+    CHECK(analysis.includes.at("page") == std::set<std::string> {"base"});
+  }
+
+  SUBCASE("count variables in set statements") {
+    CHECK(env.parse("{% set x = a + b %}{{ x }}").count_variables() == 3);
+  }
+}
+
+TEST_CASE("data projection") {
+  inja::Environment env;
+
+  inja::json data;
+  data["name"] = "Peter";
+  data["secret"] = "hidden";
+  data["brother"] = {{"name", "Chris"}, {"age", 32}, {"daughters", {"Maria", "Helen"}}};
+  data["items"] = inja::json::array({{{"name", "a"}, {"price", 1}}, {{"name", "b"}, {"price", 2}}});
+  data["lookup"] = {{"x", 1}, {"y", 2}};
+  data["keys"] = {"x"};
+
+  SUBCASE("required paths") {
+    const auto tree = env.required_paths(env.parse("{{ name }}{{ brother.daughters.1 }}{% for item in items %}{{ item.name }}{% endfor %}"));
+    CHECK(tree.paths() == std::vector<std::string> {"/brother/daughters/1", "/items", "/items/*/name", "/name"});
+    CHECK(tree.needs({"brother"}));
+    CHECK(tree.needs({"items", "5", "name"}));
+    CHECK_FALSE(tree.needs({"items", "5", "price"}));
+    CHECK_FALSE(tree.needs({"secret"}));
+  }
+
+  SUBCASE("projection renders the same") {
+    const std::vector<std::string> templates {
+        "{{ name }} {{ brother.daughters.1 }}",
+        "{% for item in items %}{{ loop.index }}{{ item.name }}{% endfor %}",
+        "{% for item in items %}-{% endfor %}{{ length(items) }}",
+        "{% for key in keys %}{{ at(lookup, key) }}{% endfor %}",
+        "{% for key, value in lookup %}{{ key }}{% endfor %}",
+        "{% set b = brother %}{{ b.age }}",
+    };
+
+    for (const auto& input : templates) {
+      const auto tmpl = env.parse(input);
+      const auto projected = inja::project(data, env.required_paths(tmpl));
+      CHECK(env.render(tmpl, projected) == env.render(tmpl, data));
+      CHECK_FALSE(projected.contains("secret"));
+    }
+  }
+
+  SUBCASE("projection drops unread values") {
+    const auto tmpl = env.parse("{% for item in items %}{{ item.name }}{% endfor %}{{ brother.daughters.1 }}");
+    const auto projected = inja::project(data, env.required_paths(tmpl));
+    CHECK(projected == inja::json::parse(R"({"brother":{"daughters":[null,"Helen"]},"items":[{"name":"a"},{"name":"b"}]})"));
+  }
+
+  SUBCASE("dynamic lookups keep everything") {
+    const auto tmpl = env.parse("{{ exists(name) }}");
+    CHECK(inja::project(data, env.required_paths(tmpl)) == data);
+  }
+}
+
+TEST_CASE("cost estimation") {
+  inja::Environment env;
+  env.add_callback("fetch", 1, [](inja::Arguments& args) { return *args.at(0); });
+
+  inja::json data;
+  data["rows"] = inja::json::array({{{"cells", {1, 2, 3}}}, {{"cells", {1, 2, 3, 4, 5}}}});
+
+  SUBCASE("loops") {
+    const auto tmpl = env.parse("{% for row in rows %}{% for cell in row.cells %}{{ cell }}{% endfor %}{% endfor %}");
+
+    const auto report = env.estimate_cost(tmpl, data);
+    CHECK(report.max_loop_depth == 2);
+    REQUIRE(report.loops.size() == 2);
+    CHECK(report.loops[0].iterated_path == "/rows");
+    CHECK(report.loops[0].assumed_size == 2);
+    CHECK(report.loops[0].location.line == 1);
+    CHECK(report.loops[1].depth == 2);
+    CHECK(report.loops[1].iterated_path == "/rows/*/cells");
+    CHECK(report.loops[1].assumed_size == 5);
+
+    CHECK(env.estimate_cost(tmpl, 100).estimated_cost > env.estimate_cost(tmpl, 10).estimated_cost);
+  }
+
+  SUBCASE("callbacks, copies and concatenations") {
+    const auto report = env.estimate_cost(env.parse("{{ fetch(1) }}{% for row in rows %}{% set label = \"row \" + row.name %}{{ fetch(label) }}{% endfor %}"));
+    CHECK(report.callbacks_per_depth == std::vector<size_t> {1, 1});
+    CHECK(report.set_copies_in_loops == 1);
+    CHECK(report.string_concatenations_in_loops == 1);
+  }
+
+  SUBCASE("include fan-out") {
+    env.include_template("cell", env.parse("{{ cell }}"));
+    env.include_template("row", env.parse("{% include \"cell\" %}{% include \"cell\" %}"));
+
+    const auto report = env.estimate_cost(env.parse("{% include \"row\" %}{% include \"row\" %}"));
+    CHECK(report.include_fan_out == 6);
+    CHECK(report.included_templates == 2);
+  }
+
+  SUBCASE("limits at parse time") {
+    env.set_cost_limits({2, 0.0, 10});
+    CHECK_NOTHROW(env.parse("{% for row in rows %}{% for cell in row.cells %}{{ cell }}{% endfor %}{% endfor %}"));
+    CHECK_THROWS_WITH(env.parse("{% for a in x %}{% for b in a %}\n  {% for c in b %}{{ c }}{% endfor %}{% endfor %}{% endfor %}"),
+                      "[inja.exception.parser_error] (at 2:12) loop nesting depth 3 exceeds the limit of 2");
+
+    env.set_cost_limits({0, 500.0, 10});
+    CHECK_NOTHROW(env.parse("{% for row in rows %}{{ row }}{% endfor %}"));
+    CHECK_THROWS_WITH(env.parse("{% for a in x %}{% for b in a %}{% for c in b %}{{ c }}{% endfor %}{% endfor %}{% endfor %}"),
+                      "[inja.exception.parser_error] (at 1:1) estimated render cost 2222 exceeds the limit of 500");
+
+    const auto cell = env.parse("{{ c }}");
+    env.set_search_included_templates_in_files(false);
+    env.set_include_callback([&cell](const std::filesystem::path&, const std::string&) { return cell; });
+    CHECK_THROWS(env.parse("{% for a in x %}{% for b in a %}{% for c in b %}{% include \"cell\" %}{% endfor %}{% endfor %}{% endfor %}"));
+    CHECK(env.get_template_storage_snapshot()->count("cell") == 0);
+  }
+
+  SUBCASE("limits include templates discovered by the parse") {
+    const auto directory = test_temp_directory / "inja-test-cost-limits";
+    std::filesystem::create_directories(directory);
+    std::ofstream(directory / "heavy.txt") << "{% for a in x %}{% for b in a %}{% for c in b %}{{ c }}{% endfor %}{% endfor %}{% endfor %}";
+
+    inja::Environment file_env {directory / ""};
+    file_env.set_cost_limits({2, 0.0, 10});
+    for (int i = 0; i < 2; ++i) {
+      CHECK_THROWS_WITH(file_env.parse("{% include \"heavy.txt\" %}"), "[inja.exception.parser_error] (at 1:42) loop nesting depth 3 exceeds the limit of 2");
+    }
+    CHECK(file_env.get_template_storage_snapshot()->empty());
+
+    std::filesystem::remove_all(directory);
+  }
+}
@@ -5,5 +5,6 @@
 #include <doctest/doctest.h>
 
 extern const std::filesystem::path test_file_directory;
+extern const std::filesystem::path test_temp_directory; // Unique for each test process, removed at exit
 
 #endif // INCLUDE_TEST_COMMON_HPP_
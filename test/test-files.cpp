@@ -1,5 +1,16 @@
 // Copyright (c) 2020 Pantor. All rights reserved.
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "inja/environment.hpp"
 
 #include "test-common.hpp"
@@ -106,3 +117,299 @@ TEST_CASE("include-in-memory-and-file-template") {
 
   CHECK(env.render_file("include-both.txt", data) == "Hello Jeff. - Bye Jeff.");
 }
+
+TEST_CASE("bundle") {
+  inja::json data;
+  data["name"] = "Jeff";
+
+  const auto bundle_file = test_temp_directory / "inja-test-bundle.bin";
+
+  SUBCASE("Bundled files should be rendered") {
+    inja::Environment env {test_file_directory};
+    env.write_bundle(bundle_file, {"html/template.txt", "include.txt"});
+
+    inja::Environment bundled_env {test_file_directory};
+    CHECK(bundled_env.load_bundle(bundle_file));
+    CHECK(bundled_env.render_file_with_json_file("html/template.txt", "html/data.json") == env.load_file("html/result.txt"));
+    CHECK(bundled_env.render_file("include.txt", data) == "Answer: Hello Jeff.");
+  }
+
+  SUBCASE("Bundled templates should render like parsed ones") {
+    const std::string source = R"({% extends "base" %}{% block content %}{% set x = 2 * 3 %}{% for i in [1, 2, 3] %}{% if i > 1 and not loop.is_last %})"
+                               R"({{ upper(name) }}{% else %}{{ i + x }}{% endif %}{% endfor %}{% for k, v in {"a": 1} %}{{ k }}={{ v }}{% endfor %})"
+                               R"({% raw %}{{ raw }}{% endraw %}{{ double(x) }}{# comment #}{% endblock %})";
+
+    inja::Environment env;
+    env.add_callback("double", 1, [](inja::Arguments& args) { return args.at(0)->get<int>() * 2; });
+    env.include_template("base", env.parse("<{% block content %}{% endblock %}>"));
+    env.include_template("child", env.parse(source));
+    env.write_bundle(bundle_file, {});
+
+    inja::Environment bundled_env;
+    CHECK(bundled_env.load_bundle(bundle_file));
+    bundled_env.add_callback("double", 1, [](inja::Arguments& args) { return args.at(0)->get<int>() * 2; });
+    CHECK(bundled_env.render("{% include \"child\" %}", data) == env.render(source, data));
+  }
+
+  SUBCASE("Changed files should be parsed again") {
+    const auto template_file = test_temp_directory / "inja-test-bundle-template.txt";
+    std::ofstream(template_file) << "Hello {{ name }}.";
+
+    inja::Environment env;
+    env.write_bundle(bundle_file, {template_file.string()});
+    const auto modification_time = std::filesystem::last_write_time(template_file);
+
+    // An unchanged modification time keeps the bundled template
+    std::ofstream(template_file) << "Bye {{ name }}.";
+    std::filesystem::last_write_time(template_file, modification_time);
+    inja::Environment bundled_env;
+    CHECK(bundled_env.load_bundle(bundle_file));
+    CHECK(bundled_env.render_file(template_file.string(), data) == "Hello Jeff.");
+
+    std::filesystem::last_write_time(template_file, modification_time + std::chrono::seconds(10));
+    CHECK(bundled_env.render_file(template_file.string(), data) == "Bye Jeff.");
+
+    inja::Environment reloaded_env;
+    CHECK(reloaded_env.load_bundle(bundle_file));
+    CHECK(reloaded_env.render_file(template_file.string(), data) == "Bye Jeff.");
+
+    std::filesystem::remove(template_file);
+  }
+
+  SUBCASE("Bundles with other settings should not be loaded") {
+    inja::Environment env {test_file_directory};
+    env.write_bundle(bundle_file, {"simple.txt"});
+
+    inja::Environment other_env {test_file_directory};
+    other_env.set_expression("<%", "%>");
+    CHECK_FALSE(other_env.load_bundle(bundle_file));
+    CHECK_FALSE(other_env.load_bundle(bundle_file.string() + ".missing"));
+  }
+
+  SUBCASE("Incomplete bundles should not be loaded") {
+    const auto write = [&bundle_file](const inja::json& templates) {
+      const inja::json bundle {{"format", "inja-bundle"},
+                               {"version", inja::TemplateBundle::version},
+                               {"config", inja::parse_config_hash(inja::LexerConfig {}, inja::ParserConfig {})},
+                               {"templates", templates}};
+      const auto bytes = inja::json::to_cbor(bundle);
+      std::ofstream(bundle_file, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    };
+
+    inja::Environment env;
+    write(inja::json::array({{{"name", "a"}, {"path", ""}, {"mtime", 0}, {"hash", 0}, {"source", "abc"}}}));
+    CHECK_FALSE(env.load_bundle(bundle_file));
+    write(inja::json::array({{{"name", "a"}, {"path", ""}, {"mtime", 0}, {"hash", 0}, {"source", "abc"}, {"root", inja::json::array({inja::json::array({0})})}}}));
+    CHECK_FALSE(env.load_bundle(bundle_file));
+    write(nullptr);
+    CHECK_FALSE(env.load_bundle(bundle_file));
+    CHECK(env.get_template_storage_snapshot()->empty());
+
+    write(inja::json::array({{{"name", "a"}, {"path", ""}, {"mtime", 0}, {"hash", 0}, {"source", "abc"}, {"root", inja::json::array({inja::json::array({0, 1, 5})})}}}));
+    CHECK_THROWS_WITH(env.load_bundle(bundle_file), "[inja.exception.file_error] invalid node in template bundle");
+  }
+
+  std::filesystem::remove(bundle_file);
+}
+
+TEST_CASE("preload-directory") {
+  inja::Environment env {test_file_directory};
+
+  SUBCASE("Globs should match paths") {
+    CHECK(inja::glob_match("*.txt", "template.txt"));
+    CHECK_FALSE(inja::glob_match("*.txt", "html/template.txt"));
+    CHECK(inja::glob_match("**/*.txt", "template.txt"));
+    CHECK(inja::glob_match("**/*.txt", "html/template.txt"));
+    CHECK(inja::glob_match("html/????er.txt", "html/header.txt"));
+    CHECK_FALSE(inja::glob_match("*.txt", "data.json"));
+  }
+
+  SUBCASE("All matching templates should be parsed") {
+    const auto report = env.preload_directory("html", "*.txt", 4);
+    CHECK(report.files.size() == 4);
+    CHECK(report.critical_path_time <= report.total_time);
+
+    // The critical path follows includes, and takes at least as long as the template with its header
+    std::map<std::string, inja::PreloadReport::File> files;
+    for (const auto& file : report.files) {
+      files.emplace(file.name, file);
+    }
+    for (size_t i = 1; i < report.critical_path.size(); ++i) {
+      const auto& dependencies = files.at(report.critical_path[i - 1]).dependencies;
+      CHECK(std::find(dependencies.begin(), dependencies.end(), report.critical_path[i]) != dependencies.end());
+    }
+    const auto& tmpl = files.at((test_file_directory / "html" / "template.txt").string());
+    CHECK(tmpl.dependencies.size() == 2);
+    CHECK(report.critical_path_time >= tmpl.parse_time + files.at((test_file_directory / "html" / "header.txt").string()).parse_time);
+
+    CHECK(env.find_template((test_file_directory / "html" / "header.txt").string()) != nullptr);
+    CHECK(env.render_file_with_json_file("html/template.txt", "html/data.json") == env.load_file("html/result.txt"));
+  }
+
+  SUBCASE("Shared includes should be parsed once") {
+    const auto report = env.preload_directory("", "html*/*.txt");
+    const auto header = (test_file_directory / "html" / "header.txt").string();
+    CHECK(std::count_if(report.files.begin(), report.files.end(), [&header](const auto& file) { return file.name == header; }) == 1);
+    CHECK(env.render_file_with_json_file("html-extend/template.txt", "html-extend/data.json") == env.load_file("html-extend/result.txt"));
+  }
+
+  SUBCASE("Thread pool should run all tasks") {
+    inja::ThreadPool pool(3);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; ++i) {
+      results.push_back(pool.submit([i]() { return i * i; }));
+    }
+    int sum = 0;
+    for (auto& result : results) {
+      sum += result.get();
+    }
+    CHECK(sum == 328350);
+  }
+}
+
+TEST_CASE("watch-templates") {
+  const auto directory = test_temp_directory / "inja-test-watch";
+  std::filesystem::create_directories(directory);
+  std::ofstream(directory / "page.txt") << "Page: {% include \"header.txt\" %}";
+  std::ofstream(directory / "header.txt") << "Hello {{ name }}.";
+
+  inja::json data;
+  data["name"] = "Jeff";
+
+  const auto header = (directory / "header.txt").string();
+  const auto page = (directory / "page.txt").string();
+
+  SUBCASE("Reloading should publish changed templates with their dependents") {
+    inja::Environment env {directory / ""};
+    env.preload_directory("", "*.txt");
+    const auto page_template = env.parse_template("page.txt");
+    CHECK(env.render(page_template, data) == "Page: Hello Jeff.");
+
+    std::ofstream(header) << "Bye {{ name }}.";
+    const auto reloaded = env.reload_templates({header});
+    CHECK(reloaded.size() == 2);
+    CHECK(reloaded.front() == header);
+    CHECK(reloaded.back() == page);
+    CHECK(env.render(page_template, data) == "Page: Bye Jeff.");
+  }
+
+  for (const bool use_notifications : {true, false}) {
+    SUBCASE(use_notifications ? "Changed files should be reloaded with notifications" : "Changed files should be reloaded by polling") {
+      inja::Environment env {directory / ""};
+      env.preload_directory("", "*.txt");
+
+      std::mutex mutex;
+      std::vector<std::string> reloaded;
+      env.watch_templates(
+          std::chrono::milliseconds(10),
+          [&mutex, &reloaded](const std::vector<std::string>& names) {
+            std::lock_guard<std::mutex> lock(mutex);
+            reloaded.insert(reloaded.end(), names.begin(), names.end());
+          },
+          use_notifications);
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+      std::ofstream(header) << "Bye {{ name }}.";
+      std::filesystem::last_write_time(header, std::filesystem::last_write_time(header) + std::chrono::seconds(1));
+      for (int i = 0; i < 200 && env.render_file("page.txt", data) != "Page: Bye Jeff."; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      env.stop_watching();
+
+      CHECK(env.render_file("page.txt", data) == "Page: Bye Jeff.");
+      std::lock_guard<std::mutex> lock(mutex);
+      CHECK(std::find(reloaded.begin(), reloaded.end(), page) != reloaded.end());
+    }
+  }
+
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("include-cache") {
+  inja::json data;
+  data["name"] = "Jeff";
+
+  SUBCASE("Include callbacks should be called once per name") {
+    inja::Environment env {test_file_directory};
+    int calls = 0;
+    env.set_include_callback([&env, &calls](const std::filesystem::path&, const std::string& name) {
+      calls += 1;
+      return env.parse("Callback " + name);
+    });
+
+    CHECK(env.render("{% include \"callback-only\" %}", data) == "Callback callback-only");
+    CHECK(env.render("{% include \"callback-only\" %} {% include \"simple.txt\" %}", data) == "Callback callback-only Hello Jeff.");
+    CHECK(calls == 1);
+    CHECK(env.include_cache_size() == 2);
+
+    env.clear_include_cache();
+    CHECK(env.include_cache_size() == 0);
+  }
+
+  SUBCASE("Templates added under the resolved name should be found") {
+    inja::Environment env {test_file_directory};
+    const std::string error_message = "[inja.exception.file_error] failed accessing file at '" + (test_file_directory / "missing.txt").string() + "'";
+    CHECK_THROWS_WITH(env.render("{% include \"missing.txt\" %}", data), error_message.c_str());
+
+    env.include_template((test_file_directory / "missing.txt").string(), env.parse("Added {{ name }}."));
+    CHECK(env.render("{% include \"missing.txt\" %}", data) == "Added Jeff.");
+  }
+
+  SUBCASE("Missing files should be found once they exist") {
+    const auto directory = test_temp_directory / "inja-test-include-cache";
+    std::filesystem::create_directories(directory);
+    std::filesystem::remove(directory / "later.txt");
+
+    inja::Environment env {directory / ""};
+    env.set_include_cache_revalidate_interval(std::chrono::milliseconds(0));
+    const std::string error_message = "[inja.exception.file_error] failed accessing file at '" + (directory / "later.txt").string() + "'";
+    CHECK_THROWS_WITH(env.render("{% include \"later.txt\" %}", data), error_message.c_str());
+    CHECK_THROWS_WITH(env.render("{% include \"later.txt\" %}", data), error_message.c_str());
+    CHECK(env.include_cache_size() == 1);
+
+    std::ofstream(directory / "later.txt") << "Later {{ name }}.";
+    std::filesystem::last_write_time(directory, std::filesystem::last_write_time(directory) + std::chrono::seconds(1));
+    CHECK(env.render("{% include \"later.txt\" %}", data) == "Later Jeff.");
+
+    std::filesystem::remove_all(directory);
+  }
+}
+
+TEST_CASE("data-files") {
+  inja::Environment env {test_file_directory};
+  const inja::json expected = env.load_json("html/data.json");
+  const auto directory = test_temp_directory;
+
+  const auto write_bytes = [](const std::filesystem::path& filename, const std::vector<std::uint8_t>& bytes) {
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  };
+
+  SUBCASE("Formats should be detected by their first bytes") {
+    CHECK(inja::detect_data_format("{\"a\": 1}") == inja::DataFormat::Json);
+    for (const auto& [format, bytes] : std::vector<std::pair<inja::DataFormat, std::vector<std::uint8_t>>> {
+             {inja::DataFormat::Cbor, inja::json::to_cbor(expected)},
+             {inja::DataFormat::MessagePack, inja::json::to_msgpack(expected)},
+             {inja::DataFormat::Bson, inja::json::to_bson(expected)},
+             {inja::DataFormat::Cbor, inja::json::to_cbor(inja::json::array({1, 2}))},
+         }) {
+      const std::string_view data(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+      CHECK(inja::detect_data_format(data) == format);
+      CHECK(inja::parse_data(data) == inja::parse_data(data, format));
+    }
+  }
+
+  SUBCASE("Binary data files should be rendered") {
+    write_bytes(directory / "inja-test-data.bin", inja::json::to_msgpack(expected));
+    write_bytes(directory / "inja-test-data.cbor", inja::json::to_cbor(expected));
+
+    inja::Environment temp_env {directory};
+    CHECK(temp_env.load_data("inja-test-data.bin") == expected);
+    CHECK(temp_env.load_data("inja-test-data.cbor") == expected);
+    CHECK(env.render_file_with_data_file("html/template.txt", (directory / "inja-test-data.bin").string()) == env.load_file("html/result.txt"));
+    CHECK(env.render_file_with_data_file("html/template.txt", "html/data.json") == env.load_file("html/result.txt"));
+
+    std::filesystem::remove(directory / "inja-test-data.bin");
+    std::filesystem::remove(directory / "inja-test-data.cbor");
+  }
+}
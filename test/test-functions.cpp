@@ -42,6 +42,12 @@ TEST_CASE("functions") {
     CHECK(env.render("{{ 5^3 }}", data) == "125");
     CHECK(env.render("{{ 5 + 12 + 4 * (4 - (1 + 1))^2 - 75 * 1 }}", data) == "-42");
 
+    // The operand types of one node change between loop iterations
+    data["mixed"] = inja::json::parse(R"([1, 2.5, "a", 3, 18446744073709551615, -2, "b"])");
+    CHECK(env.render("{% for x in mixed %}{{ x == 2.5 }},{{ x < 3 }},{{ x + x }};{% endfor %}", data) ==
+          "false,true,2;true,true,5.0;false,false,aa;false,false,6;false,false,-2;false,true,-4;false,false,bb;");
+    CHECK(env.render("{% for x in mixed %}{% if x > \"a\" %}{{ x }}{% endif %}{% endfor %}", data) == "b");
+
     CHECK_THROWS_WITH(env.render("{{ +1 }}", data), "[inja.exception.parser_error] (at 1:7) too few arguments");
     CHECK_THROWS_WITH(env.render("{{ 1 + }}", data), "[inja.exception.parser_error] (at 1:8) too few arguments");
   }
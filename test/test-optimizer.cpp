@@ -0,0 +1,287 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#include <chrono>
+#include <thread>
+
+#include "inja/environment.hpp"
+
+#include "test-common.hpp"
+
+TEST_CASE("loop-invariant hoisting") {
+  inja::Environment env;
+
+  int calls = 0;
+  env.add_callback("decorate", 1, [&calls](inja::Arguments& args) {
+    calls += 1;
+    return "*" + args.at(0)->get<std::string>() + "*";
+  });
+
+  inja::json data;
+  data["player"] = {{"name", "Peter"}};
+  data["config"] = {{"verbose", true}, {"level", 3}};
+  data["items"] = {"a", "b", "c", "d"};
+  data["groups"] = {{"x", "y"}, {"z"}};
+
+  SUBCASE("invariant expressions") {
+    auto tmpl = env.parse("{% for item in items %}{{ upper(player.name) }}{% if config.level > 2 %}{{ item }}{% endif %}{{ loop.index + 1 }}{% endfor %}");
+    const auto expected = env.render(tmpl, data);
+
+    const auto stats = env.optimize(tmpl);
+    CHECK(stats.hoisted_expressions == 2);
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK(env.render(tmpl, data) == "PETERa1PETERb2PETERc3PETERd4");
+  }
+
+  SUBCASE("callbacks need to be deterministic") {
+    auto tmpl = env.parse("{% for item in items %}{{ decorate(player.name) }}{% endfor %}");
+    CHECK(env.optimize(tmpl).hoisted_expressions == 0);
+    env.render(tmpl, data);
+    CHECK(calls == 4);
+
+    env.set_callback_deterministic("decorate", 1);
+    CHECK(env.optimize(tmpl).hoisted_expressions == 1);
+    calls = 0;
+    CHECK(env.render(tmpl, data) == "*Peter**Peter**Peter**Peter*");
+    CHECK(calls == 1);
+  }
+
+  SUBCASE("nested loops") {
+    env.set_callback_deterministic("decorate", 1);
+    auto tmpl = env.parse("{% for group in groups %}{% for item in group %}{{ decorate(first(group)) }}{{ item }}{% endfor %};{% endfor %}");
+    const auto expected = env.render(tmpl, data);
+
+    CHECK(env.optimize(tmpl).hoisted_expressions == 1);
+    CHECK(expected == "*x*x*x*y;*z*z;");
+    calls = 0;
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK(calls == 2); // Once per outer iteration
+  }
+
+  SUBCASE("assignments invalidate cached values") {
+    auto tmpl = env.parse("{% set total = 0 %}{% for item in items %}{{ total + 1 }}{% set total = total + 1 %}{% endfor %}"
+                          "{% for item in items %}{% if loop.is_first %}{% set name = upper(player.name) %}{% endif %}{{ length(player.name) }}{% endfor %}");
+    const auto expected = env.render(tmpl, data);
+
+    CHECK(env.optimize(tmpl).hoisted_expressions == 2);
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK(env.render(tmpl, data) == "12345555");
+  }
+
+  SUBCASE("errors are not cached") {
+    env.set_graceful_errors(true);
+    auto tmpl = env.parse("{% for item in items %}{{ upper(missing) }}{% endfor %}");
+    const auto expected = env.render(tmpl, data);
+    const auto expected_errors = env.get_last_render_errors().size();
+
+    env.optimize(tmpl);
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK(env.get_last_render_errors().size() == expected_errors);
+  }
+}
+
+TEST_CASE("common subexpression elimination") {
+  inja::Environment env;
+
+  int calls = 0;
+  env.add_callback("title", 1, [&calls](inja::Arguments& args) {
+    calls += 1;
+    return "Sir " + args.at(0)->get<std::string>();
+  });
+  env.set_callback_deterministic("title", 1);
+
+  inja::json data;
+  data["actor"] = {{"name", "Peter"}, {"inventory", {"sword", "shield"}}};
+
+  SUBCASE("identical expressions") {
+    auto tmpl = env.parse("{% if length(actor.inventory) > 0 %}{{ title(actor.name) }} has {{ length(actor.inventory) }} items{% endif %}"
+                          "{% if length(actor.inventory) > 0 %}, {{ title(actor.name) }}{% endif %}");
+    const auto expected = env.render(tmpl, data);
+
+    const auto stats = env.optimize(tmpl);
+    CHECK(stats.eliminated_evaluations == 2);
+    CHECK(expected == "Sir Peter has 2 items, Sir Peter");
+    calls = 0;
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK(calls == 1);
+  }
+
+  SUBCASE("assignments invalidate shared values") {
+    auto tmpl = env.parse("{{ title(actor.name) }}{% set actor.name = \"Paul\" %} {{ title(actor.name) }}");
+    CHECK(env.optimize(tmpl).eliminated_evaluations == 1);
+    calls = 0;
+    CHECK(env.render(tmpl, data) == "Sir Peter Sir Paul");
+    CHECK(calls == 2);
+  }
+
+  SUBCASE("memo hits are instrumented") {
+    auto tmpl = env.parse("{{ upper(actor.name) }}{{ upper(actor.name) }}{{ upper(actor.name) }}");
+    CHECK(env.optimize(tmpl).eliminated_evaluations == 2);
+
+    size_t hits = 0;
+    env.set_instrumentation_callback([&hits](const inja::InstrumentationData& event) {
+      if (event.event == inja::InstrumentationEvent::MemoHit) {
+        hits += 1;
+      }
+    });
+    CHECK(env.render(tmpl, data) == "PETERPETERPETER");
+    CHECK(hits == 2);
+  }
+}
+
+TEST_CASE("partial evaluation") {
+  inja::Environment env;
+
+  inja::json static_data;
+  static_data["world"] = {{"name", "Midgard"}, {"regions", {"north", "south"}}, {"hard_mode", false}};
+  static_data["locale"] = "en";
+
+  inja::json dynamic_data;
+  dynamic_data["player"] = {{"name", "Peter"}, {"items", {"sword", "shield"}}};
+
+  inja::json merged = dynamic_data;
+  merged.update(static_data);
+
+  const auto check_specialized = [&](const std::string& input) {
+    const auto tmpl = env.parse(input);
+    const auto specialized = env.specialize(tmpl, static_data);
+    CHECK(env.render(specialized, dynamic_data) == env.render(tmpl, merged));
+    return specialized;
+  };
+
+  SUBCASE("static expressions become text") {
+    const auto specialized = check_specialized("Welcome to {{ upper(world.name) }} ({{ locale }}), {{ player.name }}!");
+    CHECK(specialized.root.nodes.size() == 3);
+    CHECK(specialized.count_variables() == 1);
+  }
+
+  SUBCASE("dead branches are removed") {
+    const auto specialized = check_specialized("{% if world.hard_mode %}Hard {{ player.name }}{% else if locale == \"de\" %}Hallo{% else %}Hi {{ player.name }}{% endif %}");
+    CHECK(specialized.count_variables() == 1);
+    CHECK(specialized.root.nodes.size() == 2);
+  }
+
+  SUBCASE("static loops are unrolled") {
+    const auto specialized = check_specialized("{% for region in world.regions %}{{ loop.index1 }}. {{ region }} {% endfor %}{{ player.name }}");
+    CHECK(specialized.root.nodes.size() == 2);
+  }
+
+  SUBCASE("dynamic parts are kept") {
+    check_specialized("{% for item in player.items %}{{ item }} in {{ world.name }}{% if world.hard_mode %}!{% endif %}{% endfor %}");
+    check_specialized("{% set count = length(world.regions) + length(player.items) %}{{ count }} {{ at(world.regions, 1) }}");
+    check_specialized("{% for region in world.regions %}{{ region }}{{ player.name }}{% endfor %}");
+    check_specialized("{% for region in world.regions %}{{ region }}{% endfor %}{{ region }}");
+    check_specialized("{{ exists(\"world\") }} {{ exists(\"player\") }} {{ world.regions }}");
+    check_specialized("{% set world = player %}{{ world.name }}");
+  }
+
+  SUBCASE("included templates see the static data") {
+    env.include_template("footer", env.parse("{{ world.name }}/{{ player.name }}"));
+    check_specialized("{{ locale }} {% include \"footer\" %}");
+  }
+}
+
+TEST_CASE("tiered compilation") {
+  inja::Environment env;
+  env.set_compile_threshold(3);
+
+  const auto wait_for_compiled = [&env](const inja::Template& tmpl) {
+    for (int i = 0; i < 500 && !env.is_compiled(tmpl); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return env.is_compiled(tmpl);
+  };
+
+  inja::json data;
+  data["name"] = "Peter";
+  data["items"] = {1, 2, 3};
+
+  SUBCASE("hot templates are compiled") {
+    const auto tmpl = env.parse("{{ 2 * 3 }} {{ upper(name) }}{% for item in items %}{{ length(items) + item }}{% endfor %}");
+    const std::string expected = "6 PETER456";
+
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK(env.render(tmpl, data) == expected);
+    CHECK_FALSE(env.is_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == expected);
+
+    REQUIRE(wait_for_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == expected);
+
+    data["name"] = "Chris";
+    CHECK(env.render(tmpl, data) == "6 CHRIS456");
+
+    // Copies share the compiled form
+    const auto copy = tmpl;
+    CHECK(env.is_compiled(copy));
+  }
+
+  SUBCASE("copied environments keep compiling") {
+    inja::Environment copy_env {env};
+    const auto tmpl = copy_env.parse("{{ upper(name) }}");
+
+    for (int i = 0; i < 3; ++i) {
+      CHECK(copy_env.render(tmpl, data) == "PETER");
+    }
+    for (int i = 0; i < 500 && !copy_env.is_compiled(tmpl); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(copy_env.is_compiled(tmpl));
+  }
+
+  SUBCASE("includes are linked and invalidated") {
+    env.include_template("greeting", env.parse("Hello {{ name }}!"));
+    const auto tmpl = env.parse("{% include \"greeting\" %} {{ 1 + 1 }}");
+
+    for (int i = 0; i < 3; ++i) {
+      CHECK(env.render(tmpl, data) == "Hello Peter! 2");
+    }
+    REQUIRE(wait_for_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == "Hello Peter! 2");
+
+    // Changing an included template drops the compiled form
+    env.include_template("greeting", env.parse("Bye {{ name }}!"));
+    CHECK_FALSE(env.is_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == "Bye Peter! 2");
+
+    REQUIRE(wait_for_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == "Bye Peter! 2");
+  }
+
+  SUBCASE("autoescape changes") {
+    data["name"] = "<b>";
+    const auto tmpl = env.parse("{{ \"<i>\" }}{{ name }}");
+    for (int i = 0; i < 3; ++i) {
+      env.render(tmpl, data);
+    }
+    REQUIRE(wait_for_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == "<i><b>");
+
+    env.set_html_autoescape(true);
+    CHECK_FALSE(env.is_compiled(tmpl));
+    CHECK(env.render(tmpl, data) == "&lt;i&gt;&lt;b&gt;");
+  }
+
+  SUBCASE("deterministic callbacks are still called by every render") {
+    int ticks = 0;
+    env.add_callback("tick", 1, [&ticks](inja::Arguments&) { return ++ticks; });
+    env.set_callback_deterministic("tick", 1);
+    const auto tmpl = env.parse("{{ tick(1) }}-{{ tick(1) }}");
+
+    for (int i = 0; i < 3; ++i) {
+      env.render(tmpl, data);
+    }
+    REQUIRE(wait_for_compiled(tmpl));
+    const auto first = env.render(tmpl, data);
+    CHECK(env.render(tmpl, data) != first);
+  }
+
+  SUBCASE("disabled by default") {
+    inja::Environment cold_env;
+    const auto tmpl = cold_env.parse("{{ name }}");
+    for (int i = 0; i < 10; ++i) {
+      cold_env.render(tmpl, data);
+    }
+    CHECK_FALSE(cold_env.is_compiled(tmpl));
+    CHECK(tmpl.tier->render_count == 0);
+  }
+}
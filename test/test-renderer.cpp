@@ -521,3 +521,457 @@ $$ endif
     CHECK(env.render(string_template, data) == "Hello Peter\n    You really are Peter\n");
   }
 }
+
+class CountingDataProvider : public inja::DataProvider {
+  const inja::JsonDataProvider provider;
+
+public:
+  mutable std::vector<std::string> lookups;
+
+  explicit CountingDataProvider(const inja::json& data): provider(data) {}
+
+  std::optional<inja::json> lookup(const Path& path) const override {
+    std::string joined;
+    for (const auto& key : path) {
+      joined += (joined.empty() ? "" : "/") + key;
+    }
+    lookups.push_back(joined);
+    return provider.lookup(path);
+  }
+
+  std::optional<size_t> array_size(const Path& path) const override {
+    return provider.array_size(path);
+  }
+
+  std::optional<std::vector<std::string>> object_keys(const Path& path) const override {
+    return provider.object_keys(path);
+  }
+};
+
+TEST_CASE("data providers") {
+  inja::Environment env;
+  inja::json data;
+  data["name"] = "Peter";
+  data["actors"] = {{{"name", "Ann"}, {"level", 3}}, {{"name", "Bob"}, {"level", 7}}};
+  data["relatives"] = {{"mother", "Maria"}, {"brother", "Chris"}};
+  CountingDataProvider provider(data);
+
+  SUBCASE("lookups") {
+    CHECK(env.render("Hello {{ name }}! {{ name }} and {{ actors.1.name }}", provider) == "Hello Peter! Peter and Bob");
+    CHECK(provider.lookups == std::vector<std::string> {"name", "actors/1/name"});
+
+    CHECK(env.render("{% if exists(\"name\") %}yes{% endif %}{% if exists(\"age\") %}no{% endif %}", provider) == "yes");
+    CHECK_THROWS_WITH(env.render("{{ age }}", provider), "[inja.exception.render_error] (at 1:4) variable 'age' not found");
+  }
+
+  SUBCASE("loops") {
+    CHECK(env.render("{% for actor in actors %}{{ loop.index }}:{{ actor.name }};{% endfor %}", provider) == "0:Ann;1:Bob;");
+    CHECK(provider.lookups == std::vector<std::string> {"actors/0/name", "actors/1/name"});
+
+    provider.lookups.clear();
+    CHECK(env.render("{% for key, value in relatives %}{{ key }}={{ value }};{% endfor %}", provider) == "brother=Chris;mother=Maria;");
+    CHECK(provider.lookups == std::vector<std::string> {"relatives/brother", "relatives/mother"});
+
+    CHECK(env.render("{% for actor in actors %}{% for n in [1, 2] %}{{ actor.level * n }} {% endfor %}{% endfor %}", provider) == "3 6 7 14 ");
+    CHECK(env.render("{{ length(actors) }}{% for actor in actors %}{{ actor.level }}{% endfor %}", provider) == "237");
+  }
+
+  SUBCASE("set and include") {
+    CHECK(env.render("{% for actor in actors %}{% set actor.level = actor.level + 1 %}{{ actor.level }}{% endfor %}", provider) == "48");
+
+    env.include_template("actor", env.parse("{{ actor.name }}@{{ name }};"));
+    CHECK(env.render("{% for actor in actors %}{% include \"actor\" %}{% endfor %}", provider) == "Ann@Peter;Bob@Peter;");
+  }
+}
+
+struct Item {
+  std::string name;
+  int count;
+};
+
+struct Actor {
+  std::string name;
+  int level;
+  std::vector<Item> inventory;
+  std::optional<std::string> title;
+  std::map<std::string, double> stats;
+  const Actor* rival {nullptr};
+};
+
+INJA_REFLECT(Item, name, count)
+INJA_REFLECT(Actor, name, level, inventory, title, stats, rival)
+
+TEST_CASE("reflected structs") {
+  inja::Environment env;
+  const Actor bob {"Bob", 2, {}, std::nullopt, {}, nullptr};
+  const Actor ann {"Ann", 3, {{"sword", 1}, {"apple", 5}}, "Dr", {{"hp", 9.5}}, &bob};
+
+  const int version = 4;
+  inja::ObjectDataProvider provider;
+  provider.bind("actor", ann).bind("version", version);
+
+  CHECK(env.render("{{ actor.title }} {{ actor.name }} ({{ actor.level + version }})", provider) == "Dr Ann (7)");
+  CHECK(env.render("{% for item in actor.inventory %}{{ item.count }}x{{ item.name }};{% endfor %}", provider) == "1xsword;5xapple;");
+  CHECK(env.render("{% for key, value in actor.stats %}{{ key }}={{ value }}{% endfor %} {{ actor.rival.name }}", provider) == "hp=9.5 Bob");
+  CHECK(env.render("{{ actor.inventory.1 }} {{ length(actor.inventory) }}", provider) == R"({"count":5,"name":"apple"} 2)");
+  CHECK(env.render("{% for key, value in actor.rival %}{{ key }},{% endfor %}", provider) == "name,level,inventory,title,stats,rival,");
+  CHECK(env.render("{% if actor.rival.title %}titled{% else %}untitled{% endif %}", provider) == "untitled");
+  CHECK_THROWS_WITH(env.render("{{ actor.age }}", provider), "[inja.exception.render_error] (at 1:4) variable 'actor.age' not found");
+
+  const inja::ObjectDataProvider root(ann);
+  CHECK(env.render("{{ name }}: {{ inventory.0.name }}", root) == "Ann: sword");
+
+  // Temporaries are owned by the provider
+  provider.bind("edition", std::string("first")).bind("tags", std::vector<std::string> {"a", "b"});
+  const inja::ObjectDataProvider owned_root(Actor {"Cid", 1, {}, std::nullopt, {}, nullptr});
+  CHECK(env.render("{{ edition }} {{ join(tags, \",\") }} {{ actor.name }}", provider) == "first a,b Ann");
+  CHECK(env.render("{{ name }} {{ level }}", owned_root) == "Cid 1");
+}
+
+TEST_CASE("data layers") {
+  inja::Environment env;
+  const inja::json globals {{"site", "Inja"}, {"user", {{"name", "Peter"}, {"role", "guest"}}}, {"items", {1, 2}}};
+  const inja::json actor {{"user", {{"role", "admin"}}}, {"level", 3}};
+  const inja::json call {{"level", 4}};
+
+  CHECK(env.render(env.parse("{{ site }} {{ user.name }} {{ user.role }} {{ level }}"), {&call, &actor, &globals}) == "Inja Peter admin 4");
+  CHECK(env.render(env.parse("{{ level }}"), {nullptr, &actor}) == "3");
+  CHECK(env.render(env.parse("{% if exists(\"user.name\") %}{{ length(items) }}{% endif %}"), {&call, &globals}) == "2");
+  CHECK(env.render(env.parse("{% set level = level + 1 %}{% set site = \"Other\" %}{{ level }} {{ site }}"), {&call, &globals}) == "5 Other");
+  CHECK(call["level"] == 4);
+  CHECK(globals["site"] == "Inja");
+
+  env.include_template("user", env.parse("{{ user.name }}:{{ user.role }}"));
+  CHECK(env.render(env.parse("{% for i in items %}{% include \"user\" %};{% endfor %}"), {&actor, &globals}) == "Peter:admin;Peter:admin;");
+
+  CHECK(env.render(env.parse("empty"), std::vector<const inja::json*> {}) == "empty");
+  CHECK_THROWS_WITH(env.render(env.parse("{{ missing }}"), {&call, &globals}), "[inja.exception.render_error] (at 1:4) variable 'missing' not found");
+}
+
+TEST_CASE("globals") {
+  inja::Environment env;
+  int calls = 0;
+  env.add_callback("today", 0, [&calls](inja::Arguments&) { return "day " + std::to_string(++calls); });
+
+  const inja::json setup_data {{"names", {"Jeff", "Seb"}}, {"unit", "cm"}};
+  const auto report = env.set_globals_from(env.parse(R""""({% set date = today %}{% set upper_names = [] %}
+{% for name in names %}{% set upper_names = append(upper_names, upper(name)) %}{% endfor %}
+{% set suffix = " " + unit %}ignored output)""""), setup_data);
+
+  CHECK(report.refresh_count == 1);
+  CHECK(report.variable_count == 3);
+  CHECK(report.estimated_cost > 0.0);
+  CHECK(env.get_globals() == inja::json {{"date", "day 1"}, {"upper_names", {"JEFF", "SEB"}}, {"suffix", " cm"}});
+
+  const inja::json data {{"size", 3}, {"suffix", " m"}};
+  CHECK(env.render("{{ date }}: {{ join(upper_names, \",\") }} {{ size }}{{ suffix }}", data) == "day 1: JEFF,SEB 3 m");
+  CHECK(env.render("{% set date = \"local\" %}{{ date }}", data) == "local");
+  CHECK(env.render("{{ date }}", data) == "day 1");
+  CHECK(calls == 1);
+
+  CHECK(env.refresh_globals().refresh_count == 2);
+  CHECK(env.render("{{ date }}", data) == "day 2");
+  CHECK(env.refresh_globals(inja::json {{"names", {"Ann"}}, {"unit", "in"}}).refresh_count == 3);
+  CHECK(env.render("{{ first(upper_names) }}{{ suffix }}", inja::json::object()) == "ANN in");
+  CHECK(env.get_globals_report().variable_count == 3);
+
+  env.clear_globals();
+  CHECK(env.get_globals().is_null());
+  CHECK(env.refresh_globals().refresh_count == 0);
+  CHECK_THROWS_WITH(env.render("{{ date }}", data), "[inja.exception.render_error] (at 1:4) variable 'date' not found");
+}
+
+TEST_CASE("render batch") {
+  inja::Environment env;
+  env.include_template("row", env.parse("{{ loop.index }}:{{ item }}"));
+  const auto tmpl = env.parse("{{ name }}{% set name = \"local\" %}{% for item in items %}[{% include \"row\" %}]{% endfor %}{{ name }}");
+
+  std::vector<inja::json> data;
+  for (int i = 0; i < 50; ++i) {
+    data.push_back({{"name", "n" + std::to_string(i)}, {"items", std::vector<int>(static_cast<size_t>(i % 3), i)}});
+  }
+  std::vector<const inja::json*> inputs;
+  for (const auto& d : data) {
+    inputs.push_back(&d);
+  }
+
+  SUBCASE("outputs in order") {
+    const auto results = env.render_batch(tmpl, inputs);
+    REQUIRE(results.size() == inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      CHECK(results[i].output == env.render(tmpl, data[i]));
+      CHECK(results[i].errors.empty());
+    }
+    CHECK(results[4].output == "n4[0:4]local");
+  }
+
+  SUBCASE("thread pool and sinks") {
+    inja::ThreadPool pool(4);
+    std::vector<std::ostringstream> streams(inputs.size());
+    std::vector<std::ostream*> sinks;
+    for (auto& stream : streams) {
+      sinks.push_back(&stream);
+    }
+
+    env.render_batch(tmpl, inputs, sinks, &pool);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      CHECK(streams[i].str() == env.render(tmpl, data[i]));
+    }
+    CHECK_THROWS_WITH(env.render_batch(tmpl, inputs, std::span<std::ostream* const>(sinks).first(3)),
+                      "[inja.exception.render_error] render_batch needs one sink per input, got 3 sinks for 50 inputs");
+  }
+
+  SUBCASE("errors per input") {
+    const inja::json missing_name {{"items", inja::json::array()}};
+    CHECK_THROWS_WITH(env.render_batch(tmpl, std::vector<const inja::json*> {inputs[0], &missing_name}), "[inja.exception.render_error] (at 1:4) variable 'name' not found");
+
+    env.set_graceful_errors(true);
+    inja::ThreadPool pool(2);
+    const auto results = env.render_batch(tmpl, std::vector<const inja::json*> {inputs[1], &missing_name, nullptr}, &pool);
+    CHECK(results[0].output == "n1[0:1]local");
+    CHECK(results[0].errors.empty());
+    CHECK(results[1].output == "{{ name }}local");
+    CHECK(results[1].errors.size() == 1);
+    CHECK(results[2].errors.size() == 2);
+  }
+}
+
+TEST_CASE("async render") {
+  // Runs tasks when asked to, on the calling thread
+  class QueueExecutor : public inja::Executor {
+  public:
+    std::vector<std::function<void()>> tasks;
+
+    void execute(std::function<void()> task) override {
+      tasks.push_back(std::move(task));
+    }
+
+    void run_all() {
+      for (auto& task : tasks) {
+        task();
+      }
+      tasks.clear();
+    }
+  };
+
+  inja::Environment env;
+  const auto tmpl = env.parse("{{ name }}{% set name = \"local\" %}{% for i in items %}{{ i }}{% endfor %}");
+
+  SUBCASE("built-in thread pool") {
+    std::vector<std::future<inja::RenderResult>> results;
+    for (int i = 0; i < 20; ++i) {
+      results.push_back(env.render_async(tmpl, inja::json {{"name", "n" + std::to_string(i)}, {"items", {i, i}}}));
+    }
+    for (int i = 0; i < 20; ++i) {
+      const auto result = results[static_cast<size_t>(i)].get();
+      CHECK(result.output == "n" + std::to_string(i) + std::to_string(i) + std::to_string(i));
+      CHECK(result.errors.empty());
+    }
+  }
+
+  SUBCASE("executor and completion") {
+    QueueExecutor executor;
+    inja::AsyncRenderOptions options;
+    options.executor = &executor;
+
+    std::vector<std::string> outputs;
+    const auto on_complete = [&outputs](inja::RenderResult result, std::exception_ptr error) {
+      CHECK_FALSE(error);
+      outputs.push_back(result.output);
+    };
+    env.render_async(tmpl, inja::json {{"name", "a"}, {"items", {1}}}, on_complete, options);
+    env.set_graceful_errors(true);
+    env.render_async(tmpl, inja::json {{"items", {2}}}, on_complete, options);
+    auto graceful = env.render_async(env.parse("{{ missing }}"), inja::json::object(), options);
+
+    CHECK(outputs.empty());
+    executor.run_all();
+    CHECK(outputs == std::vector<std::string> {"a1", "{{ name }}2"});
+    const auto result = graceful.get();
+    CHECK(result.output == "{{ missing }}");
+    REQUIRE(result.errors.size() == 1);
+    CHECK(result.errors[0].message == "variable 'missing' not found");
+    CHECK(env.get_last_render_errors().empty());
+  }
+
+  SUBCASE("cancellation and deadline") {
+    QueueExecutor executor;
+    inja::AsyncRenderOptions options;
+    options.executor = &executor;
+
+    std::stop_source stop;
+    options.stop_token = stop.get_token();
+    env.add_callback("stop", 0, [&stop](inja::Arguments&) {
+      stop.request_stop();
+      return "stopped";
+    });
+    auto stopped = env.render_async(env.parse("{{ stop }}{{ name }}"), inja::json::object(), options);
+    auto cancelled = env.render_async(tmpl, inja::json {{"name", "a"}, {"items", {1}}}, options);
+
+    options.stop_token = std::stop_token();
+    options.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+    auto late = env.render_async(tmpl, inja::json {{"name", "a"}, {"items", {1}}}, options);
+
+    executor.run_all();
+    CHECK_THROWS_WITH(stopped.get(), "[inja.exception.interrupt_error] render was cancelled");
+    CHECK_THROWS_WITH(cancelled.get(), "[inja.exception.interrupt_error] render was cancelled");
+    CHECK_THROWS_WITH(late.get(), "[inja.exception.interrupt_error] render deadline exceeded");
+  }
+}
+
+TEST_CASE("concurrent includes and blocks") {
+  inja::Environment env;
+  env.add_callback("shout", 1, [](inja::Arguments& args) { return args.at(0)->get<std::string>() + "!"; });
+  env.set_callback_deterministic("shout", 1);
+  int counter = 0;
+  env.add_callback("next", 0, [&counter](inja::Arguments&) { return ++counter; });
+
+  for (int i = 0; i < 15; ++i) {
+    env.include_template("part" + std::to_string(i),
+                         env.parse("<{{ title }}{% set title = \"p" + std::to_string(i) + "\" %}{% for x in items %}{{ shout(title) }}{{ loop.index }}{% endfor %}>"));
+  }
+  env.include_template("counted", env.parse("[{{ next }}]"));
+  env.include_template("base", env.parse("{% block head %}H{{ title }}{% endblock %}|{% block body %}B{% endblock %}|{% block foot %}F{% endblock %}"));
+
+  std::string parts_source = "{% set title = \"a\" %}";
+  for (int i = 0; i < 15; ++i) {
+    parts_source += "{% include \"part" + std::to_string(i) + "\" %}" + ((i == 7) ? "{% set title = \"b\" %}{{ title }}" : "-");
+  }
+  const auto parts = env.parse(parts_source);
+  const auto counted = env.parse("{% include \"counted\" %}{% include \"counted\" %}{{ next }}{% include \"counted\" %}");
+  const auto child = env.parse("{% extends \"base\" %}{% block body %}{% include \"part1\" %}{{ super() }}{{ shout(title) }}{% endblock %}{% block foot %}{{ title }}{% endblock %}");
+  const auto missing = env.parse("{% include \"part0\" %}{{ missing }}{% include \"part1\" %}{{ other }}{% include \"part2\" %}");
+  const inja::json data {{"items", {1, 2, 3}}, {"title", "t"}};
+
+  const auto serial_parts = env.render(parts, data);
+  const auto serial_counted = env.render(counted, data);
+  const auto serial_child = env.render(child, data);
+  env.set_graceful_errors(true);
+  const auto serial_missing = env.render(missing, data);
+  const auto serial_errors = env.get_last_render_errors();
+  env.set_graceful_errors(false);
+
+  env.set_render_thread_pool(std::make_shared<inja::ThreadPool>(4));
+  counter = 0;
+  for (int i = 0; i < 5; ++i) {
+    CHECK(env.render(parts, data) == serial_parts);
+    CHECK(env.render(child, data) == serial_child);
+  }
+  CHECK(env.render(counted, data) == serial_counted);
+  CHECK(serial_counted == "[1][2]3[4]");
+
+  env.set_graceful_errors(true);
+  CHECK(env.render(missing, data) == serial_missing);
+  const auto errors = env.get_last_render_errors();
+  REQUIRE(errors.size() == serial_errors.size());
+  for (size_t i = 0; i < errors.size(); ++i) {
+    CHECK(errors[i].message == serial_errors[i].message);
+  }
+
+  env.set_graceful_errors(false);
+  CHECK_THROWS_WITH(env.render(missing, data), "[inja.exception.render_error] (at 1:25) variable 'missing' not found");
+}
+
+TEST_CASE("concurrent loops") {
+  inja::Environment env;
+  env.add_callback("shout", 1, [](inja::Arguments& args) { return args.at(0)->get<std::string>() + "!"; });
+  env.set_callback_deterministic("shout", 1);
+  int counter = 0;
+  env.add_callback("next", 0, [&counter](inja::Arguments&) { return ++counter; });
+  env.include_template("cell", env.parse("({{ c }}{% set c = 0 %}{{ loop.index }})"));
+
+  inja::json rows = inja::json::array();
+  for (int i = 0; i < 3000; ++i) {
+    const std::string index = std::to_string(i);
+    inja::json cols = inja::json::array();
+    for (int j = 0; j < ((i < 2900) ? i % 4 : 0); ++j) {
+      cols.push_back((j == 1) ? inja::json("s" + index) : inja::json(i * j));
+    }
+    rows.push_back({{"name", "r" + index}, {"cols", cols}});
+  }
+  const inja::json data {{"rows", rows}, {"c", "outer"}};
+
+  const std::vector<std::string> sources {
+      "{% for r in rows %}{{ loop.index }}{% if loop.is_first %}F{% endif %}{% if loop.is_last %}L{% endif %}{{ shout(r.name) }}"
+      "{% for c in r.cols %}<{{ loop.parent.index1 }}.{{ loop.index }}{% include \"cell\" %}>{% endfor %};{% endfor %}[{{ c }}][{{ r }}]{{ loop }}",
+      "{% for r in rows %}{% for x in [1, 2] %}{% for r2 in r.cols %}{{ r2 }}{% endfor %}{% endfor %}{% endfor %}{{ r2 }}{{ x }}",
+      "{% for r in rows %}{{ c }}{% for c in r.cols %}{{ c }}{% endfor %}{% endfor %}{{ c }}",
+      "{% for r in rows %}{% set total = r.name %}{% endfor %}{{ total }}",
+      "{% for r in rows %}{{ next }},{% endfor %}",
+  };
+
+  std::vector<std::string> serial;
+  for (const auto& source : sources) {
+    serial.push_back(env.render(source, data));
+  }
+  CHECK(serial[3] == "r2999");
+
+  env.set_render_thread_pool(std::make_shared<inja::ThreadPool>(4), 2);
+  for (size_t i = 0; i < sources.size(); ++i) {
+    counter = 0;
+    CHECK(env.render(sources[i], data) == serial[i]);
+  }
+
+  env.set_graceful_errors(true);
+  const auto missing = env.render("{% for r in rows %}{% if r.name == \"r5\" or r.name == \"r2990\" %}{{ missing }}{% endif %}{% endfor %}", data);
+  CHECK(missing == "{{ missing }}{{ missing }}");
+  CHECK(env.get_last_render_errors().size() == 2);
+
+  env.set_graceful_errors(false);
+  CHECK_THROWS_WITH(env.render("{% for r in rows %}{% if r.name == \"r2000\" %}{{ missing }}{% endif %}{% endfor %}", data),
+                    "[inja.exception.render_error] (at 1:49) variable 'missing' not found");
+}
+
+TEST_CASE("render stream") {
+  inja::Environment env;
+  const auto tmpl = env.parse("{% for i in range(200) %}line {{ i }}\n{% endfor %}{{ end }}");
+  const inja::json data {{"end", "done"}};
+
+  SUBCASE("chunks") {
+    std::string output;
+    size_t chunks = 0;
+    for (const auto chunk : env.render_stream(tmpl, data, 16)) {
+      CHECK(chunk.size() <= 16);
+      output += chunk;
+      chunks += 1;
+    }
+    CHECK(output == env.render(tmpl, data));
+    CHECK(chunks == (output.size() + 15) / 16);
+  }
+
+  SUBCASE("errors") {
+    std::string output;
+    auto stream = env.render_stream(tmpl, inja::json::object(), 64);
+    CHECK_THROWS_WITH(
+        [&] {
+          for (const auto chunk : stream) {
+            output += chunk;
+          }
+        }(),
+        "[inja.exception.render_error] (at 2:16) variable 'end' not found");
+    CHECK(output.size() >= 64);
+
+    env.set_graceful_errors(true);
+    output.clear();
+    for (const auto chunk : env.render_stream(tmpl, inja::json::object())) {
+      output += chunk;
+    }
+    CHECK(output.substr(output.size() - 9) == "{{ end }}");
+    CHECK(env.get_last_render_errors().size() == 1);
+  }
+
+  SUBCASE("stopped by the consumer") {
+    std::atomic<int> ticks {0};
+    env.add_callback("tick", 0, [&ticks](inja::Arguments&) { return ticks.fetch_add(1); });
+    const auto long_template = env.parse("{% for i in range(100000) %}{{ tick }}{% endfor %}");
+    std::string output;
+    for (const auto chunk : env.render_stream(long_template, data, 8)) {
+      output += chunk;
+      if (output.size() >= 32) {
+        break;
+      }
+    }
+    CHECK(output.substr(0, 12) == "012345678910");
+    CHECK(ticks.load() < 1000);
+  }
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#include "inja/environment.hpp"
+#include "inja/static_template.hpp"
+
+#include "test-common.hpp"
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L && defined(__cpp_lib_constexpr_vector) &&                \
+    defined(__cpp_lib_constexpr_string)
+
+TEST_CASE("static templates") {
+  inja::Environment env;
+
+  inja::json data;
+  data["name"] = "Peter";
+  data["age"] = 29;
+  data["height"] = 1.5;
+  data["is_happy"] = true;
+  data["brother"] = {{"name", "Chris"}, {"daughters", {"Maria", "Helen"}}};
+  data["nothing"] = nullptr;
+  data["names"] = {"Jeff", "Seb", "Chris"};
+  data["city"] = {{"name", "Paris"}, {"zip", 75000}};
+
+  SUBCASE("text and variables") {
+    using Greeting = inja::static_template<"Hello {{ name }}, {{ age }} ({{ height }}) {{is_happy}}!{# comment #}">;
+    CHECK(Greeting::render(data) == "Hello Peter, 29 (1.5) true!");
+    CHECK(Greeting::render(data) == env.render(Greeting::source(), data));
+
+    CHECK(inja::static_template<"">::render(data) == "");
+    CHECK(inja::static_template<"Only text">::render(data) == "Only text");
+    CHECK(inja::static_template<"{{ nothing }}{{ brother }}">::render(data) == R"({"daughters":["Maria","Helen"],"name":"Chris"})");
+  }
+
+  SUBCASE("paths") {
+    using Family = inja::static_template<"{{ brother.name }} {{ brother/daughters/1 }} {{ brother.daughters.0 }}">;
+    CHECK(Family::render(data) == "Chris Helen Maria");
+    CHECK(Family::render(data) == env.render(Family::source(), data));
+  }
+
+  SUBCASE("whitespace control") {
+    using Trimmed = inja::static_template<"a  \n  {{- name -}}  \n  b {#- comment -#}\n c">;
+    CHECK(Trimmed::render(data) == env.render(Trimmed::source(), data));
+  }
+
+  SUBCASE("missing variables") {
+    using Missing = inja::static_template<"Hello\n {{ brother.age }}">;
+    CHECK_THROWS_WITH(Missing::render(data), "[inja.exception.render_error] (at 2:5) variable 'brother.age' not found");
+    CHECK_THROWS_WITH(env.render(Missing::source(), data), "[inja.exception.render_error] (at 2:5) variable 'brother.age' not found");
+  }
+
+  SUBCASE("conditions") {
+    using Conditions = inja::static_template<"{% if age > 30 %}old{% else if age == 29 and is_happy %}29{% else %}young{% endif %}"
+                                             "{% if not nothing %}!{% endif %}{% if age < 18 %}minor{% elif \"Peter\" in names %}in{% endif %}">;
+    CHECK(Conditions::render(data) == "29!");
+    CHECK(Conditions::render(data) == env.render(Conditions::source(), data));
+
+    using Lines = inja::static_template<"## if is_happy\nhappy\n## else\nsad\n## endif\n">;
+    CHECK(Lines::render(data) == "happy\n");
+    CHECK(Lines::render(data) == env.render(Lines::source(), data));
+  }
+
+  SUBCASE("loops") {
+    using Names = inja::static_template<"{% for n in names %}{{ loop.index }}:{{ n }}{% if not loop.is_last %}, {% endif %}{% endfor %}">;
+    CHECK(Names::render(data) == "0:Jeff, 1:Seb, 2:Chris");
+    CHECK(Names::render(data) == env.render(Names::source(), data));
+
+    using Nested = inja::static_template<"{% for k, v in city %}{{ k }}={{ v }};{% for n in brother.daughters %}{{ loop.parent.index1 }}{{ n }}{% endfor %}{% endfor %}">;
+    CHECK(Nested::render(data) == env.render(Nested::source(), data));
+
+    using NotArray = inja::static_template<"{% for n in name %}{% endfor %}">;
+    CHECK_THROWS_WITH(NotArray::render(data), "[inja.exception.render_error] (at 1:10) object must be an array");
+    CHECK_THROWS_WITH(env.render(NotArray::source(), data), "[inja.exception.render_error] (at 1:10) object must be an array");
+  }
+
+  SUBCASE("set statements") {
+    using Set = inja::static_template<"{% set x = age + 1 %}{% set city.name = upper(city.name) %}{{ x }} {{ city.name }}">;
+    CHECK(Set::render(data) == "30 PARIS");
+    CHECK(Set::render(data) == env.render(Set::source(), data));
+  }
+
+  SUBCASE("functions and operators") {
+    using Functions = inja::static_template<"{{ length(names) }} {{ names | sort | first }} {{ join(names, \"-\") }} {{ 2 ^ 3 ^ 2 }} "
+                                            "{{ (age - 9) / 4 }} {{ 7 % 3 }} {{ default(missing, [1, {\"a\": 2}]) }} {{ at(names, 1) }} "
+                                            "{{ round(height * 3, 1) }} {{ isString(name) }} {{ exists(\"brother.name\") }} {{ existsIn(city, \"zip\") }} "
+                                            "{{ range(3) }} {{ replace(name, \"e\", \"3\") | capitalize }} {{ max([1, 5, 2]) }} {{ even(age) }}">;
+    CHECK(Functions::render(data) == "3 Chris Jeff-Seb-Chris 512 5.0 1 [1,{\"a\":2}] Seb 4.5 true true true [0,1,2] P3t3r 5 false");
+    CHECK(Functions::render(data) == env.render(Functions::source(), data));
+
+    using Failure = inja::static_template<"Hi\n{{ age / (name == \"Peter\") * 0 }}">;
+    const std::string error = "[inja.exception.render_error] (at 2:28) operation 'multiply' failed: [inja.exception.render_error] (at 2:8) operation 'division' failed: "
+                      "[json.exception.type_error.302] type must be number, but is boolean";
+    CHECK_THROWS_WITH(Failure::render(data), error.c_str());
+    CHECK_THROWS_WITH(env.render(Failure::source(), data), error.c_str());
+  }
+}
+
+#endif
@@ -4,7 +4,10 @@
 #define JSON_USE_IMPLICIT_CONVERSIONS 0
 #define JSON_NO_IO 1
 
+#include <chrono>
 #include <filesystem>
+#include <random>
+#include <string>
 
 #include "test-files.cpp"
 #include "test-functions.cpp"
@@ -14,8 +17,36 @@
 #include "test-array-functions.cpp"
 #include "test-elif-raw.cpp"
 #include "test-variable-crashes.cpp"
+#include "test-analysis.cpp"
+#include "test-optimizer.cpp"
+#include "test-static-template.cpp"
 
 #define xstr(s) str(s)
 #define str(s) #s
 
 const std::filesystem::path test_file_directory { std::filesystem::path(xstr(__TEST_DIR__)) / "data" };
+
+namespace {
+
+// Test executables run in parallel, so each one writes its temporary files into its own directory
+struct TestTempDirectory {
+  std::filesystem::path path;
+
+  TestTempDirectory() {
+    std::random_device random;
+    const auto time = std::chrono::steady_clock::now().time_since_epoch().count();
+    path = std::filesystem::temp_directory_path() / (std::string("inja-test-") + std::to_string(random()) + "-" + std::to_string(time));
+    std::filesystem::create_directories(path);
+  }
+
+  ~TestTempDirectory() {
+    std::error_code error;
+    std::filesystem::remove_all(path, error);
+  }
+};
+
+const TestTempDirectory temp_directory;
+
+} // namespace
+
+const std::filesystem::path test_temp_directory {temp_directory.path};
@@ -0,0 +1,1316 @@
+// Copyright (c) 2020 Pantor. All rights reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "inja/inja.hpp"
+
+namespace {
+
+using Op = inja::FunctionStorage::Operation;
+
+const char* operation_name(Op operation) {
+  switch (operation) {
+  case Op::Not:
+    return "Not";
+  case Op::And:
+    return "And";
+  case Op::Or:
+    return "Or";
+  case Op::In:
+    return "In";
+  case Op::Equal:
+    return "Equal";
+  case Op::NotEqual:
+    return "NotEqual";
+  case Op::Greater:
+    return "Greater";
+  case Op::GreaterEqual:
+    return "GreaterEqual";
+  case Op::Less:
+    return "Less";
+  case Op::LessEqual:
+    return "LessEqual";
+  case Op::Add:
+    return "Add";
+  case Op::Subtract:
+    return "Subtract";
+  case Op::Multiplication:
+    return "Multiplication";
+  case Op::Division:
+    return "Division";
+  case Op::Power:
+    return "Power";
+  case Op::Modulo:
+    return "Modulo";
+  case Op::AtId:
+    return "AtId";
+  case Op::At:
+    return "At";
+  case Op::Capitalize:
+    return "Capitalize";
+  case Op::Default:
+    return "Default";
+  case Op::DivisibleBy:
+    return "DivisibleBy";
+  case Op::Even:
+    return "Even";
+  case Op::Exists:
+    return "Exists";
+  case Op::ExistsInObject:
+    return "ExistsInObject";
+  case Op::First:
+    return "First";
+  case Op::Float:
+    return "Float";
+  case Op::Int:
+    return "Int";
+  case Op::IsArray:
+    return "IsArray";
+  case Op::IsBoolean:
+    return "IsBoolean";
+  case Op::IsFloat:
+    return "IsFloat";
+  case Op::IsInteger:
+    return "IsInteger";
+  case Op::IsNumber:
+    return "IsNumber";
+  case Op::IsObject:
+    return "IsObject";
+  case Op::IsString:
+    return "IsString";
+  case Op::Last:
+    return "Last";
+  case Op::Length:
+    return "Length";
+  case Op::Lower:
+    return "Lower";
+  case Op::Max:
+    return "Max";
+  case Op::Min:
+    return "Min";
+  case Op::Odd:
+    return "Odd";
+  case Op::Range:
+    return "Range";
+  case Op::Replace:
+    return "Replace";
+  case Op::Round:
+    return "Round";
+  case Op::Sort:
+    return "Sort";
+  case Op::Upper:
+    return "Upper";
+  case Op::Super:
+    return "Super";
+  case Op::Join:
+    return "Join";
+  case Op::Callback:
+    return "Callback";
+  default:
+    return "None";
+  }
+}
+
+/// Returns the text as a C++ string literal, broken into lines after newlines
+std::string string_literal(std::string_view text) {
+  std::string result = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    const unsigned char ch = static_cast<unsigned char>(text[i]);
+    switch (ch) {
+    case '\n':
+      result += (i + 1 < text.size()) ? "\\n\"\n        \"" : "\\n";
+      break;
+    case '\t':
+      result += "\\t";
+      break;
+    case '\r':
+      result += "\\r";
+      break;
+    case '\\':
+      result += "\\\\";
+      break;
+    case '"':
+      result += "\\\"";
+      break;
+    default:
+      if (ch < 0x20 || ch >= 0x7f || ch == '?') {
+        char escaped[5];
+        std::snprintf(escaped, sizeof(escaped), "\\%03o", ch);
+        result += escaped;
+      } else {
+        result += static_cast<char>(ch);
+      }
+    }
+  }
+  return result + "\"";
+}
+
+std::string identifier(std::string_view name) {
+  std::string result;
+  for (const char ch : name) {
+    result += std::isalnum(static_cast<unsigned char>(ch)) ? ch : '_';
+  }
+  if (result.empty() || std::isdigit(static_cast<unsigned char>(result[0]))) {
+    result.insert(0, "_");
+  }
+  return result;
+}
+
+/*!
+ * \brief Generates C++ code that builds the AST of a parsed template, for templates rendered by the interpreter.
+ */
+class AstGenerator : public inja::NodeVisitor {
+  const std::map<std::string, std::string>& names; // Storage keys to the names of the compiled templates
+
+  std::ostringstream out;
+  std::vector<std::string> blocks {"tmpl.root"};
+  std::string indent {"  "};
+  size_t counter {0};
+
+  // Large templates are split into functions after nodes of their root, as compilers are slow for long functions
+  static constexpr size_t max_part_lines {400};
+  std::vector<std::string> parts;
+  size_t part_lines {0};
+
+  std::string name_of(const std::string& key) const {
+    const auto it = names.find(key);
+    return (it != names.end()) ? it->second : key;
+  }
+
+  std::string next_node() {
+    counter += 1;
+    return "n" + std::to_string(counter);
+  }
+
+  void line(const std::string& text) {
+    out << indent << text << "\n";
+    part_lines += 1;
+  }
+
+  void open(const std::string& node, const std::string& construction) {
+    line("{");
+    indent += "  ";
+    line("auto " + node + " = " + construction + ";");
+  }
+
+  void close(const std::string& node) {
+    line(blocks.back() + ".nodes.push_back(" + node + ");");
+    indent.resize(indent.size() - 2);
+    line("}");
+  }
+
+  void visit_block(const inja::BlockNode& block, const std::string& target) {
+    blocks.push_back(target);
+    block.accept(*this);
+    blocks.pop_back();
+  }
+
+  std::string expression(const std::shared_ptr<inja::ExpressionNode>& node) const {
+    if (!node) {
+      return "nullptr";
+    }
+
+    const std::string pos = std::to_string(node->pos);
+    if (const auto* literal = dynamic_cast<const inja::LiteralNode*>(node.get())) {
+      return "std::make_shared<inja::LiteralNode>(std::string_view(" + string_literal(literal->value.dump()) + "), " + pos + ")";
+
+    } else if (const auto* data = dynamic_cast<const inja::DataNode*>(node.get())) {
+      return "std::make_shared<inja::DataNode>(" + string_literal(data->name) + ", " + pos + ")";
+
+    } else if (const auto* function = dynamic_cast<const inja::FunctionNode*>(node.get())) {
+      std::string arguments;
+      for (const auto& argument : function->arguments) {
+        arguments += (arguments.empty() ? "" : ", ") + expression(argument);
+      }
+      return "detail::function(inja::FunctionStorage::Operation::" + std::string(operation_name(function->operation)) + ", " +
+             string_literal(function->name) + ", " + std::to_string(function->number_args) + ", " + pos + ", {" + arguments + "})";
+    }
+    return "nullptr";
+  }
+
+  void expression_list(const std::string& target, const inja::ExpressionListNode& node) {
+    line(target + ".pos = " + std::to_string(node.pos) + ";");
+    line(target + ".length = " + std::to_string(node.length) + ";");
+    line(target + ".root = " + expression(node.root) + ";");
+  }
+
+  std::string link(const std::string& key) const {
+    const auto it = names.find(key);
+    return (it != names.end()) ? "&storage.at(" + string_literal(it->second) + ")" : "nullptr";
+  }
+
+  void visit(const inja::BlockNode& node) override {
+    for (const auto& n : node.nodes) {
+      n->accept(*this);
+
+      if (blocks.size() == 1 && part_lines >= max_part_lines) {
+        parts.push_back(out.str());
+        out.str("");
+        part_lines = 0;
+      }
+    }
+  }
+
+  void visit(const inja::TextNode& node) override {
+    line(blocks.back() + ".nodes.push_back(std::make_shared<inja::TextNode>(" + std::to_string(node.pos) + ", " + std::to_string(node.length) + "));");
+  }
+
+  void visit(const inja::ExpressionNode&) override {}
+  void visit(const inja::LiteralNode&) override {}
+  void visit(const inja::DataNode&) override {}
+  void visit(const inja::FunctionNode&) override {}
+
+  void visit(const inja::ExpressionListNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::ExpressionListNode>(" + std::to_string(node.pos) + ")");
+    expression_list("(*" + n + ")", node);
+    close(n);
+  }
+
+  void visit(const inja::StatementNode&) override {}
+  void visit(const inja::ForStatementNode&) override {}
+
+  void visit(const inja::ForArrayStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::ForArrayStatementNode>(" + string_literal(node.value) + ", &" + blocks.back() + ", " + std::to_string(node.pos) + ")");
+    expression_list(n + "->condition", node.condition);
+    visit_block(node.body, n + "->body");
+    close(n);
+  }
+
+  void visit(const inja::ForObjectStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::ForObjectStatementNode>(" + string_literal(node.key) + ", " + string_literal(node.value) + ", &" + blocks.back() +
+                ", " + std::to_string(node.pos) + ")");
+    expression_list(n + "->condition", node.condition);
+    visit_block(node.body, n + "->body");
+    close(n);
+  }
+
+  void visit(const inja::IfStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::IfStatementNode>(" + std::string(node.is_nested ? "true" : "false") + ", &" + blocks.back() + ", " +
+                std::to_string(node.pos) + ")");
+    line(n + "->has_false_statement = " + (node.has_false_statement ? "true" : "false") + ";");
+    expression_list(n + "->condition", node.condition);
+    visit_block(node.true_statement, n + "->true_statement");
+    visit_block(node.false_statement, n + "->false_statement");
+    close(n);
+  }
+
+  void visit(const inja::IncludeStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::IncludeStatementNode>(" + string_literal(name_of(node.file)) + ", " + std::to_string(node.pos) + ")");
+    line(n + "->linked = " + link(node.file) + ";");
+    close(n);
+  }
+
+  void visit(const inja::ExtendsStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::ExtendsStatementNode>(" + string_literal(name_of(node.file)) + ", " + std::to_string(node.pos) + ")");
+    line(n + "->linked = " + link(node.file) + ";");
+    close(n);
+  }
+
+  void visit(const inja::BlockStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::BlockStatementNode>(&" + blocks.back() + ", " + string_literal(node.name) + ", " + std::to_string(node.pos) + ")");
+    visit_block(node.block, n + "->block");
+    line("tmpl.block_storage.emplace(" + string_literal(node.name) + ", " + n + ");");
+    close(n);
+  }
+
+  void visit(const inja::SetStatementNode& node) override {
+    const auto n = next_node();
+    open(n, "std::make_shared<inja::SetStatementNode>(" + string_literal(node.key) + ", " + std::to_string(node.pos) + ")");
+    expression_list(n + "->expression", node.expression);
+    close(n);
+  }
+
+  void visit(const inja::RawStatementNode& node) override {
+    line(blocks.back() + ".nodes.push_back(std::make_shared<inja::RawStatementNode>(" + std::to_string(node.pos) + ", " +
+         std::to_string(node.content_pos) + ", " + std::to_string(node.content_length) + "));");
+  }
+
+public:
+  explicit AstGenerator(const std::map<std::string, std::string>& names): names(names) {}
+
+  /// Returns the statements building the template into `tmpl` in consecutive parts, linking other templates from `storage`
+  std::vector<std::string> generate(const inja::Template& tmpl) {
+    out.str("");
+    parts.clear();
+    part_lines = 0;
+    line("tmpl = inja::Template(std::string(" + string_literal(tmpl.content) + ", " + std::to_string(tmpl.content.size()) + "));");
+    tmpl.root.accept(*this);
+    if (parts.empty() || part_lines > 0) {
+      parts.push_back(out.str());
+    }
+    return parts;
+  }
+};
+
+/// Thrown while generating the render function of a template the interpreter has to render, see RenderGenerator
+struct Unsupported {};
+
+/*!
+ * \brief Generates the native render function of a template.
+ *
+ * The function writes the text of the template, and evaluates its expressions
+ * and statements with the helpers of NativeRender, so that it renders like the
+ * Renderer. Includes of other compiled templates call their render functions,
+ * while extended templates and their blocks are generated into the function,
+ * as they are known for each template. Templates that can't be generated this
+ * way, e.g. ones with an extends statement within a block, are rendered by the
+ * interpreter instead.
+ */
+class RenderGenerator : public inja::NodeVisitor {
+  using Op = inja::FunctionStorage::Operation;
+
+  const inja::TemplateStorage& storage;
+  const std::map<std::string, std::string>& identifiers; // Storage keys to the identifiers of the compiled templates
+
+  /// What the Renderer knows about the templates while rendering, which is the same for each render at a given node
+  struct State {
+    std::vector<const inja::Template*> template_stack;
+    const inja::Template* current_template {nullptr};
+    size_t current_level {0};
+    std::vector<const inja::BlockStatementNode*> block_statement_stack;
+
+    bool operator==(const State& other) const {
+      return template_stack == other.template_stack && current_template == other.current_template && current_level == other.current_level &&
+             block_statement_stack == other.block_statement_stack;
+    }
+  };
+
+  /// A value of the generated code, either a json or a bool
+  struct Value {
+    std::string name;
+    bool is_bool {false};
+    bool is_reference {false}; // Points into the data, which the local data might change
+  };
+
+  State state;
+  std::ostringstream out;
+  std::string indent;
+  size_t counter {0};
+  size_t inlined_blocks {0};
+  bool rendering_stopped {false}; // After an extends statement, as the Renderer stops rendering the template
+
+  // Large templates are split into functions after nodes of their root, as compilers are slow for long functions
+  static constexpr size_t max_part_lines {400};
+  const inja::BlockNode* entry_root {nullptr};
+  std::vector<std::string> parts;
+  size_t part_lines {0};
+
+  std::string next(const std::string& prefix) {
+    counter += 1;
+    return prefix + std::to_string(counter);
+  }
+
+  void line(const std::string& text) {
+    out << indent << text << "\n";
+    part_lines += 1;
+  }
+
+  void open(const std::string& text) {
+    line(text);
+    indent += "  ";
+  }
+
+  void close(const std::string& text = "}") {
+    indent.resize(indent.size() - 2);
+    line(text);
+  }
+
+  std::string location(const inja::AstNode& node) const {
+    const auto loc = inja::get_source_location(state.current_template->content, node.pos);
+    return "{" + std::to_string(loc.line) + ", " + std::to_string(loc.column) + "}";
+  }
+
+  void fail(const std::string& message, const inja::AstNode& node) {
+    line("inja::NativeRender::fail(" + string_literal(message) + ", " + location(node) + ");");
+  }
+
+  /// Returns the keys of the json pointer of a variable
+  static std::vector<std::string> path_of(const inja::DataNode& node) {
+    std::vector<std::string> result;
+    const std::string ptr = node.ptr.to_string();
+    size_t start = 1;
+    while (start <= ptr.size()) {
+      size_t end = ptr.find('/', start);
+      if (end == std::string::npos) {
+        end = ptr.size();
+      }
+      std::string key = ptr.substr(start, end - start);
+      inja::replace_substring(key, "~1", "/");
+      inja::replace_substring(key, "~0", "~");
+      result.push_back(std::move(key));
+      start = end + 1;
+    }
+    return result;
+  }
+
+  std::string path(const inja::DataNode& node) {
+    const auto p = next("p");
+    std::string keys;
+    for (const auto& key : path_of(node)) {
+      keys += (keys.empty() ? "" : ", ") + string_literal(key);
+    }
+    line("static constexpr std::string_view " + p + "[] {" + keys + "};");
+    return p;
+  }
+
+  std::string json_of(const Value& value) {
+    if (!value.is_bool) {
+      return value.name;
+    }
+    const auto j = next("j");
+    line("const inja::json " + j + "(" + value.name + ");");
+    return j;
+  }
+
+  static std::string truthy(const Value& value) {
+    return value.is_bool ? value.name : "inja::NativeRender::truthy(" + value.name + ")";
+  }
+
+  Value data(const inja::DataNode& node, bool copy_local = false) {
+    const auto p = path(node);
+    const auto t = next("t");
+    const auto v = next("v");
+    line("inja::json " + t + ";");
+    line("const inja::json& " + v + " = r.get(" + p + ", " + string_literal(node.name) + ", " + t + ", " + location(node) +
+         (copy_local ? ", true" : "") + ");");
+    return {v, false, !copy_local};
+  }
+
+  /// Returns a pointer to the variable, or nullptr if it was not found
+  std::string lookup(const inja::DataNode& node, const std::string& result) {
+    const auto p = path(node);
+    const auto d = next("d");
+    line("const inja::json* " + d + " = r.lookup(" + p + ", " + string_literal(node.name) + ", " + result + ");");
+    return d;
+  }
+
+  /// Returns the call of a builtin function that can fail, for its evaluated arguments
+  std::string builtin_call(const inja::FunctionNode& node, const std::vector<std::string>& args) {
+    const std::string loc = location(node);
+    switch (node.operation) {
+    case Op::Add:
+      return "inja::NativeRender::add(" + args[0] + ", " + args[1] + ")";
+    case Op::Subtract:
+      return "inja::NativeRender::subtract(" + args[0] + ", " + args[1] + ")";
+    case Op::Multiplication:
+      return "inja::NativeRender::multiply(" + args[0] + ", " + args[1] + ")";
+    case Op::Division:
+      return "inja::NativeRender::divide(" + args[0] + ", " + args[1] + ", " + loc + ")";
+    case Op::Power:
+      return "inja::NativeRender::power(" + args[0] + ", " + args[1] + ")";
+    case Op::Modulo:
+      return "inja::NativeRender::modulo(" + args[0] + ", " + args[1] + ")";
+    case Op::Capitalize:
+      return "inja::NativeRender::capitalize(" + args[0] + ")";
+    case Op::DivisibleBy:
+      return "inja::NativeRender::divisible_by(" + args[0] + ", " + args[1] + ")";
+    case Op::Even:
+      return "inja::NativeRender::even(" + args[0] + ")";
+    case Op::Exists:
+      return "r.exists(" + args[0] + ")";
+    case Op::ExistsInObject:
+      return "inja::NativeRender::exists_in(" + args[0] + ", " + args[1] + ")";
+    case Op::First:
+      return "inja::NativeRender::first(" + args[0] + ", " + loc + ")";
+    case Op::Float:
+      return "inja::NativeRender::to_float(" + args[0] + ")";
+    case Op::Int:
+      return "inja::NativeRender::to_int(" + args[0] + ")";
+    case Op::Last:
+      return "inja::NativeRender::last(" + args[0] + ", " + loc + ")";
+    case Op::Length:
+      return "inja::NativeRender::length(" + args[0] + ")";
+    case Op::Lower:
+      return "inja::NativeRender::lower(" + args[0] + ")";
+    case Op::Max:
+      return "inja::NativeRender::max(" + args[0] + ")";
+    case Op::Min:
+      return "inja::NativeRender::min(" + args[0] + ")";
+    case Op::Odd:
+      return "inja::NativeRender::odd(" + args[0] + ")";
+    case Op::Range:
+      return "inja::NativeRender::range(" + args[0] + ")";
+    case Op::Replace:
+      return "inja::NativeRender::replace(" + args[0] + ", " + args[1] + ", " + args[2] + ")";
+    case Op::Round:
+      return "inja::NativeRender::round(" + args[0] + ", " + args[1] + ")";
+    case Op::Sort:
+      return "inja::NativeRender::sort(" + args[0] + ")";
+    case Op::Upper:
+      return "inja::NativeRender::upper(" + args[0] + ")";
+    case Op::Join:
+      return "inja::NativeRender::join(" + args[0] + ", " + args[1] + ")";
+    default:
+      throw Unsupported {};
+    }
+  }
+
+  static bool returns_bool(Op operation) {
+    switch (operation) {
+    case Op::DivisibleBy:
+    case Op::Even:
+    case Op::Exists:
+    case Op::ExistsInObject:
+    case Op::Odd:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  std::vector<std::string> arguments(const inja::FunctionNode& node) {
+    std::vector<std::string> result;
+    for (const auto& argument : node.arguments) {
+      result.push_back(json_of(expression(argument)));
+    }
+    return result;
+  }
+
+  Value comparison(const inja::FunctionNode& node, const std::string& compare) {
+    const auto args = arguments(node);
+    const auto b = next("b");
+    line("const bool " + b + " = inja::NativeRender::compare(" + args[0] + ", " + args[1] + ", " + compare + "());");
+    return {b, true};
+  }
+
+  Value type_check(const inja::FunctionNode& node, const std::string& method) {
+    const auto args = arguments(node);
+    const auto b = next("b");
+    line("const bool " + b + " = " + args[0] + "." + method + "();");
+    return {b, true};
+  }
+
+  Value function(const inja::FunctionNode& node) {
+    if (node.arguments.size() < static_cast<size_t>(std::max(node.number_args, 0))) {
+      throw Unsupported {};
+    }
+
+    if (const char* name = inja::NativeRender::builtin_name(node.operation)) {
+      // The arguments are evaluated within the try block, as their errors are reported as failures of the function
+      const bool is_bool = returns_bool(node.operation);
+      const auto v = next(is_bool ? "b" : "v");
+      line(is_bool ? "bool " + v + " {false};" : "inja::json " + v + ";");
+      open("try {");
+      const auto call = builtin_call(node, arguments(node));
+      line(v + " = " + call + ";");
+      indent.resize(indent.size() - 2);
+      open("} catch (...) {");
+      line("inja::NativeRender::fail_operation(" + string_literal(name) + ", " + location(node) + ");");
+      close();
+      return {v, is_bool};
+    }
+
+    switch (node.operation) {
+    case Op::Not: {
+      const auto value = expression(node.arguments[0]);
+      const auto b = next("b");
+      line("const bool " + b + " = !" + truthy(value) + ";");
+      return {b, true};
+    }
+    case Op::And:
+    case Op::Or: {
+      const auto lhs = expression(node.arguments[0]);
+      const auto b = next("b");
+      line("bool " + b + " = " + truthy(lhs) + ";");
+      open(std::string("if (") + (node.operation == Op::And ? "" : "!") + b + ") {");
+      const auto rhs = expression(node.arguments[1]);
+      line(b + " = " + truthy(rhs) + ";");
+      close();
+      return {b, true};
+    }
+    case Op::In: {
+      const auto args = arguments(node);
+      const auto b = next("b");
+      line("const bool " + b + " = inja::NativeRender::in(" + args[0] + ", " + args[1] + ");");
+      return {b, true};
+    }
+    case Op::Equal:
+      return comparison(node, "std::equal_to<>");
+    case Op::NotEqual:
+      return comparison(node, "std::not_equal_to<>");
+    case Op::Greater:
+      return comparison(node, "std::greater<>");
+    case Op::GreaterEqual:
+      return comparison(node, "std::greater_equal<>");
+    case Op::Less:
+      return comparison(node, "std::less<>");
+    case Op::LessEqual:
+      return comparison(node, "std::less_equal<>");
+    case Op::IsBoolean:
+      return type_check(node, "is_boolean");
+    case Op::IsNumber:
+      return type_check(node, "is_number");
+    case Op::IsInteger:
+      return type_check(node, "is_number_integer");
+    case Op::IsFloat:
+      return type_check(node, "is_number_float");
+    case Op::IsObject:
+      return type_check(node, "is_object");
+    case Op::IsArray:
+      return type_check(node, "is_array");
+    case Op::IsString:
+      return type_check(node, "is_string");
+    case Op::At: {
+      const auto args = arguments(node);
+      const auto v = next("v");
+      line("const inja::json& " + v + " = inja::NativeRender::at(" + args[0] + ", " + args[1] + ", " + location(node) + ");");
+      return {v, false, true};
+    }
+    case Op::AtId: {
+      const auto* member = dynamic_cast<const inja::DataNode*>(node.arguments[1].get());
+      if (member == nullptr) {
+        throw Unsupported {};
+      }
+
+      std::string container;
+      if (const auto* data_node = dynamic_cast<const inja::DataNode*>(node.arguments[0].get())) {
+        const auto t = next("t");
+        line("inja::json " + t + ";");
+        container = lookup(*data_node, t);
+      } else {
+        container = "&" + json_of(expression(node.arguments[0]));
+      }
+
+      // The member is looked up as a variable first, and must not be found
+      open("{");
+      const auto t = next("t");
+      line("inja::json " + t + ";");
+      open("if (" + lookup(*member, t) + " != nullptr) {");
+      fail("could not find element with given name", node);
+      close();
+      close();
+
+      const auto v = next("v");
+      line("const inja::json& " + v + " = inja::NativeRender::member(" + container + ", " + string_literal(member->name) + ", " + location(node) + ");");
+      return {v, false, true};
+    }
+    case Op::Default: {
+      const auto* data_node = dynamic_cast<const inja::DataNode*>(node.arguments[0].get());
+      if (data_node == nullptr) {
+        return expression(node.arguments[0]);
+      }
+
+      const auto t = next("t");
+      line("inja::json " + t + ";");
+      const auto d = lookup(*data_node, t);
+      open("if (" + d + " == nullptr) {");
+      const auto fallback = json_of(expression(node.arguments[1]));
+      line(t + " = " + fallback + ";");
+      line(d + " = &" + t + ";");
+      close();
+      const auto v = next("v");
+      line("const inja::json& " + v + " = *" + d + ";");
+      return {v, false, true};
+    }
+    case Op::Callback: {
+      // Callbacks are registered in the environment, and resolved before their arguments are evaluated
+      const auto f = next("f");
+      line("const auto " + f + " = r.function(" + string_literal(node.name) + ", " + std::to_string(node.arguments.size()) + ", " + location(node) + ");");
+      std::string pointers;
+      for (const auto& argument : arguments(node)) {
+        pointers += (pointers.empty() ? "&" : ", &") + argument;
+      }
+      const auto v = next("v");
+      line("const inja::json " + v + " = r.call(" + f + ", " + string_literal(node.name) + ", {" + pointers + "});");
+      return {v};
+    }
+    default:
+      // super() is only generated as a whole expression, see super()
+      throw Unsupported {};
+    }
+  }
+
+  Value expression(const std::shared_ptr<inja::ExpressionNode>& node, bool copy_local = false) {
+    if (const auto* literal = dynamic_cast<const inja::LiteralNode*>(node.get())) {
+      const auto l = next("l");
+      line("static const inja::json " + l + " = inja::json::parse(" + string_literal(literal->value.dump()) + ");");
+      return {l};
+    } else if (const auto* data_node = dynamic_cast<const inja::DataNode*>(node.get())) {
+      return data(*data_node, copy_local);
+    } else if (const auto* function_node = dynamic_cast<const inja::FunctionNode*>(node.get())) {
+      return function(*function_node);
+    }
+    throw Unsupported {};
+  }
+
+  /// Returns the value of an expression list as a json, which stays valid while the local data changes
+  std::string stable_value(const inja::ExpressionListNode& node) {
+    if (!node.root) {
+      throw Unsupported {};
+    }
+
+    const auto value = expression(node.root, true);
+    if (!value.is_reference) {
+      return json_of(value);
+    }
+    const auto c = next("c");
+    line("const inja::json " + c + " = " + value.name + ";");
+    return c;
+  }
+
+  void super(const inja::FunctionNode& node) {
+    int level_diff = 1;
+    if (node.arguments.size() == 1) {
+      const auto* literal = dynamic_cast<const inja::LiteralNode*>(node.arguments[0].get());
+      if (literal == nullptr || !literal->value.is_number_integer()) {
+        throw Unsupported {};
+      }
+      level_diff = literal->value.get<int>();
+    } else if (!node.arguments.empty()) {
+      throw Unsupported {};
+    }
+    const size_t level = state.current_level + static_cast<size_t>(level_diff);
+
+    if (state.block_statement_stack.empty()) {
+      fail("super() call is not within a block", node);
+      return;
+    }
+    if (level < 1 || level > state.template_stack.size() - 1) {
+      fail("level of super() call does not match parent templates (between 1 and " + std::to_string(state.template_stack.size() - 1) + ")", node);
+      return;
+    }
+
+    const auto* current_block_statement = state.block_statement_stack.back();
+    const inja::Template* new_template = state.template_stack.at(level);
+    const auto block_it = new_template->block_storage.find(current_block_statement->name);
+    if (block_it == new_template->block_storage.end()) {
+      fail("could not find block with name '" + current_block_statement->name + "'", node);
+      return;
+    }
+
+    const inja::Template* old_template = state.current_template;
+    const size_t old_level = state.current_level;
+    state.current_template = new_template;
+    state.current_level = level;
+    inline_block(block_it->second->block);
+    state.current_level = old_level;
+    state.current_template = old_template;
+  }
+
+  /// Generates the content of a block statement or a super() call, guarding against blocks that contain themselves
+  void inline_block(const inja::BlockNode& block) {
+    if (++inlined_blocks > 64) {
+      throw Unsupported {};
+    }
+    visit(block);
+    inlined_blocks -= 1;
+  }
+
+  /// Generates a block, where an extends statement is only supported in the root of a template
+  void generate_block(const inja::BlockNode& block, bool is_root) {
+    for (const auto& node : block.nodes) {
+      if (const auto* extends = dynamic_cast<const inja::ExtendsStatementNode*>(node.get())) {
+        if (!is_root) {
+          throw Unsupported {};
+        }
+        extends_template(*extends);
+        rendering_stopped = true;
+        return;
+      }
+
+      node->accept(*this);
+      if (rendering_stopped) {
+        return;
+      }
+
+      if (&block == entry_root && part_lines >= max_part_lines) {
+        parts.push_back(out.str());
+        out.str("");
+        part_lines = 0;
+      }
+    }
+  }
+
+  void extends_template(const inja::ExtendsStatementNode& node) {
+    const auto it = identifiers.find(node.file);
+    if (it == identifiers.end()) {
+      throw Unsupported {};
+    }
+
+    const inja::Template* parent_template = &storage.at(node.file);
+    state.current_template = parent_template;
+    state.template_stack.push_back(parent_template);
+    generate_block(parent_template->root, true);
+  }
+
+  /// Generates a block that must leave the state as it was, as it might be rendered any number of times
+  void generate_branch(const inja::BlockNode& block, const State& expected) {
+    visit(block);
+    if (!(state == expected)) {
+      throw Unsupported {};
+    }
+  }
+
+  void visit(const inja::BlockNode& node) override {
+    generate_block(node, false);
+  }
+
+  void visit(const inja::TextNode& node) override {
+    line("r.write(std::string_view(" + string_literal(std::string_view(state.current_template->content).substr(node.pos, node.length)) + ", " +
+         std::to_string(node.length) + "));");
+  }
+
+  void visit(const inja::ExpressionNode&) override {}
+  void visit(const inja::LiteralNode&) override {}
+  void visit(const inja::DataNode&) override {}
+  void visit(const inja::FunctionNode&) override {}
+
+  void visit(const inja::ExpressionListNode& node) override {
+    if (!node.root) {
+      fail("empty expression", node);
+      return;
+    }
+    if (const auto* function_node = dynamic_cast<const inja::FunctionNode*>(node.root.get())) {
+      if (function_node->operation == Op::Super) {
+        super(*function_node);
+        return;
+      }
+    }
+
+    open("{");
+    const auto value = expression(node.root);
+    line("r.print(" + value.name + ");");
+    close();
+  }
+
+  void visit(const inja::StatementNode&) override {}
+  void visit(const inja::ForStatementNode&) override {}
+
+  void visit(const inja::ForArrayStatementNode& node) override {
+    open("{");
+    const auto source = stable_value(node.condition);
+    open("if (!" + source + ".is_array()) {");
+    fail("object must be an array", node);
+    close();
+
+    const auto size = next("size");
+    const auto index = next("index");
+    const auto it = next("it");
+    line("const size_t " + size + " = " + source + ".size();");
+    line("r.enter_loop(" + size + ");");
+    line("size_t " + index + " = 0;");
+    open("for (auto " + it + " = " + source + ".begin(); " + index + " < " + size + "; ++" + it + ", ++" + index + ") {");
+    line("r.bind(" + string_literal(node.value) + ", *" + it + ");");
+    line("r.update_loop(" + index + ", " + size + ");");
+    const State before = state;
+    generate_branch(node.body, before);
+    close();
+    line("r.unbind(" + string_literal(node.value) + ");");
+    line("r.leave_loop();");
+    close();
+  }
+
+  void visit(const inja::ForObjectStatementNode& node) override {
+    open("{");
+    const auto source = stable_value(node.condition);
+    open("if (!" + source + ".is_object()) {");
+    fail("object must be an object", node);
+    close();
+
+    const auto size = next("size");
+    const auto index = next("index");
+    const auto it = next("it");
+    line("const size_t " + size + " = " + source + ".size();");
+    line("r.enter_loop(" + size + ");");
+    line("size_t " + index + " = 0;");
+    open("for (auto " + it + " = " + source + ".begin(); " + index + " < " + size + "; ++" + it + ", ++" + index + ") {");
+    line("r.bind(" + string_literal(node.key) + ", " + it + ".key());");
+    line("r.bind(" + string_literal(node.value) + ", " + it + ".value());");
+    line("r.update_loop(" + index + ", " + size + ");");
+    const State before = state;
+    generate_branch(node.body, before);
+    close();
+    line("r.unbind(" + string_literal(node.key) + ");");
+    line("r.unbind(" + string_literal(node.value) + ");");
+    line("r.leave_loop();");
+    close();
+  }
+
+  void visit(const inja::IfStatementNode& node) override {
+    open("{");
+    if (!node.condition.root) {
+      throw Unsupported {};
+    }
+    const auto condition = expression(node.condition.root);
+
+    const State before = state;
+    open("if (" + truthy(condition) + ") {");
+    visit(node.true_statement);
+    const State after = state;
+    if (node.has_false_statement) {
+      state = before;
+      indent.resize(indent.size() - 2);
+      open("} else {");
+      generate_branch(node.false_statement, after);
+    } else if (!(after == before)) {
+      throw Unsupported {};
+    }
+    close();
+    close();
+  }
+
+  void visit(const inja::IncludeStatementNode& node) override {
+    const auto it = identifiers.find(node.file);
+    if (it == identifiers.end()) {
+      line("r.include(" + string_literal(node.file) + ", " + location(node) + ");");
+      return;
+    }
+
+    open("{");
+    line("inja::NativeRender included = r.include_scope();");
+    line("render_" + it->second + "(included);");
+    close();
+  }
+
+  void visit(const inja::ExtendsStatementNode&) override {
+    throw Unsupported {};
+  }
+
+  void visit(const inja::BlockStatementNode& node) override {
+    const size_t old_level = state.current_level;
+    state.current_level = 0;
+    state.current_template = state.template_stack.front();
+    const auto block_it = state.current_template->block_storage.find(node.name);
+    if (block_it != state.current_template->block_storage.end()) {
+      state.block_statement_stack.push_back(&node);
+      inline_block(block_it->second->block);
+      state.block_statement_stack.pop_back();
+    }
+    state.current_level = old_level;
+    state.current_template = state.template_stack.back();
+  }
+
+  void visit(const inja::SetStatementNode& node) override {
+    std::string ptr = node.key;
+    inja::replace_substring(ptr, ".", "/");
+    ptr = "/" + ptr;
+
+    open("{");
+    const auto p = next("p");
+    line("static const inja::json::json_pointer " + p + "(" + string_literal(ptr) + ");");
+    open("try {");
+    if (!node.expression.root) {
+      throw Unsupported {};
+    }
+    const auto value = expression(node.expression.root);
+    line("r.set(" + p + ", " + json_of(value) + ");");
+    indent.resize(indent.size() - 2);
+    open("} catch (...) {");
+    line("inja::NativeRender::fail_set(" + string_literal(node.key) + ", " + location(node) + ");");
+    close();
+    close();
+  }
+
+  void visit(const inja::RawStatementNode& node) override {
+    line("r.write(std::string_view(" + string_literal(std::string_view(state.current_template->content).substr(node.content_pos, node.content_length)) +
+         ", " + std::to_string(node.content_length) + "));");
+  }
+
+public:
+  explicit RenderGenerator(const inja::TemplateStorage& storage, const std::map<std::string, std::string>& identifiers)
+      : storage(storage), identifiers(identifiers) {}
+
+  /// Returns the statements rendering the template with `r` in consecutive parts, or std::nullopt if the interpreter has to render it
+  std::optional<std::vector<std::string>> generate(const inja::Template& tmpl) {
+    out.str("");
+    indent = "  ";
+    state = State {{&tmpl}, &tmpl, 0, {}};
+    inlined_blocks = 0;
+    rendering_stopped = false;
+    entry_root = &tmpl.root;
+    parts.clear();
+    part_lines = 0;
+    try {
+      generate_block(tmpl.root, true);
+    } catch (const Unsupported&) {
+      return std::nullopt;
+    }
+    if (parts.empty() || part_lines > 0) {
+      parts.push_back(out.str());
+    }
+    return parts;
+  }
+};
+
+void print_usage() {
+  std::cerr << "Usage: inja_compile [options] <template>...\n"
+               "Compiles inja templates into a C++ header with a native render function per template.\n\n"
+               "Options:\n"
+               "  -o, --output <file>           Output file (default: standard output)\n"
+               "  -n, --namespace <name>        Namespace of the generated code (default: templates)\n"
+               "  -i, --input-dir <dir>         Directory the templates are relative to (default: .)\n"
+               "  -c, --callback <name>:<args>  Declares a callback, registered at render time (args -1 for variadic)\n"
+               "  -e, --external <name>         Declares a template that is included by name, added at render time\n"
+               "      --trim-blocks             Remove the first newline after a block\n"
+               "      --lstrip-blocks           Strip whitespace from the start of a line to a block\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string output;
+  std::string name_space {"templates"};
+  std::filesystem::path input_dir {"."};
+  std::vector<std::string> files;
+  std::set<std::string> externals;
+
+  inja::LexerConfig lexer_config;
+  inja::ParserConfig parser_config;
+  inja::FunctionStorage function_storage;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string argument = argv[i];
+    const bool has_value = (i + 1 < argc);
+    if ((argument == "-o" || argument == "--output") && has_value) {
+      output = argv[++i];
+    } else if ((argument == "-n" || argument == "--namespace") && has_value) {
+      name_space = argv[++i];
+    } else if ((argument == "-i" || argument == "--input-dir") && has_value) {
+      input_dir = argv[++i];
+    } else if ((argument == "-c" || argument == "--callback") && has_value) {
+      const std::string callback = argv[++i];
+      const size_t separator = callback.rfind(':');
+      if (separator == std::string::npos) {
+        std::cerr << "inja_compile: expected <name>:<args> for callback '" << callback << "'\n";
+        return 1;
+      }
+      function_storage.add_callback(callback.substr(0, separator), std::stoi(callback.substr(separator + 1)), inja::CallbackFunction {});
+    } else if ((argument == "-e" || argument == "--external") && has_value) {
+      externals.insert(argv[++i]);
+    } else if (argument == "--trim-blocks") {
+      lexer_config.trim_blocks = true;
+    } else if (argument == "--lstrip-blocks") {
+      lexer_config.lstrip_blocks = true;
+    } else if (argument == "-h" || argument == "--help") {
+      print_usage();
+      return 0;
+    } else if (!argument.empty() && argument[0] == '-') {
+      print_usage();
+      return 1;
+    } else {
+      files.push_back(argument);
+    }
+  }
+
+  if (files.empty()) {
+    print_usage();
+    return 1;
+  }
+
+  // Parse all templates, the included ones are added to the storage by the parser. External
+  // templates are found by their name, and are looked up in the environment at render time.
+  inja::TemplateStorage storage;
+  for (const auto& name : externals) {
+    storage[name];
+  }
+  inja::Parser parser(parser_config, lexer_config, storage, function_storage);
+  try {
+    for (const auto& file : files) {
+      // Named like the parser names included templates
+      std::string key = (input_dir / file).string();
+      if (key.compare(0, 2, "./") == 0) {
+        key.erase(0, 2);
+      }
+      if (storage.count(key) == 0) {
+        auto tmpl = inja::Template(inja::Parser::load_file(key));
+        parser.parse_into_template(tmpl, key);
+        storage[key] = tmpl;
+      }
+    }
+  } catch (const inja::InjaError& error) {
+    std::cerr << "inja_compile: " << error.what() << "\n";
+    return 1;
+  }
+  for (const auto& name : externals) {
+    storage.erase(name);
+  }
+
+  // Templates are named relative to the input directory
+  std::map<std::string, std::string> names;
+  std::map<std::string, std::string> identifiers;
+  std::set<std::string> used_identifiers;
+  for (const auto& [key, tmpl] : storage) {
+    const auto relative = std::filesystem::path(key).lexically_relative(input_dir);
+    const std::string name = (relative.empty() || *relative.begin() == "..") ? key : relative.generic_string();
+    names[key] = name;
+
+    std::string id = identifier(name);
+    while (!used_identifiers.insert(id).second) {
+      id += "_";
+    }
+    identifiers[key] = id;
+  }
+
+  std::ostringstream code;
+  const std::string guard = "INJA_COMPILED_" + identifier(name_space) + "_HPP_";
+  code << "// Generated by inja_compile, do not edit.\n\n"
+       << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+       << "#include <functional>\n#include <map>\n#include <memory>\n#include <string>\n#include <string_view>\n#include <utility>\n#include <vector>\n\n"
+       << "#include <inja/inja.hpp>\n\n"
+       << "namespace " << name_space << " {\n\n"
+       << "namespace detail {\n\n"
+       << "inline std::shared_ptr<inja::FunctionNode> function(inja::FunctionStorage::Operation operation, std::string_view name, int number_args, size_t pos,\n"
+       << "                                                    std::vector<std::shared_ptr<inja::ExpressionNode>> arguments) {\n"
+       << "  auto node = name.empty() ? std::make_shared<inja::FunctionNode>(operation, pos) : std::make_shared<inja::FunctionNode>(name, pos);\n"
+       << "  node->operation = operation;\n"
+       << "  node->number_args = number_args;\n"
+       << "  node->arguments = std::move(arguments);\n"
+       << "  return node;\n"
+       << "}\n\n";
+
+  AstGenerator ast_generator(names);
+  for (const auto& [key, tmpl] : storage) {
+    const auto& id = identifiers[key];
+    const auto parts = ast_generator.generate(tmpl);
+    for (size_t i = 0; i < parts.size(); ++i) {
+      code << "inline void build_" << id << ((parts.size() > 1) ? "_part" + std::to_string(i) : "")
+           << "(inja::Template& tmpl, const inja::TemplateStorage& storage) {\n"
+           << "  static_cast<void>(storage);\n"
+           << parts[i] << "}\n\n";
+    }
+    if (parts.size() > 1) {
+      code << "inline void build_" << id << "(inja::Template& tmpl, const inja::TemplateStorage& storage) {\n";
+      for (size_t i = 0; i < parts.size(); ++i) {
+        code << "  build_" << id << "_part" << i << "(tmpl, storage);\n";
+      }
+      code << "}\n\n";
+    }
+  }
+
+  code << "struct Templates {\n"
+       << "  inja::TemplateStorage storage;\n\n"
+       << "  Templates() {\n"
+       << "    // All templates are inserted first, so that they can be linked by their address\n";
+  for (const auto& [key, name] : names) {
+    code << "    storage[" << string_literal(name) << "];\n";
+  }
+  for (const auto& [key, name] : names) {
+    code << "    build_" << identifiers[key] << "(storage.at(" << string_literal(name) << "), storage);\n";
+  }
+  code << "  }\n"
+       << "};\n\n"
+       << "} // namespace detail\n\n"
+       << "/// All compiled templates by name, with their includes and extends linked\n"
+       << "inline const inja::TemplateStorage& templates() {\n"
+       << "  static const detail::Templates instance;\n"
+       << "  return instance.storage;\n"
+       << "}\n\n"
+       << "/// Adds all compiled templates to an environment, so that they can be included by name\n"
+       << "inline void include_templates(inja::Environment& env) {\n"
+       << "  for (const auto& [name, tmpl] : templates()) {\n"
+       << "    env.include_template(name, tmpl);\n"
+       << "  }\n"
+       << "}\n\n";
+
+  for (const auto& [key, name] : names) {
+    code << "/// Template " << name << "\n"
+         << "inline const inja::Template& template_" << identifiers[key] << "() {\n"
+         << "  return templates().at(" << string_literal(name) << ");\n"
+         << "}\n\n";
+  }
+
+  code << "namespace detail {\n\n";
+  for (const auto& [key, name] : names) {
+    code << "inline void render_" << identifiers[key] << "(inja::NativeRender& r);\n";
+  }
+  code << "\n";
+
+  RenderGenerator render_generator(storage, identifiers);
+  for (const auto& [key, tmpl] : storage) {
+    const auto& id = identifiers[key];
+    const auto parts = render_generator.generate(tmpl);
+    if (!parts) {
+      std::cerr << "inja_compile: " << names[key] << " is rendered by the interpreter\n";
+      code << "inline void render_" << id << "(inja::NativeRender& r) {\n"
+           << "  // Not supported by the code generator, e.g. due to an extends statement within a block\n"
+           << "  r.interpret(template_" << id << "());\n"
+           << "}\n\n";
+      continue;
+    }
+
+    if (parts->size() == 1) {
+      code << "inline void render_" << id << "(inja::NativeRender& r) {\n" << parts->front() << "}\n\n";
+      continue;
+    }
+    for (size_t i = 0; i < parts->size(); ++i) {
+      code << "inline void render_" << id << "_part" << i << "(inja::NativeRender& r) {\n" << (*parts)[i] << "}\n\n";
+    }
+    code << "inline void render_" << id << "(inja::NativeRender& r) {\n";
+    for (size_t i = 0; i < parts->size(); ++i) {
+      code << "  render_" << id << "_part" << i << "(r);\n";
+    }
+    code << "}\n\n";
+  }
+
+  code << "inline const std::map<std::string, inja::NativeFunction, std::less<>>& functions() {\n"
+       << "  static const std::map<std::string, inja::NativeFunction, std::less<>> instance {\n";
+  for (const auto& [key, name] : names) {
+    code << "      {" << string_literal(name) << ", render_" << identifiers[key] << "},\n";
+  }
+  code << "  };\n"
+       << "  return instance;\n"
+       << "}\n\n"
+       << "inline inja::Environment& environment() {\n"
+       << "  static inja::Environment env;\n"
+       << "  static const bool initialized = (include_templates(env), true);\n"
+       << "  static_cast<void>(initialized);\n"
+       << "  return env;\n"
+       << "}\n\n"
+       << "} // namespace detail\n\n";
+
+  for (const auto& [key, name] : names) {
+    const auto& id = identifiers[key];
+    code << "/// Renders the template " << name << " with the callbacks, templates and settings of the environment\n"
+         << "inline std::string render_" << id << "(inja::Environment& env, const inja::json& data) {\n"
+         << "  return env.render(detail::render_" << id << ", template_" << id << "(), data);\n"
+         << "}\n\n"
+         << "inline std::string render_" << id << "(const inja::json& data) {\n"
+         << "  return render_" << id << "(detail::environment(), data);\n"
+         << "}\n\n";
+  }
+
+  code << "/// Renders a compiled template by name, throws a FileError if it does not exist\n"
+       << "inline std::string render(inja::Environment& env, std::string_view name, const inja::json& data) {\n"
+       << "  const auto it = detail::functions().find(name);\n"
+       << "  if (it == detail::functions().end()) {\n"
+       << "    INJA_THROW(inja::FileError(\"template '\" + std::string(name) + \"' was not compiled\"));\n"
+       << "  }\n"
+       << "  return env.render(it->second, templates().at(it->first), data);\n"
+       << "}\n\n"
+       << "inline std::string render(std::string_view name, const inja::json& data) {\n"
+       << "  return render(detail::environment(), name, data);\n"
+       << "}\n\n"
+       << "} // namespace " << name_space << "\n\n"
+       << "#endif // " << guard << "\n";
+
+  if (output.empty()) {
+    std::cout << code.str();
+  } else {
+    std::ofstream file(output);
+    file << code.str();
+    if (!file) {
+      std::cerr << "inja_compile: failed writing '" << output << "'\n";
+      return 1;
+    }
+  }
+  return 0;
+}